@@ -57,6 +57,7 @@ NTSTATUS
 CmpSetValueKeyNew(
     IN PHHIVE  Hive,
     IN PCM_KEY_NODE Parent,
+    IN HCELL_INDEX ParentCell,
     IN PUNICODE_STRING ValueName,
     IN ULONG Type,
     IN PVOID Data,
@@ -577,6 +578,10 @@ Routine Description:
     WARNING: CmFlushKey will flush the entire registry tree, and thus will
     burn cycles and I/O.
 
+    For a hive with a log, only the changes since the last flush are
+    appended to the log (see HvCommitHive).  The lazy flusher writes
+    them to the primary later.
+
 Arguments:
 
     Hive - supplies a pointer to the hive control structure for the hive
@@ -624,12 +629,12 @@ Return Value:
 
         CmLockHive (CmHive);
 
-        if (! HvSyncHive(Hive)) {
+        if (! HvCommitHive(Hive)) {
 
             status = STATUS_REGISTRY_IO_FAILED;
 
             CMLOG(CML_MAJOR, CMS_IO_ERROR) {
-                KdPrint(("CmFlushKey: HvSyncHive failed\n"));
+                KdPrint(("CmFlushKey: HvCommitHive failed\n"));
             }
         }
 
@@ -1332,6 +1337,7 @@ Return Value:
 
         status = CmpSetValueKeyNew(Hive,
                                    parent,
+                                   Cell,
                                    ValueName,
                                    Type,
                                    Data,
@@ -1567,7 +1573,7 @@ Return Value:
     // Allocate and fill a new cell.  Free the old one.  Store
     // the new's index into the value entry body.
 
-    NewCell = HvAllocateCell(Hive, DataSize, StorageType);
+    NewCell = HvAllocateCellNear(Hive, DataSize, StorageType, OldChild);
 
     if (NewCell == HCELL_NIL) {
         return STATUS_INSUFFICIENT_RESOURCES;
@@ -1619,6 +1625,7 @@ NTSTATUS
 CmpSetValueKeyNew(
     IN PHHIVE  Hive,
     IN PCM_KEY_NODE Parent,
+    IN HCELL_INDEX ParentCell,
     IN PUNICODE_STRING ValueName,
     IN ULONG Type,
     IN PVOID Data,
@@ -1640,6 +1647,8 @@ Arguments:
 
     Parent - pointer to key node value entry is for
 
+    ParentCell - cell of Parent, new cells are allocated near it
+
     ValueName - The unique (relative to the containing key) name
         of the value entry.  May be NULL.
 
@@ -1686,10 +1695,11 @@ Return Value:
 
     // allocate the body of the value entry, and the data
 
-    ValueCell = HvAllocateCell(
+    ValueCell = HvAllocateCellNear(
                     Hive,
                     CmpHKeyValueSize(Hive, ValueName),
-                    StorageType
+                    StorageType,
+                    ParentCell
                     );
 
     if (ValueCell == HCELL_NIL) {
@@ -1698,7 +1708,7 @@ Return Value:
 
     DataCell = HCELL_NIL;
     if (DataSize > CM_KEY_VALUE_SMALL) {
-        DataCell = HvAllocateCell(Hive, DataSize, StorageType);
+        DataCell = HvAllocateCellNear(Hive, DataSize, StorageType, ValueCell);
         if (DataCell == HCELL_NIL) {
             HvFreeCell(Hive, ValueCell);
             return STATUS_INSUFFICIENT_RESOURCES;
@@ -1810,7 +1820,7 @@ Return Value:
                         AllocateSize
                         );
     } else {
-        NewCell = HvAllocateCell(Hive, sizeof(HCELL_INDEX), StorageType);
+        NewCell = HvAllocateCellNear(Hive, sizeof(HCELL_INDEX), StorageType, ParentCell);
     }
 
 
@@ -524,7 +524,8 @@ Return Value:
                                     );
             CmpCheckKeyDebug.RootPoint = Root;
             if ((Root->Signature == CM_KEY_INDEX_LEAF) ||
-                (Root->Signature == CM_KEY_FAST_LEAF)) {
+                (Root->Signature == CM_KEY_FAST_LEAF) ||
+                (Root->Signature == CM_KEY_HASH_LEAF)) {
                 if ((ULONG)Root->Count != pcell->u.KeyNode.SubKeyCounts[Stable]) {
                     KdPrint(("CmpCheckKey: CmpCheckHive:%08lx Cell:%08lx\n", CmpCheckHive, Cell));
                     KdPrint(("\tBad Index count @%08lx\n", Root));
@@ -546,7 +547,8 @@ Return Value:
                     Leaf = (PCM_KEY_INDEX)HvGetCell(CmpCheckHive,
                                                     Root->List[i]);
                     if ((Leaf->Signature != CM_KEY_INDEX_LEAF) &&
-                        (Leaf->Signature != CM_KEY_FAST_LEAF)) {
+                        (Leaf->Signature != CM_KEY_FAST_LEAF) &&
+                        (Leaf->Signature != CM_KEY_HASH_LEAF)) {
                         KdPrint(("CmpCheckKey: CmpCheckHive:%08lx Cell:%08lx\n", CmpCheckHive, Cell));
                         KdPrint(("\tBad Leaf Index @%08lx Root@%08lx\n", Leaf, Root));
                         rc = 4140;
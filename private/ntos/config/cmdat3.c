@@ -52,6 +52,8 @@ extern LOGICAL MmDontVerifyRandomDrivers;
 extern ULONG ObpProtectionMode;
 extern ULONG ObpAuditBaseDirectories;
 extern ULONG ObpAuditBaseObjects;
+extern ULONG ObpReferenceSampleInterval;
+extern ULONG ObpShardedReferenceThreshold;
 extern ULONG CmNtGlobalFlag;
 extern SIZE_T MmSizeOfPagedPoolInBytes;
 extern SIZE_T MmSizeOfNonPagedPoolInBytes;
@@ -76,6 +78,7 @@ extern LOGICAL MmTrackPtes;
 extern ULONG CmRegistrySizeLimit;
 extern ULONG CmRegistrySizeLimitLength;
 extern ULONG CmRegistrySizeLimitType;
+extern ULONG CmpUpgradeHashIndex;
 extern ULONG PspDefaultPagedLimit;
 extern ULONG PspDefaultNonPagedLimit;
 extern ULONG PspDefaultPagefileLimit;
@@ -145,6 +148,20 @@ CM_SYSTEM_CONTROL_VECTOR   CmControlVector[] = {
       NULL
     },
 
+    { L"Session Manager\\Kernel",
+      L"ObReferenceSampleInterval",
+      &ObpReferenceSampleInterval,
+      NULL,
+      NULL
+    },
+
+    { L"Session Manager\\Kernel",
+      L"ObShardedReferenceThreshold",
+      &ObpShardedReferenceThreshold,
+      NULL,
+      NULL
+    },
+
     { L"TimeZoneInformation",
       L"ActiveTimeBias",
       &ExpLastTimeZoneBias,
@@ -547,6 +564,13 @@ CM_SYSTEM_CONTROL_VECTOR   CmControlVector[] = {
       &CmRegistrySizeLimitType
     },
 
+    { L"Session Manager\\Configuration Manager",
+      L"UpgradeHashIndex",
+      &CmpUpgradeHashIndex,
+      NULL,
+      NULL
+    },
+
 #if defined(i386)
     { L"Session Manager",
       L"ForceNpxEmulation",
@@ -85,6 +85,12 @@ The Structure:
     entries.  Max of 1 million total, best case.  Worst case something
     like 1/4 of that.
 
+    In version 4 hives the leaves are hash leaves.  Each entry carries a
+    hash of the full upcased name next to the cell, so a lookup scans the
+    hashes of one leaf and only reads the key nodes whose hash matches.
+    Hash leaves hold about 500 entries; the leaves below a root are still
+    selected by binary search on the names of their first and last keys.
+
 */
 
 #include    "cmp.h"
@@ -154,6 +160,43 @@ CmpSplitLeaf(
     HSTORAGE_TYPE   Type
 );
 
+ULONG
+CmpFindSubKeyInHashLeaf(
+    PHHIVE              Hive,
+    PCM_KEY_FAST_INDEX  Index,
+    ULONG               HintIndex,
+    ULONG               HashKey,
+    PUNICODE_STRING     SearchName,
+    PHCELL_INDEX        Child
+);
+
+ULONG
+CmpComputeHashKey(
+    PUNICODE_STRING Name
+);
+
+ULONG
+CmpComputeHashKeyForKeyNode(
+    PHHIVE          Hive,
+    HCELL_INDEX     Cell
+);
+
+HCELL_INDEX
+CmpConvertToHashLeaf(
+    PHHIVE          Hive,
+    HCELL_INDEX     LeafCell
+);
+
+// A leaf is full when one more entry would no longer fit in a single
+// logical block.  Fast and hash leaves use twice the space per entry.
+// In a version 4 hive slow leaves are held to the hash leaf limit, so
+// that they are split down to a size that can be converted.
+
+#define CmpIsLeafFull(Hive, Leaf)                                       \
+    ((Leaf)->Count >= (((UseHashIndex(Hive) ||                          \
+                         ((Leaf)->Signature != CM_KEY_INDEX_LEAF)) ?    \
+                        CM_MAX_FAST_INDEX : CM_MAX_INDEX) - 1))
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE,CmpFindSubKeyByName)
 #pragma alloc_text(PAGE,CmpFindSubKeyInRoot)
@@ -168,10 +211,22 @@ CmpSplitLeaf(
 #pragma alloc_text(PAGE,CmpSplitLeaf)
 #pragma alloc_text(PAGE,CmpMarkIndexDirty)
 #pragma alloc_text(PAGE,CmpRemoveSubKey)
+#pragma alloc_text(PAGE,CmpFindSubKeyInHashLeaf)
+#pragma alloc_text(PAGE,CmpComputeHashKey)
+#pragma alloc_text(PAGE,CmpComputeHashKeyForKeyNode)
+#pragma alloc_text(PAGE,CmpConvertToHashLeaf)
+#pragma alloc_text(PAGE,CmpGetSubKeyNameHint)
 #endif
 
 ULONG CmpHintHits = 0;
 ULONG CmpHintMisses = 0;
+ULONG CmpHashLeafCollisions = 0;
+
+// Version 3 hives are only upgraded to version 4, the first time a subkey
+// is added to them, when this is set from the registry.  Otherwise they are
+// left readable on V3 systems.
+
+ULONG CmpUpgradeHashIndex = 0;
 
 
 HCELL_INDEX
@@ -195,12 +250,19 @@ Return Value:
     HCELL_INDEX     Child;
     ULONG           i;
     ULONG           FoundIndex;
+    ULONG           HashKey = 0;
 
     CMLOG(CML_MAJOR, CMS_INDEX) {
         KdPrint(("CmpFindSubKeyByName:\n\t"));
         KdPrint(("Hive=%08lx Parent=%08lx SearchName=%08lx\n", Hive, Parent, SearchName));
     }
 
+    // Only hash leaves need the hash, and only version 4 hives have them.
+
+    if (UseHashIndex(Hive)) {
+        HashKey = CmpComputeHashKey(SearchName);
+    }
+
     // Try first the Stable, then the Volatile store.  Assumes that
     // all Volatile refs in Stable space are zeroed out at boot.
 
@@ -216,9 +278,16 @@ Return Value:
                 }
                 IndexRoot = (PCM_KEY_INDEX)HvGetCell(Hive, Child);
             }
-            ASSERT((IndexRoot->Signature == CM_KEY_INDEX_LEAF) || (IndexRoot->Signature == CM_KEY_FAST_LEAF));
+            ASSERT((IndexRoot->Signature == CM_KEY_INDEX_LEAF) ||
+                   (IndexRoot->Signature == CM_KEY_FAST_LEAF) ||
+                   (IndexRoot->Signature == CM_KEY_HASH_LEAF));
 
-            FoundIndex = CmpFindSubKeyInLeaf(Hive, IndexRoot, Parent->WorkVar, SearchName, &Child);
+            if (IndexRoot->Signature == CM_KEY_HASH_LEAF) {
+                FoundIndex = CmpFindSubKeyInHashLeaf(Hive, (PCM_KEY_FAST_INDEX)IndexRoot, Parent->WorkVar, HashKey, SearchName, &Child);
+            }
+            else {
+                FoundIndex = CmpFindSubKeyInLeaf(Hive, IndexRoot, Parent->WorkVar, SearchName, &Child);
+            }
             if (Child != HCELL_NIL) {
                 // WorkVar is used as a hint for the last successful lookup
                 // to improve our locality when similar keys are opened repeatedly.
@@ -285,7 +354,9 @@ Return Value:
         LeafCell = Index->List[CanCount];
         Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
 
-        ASSERT((Leaf->Signature == CM_KEY_INDEX_LEAF) || (Leaf->Signature == CM_KEY_FAST_LEAF));
+        ASSERT((Leaf->Signature == CM_KEY_INDEX_LEAF) ||
+               (Leaf->Signature == CM_KEY_FAST_LEAF) ||
+               (Leaf->Signature == CM_KEY_HASH_LEAF));
         ASSERT(Leaf->Count != 0);
 
         Result = CmpCompareInIndex(Hive, SearchName, Leaf->Count - 1, Leaf, Child);
@@ -383,7 +454,9 @@ CmpFindSubKeyInLeaf(
 )
 /*++
 Routine Description:
-    Find a named key in a leaf index, if it exists. The supplied index may be either a fast index or a slow one.
+    Find a named key in a leaf index, if it exists. The supplied index may be a fast, hash or slow one.
+    The search is a binary search on the names, so for a hash leaf it reads about log2(Count) key nodes;
+    lookups that only need a match use CmpFindSubKeyInHashLeaf instead.
 Arguments:
     Hive - pointer to hive control structure for hive of interest
     Index - pointer to leaf block
@@ -406,7 +479,9 @@ Return Value:
         KdPrint(("Hive=%08lx Index=%08lx SearchName=%08lx\n", Hive, Index, SearchName));
     }
 
-    ASSERT((Index->Signature == CM_KEY_INDEX_LEAF) || (Index->Signature == CM_KEY_FAST_LEAF));
+    ASSERT((Index->Signature == CM_KEY_INDEX_LEAF) ||
+           (Index->Signature == CM_KEY_FAST_LEAF) ||
+           (Index->Signature == CM_KEY_HASH_LEAF));
 
     High = Index->Count - 1;
     Low = 0;
@@ -465,6 +540,194 @@ Return Value:
 }
 
 
+ULONG
+CmpFindSubKeyInHashLeaf(
+    PHHIVE              Hive,
+    PCM_KEY_FAST_INDEX  Index,
+    ULONG               HintIndex,
+    ULONG               HashKey,
+    PUNICODE_STRING     SearchName,
+    PHCELL_INDEX        Child
+)
+/*++
+Routine Description:
+    Find a named key in a hash leaf, if it exists.  The hashes are scanned
+    in order and only the key nodes of entries whose hash matches are read.
+Arguments:
+    Hive - pointer to hive control structure for hive of interest
+    Index - pointer to hash leaf block
+    HintIndex - Supplies hint for first key to check.
+    HashKey - hash of SearchName, as computed by CmpComputeHashKey
+    SearchName - pointer to name of key of interest
+    Child - pointer to variable to receive hcell_index of found key HCELL_NIL if none found
+Return Value:
+    If Child != HCELL_NIL, offset in list at which Child was found.
+    Else, Count.  Callers that need an insertion point use CmpFindSubKeyInLeaf.
+--*/
+{
+    PCM_INDEX   Entry;
+    ULONG       i;
+
+    CMLOG(CML_MAJOR, CMS_INDEX) {
+        KdPrint(("CmpFindSubKeyInHashLeaf:\n\t"));
+        KdPrint(("Hive=%08lx Index=%08lx SearchName=%08lx\n", Hive, Index, SearchName));
+    }
+
+    ASSERT(Index->Signature == CM_KEY_HASH_LEAF);
+
+    // Try the entry of the last successful lookup first.
+
+    if (HintIndex < Index->Count) {
+        Entry = &Index->List[HintIndex];
+        if ((Entry->HashKey == HashKey) &&
+            (CmpDoCompareKeyName(Hive, SearchName, Entry->Cell) == 0)) {
+            *Child = Entry->Cell;
+            return HintIndex;
+        }
+    }
+
+    for (i = 0; i < Index->Count; i++) {
+        Entry = &Index->List[i];
+        if ((Entry->HashKey != HashKey) || (i == HintIndex)) {
+            continue;
+        }
+        if (CmpDoCompareKeyName(Hive, SearchName, Entry->Cell) == 0) {
+            *Child = Entry->Cell;
+            return i;
+        }
+        CmpHashLeafCollisions++;
+    }
+
+    *Child = HCELL_NIL;
+    return Index->Count;
+}
+
+
+ULONG
+CmpComputeHashKey(
+    PUNICODE_STRING Name
+)
+/*++
+Routine Description:
+    Compute the hash stored in a hash leaf entry for a subkey name.  This is
+    the same function used to build the ConvKey of a kcb, applied to a single
+    name component.
+Arguments:
+    Name - name of the subkey
+Return Value:
+    Hash of the upcased name.
+--*/
+{
+    ULONG   HashKey = 0;
+    ULONG   i;
+
+    for (i = 0; i < Name->Length / sizeof(WCHAR); i++) {
+        HashKey = 37 * HashKey + (ULONG)RtlUpcaseUnicodeChar(Name->Buffer[i]);
+    }
+    return HashKey;
+}
+
+
+ULONG
+CmpComputeHashKeyForKeyNode(
+    PHHIVE          Hive,
+    HCELL_INDEX     Cell
+)
+/*++
+Routine Description:
+    Compute the hash leaf hash for the name stored in a key node, which may
+    be compressed.
+Arguments:
+    Hive - pointer to hive control structure for hive of interest
+    Cell - cell of the key node
+Return Value:
+    Hash of the upcased name of the key.
+--*/
+{
+    PCM_KEY_NODE    Pcan;
+    UNICODE_STRING  KeyName;
+    ULONG           HashKey = 0;
+    ULONG           i;
+
+    Pcan = (PCM_KEY_NODE)HvGetCell(Hive, Cell);
+    if (Pcan->Flags & KEY_COMP_NAME) {
+        for (i = 0; i < Pcan->NameLength; i++) {
+            HashKey = 37 * HashKey + (ULONG)RtlUpcaseUnicodeChar((WCHAR)(((PUCHAR)Pcan->Name)[i]));
+        }
+        return HashKey;
+    }
+    else {
+        KeyName.Buffer = &(Pcan->Name[0]);
+        KeyName.Length = Pcan->NameLength;
+        KeyName.MaximumLength = KeyName.Length;
+        return CmpComputeHashKey(&KeyName);
+    }
+}
+
+
+HCELL_INDEX
+CmpConvertToHashLeaf(
+    PHHIVE          Hive,
+    HCELL_INDEX     LeafCell
+)
+/*++
+Routine Description:
+    Convert a fast or slow leaf to a hash leaf.  A fast leaf is converted in
+    place.  A slow leaf is reallocated first, since its entries double in size.
+
+    NOTE:   We expect Leaf to already be marked dirty by caller, and the
+            leaf to have fewer than CM_MAX_FAST_INDEX entries.
+Arguments:
+    Hive - pointer to hive control structure for hive of interest
+    LeafCell - cell of index leaf to convert
+Return Value:
+    HCELL_NIL - resource problem, the leaf is unchanged
+    Else - cell of the hash leaf, caller is expected to set this into Root
+           index or Key body.
+--*/
+{
+    PCM_KEY_INDEX       Leaf;
+    PCM_KEY_FAST_INDEX  FastLeaf;
+    HCELL_INDEX         NewCell;
+    ULONG               Size;
+    ULONG               i;
+
+    Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
+    ASSERT((Leaf->Signature == CM_KEY_INDEX_LEAF) || (Leaf->Signature == CM_KEY_FAST_LEAF));
+    ASSERT(Leaf->Count < CM_MAX_FAST_INDEX);
+
+    NewCell = LeafCell;
+    if (Leaf->Signature == CM_KEY_INDEX_LEAF) {
+        // Leave room for the entry about to be added, so the caller never
+        // has to reallocate again (and fail) once the old cell is gone.
+
+        Size = FIELD_OFFSET(CM_KEY_FAST_INDEX, List) + (sizeof(CM_INDEX) * (Leaf->Count + 1));
+        if (HvGetCellSize(Hive, Leaf) < Size) {
+            NewCell = HvReallocateCell(Hive, LeafCell, Size);
+            if (NewCell == HCELL_NIL) {
+                return HCELL_NIL;
+            }
+            Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, NewCell);
+        }
+
+        // Spread the cells out from the top down, so no cell is overwritten
+        // before it has been moved.
+
+        FastLeaf = (PCM_KEY_FAST_INDEX)Leaf;
+        for (i = Leaf->Count; i > 0; i--) {
+            FastLeaf->List[i - 1].Cell = Leaf->List[i - 1];
+        }
+    }
+
+    FastLeaf = (PCM_KEY_FAST_INDEX)Leaf;
+    for (i = 0; i < FastLeaf->Count; i++) {
+        FastLeaf->List[i].HashKey = CmpComputeHashKeyForKeyNode(Hive, FastLeaf->List[i].Cell);
+    }
+    FastLeaf->Signature = CM_KEY_HASH_LEAF;
+    return NewCell;
+}
+
+
 LONG
 CmpCompareInIndex(
     PHHIVE          Hive,
@@ -475,7 +738,7 @@ CmpCompareInIndex(
 )
 /*++
 Routine Description:
-    Do a compare of a name in an index. This routine handles both fast leafs and slow ones.
+    Do a compare of a name in an index. This routine handles fast, hash and slow leafs.
 Arguments:
     Hive - pointer to hive control structure for hive of interest
     SearchName - pointer to name of key we are searching for
@@ -542,6 +805,14 @@ Return Value:
             *Child = Hint->Cell;
         }
     }
+    else if (Index->Signature == CM_KEY_HASH_LEAF) {
+        // The hash says nothing about ordering, compare the names.
+        FastIndex = (PCM_KEY_FAST_INDEX)Index;
+        Result = CmpDoCompareKeyName(Hive, SearchName, FastIndex->List[Count].Cell);
+        if (Result == 0) {
+            *Child = FastIndex->List[Count].Cell;
+        }
+    }
     else {
         // This is just a normal old slow index.
         Result = CmpDoCompareKeyName(Hive, SearchName, Index->List[Count]);
@@ -692,7 +963,7 @@ Return Value:
             LeafCell = Index->List[i];
             Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
             if (Number < Leaf->Count) {
-                if (Leaf->Signature == CM_KEY_FAST_LEAF) {
+                if (Leaf->Signature != CM_KEY_INDEX_LEAF) {
                     FastIndex = (PCM_KEY_FAST_INDEX)Leaf;
                     return (FastIndex->List[Number].Cell);
                 }
@@ -707,7 +978,7 @@ Return Value:
         ASSERT(FALSE);
     }
     ASSERT(Number < Index->Count);
-    if (Index->Signature == CM_KEY_FAST_LEAF) {
+    if (Index->Signature != CM_KEY_INDEX_LEAF) {
         FastIndex = (PCM_KEY_FAST_INDEX)Index;
         return(FastIndex->List[Number].Cell);
     }
@@ -767,6 +1038,17 @@ Return Value:
     }
 
 
+    // Upgrade a version 3 hive the first time one of its indexes is
+    // written.  The new minor version reaches the disk with the next
+    // flush, together with the first hash leaf.  Its leaves are then
+    // converted one at a time by CmpAddToLeaf.
+
+    if ((CmpUpgradeHashIndex != 0) && UseFastIndex(Hive) && !UseHashIndex(Hive)) {
+        Hive->Version = HSYS_MINOR;
+        Hive->BaseBlock->Minor = HSYS_MINOR;
+    }
+
+
     // build a name string
 
     pcell = (PCM_KEY_NODE)HvGetCell(Hive, Child);
@@ -801,12 +1083,17 @@ Return Value:
 
         // we must allocate a leaf
 
-        WorkCell = HvAllocateCell(Hive, sizeof(CM_KEY_FAST_INDEX), Type);
+        WorkCell = HvAllocateCellNear(Hive, sizeof(CM_KEY_FAST_INDEX), Type, Parent);
         if (WorkCell == HCELL_NIL) {
             goto ErrorExit;
         }
         Index = (PCM_KEY_INDEX)HvGetCell(Hive, WorkCell);
-        Index->Signature = UseFastIndex(Hive) ? CM_KEY_FAST_LEAF : CM_KEY_INDEX_LEAF;
+        if (UseHashIndex(Hive)) {
+            Index->Signature = CM_KEY_HASH_LEAF;
+        }
+        else {
+            Index->Signature = UseFastIndex(Hive) ? CM_KEY_FAST_LEAF : CM_KEY_INDEX_LEAF;
+        }
         Index->Count = 0;
         pcell->SubKeyLists[Type] = WorkCell;
         cleanup = 1;
@@ -815,7 +1102,8 @@ Return Value:
 
         Index = (PCM_KEY_INDEX)HvGetCell(Hive, pcell->SubKeyLists[Type]);
         if ((Index->Signature == CM_KEY_FAST_LEAF) &&
-            (Index->Count >= (CM_MAX_FAST_INDEX))) {
+            (Index->Count >= (CM_MAX_FAST_INDEX)) &&
+            !UseHashIndex(Hive)) {
 
 
             // We must change fast index to a slow index to accomodate
@@ -829,15 +1117,19 @@ Return Value:
             Index->Signature = CM_KEY_INDEX_LEAF;
 
         }
-        else if ((Index->Signature == CM_KEY_INDEX_LEAF) &&
-            (Index->Count >= (CM_MAX_INDEX - 1))) {
+        else if ((Index->Signature != CM_KEY_INDEX_ROOT) &&
+                 (UseHashIndex(Hive) || (Index->Signature == CM_KEY_INDEX_LEAF)) &&
+                 CmpIsLeafFull(Hive, Index)) {
 
-            // We must change flat entry to a root/leaf tree
+            // We must change flat entry to a root/leaf tree.  In a version 4
+            // hive a full fast or hash leaf ends up here too, and is split
+            // into hash leaves below the new root.
 
-            WorkCell = HvAllocateCell(
+            WorkCell = HvAllocateCellNear(
                 Hive,
                 sizeof(CM_KEY_INDEX) + sizeof(HCELL_INDEX), // allow for 2
-                Type
+                Type,
+                Parent
             );
             if (WorkCell == HCELL_NIL) {
                 goto ErrorExit;
@@ -924,8 +1216,10 @@ CmpAddToLeaf(
 
 Routine Description:
 
-    Insert a new subkey into a Leaf index. Supports both fast and slow
+    Insert a new subkey into a Leaf index. Supports fast, hash and slow
     leaf indexes and will determine which sort of index the given leaf is.
+    In a version 4 hive, fast and slow leaves that have room are converted
+    to hash leaves first.
 
     NOTE:   We expect Root to already be marked dirty by caller if non NULL.
             We expect Leaf to always be marked dirty by caller.
@@ -971,6 +1265,21 @@ Return Value:
     }
 
 
+    // upgrade old leaves of a version 4 hive as they are written
+
+    Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
+    if (UseHashIndex(Hive) &&
+        (Leaf->Signature != CM_KEY_HASH_LEAF) &&
+        (Leaf->Count < (CM_MAX_FAST_INDEX - 1))) {
+
+        NewCell = CmpConvertToHashLeaf(Hive, LeafCell);
+        if (NewCell == HCELL_NIL) {
+            return HCELL_NIL;
+        }
+        LeafCell = NewCell;
+    }
+
+
     // compute number free slots left in the leaf
 
     Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
@@ -979,7 +1288,7 @@ Return Value:
         EntrySize = sizeof(HCELL_INDEX);
     }
     else {
-        ASSERT(Leaf->Signature == CM_KEY_FAST_LEAF);
+        ASSERT((Leaf->Signature == CM_KEY_FAST_LEAF) || (Leaf->Signature == CM_KEY_HASH_LEAF));
         FastLeaf = (PCM_KEY_FAST_INDEX)Leaf;
         EntrySize = sizeof(CM_INDEX);
     }
@@ -1055,7 +1364,11 @@ Return Value:
             }
         }
     }
-    if (FastLeaf != NULL) {
+    if ((FastLeaf != NULL) && (FastLeaf->Signature == CM_KEY_HASH_LEAF)) {
+        FastLeaf->List[Select].Cell = NewKey;
+        FastLeaf->List[Select].HashKey = CmpComputeHashKey(NewName);
+    }
+    else if (FastLeaf != NULL) {
         FastLeaf->List[Select].Cell = NewKey;
         FastLeaf->List[Select].NameHint[0] = 0;
         FastLeaf->List[Select].NameHint[1] = 0;
@@ -1203,7 +1516,7 @@ Return Value:
                     LeafCell = Index->List[RootSelect - 1];
                     Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
 
-                    if (Leaf->Count < (CM_MAX_INDEX - 1)) {
+                    if (!CmpIsLeafFull(Hive, Leaf)) {
                         RootSelect--;
                         *RootPointer = &(Index->List[RootSelect]);
                         break;
@@ -1217,7 +1530,7 @@ Return Value:
 
                     LeafCell = Index->List[0];
                     Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
-                    if (Leaf->Count < (CM_MAX_INDEX - 1)) {
+                    if (!CmpIsLeafFull(Hive, Leaf)) {
                         *RootPointer = &(Index->List[0]);
                         break;
                     }
@@ -1238,7 +1551,7 @@ Return Value:
                 LeafCell = Index->List[RootSelect];
                 Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
 
-                if (Leaf->Count < (CM_MAX_INDEX - 1)) {
+                if (!CmpIsLeafFull(Hive, Leaf)) {
                     *RootPointer = &(Index->List[RootSelect]);
                     break;
                 }
@@ -1252,7 +1565,7 @@ Return Value:
                     LeafCell = Index->List[RootSelect + 1];
                     Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
 
-                    if (Leaf->Count < (CM_MAX_INDEX - 1)) {
+                    if (!CmpIsLeafFull(Hive, Leaf)) {
                         *RootPointer = &(Index->List[RootSelect + 1]);
                         break;
                     }
@@ -1272,7 +1585,7 @@ Return Value:
          // therefore it must go in Leaf.  If no space, split it.
 
             Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafCell);
-            if (Leaf->Count < (CM_MAX_INDEX - 1)) {
+            if (!CmpIsLeafFull(Hive, Leaf)) {
 
                 *RootPointer = &(Index->List[RootSelect]);
                 break;
@@ -1318,7 +1631,8 @@ Routine Description:
 
     Split the Leaf index block specified by RootSelect, causing both
     of the split out Leaf blocks to appear in the Root index block
-    specified by RootCell.
+    specified by RootCell.  The new Leaf has the same format as the
+    one being split.
 
     Caller is expected to have marked old root cell dirty.
 
@@ -1350,6 +1664,7 @@ Return Value:
     USHORT          OldCount;
     USHORT          KeepCount;
     USHORT          NewCount;
+    ULONG           EntrySize;
 
     CMLOG(CML_MAJOR, CMS_INDEX) {
         KdPrint(("CmpSplitLeaf:\n\t"));
@@ -1367,19 +1682,26 @@ Return Value:
     KeepCount = (USHORT)(OldCount / 2);     // # of entries to keep in org. Leaf
     NewCount = (OldCount - KeepCount);      // # of entries to move
 
-    Size = (sizeof(HCELL_INDEX) * NewCount) +
+    if (Leaf->Signature == CM_KEY_INDEX_LEAF) {
+        EntrySize = sizeof(HCELL_INDEX);
+    }
+    else {
+        EntrySize = sizeof(CM_INDEX);
+    }
+
+    Size = (EntrySize * NewCount) +
         FIELD_OFFSET(CM_KEY_INDEX, List) + 1;   // +1 to assure room for add
 
     if (!HvMarkCellDirty(Hive, LeafCell)) {
         return HCELL_NIL;
     }
 
-    NewLeafCell = HvAllocateCell(Hive, Size, Type);
+    NewLeafCell = HvAllocateCellNear(Hive, Size, Type, LeafCell);
     if (NewLeafCell == HCELL_NIL) {
         return HCELL_NIL;
     }
     NewLeaf = (PCM_KEY_INDEX)HvGetCell(Hive, NewLeafCell);
-    NewLeaf->Signature = CM_KEY_INDEX_LEAF;
+    NewLeaf->Signature = Leaf->Signature;
 
 
 
@@ -1410,8 +1732,8 @@ Return Value:
 
     RtlMoveMemory(
         (PVOID)&(NewLeaf->List[0]),
-        (PVOID)&(Leaf->List[KeepCount]),
-        sizeof(HCELL_INDEX) * NewCount
+        (PVOID)((PUCHAR)&(Leaf->List[0]) + (EntrySize * KeepCount)),
+        EntrySize * NewCount
     );
 
     ASSERT(KeepCount != 0);
@@ -1528,9 +1850,20 @@ Return Value:
                 Index = (PCM_KEY_INDEX)HvGetCell(Hive, Child);
             }
             ASSERT((Index->Signature == CM_KEY_INDEX_LEAF) ||
-                (Index->Signature == CM_KEY_FAST_LEAF));
-
-            CmpFindSubKeyInLeaf(Hive, Index, pcell->WorkVar, &SearchName, &Child);
+                (Index->Signature == CM_KEY_FAST_LEAF) ||
+                (Index->Signature == CM_KEY_HASH_LEAF));
+
+            if (Index->Signature == CM_KEY_HASH_LEAF) {
+                CmpFindSubKeyInHashLeaf(Hive,
+                                        (PCM_KEY_FAST_INDEX)Index,
+                                        pcell->WorkVar,
+                                        CmpComputeHashKey(&SearchName),
+                                        &SearchName,
+                                        &Child);
+            }
+            else {
+                CmpFindSubKeyInLeaf(Hive, Index, pcell->WorkVar, &SearchName, &Child);
+            }
             if (Child != HCELL_NIL) {
                 if (IsCompressed) {
                     (Hive->Free)(SearchName.Buffer, SearchName.Length);
@@ -1639,9 +1972,20 @@ Return Value:
     }
 
     ASSERT((Leaf->Signature == CM_KEY_INDEX_LEAF) ||
-        (Leaf->Signature == CM_KEY_FAST_LEAF));
-
-    LeafSelect = CmpFindSubKeyInLeaf(Hive, Leaf, pcell->WorkVar, &SearchName, &Child);
+        (Leaf->Signature == CM_KEY_FAST_LEAF) ||
+        (Leaf->Signature == CM_KEY_HASH_LEAF));
+
+    if (Leaf->Signature == CM_KEY_HASH_LEAF) {
+        LeafSelect = CmpFindSubKeyInHashLeaf(Hive,
+                                             (PCM_KEY_FAST_INDEX)Leaf,
+                                             pcell->WorkVar,
+                                             CmpComputeHashKey(&SearchName),
+                                             &SearchName,
+                                             &Child);
+    }
+    else {
+        LeafSelect = CmpFindSubKeyInLeaf(Hive, Leaf, pcell->WorkVar, &SearchName, &Child);
+    }
 
     ASSERT(Child != HCELL_NIL);
 
@@ -1720,3 +2064,89 @@ Return Value:
     }
     return TRUE;
 }
+
+
+VOID
+CmpGetSubKeyNameHint(
+    PHHIVE          Hive,
+    PCM_KEY_INDEX   Index,
+    ULONG           Number,
+    PUCHAR          NameHint
+)
+/*++
+
+Routine Description:
+
+    Return the four character name hint of the Number'th entry in a fast
+    or hash leaf, as used for the subkey hints in a kcb.  A fast leaf
+    stores the hint in the entry; for a hash leaf it is built from the
+    name in the key node.
+
+Arguments:
+
+    Hive - pointer to hive control structure for hive of interest
+
+    Index - fast or hash leaf
+
+    Number - entry in the leaf
+
+    NameHint - receives CM_SUBKEY_HINT_LENGTH characters.  NameHint[0]
+               is 0 if the name cannot be hinted and must be looked up
+               in the key.
+
+Return Value:
+
+    NONE.
+
+--*/
+{
+    PCM_KEY_FAST_INDEX  FastIndex;
+    PCM_KEY_NODE        Pcan;
+    ULONG               Length;
+    ULONG               i;
+    WCHAR               c;
+
+    ASSERT((Index->Signature == CM_KEY_FAST_LEAF) || (Index->Signature == CM_KEY_HASH_LEAF));
+    ASSERT(Number < Index->Count);
+
+    FastIndex = (PCM_KEY_FAST_INDEX)Index;
+    if (Index->Signature == CM_KEY_FAST_LEAF) {
+        for (i = 0; i < CM_SUBKEY_HINT_LENGTH; i++) {
+            NameHint[i] = FastIndex->List[Number].NameHint[i];
+        }
+        return;
+    }
+
+    for (i = 0; i < CM_SUBKEY_HINT_LENGTH; i++) {
+        NameHint[i] = 0;
+    }
+
+    Pcan = (PCM_KEY_NODE)HvGetCell(Hive, FastIndex->List[Number].Cell);
+    if (Pcan->Flags & KEY_COMP_NAME) {
+        Length = Pcan->NameLength;
+    }
+    else {
+        Length = Pcan->NameLength / sizeof(WCHAR);
+    }
+    if (Length > CM_SUBKEY_HINT_LENGTH) {
+        Length = CM_SUBKEY_HINT_LENGTH;
+    }
+
+    for (i = 0; i < Length; i++) {
+        if (Pcan->Flags & KEY_COMP_NAME) {
+            c = (WCHAR)(((PUCHAR)Pcan->Name)[i]);
+        }
+        else {
+            c = Pcan->Name[i];
+        }
+        if ((USHORT)c > (UCHAR)-1) {
+
+            // Can't compress this name. Leave NameHint[0]==0
+            // to force the name to be looked up in the key.
+
+            NameHint[0] = 0;
+            return;
+        }
+        NameHint[i] = (UCHAR)c;
+    }
+}
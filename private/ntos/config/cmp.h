@@ -181,6 +181,7 @@ CmpMarkAllBinsReadOnly(
 #define  CM_CACHE_INDEX_TAG       'nIMC'
 #define  CM_CACHE_VALUE_DATA_TAG  'aDMC'
 #define  CM_NAME_TAG              'bNMC'
+#define  CM_NEGATIVE_TAG          'gNMC'
 
 
 #define ExAllocatePool(a,b) ExAllocatePoolWithTag(a,b,CM_POOL_TAG)
@@ -432,6 +433,37 @@ extern  POBJECT_TYPE CmpKeyObjectType;// extern for object type pointer
 #define GET_HASH_INDEX(Key) HASH_KEY(Key) % CmpHashTableSize
 #define GET_HASH_ENTRY(Table, Key) Table[GET_HASH_INDEX(Key)]
 
+#define GET_NAME_HASH_INDEX(Key) HASH_KEY(Key) % CmpNameHashTableSize
+#define GET_NAME_HASH_ENTRY(Table, Key) Table[GET_NAME_HASH_INDEX(Key)]
+
+
+// The kcb hash table starts at CmpHashTableSize buckets and is doubled whenever
+// the number of kcbs in it exceeds CM_KCB_HASH_LOAD_FACTOR per bucket, up to
+// CmpMaximumHashTableSize buckets.  It is only resized by CmpInsertKeyHash with the
+// KCB lock held, so the table must not be referenced outside of the KCB lock
+// unless the registry is locked exclusively.
+
+#define CM_KCB_HASH_LOAD_FACTOR     2
+
+
+// Negative lookup cache.
+// Each entry records a subkey name that was looked up under ParentKcb and not
+// found, so a repeated lookup fails without touching the hive.  The cache is
+// direct mapped on the ConvKey the subkey would have.  Names are kept upcased and
+// names longer than CM_NEGATIVE_NAME_LENGTH characters are not cached.
+// Entries are only read or added with the KCB lock held, and are purged with the
+// registry locked exclusively (or the KCB lock held when a kcb is freed).
+
+#define CM_NEGATIVE_CACHE_SIZE      1024
+#define CM_NEGATIVE_NAME_LENGTH     40
+
+typedef struct _CM_NEGATIVE_LOOKUP {
+    PCM_KEY_CONTROL_BLOCK   ParentKcb;      // NULL for a free entry
+    ULONG                   ConvKey;
+    USHORT                  NameLength;     // in bytes
+    WCHAR                   Name[CM_NEGATIVE_NAME_LENGTH];
+} CM_NEGATIVE_LOOKUP, *PCM_NEGATIVE_LOOKUP;
+
 // CM_KEY_BODY
 
 //  Same structure used for KEY_ROOT and KEY objects.
@@ -1613,6 +1645,14 @@ CmpRemoveSubKey(
     HCELL_INDEX     TargetKey
     );
 
+VOID
+CmpGetSubKeyNameHint(
+    PHHIVE          Hive,
+    PCM_KEY_INDEX   Index,
+    ULONG           Number,
+    PUCHAR          NameHint
+    );
+
 BOOLEAN
 CmpGetNextName(
     IN OUT PUNICODE_STRING  RemainingName,
@@ -1757,7 +1797,14 @@ VOID CmpFlushNotifiesOnKeyBodyList(IN PCM_KEY_CONTROL_BLOCK   kcb);
 #endif
 
 extern ULONG CmpHashTableSize;
+extern ULONG CmpMaximumHashTableSize;
+extern ULONG CmpNameHashTableSize;
 extern PCM_KEY_HASH *CmpCacheTable;
+extern CM_KCB_CACHE_INFORMATION CmpKcbCacheInformation;
+
+BOOLEAN CmpFindNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name);
+VOID CmpAddNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name);
+VOID CmpRemoveNegativeLookups(IN PCM_KEY_CONTROL_BLOCK ParentKcb);
 
 #ifdef _WANT_MACHINE_IDENTIFICATION
 BOOLEAN CmpGetBiosDateFromRegistry(IN PHHIVE Hive, IN HCELL_INDEX ControlSet, OUT PUNICODE_STRING Date);
@@ -331,7 +331,21 @@ Return Value:
     // on KCBs, We can change KCB lock to a read-write lock if this becomes a problem.
 
 
-    if (kcb->ExtFlags & CM_KCB_CACHE_MASK) {
+    if ((MatchRemainSubkeyLevel < TotalRemainingSubkeys) &&
+        CmpFindNegativeLookup(kcb, &(HashStack[MatchRemainSubkeyLevel].KeyName))) {
+
+        // The next subkey in the path was looked up before and does not exist.
+        // Fail unless this is the create of that subkey; the create purges the negative cache.
+
+        if (((TotalRemainingSubkeys - MatchRemainSubkeyLevel) == 1) && (ARGUMENT_PRESENT(lcontext))) {
+
+            // The key will be created in CmpDoCreate.
+
+        } else {
+            status = STATUS_OBJECT_NAME_NOT_FOUND;
+            GoToValue = CMP_PARSE_GOTO_RETURN;
+        }
+    } else if (kcb->ExtFlags & CM_KCB_CACHE_MASK) {
         if (MatchRemainSubkeyLevel == TotalRemainingSubkeys) {
 
             // We have found a cache for the complete path,
@@ -1570,9 +1584,10 @@ Return Value:
         }
 
 
-        KeyHash = GET_HASH_ENTRY(CmpCacheTable, ConvKey);
+        // The hash table can be resized on insert, so only index it with the KCB lock held.
 
         LOCK_KCB_TREE();
+        KeyHash = GET_HASH_ENTRY(CmpCacheTable, ConvKey);
         while (KeyHash) {
             RealKcb =  CONTAINING_RECORD(KeyHash, CM_KEY_CONTROL_BLOCK, KeyHash);
             if ((ConvKey == KeyHash->ConvKey) && (TotalLevels == RealKcb->TotalLevels)) {
@@ -1882,6 +1897,7 @@ Return Value:
 
     BaseKcb = *Kcb;
     CurrentLevel = TotalRemainingSubkeys + BaseKcb->TotalLevels + 1;
+    CmpKcbCacheInformation.Lookups += 1;
 
     for(i = TotalRemainingSubkeys-1; i>=0; i--) {
 
@@ -1896,6 +1912,7 @@ Return Value:
 
         while (Current) {
             ASSERT_KEY_HASH(Current);
+            CmpKcbCacheInformation.ChainProbes += 1;
 
 
             // Check against both the ConvKey and total levels;
@@ -2028,6 +2045,14 @@ Return Value:
         status = STATUS_INSUFFICIENT_RESOURCES;
     }
     *MatchRemainSubkeyLevel = i+1;
+
+    if (!Found) {
+        CmpKcbCacheInformation.Misses += 1;
+    } else if ((ULONG)(i+1) == TotalRemainingSubkeys) {
+        CmpKcbCacheInformation.CompleteHits += 1;
+    } else {
+        CmpKcbCacheInformation.PartialHits += 1;
+    }
     return status;
 }
 
@@ -2058,6 +2083,7 @@ Routine Description:
        we do create too many fake keys.
        One solution is to use hash value for index hint (We can do it in the cache only
        if we need to be backward comparible).
+    4. In all cases, record the name in the negative lookup cache.
 
 Arguments:
 
@@ -2079,7 +2105,14 @@ Return Value:
     BOOLEAN CreateFakeKcb = FALSE;
     BOOLEAN HintCached;
     PCM_KEY_CONTROL_BLOCK ParentKcb;
-    USHORT i,j,k;
+    USHORT i,j;
+
+
+    // Remember the failure so the next lookup of this name does not touch the hive.
+
+    LOCK_KCB_TREE();
+    CmpAddNegativeLookup(kcb, NodeName);
+    UNLOCK_KCB_TREE();
 
     if (!UseFastIndex(Hive)) {
 
@@ -2101,7 +2134,6 @@ Return Value:
             // Build the subkey hint to avoid unnecessary lookups in the index leaf
 
             PCM_KEY_INDEX   Index;
-            PCM_INDEX       Hint;
 
             if (Node->SubKeyCounts[Stable] == 1) {
                 Index = (PCM_KEY_INDEX)HvGetCell(Hive, Node->SubKeyLists[Stable]);
@@ -2109,14 +2141,9 @@ Return Value:
                 Index = (PCM_KEY_INDEX)HvGetCell(Hive, Node->SubKeyLists[Volatile]);
             }
 
-            if (Index->Signature == CM_KEY_FAST_LEAF) {
-                PCM_KEY_FAST_INDEX FastIndex;
-                FastIndex = (PCM_KEY_FAST_INDEX)Index;
-                Hint = &FastIndex->List[0];
-
-                for (k=0; k<CM_SUBKEY_HINT_LENGTH; k++) {
-                    kcb->NameHint[k] = Hint->NameHint[k];
-                }
+            if ((Index->Signature == CM_KEY_FAST_LEAF) ||
+                (Index->Signature == CM_KEY_HASH_LEAF)) {
+                CmpGetSubKeyNameHint(Hive, Index, 0, kcb->NameHint);
 
                 kcb->ExtFlags |= CM_KCB_SUBKEY_ONE;
             }
@@ -2137,8 +2164,6 @@ Return Value:
 
             ULONG Size;
             PCM_KEY_INDEX   Index;
-            PCM_INDEX       Hint;
-            PCM_KEY_FAST_INDEX FastIndex;
             UCHAR           *NameHint;
 
             Size = sizeof(ULONG) * (Node->SubKeyCounts[Stable] + Node->SubKeyCounts[Volatile] + 1);
@@ -2154,13 +2179,9 @@ Return Value:
                     if(Node->SubKeyCounts[i]) {
                         Index = (PCM_KEY_INDEX)HvGetCell(Hive, Node->SubKeyLists[i]);
                         for (j=0; j<Node->SubKeyCounts[i]; j++) {
-                            if (Index->Signature == CM_KEY_FAST_LEAF) {
-                                FastIndex = (PCM_KEY_FAST_INDEX)Index;
-                                Hint = &FastIndex->List[j];
-
-                                for (k=0; k<CM_SUBKEY_HINT_LENGTH; k++) {
-                                    NameHint[k] = Hint->NameHint[k];
-                                }
+                            if ((Index->Signature == CM_KEY_FAST_LEAF) ||
+                                (Index->Signature == CM_KEY_HASH_LEAF)) {
+                                CmpGetSubKeyNameHint(Hive, Index, j, NameHint);
                             } else {
                                 HintCached = FALSE;
                                 break;
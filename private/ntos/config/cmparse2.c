@@ -312,10 +312,11 @@ Return Value:
 
         // Allocate child cell
 
-        *KeyCell = HvAllocateCell(
+        *KeyCell = HvAllocateCellNear(
                         Hive,
                         CmpHKeyNodeSize(Hive, Name),
-                        StorageType
+                        StorageType,
+                        ParentCell
                         );
         if (*KeyCell == HCELL_NIL) {
             Status = STATUS_INSUFFICIENT_RESOURCES;
@@ -328,7 +329,7 @@ Return Value:
         // Allocate cell for class name
 
         if (Context->Class.Length > 0) {
-            ClassCell = HvAllocateCell(Hive, Context->Class.Length, StorageType);
+            ClassCell = HvAllocateCellNear(Hive, Context->Class.Length, StorageType, *KeyCell);
             if (ClassCell == HCELL_NIL) {
                 Status = STATUS_INSUFFICIENT_RESOURCES;
                 __leave;
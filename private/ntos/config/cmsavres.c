@@ -237,7 +237,11 @@ Return Value:
         // Look in each leaf for the HCELL_INDEX we need to replace
         for (i = 0; i < NumberLeaves; i++) {
             Leaf = (PCM_KEY_INDEX)HvGetCell(Hive, LeafArray[i]);
-            if (Leaf->Signature == CM_KEY_FAST_LEAF) {
+            if (Leaf->Signature != CM_KEY_INDEX_LEAF) {
+
+                // Fast or hash leaf.  The restored root keeps its name, so
+                // a hash leaf entry only needs the new cell.
+
                 FastLeaf = (PCM_KEY_FAST_INDEX)Leaf;
                 for (j=0; j < FastLeaf->Count; j++) {
                     if (FastLeaf->List[j].Cell == Cell) {
@@ -278,6 +282,7 @@ FoundCell:
     KeyControlBlock->ValueCache.ValueList = (ULONG_PTR) (KeyControlBlock->KeyNode->ValueList.List);
     KeyControlBlock->Flags = KeyControlBlock->KeyNode->Flags;
     KeyControlBlock->Security = KeyControlBlock->KeyNode->Security;
+    CmpRemoveNegativeLookups(KeyControlBlock);
     KeyControlBlock->ExtFlags = 0;
 
     // Delete the old subtree and it's root cell
@@ -19,14 +19,20 @@ FAST_MUTEX CmpPostLock;
 
 PCM_KEY_HASH *CmpCacheTable;
 ULONG CmpHashTableSize = 2048;
+ULONG CmpMaximumHashTableSize = 256 * 1024;
+ULONG CmpNameHashTableSize = 2048;
 ULONG CmpDelayedCloseSize = 512;
 PCM_KEY_CONTROL_BLOCK *CmpDelayedCloseTable;
 PCM_KEY_CONTROL_BLOCK *CmpDelayedCloseCurrent;
 ULONG_PTR CmpDelayedFreeIndex=0;
 PCM_NAME_HASH *CmpNameCacheTable;
+PCM_NEGATIVE_LOOKUP CmpNegativeCache;
+CM_KCB_CACHE_INFORMATION CmpKcbCacheInformation;
 
 VOID CmpRemoveKeyHash(IN PCM_KEY_HASH KeyHash);
 PCM_KEY_CONTROL_BLOCK CmpInsertKeyHash(IN PCM_KEY_HASH KeyHash, IN BOOLEAN FakeKey);
+VOID CmpResizeKeyHashTable(IN ULONG NewSize);
+BOOLEAN CmpBuildNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name, OUT PCM_NEGATIVE_LOOKUP Lookup);
 
 // private prototype for recursive worker
 VOID CmpDereferenceNameControlBlockWithLock(PCM_NAME_CONTROL_BLOCK Ncb);
@@ -52,6 +58,12 @@ VOID CmpDumpKeyBodyList(IN PCM_KEY_CONTROL_BLOCK kcb, IN PULONG Count);
 #pragma alloc_text(PAGE,CmpFreeKeyBody)
 #pragma alloc_text(PAGE,CmpInsertKeyHash)
 #pragma alloc_text(PAGE,CmpRemoveKeyHash)
+#pragma alloc_text(PAGE,CmpResizeKeyHashTable)
+#pragma alloc_text(PAGE,CmpBuildNegativeLookup)
+#pragma alloc_text(PAGE,CmpFindNegativeLookup)
+#pragma alloc_text(PAGE,CmpAddNegativeLookup)
+#pragma alloc_text(PAGE,CmpRemoveNegativeLookups)
+#pragma alloc_text(PAGE,CmQueryKcbCacheInformation)
 #pragma alloc_text(PAGE,CmpInitializeCache)
 #ifdef KCB_TO_KEYBODY_LINK
 #pragma alloc_text(PAGE,CmpDumpKeyBodyList)
@@ -288,7 +300,7 @@ PCM_NAME_CONTROL_BLOCK CmpGetNameControlBlock(PUNICODE_STRING NodeName)
         }
     }
 
-    Index = GET_HASH_INDEX(NameConvKey);
+    Index = GET_NAME_HASH_INDEX(NameConvKey);
     CurrentName = CmpNameCacheTable[Index];
 
     while (CurrentName) {
@@ -369,7 +381,7 @@ VOID CmpDereferenceNameControlBlockWithLock(PCM_NAME_CONTROL_BLOCK   Ncb)
 
     if (--Ncb->RefCount == 0) {
         // Remove it from the the Hash Table
-        Prev = &(GET_HASH_ENTRY(CmpNameCacheTable, Ncb->ConvKey));
+        Prev = &(GET_NAME_HASH_ENTRY(CmpNameCacheTable, Ncb->ConvKey));
 
         while (TRUE) {
             Current = *Prev;
@@ -404,6 +416,9 @@ Arguments:
         }
         KeyControlBlock->ExtFlags &= ~((CM_KCB_NO_SUBKEY | CM_KCB_SUBKEY_ONE | CM_KCB_SUBKEY_HINT));
     }
+
+    // A subkey that was cached as nonexistent may have just been created.
+    CmpRemoveNegativeLookups(KeyControlBlock);
 }
 
 
@@ -478,6 +493,9 @@ Arguments:
             ExFreePoolWithTag(Kcb->IndexHint, CM_CACHE_INDEX_TAG | PROTECTED_POOL);
         }
 
+        // The negative lookup cache must not outlive the kcb it is keyed on.
+        CmpRemoveNegativeLookups(Kcb);
+
         // Save the ParentKcb before we free the Kcb
         ParentKcb = Kcb->ParentKcb;
 
@@ -819,6 +837,7 @@ Arguments:
             } else if (WorkerResult == KCB_WORKER_DELETE) {
                 ASSERT(Current->Delete);
                 *Prev = Current->NextHash;
+                CmpKcbCacheInformation.KcbCount -= 1;
                 continue;
             } else {
                 ASSERT(WorkerResult == KCB_WORKER_CONTINUE);
@@ -965,6 +984,13 @@ Return Value:
     PCM_KEY_HASH Current;
 
     ASSERT_KEY_HASH(KeyHash);
+
+    // Grow the table before the chains get long.  The index must be computed after this.
+    if ((CmpKcbCacheInformation.KcbCount >= CmpHashTableSize * CM_KCB_HASH_LOAD_FACTOR) &&
+        (CmpHashTableSize < CmpMaximumHashTableSize)) {
+        CmpResizeKeyHashTable(CmpHashTableSize * 2);
+    }
+
     Index = GET_HASH_INDEX(KeyHash->ConvKey);
 
     // If this is a fake key, we will use the cell and hive from its parent for uniqeness.
@@ -1014,6 +1040,7 @@ Return Value:
     // No duplicate was found, add this entry at the head of the list
     KeyHash->NextHash = CmpCacheTable[Index];
     CmpCacheTable[Index] = KeyHash;
+    CmpKcbCacheInformation.KcbCount += 1;
     return(NULL);
 }
 
@@ -1044,6 +1071,7 @@ Arguments:
         ASSERT_KEY_HASH(Current);
         if (Current == KeyHash) {
             *Prev = Current->NextHash;
+            CmpKcbCacheInformation.KcbCount -= 1;
 #if DBG
             if (*Prev) {
                 ASSERT_KEY_HASH(*Prev);
@@ -1056,6 +1084,220 @@ Arguments:
 }
 
 
+VOID CmpResizeKeyHashTable(IN ULONG NewSize)
+/*++
+Routine Description:
+    Moves every key hash structure into a new hash table of NewSize buckets.
+    The KCB lock must be held.  If the new table cannot be allocated the current one is kept.
+Arguments:
+    NewSize - Supplies the number of buckets for the new table.
+--*/
+{
+    PCM_KEY_HASH *NewTable;
+    PCM_KEY_HASH Current;
+    PCM_KEY_HASH Next;
+    ULONG Index;
+    ULONG i;
+
+    NewTable = ExAllocatePoolWithTag(PagedPool, NewSize * sizeof(PCM_KEY_HASH), 'aCMC');
+    if (NewTable == NULL) {
+        // Not fatal, the chains are just longer than we would like.
+        return;
+    }
+    RtlZeroMemory(NewTable, NewSize * sizeof(PCM_KEY_HASH));
+
+    for (i=0; i<CmpHashTableSize; i++) {
+        Current = CmpCacheTable[i];
+        while (Current) {
+            ASSERT_KEY_HASH(Current);
+            Next = Current->NextHash;
+            Index = HASH_KEY(Current->ConvKey) % NewSize;
+            Current->NextHash = NewTable[Index];
+            NewTable[Index] = Current;
+            Current = Next;
+        }
+    }
+
+    ExFreePoolWithTag(CmpCacheTable, 'aCMC');
+    CmpCacheTable = NewTable;
+    CmpHashTableSize = NewSize;
+    CmpKcbCacheInformation.TableResizes += 1;
+}
+
+
+BOOLEAN CmpBuildNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name, OUT PCM_NEGATIVE_LOOKUP Lookup)
+/*++
+Routine Description:
+    Fills in a negative lookup entry for the subkey Name of ParentKcb.
+    The ConvKey is computed the same way CmpCreateKeyControlBlock computes it for the subkey kcb.
+Arguments:
+    ParentKcb - Supplies the kcb of the key the name was looked up under.
+    Name - Supplies the subkey name (a single path component).
+    Lookup - Returns the entry.
+Return Value:
+    FALSE if the name cannot be cached.
+--*/
+{
+    ULONG ConvKey;
+    ULONG i;
+
+    if ((Name->Length == 0) || (Name->Length > CM_NEGATIVE_NAME_LENGTH * sizeof(WCHAR))) {
+        return FALSE;
+    }
+
+    ConvKey = ParentKcb->ConvKey;
+    for (i=0; i<Name->Length/sizeof(WCHAR); i++) {
+        if (Name->Buffer[i] == OBJ_NAME_PATH_SEPARATOR) {
+            return FALSE;
+        }
+        Lookup->Name[i] = RtlUpcaseUnicodeChar(Name->Buffer[i]);
+        ConvKey = 37 * ConvKey + (ULONG)Lookup->Name[i];
+    }
+
+    Lookup->ParentKcb = ParentKcb;
+    Lookup->ConvKey = ConvKey;
+    Lookup->NameLength = Name->Length;
+    return TRUE;
+}
+
+
+BOOLEAN CmpFindNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name)
+/*++
+Routine Description:
+    Checks whether the subkey Name of ParentKcb is cached as nonexistent.  The KCB lock must be held.
+Arguments:
+    ParentKcb - Supplies the kcb of the key to look under.
+    Name - Supplies the subkey name.
+Return Value:
+    TRUE if the subkey is known not to exist.
+--*/
+{
+    CM_NEGATIVE_LOOKUP Lookup;
+    PCM_NEGATIVE_LOOKUP Entry;
+
+    if (!(ParentKcb->ExtFlags & CM_KCB_NEGATIVE_CACHED) || !CmpBuildNegativeLookup(ParentKcb, Name, &Lookup)) {
+        return FALSE;
+    }
+
+    Entry = &CmpNegativeCache[HASH_KEY(Lookup.ConvKey) % CM_NEGATIVE_CACHE_SIZE];
+    if ((Entry->ParentKcb == ParentKcb) &&
+        (Entry->ConvKey == Lookup.ConvKey) &&
+        (Entry->NameLength == Lookup.NameLength) &&
+        RtlEqualMemory(Entry->Name, Lookup.Name, Lookup.NameLength)) {
+        CmpKcbCacheInformation.NegativeHits += 1;
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+
+VOID CmpAddNegativeLookup(IN PCM_KEY_CONTROL_BLOCK ParentKcb, IN PUNICODE_STRING Name)
+/*++
+Routine Description:
+    Records that the subkey Name of ParentKcb does not exist, replacing whatever entry used the same slot.
+    The KCB lock must be held.
+Arguments:
+    ParentKcb - Supplies the kcb of the key the lookup failed under.
+    Name - Supplies the subkey name that was not found.
+--*/
+{
+    CM_NEGATIVE_LOOKUP Lookup;
+    PCM_NEGATIVE_LOOKUP Entry;
+
+    if (ParentKcb->Delete || (ParentKcb->Flags & KEY_SYM_LINK) || !CmpBuildNegativeLookup(ParentKcb, Name, &Lookup)) {
+        return;
+    }
+
+    Entry = &CmpNegativeCache[HASH_KEY(Lookup.ConvKey) % CM_NEGATIVE_CACHE_SIZE];
+    if (Entry->ParentKcb == NULL) {
+        CmpKcbCacheInformation.NegativeEntries += 1;
+    }
+
+    // The kcb that owned a replaced entry keeps CM_KCB_NEGATIVE_CACHED; that only costs it a scan later.
+    Entry->ParentKcb = ParentKcb;
+    Entry->ConvKey = Lookup.ConvKey;
+    Entry->NameLength = Lookup.NameLength;
+    RtlCopyMemory(Entry->Name, Lookup.Name, Lookup.NameLength);
+
+    ParentKcb->ExtFlags |= CM_KCB_NEGATIVE_CACHED;
+    CmpKcbCacheInformation.NegativeInserts += 1;
+}
+
+
+VOID CmpRemoveNegativeLookups(IN PCM_KEY_CONTROL_BLOCK ParentKcb)
+/*++
+Routine Description:
+    Purges all negative lookup entries for subkeys of ParentKcb.
+    Either the registry is locked exclusively or the KCB lock is held.
+Arguments:
+    ParentKcb - Supplies the kcb whose entries are purged.
+--*/
+{
+    ULONG i;
+
+    if (!(ParentKcb->ExtFlags & CM_KCB_NEGATIVE_CACHED)) {
+        return;
+    }
+
+    for (i=0; i<CM_NEGATIVE_CACHE_SIZE; i++) {
+        if (CmpNegativeCache[i].ParentKcb == ParentKcb) {
+            CmpNegativeCache[i].ParentKcb = NULL;
+            CmpKcbCacheInformation.NegativeEntries -= 1;
+            CmpKcbCacheInformation.NegativeInvalidations += 1;
+        }
+    }
+
+    ParentKcb->ExtFlags &= ~CM_KCB_NEGATIVE_CACHED;
+}
+
+
+VOID CmQueryKcbCacheInformation(OUT PCM_KCB_CACHE_INFORMATION KcbCacheInformation)
+/*++
+Routine Description:
+    Returns the kcb cache counters along with the current hash table size and chain lengths.
+Arguments:
+    KcbCacheInformation - Supplies pointer to buffer that will return the kcb cache information.
+--*/
+{
+    CM_KCB_CACHE_INFORMATION Information;
+    PCM_KEY_HASH Current;
+    ULONG Length;
+    ULONG i;
+
+    PAGED_CODE();
+
+    CmpLockRegistry();
+    LOCK_KCB_TREE();
+
+    Information = CmpKcbCacheInformation;
+    Information.HashTableSize = CmpHashTableSize;
+    Information.MaximumHashTableSize = CmpMaximumHashTableSize;
+    Information.NegativeCacheSize = CM_NEGATIVE_CACHE_SIZE;
+    Information.UsedBuckets = 0;
+    Information.LongestChain = 0;
+
+    for (i=0; i<CmpHashTableSize; i++) {
+        Length = 0;
+        for (Current = CmpCacheTable[i]; Current != NULL; Current = Current->NextHash) {
+            Length += 1;
+        }
+
+        if (Length != 0) {
+            Information.UsedBuckets += 1;
+            if (Length > Information.LongestChain) {
+                Information.LongestChain = Length;
+            }
+        }
+    }
+
+    UNLOCK_KCB_TREE();
+    CmpUnlockRegistry();
+
+    *KcbCacheInformation = Information;
+}
+
+
 VOID CmpInitializeCache()
 {
     ULONG TotalCmCacheSize;
@@ -1069,7 +1311,7 @@ VOID CmpInitializeCache()
     }
     RtlZeroMemory(CmpCacheTable, TotalCmCacheSize);
 
-    TotalCmCacheSize = CmpHashTableSize * sizeof(PCM_NAME_HASH);
+    TotalCmCacheSize = CmpNameHashTableSize * sizeof(PCM_NAME_HASH);
     CmpNameCacheTable = ExAllocatePoolWithTag(PagedPool, TotalCmCacheSize, 'aCMC');
     if (CmpNameCacheTable == NULL) {
         KeBugCheckEx(CONFIG_INITIALIZATION_FAILED,6,1,0,0);
@@ -1077,6 +1319,14 @@ VOID CmpInitializeCache()
     }
     RtlZeroMemory(CmpNameCacheTable, TotalCmCacheSize);
 
+    TotalCmCacheSize = CM_NEGATIVE_CACHE_SIZE * sizeof(CM_NEGATIVE_LOOKUP);
+    CmpNegativeCache = ExAllocatePoolWithTag(PagedPool, TotalCmCacheSize, CM_NEGATIVE_TAG);
+    if (CmpNegativeCache == NULL) {
+        KeBugCheckEx(CONFIG_INITIALIZATION_FAILED,6,3,0,0);
+        return;
+    }
+    RtlZeroMemory(CmpNegativeCache, TotalCmCacheSize);
+
     CmpDelayedCloseTable = ExAllocatePoolWithTag(PagedPool, CmpDelayedCloseSize * sizeof(PCM_KEY_CONTROL_BLOCK), 'cDMC');
     if (CmpDelayedCloseTable == NULL) {
         KeBugCheckEx(CONFIG_INITIALIZATION_FAILED,6,2,0,0);
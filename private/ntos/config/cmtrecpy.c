@@ -818,10 +818,11 @@ Return Value:
 
         psrclist = HvGetCell(SourceHive, psrckey->u.KeyNode.ValueList.List);
 
-        newlist = HvAllocateCell(
+        newlist = HvAllocateCellNear(
                     TargetHive,
                     count * sizeof(HCELL_INDEX),
-                    Type
+                    Type,
+                    newkey
                     );
         if (newlist == HCELL_NIL) {
             goto DoFinally;
@@ -1440,10 +1441,11 @@ Return Value:
 
         psrclist = HvGetCell(SourceHive, SourceKeyNode->ValueList.List);
 
-        newlist = HvAllocateCell(
+        newlist = HvAllocateCellNear(
                     TargetHive,
                     count * sizeof(HCELL_INDEX),
-                    Type
+                    Type,
+                    TargetKeyCell
                     );
         if (newlist == HCELL_NIL) {
             goto EndValueSync;
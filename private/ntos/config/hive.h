@@ -108,6 +108,13 @@ HvpHeaderCheckSum(
     PHBASE_BLOCK    BaseBlock
     );
 
+ULONG
+HvpLogRecordCheckSum(
+    ULONG   Sum,
+    PVOID   Buffer,
+    ULONG   Length
+    );
+
 NTSTATUS
 HvpBuildMap(
     PHHIVE  Hive,
@@ -226,6 +233,11 @@ HvSyncHive(
     PHHIVE  Hive
     );
 
+BOOLEAN
+HvCommitHive(
+    PHHIVE  Hive
+    );
+
 NTSTATUS
 HvWriteHive(
     PHHIVE  Hive
@@ -311,6 +323,14 @@ HvAllocateCell(
     HSTORAGE_TYPE   Type
     );
 
+HCELL_INDEX
+HvAllocateCellNear(
+    PHHIVE          Hive,
+    ULONG           NewSize,
+    HSTORAGE_TYPE   Type,
+    HCELL_INDEX     Vicinity
+    );
+
 VOID
 HvFreeCell(
     PHHIVE      Hive,
@@ -88,6 +88,7 @@ Return Value:
     ULONG           i;
     ULONG           j;
     PULONG          NewVector;
+    PULONG          NewCommitVector;
     PLIST_ENTRY     Entry;
     PFREE_HBIN      FreeBin;
     ULONG           TotalDiscardedSize;
@@ -163,8 +164,12 @@ Retry:
         // No sufficiently large discarded bin was found,
         // but the total discarded space is large enough.
         // Attempt to coalesce adjacent discarded bins into
-        // a larger bin and retry.
+        // a larger bin and retry.  Coalesced bins do not match the
+        // layout of the primary, so stop appending commit records.
 
+        if (Type == Stable) {
+            Hive->LogAppend = FALSE;
+        }
         if (HvpCoalesceDiscardedBins(Hive, NewSize, Type)) {
             goto Retry;
         }
@@ -319,14 +324,43 @@ Retry:
     if ((Type == Stable) && (!(Hive->HiveFlags & HIVE_VOLATILE))) {
 
 
-        // Grow the dirtyvector
+        // The primary has no room for the new bin, so commit records
+        // can no longer be replayed against it.  Sync before appending more.
+
+        Hive->LogAppend = FALSE;
+
+
+        // Grow the dirtyvector and the commit vector
 
         NewVector = (PULONG)(Hive->Allocate)(ROUND_UP(NewMap+1,sizeof(ULONG)), TRUE);
         if (NewVector == NULL) {
             goto ErrorExit3;
         }
 
+        NewCommitVector = (PULONG)(Hive->Allocate)(ROUND_UP(NewMap+1,sizeof(ULONG)), TRUE);
+        if (NewCommitVector == NULL) {
+            (Hive->Free)(NewVector, NewMap+1);
+            goto ErrorExit3;
+        }
+
         RtlZeroMemory(NewVector, NewMap+1);
+        RtlZeroMemory(NewCommitVector, NewMap+1);
+
+        if (Hive->CommitVector.Buffer != NULL) {
+
+            RtlCopyMemory(
+                (PVOID)NewCommitVector,
+                (PVOID)Hive->CommitVector.Buffer,
+                OldMap+1
+                );
+            (Hive->Free)(Hive->CommitVector.Buffer, Hive->DirtyAlloc);
+        }
+
+        RtlInitializeBitMap(
+            &(Hive->CommitVector),
+            NewCommitVector,
+            NewLength / HSECTOR_SIZE
+            );
 
         if (Hive->DirtyVector.Buffer != NULL) {
 
@@ -417,6 +451,9 @@ ErrorExit4:
                         NewVector,
                         OldLength / HSECTOR_SIZE);
     Hive->DirtyCount = RtlNumberOfSetBits(&Hive->DirtyVector);
+    RtlInitializeBitMap(&Hive->CommitVector,
+                        NewCommitVector,
+                        OldLength / HSECTOR_SIZE);
 
 ErrorExit3:
     Hive->Storage[Type].Length = OldLength;
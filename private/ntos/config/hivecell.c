@@ -36,6 +36,24 @@ HCELL_INDEX
 HvpDoAllocateCell(
     PHHIVE          Hive,
     ULONG           NewSize,
+    HSTORAGE_TYPE   Type,
+    HCELL_INDEX     Vicinity
+    );
+
+HCELL_INDEX
+HvpFindFreeCellInBin(
+    PHHIVE          Hive,
+    HCELL_INDEX     Vicinity,
+    ULONG           NewSize,
+    HSTORAGE_TYPE   Type
+    );
+
+VOID
+HvpUnlinkFreeCell(
+    PHHIVE          Hive,
+    HCELL_INDEX     Prev,
+    PHCELL          Pcell,
+    ULONG           Index,
     HSTORAGE_TYPE   Type
     );
 
@@ -98,6 +116,13 @@ extern CCHAR KiFindFirstSetLeft[256];
         }                                                               \
     }
 
+// Number of cells large enough for a request that are looked at on an
+// exponential free list before the smallest of them is taken, and the
+// number of cells walked in a bin looking for room near a given cell.
+
+#define HV_BEST_FIT_SCAN        8
+#define HV_VICINITY_SCAN        256
+
 #define ONE_K   1024
 
 //  Double requests bigger  than 1KB
@@ -131,7 +156,10 @@ extern CCHAR KiFindFirstSetLeft[256];
 #pragma alloc_text(PAGE,HvpGetCellMap)
 #pragma alloc_text(PAGE,HvGetCellSize)
 #pragma alloc_text(PAGE,HvAllocateCell)
+#pragma alloc_text(PAGE,HvAllocateCellNear)
 #pragma alloc_text(PAGE,HvpDoAllocateCell)
+#pragma alloc_text(PAGE,HvpFindFreeCellInBin)
+#pragma alloc_text(PAGE,HvpUnlinkFreeCell)
 #pragma alloc_text(PAGE,HvFreeCell)
 #pragma alloc_text(PAGE,HvpIsFreeNeighbor)
 #pragma alloc_text(PAGE,HvpEnlistFreeCell)
@@ -412,13 +440,50 @@ Return Value:
 
     New HCELL_INDEX if success, HCELL_NIL if failure.
 
+--*/
+{
+    return HvAllocateCellNear(Hive, NewSize, Type, HCELL_NIL);
+}
+
+
+HCELL_INDEX
+HvAllocateCellNear(
+    PHHIVE          Hive,
+    ULONG           NewSize,
+    HSTORAGE_TYPE   Type,
+    HCELL_INDEX     Vicinity
+    )
+/*++
+
+Routine Description:
+
+    Allocates the space and the cell index for a new cell, preferring
+    free space in the same bin as Vicinity.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    NewSize - size in bytes of the cell to allocate
+
+    Type - indicates whether Stable or Volatile storage is desired.
+
+    Vicinity - supplies a cell the new cell will be used with (its
+            parent key, say), or HCELL_NIL.  Cells of the other storage
+            type are ignored.
+
+Return Value:
+
+    New HCELL_INDEX if success, HCELL_NIL if failure.
+
 --*/
 {
     HCELL_INDEX NewCell;
 
     CMLOG(CML_MAJOR, CMS_HIVE) {
-        KdPrint(("HvAllocateCell:\n"));
-        KdPrint(("\tHive=%08lx NewSize=%08lx\n",Hive,NewSize));
+        KdPrint(("HvAllocateCellNear:\n"));
+        KdPrint(("\tHive=%08lx NewSize=%08lx Vicinity=%08lx\n",Hive,NewSize,Vicinity));
     }
     ASSERT(Hive->Signature == HHIVE_SIGNATURE);
     ASSERT(Hive->ReadOnly == FALSE);
@@ -448,7 +513,7 @@ Return Value:
 
     // Do the actual storage allocation
 
-    NewCell = HvpDoAllocateCell(Hive, NewSize, Type);
+    NewCell = HvpDoAllocateCell(Hive, NewSize, Type, Vicinity);
 
 #if DBG
     if (NewCell != HCELL_NIL) {
@@ -468,7 +533,8 @@ HCELL_INDEX
 HvpDoAllocateCell(
     PHHIVE          Hive,
     ULONG           NewSize,
-    HSTORAGE_TYPE   Type
+    HSTORAGE_TYPE   Type,
+    HCELL_INDEX     Vicinity
     )
 /*++
 
@@ -476,6 +542,17 @@ Routine Description:
 
     Allocates space in the hive.  Does not affect cell map in any way.
 
+    If Vicinity is supplied, the bin holding it is searched first for
+    the smallest free cell large enough, so that cells which are used
+    together (a key and its values, say) end up in the same page.
+    Otherwise, or if that bin has no room, the free display is searched.
+    The linear lists hold cells of a single size, so the first cell on
+    the first non-empty list that fits is an exact or best fit.  The
+    exponential lists hold a range of sizes, so up to HV_BEST_FIT_SCAN
+    cells that fit are looked at and the smallest is taken, which leaves
+    larger cells for larger requests instead of cracking them.  A new bin
+    is added only if no list holds a cell large enough.
+
 Arguments:
 
     Hive - supplies a pointer to the hive control structure for the
@@ -485,6 +562,9 @@ Arguments:
 
     Type - indicates whether Stable or Volatile storage is desired.
 
+    Vicinity - supplies a cell the new cell should be placed near, or
+            HCELL_NIL if there is no preference.
+
 Return Value:
 
     HCELL_INDEX of new cell, HCELL_NIL if failure
@@ -497,6 +577,11 @@ Return Value:
     PHCELL      pcell;
     HCELL_INDEX tcell;
     PHCELL      ptcell;
+    HCELL_INDEX prev;
+    HCELL_INDEX bestcell;
+    HCELL_INDEX bestprev;
+    PHCELL      pbestcell;
+    ULONG       Scanned;
     PHBIN       Bin;
     PHMAP_ENTRY Me;
     ULONG       offset;
@@ -511,6 +596,28 @@ Return Value:
     ASSERT(Hive->ReadOnly == FALSE);
 
 
+    // Try the bin of the cell we were asked to allocate near first.
+
+    if ((Vicinity != HCELL_NIL) &&
+        (HvGetCellType(Vicinity) == (ULONG)Type) &&
+        (Hive->Flat == FALSE)) {
+
+        cell = HvpFindFreeCellInBin(Hive, Vicinity, NewSize, Type);
+        if (cell != HCELL_NIL) {
+
+            if (! HvMarkCellDirty(Hive, cell)) {
+                return HCELL_NIL;
+            }
+
+            pcell = HvpGetHCell(Hive, cell);
+            HvpDelistFreeCell(Hive, pcell, Type, NULL);
+
+            ASSERT(pcell->Size > 0);
+            ASSERT(NewSize <= (ULONG)pcell->Size);
+            goto UseIt;
+        }
+    }
+
 
     // Compute Index into Display
 
@@ -525,9 +632,9 @@ Return Value:
 
     // We now have a summary of lists that are non-null and may
     // contain entries large enough to satisfy the request.
-    // Iterate through the list and pull the first cell that is
-    // big enough.  If no cells are big enough, advance to the
-    // next non-null list.
+    // Iterate through the list and pick the best of the first few
+    // cells that are big enough.  If no cells are big enough, advance
+    // to the next non-null list.
 
 
     ASSERT(HHIVE_FREE_DISPLAY_SIZE == 24);
@@ -542,14 +649,19 @@ Return Value:
         }
 
 
-        // Walk through the list until we find a cell large enough
-        // to satisfy the allocation.  If we find one, pull it from
-        // the list and use it.  If we don't find one, clear this
-        // list's bit in the Summary and try the next larger list.
-
+        // Walk through the list remembering the smallest cell large
+        // enough to satisfy the allocation, and the cell before it so
+        // it can be unlinked without walking the list again.  Stop at
+        // an exact fit, at the first fit on a linear list (its cells
+        // are all one size) or after HV_BEST_FIT_SCAN candidates.
+        // If we don't find one, clear this list's bit in the Summary
+        // and try the next larger list.
 
-
-        // look for a large enough cell in the list
+        bestcell = HCELL_NIL;
+        bestprev = HCELL_NIL;
+        pbestcell = NULL;
+        prev = HCELL_NIL;
+        Scanned = 0;
 
         cell = Hive->Storage[Type].FreeDisplay[Index];
         while (cell != HCELL_NIL) {
@@ -558,26 +670,44 @@ Return Value:
 
             if (NewSize <= (ULONG)pcell->Size) {
 
-
-                // Found a big enough cell.
-
-                if (! HvMarkCellDirty(Hive, cell)) {
-                    return HCELL_NIL;
+                if ((pbestcell == NULL) || (pcell->Size < pbestcell->Size)) {
+                    bestcell = cell;
+                    bestprev = prev;
+                    pbestcell = pcell;
                 }
 
-                HvpDelistFreeCell(Hive, pcell, Type, NULL);
-
-                ASSERT(pcell->Size > 0);
-                ASSERT(NewSize <= (ULONG)pcell->Size);
-                goto UseIt;
+                Scanned += 1;
+                if ((NewSize == (ULONG)pcell->Size) ||
+                    (Index < HHIVE_LINEAR_INDEX) ||
+                    (Scanned >= HV_BEST_FIT_SCAN)) {
+                    break;
+                }
             }
-//            DbgPrint("cell %08lx (%lx) too small (%d < %d), trying next at",cell,pcell,pcell->Size,NewSize);
+
+            prev = cell;
             if (USE_OLD_CELL(Hive)) {
                 cell = pcell->u.OldCell.u.Next;
             } else {
                 cell = pcell->u.NewCell.u.Next;
             }
-//          DbgPrint(" %08lx\n",cell);
+        }
+
+        if (pbestcell != NULL) {
+
+
+            // Found a big enough cell.
+
+            if (! HvMarkCellDirty(Hive, bestcell)) {
+                return HCELL_NIL;
+            }
+
+            cell = bestcell;
+            pcell = pbestcell;
+            HvpUnlinkFreeCell(Hive, bestprev, pcell, Index, Type);
+
+            ASSERT(pcell->Size > 0);
+            ASSERT(NewSize <= (ULONG)pcell->Size);
+            goto UseIt;
         }
 
 
@@ -585,10 +715,8 @@ Return Value:
         // Clear the bit in the summary and try the
         // next biggest list.
 
-//        DbgPrint("No suitable cell, Index %d, Summary %08lx -> ",Index, Summary);
         ASSERT(Summary & (1 << Index));
         Summary = Summary & ~(1 << Index);
-//        DbgPrint("%08lx\n",Summary);
     }
 
     if (Summary == 0) {
@@ -689,6 +817,148 @@ UseIt:
 
 
 
+HCELL_INDEX
+HvpFindFreeCellInBin(
+    PHHIVE          Hive,
+    HCELL_INDEX     Vicinity,
+    ULONG           NewSize,
+    HSTORAGE_TYPE   Type
+    )
+/*++
+
+Routine Description:
+
+    Looks for the smallest free cell of at least NewSize bytes in the
+    bin that holds Vicinity.  At most HV_VICINITY_SCAN cells are looked
+    at, so large bins are only partly searched.  The cell is left on its
+    free list.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    Vicinity - supplies a cell in the bin to search
+
+    NewSize - size in bytes of the cell needed, including overhead
+
+    Type - storage type of Vicinity
+
+Return Value:
+
+    HCELL_INDEX of the free cell, HCELL_NIL if the bin has none that is
+    large enough.
+
+--*/
+{
+    PHMAP_ENTRY Me;
+    PHBIN       Bin;
+    PHCELL      pcell;
+    PHCELL      pbest;
+    PUCHAR      End;
+    ULONG       Scanned;
+
+    Me = HvpGetCellMap(Hive, Vicinity);
+    if ((Me == NULL) || (Me->BinAddress & HMAP_DISCARDABLE)) {
+        return HCELL_NIL;
+    }
+    Bin = (PHBIN)(Me->BinAddress & HMAP_BASE);
+    End = (PUCHAR)Bin + Bin->Size;
+
+    pbest = NULL;
+    pcell = (PHCELL)(Bin + 1);
+    for (Scanned = 0; (Scanned < HV_VICINITY_SCAN) && ((PUCHAR)pcell < End); Scanned += 1) {
+
+        if (pcell->Size > 0) {
+
+            if ((NewSize <= (ULONG)pcell->Size) &&
+                ((pbest == NULL) || (pcell->Size < pbest->Size))) {
+                pbest = pcell;
+                if (NewSize == (ULONG)pcell->Size) {
+                    break;
+                }
+            }
+            pcell = (PHCELL)((PUCHAR)pcell + pcell->Size);
+
+        } else if (pcell->Size < 0) {
+            pcell = (PHCELL)((PUCHAR)pcell - pcell->Size);
+
+        } else {
+
+            // A zero size would loop forever; the bin is bad, so
+            // leave it to the normal path.
+
+            return HCELL_NIL;
+        }
+    }
+
+    if (pbest == NULL) {
+        return HCELL_NIL;
+    }
+
+    return Bin->FileOffset + (ULONG)((PUCHAR)pbest - (PUCHAR)Bin) + (Type * HCELL_TYPE_MASK);
+}
+
+
+VOID
+HvpUnlinkFreeCell(
+    PHHIVE          Hive,
+    HCELL_INDEX     Prev,
+    PHCELL          Pcell,
+    ULONG           Index,
+    HSTORAGE_TYPE   Type
+    )
+/*++
+
+Routine Description:
+
+    Removes a free cell from its list when the cell before it is already
+    known, and clears the Summary bit for the list if it is now empty.
+    This is HvpDelistFreeCell without the walk to find Prev.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    Prev - supplies the cell before Pcell on the list, or HCELL_NIL if
+            Pcell is at the head
+
+    Pcell - supplies a pointer to the HCELL structure to remove
+
+    Index - supplies the index of the list in the free display
+
+    Type - Stable vs. Volatile
+
+Return Value:
+
+    NONE.
+
+--*/
+{
+    PHCELL_INDEX List;
+
+    if (Prev == HCELL_NIL) {
+        List = &(Hive->Storage[Type].FreeDisplay[Index]);
+    } else {
+        List = (PHCELL_INDEX)HvGetCell(Hive, Prev);
+    }
+    ASSERT(HvpGetHCell(Hive, *List) == Pcell);
+
+    if (USE_OLD_CELL(Hive)) {
+        *List = Pcell->u.OldCell.u.Next;
+    } else {
+        *List = Pcell->u.NewCell.u.Next;
+    }
+
+    if (Hive->Storage[Type].FreeDisplay[Index] == HCELL_NIL) {
+        Hive->Storage[Type].FreeSummary &= ~(1 << Index);
+    }
+}
+
+
+
+
 VOID
 HvFreeCell(
     PHHIVE      Hive,
@@ -1426,7 +1696,7 @@ Return Value:
         // Allocate a new block of memory to hold the cell
 
 
-        if ((NewCell = HvpDoAllocateCell(Hive, NewSize, Type)) == HCELL_NIL) {
+        if ((NewCell = HvpDoAllocateCell(Hive, NewSize, Type, Cell)) == HCELL_NIL) {
             return HCELL_NIL;
         }
         ASSERT(HvIsCellAllocated(Hive, NewCell));
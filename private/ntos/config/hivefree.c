@@ -152,6 +152,10 @@ Return Value:
         CmpFree((PVOID)(Hive->DirtyVector.Buffer), Hive->DirtyAlloc);
     }
 
+    if (Hive->CommitVector.Buffer != NULL) {
+        CmpFree((PVOID)(Hive->CommitVector.Buffer), Hive->DirtyAlloc);
+    }
+
     return;
 }
 
@@ -260,6 +264,7 @@ Return Value:
         ASSERT(Hive->DirtyCount == RtlNumberOfSetBits(&Hive->DirtyVector));
         RtlClearBits(&Hive->DirtyVector, FirstBit, LastBit-FirstBit);
         Hive->DirtyCount = RtlNumberOfSetBits(&Hive->DirtyVector);
+        RtlClearBits(&Hive->CommitVector, FirstBit, LastBit-FirstBit);
     }
 
     return;
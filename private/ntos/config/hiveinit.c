@@ -381,6 +381,11 @@ Return Value:
     Hive->DirtyAlloc = 0;
     Hive->LogSize = 0;
 
+    RtlInitializeBitMap(&(Hive->CommitVector), NULL, 0);
+    Hive->LogAppend = FALSE;
+    Hive->LogRecordCount = 0;
+    Hive->LogRecordLength = 0;
+
     Hive->GetCellRoutine = HvpGetCellPaged;
     Hive->Flat = FALSE;
     Hive->ReadOnly = FALSE;
@@ -622,11 +627,18 @@ Return Value:
 
             RtlClearAllBits(&(Hive->DirtyVector));
             Hive->DirtyCount = 0;
+            RtlClearAllBits(&(Hive->CommitVector));
             (Hive->FileSetSize)(Hive, HFILE_TYPE_LOG, 0);
             Hive->LogSize = 0;
         }
 
 
+        // The bins in memory now match the primary, so flushes may
+        // append commit records to the log until the layout changes.
+
+        Hive->LogAppend = Hive->Log;
+
+
         // slam debug name data into base block
 
         HvpFillFileName(Hive->BaseBlock, FileName);
@@ -39,7 +39,8 @@ typedef enum _RESULT {
     NoMemory,
     HiveSuccess,
     RecoverHeader,
-    RecoverData
+    RecoverData,
+    RecoverRecords
 } RESULT;
 
 RESULT
@@ -63,6 +64,28 @@ HvpRecoverData(
     PHCELL_INDEX    TailDisplay OPTIONAL
     );
 
+RESULT
+HvpGetLogRecord(
+    PHHIVE          Hive,
+    PHBASE_BLOCK    BaseBlock,
+    ULONG           FileOffset,
+    ULONG           RecordIndex,
+    PHLOG_RECORD    *Record
+    );
+
+RESULT
+HvpRecoverRecords(
+    PHHIVE          Hive,
+    BOOLEAN         ReadOnly,
+    PHCELL_INDEX    TailDisplay OPTIONAL
+    );
+
+BOOLEAN
+HvpEnlistHiveFreeCells(
+    PHHIVE          Hive,
+    PHCELL_INDEX    TailDisplay OPTIONAL
+    );
+
 NTSTATUS
 HvpReadFileImageAndBuildMap(
                             PHHIVE  Hive,
@@ -83,6 +106,9 @@ HvpDelistBinFreeCells(
 #pragma alloc_text(PAGE,HvpGetHiveHeader)
 #pragma alloc_text(PAGE,HvpGetLogHeader)
 #pragma alloc_text(PAGE,HvpRecoverData)
+#pragma alloc_text(PAGE,HvpGetLogRecord)
+#pragma alloc_text(PAGE,HvpRecoverRecords)
+#pragma alloc_text(PAGE,HvpEnlistHiveFreeCells)
 #pragma alloc_text(PAGE,HvpReadFileImageAndBuildMap)
 #endif
 
@@ -129,12 +155,20 @@ Routine Description:
                 return failure
             fix up baseblock
 
+        if (HiveSuccess) and (log) and (log holds a valid commit
+            record for this primary)
+            RecoverRecords
+
         Read Data
 
         if (RecoverData or RecoverHeader)
             HvpRecoverData
             return STATUS_REGISTRY_RECOVERED
 
+        if (RecoverRecords)
+            HvpRecoverRecords
+            return STATUS_REGISTRY_RECOVERED
+
         clean up sequence numbers
 
         return success OR STATUS_REGISTRY_RECOVERED
@@ -180,6 +214,7 @@ Return Value:
     ULONG           FileOffset;
     PHBIN           pbin;
     BOOLEAN         ReadOnlyFlagCopy;
+    PHLOG_RECORD    Record;
 
     ASSERT(Hive->Signature == HHIVE_SIGNATURE);
 
@@ -201,10 +236,27 @@ Return Value:
 
     ReadOnlyFlagCopy = Hive->ReadOnly;
 
+
+    // the primary may be intact but older than commit records that
+    // were appended to the log since it was written
+
+    if ((result1 == HiveSuccess) && (Hive->Log == TRUE)) {
+        result2 = HvpGetLogRecord(Hive, BaseBlock, Hive->Cluster * HSECTOR_SIZE, 0, &Record);
+        if (result2 == NoMemory) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit1;
+        }
+        if (result2 == HiveSuccess) {
+            ExFreePool(Record);
+            result1 = RecoverRecords;
+        }
+    }
+
     // if recovery needed, and no log, bomb out
 
     if ( ((result1 == RecoverData) ||
-          (result1 == RecoverHeader)) )
+          (result1 == RecoverHeader) ||
+          (result1 == RecoverRecords)) )
     {
 
         // recovery needed
@@ -282,6 +334,19 @@ Return Value:
         status = STATUS_REGISTRY_RECOVERED;
     }
 
+    if (result1 == RecoverRecords) {
+        result2 = HvpRecoverRecords(Hive,ReadOnlyFlagCopy,TailDisplay);
+        if (result2 == NoMemory) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+            goto Exit2;
+        }
+        if (result2 == Fail) {
+            status = STATUS_REGISTRY_CORRUPT;
+            goto Exit2;
+        }
+        status = STATUS_REGISTRY_RECOVERED;
+    }
+
     BaseBlock->Sequence2 = BaseBlock->Sequence1;
     return status;
 
@@ -908,6 +973,8 @@ Return Value:
     RTL_BITMAP  BitMap;
     ULONG       Length;
     ULONG       DirtyVectorSignature = 0;
+    ULONG       RecordOffset;
+    HLOG_RECORD RecordHeader;
     ULONG       i;
     PHMAP_ENTRY Me;
     PHBIN       Bin;
@@ -930,19 +997,37 @@ Return Value:
     FileOffset = ClusterSize;
 
 
-    // get and check signature
+    // get and check signature.  The dirty vector follows any commit
+    // records that were in the log when it was written.
 
-    rc = (Hive->FileRead)(
-            Hive,
-            HFILE_TYPE_LOG,
-            &FileOffset,
-            (PVOID)&DirtyVectorSignature,
-            sizeof(DirtyVectorSignature)
-            );
-    if (rc == FALSE) {
-        return Fail;
+    while (TRUE) {
+        RecordOffset = FileOffset;
+        rc = (Hive->FileRead)(
+                Hive,
+                HFILE_TYPE_LOG,
+                &FileOffset,
+                (PVOID)&RecordHeader,
+                sizeof(RecordHeader)
+                );
+        if (rc == FALSE) {
+            return Fail;
+        }
+
+        if (RecordHeader.Signature != HLOG_RECORD_SIGNATURE) {
+            break;
+        }
+
+        if ((RecordHeader.Length == 0) ||
+            ((RecordHeader.Length % ClusterSize) != 0) ||
+            (RecordHeader.Length > HLOG_RECORD_LIMIT)) {
+            return Fail;
+        }
+        FileOffset = RecordOffset + RecordHeader.Length;
     }
 
+    DirtyVectorSignature = RecordHeader.Signature;
+    FileOffset = RecordOffset + sizeof(DirtyVectorSignature);
+
     if (DirtyVectorSignature != HLOG_DV_SIGNATURE) {
         return Fail;
     }
@@ -1236,28 +1321,8 @@ Return Value:
 
         // no point going through this loop if the hive is read-only
 
-        Address = 0;
-        while( Address < Hive->BaseBlock->Length ) {
-            Me = HvpGetCellMap(Hive, Address);
-            VALIDATE_CELL_MAP(__LINE__,Me,Hive,Address);
-            Bin = (PHBIN)(Me->BinAddress & HMAP_BASE);
-
-            ASSERT( Bin->FileOffset == Address );
-            ASSERT( Bin->Signature == HBIN_SIGNATURE );
-
-
-            // add free cells in the bin to the appropriate free lists
-
-            if ( ! HvpEnlistFreeCells(Hive, Bin, Address,TailDisplay)) {
-                HvCheckHiveDebug.Hive = Hive;
-                HvCheckHiveDebug.Status = 0xA004;
-                HvCheckHiveDebug.Space = Bin->Size;
-                HvCheckHiveDebug.MapPoint = Address;
-                HvCheckHiveDebug.BinPoint = Bin;
-                goto ErrorExit;
-            }
-
-            Address += Bin->Size;
+        if ( ! HvpEnlistHiveFreeCells(Hive, TailDisplay)) {
+            goto ErrorExit;
         }
     }
 
@@ -1279,3 +1344,309 @@ ErrorExit:
     return Fail;
 }
 
+
+BOOLEAN
+HvpEnlistHiveFreeCells(
+    PHHIVE          Hive,
+    PHCELL_INDEX    TailDisplay OPTIONAL
+    )
+/*++
+
+Routine Description:
+
+    Add the free cells in every Stable bin to the free lists, once
+    recovery has put the right data in the bins.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    TailDisplay - array containing the tail ends of the free cell lists - optional
+
+Return Value:
+
+    TRUE - it worked
+
+    FALSE - a bin is corrupt
+
+--*/
+{
+    ULONG       Address;
+    PHMAP_ENTRY Me;
+    PHBIN       Bin;
+
+    Address = 0;
+    while( Address < Hive->BaseBlock->Length ) {
+        Me = HvpGetCellMap(Hive, Address);
+        VALIDATE_CELL_MAP(__LINE__,Me,Hive,Address);
+        Bin = (PHBIN)(Me->BinAddress & HMAP_BASE);
+
+        ASSERT( Bin->FileOffset == Address );
+        ASSERT( Bin->Signature == HBIN_SIGNATURE );
+
+
+        // add free cells in the bin to the appropriate free lists
+
+        if ( ! HvpEnlistFreeCells(Hive, Bin, Address,TailDisplay)) {
+            HvCheckHiveDebug.Hive = Hive;
+            HvCheckHiveDebug.Status = 0xA004;
+            HvCheckHiveDebug.Space = Bin->Size;
+            HvCheckHiveDebug.MapPoint = Address;
+            HvCheckHiveDebug.BinPoint = Bin;
+            return FALSE;
+        }
+
+        Address += Bin->Size;
+    }
+
+    return TRUE;
+}
+
+
+RESULT
+HvpGetLogRecord(
+    PHHIVE          Hive,
+    PHBASE_BLOCK    BaseBlock,
+    ULONG           FileOffset,
+    ULONG           RecordIndex,
+    PHLOG_RECORD    *Record
+    )
+/*++
+
+Routine Description:
+
+    Read a commit record from the log and check that it is complete
+    and applies to the primary.  Records written before the primary
+    was last written carry an older sequence number and are rejected.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    BaseBlock - supplies the base block read from the primary
+
+    FileOffset - offset of the record in the log
+
+    RecordIndex - index the record must have
+
+    Record - supplies pointer to variable to receive the record, header
+            vector and data, in a buffer allocated from paged pool
+
+Return Value:
+
+    RESULT
+
+--*/
+{
+    HLOG_RECORD     Header;
+    PHLOG_RECORD    buffer;
+    ULONG           ClusterSize;
+    ULONG           VectorLength;
+    ULONG           DataOffset;
+    ULONG           Offset;
+    ULONG           Sum;
+    RTL_BITMAP      BitMap;
+    BOOLEAN         rc;
+
+    *Record = NULL;
+    ClusterSize = Hive->Cluster * HSECTOR_SIZE;
+    VectorLength = (BaseBlock->Length / HSECTOR_SIZE) / 8;
+    DataOffset = ClusterSize + ROUND_UP(VectorLength, ClusterSize);
+
+    Offset = FileOffset;
+    rc = (Hive->FileRead)(
+            Hive,
+            HFILE_TYPE_LOG,
+            &Offset,
+            (PVOID)&Header,
+            sizeof(Header)
+            );
+
+    if ( (rc == FALSE)                                          ||
+         (Header.Signature != HLOG_RECORD_SIGNATURE)            ||
+         (Header.Sequence != BaseBlock->Sequence2)              ||
+         (Header.Record != RecordIndex)                         ||
+         (Header.HiveLength != BaseBlock->Length)               ||
+         ((Header.DataLength % ClusterSize) != 0)               ||
+         (Header.Length != (DataOffset + Header.DataLength))    ||
+         (Header.Length > HLOG_RECORD_LIMIT)) {
+        return Fail;
+    }
+
+
+    // read the whole record and check it
+
+    buffer = (PHLOG_RECORD)ExAllocatePoolWithTag(PagedPool, Header.Length, CM_POOL_TAG);
+    if (buffer == NULL) {
+        return NoMemory;
+    }
+
+    Offset = FileOffset;
+    rc = (Hive->FileRead)(
+            Hive,
+            HFILE_TYPE_LOG,
+            &Offset,
+            (PVOID)buffer,
+            Header.Length
+            );
+    if (rc == FALSE) {
+        ExFreePool(buffer);
+        return Fail;
+    }
+
+    buffer->CheckSum = 0;
+    Sum = HvpLogRecordCheckSum(0, buffer, sizeof(HLOG_RECORD));
+    Sum = HvpLogRecordCheckSum(Sum, (PUCHAR)buffer + ClusterSize, VectorLength);
+    Sum = HvpLogRecordCheckSum(Sum, (PUCHAR)buffer + DataOffset, Header.DataLength);
+
+    RtlInitializeBitMap(&BitMap, (PULONG)((PUCHAR)buffer + ClusterSize), VectorLength * 8);
+
+    if ( (Sum != Header.CheckSum) ||
+         ((RtlNumberOfSetBits(&BitMap) * HSECTOR_SIZE) != Header.DataLength) ) {
+
+        // record was only partly written
+
+        ExFreePool(buffer);
+        return Fail;
+    }
+
+    buffer->CheckSum = Header.CheckSum;
+    *Record = buffer;
+    return HiveSuccess;
+}
+
+
+RESULT
+HvpRecoverRecords(
+    PHHIVE          Hive,
+    BOOLEAN         ReadOnly,
+    PHCELL_INDEX    TailDisplay OPTIONAL
+    )
+/*++
+
+Routine Description:
+
+    Apply the commit records in the log to the hive memory image read
+    from an intact primary, in the order they were written, stopping at
+    the first record that is missing or was only partly written.
+
+    Records are only written while the bins in memory are laid out as
+    in the primary, so each sector is copied to the same offset in the
+    bin that holds it now.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+    ReadOnly - by the time this function is called, the hive is forced to the
+            ready-only state. At the end, if recovery goes OK, we restore the
+            hive at it's original state, and enlist all free cells.
+
+    TailDisplay - array containing the tail ends of the free cell lists - optional
+
+Return Value:
+
+    RESULT
+
+--*/
+{
+    PHLOG_RECORD    Record;
+    ULONG           ClusterSize;
+    ULONG           VectorLength;
+    ULONG           FileOffset;
+    ULONG           RecordIndex;
+    RTL_BITMAP      BitMap;
+    PUCHAR          Source;
+    PUCHAR          SectorImage;
+    ULONG           Address;
+    ULONG           MemAlloc;
+    ULONG           BinSize;
+    PHMAP_ENTRY     Me;
+    PHBIN           Bin;
+    RESULT          result;
+    ULONG           i;
+
+    ClusterSize = Hive->Cluster * HSECTOR_SIZE;
+    VectorLength = (Hive->BaseBlock->Length / HSECTOR_SIZE) / 8;
+    FileOffset = ClusterSize;
+    RecordIndex = 0;
+
+    while (TRUE) {
+        result = HvpGetLogRecord(Hive, Hive->BaseBlock, FileOffset, RecordIndex, &Record);
+        if (result == NoMemory) {
+            return NoMemory;
+        }
+        if (result != HiveSuccess) {
+            break;
+        }
+
+        RtlInitializeBitMap(&BitMap, (PULONG)((PUCHAR)Record + ClusterSize), VectorLength * 8);
+        Source = (PUCHAR)Record + ClusterSize + ROUND_UP(VectorLength, ClusterSize);
+
+        for (i = 0; i < BitMap.SizeOfBitMap; i++) {
+            if (RtlCheckBit(&BitMap, i) == 0) {
+                continue;
+            }
+
+            Address = i * HSECTOR_SIZE;
+            Me = HvpGetCellMap(Hive, Address);
+            VALIDATE_CELL_MAP(__LINE__,Me,Hive,Address);
+            Bin = (PHBIN)(Me->BinAddress & HMAP_BASE);
+            SectorImage = (PUCHAR)Me->BlockAddress + (Address & HCELL_OFFSET_MASK);
+
+            if (Address == Bin->FileOffset) {
+
+                // Bin header: MemAlloc describes the allocation in the
+                // image we built, not the one the record was taken from,
+                // and the bin must not have moved or changed size.
+
+                MemAlloc = Bin->MemAlloc;
+                BinSize = Bin->Size;
+                RtlCopyMemory(SectorImage, Source, HSECTOR_SIZE);
+                Bin->MemAlloc = MemAlloc;
+
+                if ((Bin->Signature != HBIN_SIGNATURE) ||
+                    (Bin->FileOffset != Address) ||
+                    (Bin->Size != BinSize)) {
+                    ExFreePool(Record);
+                    return Fail;
+                }
+            } else {
+                RtlCopyMemory(SectorImage, Source, HSECTOR_SIZE);
+            }
+
+            RtlSetBits(&(Hive->DirtyVector), i, 1);
+            Source += HSECTOR_SIZE;
+        }
+
+        FileOffset += Record->Length;
+        RecordIndex += 1;
+        ExFreePool(Record);
+    }
+
+    CMLOG(CML_MAJOR, CMS_IO) {
+        KdPrint(("HvpRecoverRecords: Hive:%08lx applied %lu records\n", Hive, RecordIndex));
+    }
+
+
+    // enlist free cells and restore the hive to it's original state
+
+    Hive->ReadOnly = ReadOnly;
+
+    if( ReadOnly == FALSE ) {
+        if ( ! HvpEnlistHiveFreeCells(Hive, TailDisplay)) {
+            return Fail;
+        }
+    }
+
+
+    // the recovered sectors are dirty, so that the caller writes them
+    // to the primary
+
+    Hive->DirtyCount = RtlNumberOfSetBits(&Hive->DirtyVector);
+    HvMarkDirty(Hive, 0, sizeof(HBIN));  // force header of 1st bin dirty
+    return HiveSuccess;
+}
@@ -138,6 +138,16 @@ Return Value:
         Hive->DirtyAlloc = (Length/HSECTOR_SIZE/8);
     }
 
+    if (Hive->CommitVector.Buffer == NULL) {
+        Vector = (PULONG)((Hive->Allocate)(ROUND_UP(Length/HSECTOR_SIZE/8,sizeof(ULONG)), TRUE));
+        if (Vector == NULL) {
+            Status = STATUS_NO_MEMORY;
+            goto ErrorExit1;
+        }
+        RtlZeroMemory(Vector, Length / HSECTOR_SIZE / 8);
+        RtlInitializeBitMap(&Hive->CommitVector, Vector, Length / HSECTOR_SIZE);
+    }
+
 
     // allocate and build structure for map
 
@@ -375,6 +385,16 @@ Return Value:
         Hive->DirtyAlloc = (Length/HSECTOR_SIZE/8);
     }
 
+    if (Hive->CommitVector.Buffer == NULL) {
+        Vector = (PULONG)((Hive->Allocate)(ROUND_UP(Length/HSECTOR_SIZE/8,sizeof(ULONG)), TRUE));
+        if (Vector == NULL) {
+            Status = STATUS_NO_MEMORY;
+            goto ErrorExit1;
+        }
+        RtlZeroMemory(Vector, Length / HSECTOR_SIZE / 8);
+        RtlInitializeBitMap(&Hive->CommitVector, Vector, Length / HSECTOR_SIZE);
+    }
+
 
     // allocate and build structure for map
 
@@ -8,7 +8,7 @@ Module Name:
 
 Abstract:
 
-    Hive header checksum module.
+    Hive header and log record checksum module.
 
 Author:
 
@@ -25,6 +25,7 @@ Revision History:
 
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE,HvpHeaderCheckSum)
+#pragma alloc_text(PAGE,HvpLogRecordCheckSum)
 #endif
 
 ULONG
@@ -62,3 +63,48 @@ Return Value:
     }
     return sum;
 }
+
+
+ULONG
+HvpLogRecordCheckSum(
+    ULONG   Sum,
+    PVOID   Buffer,
+    ULONG   Length
+    )
+/*++
+
+Routine Description:
+
+    Fold a buffer into the running checksum of a log commit record.
+    The sum is rotated before each ULONG is folded in, so that sectors
+    written to the wrong place in the record change the result.
+
+Arguments:
+
+    Sum - supplies the checksum of the record so far, 0 to start
+
+    Buffer - supplies pointer to the data to checksum
+
+    Length - supplies length of the data in bytes
+
+Return Value:
+
+    the updated check sum.
+
+--*/
+{
+    PULONG  p;
+    PUCHAR  b;
+    ULONG   i;
+
+    p = (PULONG)Buffer;
+    for (i = 0; i < (Length / sizeof(ULONG)); i++) {
+        Sum = ((Sum << 1) | (Sum >> 31)) ^ p[i];
+    }
+
+    b = (PUCHAR)(p + i);
+    for (i = 0; i < (Length % sizeof(ULONG)); i++) {
+        Sum = ((Sum << 1) | (Sum >> 31)) ^ b[i];
+    }
+    return Sum;
+}
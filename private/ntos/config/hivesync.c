@@ -60,6 +60,13 @@ HvpWriteLog(
     PHHIVE          Hive
     );
 
+BOOLEAN
+HvpWriteLogRecord(
+    PHHIVE          Hive,
+    ULONG           SectorCount,
+    ULONG           RecordLength
+    );
+
 BOOLEAN
 HvpFindNextDirtyBlock(
     PHHIVE          Hive,
@@ -93,6 +100,8 @@ HvRefreshHive(
 #pragma alloc_text(PAGE,HvpGrowLog1)
 #pragma alloc_text(PAGE,HvpGrowLog2)
 #pragma alloc_text(PAGE,HvSyncHive)
+#pragma alloc_text(PAGE,HvCommitHive)
+#pragma alloc_text(PAGE,HvpWriteLogRecord)
 #pragma alloc_text(PAGE,HvpDoWriteHive)
 #pragma alloc_text(PAGE,HvpWriteLog)
 #pragma alloc_text(PAGE,HvpFindNextDirtyBlock)
@@ -284,6 +293,9 @@ Routine Description:
     allocated for them.)  This must be done here rather than in
     HvSyncHive so that we can know how much to grow the log.
 
+    The range is also marked in the CommitVector, whether or not it
+    was already dirty, so that the next commit record will carry it.
+
     This is a noop for Volatile address range.
 
     NOTE:   Range will not be marked dirty if operation fails.
@@ -386,6 +398,8 @@ Return Value:
         RtlSetBits(BitMap, First, Last-First+1);
     }
 
+    RtlSetBits(&(Hive->CommitVector), First, Last-First+1);
+
     // mark this bin as writable
     HvpMarkBinReadWrite(Hive,Start);
 
@@ -484,6 +498,7 @@ Return Value:
             RtlClearBits(BitMap, i, 1);
         }
     }
+    RtlClearBits(&(Hive->CommitVector), First, Last-First+1);
     ASSERT(Hive->DirtyCount == RtlNumberOfSetBits(&Hive->DirtyVector));
 
     return(TRUE);
@@ -544,6 +559,7 @@ Return Value:
 
     RequiredSize =
         ClusterSize  +                                  // 1 cluster for header
+        Hive->LogRecordLength +                         // commit records
         ROUND_UP(tmp, ClusterSize) +
         ((Hive->DirtyCount + Count) * HSECTOR_SIZE);
 
@@ -621,6 +637,7 @@ Return Value:
 
     RequiredSize =
         ClusterSize  +                                  // 1 cluster for header
+        Hive->LogRecordLength +                         // commit records
         (Hive->DirtyCount * HSECTOR_SIZE) +
         DirtyBytes;
 
@@ -660,7 +677,9 @@ Routine Description:
 
     It is possible to write only the primary.
 
-    All dirty bits will be set clear.
+    All dirty bits will be set clear.  Once the primary is written any
+    commit records in the log are obsolete, so new records may again be
+    appended from the start of the log.
 
 Arguments:
 
@@ -767,6 +786,142 @@ Return Value:
     RtlClearAllBits(&(Hive->DirtyVector));
     Hive->DirtyCount = 0;
 
+
+    // Bins in memory now match the primary, start a new set of records
+
+    RtlClearAllBits(&(Hive->CommitVector));
+    Hive->LogRecordCount = 0;
+    Hive->LogRecordLength = 0;
+    Hive->LogAppend = Hive->Log;
+
+    return TRUE;
+}
+
+
+BOOLEAN
+HvCommitHive(
+    PHHIVE  Hive
+    )
+/*++
+
+Routine Description:
+
+    Make all changes to the Stable part of the hive durable, without
+    necessarily writing the primary.
+
+    If the hive has a log and its bins are laid out as in the primary,
+    the sectors changed since the last commit record are appended to
+    the log as a new record, with a single flush.  The primary is
+    brought up to date later by HvSyncHive, normally from the lazy
+    flusher.  Otherwise, or if the records would pass HLOG_RECORD_LIMIT,
+    this is the same as HvSyncHive.
+
+    Callers serialize on the hive lock.  A caller that waited while
+    another one committed usually finds nothing left to write, since
+    its changes went out in the other caller's record.
+
+Arguments:
+
+    Hive - supplies a pointer to the hive control structure for the
+            hive of interest
+
+Return Value:
+
+    TRUE - it worked
+
+    FALSE - some failure.
+
+--*/
+{
+    ULONG   ClusterSize;
+    ULONG   VectorLength;
+    ULONG   SectorCount;
+    ULONG   RecordLength;
+    ULONG   RequiredSize;
+    BOOLEAN oldFlag;
+    BOOLEAN rc;
+
+    CMLOG(CML_WORKER, CMS_IO) {
+        KdPrint(("HvCommitHive:\n\t"));
+        KdPrint(("Hive:%08lx\n", Hive));
+    }
+
+    ASSERT(Hive->Signature == HHIVE_SIGNATURE);
+    ASSERT(Hive->ReadOnly == FALSE);
+
+    if ((Hive->Log == FALSE) ||
+        (Hive->LogAppend == FALSE) ||
+        (Hive->HiveFlags & (HIVE_VOLATILE | HIVE_NOLAZYFLUSH)) ||
+        (HvShutdownComplete)) {
+        return HvSyncHive(Hive);
+    }
+
+
+    // If nothing dirty, or everything dirty is already in a record,
+    // do nothing
+
+    if (Hive->DirtyCount == 0) {
+        return TRUE;
+    }
+
+    SectorCount = RtlNumberOfSetBits(&(Hive->CommitVector));
+    if (SectorCount == 0) {
+        return TRUE;
+    }
+
+    ClusterSize = Hive->Cluster * HSECTOR_SIZE;
+    VectorLength = Hive->CommitVector.SizeOfBitMap / 8;
+
+    RecordLength =
+        ClusterSize +                                   // record header
+        ROUND_UP(VectorLength, ClusterSize) +
+        (SectorCount * HSECTOR_SIZE);
+
+    if ((Hive->LogRecordLength + RecordLength) > HLOG_RECORD_LIMIT) {
+        return HvSyncHive(Hive);
+    }
+
+
+    // Grow the log for the record, keeping the space HvSyncHive will
+    // need to log all the dirty data after the records.
+
+    RequiredSize =
+        ClusterSize +                                   // 1 cluster for header
+        Hive->LogRecordLength +
+        RecordLength +
+        ROUND_UP(VectorLength + sizeof(ULONG), ClusterSize) +
+        (Hive->DirtyCount * HSECTOR_SIZE);
+
+    RequiredSize = ROUND_UP(RequiredSize, HLOG_GROW);
+
+    if (RequiredSize > Hive->LogSize) {
+        if ( ! (Hive->FileSetSize)(Hive, HFILE_TYPE_LOG, RequiredSize)) {
+            return HvSyncHive(Hive);
+        }
+        Hive->LogSize = RequiredSize;
+    }
+
+
+    // disable hard error popups, to avoid self deadlock on bogus devices
+
+    oldFlag = IoSetThreadHardErrorMode(FALSE);
+    rc = HvpWriteLogRecord(Hive, SectorCount, RecordLength);
+    IoSetThreadHardErrorMode(oldFlag);
+
+    if (rc == FALSE) {
+
+
+        // The log may hold part of a record now.  Write the primary,
+        // which puts the dirty data where the partial record was.
+
+        Hive->LogAppend = FALSE;
+        return HvSyncHive(Hive);
+    }
+
+    Hive->LogRecordCount += 1;
+    Hive->LogRecordLength += RecordLength;
+    RtlClearAllBits(&(Hive->CommitVector));
+
     return TRUE;
 }
 
@@ -1002,13 +1157,15 @@ Return Value:
     }
 
     if ((Hive->Log) &&
-        (Hive->LogSize > HLOG_MINSIZE(Hive))) {
+        (Hive->LogSize > HLOG_MINSIZE(Hive)) &&
+        ((FileType != HFILE_TYPE_EXTERNAL) || (Hive->LogRecordLength == 0))) {
 
         // Shrink log back down, reserve at least two clusters
         // worth of space so that if all the disk space is
         // consumed, there will still be enough space prereserved
         // to allow a minimum of registry operations so the user
-        // can log on.
+        // can log on.  Saving to an external file leaves the
+        // primary behind any commit records, so keep them.
 
         CmpDoFileSetSize(Hive, HFILE_TYPE_LOG, HLOG_MINSIZE(Hive));
         Hive->LogSize = HLOG_MINSIZE(Hive);
@@ -1115,6 +1272,13 @@ Return Value:
     }
 
 
+    // Leave any commit records in place.  Until this log is complete
+    // they are the only copy of data committed since the primary was
+    // last written.
+
+    Offset += Hive->LogRecordLength;
+
+
     // --- Write out dirty vector ---
 
     ASSERT(sizeof(ULONG) == sizeof(DirtyVectorSignature));  // See GrowLog1 above
@@ -1223,6 +1387,139 @@ Return Value:
 }
 
 
+BOOLEAN
+HvpWriteLogRecord(
+    PHHIVE          Hive,
+    ULONG           SectorCount,
+    ULONG           RecordLength
+    )
+/*++
+
+Routine Description:
+
+    Append a commit record holding the sectors marked in the
+    CommitVector to the log, after any records already there, and
+    flush it.  The whole record is issued as one write; the checksum
+    lets recovery tell a record that was only partly written.
+
+Arguments:
+
+    Hive - pointer to Hive for which changes are to be committed.
+
+    SectorCount - number of bits set in the CommitVector.
+
+    RecordLength - length of the record, cluster multiple.
+
+Return Value:
+
+    TRUE - it worked
+
+    FALSE - it failed
+
+--*/
+{
+    PHLOG_RECORD    Record;
+    ULONG           ClusterSize;
+    ULONG           VectorLength;
+    ULONG           Offset;
+    PUCHAR          Address;
+    ULONG           Length;
+    ULONG           Current;
+    ULONG           junk;
+    ULONG           Sum;
+    BOOLEAN         rc;
+    PCMP_OFFSET_ARRAY offsetArray;
+    ULONG Count;
+
+    CMLOG(CML_MINOR, CMS_IO) {
+        KdPrint(("HvpWriteLogRecord:\n\t"));
+        KdPrint(("Hive:%08lx Record:%08lx Sectors:%08lx\n", Hive, Hive->LogRecordCount, SectorCount));
+    }
+
+    ASSERT(Hive->BaseBlock->Sequence1 == Hive->BaseBlock->Sequence2);
+    ASSERT(Hive->Storage[Stable].Length == Hive->BaseBlock->Length);
+
+    ClusterSize = Hive->Cluster * HSECTOR_SIZE;
+    VectorLength = Hive->CommitVector.SizeOfBitMap / 8;
+
+    Record = (PHLOG_RECORD)ExAllocatePool(PagedPool, ClusterSize);
+    if (Record == NULL) {
+        return FALSE;
+    }
+    offsetArray = (PCMP_OFFSET_ARRAY)ExAllocatePool(PagedPool, sizeof(CMP_OFFSET_ARRAY) * (SectorCount + 2));
+    if (offsetArray == NULL) {
+        ExFreePool(Record);
+        return FALSE;
+    }
+
+    RtlZeroMemory(Record, ClusterSize);
+    Record->Signature = HLOG_RECORD_SIGNATURE;
+    Record->Sequence = Hive->BaseBlock->Sequence2;
+    Record->Record = Hive->LogRecordCount;
+    Record->Length = RecordLength;
+    Record->HiveLength = Hive->Storage[Stable].Length;
+    Record->DataLength = SectorCount * HSECTOR_SIZE;
+
+    Sum = HvpLogRecordCheckSum(0, Record, sizeof(HLOG_RECORD));
+    Sum = HvpLogRecordCheckSum(Sum, Hive->CommitVector.Buffer, VectorLength);
+
+
+    // Gather header, vector and changed sectors into one write
+
+    Offset = ClusterSize + Hive->LogRecordLength;
+    offsetArray[0].FileOffset = Offset;
+    offsetArray[0].DataBuffer = (PVOID) Record;
+    offsetArray[0].DataLength = ClusterSize;
+    offsetArray[1].FileOffset = Offset + ClusterSize;
+    offsetArray[1].DataBuffer = (PVOID) Hive->CommitVector.Buffer;
+    offsetArray[1].DataLength = VectorLength;
+    Offset += ClusterSize + ROUND_UP(VectorLength, ClusterSize);
+    Count = 2;
+
+    Current = 0;
+    while (HvpFindNextDirtyBlock(
+                Hive,
+                &(Hive->CommitVector),
+                &Current,
+                &Address,
+                &Length,
+                &junk
+                ) == TRUE)
+    {
+        ASSERT(Count < (SectorCount + 2));
+        Sum = HvpLogRecordCheckSum(Sum, Address, Length);
+        offsetArray[Count].FileOffset = Offset;
+        offsetArray[Count].DataBuffer = Address;
+        offsetArray[Count].DataLength = Length;
+        Offset += Length;
+        Count++;
+        ASSERT((Offset % ClusterSize) == 0);
+    }
+    ASSERT(Offset == (ClusterSize + Hive->LogRecordLength + RecordLength));
+
+    Record->CheckSum = Sum;
+
+    rc = (Hive->FileWrite)(
+            Hive,
+            HFILE_TYPE_LOG,
+            offsetArray,
+            Count,
+            &Offset
+            );
+    ExFreePool(offsetArray);
+    ExFreePool(Record);
+    if (rc == FALSE) {
+        return FALSE;
+    }
+
+    if ( ! (Hive->FileFlush)(Hive, HFILE_TYPE_LOG)) {
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
 BOOLEAN
 HvpFindNextDirtyBlock(
     PHHIVE          Hive,
@@ -1859,6 +2156,7 @@ Return Value:
 
     RtlClearAllBits(&(Hive->DirtyVector));
     Hive->DirtyCount = 0;
+    RtlClearAllBits(&(Hive->CommitVector));
 
 
 
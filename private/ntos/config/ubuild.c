@@ -0,0 +1,328 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ubuild.c
+
+Abstract:
+    Registry hive build and replay benchmark.  Loads an empty hive from
+    a file in the current directory, builds a tree of keys in it and
+    replays a pseudo random mix of value sets (of varying sizes) and
+    value deletes, which leaves free cells of many sizes scattered
+    through the hive.  Reports the rate of operations, the size of the
+    hive file after the replay is flushed, and the size of a copy made
+    with NtSaveKey, which rewrites the tree into a fresh hive with no
+    free space.  The difference between the two is the space lost to
+    fragmentation; the copy can be put in place of the hive offline
+    with NtReplaceKey.
+
+    The replay is deterministic, so runs on different builds see the
+    same sequence of allocations and frees.
+
+    usage: ubuild [keys [operations]]
+
+    Requires SeBackupPrivilege and SeRestorePrivilege.
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_KEY_NAME      L"\\Registry\\Machine\\HiveBuildBench"
+#define BENCH_SEED_NAME     L"\\Registry\\Machine\\Software\\HiveBuildSeed"
+#define BENCH_HIVE_FILE     L"hivebld.dat"
+#define BENCH_SAVE_FILE     L"hivebld.cmp"
+#define BENCH_MAX_KEYS      20000
+#define BENCH_FANOUT        8
+#define BENCH_VALUES        16
+#define BENCH_MAX_DATA      2048
+
+HANDLE BenchKeys[BENCH_MAX_KEYS];
+ULONG BenchKeyCount;
+UCHAR BenchData[BENCH_MAX_DATA];
+
+
+NTSTATUS OpenBenchFile(IN PWSTR DosName, IN BOOLEAN Create, OUT PHANDLE Handle, OUT POBJECT_ATTRIBUTES ObjectAttributes, OUT PUNICODE_STRING NtName)
+{
+    IO_STATUS_BLOCK IoStatus;
+
+    if (!RtlDosPathNameToNtPathName_U(DosName, NtName, NULL, NULL))
+    {
+        return STATUS_OBJECT_NAME_INVALID;
+    }
+
+    InitializeObjectAttributes(ObjectAttributes, NtName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    if (!Create)
+    {
+        return STATUS_SUCCESS;
+    }
+
+    return NtCreateFile(Handle, GENERIC_WRITE | SYNCHRONIZE, ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, FILE_OVERWRITE_IF, FILE_SYNCHRONOUS_IO_NONALERT, NULL, 0);
+}
+
+
+ULONG QueryFileSize(IN POBJECT_ATTRIBUTES ObjectAttributes)
+{
+    FILE_NETWORK_OPEN_INFORMATION Information;
+
+    if (!NT_SUCCESS(NtQueryFullAttributesFile(ObjectAttributes, &Information)))
+    {
+        return 0;
+    }
+
+    return Information.EndOfFile.LowPart;
+}
+
+
+NTSTATUS CreateEmptyHive(IN POBJECT_ATTRIBUTES FileAttributes)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    IO_STATUS_BLOCK IoStatus;
+    HANDLE Seed;
+    HANDLE File;
+    NTSTATUS Status;
+
+    RtlInitUnicodeString(&Name, BENCH_SEED_NAME);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtCreateKey(&Seed, KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, REG_OPTION_VOLATILE, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create %wZ (%X)\n", &Name, Status);
+        return Status;
+    }
+
+    Status = NtCreateFile(&File, GENERIC_WRITE | SYNCHRONIZE, FileAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, FILE_OVERWRITE_IF, FILE_SYNCHRONOUS_IO_NONALERT, NULL, 0);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtSaveKey(Seed, File);
+        NtClose(File);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to save empty hive (%X)\n", Status);
+    }
+
+    NtDeleteKey(Seed);
+    NtClose(Seed);
+    return Status;
+}
+
+
+NTSTATUS BuildKeys(IN ULONG Keys)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[16];
+    NTSTATUS Status;
+
+    for (BenchKeyCount = 1; BenchKeyCount < Keys; BenchKeyCount++)
+    {
+        swprintf(NameBuffer, L"Key%u", BenchKeyCount);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, BenchKeys[(BenchKeyCount - 1) / BENCH_FANOUT], NULL);
+        Status = NtCreateKey(&BenchKeys[BenchKeyCount], KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, REG_OPTION_NON_VOLATILE, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create subkey %wZ (%X)\n", &Name, Status);
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+ULONG DataSize(IN PULONG Seed)
+{
+    ULONG Choice = RtlRandom(Seed) % 100;
+
+    //  Mostly small values, some medium, a few large enough to take
+    //  a cell of their own in a bin.
+
+    if (Choice < 60)
+    {
+        return 8 + (RtlRandom(Seed) % 56);
+    }
+
+    if (Choice < 90)
+    {
+        return 64 + (RtlRandom(Seed) % 448);
+    }
+
+    return 512 + (RtlRandom(Seed) % (BENCH_MAX_DATA - 512));
+}
+
+
+NTSTATUS Replay(IN ULONG Operations)
+{
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[16];
+    NTSTATUS Status;
+    ULONG Seed = 1;
+    ULONG Key;
+    ULONG i;
+
+    for (i = 0; i < Operations; i++)
+    {
+        Key = RtlRandom(&Seed) % BenchKeyCount;
+        swprintf(NameBuffer, L"Value%u", RtlRandom(&Seed) % BENCH_VALUES);
+        RtlInitUnicodeString(&Name, NameBuffer);
+
+        if ((RtlRandom(&Seed) % 4) == 0)
+        {
+            Status = NtDeleteValueKey(BenchKeys[Key], &Name);
+            if (Status == STATUS_OBJECT_NAME_NOT_FOUND)
+            {
+                Status = STATUS_SUCCESS;
+            }
+        }
+        else
+        {
+            Status = NtSetValueKey(BenchKeys[Key], &Name, 0, REG_BINARY, BenchData, DataSize(&Seed));
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Operation %u on Key%u\\%wZ failed (%X)\n", i, Key, &Name, Status);
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+main(int argc, char **argv)
+{
+    OBJECT_ATTRIBUTES KeyAttributes;
+    OBJECT_ATTRIBUTES HiveAttributes;
+    OBJECT_ATTRIBUTES SaveAttributes;
+    UNICODE_STRING KeyName;
+    UNICODE_STRING HiveName;
+    UNICODE_STRING SaveName;
+    LARGE_INTEGER Start, Middle, End, Frequency;
+    HANDLE SaveFile = NULL;
+    BOOLEAN Loaded = FALSE;
+    BOOLEAN Enabled;
+    ULONG Keys = 2000;
+    ULONG Operations = 200000;
+    ULONG HiveSize;
+    ULONG SaveSize;
+    ULONGLONG Elapsed;
+    NTSTATUS Status;
+    ULONG i;
+
+    if (argc > 1)
+    {
+        Keys = atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        Operations = atoi(argv[2]);
+    }
+
+    if ((Keys < 2) || (Keys > BENCH_MAX_KEYS) || (Operations == 0))
+    {
+        printf("usage: ubuild [keys (2-%u) [operations]]\n", BENCH_MAX_KEYS);
+        return 1;
+    }
+
+    RtlAdjustPrivilege(SE_BACKUP_PRIVILEGE, TRUE, FALSE, &Enabled);
+    RtlAdjustPrivilege(SE_RESTORE_PRIVILEGE, TRUE, FALSE, &Enabled);
+
+    for (i = 0; i < sizeof(BenchData); i++)
+    {
+        BenchData[i] = (UCHAR)i;
+    }
+
+    OpenBenchFile(BENCH_HIVE_FILE, FALSE, NULL, &HiveAttributes, &HiveName);
+    Status = CreateEmptyHive(&HiveAttributes);
+    if (!NT_SUCCESS(Status))
+    {
+        return 1;
+    }
+
+    RtlInitUnicodeString(&KeyName, BENCH_KEY_NAME);
+    InitializeObjectAttributes(&KeyAttributes, &KeyName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtLoadKey(&KeyAttributes, &HiveAttributes);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to load %wZ (%X)\n", &HiveName, Status);
+        goto Exit;
+    }
+    Loaded = TRUE;
+
+    Status = NtOpenKey(&BenchKeys[0], KEY_ALL_ACCESS, &KeyAttributes);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", &KeyName, Status);
+        goto Exit;
+    }
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+    Status = BuildKeys(Keys);
+    if (NT_SUCCESS(Status))
+    {
+        NtQueryPerformanceCounter(&Middle, NULL);
+        Status = Replay(Operations);
+    }
+    NtQueryPerformanceCounter(&End, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        goto Exit;
+    }
+
+    NtFlushKey(BenchKeys[0]);
+    HiveSize = QueryFileSize(&HiveAttributes);
+
+    Elapsed = ((Middle.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+    printf("build    %8u keys        %8I64u ms\n", Keys, Elapsed);
+    Elapsed = ((End.QuadPart - Middle.QuadPart) * 1000) / Frequency.QuadPart;
+    printf("replay   %8u operations  %8I64u ms  %8I64u operations/sec\n", Operations, Elapsed, ((ULONGLONG)Operations * 1000) / (Elapsed ? Elapsed : 1));
+
+    Status = OpenBenchFile(BENCH_SAVE_FILE, TRUE, &SaveFile, &SaveAttributes, &SaveName);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create %wZ (%X)\n", &SaveName, Status);
+        goto Exit;
+    }
+
+    NtQueryPerformanceCounter(&Start, NULL);
+    Status = NtSaveKey(BenchKeys[0], SaveFile);
+    NtQueryPerformanceCounter(&End, NULL);
+    NtClose(SaveFile);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to save %wZ (%X)\n", &KeyName, Status);
+        goto Exit;
+    }
+
+    SaveSize = QueryFileSize(&SaveAttributes);
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+    printf("compact  %8u bytes hive  %8u bytes saved  %3u%% free  %8I64u ms\n",
+           HiveSize, SaveSize, HiveSize ? ((HiveSize - min(SaveSize, HiveSize)) * 100) / HiveSize : 0, Elapsed);
+
+Exit:
+    for (i = 0; i < BenchKeyCount; i++)
+    {
+        if (BenchKeys[i] != NULL)
+        {
+            NtClose(BenchKeys[i]);
+        }
+    }
+
+    if (Loaded)
+    {
+        NtUnloadKey(&KeyAttributes);
+    }
+
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uflush.c
+
+Abstract:
+    Registry flush benchmark.  Writer threads each own a subkey of a
+    stable key in the SOFTWARE hive, set a batch of values in it and then
+    call NtFlushKey, and measure the time spent flushing.  Bytes written
+    by the process during the run, as reported by its I/O counters, are
+    divided by the number of values set to give the bytes written per
+    logical change.
+
+    Flushes of a hive with a log append the changed sectors to the log;
+    writes to the primary hive are done later by the lazy flusher in a
+    system thread and are not counted.  Running several writers shows
+    how often a flush finds its changes already written by another.
+
+    usage: uflush [threads [changes [seconds]]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_KEY_NAME      L"\\Registry\\Machine\\Software\\HiveFlushBench"
+#define BENCH_MAX_CHANGES   4096
+#define BENCH_VALUES        256
+#define BENCH_DATA_LENGTH   64
+
+HANDLE BenchKey;
+HANDLE WriterKeys[BENCH_MAX_THREADS];
+ULONG BenchChanges;
+
+ULONGLONG FlushTimes[BENCH_MAX_THREADS];
+ULONGLONG MaxFlushTimes[BENCH_MAX_THREADS];
+
+
+NTSTATUS CreateBenchKeys(IN ULONG Threads)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[32];
+    NTSTATUS Status;
+    ULONG i;
+
+    RtlInitUnicodeString(&Name, BENCH_KEY_NAME);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtCreateKey(&BenchKey, KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, REG_OPTION_NON_VOLATILE, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create %wZ (%X)\n", &Name, Status);
+        return Status;
+    }
+
+    for (i = 0; i < Threads; i++)
+    {
+        swprintf(NameBuffer, L"Writer%u", i);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, BenchKey, NULL);
+        Status = NtCreateKey(&WriterKeys[i], KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, REG_OPTION_NON_VOLATILE, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create subkey %wZ (%X)\n", &Name, Status);
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID DeleteBenchKeys(IN ULONG Threads)
+{
+    ULONG i;
+
+    for (i = 0; i < Threads; i++)
+    {
+        if (WriterKeys[i] != NULL)
+        {
+            NtDeleteKey(WriterKeys[i]);
+            NtClose(WriterKeys[i]);
+        }
+    }
+
+    if (BenchKey != NULL)
+    {
+        NtDeleteKey(BenchKey);
+        NtFlushKey(BenchKey);
+        NtClose(BenchKey);
+    }
+}
+
+
+ULONGLONG QueryWriteTransferCount(VOID)
+{
+    IO_COUNTERS IoCounters;
+
+    if (!NT_SUCCESS(NtQueryInformationProcess(NtCurrentProcess(), ProcessIoCounters, &IoCounters, sizeof(IoCounters), NULL)))
+    {
+        return 0;
+    }
+
+    return IoCounters.WriteTransferCount;
+}
+
+
+ULONG WriterThread(IN PVOID Context)
+{
+    UNICODE_STRING ValueNames[BENCH_VALUES];
+    WCHAR NameBuffers[BENCH_VALUES][16];
+    ULONG Data[BENCH_DATA_LENGTH / sizeof(ULONG)];
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Elapsed;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG Counter = 0;
+    ULONG i;
+
+    for (i = 0; i < BENCH_VALUES; i++)
+    {
+        swprintf(NameBuffers[i], L"Value%u", i);
+        RtlInitUnicodeString(&ValueNames[i], NameBuffers[i]);
+    }
+
+    RtlZeroMemory(Data, sizeof(Data));
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        for (i = 0; i < BenchChanges; i++)
+        {
+            Data[0] = Counter;
+            Status = NtSetValueKey(WriterKeys[ThreadIndex], &ValueNames[Counter % BENCH_VALUES], 0, REG_BINARY, Data, sizeof(Data));
+            if (!NT_SUCCESS(Status))
+            {
+                printf("Set of %wZ failed (%X)\n", &ValueNames[Counter % BENCH_VALUES], Status);
+                goto Exit;
+            }
+
+            Counter += 1;
+        }
+
+        NtQueryPerformanceCounter(&Start, NULL);
+        Status = NtFlushKey(WriterKeys[ThreadIndex]);
+        NtQueryPerformanceCounter(&End, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Flush failed (%X)\n", Status);
+            break;
+        }
+
+        Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+        FlushTimes[ThreadIndex] += Elapsed;
+        if (Elapsed > MaxFlushTimes[ThreadIndex])
+        {
+            MaxFlushTimes[ThreadIndex] = Elapsed;
+        }
+
+        BenchCounts[ThreadIndex] += 1;
+    }
+
+Exit:
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG WriteStart;
+    ULONGLONG BytesWritten;
+    ULONGLONG Flushes;
+    ULONGLONG FlushTime;
+    ULONGLONG MaxFlushTime;
+    ULONGLONG Changes;
+    ULONG i;
+
+    for (i = 0; i < Threads; i++)
+    {
+        FlushTimes[i] = 0;
+        MaxFlushTimes[i] = 0;
+    }
+
+    WriteStart = QueryWriteTransferCount();
+    Flushes = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WriterThread, Threads, Seconds, NULL, NULL);
+    BytesWritten = QueryWriteTransferCount() - WriteStart;
+
+    FlushTime = 0;
+    MaxFlushTime = 0;
+    for (i = 0; i < Threads; i++)
+    {
+        FlushTime += FlushTimes[i];
+        if (MaxFlushTimes[i] > MaxFlushTime)
+        {
+            MaxFlushTime = MaxFlushTimes[i];
+        }
+    }
+
+    Changes = Flushes * BenchChanges;
+    if (Flushes == 0)
+    {
+        Flushes = 1;
+    }
+
+    printf("%2u threads %4u changes/flush  %8I64u flushes  %8I64u us/flush (max %I64u)  %8I64u bytes/change\n",
+           Threads, BenchChanges, Flushes, FlushTime / Flushes, MaxFlushTime, Changes ? BytesWritten / Changes : 0);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+    NTSTATUS Status;
+
+    Threads = BenchArgument(argc, argv, 1, 1);
+    BenchChanges = BenchArgument(argc, argv, 2, 16);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) ||
+        (BenchChanges == 0) || (BenchChanges > BENCH_MAX_CHANGES) || (Seconds == 0))
+    {
+        printf("usage: uflush [threads (1-%u) [changes (1-%u) [seconds]]]\n", BENCH_MAX_THREADS, BENCH_MAX_CHANGES);
+        return 1;
+    }
+
+    Status = CreateBenchKeys(Threads);
+    if (NT_SUCCESS(Status))
+    {
+        for (n = 1; n <= Threads; n *= 2)
+        {
+            RunBenchmark(n, Seconds);
+        }
+    }
+
+    DeleteBenchKeys(Threads);
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
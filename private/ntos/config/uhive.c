@@ -0,0 +1,211 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uhive.c
+
+Abstract:
+    Registry subkey lookup benchmark.  Creates a key with many subkeys
+    named like CLSIDs, which share their first characters and so defeat
+    the four character name hints of fast index leaves, then measures
+    the rate at which subkeys can be opened by name, the rate of failed
+    opens and the rate of enumeration by index.
+
+    Subkeys are opened in a pseudo random order and the default count is
+    well above the number of kcbs kept in the delayed close table and
+    the negative lookup cache, so most opens are resolved by the subkey
+    index of the hive rather than by the kcb cache.
+
+    usage: uhive [subkeys [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_KEY_NAME      L"\\Registry\\Machine\\Software\\HiveIndexBench"
+#define BENCH_MAX_SUBKEYS   200000
+
+#define BENCH_OPEN_EXISTING 0
+#define BENCH_OPEN_MISSING  1
+#define BENCH_ENUMERATE     2
+
+HANDLE BenchKey;
+ULONG BenchSubKeys;
+
+
+VOID BenchSubKeyName(OUT PWCHAR Buffer, IN ULONG Index, IN BOOLEAN Missing)
+{
+    swprintf(Buffer, L"{%08lX-0000-0000-C000-0000000000%02X}", Index * 2654435761, Missing ? 0x47 : 0x46);
+}
+
+
+NTSTATUS CreateBenchKey(VOID)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[64];
+    HANDLE Handle;
+    NTSTATUS Status;
+    ULONG i;
+
+    RtlInitUnicodeString(&Name, BENCH_KEY_NAME);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtCreateKey(&BenchKey, KEY_ALL_ACCESS, &ObjectAttributes, 0, NULL, REG_OPTION_VOLATILE, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create %wZ (%X)\n", &Name, Status);
+        return Status;
+    }
+
+    for (i = 0; i < BenchSubKeys; i++)
+    {
+        BenchSubKeyName(NameBuffer, i, FALSE);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, BenchKey, NULL);
+        Status = NtCreateKey(&Handle, KEY_READ, &ObjectAttributes, 0, NULL, REG_OPTION_VOLATILE, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create subkey %wZ (%X)\n", &Name, Status);
+            return Status;
+        }
+        NtClose(Handle);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID DeleteBenchKey(VOID)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[64];
+    HANDLE Handle;
+    ULONG i;
+
+    if (BenchKey == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < BenchSubKeys; i++)
+    {
+        BenchSubKeyName(NameBuffer, i, FALSE);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, BenchKey, NULL);
+        if (NT_SUCCESS(NtOpenKey(&Handle, DELETE, &ObjectAttributes)))
+        {
+            NtDeleteKey(Handle);
+            NtClose(Handle);
+        }
+    }
+
+    NtDeleteKey(BenchKey);
+    NtClose(BenchKey);
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Mode, IN ULONG Seconds)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[64];
+    UCHAR InfoBuffer[256];
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    HANDLE Handle;
+    ULONGLONG Total;
+    ULONGLONG Elapsed;
+    ULONG ResultLength;
+    ULONG Seed;
+    ULONG i;
+    NTSTATUS Status;
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        return;
+    }
+
+    Total = 0;
+    Seed = 1;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        i = RtlRandom(&Seed) % BenchSubKeys;
+
+        if (Mode == BENCH_ENUMERATE)
+        {
+            Status = NtEnumerateKey(BenchKey, i, KeyBasicInformation, InfoBuffer, sizeof(InfoBuffer), &ResultLength);
+            if (!NT_SUCCESS(Status))
+            {
+                printf("Enumerate of subkey %u failed (%X)\n", i, Status);
+                break;
+            }
+        }
+        else
+        {
+            BenchSubKeyName(NameBuffer, i, (BOOLEAN)(Mode == BENCH_OPEN_MISSING));
+            RtlInitUnicodeString(&Name, NameBuffer);
+            InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, BenchKey, NULL);
+            Status = NtOpenKey(&Handle, KEY_READ, &ObjectAttributes);
+            if (NT_SUCCESS(Status))
+            {
+                NtClose(Handle);
+            }
+            if (NT_SUCCESS(Status) != (Mode == BENCH_OPEN_EXISTING))
+            {
+                printf("Open of %wZ returned %X\n", &Name, Status);
+                break;
+            }
+        }
+
+        Total += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+    if (Elapsed == 0)
+    {
+        Elapsed = 1;
+    }
+
+    printf("%-16s %8u subkeys  %10I64u lookups  %10I64u lookups/sec\n", Title, BenchSubKeys, Total, (Total * 1000) / Elapsed);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Seconds;
+    NTSTATUS Status;
+
+    BenchSubKeys = BenchArgument(argc, argv, 1, 20000);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((BenchSubKeys == 0) || (BenchSubKeys > BENCH_MAX_SUBKEYS) || (Seconds == 0))
+    {
+        printf("usage: uhive [subkeys (1-%u) [seconds]]\n", BENCH_MAX_SUBKEYS);
+        return 1;
+    }
+
+    Status = CreateBenchKey();
+    if (NT_SUCCESS(Status))
+    {
+        RunBenchmark("open existing", BENCH_OPEN_EXISTING, Seconds);
+        RunBenchmark("open missing", BENCH_OPEN_MISSING, Seconds);
+        RunBenchmark("enumerate", BENCH_ENUMERATE, Seconds);
+    }
+
+    DeleteBenchKey();
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
@@ -675,7 +675,9 @@ Return Value:
         ScanKeySD(&Data->u.KeySecurity, CellSize);
 
     } else if ((Data->u.KeyIndex.Signature == CM_KEY_INDEX_ROOT) ||
-               (Data->u.KeyIndex.Signature == CM_KEY_INDEX_LEAF)) {
+               (Data->u.KeyIndex.Signature == CM_KEY_INDEX_LEAF) ||
+               (Data->u.KeyIndex.Signature == CM_KEY_FAST_LEAF) ||
+               (Data->u.KeyIndex.Signature == CM_KEY_HASH_LEAF)) {
 
         // probably a key index
 
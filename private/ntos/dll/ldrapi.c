@@ -540,6 +540,8 @@ bottom:
             if (ShowSnaps) {
                 DbgPrint("LDR: Unmapping [%ws]\n", LdrDataTableEntry->BaseDllName.Buffer);
             }
+            LdrpDeleteExportHash(Entry->DllBase);
+
             st = NtUnmapViewOfSection(NtCurrentProcess(),Entry->DllBase);
             ASSERT(NT_SUCCESS(st));
 
@@ -19,6 +19,9 @@ Author:
 #include <apcompat.h>
 #include "ldrp.h"
 #include <ctype.h>
+#ifdef NTNAP
+#include "ntnap.h"
+#endif
 
 BOOLEAN LdrpShutdownInProgress = FALSE;
 BOOLEAN LdrpImageHasTls = FALSE;
@@ -286,6 +289,7 @@ Arguments:
                 DbgPrint("InitTime %ld\n", ElapsedTime.LowPart);
                 DbgPrint("Compares %d Bypasses %d Normal Snaps %d\nSecOpens %d SecCreates %d Maps %d Relocates %d\n",
                     LdrpCompareCount, LdrpSnapBypass, LdrpNormalSnap, LdrpSectionOpens, LdrpSectionCreates, LdrpSectionMaps, LdrpSectionRelocates);
+                DbgPrint("Export Hash Tables %d\n", LdrpExportHashTables);
             }
 #endif
         } else {
@@ -540,6 +544,8 @@ Return Value:
         InitializeListHead(&LdrpHashTable[i]);
     }
 
+    InitializeListHead(&LdrpExportHashList);
+
     // Initialize the critical section package.
     RtlpInitDeferedCriticalSection();
 
@@ -1063,6 +1069,15 @@ Routine Description:
     } finally {
         RtlLeaveCriticalSection(&LoaderLock);
     }
+
+#ifdef NTNAP
+    //
+    // Give back the profiling slot of the thread so another thread
+    // can claim it.
+    //
+
+    NapReleaseThreadSlot();
+#endif
 }
 
 VOID LdrpInitializeThread(IN PCONTEXT Context)
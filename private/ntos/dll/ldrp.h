@@ -109,6 +109,25 @@ typedef struct _LDRP_PATH_CACHE {
     HANDLE Directory;
 } LDRP_PATH_CACHE, *PLDRP_PATH_CACHE;
 
+// A DLL that exports many names gets a hash table of them, built the first time a name is looked up in it,
+// that takes the place of the binary search of its export name table.  Name lookups are made under the
+// loader lock, so the tables are kept on a plain list with the last one used cached in front of it.
+#define LDRP_EXPORT_HASH_MINIMUM_NAMES 128
+
+typedef struct _LDRP_EXPORT_HASH {
+    LIST_ENTRY Links;
+    PVOID DllBase;
+    ULONG BucketMask;
+    ULONG Buckets[1];       // index of the name in the export name table plus one, zero if empty
+} LDRP_EXPORT_HASH, *PLDRP_EXPORT_HASH;
+
+LIST_ENTRY LdrpExportHashList;
+PLDRP_EXPORT_HASH LdrpExportHashCache;
+
+ULONG LdrpHashExportName(IN PSZ Name);
+PLDRP_EXPORT_HASH LdrpFindExportHash(IN PVOID DllBase, IN ULONG NumberOfNames, IN PULONG NameTableBase);
+VOID LdrpDeleteExportHash(IN PVOID DllBase);
+
 NTSTATUS LdrpSnapIAT(IN PLDR_DATA_TABLE_ENTRY LdrDataTableEntry_Export, 
                      IN PLDR_DATA_TABLE_ENTRY LdrDataTableEntry_Import, 
                      IN PIMAGE_IMPORT_DESCRIPTOR ImportDescriptor, 
@@ -205,6 +224,7 @@ ULONG LdrpSectionOpens;
 ULONG LdrpSectionCreates;
 ULONG LdrpSectionMaps;
 ULONG LdrpSectionRelocates;
+ULONG LdrpExportHashTables;
 BOOLEAN LdrpDisplayLoadTime;
 LARGE_INTEGER BeginTime, InitcTime, InitbTime, IniteTime, EndTime, ElapsedTime, Interval;
 
@@ -216,6 +236,44 @@ LARGE_INTEGER RtlpTimeout;
 ULONG NtGlobalFlag;
 LIST_ENTRY RtlCriticalSectionList;
 RTL_CRITICAL_SECTION RtlCriticalSectionLock;
+
+// The debug information of every critical section and resource is followed by a contention profile, filled in
+// by the slow paths, that also drives the adaptive spin of critical sections.  Wait times are in microseconds.
+// The fields are updated with interlocked operations; the total wait time is kept as two halves, the high one
+// bumped when the low one carries, and read back with RtlpReadTotalWaitTime.
+#define RTLP_CS_OWNER_STACKS 4
+
+typedef struct _RTLP_CRITICAL_SECTION_PROFILE {
+    RTL_CRITICAL_SECTION_DEBUG DebugInfo;
+    ULONG MaximumSpinCount;         // most the spin count is raised to, zero if the spin is fixed
+    ULONG AverageWait;              // decaying average of recent blocking waits
+    ULONG MaximumWait;
+    ULONG TotalWaitTimeLow;
+    ULONG TotalWaitTimeHigh;
+    USHORT OwnerBackTraceIndex[RTLP_CS_OWNER_STACKS];
+    ULONG OwnerBackTraceCount[RTLP_CS_OWNER_STACKS];
+} RTLP_CRITICAL_SECTION_PROFILE, *PRTLP_CRITICAL_SECTION_PROFILE;
+
+// The snapshot returned by RtlQueryCriticalSectionContention.  This belongs with the critical section
+// types in nturtl.h, which is not part of this tree.
+typedef struct _RTL_CRITICAL_SECTION_CONTENTION {
+    ULONG EntryCount;
+    ULONG ContentionCount;
+    ULONG SpinCount;
+    ULONG MaximumSpinCount;
+    ULONG AverageWait;
+    ULONG MaximumWait;
+    ULONGLONG TotalWaitTime;
+    USHORT OwnerBackTraceIndex;     // stack trace database index of the owner that most often held up waiters
+} RTL_CRITICAL_SECTION_CONTENTION, *PRTL_CRITICAL_SECTION_CONTENTION;
+
+NTSYSAPI
+NTSTATUS
+NTAPI
+RtlQueryCriticalSectionContention(
+    IN PRTL_CRITICAL_SECTION CriticalSection,
+    OUT PRTL_CRITICAL_SECTION_CONTENTION Contention
+    );
 BOOLEAN LdrpShutdownInProgress;
 extern BOOLEAN LdrpInLdrInit;
 extern BOOLEAN LdrpLdrDatabaseIsSetup;
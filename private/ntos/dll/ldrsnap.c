@@ -535,6 +535,9 @@ NTSTATUS LdrpRunInitializeRoutines(IN PCONTEXT Context OPTIONAL)
     ULONG i;
     NTSTATUS Status;
     ULONG BreakOnDllLoad;
+#if DBG
+    LARGE_INTEGER InitBeginTime, InitEndTime;
+#endif
 
     // Run the Init routines
 
@@ -629,6 +632,12 @@ NTSTATUS LdrpRunInitializeRoutines(IN PCONTEXT Context OPTIONAL)
             }
 
             if ( InitRoutine ) {
+#if DBG
+                if (LdrpDisplayLoadTime) {
+                    NtQueryPerformanceCounter(&InitBeginTime, NULL);
+                }
+#endif
+
                 // If the DLL has TLS data, then call the optional initializers
                 if ( LdrDataTableEntry->TlsIndex && Context) {
                     LdrpCallTlsInitializers(LdrDataTableEntry->DllBase,DLL_PROCESS_ATTACH);
@@ -646,6 +655,15 @@ NTSTATUS LdrpRunInitializeRoutines(IN PCONTEXT Context OPTIONAL)
 
                 LdrDataTableEntry->Flags |= LDRP_PROCESS_ATTACH_CALLED;
 
+#if DBG
+                if (LdrpDisplayLoadTime) {
+                    NtQueryPerformanceCounter(&InitEndTime, NULL);
+                    DbgPrint("Init Routine Time %ld %wZ\n",
+                             (LONG)(InitEndTime.QuadPart - InitBeginTime.QuadPart),
+                             &LdrDataTableEntry->BaseDllName);
+                }
+#endif
+
                 if ( !InitStatus ) {
                     return STATUS_DLL_INIT_FAILED;
                 }
@@ -1675,6 +1693,13 @@ Return Value:
     SIZE_T IATSize;
     ULONG LittleIATSize;
     ULONG OldProtect;
+#if DBG
+    LARGE_INTEGER SnapBeginTime, SnapEndTime;
+
+    if (LdrpDisplayLoadTime) {
+        NtQueryPerformanceCounter(&SnapBeginTime, NULL);
+    }
+#endif
 
     Peb = NtCurrentPeb();
 
@@ -1800,6 +1825,17 @@ Return Value:
     // Restore protection for IAT and flush instruction cache.
     NtProtectVirtualMemory( NtCurrentProcess(), &IATBase, &IATSize, OldProtect, &OldProtect);
     NtFlushInstructionCache( NtCurrentProcess(), IATBase, LittleIATSize );
+
+#if DBG
+    if (LdrpDisplayLoadTime) {
+        NtQueryPerformanceCounter(&SnapEndTime, NULL);
+        DbgPrint("Snap Time %ld %wZ from %wZ\n",
+                 (LONG)(SnapEndTime.QuadPart - SnapBeginTime.QuadPart),
+                 &LdrDataTableEntry_Import->BaseDllName,
+                 &LdrDataTableEntry_Export->BaseDllName);
+    }
+#endif
+
     return st;
 }
 
@@ -2017,6 +2053,26 @@ LdrpNameToOrdinal (
     LONG Low;
     LONG Middle;
     LONG Result;
+    PLDRP_EXPORT_HASH ExportHash;
+    ULONG Bucket;
+    ULONG Index;
+
+    // If the DLL exports enough names to have a hash table, probe that.
+    if (NumberOfNames >= LDRP_EXPORT_HASH_MINIMUM_NAMES) {
+        ExportHash = LdrpFindExportHash(DllBase, NumberOfNames, NameTableBase);
+        if (ExportHash) {
+            Bucket = LdrpHashExportName(Name) & ExportHash->BucketMask;
+            while ((Index = ExportHash->Buckets[Bucket]) != 0) {
+                if (!strcmp(Name, (PCHAR)((ULONG_PTR)DllBase + NameTableBase[Index - 1]))) {
+                    return NameOrdinalTableBase[Index - 1];
+                }
+
+                Bucket = (Bucket + 1) & ExportHash->BucketMask;
+            }
+
+            return (USHORT)-1;
+        }
+    }
 
     // Lookup the import name in the name table using a binary search.
     Low = 0;
@@ -2046,6 +2102,126 @@ LdrpNameToOrdinal (
 }
 
 
+ULONG LdrpHashExportName (IN PSZ Name)
+{
+    ULONG Hash;
+
+    Hash = 0;
+    while (*Name) {
+        Hash = (Hash * 37) + (UCHAR)*Name++;
+    }
+
+    return Hash;
+}
+
+
+PLDRP_EXPORT_HASH LdrpFindExportHash (IN PVOID DllBase, IN ULONG NumberOfNames, IN PULONG NameTableBase)
+/*++
+Routine Description:
+    This function returns the export name hash table of a DLL, building it if this is the first lookup of a name in the DLL.
+    The caller must hold the loader lock.
+Arguments:
+    DllBase - Supplies the base of the DLL.
+    NumberOfNames - Supplies the number of names in the export name table of the DLL.
+    NameTableBase - Supplies the address of the export name table of the DLL.
+Return Value:
+    The hash table, or NULL if it cannot be built, in which case the caller falls back to the binary search.
+--*/
+{
+    PLDRP_EXPORT_HASH ExportHash;
+    PLIST_ENTRY Next;
+    ULONG NumberOfBuckets;
+    ULONG Bucket;
+    ULONG i;
+
+    if (LdrpExportHashCache && LdrpExportHashCache->DllBase == DllBase) {
+        return LdrpExportHashCache;
+    }
+
+    Next = LdrpExportHashList.Flink;
+    while (Next != &LdrpExportHashList) {
+        ExportHash = CONTAINING_RECORD(Next, LDRP_EXPORT_HASH, Links);
+        if (ExportHash->DllBase == DllBase) {
+            LdrpExportHashCache = ExportHash;
+            return ExportHash;
+        }
+
+        Next = Next->Flink;
+    }
+
+    // Keep the table at most half full so that the probes stay short.
+    NumberOfBuckets = LDRP_EXPORT_HASH_MINIMUM_NAMES;
+    while (NumberOfBuckets < NumberOfNames * 2) {
+        NumberOfBuckets <<= 1;
+    }
+
+    ExportHash = RtlAllocateHeap(RtlProcessHeap(),
+                                 MAKE_TAG( LDR_TAG ) | HEAP_ZERO_MEMORY,
+                                 FIELD_OFFSET(LDRP_EXPORT_HASH, Buckets) + NumberOfBuckets * sizeof(ULONG));
+    if (!ExportHash) {
+        return NULL;
+    }
+
+    ExportHash->DllBase = DllBase;
+    ExportHash->BucketMask = NumberOfBuckets - 1;
+
+    try {
+        for (i = 0; i < NumberOfNames; i++) {
+            Bucket = LdrpHashExportName((PSZ)((ULONG_PTR)DllBase + NameTableBase[i])) & ExportHash->BucketMask;
+            while (ExportHash->Buckets[Bucket]) {
+                Bucket = (Bucket + 1) & ExportHash->BucketMask;
+            }
+
+            ExportHash->Buckets[Bucket] = i + 1;
+        }
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+        RtlFreeHeap(RtlProcessHeap(), 0, ExportHash);
+        return NULL;
+    }
+
+    InsertHeadList(&LdrpExportHashList, &ExportHash->Links);
+    LdrpExportHashCache = ExportHash;
+#if DBG
+    LdrpExportHashTables++;
+#endif
+    if (ShowSnaps) {
+        DbgPrint("LDR: Hashed %lu export names of DLL at %lx\n", NumberOfNames, DllBase);
+    }
+
+    return ExportHash;
+}
+
+
+VOID LdrpDeleteExportHash (IN PVOID DllBase)
+/*++
+Routine Description:
+    This function frees the export name hash table of a DLL that is being unmapped, if it has one.
+    The caller must hold the loader lock.
+Arguments:
+    DllBase - Supplies the base of the DLL.
+--*/
+{
+    PLDRP_EXPORT_HASH ExportHash;
+    PLIST_ENTRY Next;
+
+    Next = LdrpExportHashList.Flink;
+    while (Next != &LdrpExportHashList) {
+        ExportHash = CONTAINING_RECORD(Next, LDRP_EXPORT_HASH, Links);
+        if (ExportHash->DllBase == DllBase) {
+            if (ExportHash == LdrpExportHashCache) {
+                LdrpExportHashCache = NULL;
+            }
+
+            RemoveEntryList(&ExportHash->Links);
+            RtlFreeHeap(RtlProcessHeap(), 0, ExportHash);
+            return;
+        }
+
+        Next = Next->Flink;
+    }
+}
+
+
 VOID LdrpUpdateLoadCount (IN PLDR_DATA_TABLE_ENTRY LdrDataTableEntry, IN BOOLEAN IncrementCount)
 /*++
 Routine Description:
@@ -0,0 +1,638 @@
+/*++
+
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+
+    lpcring.c
+
+Abstract:
+
+    This module implements the shared memory ring transport for LPC
+    connections.  See lpcring.h for the layout of the shared section and
+    the wakeup protocol.
+
+    The client creates the section and hands it to NtConnectPort as its
+    client view, so the kernel maps it into both processes as part of the
+    ordinary connection.  After that the kernel is only involved when a
+    reader finds its ring empty, or a client writer finds its ring full,
+    and has to sleep; the other side then sends a doorbell datagram.
+
+    A server receives doorbells through its connection port along with
+    everything else, so it never blocks inside this package.  A server
+    whose reply ring is full yields a few times for the client to make
+    room, and then gives up with STATUS_CANT_WAIT rather than let a client
+    that stopped reading hold the server thread.
+
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include "lpcring.h"
+
+#define RtlpLpcRingRecordSize( Length ) \
+    (((sizeof( ULONG ) + (Length)) + LPC_RING_ALIGNMENT - 1) & ~(LPC_RING_ALIGNMENT - 1))
+
+#define RtlpLpcRingValidSize( Size ) \
+    (((Size) >= LPC_RING_MINIMUM_SIZE) && ((Size) <= LPC_RING_MAXIMUM_SIZE) && (((Size) & ((Size) - 1)) == 0))
+
+//  How many times a server yields for room in a full reply ring
+
+#define LPC_RING_SERVER_YIELDS      16
+
+
+NTSTATUS
+RtlpRingLpcDoorbell(
+    IN PLPC_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This function wakes the other end of a ring connection by sending it
+    a zero length datagram.
+
+Arguments:
+
+    Ring - Supplies the ring connection.
+
+Return Value:
+
+    Status from NtRequestPort.
+
+--*/
+
+{
+    PORT_MESSAGE Message;
+
+    RtlZeroMemory( &Message, sizeof( Message ) );
+    Message.u1.s1.TotalLength = sizeof( Message );
+    Message.u1.s1.DataLength = 0;
+
+    Ring->DoorbellsSent += 1;
+
+    return NtRequestPort( Ring->Port, &Message );
+}
+
+
+NTSTATUS
+RtlpWaitLpcRing(
+    IN PLPC_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This function blocks the client end of a ring connection until the
+    server rings the doorbell.  Every doorbell is a hint to look at both
+    rings again, whichever one it was sent for.
+
+Arguments:
+
+    Ring - Supplies the client end of a ring connection.
+
+Return Value:
+
+    STATUS_SUCCESS if a doorbell arrived, STATUS_PORT_DISCONNECTED if the
+    server went away, or the status of the wait.
+
+--*/
+
+{
+    ULONG_PTR MessageBuffer[ PORT_MAXIMUM_MESSAGE_LENGTH / sizeof( ULONG_PTR ) ];
+    PPORT_MESSAGE Message = (PPORT_MESSAGE)MessageBuffer;
+    NTSTATUS Status;
+
+    Status = NtReplyWaitReceivePort( Ring->Port, NULL, NULL, Message );
+
+    if (!NT_SUCCESS( Status )) {
+
+        return Status;
+    }
+
+    if ((Message->u2.s2.Type & ~LPC_KERNELMODE_MESSAGE) == LPC_PORT_CLOSED) {
+
+        return STATUS_PORT_DISCONNECTED;
+    }
+
+    Ring->Wakeups += 1;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+RtlConnectLpcRing(
+    IN PUNICODE_STRING PortName,
+    IN PSECURITY_QUALITY_OF_SERVICE SecurityQos,
+    IN ULONG RingSize,
+    OUT PLPC_RING *Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This function connects to a server port as a ring connection.  A
+    section big enough for both rings is created and passed as the client
+    view of the connection.
+
+Arguments:
+
+    PortName - Supplies the name of the server connection port.
+
+    SecurityQos - Supplies the quality of service for the connection.
+
+    RingSize - Supplies the size in bytes of each ring.  Must be a power
+        of two between LPC_RING_MINIMUM_SIZE and LPC_RING_MAXIMUM_SIZE.
+        The largest message is half the ring size.
+
+    Ring - Receives the client end of the connection.
+
+Return Value:
+
+    Status of the operation.
+
+--*/
+
+{
+    LPC_RING_CONNECT_INFO ConnectInfo;
+    ULONG ConnectInfoLength;
+    PORT_VIEW ClientView;
+    LARGE_INTEGER SectionSize;
+    PLPC_RING NewRing;
+    NTSTATUS Status;
+
+    if (!RtlpLpcRingValidSize( RingSize )) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    NewRing = RtlAllocateHeap( RtlProcessHeap(), HEAP_ZERO_MEMORY, sizeof( LPC_RING ) );
+
+    if (NewRing == NULL) {
+
+        return STATUS_NO_MEMORY;
+    }
+
+    SectionSize.QuadPart = LPC_RING_SECTION_SIZE( RingSize );
+
+    Status = NtCreateSection( &NewRing->Section,
+                              SECTION_ALL_ACCESS,
+                              NULL,
+                              &SectionSize,
+                              PAGE_READWRITE,
+                              SEC_COMMIT,
+                              NULL );
+
+    if (!NT_SUCCESS( Status )) {
+
+        RtlFreeHeap( RtlProcessHeap(), 0, NewRing );
+        return Status;
+    }
+
+    ClientView.Length = sizeof( ClientView );
+    ClientView.SectionHandle = NewRing->Section;
+    ClientView.SectionOffset = 0;
+    ClientView.ViewSize = SectionSize.LowPart;
+    ClientView.ViewBase = NULL;
+    ClientView.ViewRemoteBase = NULL;
+
+    ConnectInfo.Signature = LPC_RING_SIGNATURE;
+    ConnectInfo.RingSize = RingSize;
+    ConnectInfoLength = sizeof( ConnectInfo );
+
+    Status = NtConnectPort( &NewRing->Port,
+                            PortName,
+                            SecurityQos,
+                            &ClientView,
+                            NULL,
+                            NULL,
+                            &ConnectInfo,
+                            &ConnectInfoLength );
+
+    if (!NT_SUCCESS( Status )) {
+
+        NtClose( NewRing->Section );
+        RtlFreeHeap( RtlProcessHeap(), 0, NewRing );
+        return Status;
+    }
+
+    //  The section is zero filled, so both rings start out empty with
+    //  nobody waiting.
+
+    NewRing->Server = FALSE;
+    NewRing->RingSize = RingSize;
+    NewRing->Base = (PLPC_RING_SECTION)ClientView.ViewBase;
+    NewRing->SendRing = &NewRing->Base->Request;
+    NewRing->SendData = (PUCHAR)(NewRing->Base + 1);
+    NewRing->ReceiveRing = &NewRing->Base->Reply;
+    NewRing->ReceiveData = NewRing->SendData + RingSize;
+
+    *Ring = NewRing;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+RtlAcceptLpcRing(
+    IN PPORT_MESSAGE ConnectionRequest,
+    IN PVOID Context OPTIONAL,
+    OUT PLPC_RING *Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This function is called by a server for an LPC_CONNECTION_REQUEST
+    message.  If the request came from RtlConnectLpcRing the connection
+    is accepted and completed, otherwise it is refused.
+
+    Messages received on the connection port for the new connection have
+    the returned ring as their port context.  Doorbells are zero length
+    LPC_DATAGRAM messages; the server should then call RtlReadLpcRing
+    until it returns STATUS_NO_MORE_ENTRIES.
+
+Arguments:
+
+    ConnectionRequest - Supplies the connection request message.
+
+    Context - Supplies a value for the server's use, stored in the ring.
+
+    Ring - Receives the server end of the connection.
+
+Return Value:
+
+    Status of the operation.  STATUS_INVALID_PARAMETER means the request
+    was not for a ring connection and has been refused.
+
+--*/
+
+{
+    PLPC_RING_CONNECT_INFO ConnectInfo;
+    REMOTE_PORT_VIEW ClientView;
+    PLPC_RING NewRing;
+    HANDLE Port;
+    NTSTATUS RefuseStatus;
+    NTSTATUS Status;
+
+    ConnectInfo = (PLPC_RING_CONNECT_INFO)(ConnectionRequest + 1);
+    NewRing = NULL;
+    RefuseStatus = STATUS_INVALID_PARAMETER;
+
+    if ((ConnectionRequest->u1.s1.DataLength >= sizeof( *ConnectInfo )) &&
+        (ConnectInfo->Signature == LPC_RING_SIGNATURE) &&
+        RtlpLpcRingValidSize( ConnectInfo->RingSize ) &&
+        (ConnectionRequest->ClientViewSize >= LPC_RING_SECTION_SIZE( ConnectInfo->RingSize ))) {
+
+        NewRing = RtlAllocateHeap( RtlProcessHeap(), HEAP_ZERO_MEMORY, sizeof( LPC_RING ) );
+        RefuseStatus = STATUS_NO_MEMORY;
+    }
+
+    ClientView.Length = sizeof( ClientView );
+
+    Status = NtAcceptConnectPort( &Port,
+                                  NewRing,
+                                  ConnectionRequest,
+                                  (BOOLEAN)(NewRing != NULL),
+                                  NULL,
+                                  (NewRing != NULL) ? &ClientView : NULL );
+
+    if (NewRing == NULL) {
+
+        return RefuseStatus;
+    }
+
+    if (!NT_SUCCESS( Status )) {
+
+        RtlFreeHeap( RtlProcessHeap(), 0, NewRing );
+        return Status;
+    }
+
+    //  The client's view is the ring section.  The client writes requests
+    //  into the first ring and reads replies from the second.
+
+    NewRing->Port = Port;
+    NewRing->Server = TRUE;
+    NewRing->RingSize = ConnectInfo->RingSize;
+    NewRing->Context = Context;
+    NewRing->Base = (PLPC_RING_SECTION)ClientView.ViewBase;
+    NewRing->ReceiveRing = &NewRing->Base->Request;
+    NewRing->ReceiveData = (PUCHAR)(NewRing->Base + 1);
+    NewRing->SendRing = &NewRing->Base->Reply;
+    NewRing->SendData = NewRing->ReceiveData + NewRing->RingSize;
+
+    Status = NtCompleteConnectPort( NewRing->Port );
+
+    if (!NT_SUCCESS( Status )) {
+
+        NtClose( NewRing->Port );
+        RtlFreeHeap( RtlProcessHeap(), 0, NewRing );
+        return Status;
+    }
+
+    *Ring = NewRing;
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+RtlWriteLpcRing(
+    IN PLPC_RING Ring,
+    IN PVOID Buffer,
+    IN ULONG Length
+    )
+
+/*++
+
+Routine Description:
+
+    This function writes one message into the send ring of a connection
+    and wakes the reader if it is asleep.  If the ring is full a client
+    sleeps until the server makes room.  A server yields a few times for
+    the client to make room and then fails, so that a client that stops
+    reading cannot pin it; the server may then reply through the port, or
+    drop the connection.
+
+Arguments:
+
+    Ring - Supplies the connection.
+
+    Buffer - Supplies the message.
+
+    Length - Supplies the length of the message in bytes.
+
+Return Value:
+
+    STATUS_CANT_WAIT if the ring of a server stays full, otherwise the
+    status of the operation.
+
+--*/
+
+{
+    PLPC_RING_HEADER Header;
+    ULONG Record;
+    ULONG Head;
+    ULONG Offset;
+    ULONG Contiguous;
+    ULONG Needed;
+    ULONG Yields;
+    NTSTATUS Status;
+
+    Header = Ring->SendRing;
+    Record = RtlpLpcRingRecordSize( Length );
+
+    if (Record > Ring->RingSize / 2) {
+
+        return STATUS_PORT_MESSAGE_TOO_LONG;
+    }
+
+    Yields = 0;
+
+    while (TRUE) {
+
+        //  A record never wraps.  If it does not fit before the end of the
+        //  ring a pad record fills the gap and it goes at the start.
+
+        Head = Header->Head;
+        Offset = Head & (Ring->RingSize - 1);
+        Contiguous = Ring->RingSize - Offset;
+        Needed = (Contiguous < Record) ? Contiguous + Record : Record;
+
+        if (Ring->RingSize - (Head - Header->Tail) >= Needed) {
+
+            break;
+        }
+
+        if (Ring->Server) {
+
+            if (Yields == LPC_RING_SERVER_YIELDS) {
+
+                return STATUS_CANT_WAIT;
+            }
+
+            Yields += 1;
+            NtYieldExecution();
+            continue;
+        }
+
+        //  Ask the reader for a doorbell and look again before sleeping,
+        //  in case it made room in between.
+
+        InterlockedExchange( &Header->ProducerWaiting, 1 );
+
+        if (Ring->RingSize - (Head - Header->Tail) >= Needed) {
+
+            InterlockedExchange( &Header->ProducerWaiting, 0 );
+            continue;
+        }
+
+        Status = RtlpWaitLpcRing( Ring );
+
+        if (!NT_SUCCESS( Status )) {
+
+            return Status;
+        }
+    }
+
+    if (Contiguous < Record) {
+
+        *(PULONG)(Ring->SendData + Offset) = LPC_RING_PAD_RECORD;
+        Head += Contiguous;
+        Offset = 0;
+    }
+
+    *(PULONG)(Ring->SendData + Offset) = Length;
+    RtlCopyMemory( Ring->SendData + Offset + sizeof( ULONG ), Buffer, Length );
+
+    InterlockedExchange( (PLONG)&Header->Head, Head + Record );
+
+    Ring->MessagesSent += 1;
+
+    //  Only a reader that found the ring empty needs a doorbell, and only
+    //  one writer gets to send it.
+
+    if ((Header->ConsumerWaiting != 0) &&
+        (InterlockedExchange( &Header->ConsumerWaiting, 0 ) != 0)) {
+
+        return RtlpRingLpcDoorbell( Ring );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS
+RtlReadLpcRing(
+    IN PLPC_RING Ring,
+    OUT PVOID Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength,
+    IN BOOLEAN Wait
+    )
+
+/*++
+
+Routine Description:
+
+    This function reads the next message from the receive ring of a
+    connection.  When the ring is empty the writer is asked for a
+    doorbell, and then the function either waits for it or returns.
+
+Arguments:
+
+    Ring - Supplies the connection.
+
+    Buffer - Receives the message.
+
+    BufferLength - Supplies the length of Buffer in bytes.
+
+    ReturnLength - Receives the length of the message.
+
+    Wait - Supplies TRUE to wait for a message if the ring is empty.
+        Only a client may wait.
+
+Return Value:
+
+    STATUS_SUCCESS - A message was returned.
+
+    STATUS_NO_MORE_ENTRIES - The ring is empty and Wait was FALSE.  A
+        doorbell will arrive when a message is written.
+
+    STATUS_BUFFER_TOO_SMALL - The message does not fit in Buffer; it is
+        left in the ring and ReturnLength receives its length.
+
+    STATUS_DATA_ERROR - The other side has corrupted the ring.
+
+--*/
+
+{
+    PLPC_RING_HEADER Header;
+    ULONG Tail;
+    ULONG Offset;
+    ULONG Length;
+    NTSTATUS Status;
+
+    Header = Ring->ReceiveRing;
+
+    if (Wait && Ring->Server) {
+
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    while (TRUE) {
+
+        Tail = Header->Tail;
+
+        if (Header->Head != Tail) {
+
+            //  The ring is shared with another process, so check that the
+            //  record lies inside it before using it.
+
+            if ((Header->Head - Tail) > Ring->RingSize) {
+
+                return STATUS_DATA_ERROR;
+            }
+
+            Offset = Tail & (Ring->RingSize - 1);
+            Length = *(volatile ULONG *)(Ring->ReceiveData + Offset);
+
+            if (Length & LPC_RING_PAD_RECORD) {
+
+                InterlockedExchange( (PLONG)&Header->Tail, Tail + (Ring->RingSize - Offset) );
+                continue;
+            }
+
+            if ((Length > Ring->RingSize / 2) ||
+                (Offset + RtlpLpcRingRecordSize( Length ) > Ring->RingSize)) {
+
+                return STATUS_DATA_ERROR;
+            }
+
+            *ReturnLength = Length;
+
+            if (Length > BufferLength) {
+
+                return STATUS_BUFFER_TOO_SMALL;
+            }
+
+            RtlCopyMemory( Buffer, Ring->ReceiveData + Offset + sizeof( ULONG ), Length );
+
+            InterlockedExchange( (PLONG)&Header->Tail, Tail + RtlpLpcRingRecordSize( Length ) );
+
+            Ring->MessagesReceived += 1;
+
+            if ((Header->ProducerWaiting != 0) &&
+                (InterlockedExchange( &Header->ProducerWaiting, 0 ) != 0)) {
+
+                RtlpRingLpcDoorbell( Ring );
+            }
+
+            return STATUS_SUCCESS;
+        }
+
+        //  Empty.  Ask for a doorbell and look again, so that a message
+        //  written in between is not missed.  If one did arrive the flag
+        //  is withdrawn; a doorbell may still come, which is harmless.
+
+        InterlockedExchange( &Header->ConsumerWaiting, 1 );
+
+        if (Header->Head != Tail) {
+
+            InterlockedExchange( &Header->ConsumerWaiting, 0 );
+            continue;
+        }
+
+        if (!Wait) {
+
+            return STATUS_NO_MORE_ENTRIES;
+        }
+
+        Status = RtlpWaitLpcRing( Ring );
+
+        if (!NT_SUCCESS( Status )) {
+
+            return Status;
+        }
+    }
+}
+
+
+VOID
+RtlCloseLpcRing(
+    IN PLPC_RING Ring
+    )
+
+/*++
+
+Routine Description:
+
+    This function closes one end of a ring connection.  The other end
+    sees the port close as it would for any LPC connection.
+
+Arguments:
+
+    Ring - Supplies the connection.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    NtClose( Ring->Port );
+
+    if (Ring->Section != NULL) {
+
+        NtClose( Ring->Section );
+    }
+
+    RtlFreeHeap( RtlProcessHeap(), 0, Ring );
+}
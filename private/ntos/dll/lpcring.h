@@ -0,0 +1,134 @@
+/*++
+
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+
+    lpcring.h
+
+Abstract:
+
+    Definitions for the shared memory ring transport layered on LPC
+    connections.
+
+    A ring connection is an ordinary LPC connection whose client view
+    section holds two single producer, single consumer byte rings, one
+    for requests and one for replies.  Messages are written straight into
+    the ring by the sender and read straight out by the receiver, so no
+    message is copied through the kernel.  The kernel is only entered to
+    wake a peer that has found its ring empty (or full) and gone to sleep;
+    the wakeup is a zero length LPC datagram called a doorbell.  A
+    receiver drains every message available per doorbell.
+
+--*/
+
+#ifndef __LPCRING_H__
+#define __LPCRING_H__
+
+#define LPC_RING_SIGNATURE          0x474e4952      // "RING"
+
+#define LPC_RING_ALIGNMENT          8
+#define LPC_RING_PAD_RECORD         0x80000000
+
+#define LPC_RING_MINIMUM_SIZE       0x1000
+#define LPC_RING_MAXIMUM_SIZE       0x100000
+
+
+//  Connection information sent with NtConnectPort.  The server takes the
+//  ring size from here rather than from the section, which the client does
+//  not initialize until the connection is complete.
+
+
+typedef struct _LPC_RING_CONNECT_INFO {
+    ULONG Signature;
+    ULONG RingSize;
+} LPC_RING_CONNECT_INFO, *PLPC_RING_CONNECT_INFO;
+
+
+//  Control block for one direction.  Head and Tail are free running byte
+//  counts; the producer only writes Head and the consumer only writes
+//  Tail, and they are kept on separate cache lines.  A side that finds the
+//  ring empty (or full) sets its Waiting flag, checks again, and then
+//  sleeps until the other side clears the flag and rings the doorbell.
+
+
+typedef struct _LPC_RING_HEADER {
+    volatile ULONG Head;
+    ULONG Reserved0[15];
+    volatile ULONG Tail;
+    ULONG Reserved1[15];
+    volatile LONG ConsumerWaiting;
+    volatile LONG ProducerWaiting;
+    ULONG Reserved2[14];
+} LPC_RING_HEADER, *PLPC_RING_HEADER;
+
+
+//  Layout of the client view section.  The request ring data and then the
+//  reply ring data follow this header, each RingSize bytes long.
+
+
+typedef struct _LPC_RING_SECTION {
+    LPC_RING_HEADER Request;
+    LPC_RING_HEADER Reply;
+} LPC_RING_SECTION, *PLPC_RING_SECTION;
+
+#define LPC_RING_SECTION_SIZE( RingSize ) (sizeof( LPC_RING_SECTION ) + 2 * (RingSize))
+
+
+//  Per process state for one end of a ring connection.
+
+
+typedef struct _LPC_RING {
+    HANDLE Port;
+    HANDLE Section;
+    BOOLEAN Server;
+    ULONG RingSize;
+    PLPC_RING_SECTION Base;
+    PLPC_RING_HEADER SendRing;
+    PUCHAR SendData;
+    PLPC_RING_HEADER ReceiveRing;
+    PUCHAR ReceiveData;
+    PVOID Context;
+    ULONG MessagesSent;
+    ULONG MessagesReceived;
+    ULONG DoorbellsSent;
+    ULONG Wakeups;
+} LPC_RING, *PLPC_RING;
+
+NTSTATUS
+RtlConnectLpcRing(
+    IN PUNICODE_STRING PortName,
+    IN PSECURITY_QUALITY_OF_SERVICE SecurityQos,
+    IN ULONG RingSize,
+    OUT PLPC_RING *Ring
+    );
+
+NTSTATUS
+RtlAcceptLpcRing(
+    IN PPORT_MESSAGE ConnectionRequest,
+    IN PVOID Context OPTIONAL,
+    OUT PLPC_RING *Ring
+    );
+
+NTSTATUS
+RtlWriteLpcRing(
+    IN PLPC_RING Ring,
+    IN PVOID Buffer,
+    IN ULONG Length
+    );
+
+NTSTATUS
+RtlReadLpcRing(
+    IN PLPC_RING Ring,
+    OUT PVOID Buffer,
+    IN ULONG BufferLength,
+    OUT PULONG ReturnLength,
+    IN BOOLEAN Wait
+    );
+
+VOID
+RtlCloseLpcRing(
+    IN PLPC_RING Ring
+    );
+
+#endif
@@ -57,6 +57,15 @@ PNAPCONTROL NapControl = NULL;
 PNAPDATA NapProfilingData = NULL;
 
 
+// The owners of the thread slots follow the profiling data in the
+// section, and the latency histograms follow them, one array like the
+// one above for each thread slot and one for the shared slot.
+
+
+PNAPTHREAD NapThreads = NULL;
+PNAPHISTOGRAM NapHistograms = NULL;
+
+
 VOID
 NapDllInit (
     VOID
@@ -109,6 +118,8 @@ Return Value:
     if (NT_SUCCESS(NapCreateDataSection(&NapControl))) {
 
         NapProfilingData = (PNAPDATA)(NapControl + 1);
+        NapThreads = (PNAPTHREAD)(NapProfilingData + NAP_API_COUNT + 1);
+        NapHistograms = (PNAPHISTOGRAM)(NapThreads + NAP_THREAD_SLOTS);
 
         if (!NapControl->Initialized) {
 
@@ -122,6 +133,11 @@ Return Value:
         NapControl->Paused = 0;
 
 
+        // Histogram mode starts off since the section is zero
+        // filled.  It is not stored here, so that a process which
+        // gets here as another turns it on cannot turn it off.
+
+
         // Clear the data area used for calibration data.
 
 
@@ -192,7 +208,10 @@ Return Value:
     ObjectAttributes.Attributes = OBJ_OPENIF | OBJ_CASE_INSENSITIVE;
 
     AllocationSize.HighPart = 0;
-    AllocationSize.LowPart = (NAP_API_COUNT + 1) * sizeof(NAPDATA);
+    AllocationSize.LowPart = sizeof(NAPCONTROL) +
+                             (NAP_API_COUNT + 1) * sizeof(NAPDATA) +
+                             NAP_THREAD_SLOTS * sizeof(NAPTHREAD) +
+                             (NAP_THREAD_SLOTS + 1) * (NAP_API_COUNT + 1) * sizeof(NAPHISTOGRAM);
 
     Status = NtCreateSection(&NapSectionHandle, SECTION_MAP_READ | SECTION_MAP_WRITE, &ObjectAttributes, &AllocationSize, PAGE_READWRITE, SEC_COMMIT, NULL);
     if (NT_SUCCESS(Status))
@@ -259,6 +278,22 @@ Return Value:
         ServiceNumber++;
 
 
+        // Elapsed time is end time minus start time
+
+
+        ElapsedTime =
+        RtlLargeIntegerSubtract(Counters[0],Counters[1]);
+
+
+        // In histogram mode the call is counted without a lock
+
+
+        if (NapControl->Histograms) {
+        NapRecordHistogram(ServiceNumber, ElapsedTime);
+        return;
+        }
+
+
         // Prevent others from changing data at the same time
         // we are.
 
@@ -272,13 +307,6 @@ Return Value:
         NapProfilingData[ServiceNumber].Calls++;
 
 
-        // Elapsed time is end time minus start time
-
-
-        ElapsedTime =
-        RtlLargeIntegerSubtract(Counters[0],Counters[1]);
-
-
         // Now add elapsed time to total time
 
 
@@ -324,6 +352,334 @@ Return Value:
 
 
 
+VOID
+NapRecordHistogram (
+    IN ULONG ServiceNumber,
+    IN LARGE_INTEGER ElapsedTime
+    )
+
+/*++
+
+Routine Description:
+
+    NapRecordHistogram() counts a call in the latency histogram of
+    the service in the slot of the calling thread.  It takes no lock:
+    the counters are bumped with interlocked increments, which only
+    contend for threads sharing the overflow slot.
+
+Arguments:
+
+    ServiceNumber - the number of the service being measured, already
+            bumped so that calibration is 0.
+
+    ElapsedTime   - the time the call took, in counter ticks.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PNAPHISTOGRAM Histogram;
+    ULONG Bucket;
+    ULONG Ticks;
+
+    Histogram = &NapHistograms[NapGetThreadSlot() * (NAP_API_COUNT + 1) + ServiceNumber];
+
+
+    // Find the highest bit set in the elapsed time; anything past
+    // the last bucket is counted in it
+
+
+    if (ElapsedTime.HighPart < 0) {
+    Bucket = 0;
+    }
+    else if (ElapsedTime.HighPart != 0) {
+    Bucket = NAP_HISTOGRAM_BUCKETS - 1;
+    }
+    else {
+    Bucket = 0;
+    Ticks = ElapsedTime.LowPart;
+    while ((Ticks >>= 1) != 0 && Bucket < NAP_HISTOGRAM_BUCKETS - 1) {
+        Bucket++;
+    }
+    }
+
+    InterlockedIncrement((PLONG)&Histogram->Calls);
+    InterlockedIncrement((PLONG)&Histogram->Buckets[Bucket]);
+}
+
+
+ULONG
+NapGetThreadSlot (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    NapGetThreadSlot() finds the histogram slot of the calling
+    thread, claiming a free one the first time the thread records a
+    call.  The search starts at the slot the thread id hashes to and
+    looks at NAP_THREAD_PROBES slots.  A slot belongs to the thread
+    only if both its process id and thread id match, since the slot
+    of a thread in another process that exited without giving it
+    back may carry the same thread id.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    The slot of the thread, or NAP_THREAD_SLOTS if it has none and
+    must use the shared slot.
+
+--*/
+
+{
+    ULONG ThreadId;
+    ULONG ProcessId;
+    ULONG Owner;
+    ULONG Slot;
+    ULONG Probe;
+
+    ThreadId = (ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread;
+    ProcessId = (ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueProcess;
+
+
+    // Thread ids are multiples of four, so skip the low bits
+
+
+    Slot = (ThreadId >> 2) & (NAP_THREAD_SLOTS - 1);
+
+    for (Probe = 0; Probe < NAP_THREAD_PROBES; Probe++) {
+
+    Owner = NapThreads[Slot].ThreadId;
+    if (Owner == ThreadId && NapThreads[Slot].ProcessId == ProcessId) {
+        return(Slot);
+    }
+
+
+    // The process id is written after the slot is claimed, but no
+    // other thread alive has the same thread id, so none can take
+    // the slot for its own in between
+
+
+    if (Owner == 0 &&
+        InterlockedCompareExchange((PLONG)&NapThreads[Slot].ThreadId,
+                       (LONG)ThreadId,
+                       0) == 0) {
+        NapThreads[Slot].ProcessId = ProcessId;
+        return(Slot);
+    }
+
+    Slot = (Slot + 1) & (NAP_THREAD_SLOTS - 1);
+    }
+
+    return(NAP_THREAD_SLOTS);
+}
+
+
+VOID
+NapReleaseThreadSlot (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    NapReleaseThreadSlot() is called by a thread as it exits to give
+    back its histogram slot, if it has one.  The histograms of the
+    slot are added to those of the shared slot, so the calls of the
+    thread still count in the merged report, and cleared for the next
+    thread to claim the slot.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PNAPHISTOGRAM Histogram;
+    PNAPHISTOGRAM Shared;
+    ULONG ThreadId;
+    ULONG ProcessId;
+    ULONG Slot;
+    ULONG Probe;
+    ULONG Service;
+    ULONG Bucket;
+
+    if (NapControl == NULL) {
+    return;
+    }
+
+    ThreadId = (ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueThread;
+    ProcessId = (ULONG)(ULONG_PTR)NtCurrentTeb()->ClientId.UniqueProcess;
+
+    Slot = (ThreadId >> 2) & (NAP_THREAD_SLOTS - 1);
+
+    for (Probe = 0; Probe < NAP_THREAD_PROBES; Probe++) {
+
+    if (NapThreads[Slot].ThreadId == ThreadId &&
+        NapThreads[Slot].ProcessId == ProcessId) {
+
+        Histogram = &NapHistograms[Slot * (NAP_API_COUNT + 1)];
+        Shared = &NapHistograms[NAP_THREAD_SLOTS * (NAP_API_COUNT + 1)];
+
+        for (Service = 0; Service <= NAP_API_COUNT; Service++) {
+
+        if (Histogram[Service].Calls != 0) {
+
+            InterlockedExchangeAdd((PLONG)&Shared[Service].Calls,
+                       (LONG)Histogram[Service].Calls);
+
+            for (Bucket = 0; Bucket < NAP_HISTOGRAM_BUCKETS; Bucket++) {
+            if (Histogram[Service].Buckets[Bucket] != 0) {
+                InterlockedExchangeAdd((PLONG)&Shared[Service].Buckets[Bucket],
+                           (LONG)Histogram[Service].Buckets[Bucket]);
+            }
+            }
+        }
+        }
+
+        RtlZeroMemory(Histogram, (NAP_API_COUNT + 1) * sizeof(NAPHISTOGRAM));
+
+        NapThreads[Slot].ProcessId = 0;
+        InterlockedExchange((PLONG)&NapThreads[Slot].ThreadId, 0);
+        return;
+    }
+
+    Slot = (Slot + 1) & (NAP_THREAD_SLOTS - 1);
+    }
+}
+
+
+VOID
+NapMergeHistograms (
+    IN ULONG FirstSlot,
+    IN ULONG Slots,
+    OUT NAPREPORT *NapApiReport
+    )
+
+/*++
+
+Routine Description:
+
+    NapMergeHistograms() adds up the histograms of each service in a
+    range of slots, and works out the number of calls and the median
+    and 99th percentile times from the sums.
+
+Arguments:
+
+    FirstSlot    - the first slot to merge.
+
+    Slots        - the number of slots to merge.
+
+    NapApiReport - the array of NAP_API_COUNT+1 reports to fill in.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PNAPHISTOGRAM Histogram;
+    PNAPREPORT Report;
+    ULONG ServiceNumber;
+    ULONG Slot;
+    ULONG Bucket;
+
+    for (ServiceNumber = 0; ServiceNumber <= NAP_API_COUNT; ServiceNumber++) {
+
+    Report = &NapApiReport[ServiceNumber];
+    RtlZeroMemory(Report, sizeof(NAPREPORT));
+
+    for (Slot = FirstSlot; Slot < FirstSlot + Slots; Slot++) {
+
+        Histogram = &NapHistograms[Slot * (NAP_API_COUNT + 1) + ServiceNumber];
+
+        Report->Histogram.Calls += Histogram->Calls;
+
+        for (Bucket = 0; Bucket < NAP_HISTOGRAM_BUCKETS; Bucket++) {
+        Report->Histogram.Buckets[Bucket] += Histogram->Buckets[Bucket];
+        }
+    }
+
+    Report->Calls = Report->Histogram.Calls;
+    Report->MedianTime = NapPercentileTime(&Report->Histogram, 50);
+    Report->P99Time = NapPercentileTime(&Report->Histogram, 99);
+    }
+}
+
+
+LARGE_INTEGER
+NapPercentileTime (
+    IN PNAPHISTOGRAM Histogram,
+    IN ULONG Percentile
+    )
+
+/*++
+
+Routine Description:
+
+    NapPercentileTime() finds the bucket of a merged histogram in
+    which the given percentile of the calls falls.
+
+Arguments:
+
+    Histogram  - the merged histogram.
+
+    Percentile - the percentile, from 1 to 100.
+
+Return Value:
+
+    The upper bound of the bucket, in counter ticks, or zero if no
+    calls were counted.
+
+--*/
+
+{
+    LARGE_INTEGER Time;
+    ULONGLONG Wanted;
+    ULONGLONG Seen;
+    ULONG Bucket;
+
+    Time.QuadPart = 0;
+
+    if (Histogram->Calls == 0) {
+    return(Time);
+    }
+
+    Wanted = ((ULONGLONG)Histogram->Calls * Percentile + 99) / 100;
+    Seen = 0;
+
+    for (Bucket = 0; Bucket < NAP_HISTOGRAM_BUCKETS; Bucket++) {
+    Seen += Histogram->Buckets[Bucket];
+    if (Seen >= Wanted) {
+        break;
+    }
+    }
+
+    if (Bucket == NAP_HISTOGRAM_BUCKETS) {
+    Bucket--;
+    }
+
+    Time.QuadPart = (LONGLONG)1 << (Bucket + 1);
+    return(Time);
+}
+
+
+
 NTSTATUS
 NapClearData (
     VOID
@@ -383,6 +739,16 @@ Return Value:
 
     NapReleaseSpinLock(&(NapProfilingData[1].NapLock));
 
+
+    // Clear the histograms, calibration included, and free the thread
+    // slots.  Calls recorded while this is going on may be lost or
+    // survive it.
+
+
+    RtlZeroMemory(NapThreads, NAP_THREAD_SLOTS * sizeof(NAPTHREAD));
+    RtlZeroMemory(NapHistograms,
+          (NAP_THREAD_SLOTS + 1) * (NAP_API_COUNT + 1) * sizeof(NAPHISTOGRAM));
+
     return(STATUS_SUCCESS);
 }
 
@@ -539,3 +905,176 @@ Return Value:
 
     return(STATUS_SUCCESS);
 }
+
+
+
+NTSTATUS
+NapRetrieveHistograms (
+    OUT NAPREPORT *NapApiReport,
+    OUT PCHAR **NapApiNames,
+    OUT PLARGE_INTEGER *NapCounterFrequency
+    )
+
+/*++
+
+Routine Description:
+
+    NapRetrieveHistograms() is called to get the latency histograms
+    of the API's that have been profiled in histogram mode.  The
+    slots of each service are merged into one histogram, and the
+    number of calls and the median and 99th percentile times are
+    worked out from it.  Unlike NapRetrieveData, this takes no locks,
+    so it can be called while profiling goes on; a call recorded at
+    the same time may be missing from the bucket counts or the total.
+
+Arguments:
+
+    NapApiReport - a pointer to a buffer to which is copied the
+           array of reports; must be large enough for
+           NAP_API_COUNT+1; call NapGetApiCount to obtain needed
+           size.
+
+    NapApiNames - a pointer to which is copied a pointer to
+          an array of pointers to API names
+
+    NapCounterFrequency - a buffer to which is copied the frequency
+              of the performance counter
+
+Return Value:
+
+    Status
+
+--*/
+
+{
+    *NapApiNames = NapNames;
+
+    *NapCounterFrequency = &NapFrequency;
+
+    NapMergeHistograms(0, NAP_THREAD_SLOTS + 1, NapApiReport);
+
+    return(STATUS_SUCCESS);
+}
+
+
+NTSTATUS
+NapRetrieveThreadHistograms (
+    IN ULONG ThreadSlot,
+    OUT PCLIENT_ID ClientId,
+    OUT NAPREPORT *NapApiReport
+    )
+
+/*++
+
+Routine Description:
+
+    NapRetrieveThreadHistograms() is called to get the latency
+    histograms of one thread.  Tools call it for slots 0, 1, 2 ...
+    until it fails, skipping the slots no thread has claimed.  Calls
+    of threads that found no slot of their own are only in the merged
+    report of NapRetrieveHistograms.  Like it, this takes no locks.
+
+Arguments:
+
+    ThreadSlot   - the slot to return.
+
+    ClientId     - a buffer to which is copied the ids of the thread
+           which claimed the slot, or zeros if the slot is free.
+
+    NapApiReport - a pointer to a buffer to which is copied the
+           array of reports of the thread; must be large enough for
+           NAP_API_COUNT+1.
+
+Return Value:
+
+    Status; STATUS_NO_MORE_ENTRIES past the last slot.
+
+--*/
+
+{
+    if (NapControl == NULL) {
+    return(STATUS_UNSUCCESSFUL);
+    }
+
+    if (ThreadSlot >= NAP_THREAD_SLOTS) {
+    return(STATUS_NO_MORE_ENTRIES);
+    }
+
+    ClientId->UniqueProcess = (HANDLE)(ULONG_PTR)NapThreads[ThreadSlot].ProcessId;
+    ClientId->UniqueThread = (HANDLE)(ULONG_PTR)NapThreads[ThreadSlot].ThreadId;
+
+    NapMergeHistograms(ThreadSlot, 1, NapApiReport);
+
+    return(STATUS_SUCCESS);
+}
+
+
+NTSTATUS
+NapStartHistograms (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    NapStartHistograms() switches data collection to histogram mode
+    for every process using the profiling section.  From then on
+    calls are counted in the latency histograms, without locks,
+    until a companion call to NapStopHistograms.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status
+
+--*/
+
+
+{
+    if (NapControl == NULL) {
+    return(STATUS_UNSUCCESSFUL);
+    }
+
+    NapControl->Histograms = TRUE;
+
+    return(STATUS_SUCCESS);
+}
+
+
+NTSTATUS
+NapStopHistograms (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    NapStopHistograms() switches data collection back to the
+    counters and timers returned by NapRetrieveData.  The histograms
+    are kept until NapClearData is called.
+
+Arguments:
+
+    None
+
+Return Value:
+
+    Status
+
+--*/
+
+
+{
+    if (NapControl == NULL) {
+    return(STATUS_UNSUCCESSFUL);
+    }
+
+    NapControl->Histograms = FALSE;
+
+    return(STATUS_SUCCESS);
+}
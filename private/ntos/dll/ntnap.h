@@ -50,9 +50,66 @@ typedef struct _NAPCONTROL {
 
     BOOLEAN Paused;
 
+
+    // Histogram control.  While set, NapRecordInfo counts each call
+    // in a latency histogram instead of taking the spinlock of the
+    // service to update its totals.  Can be set and cleared at any
+    // time by NapStartHistograms and NapStopHistograms.
+
+
+    BOOLEAN Histograms;
+
 } NAPCONTROL, *PNAPCONTROL;
 
 
+// Latency histograms.  Bucket i counts the calls that took from 2^i
+// up to 2^(i+1) performance counter ticks; bucket 0 also counts calls
+// that took no ticks.  Each thread claims one of NAP_THREAD_SLOTS
+// slots the first time it records a call, and has a histogram for
+// each service in it, so threads never share counters.  A thread that
+// finds no free slot within NAP_THREAD_PROBES of the one its thread
+// id hashes to records into the shared slot NAP_THREAD_SLOTS.  The
+// section is shared by every process, so a slot is owned by a process
+// id and thread id pair.  A thread gives its slot back as it exits,
+// adding its histograms to the shared slot, and NapClearData frees all
+// of them.  The slots are merged when the data is retrieved, or
+// returned one thread at a time.
+
+
+#define NAP_HISTOGRAM_BUCKETS   32
+#define NAP_THREAD_SLOTS        64      // Must be a power of two
+#define NAP_THREAD_PROBES       8
+
+typedef struct _NAPHISTOGRAM {
+
+    ULONG Calls;
+    ULONG Buckets[NAP_HISTOGRAM_BUCKETS];
+
+} NAPHISTOGRAM, *PNAPHISTOGRAM;
+
+typedef struct _NAPTHREAD {
+
+    ULONG ThreadId;             // Zero while the slot is free
+    ULONG ProcessId;
+
+} NAPTHREAD, *PNAPTHREAD;
+
+
+// Merged report for one service, as returned by NapRetrieveHistograms.
+// The percentile times are the upper bounds of the buckets the
+// percentiles fall in, in performance counter ticks.
+
+
+typedef struct _NAPREPORT {
+
+    ULONG Calls;
+    LARGE_INTEGER MedianTime;
+    LARGE_INTEGER P99Time;
+    NAPHISTOGRAM Histogram;
+
+} NAPREPORT, *PNAPREPORT;
+
+
 
 extern PCHAR NapNames[];
 
@@ -63,6 +120,24 @@ extern PCHAR NapNames[];
 VOID     NapDllInit        (VOID);
 VOID     NapRecordInfo        (IN ULONG, IN LARGE_INTEGER[]);
 NTSTATUS NapCreateDataSection    (PNAPCONTROL *);
+VOID     NapRecordHistogram    (IN ULONG, IN LARGE_INTEGER);
+ULONG    NapGetThreadSlot    (VOID);
+VOID     NapReleaseThreadSlot    (VOID);
+VOID     NapMergeHistograms    (IN ULONG, IN ULONG, OUT NAPREPORT *);
+LARGE_INTEGER NapPercentileTime (IN PNAPHISTOGRAM, IN ULONG);
+
+
+// Called by profiling tools
+
+
+NTSTATUS NapClearData        (VOID);
+NTSTATUS NapGetApiCount        (OUT PULONG);
+NTSTATUS NapPause        (VOID);
+NTSTATUS NapResume        (VOID);
+NTSTATUS NapRetrieveHistograms    (OUT NAPREPORT *, OUT PCHAR **, OUT PLARGE_INTEGER *);
+NTSTATUS NapRetrieveThreadHistograms (IN ULONG, OUT PCLIENT_ID, OUT NAPREPORT *);
+NTSTATUS NapStartHistograms    (VOID);
+NTSTATUS NapStopHistograms    (VOID);
 
 
 // Called by us
@@ -19,6 +19,7 @@ Environment:
 #include <ntrtl.h>
 #include <nturtl.h>
 #include <heap.h>
+#include <stktrace.h>
 #include "ldrp.h"
 
 
@@ -35,6 +36,18 @@ VOID RtlDumpResource( IN PRTL_RESOURCE Resource );
 
 extern BOOLEAN LdrpShutdownInProgress;
 extern HANDLE LdrpShutdownThreadId;
+extern PSTACK_TRACE_DATABASE RtlpStackTraceDataBase;
+
+
+// Bounds used to adapt the spin count of a critical section to the blocking
+// waits for it, in microseconds.
+
+
+#define RTLP_CS_SHORT_WAIT          50
+#define RTLP_CS_LONG_WAIT           1000
+#define RTLP_CS_MINIMUM_SPIN_COUNT  64
+
+LARGE_INTEGER RtlpPerformanceFrequency;
 
 VOID
 RtlpInitDeferedCriticalSection( VOID );
@@ -103,7 +116,7 @@ UnProtectHandle(
 }
 #endif // DBG
 
-RTL_CRITICAL_SECTION_DEBUG RtlpStaticDebugInfo[ 64 ];
+RTLP_CRITICAL_SECTION_PROFILE RtlpStaticDebugInfo[ 64 ];
 PRTL_CRITICAL_SECTION_DEBUG RtlpDebugInfoFreeList;
 BOOLEAN RtlpCritSectInitialized;
 
@@ -113,19 +126,19 @@ RtlpChainDebugInfo(
     IN ULONG Size
     )
 {
-    PRTL_CRITICAL_SECTION_DEBUG p, p1;
+    PRTLP_CRITICAL_SECTION_PROFILE p, p1;
 
-    if (Size = Size / sizeof( RTL_CRITICAL_SECTION_DEBUG )) {
-        p = (PRTL_CRITICAL_SECTION_DEBUG)BaseAddress + Size - 1;
+    if (Size = Size / sizeof( RTLP_CRITICAL_SECTION_PROFILE )) {
+        p = (PRTLP_CRITICAL_SECTION_PROFILE)BaseAddress + Size - 1;
         *(PRTL_CRITICAL_SECTION_DEBUG *)p = NULL;
         while (--Size) {
             p1 = p - 1;
-            *(PRTL_CRITICAL_SECTION_DEBUG *)p1 = p;
+            *(PRTL_CRITICAL_SECTION_DEBUG *)p1 = &p->DebugInfo;
             p = p1;
             }
         }
 
-    return p;
+    return &p->DebugInfo;
 }
 
 
@@ -179,7 +192,7 @@ RtlpFreeDebugInfo(
 {
     RtlEnterCriticalSection(&DeferedCriticalSection);
     try {
-        RtlZeroMemory( DebugInfo, sizeof( RTL_CRITICAL_SECTION_DEBUG ) );
+        RtlZeroMemory( DebugInfo, sizeof( RTLP_CRITICAL_SECTION_PROFILE ) );
         *(PRTL_CRITICAL_SECTION_DEBUG *)DebugInfo = RtlpDebugInfoFreeList;
         RtlpDebugInfoFreeList = (PRTL_CRITICAL_SECTION_DEBUG)DebugInfo;
         }
@@ -199,8 +212,12 @@ VOID
 RtlpInitDeferedCriticalSection( VOID )
 {
 
+    LARGE_INTEGER PerformanceCounter;
+
     InitializeListHead( &RtlCriticalSectionList );
 
+    NtQueryPerformanceCounter( &PerformanceCounter, &RtlpPerformanceFrequency );
+
     if (sizeof( RTL_CRITICAL_SECTION_DEBUG ) != sizeof( RTL_RESOURCE_DEBUG )) {
         DbgPrint( "NTDLL: Critical Section & Resource Debug Info length mismatch.\n" );
         return;
@@ -754,24 +771,30 @@ Return Value:
             Resource->ExclusiveOwnerThread = NULL;
 
 
-            //  If there is another waiting exclusive then give the resource
-            //  to it.
+            //  If there are waiting shared then give the resource to all of
+            //  them at once.  Handing it from one waiting exclusive to the
+            //  next instead would keep the shared waiters, which may be
+            //  many, queued up behind every exclusive that arrives.  The
+            //  waiting exclusive get the resource when the last of these
+            //  shared users releases it.
 
 
-            if (Resource->NumberOfWaitingExclusive > 0) {
+            if (Resource->NumberOfWaitingShared > 0) {
 
 
-                //  Set the resource to exclusive, and its owner undefined.
-                //  Decrement the number of waiting exclusive and release one
-                //  exclusive waiter
+                //  Set the new state to indicate that all of the shared
+                //  requesters have access and there are no more waiting
+                //  shared requesters, and then release all of the shared
+                //  requsters
 
 
-                Resource->NumberOfActive = -1;
-                Resource->NumberOfWaitingExclusive -= 1;
+                Resource->NumberOfActive = Resource->NumberOfWaitingShared;
+
+                Resource->NumberOfWaitingShared = 0;
 
                 Status = NtReleaseSemaphore(
-                             Resource->ExclusiveSemaphore,
-                             1,
+                             Resource->SharedSemaphore,
+                             Resource->NumberOfActive,
                              &PreviousCount
                              );
                 if ( !NT_SUCCESS(Status) ) {
@@ -779,26 +802,23 @@ Return Value:
                     }
 
 
-            //  Check to see if there are waiting shared, who should now get
-            //  the resource
+            //  Otherwise give the resource to the next waiting exclusive
 
 
-            } else if (Resource->NumberOfWaitingShared > 0) {
+            } else if (Resource->NumberOfWaitingExclusive > 0) {
 
 
-                //  Set the new state to indicate that all of the shared
-                //  requesters have access and there are no more waiting
-                //  shared requesters, and then release all of the shared
-                //  requsters
-
+                //  Set the resource to exclusive, and its owner undefined.
+                //  Decrement the number of waiting exclusive and release one
+                //  exclusive waiter
 
-                Resource->NumberOfActive = Resource->NumberOfWaitingShared;
 
-                Resource->NumberOfWaitingShared = 0;
+                Resource->NumberOfActive = -1;
+                Resource->NumberOfWaitingExclusive -= 1;
 
                 Status = NtReleaseSemaphore(
-                             Resource->SharedSemaphore,
-                             Resource->NumberOfActive,
+                             Resource->ExclusiveSemaphore,
+                             1,
                              &PreviousCount
                              );
                 if ( !NT_SUCCESS(Status) ) {
@@ -1324,9 +1344,15 @@ Return Value:
         return STATUS_NO_MEMORY;
     }
 
+    RtlZeroMemory( DebugInfo, sizeof( RTLP_CRITICAL_SECTION_PROFILE ) );
     DebugInfo->Type = RTL_CRITSECT_TYPE;
-    DebugInfo->ContentionCount = 0;
-    DebugInfo->EntryCount = 0;
+
+
+    // The spin count given is the most the critical section spins, the
+    // count is lowered while the waits for it are long.
+
+
+    ((PRTLP_CRITICAL_SECTION_PROFILE)DebugInfo)->MaximumSpinCount = (ULONG)CriticalSection->SpinCount;
 
 
     // If the critical section lock itself is not being initialized, then
@@ -1388,6 +1414,10 @@ Return Value:
         CriticalSection->SpinCount = 0;
         }
 
+    if ( CriticalSection->DebugInfo != NULL ) {
+        ((PRTLP_CRITICAL_SECTION_PROFILE)CriticalSection->DebugInfo)->MaximumSpinCount = (ULONG)CriticalSection->SpinCount;
+        }
+
     return OldSpinCount;
 }
 
@@ -1517,6 +1547,266 @@ Return Value:
 
 
 
+VOID
+RtlpProfileCriticalSectionWait(
+    IN PRTL_CRITICAL_SECTION CriticalSection,
+    IN LONGLONG WaitTicks
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records a blocking wait for a critical section in its
+    contention profile and adapts the spin count of the critical section.
+
+    The waiter has just been given the critical section, so the wait is
+    about as long as the owner went on holding it after the waiter gave up
+    spinning.  While recent waits are short, spinning a little longer
+    would have saved blocking, so the spin count is doubled, up to the
+    count the critical section was given.  While they are long the
+    spinning is wasted, so the spin count is halved.  Once the spinning
+    succeeds no more waits are seen and the spin count stays put.
+
+    The profile is updated with interlocked operations, since waiters on
+    different processors may record their waits at the same time.  Only
+    the spin count is stored without one; a lost update of it is made up
+    by the next wait.
+
+Arguments:
+
+    CriticalSection - Supplies the critical section that was waited for
+
+    WaitTicks - Supplies the length of the wait in performance counter ticks
+
+Return Value:
+
+    None.
+
+*/
+
+{
+    PRTLP_CRITICAL_SECTION_PROFILE Profile;
+    ULONGLONG Wait;
+    ULONG SpinCount;
+    ULONG MinimumSpinCount;
+    ULONG TotalWait;
+    ULONG Average;
+    ULONG NewAverage;
+    ULONG Maximum;
+
+    if (RtlpPerformanceFrequency.QuadPart == 0) {
+        return;
+        }
+
+    Profile = (PRTLP_CRITICAL_SECTION_PROFILE)CriticalSection->DebugInfo;
+
+    Wait = ((ULONGLONG)WaitTicks * 1000000) / RtlpPerformanceFrequency.QuadPart;
+    if (Wait > MAXULONG) {
+        Wait = MAXULONG;
+        }
+
+    TotalWait = (ULONG)InterlockedExchangeAdd( (PLONG)&Profile->TotalWaitTimeLow, (LONG)Wait );
+    if (TotalWait + (ULONG)Wait < TotalWait) {
+        InterlockedIncrement( (PLONG)&Profile->TotalWaitTimeHigh );
+        }
+
+    do {
+        Maximum = Profile->MaximumWait;
+        if ((ULONG)Wait <= Maximum) {
+            break;
+            }
+        }
+    while ((ULONG)InterlockedCompareExchange( (PLONG)&Profile->MaximumWait, (LONG)Wait, (LONG)Maximum ) != Maximum);
+
+    do {
+        Average = Profile->AverageWait;
+        NewAverage = (ULONG)((((ULONGLONG)Average * 7) + Wait) / 8);
+        }
+    while ((ULONG)InterlockedCompareExchange( (PLONG)&Profile->AverageWait, (LONG)NewAverage, (LONG)Average ) != Average);
+
+    if (Profile->MaximumSpinCount == 0) {
+        return;
+        }
+
+    SpinCount = (ULONG)CriticalSection->SpinCount;
+    if (NewAverage < RTLP_CS_SHORT_WAIT) {
+        if (SpinCount < Profile->MaximumSpinCount / 2) {
+            SpinCount *= 2;
+            }
+        else {
+            SpinCount = Profile->MaximumSpinCount;
+            }
+        }
+    else if (NewAverage > RTLP_CS_LONG_WAIT) {
+        MinimumSpinCount = min(RTLP_CS_MINIMUM_SPIN_COUNT, Profile->MaximumSpinCount);
+        if (SpinCount / 2 > MinimumSpinCount) {
+            SpinCount /= 2;
+            }
+        else {
+            SpinCount = MinimumSpinCount;
+            }
+        }
+
+    CriticalSection->SpinCount = SpinCount;
+}
+
+
+#if i386
+VOID
+RtlpProfileCriticalSectionOwner(
+    IN PRTL_CRITICAL_SECTION CriticalSection
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by an owner that has left a critical section
+    with threads waiting for it, after it has woken one of them.  It logs
+    the stack of the owner in the stack trace database and counts it
+    against the few stacks the profile of the critical section keeps.  A
+    stack that is not among them replaces the one seen least often, which
+    keeps the stacks seen most often.  The counts are bumped with
+    interlocked increments; two owners replacing the same stack at once
+    only lose one of the new stacks.
+
+Arguments:
+
+    CriticalSection - Supplies the critical section being left
+
+Return Value:
+
+    None.
+
+*/
+
+{
+    PRTLP_CRITICAL_SECTION_PROFILE Profile;
+    USHORT Index;
+    ULONG Slot;
+    ULONG i;
+
+    Index = RtlLogStackBackTrace();
+    if (Index == 0) {
+        return;
+        }
+
+    Profile = (PRTLP_CRITICAL_SECTION_PROFILE)CriticalSection->DebugInfo;
+
+    Slot = 0;
+    for (i = 0; i < RTLP_CS_OWNER_STACKS; i++) {
+        if (Profile->OwnerBackTraceIndex[ i ] == Index) {
+            InterlockedIncrement( (PLONG)&Profile->OwnerBackTraceCount[ i ] );
+            return;
+            }
+
+        if (Profile->OwnerBackTraceCount[ i ] < Profile->OwnerBackTraceCount[ Slot ]) {
+            Slot = i;
+            }
+        }
+
+    Profile->OwnerBackTraceIndex[ Slot ] = Index;
+    InterlockedIncrement( (PLONG)&Profile->OwnerBackTraceCount[ Slot ] );
+}
+#endif // i386
+
+
+ULONGLONG
+RtlpReadTotalWaitTime(
+    IN PRTLP_CRITICAL_SECTION_PROFILE Profile
+    )
+
+/*++
+
+Routine Description:
+
+    This routine reads the total wait time of a contention profile, which
+    is kept in two halves so that it can be added to with interlocked
+    operations.  The high half is read before and after the low one, and
+    the read is tried again if a carry came in between.
+
+Arguments:
+
+    Profile - Supplies the contention profile
+
+Return Value:
+
+    The total wait time in microseconds.
+
+*/
+
+{
+    ULONG High;
+    ULONG Low;
+
+    do {
+        High = *(volatile ULONG *)&Profile->TotalWaitTimeHigh;
+        Low = *(volatile ULONG *)&Profile->TotalWaitTimeLow;
+        }
+    while (High != *(volatile ULONG *)&Profile->TotalWaitTimeHigh);
+
+    return ((ULONGLONG)High << 32) | Low;
+}
+
+
+NTSTATUS
+RtlQueryCriticalSectionContention(
+    IN PRTL_CRITICAL_SECTION CriticalSection,
+    OUT PRTL_CRITICAL_SECTION_CONTENTION Contention
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns a snapshot of the contention profile of a
+    critical section.  The critical section need not be owned, so the
+    counts may be changing while they are copied.
+
+Arguments:
+
+    CriticalSection - Supplies the critical section to query
+
+    Contention - Returns the contention profile
+
+Return Value:
+
+    STATUS_SUCCESS, or STATUS_INVALID_PARAMETER if the critical section
+    has no debug information.
+
+*/
+
+{
+    PRTLP_CRITICAL_SECTION_PROFILE Profile;
+    ULONG Top;
+    ULONG i;
+
+    Profile = (PRTLP_CRITICAL_SECTION_PROFILE)CriticalSection->DebugInfo;
+    if (Profile == NULL) {
+        return STATUS_INVALID_PARAMETER;
+        }
+
+    Contention->EntryCount = Profile->DebugInfo.EntryCount;
+    Contention->ContentionCount = Profile->DebugInfo.ContentionCount;
+    Contention->SpinCount = (ULONG)CriticalSection->SpinCount;
+    Contention->MaximumSpinCount = Profile->MaximumSpinCount;
+    Contention->AverageWait = Profile->AverageWait;
+    Contention->MaximumWait = Profile->MaximumWait;
+    Contention->TotalWaitTime = RtlpReadTotalWaitTime( Profile );
+
+    Top = 0;
+    for (i = 1; i < RTLP_CS_OWNER_STACKS; i++) {
+        if (Profile->OwnerBackTraceCount[ i ] > Profile->OwnerBackTraceCount[ Top ]) {
+            Top = i;
+            }
+        }
+
+    Contention->OwnerBackTraceIndex = Profile->OwnerBackTraceIndex[ Top ];
+
+    return STATUS_SUCCESS;
+}
+
 
 // The following support routines are called from the machine language
 // implementations of RtlEnterCriticalSection and RtlLeaveCriticalSection
@@ -1533,6 +1823,7 @@ RtlpWaitForCriticalSection(
     ULONG TimeoutCount = 0;
     PLARGE_INTEGER TimeoutTime;
     BOOLEAN CsIsLoaderLock;
+    LARGE_INTEGER WaitBeginTime, WaitEndTime;
 
 
     // critical sections are disabled during exit process so that
@@ -1576,6 +1867,7 @@ RtlpWaitForCriticalSection(
         }
 
     CriticalSection->DebugInfo->EntryCount++;
+    NtQueryPerformanceCounter( &WaitBeginTime, NULL );
     while( TRUE ) {
 
         CriticalSection->DebugInfo->ContentionCount++;
@@ -1642,6 +1934,12 @@ RtlpWaitForCriticalSection(
                 // owns the lock if we have been granted ownership.
 
                 ASSERT(CriticalSection->OwningThread == 0);
+
+                NtQueryPerformanceCounter( &WaitEndTime, NULL );
+                RtlpProfileCriticalSectionWait( CriticalSection,
+                                                WaitEndTime.QuadPart - WaitBeginTime.QuadPart
+                                              );
+
                 if ( CsIsLoaderLock ) {
                     CriticalSection->OwningThread = NtCurrentTeb()->ClientId.UniqueThread;
                     NtCurrentTeb()->WaitingOnLoaderLock = 0;
@@ -1689,6 +1987,20 @@ RtlpUnWaitCriticalSection(
 #endif
 
     if ( NT_SUCCESS(st) ) {
+
+#if i386
+
+        // Remember who held up the waiters, once the waiter has been woken
+        // so that it does not wait for the stack to be logged.  The stack
+        // trace database has a critical section of its own, which must not
+        // be recorded or the release of it would recurse.
+
+        if ( RtlpStackTraceDataBase != NULL &&
+             CriticalSection != &RtlpStackTraceDataBase->Lock.CriticalSection ) {
+            RtlpProfileCriticalSectionOwner( CriticalSection );
+            }
+#endif // i386
+
         return;
         }
     else {
@@ -0,0 +1,245 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ucs.c
+
+Abstract:
+    Critical section and resource benchmark.  Worker threads enter a
+    critical section, do a little work holding it and a little more
+    outside it, in a tight loop.  The critical section is given a spin
+    count, which adapts to how long the waits for it turn out to be, so
+    with short holds the workers should mostly spin rather than block,
+    and with long holds they should stop wasting time spinning.  The rate
+    of entries is reported with the contention profile of the critical
+    section: the number of entries that had to wait, the spin count it
+    ended at and the most it was raised to, and the average and longest
+    wait in microseconds.  This is done for 1, 2, 4 ... threads up to the
+    count given, first with short and then with long holds.
+
+    Then the workers share a resource instead, most of them acquiring it
+    shared and one in eight exclusive, and the rates of shared and
+    exclusive acquires are reported.  Shared waiters are let in together
+    when an exclusive owner releases the resource rather than after every
+    exclusive waiter, so the shared rate should hold up as threads are
+    added.
+
+    usage: ucs [threads [hold [seconds]]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ldrp.h"       // RtlQueryCriticalSectionContention
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_SPIN_COUNT    4000
+#define BENCH_LONG_HOLD     100
+
+RTL_CRITICAL_SECTION BenchLock;
+RTL_RESOURCE BenchResource;
+volatile ULONG BenchWork;
+ULONG BenchHold;
+ULONGLONG SharedCounts[BENCH_MAX_THREADS];
+
+
+VOID DoWork(IN ULONG Amount)
+{
+    ULONG i;
+
+    for (i = 0; i < Amount; i++)
+    {
+        BenchWork += 1;
+    }
+}
+
+
+ULONG CriticalSectionThread(IN PVOID Context)
+{
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    while (!StopBenchmark)
+    {
+        RtlEnterCriticalSection(&BenchLock);
+        DoWork(BenchHold);
+        RtlLeaveCriticalSection(&BenchLock);
+
+        DoWork(BenchHold);
+        BenchCounts[ThreadIndex] += 1;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+ULONG ResourceThread(IN PVOID Context)
+{
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG Iteration = ThreadIndex;
+
+    while (!StopBenchmark)
+    {
+        if ((++Iteration % 8) == 0)
+        {
+            RtlAcquireResourceExclusive(&BenchResource, TRUE);
+            DoWork(BenchHold);
+            RtlReleaseResource(&BenchResource);
+            BenchCounts[ThreadIndex] += 1;
+        }
+        else
+        {
+            RtlAcquireResourceShared(&BenchResource, TRUE);
+            DoWork(BenchHold);
+            RtlReleaseResource(&BenchResource);
+            SharedCounts[ThreadIndex] += 1;
+        }
+
+        DoWork(BenchHold);
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunThreads(IN PUSER_THREAD_START_ROUTINE StartRoutine, IN ULONG Threads, IN ULONG Seconds, OUT PULONGLONG Shared, OUT PULONGLONG Exclusive)
+{
+    ULONG i;
+
+    for (i = 0; i < Threads; i++)
+    {
+        SharedCounts[i] = 0;
+    }
+
+    *Exclusive = BenchRunThreads(StartRoutine, Threads, Seconds, NULL, NULL);
+
+    *Shared = 0;
+    for (i = 0; i < Threads; i++)
+    {
+        *Shared += SharedCounts[i];
+    }
+}
+
+
+ULONG QueryContentionCount(IN PVOID Lock)
+{
+    PRTL_DEBUG_INFORMATION Buffer;
+    ULONG ContentionCount;
+    NTSTATUS Status;
+    ULONG i;
+
+    Buffer = RtlCreateQueryDebugBuffer(0, FALSE);
+    if (Buffer == NULL)
+    {
+        return 0;
+    }
+
+    ContentionCount = 0;
+    Status = RtlQueryProcessDebugInformation(NtCurrentTeb()->ClientId.UniqueProcess, RTL_QUERY_PROCESS_LOCKS, Buffer);
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; i < Buffer->Locks->NumberOfLocks; i++)
+        {
+            if (Buffer->Locks->Locks[i].Address == Lock)
+            {
+                ContentionCount = Buffer->Locks->Locks[i].ContentionCount;
+                break;
+            }
+        }
+    }
+
+    RtlDestroyQueryDebugBuffer(Buffer);
+    return ContentionCount;
+}
+
+
+VOID RunCriticalSection(IN ULONG Threads, IN ULONG Hold, IN ULONG Seconds)
+{
+    RTL_CRITICAL_SECTION_CONTENTION Contention;
+    ULONGLONG Shared;
+    ULONGLONG Entries;
+    NTSTATUS Status;
+
+    //  A fresh critical section starts from the full spin count and
+    //  zero counts
+
+    Status = RtlInitializeCriticalSectionAndSpinCount(&BenchLock, BENCH_SPIN_COUNT);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to initialize the critical section (%X)\n", Status);
+        return;
+    }
+
+    BenchHold = Hold;
+    RunThreads((PUSER_THREAD_START_ROUTINE)CriticalSectionThread, Threads, Seconds, &Shared, &Entries);
+
+    Status = RtlQueryCriticalSectionContention(&BenchLock, &Contention);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to query the critical section contention (%X)\n", Status);
+        RtlDeleteCriticalSection(&BenchLock);
+        return;
+    }
+
+    printf("%2u threads  hold %4u  %10I64u entries  %8I64u per sec  %8u waits  spin %5u max %5u  wait %6u avg %6u max\n",
+           Threads, Hold, Entries, Entries / Seconds, Contention.ContentionCount,
+           Contention.SpinCount, Contention.MaximumSpinCount, Contention.AverageWait, Contention.MaximumWait);
+
+    RtlDeleteCriticalSection(&BenchLock);
+}
+
+
+VOID RunResource(IN ULONG Threads, IN ULONG Hold, IN ULONG Seconds)
+{
+    ULONGLONG Shared;
+    ULONGLONG Exclusive;
+
+    RtlInitializeResource(&BenchResource);
+
+    BenchHold = Hold;
+    RunThreads((PUSER_THREAD_START_ROUTINE)ResourceThread, Threads, Seconds, &Shared, &Exclusive);
+
+    printf("%2u threads  hold %4u  %8I64u shared per sec  %8I64u exclusive per sec  %8u waits\n",
+           Threads, Hold, Shared / Seconds, Exclusive / Seconds, QueryContentionCount(&BenchResource));
+
+    RtlDeleteResource(&BenchResource);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Hold;
+    ULONG Seconds;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 1, 8);
+    Hold = BenchArgument(argc, argv, 2, 10);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: ucs [threads (1-%u) [hold [seconds]]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        RunCriticalSection(n, Hold, Seconds);
+        RunCriticalSection(n, Hold * BENCH_LONG_HOLD, Seconds);
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        RunResource(n, Hold, Seconds);
+    }
+
+    return 0;
+}
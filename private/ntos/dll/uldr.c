@@ -0,0 +1,180 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uldr.c
+
+Abstract:
+    Loader benchmark.  Loads the given DLL and looks up every name it
+    exports with LdrGetProcedureAddress in a tight loop, the way programs
+    that bind to a DLL at run time do.  Such lookups carry no hint, so each
+    one finds the name in the export name table of the DLL, which takes a
+    probe of the export name hash table for DLLs with many exports and a
+    binary search for the others.
+
+    Then the DLL is unloaded and loaded again in a loop, which maps it,
+    snaps its imports and runs its init routine each time, unless another
+    DLL in the process holds it loaded.  Built checked, setting
+    LdrpDisplayLoadTime from the debugger prints how long each DLL took
+    to map, snap and initialize.
+
+    usage: uldr [dll [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+
+VOID RunLookups(IN PVOID DllHandle, IN ULONG Seconds)
+{
+    PIMAGE_EXPORT_DIRECTORY ExportDirectory;
+    ANSI_STRING ProcedureName;
+    LARGE_INTEGER Start, End, Frequency;
+    PVOID ProcedureAddress;
+    PULONG NameTableBase;
+    ULONGLONG Lookups;
+    ULONGLONG Elapsed;
+    HANDLE Thread;
+    ULONG ExportSize;
+    NTSTATUS Status;
+    ULONG i;
+
+    ExportDirectory = RtlImageDirectoryEntryToData(DllHandle, TRUE, IMAGE_DIRECTORY_ENTRY_EXPORT, &ExportSize);
+    if ((ExportDirectory == NULL) || (ExportDirectory->NumberOfNames == 0))
+    {
+        printf("The DLL exports no names\n");
+        return;
+    }
+
+    NameTableBase = (PULONG)((ULONG_PTR)DllHandle + ExportDirectory->AddressOfNames);
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        return;
+    }
+
+    Lookups = 0;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        for (i = 0; i < ExportDirectory->NumberOfNames; i++)
+        {
+            RtlInitAnsiString(&ProcedureName, (PSZ)((ULONG_PTR)DllHandle + NameTableBase[i]));
+            Status = LdrGetProcedureAddress(DllHandle, &ProcedureName, 0, &ProcedureAddress);
+
+            //  Forwarders to DLLs that are not around fail, which is fine
+
+            if (!NT_SUCCESS(Status) && (Status != STATUS_DLL_NOT_FOUND) && (Status != STATUS_PROCEDURE_NOT_FOUND))
+            {
+                printf("Lookup of %Z failed (%X)\n", &ProcedureName, Status);
+                StopBenchmark = TRUE;
+                break;
+            }
+        }
+
+        Lookups += i;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("lookups  %5u names  %10I64u lookups  %8I64u ns/lookup\n",
+           ExportDirectory->NumberOfNames, Lookups, Lookups ? (Elapsed * 1000) / Lookups : 0);
+}
+
+
+BOOLEAN RunLoads(IN PUNICODE_STRING DllName, IN OUT PVOID *DllHandle, IN ULONG Seconds)
+{
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Loads;
+    ULONGLONG Elapsed;
+    HANDLE Thread;
+    NTSTATUS Status;
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        return TRUE;
+    }
+
+    Loads = 0;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        LdrUnloadDll(*DllHandle);
+
+        Status = LdrLoadDll(NULL, NULL, DllName, DllHandle);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Load of %wZ failed (%X)\n", DllName, Status);
+            StopBenchmark = TRUE;
+            BenchWaitTimer(Thread);
+            return FALSE;
+        }
+
+        Loads += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("loads    %10I64u loads  %8I64u us/load\n", Loads, Loads ? Elapsed / Loads : 0);
+
+    return TRUE;
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DllName;
+    PVOID DllHandle;
+    PCHAR Name = "gdi32.dll";
+    ULONG Seconds;
+    NTSTATUS Status;
+
+    if (argc > 1)
+    {
+        Name = argv[1];
+    }
+
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if (Seconds == 0)
+    {
+        printf("usage: uldr [dll [seconds]]\n");
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, Name);
+    RtlAnsiStringToUnicodeString(&DllName, &AnsiName, TRUE);
+
+    Status = LdrLoadDll(NULL, NULL, &DllName, &DllHandle);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to load %s (%X)\n", Name, Status);
+        return 1;
+    }
+
+    RunLookups(DllHandle, Seconds);
+
+    if (!RunLoads(&DllName, &DllHandle, Seconds))
+    {
+        return 1;
+    }
+
+    LdrUnloadDll(DllHandle);
+
+    return 0;
+}
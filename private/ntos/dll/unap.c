@@ -0,0 +1,162 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    unap.c
+
+Abstract:
+    System call profiler benchmark, for the NTDLL built with sources.nap.
+    Worker threads make cheap system calls in a tight loop, first with
+    profiling into the locked counters and timers of each service and
+    then in histogram mode, where each call is counted in the latency
+    histograms of its own thread without a lock.  The rates of
+    calls are reported for 1, 2, 4 ... threads up to the count given, so
+    the cost of the two modes can be compared as threads are added.
+
+    Finally the merged histograms are dumped: calls and the median and
+    99th percentile latency of every service called while histogram mode
+    was on, by this or any other process using the profiled NTDLL,
+    followed by the calls of each thread of this process that had its
+    own histograms.
+
+    usage: unap [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+#include "ntnap.h"
+
+
+ULONG WorkerThread(IN PVOID Context)
+{
+    LARGE_INTEGER SystemTime;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    while (!StopBenchmark)
+    {
+        NtQuerySystemTime(&SystemTime);
+        NtYieldExecution();
+        BenchCounts[ThreadIndex] += 2;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG Calls;
+
+    Calls = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WorkerThread, Threads, Seconds, NULL, NULL);
+    printf("%2u threads  %-10s %10I64u calls  %8I64u per sec\n", Threads, Title, Calls, Calls / Seconds);
+}
+
+
+VOID DumpReport(VOID)
+{
+    PLARGE_INTEGER Frequency;
+    PNAPREPORT Reports;
+    PCHAR *Names;
+    CLIENT_ID ClientId;
+    SIZE_T Size;
+    ULONG ApiCount;
+    ULONG Calls;
+    ULONG Slot;
+    NTSTATUS Status;
+    ULONG i;
+
+    NapGetApiCount(&ApiCount);
+
+    Reports = NULL;
+    Size = (ApiCount + 1) * sizeof(NAPREPORT);
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), (PVOID *)&Reports, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to allocate the report (%X)\n", Status);
+        return;
+    }
+
+    NapRetrieveHistograms(Reports, &Names, &Frequency);
+
+    //  Element 0 is the calibration data
+
+    printf("%-40s %10s %10s %10s\n", "service", "calls", "p50 us", "p99 us");
+    for (i = 1; i <= ApiCount; i++)
+    {
+        if (Reports[i].Calls != 0)
+        {
+            printf("%-40s %10u %10I64u %10I64u\n", Names[i], Reports[i].Calls,
+                   (Reports[i].MedianTime.QuadPart * 1000000) / Frequency->QuadPart,
+                   (Reports[i].P99Time.QuadPart * 1000000) / Frequency->QuadPart);
+        }
+    }
+
+    printf("\n%-10s %10s\n", "thread", "calls");
+    for (Slot = 0; NT_SUCCESS(NapRetrieveThreadHistograms(Slot, &ClientId, Reports)); Slot++)
+    {
+        if (ClientId.UniqueProcess == NtCurrentTeb()->ClientId.UniqueProcess)
+        {
+            Calls = 0;
+            for (i = 1; i <= ApiCount; i++)
+            {
+                Calls += Reports[i].Calls;
+            }
+
+            printf("%-10x %10u\n", (ULONG)(ULONG_PTR)ClientId.UniqueThread, Calls);
+        }
+    }
+
+    Size = 0;
+    NtFreeVirtualMemory(NtCurrentProcess(), (PVOID *)&Reports, &Size, MEM_RELEASE);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 1, 8);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: unap [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    NapPause();
+    NapClearData();
+    NapResume();
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        NapStopHistograms();
+        RunBenchmark("locked", n, Seconds);
+
+        if (!NT_SUCCESS(NapStartHistograms()))
+        {
+            printf("Profiling is not initialized; is this the profiled NTDLL?\n");
+            return 1;
+        }
+
+        RunBenchmark("histograms", n, Seconds);
+    }
+
+    NapPause();
+    DumpReport();
+    NapStopHistograms();
+    NapResume();
+
+    return 0;
+}
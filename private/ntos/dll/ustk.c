@@ -0,0 +1,138 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ustk.c
+
+Abstract:
+    Stack trace database benchmark.  Worker threads allocate and free
+    heap blocks in a tight loop from a few different call sites, and the
+    rate of allocations is reported for 1, 2, 4 ... threads up to the
+    count given.  Run it once with the user mode stack trace database
+    turned on (gflags +ust) and once without to see what tracing costs.
+    With tracing on, every allocation logs its stack, and since the same
+    few stacks come up again and again the logging mostly finds them in
+    the database without taking its lock, so the rate should scale with
+    the threads much as it does with tracing off.
+
+    With tracing on, the rate of bare RtlLogStackBackTrace calls is
+    reported as well.
+
+    usage: ustk [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_BLOCK_SIZE    64
+
+HANDLE BenchHeap;
+BOOLEAN BenchLogOnly;
+
+
+//  Separate routines so that the allocations come from a few different
+//  stacks
+
+PVOID AllocateSmall(VOID)
+{
+    return RtlAllocateHeap(BenchHeap, 0, BENCH_BLOCK_SIZE);
+}
+
+
+PVOID AllocateLarge(VOID)
+{
+    return RtlAllocateHeap(BenchHeap, 0, BENCH_BLOCK_SIZE * 8);
+}
+
+
+ULONG WorkerThread(IN PVOID Context)
+{
+    PVOID Small, Large;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    while (!StopBenchmark)
+    {
+        if (BenchLogOnly)
+        {
+            RtlLogStackBackTrace();
+            BenchCounts[ThreadIndex] += 1;
+            continue;
+        }
+
+        Small = AllocateSmall();
+        Large = AllocateLarge();
+        if ((Small == NULL) || (Large == NULL))
+        {
+            printf("Allocation failed\n");
+            break;
+        }
+
+        RtlFreeHeap(BenchHeap, 0, Large);
+        RtlFreeHeap(BenchHeap, 0, Small);
+        BenchCounts[ThreadIndex] += 2;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG Calls;
+
+    Calls = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WorkerThread, Threads, Seconds, NULL, NULL);
+    printf("%2u threads  %-12s %10I64u calls  %8I64u per sec\n", Threads, Title, Calls, Calls / Seconds);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    BOOLEAN Tracing;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 1, 8);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: ustk [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    Tracing = (NtCurrentPeb()->NtGlobalFlag & FLG_USER_STACK_TRACE_DB) != 0;
+    printf("stack trace database %s\n", Tracing ? "on" : "off");
+
+    BenchHeap = RtlCreateHeap(HEAP_GROWABLE, NULL, 0, 0, NULL, NULL);
+    if (BenchHeap == NULL)
+    {
+        printf("Unable to create the heap\n");
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        BenchLogOnly = FALSE;
+        RunBenchmark("allocations", n, Seconds);
+
+        if (Tracing)
+        {
+            BenchLogOnly = TRUE;
+            RunBenchmark("traces", n, Seconds);
+        }
+    }
+
+    RtlDestroyHeap(BenchHeap);
+
+    return 0;
+}
@@ -57,6 +57,8 @@ Arguments:
         SysDbgSetSpecialCall
         SysDbgClearSpecialCalls
         SysDbgQuerySpecialCalls
+        SysDbgStartTrace
+        SysDbgStopTrace
 
     InputBuffer - A pointer to a buffer describing the input data for
         the request, if any.  The structure of this buffer varies
@@ -196,6 +198,20 @@ Return Value:
             }
             break;
 
+        case SysDbgStartTrace:
+        case SysDbgStopTrace:
+
+            status = ExpTraceControl(
+                        Command,
+                        InputBuffer,
+                        InputBufferLength,
+                        OutputBuffer,
+                        OutputBufferLength,
+                        &length
+                        );
+
+            break;
+
         default:
 
 
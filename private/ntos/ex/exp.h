@@ -127,6 +127,16 @@ ExpProfileDelete (
     IN PVOID Object
     );
 
+NTSTATUS
+ExpTraceControl (
+    IN SYSDBG_COMMAND Command,
+    IN PVOID InputBuffer,
+    IN ULONG InputBufferLength,
+    OUT PVOID OutputBuffer,
+    IN ULONG OutputBufferLength,
+    OUT PULONG ReturnLength
+    );
+
 
 BOOLEAN
 ExpInitializeCallbacks (
@@ -101,6 +101,7 @@ ExpLookupHandleTableEntry (
 #pragma alloc_text(PAGE, ExDestroyHandle)
 #pragma alloc_text(PAGE, ExChangeHandle)
 #pragma alloc_text(PAGE, ExMapHandleToPointer)
+#pragma alloc_text(PAGE, ExLookupHandleTableObject)
 #pragma alloc_text(PAGE, ExpAllocateHandleTable)
 #pragma alloc_text(PAGE, ExpFreeHandleTable)
 #pragma alloc_text(PAGE, ExpAllocateHandleTableEntry)
@@ -1384,6 +1385,73 @@ Return Value:
 }
 
 
+NTKERNELAPI
+PVOID
+ExLookupHandleTableObject (
+    IN PHANDLE_TABLE HandleTable,
+    IN HANDLE Handle
+    )
+
+/*++
+
+Routine Description:
+
+    This function maps a handle to the object pointer stored in its handle
+    table entry.  Unlike ExMapHandleToPointer the entry is not locked, so
+    the lookup never waits for other users of the entry and never writes
+    to it.  The value returned is only a snapshot; the entry may be freed
+    or changed as soon as it has been read, and the caller is responsible
+    for making sure that the object it points to is still there before it
+    uses it.
+
+Arguments:
+
+    HandleTable - Supplies a pointer to a handle table.
+
+    Handle - Supplies the handle to be mapped.
+
+Return Value:
+
+    The object pointer from the handle table entry, with the lock bit
+    restored, or NULL if the handle is invalid or its entry is free.
+
+--*/
+
+{
+    EXHANDLE LocalHandle;
+    PHANDLE_TABLE_ENTRY HandleTableEntry;
+    LONG_PTR CurrentValue;
+
+    PAGED_CODE();
+
+    LocalHandle.GenericHandleOverlay = Handle;
+
+    HandleTableEntry = ExpLookupHandleTableEntry( HandleTable,
+                                                  LocalHandle );
+
+    if (HandleTableEntry == NULL) {
+
+        return NULL;
+    }
+
+
+    //  A zero value means the entry is free.  Otherwise the pointer is
+    //  stored with its sign bit clear while the entry is unlocked and set
+    //  while it is locked, and in either case setting the bit gives back
+    //  the original pointer.
+
+
+    CurrentValue = *((volatile LONG_PTR *)&HandleTableEntry->Object);
+
+    if (CurrentValue == 0) {
+
+        return NULL;
+    }
+
+    return (PVOID)(CurrentValue | EXHANDLE_TABLE_ENTRY_LOCK_BIT);
+}
+
+
 
 //  Local Support Routine
 
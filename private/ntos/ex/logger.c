@@ -5,7 +5,10 @@ Module Name:
     logger.c
 
 Abstract:
-    This file contains the code for the debug logging facility.
+    This file contains the code for the debug logging facility, and for the
+    kernel event tracing that logs timestamped events of the I/O manager,
+    page fault path and context switch into per-processor rings and writes
+    them to a file.
 
 Author:
     Steve Wood (stevewo) 20-Jun-1992
@@ -19,6 +22,64 @@ Revision History:
 
 #include "exp.h"
 
+// Events per processor of a trace session, rounded up to a power of two
+#define EXP_TRACE_MINIMUM_EVENTS    256
+#define EXP_TRACE_MAXIMUM_EVENTS    (64 * 1024)
+
+// Bytes the logger thread gathers in its write buffer before writing them
+#define EXP_TRACE_WRITE_SIZE        (64 * 1024)
+
+// How often the logger thread drains the rings, in 100ns units
+#define EXP_TRACE_FLUSH_INTERVAL    (-10 * 1000 * 1000)
+
+// The ring of a processor.  Writers reserve slots by incrementing Next,
+// which may wrap over events the logger thread has not flushed yet, and
+// store the slot's Sequence, its index plus one, last.  The logger thread
+// flushes the events between Flushed and Next whose Sequence matches.
+typedef struct _EXP_TRACE_BUFFER {
+    ULONG Next;
+    ULONG Flushed;
+    ULONG Mask;
+    ULONG Reserved;
+    EX_TRACE_EVENT Events[1];
+} EXP_TRACE_BUFFER, *PEXP_TRACE_BUFFER;
+
+typedef struct _EXP_TRACE_SESSION {
+    ULONG EnableFlags;
+    ULONG EventsPerProcessor;
+    UNICODE_STRING FileName;
+    HANDLE FileHandle;
+    LARGE_INTEGER FileOffset;
+    NTSTATUS Status;
+    PETHREAD LoggerThread;
+    KEVENT StartedEvent;
+    KEVENT StopEvent;
+    PEX_TRACE_EVENT WriteBuffer;
+    ULONG WriteCount;
+    PEXP_TRACE_BUFFER Buffers[MAXIMUM_PROCESSORS];
+} EXP_TRACE_SESSION, *PEXP_TRACE_SESSION;
+
+VOID ExpTraceLoggerThread(IN PVOID Context);
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, ExStartTrace)
+#pragma alloc_text(PAGE, ExStopTrace)
+#pragma alloc_text(PAGE, ExpTraceControl)
+#pragma alloc_text(PAGE, ExpTraceLoggerThread)
+#endif
+
+// The classes enabled by any session, checked by the callers of
+// ExTraceEvent so that tracing costs nothing when it is off
+ULONG ExTraceEnableFlags;
+
+// The active sessions, read by ExTraceEvent at DISPATCH_LEVEL and changed
+// holding ExpTraceControl, which also serializes starting and stopping
+PEXP_TRACE_SESSION ExpTraceSessions[EX_TRACE_MAXIMUM_SESSIONS];
+ULONG ExpTraceHooks;
+FAST_MUTEX ExpTraceControl;
+BOOLEAN ExpTraceControlInitialized;
+KSPIN_LOCK ExpTraceLock;
+
 
 PEX_DEBUG_LOG ExCreateDebugLog(IN UCHAR MaximumNumberOfTags, IN ULONG MaximumNumberOfEvents)
 {
@@ -100,4 +161,669 @@ VOID ExDebugLogEvent(IN PEX_DEBUG_LOG Log, IN UCHAR Tag, IN ULONG Data1, IN ULON
     p->Data[2] = Data3;
     p->Data[3] = Data4;
     ExReleaseSpinLock(&Log->Lock, OldIrql);
-}
\ No newline at end of file
+}
+
+
+VOID FASTCALL ExpTracePageFault(IN NTSTATUS Status, IN PVOID VirtualAddress, IN PVOID TrapInformation)
+{
+    ULONG_PTR ProgramCounter = 0;
+
+#if defined(_X86_)
+    if (TrapInformation != NULL) {
+        ProgramCounter = ((PKTRAP_FRAME)TrapInformation)->Eip;
+    }
+#endif
+
+    ExTraceEvent(EX_TRACE_CLASS_PAGE_FAULT, EX_TRACE_EVENT_PAGE_FAULT, (ULONG_PTR)VirtualAddress, (ULONG_PTR)Status, ProgramCounter, 0);
+}
+
+
+VOID FASTCALL ExpTraceContextSwap(IN HANDLE OldThreadId, IN HANDLE NewThreadId)
+{
+    ExTraceEvent(EX_TRACE_CLASS_CONTEXT_SWAP, EX_TRACE_EVENT_CONTEXT_SWAP, (ULONG_PTR)OldThreadId, (ULONG_PTR)NewThreadId, 0, 0);
+}
+
+
+VOID ExTraceEvent(IN ULONG Class, IN USHORT Type, IN ULONG_PTR Data1, IN ULONG_PTR Data2, IN ULONG_PTR Data3, IN ULONG_PTR Data4)
+/*++
+Routine Description:
+    This function logs an event into the ring of the current processor of every trace session that enables its class.
+    It takes no lock, so it may be called at any IRQL up to SYNCH_LEVEL, including with the dispatcher lock held.
+Arguments:
+    Class - Supplies the EX_TRACE_CLASS_ of the event.
+    Type - Supplies the EX_TRACE_EVENT_ type of the event.
+    Data1, Data2, Data3, Data4 - Supply the data of the event.
+Return Value:
+    None.
+--*/
+{
+    PEXP_TRACE_SESSION Session;
+    PEXP_TRACE_BUFFER Buffer;
+    PEX_TRACE_EVENT Event;
+    PETHREAD Thread;
+    LARGE_INTEGER TimeStamp;
+    KIRQL OldIrql;
+    ULONG Processor;
+    ULONG Index;
+    ULONG i;
+
+    // Running at DISPATCH_LEVEL keeps the ring this processor's, and keeps
+    // the sessions from being freed until the event is logged.
+    OldIrql = KeGetCurrentIrql();
+    if (OldIrql < DISPATCH_LEVEL) {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+    }
+
+    TimeStamp = KeQueryPerformanceCounter(NULL);
+    Processor = KeGetCurrentProcessorNumber();
+    Thread = PsGetCurrentThread();
+
+    for (i = 0; i < EX_TRACE_MAXIMUM_SESSIONS; i += 1) {
+        Session = ExpTraceSessions[i];
+        if ((Session == NULL) || ((Session->EnableFlags & Class) == 0)) {
+            continue;
+        }
+
+        // The slot is reserved interlocked since an event may be logged
+        // from an interrupt of one being logged on the same processor.
+        // Its sequence is cleared first and stored last so that the logger
+        // thread neither flushes it half written nor keeps a copy of it
+        // that was overwritten while being taken.
+        Buffer = Session->Buffers[Processor];
+        Index = (ULONG)InterlockedIncrement((PLONG)&Buffer->Next) - 1;
+        Event = &Buffer->Events[Index & Buffer->Mask];
+
+        *((volatile ULONG *)&Event->Sequence) = 0;
+        Event->Type = Type;
+        Event->Processor = (UCHAR)Processor;
+        Event->Irql = OldIrql;
+        Event->ProcessId = Thread->Cid.UniqueProcess;
+        Event->ThreadId = Thread->Cid.UniqueThread;
+        Event->TimeStamp = TimeStamp;
+        Event->Data[0] = Data1;
+        Event->Data[1] = Data2;
+        Event->Data[2] = Data3;
+        Event->Data[3] = Data4;
+        *((volatile ULONG *)&Event->Sequence) = Index + 1;
+    }
+
+    if (OldIrql < DISPATCH_LEVEL) {
+        KeLowerIrql(OldIrql);
+    }
+}
+
+
+VOID ExpAcquireTraceControl(VOID)
+{
+    KIRQL OldIrql;
+
+    // There is no executive initialization to set up the control mutex, so
+    // the first caller does it.
+    if (!ExpTraceControlInitialized) {
+        ExAcquireSpinLock(&ExpTraceLock, &OldIrql);
+        if (!ExpTraceControlInitialized) {
+            ExInitializeFastMutex(&ExpTraceControl);
+            ExpTraceControlInitialized = TRUE;
+        }
+        ExReleaseSpinLock(&ExpTraceLock, OldIrql);
+    }
+
+    KeEnterCriticalRegion();
+    ExAcquireFastMutexUnsafe(&ExpTraceControl);
+}
+
+
+VOID ExpReleaseTraceControl(VOID)
+{
+    ExReleaseFastMutexUnsafe(&ExpTraceControl);
+    KeLeaveCriticalRegion();
+}
+
+
+NTSTATUS ExpUpdateTraceHooks(IN ULONG StartFlags)
+/*++
+Routine Description:
+    This function recomputes the enabled classes after a session is stopped, or before one is started,
+    and sets or clears the page fault and context swap callouts that log the events of those classes.
+    The callouts are single slots with no way to chain, so a class whose slot holds someone else's routine cannot be enabled,
+    and disabling a class clears its slot only if it still holds the trace routine.  Slots of classes whose state does not change
+    are not touched.  It is called holding the trace control mutex.
+Arguments:
+    StartFlags - Supplies the classes of the session being started, which is not in the session table yet, or zero.
+Return Value:
+    STATUS_SUCCESS, or STATUS_DEVICE_BUSY if the slot of a class being enabled holds another routine,
+    in which case no slot and no enabled class is changed.
+--*/
+{
+    PPAGE_FAULT_NOTIFY_ROUTINE PageFaultRoutine;
+    PSWAP_CONTEXT_NOTIFY_ROUTINE ContextSwapRoutine;
+    ULONG EnableFlags;
+    ULONG Enable;
+    ULONG i;
+
+    EnableFlags = StartFlags;
+    for (i = 0; i < EX_TRACE_MAXIMUM_SESSIONS; i += 1) {
+        if (ExpTraceSessions[i] != NULL) {
+            EnableFlags |= ExpTraceSessions[i]->EnableFlags;
+        }
+    }
+
+    Enable = EnableFlags & ~ExpTraceHooks;
+
+    if (Enable & EX_TRACE_CLASS_PAGE_FAULT) {
+        PageFaultRoutine = MmExchangePageFaultNotifyRoutine(ExpTracePageFault, NULL);
+        if ((PageFaultRoutine != NULL) && (PageFaultRoutine != ExpTracePageFault)) {
+            return STATUS_DEVICE_BUSY;
+        }
+    }
+
+    // The context swap callout is only made by the multiprocessor kernel.
+    if (Enable & EX_TRACE_CLASS_CONTEXT_SWAP) {
+        ContextSwapRoutine = KeExchangeSwapContextNotifyRoutine(ExpTraceContextSwap, NULL);
+        if ((ContextSwapRoutine != NULL) && (ContextSwapRoutine != ExpTraceContextSwap)) {
+            if (Enable & EX_TRACE_CLASS_PAGE_FAULT) {
+                MmExchangePageFaultNotifyRoutine(NULL, ExpTracePageFault);
+            }
+
+            return STATUS_DEVICE_BUSY;
+        }
+    }
+
+    ExTraceEnableFlags = EnableFlags;
+
+    if (ExpTraceHooks & ~EnableFlags & EX_TRACE_CLASS_PAGE_FAULT) {
+        MmExchangePageFaultNotifyRoutine(NULL, ExpTracePageFault);
+    }
+
+    if (ExpTraceHooks & ~EnableFlags & EX_TRACE_CLASS_CONTEXT_SWAP) {
+        KeExchangeSwapContextNotifyRoutine(NULL, ExpTraceContextSwap);
+    }
+
+    ExpTraceHooks = EnableFlags;
+    return STATUS_SUCCESS;
+}
+
+VOID ExpFreeTraceSession(IN PEXP_TRACE_SESSION Session)
+{
+    ULONG i;
+
+    for (i = 0; i < MAXIMUM_PROCESSORS; i += 1) {
+        if (Session->Buffers[i] != NULL) {
+            ExFreePool(Session->Buffers[i]);
+        }
+    }
+
+    if (Session->WriteBuffer != NULL) {
+        ExFreePool(Session->WriteBuffer);
+    }
+
+    if (Session->FileName.Buffer != NULL) {
+        ExFreePool(Session->FileName.Buffer);
+    }
+
+    if (Session->LoggerThread != NULL) {
+        ObDereferenceObject(Session->LoggerThread);
+    }
+
+    ExFreePool(Session);
+}
+
+
+NTSTATUS ExStartTrace(IN PUNICODE_STRING FileName, IN ULONG EnableFlags, IN ULONG EventsPerProcessor, OUT PULONG SessionId)
+/*++
+Routine Description:
+    This function starts a trace session, which logs the events of the given classes into a ring per processor,
+    and starts its logger thread, which creates the file and writes the events to it about once a second.
+    A ring that fills between writes wraps over its oldest events, and the number lost is written in their place.
+Arguments:
+    FileName - Supplies the name of the file to write the events to.  It is overwritten if it exists.
+    EnableFlags - Supplies the EX_TRACE_CLASS_ flags of the events to log.
+    EventsPerProcessor - Supplies the number of events each ring holds; it is rounded up to a power of two.
+    SessionId - Receives the identifier to stop the session with.
+Return Value:
+    STATUS_SUCCESS, STATUS_INVALID_PARAMETER, STATUS_INSUFFICIENT_RESOURCES if the maximum number of sessions are running or
+    memory cannot be allocated, STATUS_DEVICE_BUSY if the page fault or context swap callout a class needs is set by someone else,
+    or the status of creating the file.
+--*/
+{
+    PEXP_TRACE_SESSION Session;
+    HANDLE ThreadHandle;
+    ULONG Events;
+    ULONG Slot;
+    ULONG i;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    if ((EnableFlags == 0) || ((EnableFlags & ~EX_TRACE_CLASS_ALL) != 0) || (FileName->Length == 0)) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    Events = EXP_TRACE_MINIMUM_EVENTS;
+    while ((Events < EventsPerProcessor) && (Events < EXP_TRACE_MAXIMUM_EVENTS)) {
+        Events *= 2;
+    }
+
+    Session = ExAllocatePoolWithTag(NonPagedPool, sizeof(EXP_TRACE_SESSION), 'sTxE');
+    if (Session == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(Session, sizeof(EXP_TRACE_SESSION));
+    Session->EnableFlags = EnableFlags;
+    Session->EventsPerProcessor = Events;
+    KeInitializeEvent(&Session->StartedEvent, NotificationEvent, FALSE);
+    KeInitializeEvent(&Session->StopEvent, NotificationEvent, FALSE);
+
+    Status = STATUS_SUCCESS;
+    for (i = 0; i < (ULONG)KeNumberProcessors; i += 1) {
+        Session->Buffers[i] = ExAllocatePoolWithTag(NonPagedPool, FIELD_OFFSET(EXP_TRACE_BUFFER, Events[Events]), 'bTxE');
+        if (Session->Buffers[i] == NULL) {
+            Status = STATUS_INSUFFICIENT_RESOURCES;
+            break;
+        }
+
+        // The events are zeroed too.  The pool block may have held the ring of an earlier session, whose stale events
+        // would have the sequence the logger thread expects on the first lap.
+        RtlZeroMemory(Session->Buffers[i], FIELD_OFFSET(EXP_TRACE_BUFFER, Events[Events]));
+        Session->Buffers[i]->Mask = Events - 1;
+    }
+
+    // The logger thread opens the file by name, as a handle opened here would belong to the caller's process.
+    Session->WriteBuffer = ExAllocatePoolWithTag(PagedPool, EXP_TRACE_WRITE_SIZE, 'wTxE');
+    Session->FileName.Buffer = ExAllocatePoolWithTag(PagedPool, FileName->Length, 'nTxE');
+    if ((Session->WriteBuffer == NULL) || (Session->FileName.Buffer == NULL)) {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!NT_SUCCESS(Status)) {
+        ExpFreeTraceSession(Session);
+        return Status;
+    }
+
+    RtlCopyMemory(Session->FileName.Buffer, FileName->Buffer, FileName->Length);
+    Session->FileName.Length = FileName->Length;
+    Session->FileName.MaximumLength = FileName->Length;
+
+    ExpAcquireTraceControl();
+
+    for (Slot = 0; Slot < EX_TRACE_MAXIMUM_SESSIONS; Slot += 1) {
+        if (ExpTraceSessions[Slot] == NULL) {
+            break;
+        }
+    }
+
+    if (Slot == EX_TRACE_MAXIMUM_SESSIONS) {
+        ExpReleaseTraceControl();
+        ExpFreeTraceSession(Session);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    // The callouts are claimed before the logger thread creates the file, so a busy callout fails the start without
+    // leaving an empty file behind.  Until the session is in the table the events of its classes are not logged.
+    Status = ExpUpdateTraceHooks(EnableFlags);
+    if (!NT_SUCCESS(Status)) {
+        ExpReleaseTraceControl();
+        ExpFreeTraceSession(Session);
+        return Status;
+    }
+
+    Status = PsCreateSystemThread(&ThreadHandle, THREAD_ALL_ACCESS, NULL, NULL, NULL, ExpTraceLoggerThread, Session);
+    if (NT_SUCCESS(Status)) {
+        Status = ObReferenceObjectByHandle(ThreadHandle, SYNCHRONIZE, *PsThreadType, KernelMode, (PVOID *)&Session->LoggerThread, NULL);
+        ZwClose(ThreadHandle);
+    }
+
+    if (NT_SUCCESS(Status)) {
+        // Wait for the logger thread to create the file.  If it fails the thread exits.
+        KeWaitForSingleObject(&Session->StartedEvent, Executive, KernelMode, FALSE, NULL);
+        Status = Session->Status;
+        if (!NT_SUCCESS(Status)) {
+            KeWaitForSingleObject(Session->LoggerThread, Executive, KernelMode, FALSE, NULL);
+        }
+    }
+
+    if (!NT_SUCCESS(Status)) {
+        ExpUpdateTraceHooks(0);
+        ExpReleaseTraceControl();
+        ExpFreeTraceSession(Session);
+        return Status;
+    }
+
+    ExpTraceSessions[Slot] = Session;
+
+    ExpReleaseTraceControl();
+
+    *SessionId = Slot;
+    return STATUS_SUCCESS;
+}
+
+
+NTSTATUS ExStopTrace(IN ULONG SessionId)
+/*++
+Routine Description:
+    This function stops a trace session.  Its logger thread writes the events still in the rings and closes the file.
+Arguments:
+    SessionId - Supplies the identifier returned by ExStartTrace.
+Return Value:
+    STATUS_SUCCESS, STATUS_INVALID_PARAMETER if there is no such session, or the status of the first write to the file that failed.
+--*/
+{
+    PEXP_TRACE_SESSION Session;
+    KAFFINITY Processors;
+    KAFFINITY Affinity;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    if (SessionId >= EX_TRACE_MAXIMUM_SESSIONS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ExpAcquireTraceControl();
+
+    Session = ExpTraceSessions[SessionId];
+    if (Session == NULL) {
+        ExpReleaseTraceControl();
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ExpTraceSessions[SessionId] = NULL;
+    ExpUpdateTraceHooks(0);
+
+    // Events are logged at DISPATCH_LEVEL or above, so once this thread has
+    // run on every processor no event can still be being logged into the
+    // session's rings.
+    Processors = KeActiveProcessors;
+    for (Affinity = 1; Processors != 0; Affinity <<= 1) {
+        if (Processors & Affinity) {
+            KeSetSystemAffinityThread(Affinity);
+            Processors &= ~Affinity;
+        }
+    }
+
+    KeRevertToUserAffinityThread();
+
+    ExpReleaseTraceControl();
+
+    KeSetEvent(&Session->StopEvent, 0, FALSE);
+    KeWaitForSingleObject(Session->LoggerThread, Executive, KernelMode, FALSE, NULL);
+
+    Status = Session->Status;
+    ExpFreeTraceSession(Session);
+    return Status;
+}
+
+
+NTSTATUS ExpTraceControl(IN SYSDBG_COMMAND Command,
+                         IN PVOID InputBuffer,
+                         IN ULONG InputBufferLength,
+                         OUT PVOID OutputBuffer,
+                         IN ULONG OutputBufferLength,
+                         OUT PULONG ReturnLength)
+/*++
+Routine Description:
+    This function carries out the SysDbgStartTrace and SysDbgStopTrace commands of NtSystemDebugControl,
+    which has checked the caller's privilege and probed the buffers.
+    The buffers may be the caller's, so what is needed from them is captured before a session is started or stopped.
+Arguments:
+    Command - Supplies SysDbgStartTrace or SysDbgStopTrace.
+    InputBuffer - Supplies an EX_TRACE_START, or the ULONG id of the session to stop.
+    InputBufferLength - Supplies the length of the input buffer.
+    OutputBuffer - Receives the ULONG id of the session started.
+    OutputBufferLength - Supplies the length of the output buffer.
+    ReturnLength - Receives the number of bytes returned in the output buffer.
+Return Value:
+    STATUS_INFO_LENGTH_MISMATCH, STATUS_INVALID_PARAMETER, or the status of ExStartTrace or ExStopTrace.
+--*/
+{
+    PEX_TRACE_START TraceStart;
+    UNICODE_STRING FileName;
+    ULONG EnableFlags;
+    ULONG EventsPerProcessor;
+    ULONG FileNameLength;
+    ULONG SessionId;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    *ReturnLength = 0;
+
+    if (Command == SysDbgStopTrace) {
+        if (InputBufferLength != sizeof(ULONG)) {
+            return STATUS_INFO_LENGTH_MISMATCH;
+        }
+
+        try {
+            SessionId = *(PULONG)InputBuffer;
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+            return GetExceptionCode();
+        }
+
+        return ExStopTrace(SessionId);
+    }
+
+    if ((InputBufferLength < FIELD_OFFSET(EX_TRACE_START, FileName)) || (OutputBufferLength != sizeof(ULONG))) {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    TraceStart = (PEX_TRACE_START)InputBuffer;
+    FileName.Buffer = NULL;
+
+    try {
+        EnableFlags = TraceStart->EnableFlags;
+        EventsPerProcessor = TraceStart->EventsPerProcessor;
+        FileNameLength = TraceStart->FileNameLength;
+        if ((FileNameLength == 0) || (FileNameLength > MAXUSHORT) ||
+            (FileNameLength > InputBufferLength - FIELD_OFFSET(EX_TRACE_START, FileName))) {
+            return STATUS_INVALID_PARAMETER;
+        }
+
+        FileName.Buffer = ExAllocatePoolWithTag(PagedPool, FileNameLength, 'nTxE');
+        if (FileName.Buffer == NULL) {
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        RtlCopyMemory(FileName.Buffer, TraceStart->FileName, FileNameLength);
+    } except (EXCEPTION_EXECUTE_HANDLER) {
+        if (FileName.Buffer != NULL) {
+            ExFreePool(FileName.Buffer);
+        }
+
+        return GetExceptionCode();
+    }
+
+    FileName.Length = (USHORT)FileNameLength;
+    FileName.MaximumLength = (USHORT)FileNameLength;
+
+    Status = ExStartTrace(&FileName, EnableFlags, EventsPerProcessor, &SessionId);
+    ExFreePool(FileName.Buffer);
+
+    if (NT_SUCCESS(Status)) {
+        try {
+            *(PULONG)OutputBuffer = SessionId;
+            *ReturnLength = sizeof(ULONG);
+        } except (EXCEPTION_EXECUTE_HANDLER) {
+            // Nobody would know the session to stop it
+            ExStopTrace(SessionId);
+            return GetExceptionCode();
+        }
+    }
+
+    return Status;
+}
+
+
+VOID ExpWriteTraceEvents(IN PEXP_TRACE_SESSION Session)
+{
+    IO_STATUS_BLOCK IoStatus;
+    ULONG Length;
+    NTSTATUS Status;
+
+    if (Session->WriteCount == 0) {
+        return;
+    }
+
+    Length = Session->WriteCount * sizeof(EX_TRACE_EVENT);
+    Status = ZwWriteFile(Session->FileHandle, NULL, NULL, NULL, &IoStatus, Session->WriteBuffer, Length, &Session->FileOffset, NULL);
+    if (NT_SUCCESS(Status)) {
+        Session->FileOffset.QuadPart += Length;
+    } else if (NT_SUCCESS(Session->Status)) {
+        Session->Status = Status;
+    }
+
+    Session->WriteCount = 0;
+}
+
+
+PEX_TRACE_EVENT ExpNextTraceWrite(IN PEXP_TRACE_SESSION Session)
+{
+    if (Session->WriteCount == EXP_TRACE_WRITE_SIZE / sizeof(EX_TRACE_EVENT)) {
+        ExpWriteTraceEvents(Session);
+    }
+
+    return &Session->WriteBuffer[Session->WriteCount];
+}
+
+
+VOID ExpFlushTraceBuffer(IN PEXP_TRACE_SESSION Session, IN ULONG Processor)
+/*++
+Routine Description:
+    This function copies the events logged into the ring of a processor since the last flush to the write buffer,
+    followed by a record of the number of them that were overwritten before they could be copied.
+    Events still being logged are left for the next flush.
+--*/
+{
+    PEXP_TRACE_BUFFER Buffer;
+    PEX_TRACE_EVENT Event;
+    PEX_TRACE_EVENT Copy;
+    ULONG Next;
+    ULONG Index;
+    ULONG Lost;
+    LONG Lag;
+
+    Buffer = Session->Buffers[Processor];
+    Next = *((volatile ULONG *)&Buffer->Next);
+    Index = Buffer->Flushed;
+    Lost = 0;
+
+    // Events more than a ring behind have been overwritten.
+    if (Next - Index > Buffer->Mask + 1) {
+        Lost = Next - Index - (Buffer->Mask + 1);
+        Index = Next - (Buffer->Mask + 1);
+    }
+
+    while (Index != Next) {
+        Event = &Buffer->Events[Index & Buffer->Mask];
+
+        Lag = (LONG)(*((volatile ULONG *)&Event->Sequence) - (Index + 1));
+        if (Lag != 0) {
+            // An older sequence is an event still being logged, a newer
+            // one means the event was overwritten.
+            if (Lag < 0) {
+                break;
+            }
+
+            Lost += 1;
+            Index += 1;
+            continue;
+        }
+
+        Copy = ExpNextTraceWrite(Session);
+        RtlCopyMemory(Copy, Event, sizeof(EX_TRACE_EVENT));
+        if (*((volatile ULONG *)&Event->Sequence) != Index + 1) {
+            Lost += 1;
+        } else {
+            Session->WriteCount += 1;
+        }
+
+        Index += 1;
+    }
+
+    Buffer->Flushed = Index;
+
+    if (Lost != 0) {
+        Copy = ExpNextTraceWrite(Session);
+        RtlZeroMemory(Copy, sizeof(EX_TRACE_EVENT));
+        Copy->Type = EX_TRACE_EVENT_LOST;
+        Copy->Processor = (UCHAR)Processor;
+        Copy->TimeStamp = KeQueryPerformanceCounter(NULL);
+        Copy->Data[0] = Lost;
+        Session->WriteCount += 1;
+    }
+}
+
+
+VOID ExpTraceLoggerThread(IN PVOID Context)
+/*++
+Routine Description:
+    The logger thread of a trace session executes this routine.
+    It creates the file and writes its header, then drains the rings of the session to it until the session is stopped.
+Arguments:
+    Context - Supplies the session.
+--*/
+{
+    PEXP_TRACE_SESSION Session = Context;
+    EX_TRACE_FILE_HEADER Header;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER FlushInterval;
+    ULONG Processor;
+    NTSTATUS Status;
+
+    PAGED_CODE();
+
+    InitializeObjectAttributes(&ObjectAttributes, &Session->FileName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = ZwCreateFile(&Session->FileHandle,
+                          FILE_WRITE_DATA | SYNCHRONIZE,
+                          &ObjectAttributes,
+                          &IoStatus,
+                          NULL,
+                          FILE_ATTRIBUTE_NORMAL,
+                          FILE_SHARE_READ,
+                          FILE_OVERWRITE_IF,
+                          FILE_SEQUENTIAL_ONLY | FILE_SYNCHRONOUS_IO_NONALERT,
+                          NULL,
+                          0);
+    if (NT_SUCCESS(Status)) {
+        RtlZeroMemory(&Header, sizeof(Header));
+        Header.Signature = EX_TRACE_FILE_SIGNATURE;
+        Header.Version = EX_TRACE_FILE_VERSION;
+        Header.EventSize = sizeof(EX_TRACE_EVENT);
+        Header.EnableFlags = Session->EnableFlags;
+        Header.NumberOfProcessors = KeNumberProcessors;
+        Header.EventsPerProcessor = Session->EventsPerProcessor;
+        KeQuerySystemTime(&Header.StartTime);
+        Header.StartTimeStamp = KeQueryPerformanceCounter(&Header.Frequency);
+
+        Status = ZwWriteFile(Session->FileHandle, NULL, NULL, NULL, &IoStatus, &Header, sizeof(Header), &Session->FileOffset, NULL);
+        if (NT_SUCCESS(Status)) {
+            Session->FileOffset.QuadPart = sizeof(Header);
+        } else {
+            ZwClose(Session->FileHandle);
+        }
+    }
+
+    Session->Status = Status;
+    KeSetEvent(&Session->StartedEvent, 0, FALSE);
+    if (!NT_SUCCESS(Status)) {
+        PsTerminateSystemThread(Status);
+    }
+
+    // Run above the threads whose events are being logged so that the rings are drained before they wrap.
+    KeSetPriorityThread(&PsGetCurrentThread()->Tcb, LOW_REALTIME_PRIORITY + 1);
+
+    FlushInterval.QuadPart = EXP_TRACE_FLUSH_INTERVAL;
+    do {
+        Status = KeWaitForSingleObject(&Session->StopEvent, Executive, KernelMode, FALSE, &FlushInterval);
+
+        for (Processor = 0; Processor < (ULONG)KeNumberProcessors; Processor += 1) {
+            ExpFlushTraceBuffer(Session, Processor);
+        }
+
+        ExpWriteTraceEvents(Session);
+    } while (Status == STATUS_TIMEOUT);
+
+    ZwClose(Session->FileHandle);
+    PsTerminateSystemThread(STATUS_SUCCESS);
+}
@@ -166,8 +166,13 @@ Arguments:
                  All profile hits in a given bucket will increment
                  the corresponding counter in Buffer.  Buckets
                  cannot be smaller than a ULONG.  The acceptable range of this value is 2 to 30 inclusive.
+                 PROFILE_STACK_SAMPLES instead creates a stack sample profile: RangeBase and RangeSize are
+                 ignored, and each profile interrupt records the call stack of the interrupted thread.
+                 Stack sample profiles are only supported on x86.
     Buffer - Supplies an array of ULONGs.  Each ULONG is a hit counter,
              which records the number of hits of the corresponding bucket.
+             For a stack sample profile, supplies the buffer for the per-processor
+             rings of KSTACK_SAMPLE_RING, which the caller reads while the profile runs.
     BufferSize - Size in bytes of Buffer.
     ProfileSource - Supplies the source for the profile interrupt
     Affinity - Supplies the processor set for the profile interrupt
@@ -191,6 +196,26 @@ Return Value:
         return STATUS_INVALID_PARAMETER_7;
     }
 
+    // A stack sample profile has no range.  Pass the size of the buffer as
+    // the range size, from which the kernel works out the size of the ring
+    // of each processor.
+
+    if (BucketSize == PROFILE_STACK_SAMPLES) {
+
+#if !defined(_X86_)
+
+        return STATUS_NOT_SUPPORTED;
+
+#endif
+
+        if (BufferSize / KeNumberProcessors < sizeof(KSTACK_SAMPLE_RING) + sizeof(KSTACK_SAMPLE)) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
+
+        RangeBase = NULL;
+        RangeSize = BufferSize;
+    }
+
 #ifdef i386
     //        sleazy use of bucket size.  If bucket size is zero, and
     //        RangeBase < 64K, then create a profile object to attach
@@ -222,16 +247,18 @@ Return Value:
     }
 #endif
 
-    if ((BucketSize > 31) || (BucketSize < 2)) {
-        return STATUS_INVALID_PARAMETER;
-    }
+    if (BucketSize != PROFILE_STACK_SAMPLES) {
+        if ((BucketSize > 31) || (BucketSize < 2)) {
+            return STATUS_INVALID_PARAMETER;
+        }
 
-    if ((RangeSize >> (BucketSize - 2)) > BufferSize) {
-        return STATUS_BUFFER_TOO_SMALL;
-    }
+        if ((RangeSize >> (BucketSize - 2)) > BufferSize) {
+            return STATUS_BUFFER_TOO_SMALL;
+        }
 
-    if (((ULONG_PTR)RangeBase + RangeSize) < RangeSize) {
-        return STATUS_BUFFER_OVERFLOW;
+        if (((ULONG_PTR)RangeBase + RangeSize) < RangeSize) {
+            return STATUS_BUFFER_OVERFLOW;
+        }
     }
 
     // Establish an exception handler, probe the output handle address, and
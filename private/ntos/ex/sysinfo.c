@@ -1118,7 +1118,7 @@ Return Value:
             }
 
             Status = ExpGetProcessInformation(SystemInformation, SystemInformationLength, &Length, NULL);
-            if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(ReturnLength))
+            if ((NT_SUCCESS(Status) || (Status == STATUS_INFO_LENGTH_MISMATCH)) && ARGUMENT_PRESENT(ReturnLength))
             {
                 *ReturnLength = Length;
             }
@@ -1149,7 +1149,7 @@ Return Value:
             }
 
             Status = ExpGetProcessInformation(ProcessInformation, ProcessInformationLength, &Length, &SessionId);
-            if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(ReturnLength))
+            if ((NT_SUCCESS(Status) || (Status == STATUS_INFO_LENGTH_MISMATCH)) && ARGUMENT_PRESENT(ReturnLength))
             {
                 *ReturnLength = Length;
             }
@@ -2140,12 +2140,12 @@ Routine Description:
 Arguments:
     SystemInformation - A pointer to a buffer which receives the specified information.
     SystemInformationLength - Specifies the length in bytes of the system information buffer.
-    Length - An optional pointer which, if specified, receives the number of bytes placed in the system information buffer.
+    Length - A pointer which receives the number of bytes placed in the system information buffer, or if the buffer is too small the number of bytes needed to hold the whole snapshot.
 Return Value:
     Returns one of the following status codes:
         STATUS_SUCCESS - normal, successful completion.
         STATUS_INVALID_INFO_CLASS - The SystemInformationClass parameter did not specify a valid value.
-        STATUS_INFO_LENGTH_MISMATCH - The value of the SystemInformationLength parameter did not match the length required for the information class requested by the SystemInformationClass parameter.
+        STATUS_INFO_LENGTH_MISMATCH - The buffer is too small.  The processes and threads are still counted to the end of the list so that Length tells the caller how large a buffer to pass next time.
         STATUS_ACCESS_VIOLATION - Either the SystemInformation buffer pointer or the Length pointer value specified an invalid address.
         STATUS_WORKING_SET_QUOTA - The process does not have sufficient working set to lock the specified output structure in memory.
         STATUS_INSUFFICIENT_RESOURCES - Insufficient system resources exist for this request to complete.
@@ -2165,6 +2165,7 @@ Return Value:
     PUCHAR Src;
     PWSTR Dst;
     ULONG n;
+    ULONG NumberOfThreads;
     NTSTATUS status = STATUS_SUCCESS;
 
     *Length = 0;
@@ -2210,12 +2211,11 @@ Return Value:
                TotalSize += sizeof(SYSTEM_THREAD_INFORMATION);
                if (TotalSize > SystemInformationLength) {
                    status = STATUS_INFO_LENGTH_MISMATCH;
-                   KeWaitForSingleObject (&Event, Executive, KernelMode, FALSE, NULL);
-                   goto Failed;
+               } else {
+                   Thread = (PETHREAD)(CONTAINING_RECORD(NextThread, KTHREAD, ThreadListEntry));
+                   ExpCopyThreadInfo (ThreadInfo,Thread);
+                   ProcessInfo->NumberOfThreads += 1;
                }
-               Thread = (PETHREAD)(CONTAINING_RECORD(NextThread, KTHREAD, ThreadListEntry));
-               ExpCopyThreadInfo (ThreadInfo,Thread);
-               ProcessInfo->NumberOfThreads += 1;
                NextThread = NextThread->Flink;
                ThreadInfo += 1;
            }
@@ -2238,13 +2238,18 @@ Return Value:
             ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)((PUCHAR)MappedAddress + TotalSize);
             NextEntryOffset = sizeof(SYSTEM_PROCESS_INFORMATION);
             TotalSize += sizeof(SYSTEM_PROCESS_INFORMATION);
+
+            // Once the buffer is full keep walking the lists without copying anything,
+            // so that the caller learns the size of the whole snapshot from one call
+            // instead of having to guess and try again.
             if (TotalSize > SystemInformationLength) {
                 status = STATUS_INFO_LENGTH_MISMATCH;
-                goto Failed;
             }
 
             // Get information for each process.
-            ExpCopyProcessInfo (ProcessInfo, Process);
+            if (NT_SUCCESS(status)) {
+                ExpCopyProcessInfo (ProcessInfo, Process);
+            }
 
             // Set the event with the wait parameter TRUE.
             // This causes the event to be set and control is returned with the dispatcher database locked at dispatch IRQL.
@@ -2258,30 +2263,32 @@ Return Value:
 
             // Get information for each thread.
             ThreadInfo = (PSYSTEM_THREAD_INFORMATION)(ProcessInfo + 1);
-            ProcessInfo->NumberOfThreads = 0;
+            NumberOfThreads = 0;
             NextThread = Process->Pcb.ThreadListHead.Flink;
             while (NextThread != &Process->Pcb.ThreadListHead) {
                 NextEntryOffset += sizeof(SYSTEM_THREAD_INFORMATION);
                 TotalSize += sizeof(SYSTEM_THREAD_INFORMATION);
                 if (TotalSize > SystemInformationLength) {
                     status = STATUS_INFO_LENGTH_MISMATCH;
-                    KeWaitForSingleObject (&Event, Executive, KernelMode, FALSE, NULL);
-                    goto Failed;
+                } else {
+                    Thread = (PETHREAD)(CONTAINING_RECORD(NextThread,KTHREAD,ThreadListEntry));
+                    ExpCopyThreadInfo (ThreadInfo,Thread);
                 }
-                Thread = (PETHREAD)(CONTAINING_RECORD(NextThread,KTHREAD,ThreadListEntry));
-                ExpCopyThreadInfo (ThreadInfo,Thread);
-                ProcessInfo->NumberOfThreads += 1;
+                NumberOfThreads += 1;
                 NextThread = NextThread->Flink;
                 ThreadInfo += 1;
             }
-            // Store the Remote Terminal SessionId
-            ProcessInfo->SessionId = Process->SessionId;
             // Unlock the dispatch database by waiting on the event that was previously set with the wait parameter TRUE.
             KeWaitForSingleObject (&Event, Executive, KernelMode, FALSE, NULL);
-            // Get the image name.
-            ProcessInfo->ImageName.Buffer = NULL;
-            ProcessInfo->ImageName.Length = 0;
-            ProcessInfo->ImageName.MaximumLength = 0;
+            if (NT_SUCCESS(status)) {
+                ProcessInfo->NumberOfThreads = NumberOfThreads;
+                // Store the Remote Terminal SessionId
+                ProcessInfo->SessionId = Process->SessionId;
+                // Get the image name.
+                ProcessInfo->ImageName.Buffer = NULL;
+                ProcessInfo->ImageName.Length = 0;
+                ProcessInfo->ImageName.MaximumLength = 0;
+            }
             if ((n = strlen( Src = Process->ImageFileName ))) {
                 n = ROUND_UP( ((n + 1) * sizeof( WCHAR )), sizeof(LARGE_INTEGER) );
                 TotalSize += n;
@@ -2299,23 +2306,19 @@ Return Value:
                     // Set the image name to point into the user's memory.
                     ProcessInfo->ImageName.Buffer = (PWSTR) ((PCHAR)SystemInformation + ((PCHAR)(ThreadInfo) - (PCHAR)MappedAddress));
                 }
-
-                if (!NT_SUCCESS( status )) {
-                    goto Failed;
-                }
             }
 
             // Point to next process.
-            ProcessInfo->NextEntryOffset = NextEntryOffset;
+            if (NT_SUCCESS(status)) {
+                ProcessInfo->NextEntryOffset = NextEntryOffset;
+            }
             NextProcess = NextProcess->Flink;
         }
 
-        ProcessInfo->NextEntryOffset = 0;
-        status = STATUS_SUCCESS;
+        if (NT_SUCCESS(status)) {
+            ProcessInfo->NextEntryOffset = 0;
+        }
         *Length = TotalSize;
-
-Failed:
-        ;
     } finally {
         ExReleaseFastMutex(&PspActiveProcessMutex);
         MmUnlockPagableImageSection(ExPageLockHandle);
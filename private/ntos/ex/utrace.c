@@ -0,0 +1,385 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    utrace.c
+
+Abstract:
+    Kernel event tracing test.  Starts two trace sessions at once through
+    NtSystemDebugControl: one with every class and the largest rings, one
+    with only I/O and the smallest.  While they run it makes a burst of
+    volume queries, each of which is an IRP sent to the file system and
+    completed, and touches a range of fresh pages, each of which takes a
+    demand zero fault.  Then it stops both sessions and checks their files.
+
+    For each file the header must describe the session, every event must
+    be of a class the session enabled, and on each processor the events
+    must come in sequence, with the events written and those reported in
+    lost event records adding up to the number logged.  The large session
+    must hold every query and fault of the test and lose nothing.  The
+    burst is far more than the small rings hold between writes by the
+    logger thread, so the small session must report lost events.
+
+    usage: utrace directory
+
+        needs the debug privilege; the trace files are created in the
+        directory and deleted when checked
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "extrace.h"
+
+#define BENCH_QUERIES       4000
+#define BENCH_PAGES         1024
+#define BENCH_SMALL_RING    256
+#define BENCH_LARGE_RING    (64 * 1024)
+
+//  IRP_MJ_QUERY_VOLUME_INFORMATION, the major function of the queries
+
+#define BENCH_MAJOR_FUNCTION 0x0a
+
+typedef struct _TRACE_CHECK {
+    PCHAR Title;
+    ULONG EnableFlags;
+    ULONG EventsPerProcessor;
+    ULONG SessionId;
+    UNICODE_STRING FileName;
+    WCHAR NameBuffer[512];
+} TRACE_CHECK, *PTRACE_CHECK;
+
+TRACE_CHECK Checks[2] = {
+    { "all classes", EX_TRACE_CLASS_ALL, BENCH_LARGE_RING },
+    { "i/o, small rings", EX_TRACE_CLASS_IO, BENCH_SMALL_RING }
+};
+
+PCHAR BenchPages;
+HANDLE BenchThreadId;
+
+
+NTSTATUS StartTrace(IN PTRACE_CHECK Check)
+{
+    ULONG_PTR Buffer[(sizeof(EX_TRACE_START) + sizeof(Check->NameBuffer)) / sizeof(ULONG_PTR)];
+    PEX_TRACE_START TraceStart = (PEX_TRACE_START)Buffer;
+
+    TraceStart->EnableFlags = Check->EnableFlags;
+    TraceStart->EventsPerProcessor = Check->EventsPerProcessor;
+    TraceStart->FileNameLength = Check->FileName.Length;
+    RtlCopyMemory(TraceStart->FileName, Check->FileName.Buffer, Check->FileName.Length);
+
+    return NtSystemDebugControl(SysDbgStartTrace, TraceStart, FIELD_OFFSET(EX_TRACE_START, FileName) + Check->FileName.Length,
+                                &Check->SessionId, sizeof(ULONG), NULL);
+}
+
+
+NTSTATUS StopTrace(IN PTRACE_CHECK Check)
+{
+    return NtSystemDebugControl(SysDbgStopTrace, &Check->SessionId, sizeof(ULONG), NULL, 0, NULL);
+}
+
+
+BOOLEAN RunWorkload(IN PUNICODE_STRING Directory)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    FILE_FS_SIZE_INFORMATION SizeInfo;
+    SIZE_T Size;
+    HANDLE File;
+    NTSTATUS Status;
+    ULONG i;
+
+    InitializeObjectAttributes(&ObjectAttributes, Directory, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&File, FILE_LIST_DIRECTORY | SYNCHRONIZE, &ObjectAttributes, &IoStatus,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", Directory, Status);
+        return FALSE;
+    }
+
+    //  Volume queries have no fast path, so each one is an IRP
+
+    for (i = 0; i < BENCH_QUERIES; i++)
+    {
+        Status = NtQueryVolumeInformationFile(File, &IoStatus, &SizeInfo, sizeof(SizeInfo), FileFsSizeInformation);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Volume query failed (%X)\n", Status);
+            break;
+        }
+    }
+
+    NtClose(File);
+
+    //  The first touch of each page is a demand zero fault
+
+    BenchPages = NULL;
+    Size = BENCH_PAGES * PAGE_SIZE;
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(), &BenchPages, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to allocate the pages (%X)\n", Status);
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; i < BENCH_PAGES; i++)
+        {
+            BenchPages[i * PAGE_SIZE] = 1;
+        }
+    }
+
+    return NT_SUCCESS(Status);
+}
+
+
+BOOLEAN CheckTrace(IN PTRACE_CHECK Check)
+{
+    static ULONG Written[32], Lost[32], LastSequence[32];
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    FILE_STANDARD_INFORMATION StandardInfo;
+    PEX_TRACE_FILE_HEADER Header;
+    PEX_TRACE_EVENT Event;
+    PEX_TRACE_EVENT End;
+    ULONG Counts[EX_TRACE_EVENT_CONTEXT_SWAP + 1];
+    ULONG Queries, Completions, Faults;
+    ULONG TotalLost;
+    SIZE_T Size;
+    HANDLE File;
+    BOOLEAN Passed;
+    NTSTATUS Status;
+    ULONG i;
+
+    InitializeObjectAttributes(&ObjectAttributes, &Check->FileName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&File, GENERIC_READ | DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ,
+                        FILE_SYNCHRONOUS_IO_NONALERT | FILE_DELETE_ON_CLOSE);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtQueryInformationFile(File, &IoStatus, &StandardInfo, sizeof(StandardInfo), FileStandardInformation);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("%-18s FAILED: unable to open %wZ (%X)\n", Check->Title, &Check->FileName, Status);
+        return FALSE;
+    }
+
+    Header = NULL;
+    Size = StandardInfo.EndOfFile.LowPart;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Header, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtReadFile(File, NULL, NULL, NULL, &IoStatus, Header, StandardInfo.EndOfFile.LowPart, NULL, NULL);
+    }
+
+    NtClose(File);
+
+    if (!NT_SUCCESS(Status) || (IoStatus.Information < sizeof(EX_TRACE_FILE_HEADER)))
+    {
+        printf("%-18s FAILED: unable to read the file (%X)\n", Check->Title, Status);
+        return FALSE;
+    }
+
+    if ((Header->Signature != EX_TRACE_FILE_SIGNATURE) ||
+        (Header->Version != EX_TRACE_FILE_VERSION) ||
+        (Header->EventSize != sizeof(EX_TRACE_EVENT)) ||
+        (Header->EnableFlags != Check->EnableFlags) ||
+        (Header->EventsPerProcessor != Check->EventsPerProcessor) ||
+        (Header->NumberOfProcessors == 0) || (Header->NumberOfProcessors > 32) ||
+        ((IoStatus.Information - sizeof(EX_TRACE_FILE_HEADER)) % sizeof(EX_TRACE_EVENT) != 0))
+    {
+        printf("%-18s FAILED: bad header or file size\n", Check->Title);
+        return FALSE;
+    }
+
+    Passed = TRUE;
+    RtlZeroMemory(Written, sizeof(Written));
+    RtlZeroMemory(Lost, sizeof(Lost));
+    RtlZeroMemory(LastSequence, sizeof(LastSequence));
+    RtlZeroMemory(Counts, sizeof(Counts));
+    Queries = Completions = Faults = 0;
+
+    Event = (PEX_TRACE_EVENT)(Header + 1);
+    End = (PEX_TRACE_EVENT)((PCHAR)Header + IoStatus.Information);
+    for (; Event < End; Event++)
+    {
+        if ((Event->Type > EX_TRACE_EVENT_CONTEXT_SWAP) || (Event->Processor >= Header->NumberOfProcessors))
+        {
+            printf("%-18s FAILED: bad event type %u or processor %u\n", Check->Title, Event->Type, Event->Processor);
+            Passed = FALSE;
+            break;
+        }
+
+        Counts[Event->Type] += 1;
+
+        if (Event->Type == EX_TRACE_EVENT_LOST)
+        {
+            if ((Event->Sequence != 0) || (Event->Data[0] == 0))
+            {
+                printf("%-18s FAILED: bad lost event record\n", Check->Title);
+                Passed = FALSE;
+            }
+
+            Lost[Event->Processor] += (ULONG)Event->Data[0];
+            continue;
+        }
+
+        if ((((Event->Type == EX_TRACE_EVENT_IO_START) || (Event->Type == EX_TRACE_EVENT_IO_COMPLETE)) && !(Check->EnableFlags & EX_TRACE_CLASS_IO)) ||
+            ((Event->Type == EX_TRACE_EVENT_PAGE_FAULT) && !(Check->EnableFlags & EX_TRACE_CLASS_PAGE_FAULT)) ||
+            ((Event->Type == EX_TRACE_EVENT_CONTEXT_SWAP) && !(Check->EnableFlags & EX_TRACE_CLASS_CONTEXT_SWAP)))
+        {
+            printf("%-18s FAILED: event of type %u was not enabled\n", Check->Title, Event->Type);
+            Passed = FALSE;
+        }
+
+        if (Event->Sequence <= LastSequence[Event->Processor])
+        {
+            printf("%-18s FAILED: sequence %u after %u on processor %u\n", Check->Title, Event->Sequence, LastSequence[Event->Processor], Event->Processor);
+            Passed = FALSE;
+        }
+
+        LastSequence[Event->Processor] = Event->Sequence;
+        Written[Event->Processor] += 1;
+
+        //  Count what the test itself did
+
+        if (Event->ThreadId != BenchThreadId)
+        {
+            continue;
+        }
+
+        if ((Event->Type == EX_TRACE_EVENT_IO_START) && (Event->Data[2] == BENCH_MAJOR_FUNCTION))
+        {
+            Queries += 1;
+        }
+        else if ((Event->Type == EX_TRACE_EVENT_IO_COMPLETE) && (Event->Data[3] == BENCH_MAJOR_FUNCTION))
+        {
+            Completions += 1;
+        }
+        else if ((Event->Type == EX_TRACE_EVENT_PAGE_FAULT) &&
+                 (Event->Data[0] >= (ULONG_PTR)BenchPages) && (Event->Data[0] < (ULONG_PTR)BenchPages + BENCH_PAGES * PAGE_SIZE))
+        {
+            Faults += 1;
+        }
+    }
+
+    //  Every event logged on a processor was either written or lost
+
+    TotalLost = 0;
+    for (i = 0; i < Header->NumberOfProcessors; i++)
+    {
+        if (Written[i] + Lost[i] != LastSequence[i])
+        {
+            printf("%-18s FAILED: processor %u wrote %u and lost %u of %u events\n", Check->Title, i, Written[i], Lost[i], LastSequence[i]);
+            Passed = FALSE;
+        }
+
+        TotalLost += Lost[i];
+    }
+
+    printf("%-18s %8u i/o %8u faults %8u swaps %8u lost  test: %u queries %u completions %u faults\n", Check->Title,
+           Counts[EX_TRACE_EVENT_IO_START] + Counts[EX_TRACE_EVENT_IO_COMPLETE], Counts[EX_TRACE_EVENT_PAGE_FAULT],
+           Counts[EX_TRACE_EVENT_CONTEXT_SWAP], TotalLost, Queries, Completions, Faults);
+
+    if (Check->EventsPerProcessor == BENCH_LARGE_RING)
+    {
+        if ((TotalLost != 0) || (Queries < BENCH_QUERIES) || (Completions < BENCH_QUERIES) || (Faults < BENCH_PAGES))
+        {
+            printf("%-18s FAILED: the test's events are not all there\n", Check->Title);
+            Passed = FALSE;
+        }
+    }
+    else if (TotalLost == 0)
+    {
+        printf("%-18s FAILED: the burst overran the rings but nothing was reported lost\n", Check->Title);
+        Passed = FALSE;
+    }
+
+    Size = 0;
+    NtFreeVirtualMemory(NtCurrentProcess(), &Header, &Size, MEM_RELEASE);
+
+    return Passed;
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    UNICODE_STRING Directory;
+    BOOLEAN WasEnabled;
+    BOOLEAN Passed;
+    NTSTATUS Status;
+    ULONG Started;
+    ULONG i;
+
+    if (argc < 2)
+    {
+        printf("usage: utrace directory\n");
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &Directory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    Status = RtlAdjustPrivilege(SE_DEBUG_PRIVILEGE, TRUE, FALSE, &WasEnabled);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to enable the debug privilege (%X)\n", Status);
+        return 1;
+    }
+
+    BenchThreadId = NtCurrentTeb()->ClientId.UniqueThread;
+
+    for (Started = 0; Started < 2; Started++)
+    {
+        swprintf(Checks[Started].NameBuffer, L"%wZ\\utrace%u.dat", &Directory, Started);
+        RtlInitUnicodeString(&Checks[Started].FileName, Checks[Started].NameBuffer);
+
+        Status = StartTrace(&Checks[Started]);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to start the %s session (%X)\n", Checks[Started].Title, Status);
+            break;
+        }
+    }
+
+    Passed = (Started == 2) && RunWorkload(&Directory);
+
+    for (i = 0; i < Started; i++)
+    {
+        Status = StopTrace(&Checks[i]);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to stop the %s session (%X)\n", Checks[i].Title, Status);
+            Passed = FALSE;
+        }
+    }
+
+    for (i = 0; i < Started; i++)
+    {
+        if (!CheckTrace(&Checks[i]))
+        {
+            Passed = FALSE;
+        }
+    }
+
+    printf("%s\n", Passed ? "passed" : "FAILED");
+    return Passed ? 0 : 1;
+}
@@ -46,13 +46,19 @@ LONG FsRecDebugTraceIndent = 0;
 #pragma alloc_text(INIT,DriverEntry)
 #pragma alloc_text(INIT,FsRecCreateAndRegisterDO)
 
+#pragma alloc_text(PAGE,FsRecBeginProbe)
 #pragma alloc_text(PAGE,FsRecCleanupClose)
 #pragma alloc_text(PAGE,FsRecCreate)
+#pragma alloc_text(PAGE,FsRecEndProbe)
+#pragma alloc_text(PAGE,FsRecFindProbe)
 #pragma alloc_text(PAGE,FsRecFsControl)
 #pragma alloc_text(PAGE,FsRecGetDeviceSectorSize)
 #pragma alloc_text(PAGE,FsRecGetDeviceSectors)
+#pragma alloc_text(PAGE,FsRecGetMediaChangeCount)
 #pragma alloc_text(PAGE,FsRecLoadFileSystem)
 #pragma alloc_text(PAGE,FsRecReadBlock)
+#pragma alloc_text(PAGE,FsRecReadDevice)
+#pragma alloc_text(PAGE,FsRecRetireProbe)
 #pragma alloc_text(PAGE,FsRecUnload)
 #endif // ALLOC_PRAGMA
 
@@ -63,6 +69,32 @@ LONG FsRecDebugTraceIndent = 0;
 PKEVENT FsRecLoadSync;
 
 
+//  The probes of the volumes being recognized, and the history of the probes
+//  which have finished.  This is allocated from nonpaged pool since the rest
+//  of the driver is pagable.
+
+
+PFSREC_PROBE_TABLE FsRecProbeTable;
+
+
+//  Local support routines.
+
+
+VOID
+FsRecRetireProbe (
+    IN PFSREC_PROBE Probe
+    );
+
+BOOLEAN
+FsRecReadDevice (
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PLARGE_INTEGER ByteOffset,
+    IN ULONG Length,
+    IN PVOID Buffer,
+    OUT PBOOLEAN IsDeviceFailure OPTIONAL
+    );
+
+
 NTSTATUS
 DriverEntry(
     IN PDRIVER_OBJECT DriverObject,
@@ -123,6 +155,17 @@ Return Value:
 
     KeInitializeEvent(FsRecLoadSync, SynchronizationEvent, TRUE);
 
+    FsRecProbeTable = ExAllocatePoolWithTag(NonPagedPool, sizeof(FSREC_PROBE_TABLE), FSREC_POOL_TAG);
+
+    if (FsRecProbeTable == NULL) {
+
+        ExFreePool(FsRecLoadSync);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(FsRecProbeTable, sizeof(FSREC_PROBE_TABLE));
+    ExInitializeFastMutex(&FsRecProbeTable->Mutex);
+
 
     // Create and initialize each of the file system driver type device
     // objects.
@@ -472,6 +515,8 @@ Return Value:
 {
     PDEVICE_EXTENSION deviceExtension;
     PIO_STACK_LOCATION irpSp;
+    PFSREC_PROBE probe = NULL;
+    ULONGLONG startTime;
     NTSTATUS status;
 
     PAGED_CODE();
@@ -504,6 +549,20 @@ Return Value:
         return status;
     }
 
+
+    //  Let the recognizers share what they read of a volume being mounted.
+    //  Note that the Irp is completed by the recognizer, so everything
+    //  needed from it has to be captured here.
+
+
+    if (irpSp->MinorFunction == IRP_MN_MOUNT_VOLUME) {
+
+        probe = FsRecBeginProbe(irpSp->Parameters.MountVolume.DeviceObject,
+                                irpSp->Parameters.MountVolume.Vpb,
+                                deviceExtension->FileSystemType);
+        startTime = KeQueryInterruptTime();
+    }
+
     switch (deviceExtension->FileSystemType) {
 
     case FatFileSystem:
@@ -531,6 +590,14 @@ Return Value:
     status = STATUS_INVALID_DEVICE_REQUEST;
     }
 
+    if (probe != NULL) {
+
+        FsRecEndProbe(probe,
+                      DeviceObject,
+                      status,
+                      KeQueryInterruptTime() - startTime);
+    }
+
     return status;
 }
 
@@ -558,17 +625,28 @@ Return Value:
 --*/
 
 {
+    ULONG i;
+
     PAGED_CODE();
 
 
     // Simply delete all of the device objects that this driver has created, the
-    // load event, and return.
+    // load event, the probes, and return.
 
 
     while (DriverObject->DeviceObject) {
         IoDeleteDevice(DriverObject->DeviceObject);
     }
 
+    for (i = 0; i < FSREC_PROBE_SLOTS; i += 1) {
+
+        if (FsRecProbeTable->Probes[i].TargetDevice != NULL) {
+
+            FsRecRetireProbe(&FsRecProbeTable->Probes[i]);
+        }
+    }
+
+    ExFreePool(FsRecProbeTable);
     ExFreePool(FsRecLoadSync);
 
     return;
@@ -721,6 +799,7 @@ Return Value:
     PIRP irp;
     NTSTATUS status;
     ULONG remainder;
+    PFSREC_PROBE probe;
 
     PAGED_CODE();
 
@@ -735,6 +814,18 @@ Return Value:
     }
 
 
+    //  Another recognizer may already have asked during this probe.
+
+
+    probe = FsRecFindProbe(DeviceObject);
+
+    if (probe != NULL && probe->SectorsBytesPerSector == BytesPerSector) {
+
+        *NumberOfSectors = probe->NumberOfSectors;
+        return TRUE;
+    }
+
+
     // Get the number of sectors on this partition.
 
 
@@ -778,6 +869,12 @@ Return Value:
                                                      BytesPerSector,
                                                      &remainder);
 
+    if (probe != NULL) {
+
+        probe->NumberOfSectors = *NumberOfSectors;
+        probe->SectorsBytesPerSector = BytesPerSector;
+    }
+
     return TRUE;
 }
 
@@ -814,6 +911,7 @@ Return Value:
     PIRP irp;
     NTSTATUS status;
     ULONG ControlCode;
+    PFSREC_PROBE probe;
 
     PAGED_CODE();
 
@@ -834,6 +932,18 @@ Return Value:
     return FALSE;
     }
 
+
+    //  Another recognizer may already have asked during this probe.
+
+
+    probe = FsRecFindProbe(DeviceObject);
+
+    if (probe != NULL && probe->SectorSizeKnown) {
+
+        *BytesPerSector = probe->BytesPerSector;
+        return TRUE;
+    }
+
     KeInitializeEvent(&event, SynchronizationEvent, FALSE);
     irp = IoBuildDeviceIoControlRequest(ControlCode,
                                         DeviceObject,
@@ -885,6 +995,12 @@ Return Value:
 
     *BytesPerSector = diskGeometry.BytesPerSector;
 
+    if (probe != NULL) {
+
+        probe->BytesPerSector = diskGeometry.BytesPerSector;
+        probe->SectorSizeKnown = TRUE;
+    }
+
     return TRUE;
 }
 
@@ -933,10 +1049,9 @@ Return Value:
 {
 #define RoundUp( x, y ) ( ((x + (y-1)) / y) * y )
 
-    IO_STATUS_BLOCK ioStatus;
-    KEVENT event;
-    PIRP irp;
-    NTSTATUS status;
+    LARGE_INTEGER windowOffset;
+    PFSREC_PROBE probe;
+    BOOLEAN result;
 
     PAGED_CODE();
 
@@ -944,8 +1059,6 @@ Return Value:
         *IsDeviceFailure = FALSE;
     }
 
-    KeInitializeEvent(&event, SynchronizationEvent, FALSE);
-
 
     // Set the minimum number of bytes to read to the maximum of the bytes that
     // the caller wants to read, and the number of bytes in a sector.
@@ -970,13 +1083,122 @@ Return Value:
     }
 
 
+    //  If the volume is being probed and the bytes lie in the window at the
+    //  front of it, copy them from there.  The window is read the first time
+    //  any recognizer asks for bytes within it.  Should that fail, perhaps
+    //  because the volume is smaller than the window, we go back to reading
+    //  only what each recognizer asks for.  Floppies are left alone since a
+    //  read that crosses tracks costs them far more than the sectors needed.
+
+
+    probe = FsRecFindProbe(DeviceObject);
+
+    if (probe != NULL &&
+        !probe->WindowFailed &&
+        (DeviceObject->Characteristics & FILE_FLOPPY_DISKETTE) == 0 &&
+        (FSREC_PROBE_WINDOW % BytesPerSector) == 0 &&
+        ByteOffset->QuadPart + MinimumBytes <= FSREC_PROBE_WINDOW) {
+
+        if (probe->Window == NULL) {
+
+            probe->Window = ExAllocatePoolWithTag(NonPagedPool, FSREC_PROBE_WINDOW, FSREC_POOL_TAG);
+
+            if (probe->Window != NULL) {
+
+                windowOffset.QuadPart = 0;
+                probe->Record.Reads += 1;
+
+                if (FsRecReadDevice(DeviceObject, &windowOffset, FSREC_PROBE_WINDOW, probe->Window, NULL)) {
+
+                    probe->Record.BytesRead += FSREC_PROBE_WINDOW;
+
+                } else {
+
+                    ExFreePool(probe->Window);
+                    probe->Window = NULL;
+                    probe->WindowFailed = TRUE;
+                }
+            }
+        }
+
+        if (probe->Window != NULL) {
+
+            RtlCopyMemory(*Buffer, (PUCHAR)probe->Window + ByteOffset->LowPart, MinimumBytes);
+            probe->Record.CachedReads += 1;
+            return TRUE;
+        }
+    }
+
+
     // Read the actual bytes off of the media.
 
 
+    result = FsRecReadDevice(DeviceObject, ByteOffset, MinimumBytes, *Buffer, IsDeviceFailure);
+
+    if (probe != NULL) {
+
+        probe->Record.Reads += 1;
+
+        if (result) {
+            probe->Record.BytesRead += MinimumBytes;
+        }
+    }
+
+    return result;
+}
+
+
+BOOLEAN
+FsRecReadDevice(
+    IN PDEVICE_OBJECT DeviceObject,
+    IN PLARGE_INTEGER ByteOffset,
+    IN ULONG Length,
+    IN PVOID Buffer,
+    OUT PBOOLEAN IsDeviceFailure OPTIONAL
+)
+
+/*++
+
+Routine Description:
+
+    This routine reads whole sectors from the device represented by the
+    device object into the caller's buffer.
+
+Arguments:
+
+    DeviceObject - Pointer to the device object from which to read.
+
+    ByteOffset - Pointer to a 64-bit byte offset from the base of the device
+        from which to start the read.
+
+    Length - Supplies the number of bytes to read, a multiple of the sector
+        size of the device.
+
+    Buffer - Supplies the nonpaged buffer to read into.
+
+    IsDeviceFailure - Variable to receive an indication whether a failure
+        was a result of talking to the device.
+
+Return Value:
+
+    The function value is TRUE if the bytes were read, otherwise FALSE.
+
+--*/
+
+{
+    IO_STATUS_BLOCK ioStatus;
+    KEVENT event;
+    PIRP irp;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    KeInitializeEvent(&event, SynchronizationEvent, FALSE);
+
     irp = IoBuildSynchronousFsdRequest(IRP_MJ_READ,
                                        DeviceObject,
-                                       *Buffer,
-                                       MinimumBytes,
+                                       Buffer,
+                                       Length,
                                        ByteOffset,
                                        &event,
                                        &ioStatus);
@@ -1013,6 +1235,410 @@ Return Value:
 }
 
 
+PFSREC_PROBE
+FsRecBeginProbe(
+    IN PDEVICE_OBJECT TargetDevice,
+    IN PVPB Vpb,
+    IN FILE_SYSTEM_TYPE FileSystemType
+)
+
+/*++
+
+Routine Description:
+
+    This routine is called as a recognizer is asked to mount a volume, and
+    returns the probe through which it shares what it reads of the volume
+    with the other recognizers.  The recognizers are called one after another
+    from the thread mounting the volume, so a probe belongs to that thread
+    and is found again by the next recognizer it calls.
+
+    The I/O system asks each recognizer once per mount request, so a
+    recognizer which has already looked at the probe starts a new request,
+    and the probe is retired rather than handed to it.  So is a probe of
+    removable media whose media change count has moved since it began.
+
+    Probes of different volumes go ahead in parallel; the table is only
+    locked while a probe is looked up, never while the volume is read.
+
+Arguments:
+
+    TargetDevice - Pointer to the device object of the volume being mounted.
+
+    Vpb - Pointer to the volume parameter block of the mount.
+
+    FileSystemType - Type of the recognizer being asked to mount the volume.
+
+Return Value:
+
+    The probe for the volume, or NULL if every probe is busy, in which case
+    the recognizer reads the volume for itself.
+
+--*/
+
+{
+    PFSREC_PROBE probe = NULL;
+    PFSREC_PROBE oldest = NULL;
+    PETHREAD thread = PsGetCurrentThread();
+    ULONGLONG now = KeQueryInterruptTime();
+    ULONG examined = 1 << FileSystemType;
+    ULONG mediaChangeCount = 0;
+    BOOLEAN mediaKnown = TRUE;
+    ULONG i;
+
+    PAGED_CODE();
+
+
+    //  Removable media may have been changed since the last recognizer read
+    //  it.  Ask for the change count before taking the lock.
+
+
+    if (FlagOn(TargetDevice->Characteristics, FILE_REMOVABLE_MEDIA)) {
+
+        mediaKnown = FsRecGetMediaChangeCount(TargetDevice, &mediaChangeCount);
+    }
+
+    ExAcquireFastMutex(&FsRecProbeTable->Mutex);
+
+    for (i = 0; i < FSREC_PROBE_SLOTS; i += 1) {
+
+        PFSREC_PROBE slot = &FsRecProbeTable->Probes[i];
+
+
+        //  Look for a probe this thread already began on the volume, and
+        //  remember the slot to use for a new one: a free slot if there is
+        //  one, otherwise the oldest probe no recognizer is working on.
+
+
+        if (slot->TargetDevice == NULL) {
+
+            if (oldest == NULL || oldest->TargetDevice != NULL) {
+                oldest = slot;
+            }
+
+        } else if (slot->Thread == thread && slot->TargetDevice == TargetDevice) {
+
+            probe = slot;
+
+        } else if (!slot->InUse &&
+                   (oldest == NULL ||
+                    (oldest->TargetDevice != NULL && slot->Started < oldest->Started))) {
+
+            oldest = slot;
+        }
+    }
+
+
+    //  What was read for an earlier mount request is of no use to a new one,
+    //  nor is what was read of media that has been changed since.
+
+
+    if (probe != NULL &&
+        (probe->Vpb != Vpb ||
+         FlagOn(probe->Examined, examined) ||
+         !mediaKnown ||
+         probe->MediaChangeCount != mediaChangeCount)) {
+
+        FsRecRetireProbe(probe);
+        oldest = probe;
+        probe = NULL;
+    }
+
+
+    //  Without a change count nothing read now can be trusted by the next
+    //  recognizer, so let each read the media for itself.
+
+
+    if (!mediaKnown) {
+
+        oldest = NULL;
+    }
+
+    if (probe == NULL && oldest != NULL) {
+
+        if (oldest->TargetDevice != NULL) {
+            FsRecRetireProbe(oldest);
+        }
+
+        //  The probe holds a reference to the volume's device object until
+        //  it is retired, so it cannot be deleted and its address reused
+        //  by another volume in the meantime.
+
+
+        ObReferenceObject(TargetDevice);
+
+        probe = oldest;
+        probe->Thread = thread;
+        probe->TargetDevice = TargetDevice;
+        probe->Vpb = Vpb;
+        probe->MediaChangeCount = mediaChangeCount;
+        probe->Started = now;
+        probe->Record.TargetDevice = TargetDevice;
+    }
+
+    if (probe != NULL) {
+        probe->InUse = TRUE;
+        SetFlag(probe->Examined, examined);
+    }
+
+    ExReleaseFastMutex(&FsRecProbeTable->Mutex);
+
+    return probe;
+}
+
+
+VOID
+FsRecEndProbe(
+    IN PFSREC_PROBE Probe,
+    IN FILE_SYSTEM_TYPE FileSystemType,
+    IN NTSTATUS Status,
+    IN ULONGLONG ProbeTime
+)
+
+/*++
+
+Routine Description:
+
+    This routine is called when a recognizer has finished looking at a volume.
+    It charges the time the recognizer took to the probe, and retires the probe
+    if the recognizer claimed the volume.  It also retires the probe when no
+    other active recognizer for the same type of media is left to look at the
+    volume, so that what was read of a volume none of them recognizes is not
+    kept until the slot is needed again.
+
+Arguments:
+
+    Probe - Pointer to the probe returned by FsRecBeginProbe.
+
+    DeviceObject - Pointer to the device object of the recognizer which looked
+        at the volume.
+
+    Status - Supplies the status the recognizer completed the mount with.
+
+    ProbeTime - Supplies the time the recognizer took, in 100ns units.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PDEVICE_EXTENSION deviceExtension = (PDEVICE_EXTENSION)DeviceObject->DeviceExtension;
+    PDEVICE_OBJECT recognizer;
+    BOOLEAN pending = FALSE;
+
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&FsRecProbeTable->Mutex);
+
+    Probe->InUse = FALSE;
+    Probe->Record.Recognizers += 1;
+    Probe->Record.ProbeTime += ProbeTime;
+    Probe->Record.Elapsed = KeQueryInterruptTime() - Probe->Started;
+
+    if (Status == STATUS_FS_DRIVER_REQUIRED) {
+
+        Probe->Record.FileSystemType = deviceExtension->FileSystemType;
+        FsRecRetireProbe(Probe);
+
+    } else {
+
+
+        //  The I/O system offers the volume to every file system registered
+        //  for its type of media, so look for an active recognizer of that
+        //  type which has not seen the probe yet.  Recognizers which are no
+        //  longer active complete the mount without looking at the volume.
+
+
+        for (recognizer = DeviceObject->DriverObject->DeviceObject;
+             recognizer != NULL;
+             recognizer = recognizer->NextDevice) {
+
+            PDEVICE_EXTENSION extension = (PDEVICE_EXTENSION)recognizer->DeviceExtension;
+
+            if (recognizer->DeviceType == DeviceObject->DeviceType &&
+                extension->State == Active &&
+                !FlagOn(Probe->Examined, 1 << extension->FileSystemType)) {
+
+                pending = TRUE;
+                break;
+            }
+        }
+
+        if (!pending) {
+
+            FsRecRetireProbe(Probe);
+        }
+    }
+
+    ExReleaseFastMutex(&FsRecProbeTable->Mutex);
+}
+
+
+PFSREC_PROBE
+FsRecFindProbe(
+    IN PDEVICE_OBJECT TargetDevice
+)
+
+/*++
+
+Routine Description:
+
+    This routine finds the probe of a volume which a recognizer running on
+    this thread is looking at.  Only that recognizer uses the probe until it
+    calls FsRecEndProbe, so the caller may use it without holding the lock.
+
+Arguments:
+
+    TargetDevice - Pointer to the device object being read.
+
+Return Value:
+
+    The probe for the volume, or NULL if it is not being probed.
+
+--*/
+
+{
+    PFSREC_PROBE probe = NULL;
+    PETHREAD thread = PsGetCurrentThread();
+    ULONG i;
+
+    PAGED_CODE();
+
+    ExAcquireFastMutex(&FsRecProbeTable->Mutex);
+
+    for (i = 0; i < FSREC_PROBE_SLOTS; i += 1) {
+
+        PFSREC_PROBE slot = &FsRecProbeTable->Probes[i];
+
+        if (slot->InUse && slot->Thread == thread && slot->TargetDevice == TargetDevice) {
+
+            probe = slot;
+            break;
+        }
+    }
+
+    ExReleaseFastMutex(&FsRecProbeTable->Mutex);
+
+    return probe;
+}
+
+
+BOOLEAN
+FsRecGetMediaChangeCount(
+    IN PDEVICE_OBJECT DeviceObject,
+    OUT PULONG MediaChangeCount
+)
+
+/*++
+
+Routine Description:
+
+    This routine returns the media change count of a removable media device,
+    which the device bumps each time the media is changed.
+
+Arguments:
+
+    DeviceObject - Pointer to the device object of the volume.
+
+    MediaChangeCount - Variable to receive the media change count.
+
+Return Value:
+
+    The function value is TRUE if the count was returned, otherwise FALSE.
+
+--*/
+
+{
+    IO_STATUS_BLOCK ioStatus;
+    KEVENT event;
+    PIRP irp;
+    NTSTATUS status;
+
+    PAGED_CODE();
+
+    KeInitializeEvent(&event, SynchronizationEvent, FALSE);
+
+    irp = IoBuildDeviceIoControlRequest((DeviceObject->DeviceType == FILE_DEVICE_CD_ROM ?
+                                         IOCTL_CDROM_CHECK_VERIFY :
+                                         IOCTL_DISK_CHECK_VERIFY),
+                                        DeviceObject,
+                                        (PVOID)NULL,
+                                        0,
+                                        MediaChangeCount,
+                                        sizeof(ULONG),
+                                        FALSE,
+                                        &event,
+                                        &ioStatus);
+    if (!irp) {
+        return FALSE;
+    }
+
+    SetFlag(IoGetNextIrpStackLocation(irp)->Flags, SL_OVERRIDE_VERIFY_VOLUME);
+
+    status = IoCallDriver(DeviceObject, irp);
+    if (status == STATUS_PENDING) {
+        (VOID)KeWaitForSingleObject(&event,
+                                    Executive,
+                                    KernelMode,
+                                    FALSE,
+                                    (PLARGE_INTEGER)NULL);
+        status = ioStatus.Status;
+    }
+
+    return (BOOLEAN)(NT_SUCCESS(status) && ioStatus.Information == sizeof(ULONG));
+}
+
+
+VOID
+FsRecRetireProbe(
+    IN PFSREC_PROBE Probe
+)
+
+/*++
+
+Routine Description:
+
+    This routine records a finished probe in the history, frees what was read
+    of the volume, drops the reference to the volume's device object and frees
+    the slot.  The probe table must be locked, or the driver being unloaded.
+
+Arguments:
+
+    Probe - Pointer to the probe to retire.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    DebugTrace(( 0, Dbg, "FsRecRetireProbe, DevObj %08x type %u recognizers %u reads %u cached %u bytes %u probe %u us elapsed %u us\n",
+                 Probe->Record.TargetDevice,
+                 Probe->Record.FileSystemType,
+                 Probe->Record.Recognizers,
+                 Probe->Record.Reads,
+                 Probe->Record.CachedReads,
+                 Probe->Record.BytesRead,
+                 (ULONG)(Probe->Record.ProbeTime / 10),
+                 (ULONG)(Probe->Record.Elapsed / 10) ));
+
+    FsRecProbeTable->History[FsRecProbeTable->HistoryIndex] = Probe->Record;
+    FsRecProbeTable->HistoryIndex = (FsRecProbeTable->HistoryIndex + 1) % FSREC_PROBE_HISTORY;
+
+    if (Probe->Window != NULL) {
+        ExFreePool(Probe->Window);
+    }
+
+    ObDereferenceObject(Probe->TargetDevice);
+
+    RtlZeroMemory(Probe, sizeof(FSREC_PROBE));
+}
+
+
 #if DBG
 BOOLEAN
 FsRecDebugTrace(
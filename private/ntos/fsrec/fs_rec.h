@@ -77,6 +77,62 @@ typedef struct _DEVICE_EXTENSION {
 } DEVICE_EXTENSION, *PDEVICE_EXTENSION;
 
 
+//  Define the probe context which the recognizers share while they examine
+//  one volume.  The I/O system offers a new volume to each recognizer in turn
+//  from the thread doing the mount, so the sector size, the size of the
+//  partition and the first FSREC_PROBE_WINDOW bytes of the volume, which hold
+//  the FAT and NTFS boot sectors and the start of the UDF volume recognition
+//  sequence, are read once and handed to every recognizer from here.
+
+//  A probe lasts for one mount request.  It ends when a recognizer claims the
+//  volume, or when every active recognizer for the type of media has looked
+//  at it without claiming it.  It is never used again once a recognizer which
+//  has already looked at it is asked to mount the volume a second time, since
+//  that is a new mount request, or once the media change count of removable
+//  media has moved.  Its counts are then kept in the history so the time taken
+//  to recognize each volume can be seen from the debugger.
+
+
+#define FSREC_PROBE_SLOTS         16
+#define FSREC_PROBE_HISTORY       32
+#define FSREC_PROBE_WINDOW        0x10000
+
+typedef struct _FSREC_PROBE_RECORD {
+    PDEVICE_OBJECT TargetDevice;
+    FILE_SYSTEM_TYPE FileSystemType;
+    ULONG Recognizers;
+    ULONG Reads;
+    ULONG CachedReads;
+    ULONG BytesRead;
+    ULONGLONG ProbeTime;
+    ULONGLONG Elapsed;
+} FSREC_PROBE_RECORD, *PFSREC_PROBE_RECORD;
+
+typedef struct _FSREC_PROBE {
+    PETHREAD Thread;
+    PDEVICE_OBJECT TargetDevice;
+    PVPB Vpb;
+    BOOLEAN InUse;
+    BOOLEAN WindowFailed;
+    BOOLEAN SectorSizeKnown;
+    ULONG Examined;                     // 1 << FILE_SYSTEM_TYPE of each recognizer which looked
+    ULONG MediaChangeCount;
+    ULONG BytesPerSector;
+    ULONG SectorsBytesPerSector;
+    LARGE_INTEGER NumberOfSectors;
+    PVOID Window;
+    ULONGLONG Started;
+    FSREC_PROBE_RECORD Record;
+} FSREC_PROBE, *PFSREC_PROBE;
+
+typedef struct _FSREC_PROBE_TABLE {
+    FAST_MUTEX Mutex;
+    FSREC_PROBE Probes[FSREC_PROBE_SLOTS];
+    ULONG HistoryIndex;
+    FSREC_PROBE_RECORD History[FSREC_PROBE_HISTORY];
+} FSREC_PROBE_TABLE, *PFSREC_PROBE_TABLE;
+
+
 // Define the functions provided by this driver.
 
 
@@ -149,6 +205,32 @@ FsRecReadBlock(
     OUT PBOOLEAN IsDeviceFailure OPTIONAL
     );
 
+PFSREC_PROBE
+FsRecBeginProbe (
+    IN PDEVICE_OBJECT TargetDevice,
+    IN PVPB Vpb,
+    IN FILE_SYSTEM_TYPE FileSystemType
+    );
+
+VOID
+FsRecEndProbe (
+    IN PFSREC_PROBE Probe,
+    IN PDEVICE_OBJECT DeviceObject,
+    IN NTSTATUS Status,
+    IN ULONGLONG ProbeTime
+    );
+
+PFSREC_PROBE
+FsRecFindProbe (
+    IN PDEVICE_OBJECT TargetDevice
+    );
+
+BOOLEAN
+FsRecGetMediaChangeCount (
+    IN PDEVICE_OBJECT DeviceObject,
+    OUT PULONG MediaChangeCount
+    );
+
 #if DBG
 
 extern LONG FsRecDebugTraceLevel;
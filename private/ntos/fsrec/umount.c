@@ -0,0 +1,273 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    umount.c
+
+Abstract:
+    Volume mount benchmark.  Dismounts each of the given volumes and then
+    times the open of the volume, which mounts it again, first one volume
+    after another and then all of them at once from a thread per volume.
+
+    The recognizers only look at volumes that no loaded file system
+    claims, and a recognizer goes away once it has loaded its file
+    system, so the volumes must be ones that none of the file systems the
+    recognizers stand for can mount, such as unformatted partitions or
+    blank media.  The raw file system then mounts them after every
+    recognizer has looked, which is checked before the benchmark starts.
+    With the recognizers sharing what they read of a volume the parallel
+    pass should take little longer than the slowest single mount.
+
+    The volumes must not be in use, since each has to be locked before it
+    can be dismounted.  The counts of reads made by the recognizers for
+    each volume are kept in FsRecProbeTable in the recognizer driver.
+
+    usage: umount drives [passes]
+
+        for example "umount EFG 10"
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define BENCH_MAX_VOLUMES   26
+
+CHAR BenchDrives[BENCH_MAX_VOLUMES + 1];
+ULONG BenchVolumes;
+ULONGLONG MountTimes[BENCH_MAX_VOLUMES];
+NTSTATUS MountStatus[BENCH_MAX_VOLUMES];
+LARGE_INTEGER Frequency;
+
+
+NTSTATUS OpenVolume(IN ULONG Index, IN ACCESS_MASK DesiredAccess, OUT PHANDLE Volume)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[32];
+
+    swprintf(NameBuffer, L"\\DosDevices\\%C:", BenchDrives[Index]);
+    RtlInitUnicodeString(&Name, NameBuffer);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    return NtOpenFile(Volume, DesiredAccess | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_SYNCHRONOUS_IO_NONALERT);
+}
+
+
+BOOLEAN IsRawVolume(IN ULONG Index)
+{
+    IO_STATUS_BLOCK IoStatus;
+    HANDLE Volume;
+    NTSTATUS Status;
+    UCHAR Buffer[sizeof(FILE_FS_ATTRIBUTE_INFORMATION) + 32 * sizeof(WCHAR)];
+    PFILE_FS_ATTRIBUTE_INFORMATION Attributes = (PFILE_FS_ATTRIBUTE_INFORMATION)Buffer;
+
+    Status = OpenVolume(Index, FILE_READ_DATA, &Volume);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %c: (%X)\n", BenchDrives[Index], Status);
+        return FALSE;
+    }
+
+    Status = NtQueryVolumeInformationFile(Volume, &IoStatus, Attributes, sizeof(Buffer), FileFsAttributeInformation);
+    NtClose(Volume);
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to query the file system of %c: (%X)\n", BenchDrives[Index], Status);
+        return FALSE;
+    }
+
+    if ((Attributes->FileSystemNameLength != 3 * sizeof(WCHAR)) || (_wcsnicmp(Attributes->FileSystemName, L"RAW", 3) != 0))
+    {
+        printf("%c: is mounted by %.*S, not RAW, so the recognizers never see it\n", BenchDrives[Index], (int)(Attributes->FileSystemNameLength / sizeof(WCHAR)), Attributes->FileSystemName);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+NTSTATUS DismountVolume(IN ULONG Index)
+{
+    IO_STATUS_BLOCK IoStatus;
+    HANDLE Volume;
+    NTSTATUS Status;
+
+    Status = OpenVolume(Index, FILE_READ_DATA | FILE_WRITE_DATA, &Volume);
+    if (!NT_SUCCESS(Status))
+    {
+        return Status;
+    }
+
+    Status = NtFsControlFile(Volume, NULL, NULL, NULL, &IoStatus, FSCTL_LOCK_VOLUME, NULL, 0, NULL, 0);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtFsControlFile(Volume, NULL, NULL, NULL, &IoStatus, FSCTL_DISMOUNT_VOLUME, NULL, 0, NULL, 0);
+    }
+
+    NtClose(Volume);
+    return Status;
+}
+
+
+ULONG MountThread(IN PVOID Context)
+{
+    LARGE_INTEGER Start, End;
+    HANDLE Volume;
+    ULONG Index = (ULONG)(ULONG_PTR)Context;
+
+    //  The open finds the volume dismounted, so every recognizer is asked to
+    //  mount it before the raw file system does
+
+    NtQueryPerformanceCounter(&Start, NULL);
+    MountStatus[Index] = OpenVolume(Index, FILE_READ_DATA, &Volume);
+    NtQueryPerformanceCounter(&End, NULL);
+
+    if (NT_SUCCESS(MountStatus[Index]))
+    {
+        NtClose(Volume);
+    }
+
+    MountTimes[Index] += ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+BOOLEAN RunMounts(IN PCHAR Title, IN BOOLEAN Parallel, IN ULONG Passes)
+{
+    HANDLE ThreadHandles[BENCH_MAX_VOLUMES];
+    LARGE_INTEGER Start, End;
+    ULONGLONG Elapsed;
+    ULONG ThreadCount;
+    ULONG Pass;
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < BenchVolumes; i++)
+    {
+        MountTimes[i] = 0;
+    }
+
+    Elapsed = 0;
+
+    for (Pass = 0; Pass < Passes; Pass++)
+    {
+        for (i = 0; i < BenchVolumes; i++)
+        {
+            Status = DismountVolume(i);
+            if (!NT_SUCCESS(Status))
+            {
+                printf("Unable to dismount %c: (%X)\n", BenchDrives[i], Status);
+                return FALSE;
+            }
+        }
+
+        ThreadCount = 0;
+        NtQueryPerformanceCounter(&Start, NULL);
+
+        for (i = 0; i < BenchVolumes; i++)
+        {
+            Status = RtlCreateUserThread(NtCurrentProcess(), NULL, FALSE, 0, 0, 0, (PUSER_THREAD_START_ROUTINE)MountThread, (PVOID)(ULONG_PTR)i, &ThreadHandles[ThreadCount], NULL);
+            if (!NT_SUCCESS(Status))
+            {
+                printf("Unable to create mount thread (%X)\n", Status);
+                break;
+            }
+
+            if (!Parallel)
+            {
+                NtWaitForSingleObject(ThreadHandles[ThreadCount], FALSE, NULL);
+            }
+
+            ThreadCount += 1;
+        }
+
+        NtWaitForMultipleObjects(ThreadCount, ThreadHandles, WaitAll, FALSE, NULL);
+        NtQueryPerformanceCounter(&End, NULL);
+
+        Elapsed += ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+
+        for (i = 0; i < ThreadCount; i++)
+        {
+            NtClose(ThreadHandles[i]);
+
+            if (!NT_SUCCESS(MountStatus[i]))
+            {
+                printf("Mount of %c: failed (%X)\n", BenchDrives[i], MountStatus[i]);
+                return FALSE;
+            }
+        }
+
+        if (ThreadCount != BenchVolumes)
+        {
+            return FALSE;
+        }
+    }
+
+    printf("%-10s %2u volumes  %6I64u us/pass\n", Title, BenchVolumes, Elapsed / Passes);
+
+    for (i = 0; i < BenchVolumes; i++)
+    {
+        printf("           %c:  %6I64u us/mount\n", BenchDrives[i], MountTimes[i] / Passes);
+    }
+
+    return TRUE;
+}
+
+
+main(int argc, char **argv)
+{
+    LARGE_INTEGER Now;
+    ULONG Passes = 10;
+    ULONG i;
+
+    if (argc > 2)
+    {
+        Passes = atoi(argv[2]);
+    }
+
+    if ((argc < 2) || (strlen(argv[1]) > BENCH_MAX_VOLUMES) || (Passes == 0))
+    {
+        printf("usage: umount drives [passes]\n");
+        return 1;
+    }
+
+    BenchVolumes = strlen(argv[1]);
+    for (i = 0; i < BenchVolumes; i++)
+    {
+        BenchDrives[i] = (CHAR)toupper(argv[1][i]);
+        if ((BenchDrives[i] < 'A') || (BenchDrives[i] > 'Z'))
+        {
+            printf("Invalid drive %c\n", argv[1][i]);
+            return 1;
+        }
+    }
+
+    for (i = 0; i < BenchVolumes; i++)
+    {
+        if (!IsRawVolume(i))
+        {
+            return 1;
+        }
+    }
+
+    NtQueryPerformanceCounter(&Now, &Frequency);
+
+    if (RunMounts("serial", FALSE, Passes) && RunMounts("parallel", TRUE, Passes))
+    {
+        return 0;
+    }
+
+    return 1;
+}
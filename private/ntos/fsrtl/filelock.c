@@ -104,6 +104,7 @@ Revision History:
 #define TAG_EXCLUSIVE_LOCK  'xeLF'
 #define TAG_FILE_LOCK       'lfLF'
 #define TAG_LOCK_INFO       'ilLF'
+#define TAG_LOCK_OWNER      'olLF'
 #define TAG_LOCKTREE_NODE   'nlLF'
 #define TAG_SHARED_LOCK     'hsLF'
 #define TAG_WAITING_LOCK    'lwLF'
@@ -133,6 +134,7 @@ NPAGED_LOOKASIDE_LIST FsRtlExclusiveLockLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlWaitingLockLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlLockTreeNodeLookasideList;
 NPAGED_LOOKASIDE_LIST FsRtlLockInfoLookasideList;
+NPAGED_LOOKASIDE_LIST FsRtlLockOwnerLookasideList;
 
 PAGED_LOOKASIDE_LIST FsRtlFileLockLookasideList;
 
@@ -313,6 +315,40 @@ typedef struct _WAITING_LOCK {
 } WAITING_LOCK, *PWAITING_LOCK;
 
 
+//  Each lock owner record counts the granted locks held by one file object
+//  and process pair, and is maintained in a list off of the LOCK_INFO.
+//  Unlock all uses the counts to skip the lock trees entirely when the
+//  owner holds nothing in them, and to stop walking a tree as soon as the
+//  last of the owner's locks in it has been removed, instead of always
+//  visiting every lock on the file.  This matters for files shared by many
+//  handles, each of which is unlocked in turn as it is cleaned up.
+
+
+typedef struct _LOCK_OWNER {
+
+
+    //  The link structure for the list of owners
+
+
+    SINGLE_LIST_ENTRY   Link;
+
+
+    //  The owner of the locks
+
+
+    PFILE_OBJECT        FileObject;
+    PVOID               ProcessId;
+
+
+    //  The number of locks held by the owner in each of the lock trees
+
+
+    ULONG               SharedLocks;
+    ULONG               ExclusiveLocks;
+
+} LOCK_OWNER, *PLOCK_OWNER;
+
+
 
 //  Each lock or waiting onto some lock queue.
 
@@ -376,6 +412,13 @@ typedef struct _LOCK_INFO {
 
     LOCK_QUEUE  LockQueue;
 
+
+    //  The owners of the locked ranges, most recently used first.  This
+    //  list is guarded by the queue spinlock.
+
+
+    SINGLE_LIST_ENTRY Owners;
+
 } LOCK_INFO, *PLOCK_INFO;
 
 
@@ -431,6 +474,15 @@ FsRtlAllocateLockInfo (
     return (PLOCK_INFO) ExAllocateFromNPagedLookasideList( &FsRtlLockInfoLookasideList );
 }
 
+INLINE
+PLOCK_OWNER
+FsRtlAllocateLockOwner (
+    VOID
+    )
+{
+    return (PLOCK_OWNER) ExAllocateFromNPagedLookasideList( &FsRtlLockOwnerLookasideList );
+}
+
 
 INLINE
 VOID
@@ -477,6 +529,15 @@ FsRtlFreeLockInfo (
     ExFreeToNPagedLookasideList( &FsRtlLockInfoLookasideList, (PVOID)C );
 }
 
+INLINE
+VOID
+FsRtlFreeLockOwner (
+    IN PLOCK_OWNER C
+    )
+{
+    ExFreeToNPagedLookasideList( &FsRtlLockOwnerLookasideList, (PVOID)C );
+}
+
 
 #define FsRtlAcquireLockQueue(a,b)                  \
         ExAcquireSpinLock(&(a)->QueueSpinLock, b);
@@ -548,10 +609,12 @@ FsRtlCompleteLockIrpReal (
 #undef FsRtlAllocateExclusiveLock
 #undef FsRtlAllocateLockTreeNode
 #undef FsRtlAllocateWaitingLock
+#undef FsRtlAllocateLockOwner
 #undef FsRtlFreeSharedLock
 #undef FsRtlFreeExclusiveLock
 #undef FsRtlFreeLockTreeNode
 #undef FsRtlFreeWaitingLock
+#undef FsRtlFreeLockOwner
 #undef FsRtlAcquireLockQueue
 #undef FsRtlReacquireLockQueue
 #undef FsRtlReleaseLockQueue
@@ -563,11 +626,13 @@ FsRtlCompleteLockIrpReal (
 #define FsRtlAllocateLockTreeNode( C )      (PLOCKTREE_NODE)malloc(sizeof(LOCKTREE_NODE))
 #define FsRtlAllocateWaitingLock( C )       (PWAITING_LOCK)malloc(sizeof(WAITING_LOCK))
 #define FsRtlAllocateLockInfo( C )          (PLOCK_INFO)malloc(sizeof(LOCK_INFO))
+#define FsRtlAllocateLockOwner( C )         (PLOCK_OWNER)malloc(sizeof(LOCK_OWNER))
 #define FsRtlFreeSharedLock( C )            free(C)
 #define FsRtlFreeExclusiveLock( C )         free(C)
 #define FsRtlFreeLockTreeNode( C )          free(C)
 #define FsRtlFreeWaitingLock( C )           free(C)
 #define FsRtlFreeLockInfo( C )              free(C)
+#define FsRtlFreeLockOwner( C )             free(C)
 #define FsRtlAcquireLockQueue(a,b)          (*(b) = '\0')
 #define FsRtlReacquireLockQueue(a,b,c)      (*(c) = '\0')
 #define FsRtlReleaseLockQueue(a,b)
@@ -713,6 +778,25 @@ FsRtlPrivateResetLowestLockOffset (
     PLOCK_INFO LockInfo
     );
 
+PLOCK_OWNER
+FsRtlPrivateFindLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PFILE_OBJECT FileObject,
+    IN PVOID ProcessId
+    );
+
+VOID
+FsRtlPrivateReleaseLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PFILE_LOCK_INFO FileLockInfo
+    );
+
+VOID
+FsRtlPrivateFreeLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PLOCK_OWNER Owner
+    );
+
 NTSTATUS
 FsRtlFastUnlockSingleShared (
     IN PLOCK_INFO LockInfo,
@@ -806,6 +890,14 @@ Return Value:
                                      TAG_LOCK_INFO,
                                      8 );
 
+    ExInitializeNPagedLookasideList( &FsRtlLockOwnerLookasideList,
+                                     NULL,
+                                     NULL,
+                                     0,
+                                     sizeof(LOCK_OWNER),
+                                     TAG_LOCK_OWNER,
+                                     16 );
+
     ExInitializePagedLookasideList( &FsRtlFileLockLookasideList,
                                     NULL,
                                     NULL,
@@ -958,6 +1050,7 @@ Return Value:
         LockInfo->LockQueue.ExclusiveLockTree = NULL;
         LockInfo->LockQueue.WaitingLocks.Next = NULL;
         LockInfo->LockQueue.WaitingLocksTail.Next = NULL;
+        LockInfo->Owners.Next = NULL;
 
 
         // Copy Irp & Unlock routines from pagable FileLock structure
@@ -1024,6 +1117,7 @@ Return Value:
     PSINGLE_LIST_ENTRY  Link;
     PWAITING_LOCK       WaitingLock;
     PLOCKTREE_NODE      LockTreeNode;
+    PLOCK_OWNER         Owner;
     PIRP                Irp;
     NTSTATUS            NewStatus;
     KIRQL               OldIrql;
@@ -1079,6 +1173,18 @@ Return Value:
     }
 
 
+    //  Free the lock owners, which now hold nothing
+
+
+    while (LockInfo->Owners.Next != NULL) {
+
+        Link = PopEntryList( &LockInfo->Owners );
+        Owner = CONTAINING_RECORD( Link, LOCK_OWNER, Link );
+
+        FsRtlFreeLockOwner( Owner );
+    }
+
+
     //  Free WaitingLockQueue
 
 
@@ -3488,6 +3594,8 @@ Return Value:
 
             *pLink = Link->Next;
 
+            FsRtlPrivateReleaseLockOwner( LockInfo, &Lock->LockInfo );
+
             if (pLink == &Node->Locks.Next) {
 
 
@@ -3708,6 +3816,8 @@ Return Value:
 
             LockQueue->ExclusiveLockTree = RtlDelete(&Lock->Links);
 
+            FsRtlPrivateReleaseLockOwner( LockInfo, &Lock->LockInfo );
+
             if (LockInfo->LowestLockOffset != 0xffffffff &&
                 LockInfo->LowestLockOffset == Lock->LockInfo.StartingByte.LowPart) {
 
@@ -4279,6 +4389,31 @@ Return Value:
 --*/
 
 {
+    PLOCK_OWNER Owner;
+
+
+    //  Find the record counting the locks of this owner, or start one.
+
+
+    Owner = FsRtlPrivateFindLockOwner( LockInfo, FileLockInfo->FileObject, FileLockInfo->ProcessId );
+
+    if (Owner == NULL) {
+
+        Owner = FsRtlAllocateLockOwner();
+
+        if (Owner == NULL) {
+
+            return FALSE;
+        }
+
+        Owner->FileObject = FileLockInfo->FileObject;
+        Owner->ProcessId = FileLockInfo->ProcessId;
+        Owner->SharedLocks = 0;
+        Owner->ExclusiveLocks = 0;
+
+        PushEntryList( &LockInfo->Owners, &Owner->Link );
+    }
+
 
     //  Now add the lock to the appropriate tree.
 
@@ -4300,6 +4435,8 @@ Return Value:
 
         FileObject->LastLock = &ExLock->LockInfo;
 
+        Owner->ExclusiveLocks += 1;
+
     } else {
 
         PSH_LOCK ShLock;
@@ -4319,6 +4456,8 @@ Return Value:
         }
 
         FileObject->LastLock = &ShLock->LockInfo;
+
+        Owner->SharedLocks += 1;
     }
 
 
@@ -5250,6 +5389,153 @@ Return Value:
 }
 
 
+PLOCK_OWNER
+FsRtlPrivateFindLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PFILE_OBJECT FileObject,
+    IN PVOID ProcessId
+    )
+
+/*++
+
+Routine Description:
+
+    This routine finds the record counting the locks held by a file object
+    and process pair, and moves it to the front of the owner list so that
+    the next lookup for the same owner is immediate.  The caller must hold
+    the queue spinlock.
+
+Arguments:
+
+    LockInfo - the lock data to operate on
+
+    FileObject - Supplies the file object of the owner
+
+    ProcessId - Supplies the process of the owner
+
+Return Value:
+
+    PLOCK_OWNER - the owner record, or NULL if the owner holds no locks
+
+--*/
+
+{
+    PSINGLE_LIST_ENTRY *pLink, Link;
+    PLOCK_OWNER Owner;
+
+    for (pLink = &LockInfo->Owners.Next;
+         (Link = *pLink) != NULL;
+         pLink = &Link->Next) {
+
+        Owner = CONTAINING_RECORD( Link, LOCK_OWNER, Link );
+
+        if (Owner->FileObject == FileObject &&
+            Owner->ProcessId == ProcessId) {
+
+            if (pLink != &LockInfo->Owners.Next) {
+
+                *pLink = Link->Next;
+                PushEntryList( &LockInfo->Owners, Link );
+            }
+
+            return Owner;
+        }
+    }
+
+    return NULL;
+}
+
+
+VOID
+FsRtlPrivateReleaseLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PFILE_LOCK_INFO FileLockInfo
+    )
+
+/*++
+
+Routine Description:
+
+    This routine drops the count of locks held by the owner of a lock
+    which has just been removed from the lock trees.  The owner record
+    itself is left in place, since it is only freed by unlock all.  The
+    caller must hold the queue spinlock.
+
+Arguments:
+
+    LockInfo - the lock data to operate on
+
+    FileLockInfo - Supplies the lock being removed
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PLOCK_OWNER Owner;
+
+    Owner = FsRtlPrivateFindLockOwner( LockInfo, FileLockInfo->FileObject, FileLockInfo->ProcessId );
+
+    ASSERT( Owner != NULL );
+
+    if (FileLockInfo->ExclusiveLock) {
+
+        ASSERT( Owner->ExclusiveLocks != 0 );
+        Owner->ExclusiveLocks -= 1;
+
+    } else {
+
+        ASSERT( Owner->SharedLocks != 0 );
+        Owner->SharedLocks -= 1;
+    }
+}
+
+
+VOID
+FsRtlPrivateFreeLockOwner (
+    IN PLOCK_INFO LockInfo,
+    IN PLOCK_OWNER Owner
+    )
+
+/*++
+
+Routine Description:
+
+    This routine unlinks and frees an owner record which no longer counts
+    any locks.  The caller must hold the queue spinlock.
+
+Arguments:
+
+    LockInfo - the lock data to operate on
+
+    Owner - Supplies the owner record to free
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PSINGLE_LIST_ENTRY *pLink;
+
+    ASSERT( Owner->SharedLocks == 0 && Owner->ExclusiveLocks == 0 );
+
+    for (pLink = &LockInfo->Owners.Next;
+         *pLink != &Owner->Link;
+         pLink = &(*pLink)->Next) {
+
+        ASSERT( *pLink != NULL );
+    }
+
+    *pLink = Owner->Link.Next;
+
+    FsRtlFreeLockOwner( Owner );
+}
+
+
 NTSTATUS
 FsRtlPrivateFastUnlockAll (
     IN PFILE_LOCK FileLock,
@@ -5304,6 +5590,7 @@ Return Value:
     PEX_LOCK                ExLock;
     PRTL_SPLAY_LINKS        SplayLinks, SuccessorLinks;
     PLOCKTREE_NODE          Node;
+    PLOCK_OWNER             Owner;
 
 
     DebugTrace(+1, Dbg, "FsRtlPrivateFastUnlockAll, FileLock = %08lx\n", FileLock);
@@ -5342,10 +5629,20 @@ Return Value:
     }
 
 
+    //  Find out how many locks the owner holds in each tree, so that we need only
+    //  walk a tree until we have found all of them.  The owner record can only be
+    //  freed by an unlock all for the same owner, which the file system issues once
+    //  when the file object is cleaned up, so it stays valid across the points below
+    //  where we drop the queue spinlock.
+
+
+    Owner = FsRtlPrivateFindLockOwner( LockInfo, FileObject, ProcessId );
+
+
     //  Remove all matching locks in the shared lock tree
 
 
-    if (LockQueue->SharedLockTree != NULL) {
+    if (Owner != NULL && Owner->SharedLocks != 0 && LockQueue->SharedLockTree != NULL) {
 
 
         //  Grab the lowest node in the tree
@@ -5365,7 +5662,7 @@ Return Value:
         UnlockRoutine = FALSE;
 
         for (;
-             SplayLinks;
+             SplayLinks && Owner->SharedLocks != 0;
              SplayLinks = SuccessorLinks) {
 
             Node = CONTAINING_RECORD(SplayLinks, LOCKTREE_NODE, Links );
@@ -5440,6 +5737,8 @@ Return Value:
 
                     *pLink = Link->Next;
 
+                    Owner->SharedLocks -= 1;
+
                     if (LockInfo->UnlockRoutine != NULL) {
 
 
@@ -5542,7 +5841,7 @@ Return Value:
     //  Remove all matching locks in the exclusive lock tree
 
 
-    if (LockQueue->ExclusiveLockTree != NULL) {
+    if (Owner != NULL && Owner->ExclusiveLocks != 0 && LockQueue->ExclusiveLockTree != NULL) {
 
         SplayLinks = LockQueue->ExclusiveLockTree;
 
@@ -5557,7 +5856,7 @@ Return Value:
 
         UnlockRoutine = FALSE;
 
-        for (; SplayLinks;
+        for (; SplayLinks && Owner->ExclusiveLocks != 0;
                SplayLinks = SuccessorLinks ) {
 
             SuccessorLinks = RtlRealSuccessor(SplayLinks);
@@ -5572,6 +5871,8 @@ Return Value:
 
                 LockQueue->ExclusiveLockTree = RtlDelete(&ExLock->Links);
 
+                Owner->ExclusiveLocks -= 1;
+
                 if (LockInfo->UnlockRoutine != NULL) {
 
 
@@ -5694,17 +5995,34 @@ Return Value:
     }
 
 
-    //  At this point we've gone through unlocking everything. So
-    //  now try and release any waiting locks.
+    //  If the owner held no locks there is nothing more to do, since no
+    //  range has been freed.
+
+
+    if (Owner != NULL) {
+
+
+        //  Once a full unlock all leaves the owner holding nothing, drop its record.
+
 
+        if (!MatchKey && Owner->SharedLocks == 0 && Owner->ExclusiveLocks == 0) {
 
-    FsRtlPrivateCheckWaitingLocks( LockInfo, LockQueue, OldIrql );
+            FsRtlPrivateFreeLockOwner( LockInfo, Owner );
+        }
+
+
+        //  At this point we've gone through unlocking everything. So
+        //  now try and release any waiting locks.
 
 
-    //  We deleted a (possible) bunch of locks, go repair the lowest lock offset
+        FsRtlPrivateCheckWaitingLocks( LockInfo, LockQueue, OldIrql );
 
 
-    FsRtlPrivateResetLowestLockOffset( LockInfo );
+        //  We deleted a (possible) bunch of locks, go repair the lowest lock offset
+
+
+        FsRtlPrivateResetLowestLockOffset( LockInfo );
+    }
 
     FsRtlReleaseLockQueue( LockQueue, OldIrql );
 
@@ -164,6 +164,73 @@ typedef struct _NONOPAQUE_MCB {
 typedef NONOPAQUE_MCB *PNONOPAQUE_MCB;
 
 
+//  A heavily fragmented file can need hundreds of thousands of mapping
+//  pairs, and keeping them in one array makes every insert in the middle
+//  slide the tail and every growth copy the whole array.  So once an Mcb
+//  outgrows MAXIMUM_FLAT_PAIR_COUNT its pairs are moved into chunks of
+//  MAPPING_CHUNK_PAIRS pairs each (a page apiece), described by a sorted
+//  directory hung off the Mapping field.  The MaximumPairCount field is
+//  set to CHUNKED_PAIR_COUNT to say the Mcb is in this form.
+
+//  Each directory entry records the index of the first pair in its chunk,
+//  so a pair index is found with a binary search of the directory and an
+//  insert or remove only slides pairs within one chunk and bumps the base
+//  index of the chunks that follow.  The directory also remembers the
+//  chunk last used, so the sequential walks done by the lookup routines
+//  and FsRtlGetNextLargeMcbEntry go straight to the right chunk.
+
+//  Truncating an Mcb only lowers the PairCount field (ntfs does this
+//  itself), so the directory keeps its own count of the pairs held in the
+//  chunks and trims the chunks to match the next time it is changed.
+
+
+#define MAPPING_CHUNK_PAIRS              (PAGE_SIZE / sizeof(MAPPING))
+#define MAXIMUM_FLAT_PAIR_COUNT          (2048)
+#define CHUNKED_PAIR_COUNT               (0xffffffff)
+
+typedef struct _MAPPING_CHUNK {
+    ULONG BaseIndex;
+    ULONG PairCount;
+    PMAPPING Mapping;
+} MAPPING_CHUNK;
+typedef MAPPING_CHUNK *PMAPPING_CHUNK;
+
+typedef struct _MAPPING_DIRECTORY {
+    ULONG PairCount;
+    ULONG ChunkCount;
+    ULONG MaximumChunkCount;
+    ULONG CursorChunk;
+    PMAPPING_CHUNK Chunks;
+} MAPPING_DIRECTORY;
+typedef MAPPING_DIRECTORY *PMAPPING_DIRECTORY;
+
+#define IsChunkedMcb(MCB) ((MCB)->MaximumPairCount == CHUNKED_PAIR_COUNT)
+
+#define MappingDirectory(MCB) ((PMAPPING_DIRECTORY)(MCB)->Mapping)
+
+
+//  A macro to return the mapping pair at a given index.  It may be used
+//  on either side of an assignment.
+
+
+#define MappingPair(MCB,I) (                              \
+    *(IsChunkedMcb(MCB) ?                                 \
+      FsRtlFindChunkPair(MappingDirectory(MCB),(I)) :     \
+      &((MCB)->Mapping)[(I)])                             \
+)
+
+
+//  A macro to return the Vbn following the last one mapped by a chunk,
+//  not counting any pairs in the chunk beyond the pair count of the Mcb.
+
+
+#define ChunkNextVbn(MCB,D,C) (                                               \
+    (VBN)((D)->Chunks[(C)].BaseIndex + (D)->Chunks[(C)].PairCount > (MCB)->PairCount ? \
+          (D)->Chunks[(C)].Mapping[(MCB)->PairCount - (D)->Chunks[(C)].BaseIndex - 1].NextVbn : \
+          (D)->Chunks[(C)].Mapping[(D)->Chunks[(C)].PairCount - 1].NextVbn)   \
+)
+
+
 //  A macro to return the size, in bytes, of a retrieval mapping structure
 
 
@@ -188,12 +255,12 @@ typedef NONOPAQUE_MCB *PNONOPAQUE_MCB;
     (VBN)((I) == 0 ? 0xffffffff : EndingVbn(MCB,(I)-1)) \
 )
 
-#define StartingVbn(MCB,I) (                                \
-    (VBN)((I) == 0 ? 0 : (((MCB)->Mapping))[(I)-1].NextVbn) \
+#define StartingVbn(MCB,I) (                              \
+    (VBN)((I) == 0 ? 0 : MappingPair(MCB,(I)-1).NextVbn) \
 )
 
-#define EndingVbn(MCB,I) (                     \
-    (VBN)((((MCB)->Mapping)[(I)].NextVbn) - 1) \
+#define EndingVbn(MCB,I) (                      \
+    (VBN)((MappingPair(MCB,I).NextVbn) - 1) \
 )
 
 #define NextStartingVbn(MCB,I) (                                \
@@ -207,15 +274,15 @@ typedef NONOPAQUE_MCB *PNONOPAQUE_MCB;
     (LBN)((I) == 0 ? UNUSED_LBN : EndingLbn(MCB,(I)-1)) \
 )
 
-#define StartingLbn(MCB,I) (         \
-    (LBN)(((MCB)->Mapping)[(I)].Lbn) \
+#define StartingLbn(MCB,I) (           \
+    (LBN)(MappingPair(MCB,I).Lbn) \
 )
 
 #define EndingLbn(MCB,I) (                                       \
     (LBN)(StartingLbn(MCB,I) == UNUSED_LBN ?                     \
           UNUSED_LBN :                                           \
-          ((MCB)->Mapping[(I)].Lbn +                             \
-           (MCB)->Mapping[(I)].NextVbn - StartingVbn(MCB,I) - 1) \
+          (MappingPair(MCB,I).Lbn +                              \
+           MappingPair(MCB,I).NextVbn - StartingVbn(MCB,I) - 1)  \
          )                                                       \
 )
 
@@ -283,6 +350,61 @@ FsRtlRemoveLargeEntry (
     );
 
 
+//  Private routines to keep the mapping pairs of a chunked Mcb
+
+
+VOID
+FsRtlChunkLargeMcb (
+    IN PNONOPAQUE_MCB Mcb
+    );
+
+VOID
+FsRtlUnchunkLargeMcb (
+    IN PNONOPAQUE_MCB Mcb
+    );
+
+VOID
+FsRtlFreeChunks (
+    IN PMAPPING_DIRECTORY Directory
+    );
+
+VOID
+FsRtlTrimChunks (
+    IN PNONOPAQUE_MCB Mcb
+    );
+
+ULONG
+FsRtlFindChunk (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG Index
+    );
+
+PMAPPING
+FsRtlFindChunkPair (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG Index
+    );
+
+BOOLEAN
+FsRtlFindVbnChunk (
+    IN PNONOPAQUE_MCB Mcb,
+    IN VBN Vbn,
+    OUT PULONG Chunk
+    );
+
+PMAPPING_CHUNK
+FsRtlInsertChunk (
+    IN PNONOPAQUE_MCB Mcb,
+    IN ULONG WhereToInsertChunk
+    );
+
+VOID
+FsRtlDeleteChunk (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG WhereToDeleteChunk
+    );
+
+
 //  Some private routines to handle common allocations.
 
 
@@ -712,7 +834,11 @@ Return Value:
 
     Mcb->FastMutex = NULL;
 
-    if ((Mcb->PoolType == PagedPool) && (Mcb->MaximumPairCount == INITIAL_MAXIMUM_PAIR_COUNT)) {
+    if (IsChunkedMcb( Mcb )) {
+
+        FsRtlFreeChunks( MappingDirectory( Mcb ));
+
+    } else if ((Mcb->PoolType == PagedPool) && (Mcb->MaximumPairCount == INITIAL_MAXIMUM_PAIR_COUNT)) {
 
         FsRtlFreeFirstMapping( Mcb->Mapping );
 
@@ -823,21 +949,46 @@ Return Value:
 
                     if (NextStartingVbn(Mcb, Index) > Vbn) {
 
-                        (Mcb->Mapping)[Index].NextVbn = Vbn;
+                        MappingPair(Mcb,Index).NextVbn = Vbn;
                     }
                 }
             }
         }
 
 
+        //  A chunked Mcb goes back to a single mapping pair buffer once it
+        //  is down to half of what one can hold, otherwise we just free
+        //  the chunks beyond the new end.
+
+
+        if (IsChunkedMcb( Mcb )) {
+
+            if (Mcb->PairCount <= (MAXIMUM_FLAT_PAIR_COUNT / 2)) {
+
+                try {
+
+                    FsRtlUnchunkLargeMcb( Mcb );
+
+                } except (EXCEPTION_EXECUTE_HANDLER) {
+
+                    NOTHING;
+                }
+            }
+
+            if (IsChunkedMcb( Mcb )) {
+
+                FsRtlTrimChunks( Mcb );
+            }
+
+
         //  Now see if we can shrink the allocation for the mapping pairs.
         //  We'll shrink the mapping pair buffer if the new pair count will
         //  fit within a quarter of the current maximum pair count and the
         //  current maximum is greater than the initial pair count.
 
 
-        if ((Mcb->PairCount < (Mcb->MaximumPairCount / 4)) &&
-            (Mcb->MaximumPairCount > INITIAL_MAXIMUM_PAIR_COUNT)) {
+        } else if ((Mcb->PairCount < (Mcb->MaximumPairCount / 4)) &&
+                   (Mcb->MaximumPairCount > INITIAL_MAXIMUM_PAIR_COUNT)) {
 
             ULONG NewMax;
             PMAPPING Mapping;
@@ -1173,7 +1324,7 @@ Return Value:
 
                 DebugTrace( 0, Dbg, "Continuing last run\n", 0);
 
-                (Mcb->Mapping)[Mcb->PairCount-1].NextVbn += SectorCount;
+                MappingPair(Mcb,Mcb->PairCount-1).NextVbn += SectorCount;
 
                 try_return (Result = TRUE);
             }
@@ -1207,8 +1358,8 @@ Return Value:
                 //  Add the new mapping
 
 
-                (Mcb->Mapping)[Index].Lbn = Lbn;
-                (Mcb->Mapping)[Index].NextVbn = Vbn + SectorCount;
+                MappingPair(Mcb,Index).Lbn = Lbn;
+                MappingPair(Mcb,Index).NextVbn = Vbn + SectorCount;
 
                 try_return (Result = TRUE);
             }
@@ -1233,15 +1384,15 @@ Return Value:
             //  Add the hole
 
 
-            (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
-            (Mcb->Mapping)[Index].NextVbn = Vbn;
+            MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
+            MappingPair(Mcb,Index).NextVbn = Vbn;
 
 
             //  Add the new mapping
 
 
-            (Mcb->Mapping)[Index+1].Lbn = Lbn;
-            (Mcb->Mapping)[Index+1].NextVbn = Vbn + SectorCount;
+            MappingPair(Mcb,Index+1).Lbn = Lbn;
+            MappingPair(Mcb,Index+1).NextVbn = Vbn + SectorCount;
 
             try_return (Result = TRUE);
         }
@@ -1284,15 +1435,15 @@ Return Value:
                 //  Add the first hole
 
 
-                (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
-                (Mcb->Mapping)[Index].NextVbn = Vbn;
+                MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index).NextVbn = Vbn;
 
 
                 //  Add the new mapping
 
 
-                (Mcb->Mapping)[Index+1].Lbn = Lbn;
-                (Mcb->Mapping)[Index+1].NextVbn = Vbn + SectorCount;
+                MappingPair(Mcb,Index+1).Lbn = Lbn;
+                MappingPair(Mcb,Index+1).NextVbn = Vbn + SectorCount;
 
 
                 //  The second hole is already set up by the add entry call, because
@@ -1318,7 +1469,7 @@ Return Value:
                     //  We just need to extend the previous run
 
 
-                    (Mcb->Mapping)[Index-1].NextVbn += SectorCount;
+                    MappingPair(Mcb,Index-1).NextVbn += SectorCount;
 
                     try_return (Result = TRUE);
 
@@ -1346,8 +1497,8 @@ Return Value:
                     //  Add the new mapping
 
 
-                    (Mcb->Mapping)[Index].Lbn = Lbn;
-                    (Mcb->Mapping)[Index].NextVbn = Vbn + SectorCount;
+                    MappingPair(Mcb,Index).Lbn = Lbn;
+                    MappingPair(Mcb,Index).NextVbn = Vbn + SectorCount;
 
 
                     //  The hole is already set up by the add entry call, because
@@ -1376,8 +1527,8 @@ Return Value:
                     //  We just need to extend the following run
 
 
-                    (Mcb->Mapping)[Index].NextVbn = Vbn;
-                    (Mcb->Mapping)[Index+1].Lbn = Lbn;
+                    MappingPair(Mcb,Index).NextVbn = Vbn;
+                    MappingPair(Mcb,Index+1).Lbn = Lbn;
 
                     try_return (Result = TRUE);
 
@@ -1405,14 +1556,14 @@ Return Value:
                     //  Add the hole
 
 
-                    (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
-                    (Mcb->Mapping)[Index].NextVbn = Vbn;
+                    MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
+                    MappingPair(Mcb,Index).NextVbn = Vbn;
 
 
                     //  Add the new mapping
 
 
-                    (Mcb->Mapping)[Index+1].Lbn = Lbn;
+                    MappingPair(Mcb,Index+1).Lbn = Lbn;
 
                     try_return (Result = TRUE);
                 }
@@ -1437,7 +1588,7 @@ Return Value:
                 //  one run
 
 
-                (Mcb->Mapping)[Index-1].NextVbn = (Mcb->Mapping)[Index+1].NextVbn;
+                MappingPair(Mcb,Index-1).NextVbn = MappingPair(Mcb,Index+1).NextVbn;
 
                 FsRtlRemoveLargeEntry( Mcb, Index, 2 );
 
@@ -1461,7 +1612,7 @@ Return Value:
                 //  following run to meet up with the previous run
 
 
-                (Mcb->Mapping)[Index+1].Lbn = Lbn;
+                MappingPair(Mcb,Index+1).Lbn = Lbn;
 
                 FsRtlRemoveLargeEntry( Mcb, Index, 1 );
 
@@ -1483,7 +1634,7 @@ Return Value:
                 //  previous run to meet up with the following run
 
 
-                (Mcb->Mapping)[Index-1].NextVbn = (Mcb->Mapping)[Index].NextVbn;
+                MappingPair(Mcb,Index-1).NextVbn = MappingPair(Mcb,Index).NextVbn;
 
                 FsRtlRemoveLargeEntry( Mcb, Index, 1 );
 
@@ -1500,7 +1651,7 @@ Return Value:
 
             DebugTrace( 0, Dbg, "No holes, and continues none\n", 0);
 
-            (Mcb->Mapping)[Index].Lbn = Lbn;
+            MappingPair(Mcb,Index).Lbn = Lbn;
 
             try_return (Result = TRUE);
         }
@@ -2228,8 +2379,8 @@ Return Value:
 
             FsRtlAddLargeEntry( Mcb, Index, 1 );
 
-            (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
-            (Mcb->Mapping)[Index].NextVbn = Vbn + Amount;
+            MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
+            MappingPair(Mcb,Index).NextVbn = Vbn + Amount;
 
             Index += 1;
 
@@ -2250,13 +2401,13 @@ Return Value:
 
             FsRtlAddLargeEntry( Mcb, Index, 2 );
 
-            (Mcb->Mapping)[Index].Lbn = (Mcb->Mapping)[Index+2].Lbn;
-            (Mcb->Mapping)[Index].NextVbn = Vbn;
+            MappingPair(Mcb,Index).Lbn = MappingPair(Mcb,Index+2).Lbn;
+            MappingPair(Mcb,Index).NextVbn = Vbn;
 
-            (Mcb->Mapping)[Index+1].Lbn = (LBN)UNUSED_LBN;
-            (Mcb->Mapping)[Index+1].NextVbn = Vbn + Amount;
+            MappingPair(Mcb,Index+1).Lbn = (LBN)UNUSED_LBN;
+            MappingPair(Mcb,Index+1).NextVbn = Vbn + Amount;
 
-            (Mcb->Mapping)[Index+2].Lbn = (Mcb->Mapping)[Index+2].Lbn +
+            MappingPair(Mcb,Index+2).Lbn = MappingPair(Mcb,Index+2).Lbn +
                                           StartingVbn(Mcb, Index+1) -
                                           StartingVbn(Mcb, Index);
 
@@ -2272,7 +2423,7 @@ Return Value:
 
         for (i = Index; i < Mcb->PairCount; i += 1) {
 
-            (Mcb->Mapping)[i].NextVbn += Amount;
+            MappingPair(Mcb,i).NextVbn += Amount;
         }
 
         Result = TRUE;
@@ -2330,7 +2481,7 @@ Return Value:
     //  Do a quick test to see if we are wiping out the entire MCB.
 
 
-    if ((Vbn == 0) && (Mcb->PairCount > 0) && (SectorCount >= Mcb->Mapping[Mcb->PairCount-1].NextVbn)) {
+    if ((Vbn == 0) && (Mcb->PairCount > 0) && (SectorCount >= MappingPair(Mcb,Mcb->PairCount-1).NextVbn)) {
 
         Mcb->PairCount = 0;
 
@@ -2444,7 +2595,7 @@ Return Value:
                 //  Make this index a hole
 
 
-                (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
 
             } else if (((PreviousEndingLbn(Mcb,Index) != UNUSED_LBN) || (Index == 0)) &&
                        (NextStartingLbn(Mcb,Index) == UNUSED_LBN)) {
@@ -2480,7 +2631,7 @@ Return Value:
                 //  Mark current entry a hole
 
 
-                (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
 
 
                 //  Remove previous entry
@@ -2542,14 +2693,14 @@ Return Value:
                 //  Set the hole
 
 
-                (Mcb->Mapping)[Index].Lbn = (LBN)UNUSED_LBN;
-                (Mcb->Mapping)[Index].NextVbn = Vbn + SectorCount;
+                MappingPair(Mcb,Index).Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index).NextVbn = Vbn + SectorCount;
 
 
                 //  Set the new Lbn for the remaining run
 
 
-                (Mcb->Mapping)[Index+1].Lbn += SectorCount;
+                MappingPair(Mcb,Index+1).Lbn += SectorCount;
 
             } else {
 
@@ -2565,13 +2716,13 @@ Return Value:
                 //  Expand the preceding hole
 
 
-                (Mcb->Mapping)[Index-1].NextVbn += SectorCount;
+                MappingPair(Mcb,Index-1).NextVbn += SectorCount;
 
 
                 //  Set the new Lbn for the remaining run
 
 
-                (Mcb->Mapping)[Index].Lbn += SectorCount;
+                MappingPair(Mcb,Index).Lbn += SectorCount;
             }
 
 
@@ -2615,7 +2766,7 @@ Return Value:
                 //  Shrink back the size of the current index
 
 
-                (Mcb->Mapping)[Index].NextVbn -= AmountToRemove;
+                MappingPair(Mcb,Index).NextVbn -= AmountToRemove;
 
             } else if (NextStartingLbn(Mcb,Index) == UNUSED_LBN) {
 
@@ -2633,7 +2784,7 @@ Return Value:
                 //  Shrink back the size of the current index
 
 
-                (Mcb->Mapping)[Index].NextVbn -= AmountToRemove;
+                MappingPair(Mcb,Index).NextVbn -= AmountToRemove;
 
             } else {
 
@@ -2659,14 +2810,14 @@ Return Value:
                 //  Set the new hole
 
 
-                (Mcb->Mapping)[Index+1].Lbn = (LBN)UNUSED_LBN;
-                (Mcb->Mapping)[Index+1].NextVbn = (Mcb->Mapping)[Index].NextVbn;
+                MappingPair(Mcb,Index+1).Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index+1).NextVbn = MappingPair(Mcb,Index).NextVbn;
 
 
                 //  Shrink back the size of the current index
 
 
-                (Mcb->Mapping)[Index].NextVbn -= AmountToRemove;
+                MappingPair(Mcb,Index).NextVbn -= AmountToRemove;
             }
 
 
@@ -2709,21 +2860,21 @@ Return Value:
                 //  Set up the first remaining run
 
 
-                (Mcb->Mapping)[Index].Lbn = (Mcb->Mapping)[Index+2].Lbn;
-                (Mcb->Mapping)[Index].NextVbn = Vbn;
+                MappingPair(Mcb,Index).Lbn = MappingPair(Mcb,Index+2).Lbn;
+                MappingPair(Mcb,Index).NextVbn = Vbn;
 
 
                 //  Set up the hole
 
 
-                (Mcb->Mapping)[Index+1].Lbn = (LBN)UNUSED_LBN;
-                (Mcb->Mapping)[Index+1].NextVbn = Vbn + SectorCount;
+                MappingPair(Mcb,Index+1).Lbn = (LBN)UNUSED_LBN;
+                MappingPair(Mcb,Index+1).NextVbn = Vbn + SectorCount;
 
 
                 //  Set up the second remaining run
 
 
-                (Mcb->Mapping)[Index+2].Lbn += SectorsWithinRun(Mcb,Index) +
+                MappingPair(Mcb,Index+2).Lbn += SectorsWithinRun(Mcb,Index) +
                                                SectorsWithinRun(Mcb,Index+1);
             }
 
@@ -2787,6 +2938,53 @@ Return Value:
     MinIndex = 0;
     MaxIndex = Mcb->PairCount - 1;
 
+
+    //  If the Mcb is chunked then first find the chunk that holds the Vbn.
+    //  The Vbn is then in the first pair of the chunk whose NextVbn is
+    //  beyond it, so search for that directly within the chunk.
+
+
+    if (IsChunkedMcb( Mcb ) && (Mcb->PairCount != 0)) {
+
+        PMAPPING_CHUNK Chunk;
+        ULONG ChunkIndex;
+
+        if (!FsRtlFindVbnChunk( Mcb, Vbn, &ChunkIndex )) {
+
+            *Index = Mcb->PairCount;
+
+            return FALSE;
+        }
+
+        Chunk = &MappingDirectory( Mcb )->Chunks[ChunkIndex];
+
+        MinIndex = 0;
+        MaxIndex = Chunk->PairCount - 1;
+
+        if (Chunk->BaseIndex + Chunk->PairCount > Mcb->PairCount) {
+
+            MaxIndex = Mcb->PairCount - Chunk->BaseIndex - 1;
+        }
+
+        while (MinIndex < MaxIndex) {
+
+            MidIndex = ((MaxIndex + MinIndex) / 2);
+
+            if (Vbn < Chunk->Mapping[MidIndex].NextVbn) {
+
+                MaxIndex = MidIndex;
+
+            } else {
+
+                MinIndex = MidIndex + 1;
+            }
+        }
+
+        *Index = Chunk->BaseIndex + MinIndex;
+
+        return TRUE;
+    }
+
     while (MinIndex <= MaxIndex) {
 
 
@@ -2893,7 +3091,8 @@ Return Value:
     //  the additional entries
 
 
-    if (Mcb->PairCount + AmountToAdd > Mcb->MaximumPairCount) {
+    if (!IsChunkedMcb( Mcb ) &&
+        (Mcb->PairCount + AmountToAdd > Mcb->MaximumPairCount)) {
 
         ULONG NewMax;
         PMAPPING Mapping;
@@ -2902,56 +3101,140 @@ Return Value:
         //  We need to allocate a new mapping so compute a new maximum pair
         //  count.  We'll only be asked to grow by at most 2 at a time, so
         //  doubling will definitely make us large enough for the new amount.
-        //  But we won't double without bounds we'll stop doubling if the
-        //  pair count gets too high.
+        //  But we won't double without bounds, once the pair count gets too
+        //  high we move the pairs into chunks instead.
 
 
-        if (Mcb->MaximumPairCount < 2048) {
+        if (Mcb->MaximumPairCount >= MAXIMUM_FLAT_PAIR_COUNT) {
 
-            NewMax = Mcb->MaximumPairCount * 2;
+            FsRtlChunkLargeMcb( Mcb );
 
         } else {
 
-            NewMax = Mcb->MaximumPairCount + 2048;
+            NewMax = Mcb->MaximumPairCount * 2;
+
+            Mapping = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING) * NewMax );
+
+            //**** RtlZeroMemory( Mapping, sizeof(MAPPING) * NewMax );
+
+
+            //  Now copy over the old mapping to the new buffer
+
+
+            RtlCopyMemory( Mapping, Mcb->Mapping, sizeof(MAPPING) * Mcb->PairCount );
+
+
+            //  Deallocate the old buffer
+
+
+            if ((Mcb->PoolType == PagedPool) && (Mcb->MaximumPairCount == INITIAL_MAXIMUM_PAIR_COUNT)) {
+
+                FsRtlFreeFirstMapping( Mcb->Mapping );
+
+            } else {
+
+                ExFreePool( Mcb->Mapping );
+            }
+
+
+            //  And set up the new buffer in the Mcb
+
+
+            Mcb->Mapping = Mapping;
+            Mcb->MaximumPairCount = NewMax;
         }
+    }
 
-        Mapping = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING) * NewMax );
 
-        //**** RtlZeroMemory( Mapping, sizeof(MAPPING) * NewMax );
+    //  A chunked Mcb only has to make room in the chunk that will hold
+    //  the new entries
 
 
-        //  Now copy over the old mapping to the new buffer
+    if (IsChunkedMcb( Mcb )) {
 
+        PMAPPING_DIRECTORY Directory;
+        PMAPPING_CHUNK Chunk;
+        ULONG ChunkIndex;
+        ULONG Offset;
+        ULONG i;
 
-        RtlCopyMemory( Mapping, Mcb->Mapping, sizeof(MAPPING) * Mcb->PairCount );
+        FsRtlTrimChunks( Mcb );
 
+        Directory = MappingDirectory( Mcb );
 
-        //  Deallocate the old buffer
+        ChunkIndex = FsRtlFindChunk( Directory, WhereToAddIndex );
+        Chunk = &Directory->Chunks[ChunkIndex];
+        Offset = WhereToAddIndex - Chunk->BaseIndex;
 
 
-        if ((Mcb->PoolType == PagedPool) && (Mcb->MaximumPairCount == INITIAL_MAXIMUM_PAIR_COUNT)) {
+        //  If the chunk is full then give it a new neighbor.  When adding
+        //  to the end of the last chunk the neighbor starts out empty,
+        //  because files mostly grow at the end, otherwise the upper half
+        //  of the chunk is moved over to it.
 
-            FsRtlFreeFirstMapping( Mcb->Mapping );
 
-        } else {
+        if (Chunk->PairCount + AmountToAdd > MAPPING_CHUNK_PAIRS) {
+
+            PMAPPING_CHUNK NewChunk;
+            ULONG Split;
+
+            NewChunk = FsRtlInsertChunk( Mcb, ChunkIndex + 1 );
+            Chunk = NewChunk - 1;
+
+            if ((Offset == Chunk->PairCount) &&
+                (ChunkIndex + 2 == Directory->ChunkCount)) {
+
+                Split = Chunk->PairCount;
+
+            } else {
+
+                Split = Chunk->PairCount / 2;
+            }
+
+            RtlCopyMemory( NewChunk->Mapping,
+                           &Chunk->Mapping[Split],
+                           (Chunk->PairCount - Split) * sizeof(MAPPING) );
+
+            NewChunk->BaseIndex = Chunk->BaseIndex + Split;
+            NewChunk->PairCount = Chunk->PairCount - Split;
+            Chunk->PairCount = Split;
+
+            if (Offset >= Split) {
+
+                ChunkIndex += 1;
+                Chunk = NewChunk;
+                Offset -= Split;
+            }
+        }
+
+
+        //  Slide over the entries that follow within the chunk, and move up
+        //  the base index of every chunk after this one
 
-            ExFreePool( Mcb->Mapping );
+
+        if (Offset < Chunk->PairCount) {
+
+            RtlMoveMemory( &Chunk->Mapping[Offset + AmountToAdd],
+                           &Chunk->Mapping[Offset],
+                           (Chunk->PairCount - Offset) * sizeof(MAPPING) );
         }
 
+        Chunk->PairCount += AmountToAdd;
 
-        //  And set up the new buffer in the Mcb
+        for (i = ChunkIndex + 1; i < Directory->ChunkCount; i += 1) {
 
+            Directory->Chunks[i].BaseIndex += AmountToAdd;
+        }
 
-        Mcb->Mapping = Mapping;
-        Mcb->MaximumPairCount = NewMax;
-    }
+        Directory->PairCount += AmountToAdd;
+        Directory->CursorChunk = ChunkIndex;
 
 
     //  Now see if we need to shift some entries over according to the
     //  WhereToAddIndex value
 
 
-    if (WhereToAddIndex < Mcb->PairCount) {
+    } else if (WhereToAddIndex < Mcb->PairCount) {
 
         RtlMoveMemory( &((Mcb->Mapping)[WhereToAddIndex + AmountToAdd]),
                        &((Mcb->Mapping)[WhereToAddIndex]),
@@ -3013,6 +3296,78 @@ Return Value:
     PAGED_CODE();
 
 
+    //  A chunked Mcb removes the entries from the chunks that hold them,
+    //  which might be more than one.
+
+
+    if (IsChunkedMcb( Mcb )) {
+
+        PMAPPING_DIRECTORY Directory;
+        PMAPPING_CHUNK Chunk;
+        ULONG ChunkIndex;
+        ULONG Offset;
+        ULONG Amount;
+        ULONG i;
+
+        FsRtlTrimChunks( Mcb );
+
+        Directory = MappingDirectory( Mcb );
+
+        while (AmountToRemove > 0) {
+
+            ChunkIndex = FsRtlFindChunk( Directory, WhereToRemoveIndex );
+            Chunk = &Directory->Chunks[ChunkIndex];
+            Offset = WhereToRemoveIndex - Chunk->BaseIndex;
+
+            Amount = Chunk->PairCount - Offset;
+
+            if (Amount > AmountToRemove) {
+
+                Amount = AmountToRemove;
+            }
+
+            RtlMoveMemory( &Chunk->Mapping[Offset],
+                           &Chunk->Mapping[Offset + Amount],
+                           (Chunk->PairCount - (Offset + Amount)) * sizeof(MAPPING) );
+
+            Chunk->PairCount -= Amount;
+
+            for (i = ChunkIndex + 1; i < Directory->ChunkCount; i += 1) {
+
+                Directory->Chunks[i].BaseIndex -= Amount;
+            }
+
+            Directory->PairCount -= Amount;
+            Mcb->PairCount -= Amount;
+            AmountToRemove -= Amount;
+
+
+            //  Fold the chunk into the one before it if together they fit in
+            //  half a chunk, and otherwise free it if it is now empty.  The
+            //  only chunk left is kept even when empty.
+
+
+            if ((ChunkIndex > 0) &&
+                (Directory->Chunks[ChunkIndex - 1].PairCount + Chunk->PairCount <= MAPPING_CHUNK_PAIRS / 2)) {
+
+                RtlCopyMemory( &Directory->Chunks[ChunkIndex - 1].Mapping[Directory->Chunks[ChunkIndex - 1].PairCount],
+                               Chunk->Mapping,
+                               Chunk->PairCount * sizeof(MAPPING) );
+
+                Directory->Chunks[ChunkIndex - 1].PairCount += Chunk->PairCount;
+
+                FsRtlDeleteChunk( Directory, ChunkIndex );
+
+            } else if ((Chunk->PairCount == 0) && (Directory->ChunkCount > 1)) {
+
+                FsRtlDeleteChunk( Directory, ChunkIndex );
+            }
+        }
+
+        return;
+    }
+
+
     //  Check to see if we need to shift everything down because the
     //  entries to remove do not include the last entry in the mcb
 
@@ -3044,3 +3399,635 @@ Return Value:
     return;
 }
 
+
+
+//  Private Routine
+
+
+VOID
+FsRtlChunkLargeMcb (
+    IN PNONOPAQUE_MCB Mcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves the mapping pairs of an Mcb out of its single
+    mapping buffer and into a directory of full chunks, and frees the
+    buffer.  If pool is not available this routine raises and the Mcb
+    is left as it was.
+
+Arguments:
+
+    Mcb - Supplies the mcb being changed
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PMAPPING_DIRECTORY Directory;
+    ULONG ChunkCount;
+    ULONG Amount;
+
+    PAGED_CODE();
+
+    ChunkCount = (Mcb->PairCount + MAPPING_CHUNK_PAIRS - 1) / MAPPING_CHUNK_PAIRS;
+
+    if (ChunkCount == 0) {
+
+        ChunkCount = 1;
+    }
+
+    Directory = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING_DIRECTORY) );
+
+    RtlZeroMemory( Directory, sizeof(MAPPING_DIRECTORY) );
+
+    try {
+
+
+        //  Leave the directory room to double before it has to grow
+
+
+        Directory->MaximumChunkCount = ChunkCount * 2;
+        Directory->Chunks = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING_CHUNK) * Directory->MaximumChunkCount );
+
+        while (Directory->ChunkCount < ChunkCount) {
+
+            PMAPPING_CHUNK Chunk = &Directory->Chunks[Directory->ChunkCount];
+
+            Amount = Mcb->PairCount - Directory->PairCount;
+
+            if (Amount > MAPPING_CHUNK_PAIRS) {
+
+                Amount = MAPPING_CHUNK_PAIRS;
+            }
+
+            Chunk->Mapping = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING) * MAPPING_CHUNK_PAIRS );
+            Chunk->BaseIndex = Directory->PairCount;
+            Chunk->PairCount = Amount;
+
+            Directory->ChunkCount += 1;
+
+            RtlCopyMemory( Chunk->Mapping,
+                           &((Mcb->Mapping)[Directory->PairCount]),
+                           Amount * sizeof(MAPPING) );
+
+            Directory->PairCount += Amount;
+        }
+
+    } finally {
+
+        if (AbnormalTermination()) {
+
+            FsRtlFreeChunks( Directory );
+        }
+    }
+
+
+    //  The buffer being replaced has always outgrown the initial mapping
+
+
+    ExFreePool( Mcb->Mapping );
+
+    Mcb->Mapping = (PMAPPING)Directory;
+    Mcb->MaximumPairCount = CHUNKED_PAIR_COUNT;
+
+    return;
+}
+
+
+
+//  Private Routine
+
+
+VOID
+FsRtlUnchunkLargeMcb (
+    IN PNONOPAQUE_MCB Mcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves the mapping pairs of a chunked Mcb back into a
+    single mapping buffer, sized at twice the pair count, and frees the
+    chunks.  If pool is not available this routine raises and the Mcb
+    is left as it was.
+
+Arguments:
+
+    Mcb - Supplies the mcb being changed
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PMAPPING_DIRECTORY Directory;
+    PMAPPING Mapping;
+    ULONG NewMax;
+    ULONG i;
+
+    PAGED_CODE();
+
+    FsRtlTrimChunks( Mcb );
+
+    Directory = MappingDirectory( Mcb );
+
+    NewMax = Mcb->PairCount * 2;
+
+    if (NewMax < INITIAL_MAXIMUM_PAIR_COUNT) {
+        NewMax = INITIAL_MAXIMUM_PAIR_COUNT;
+    }
+
+    if (NewMax == INITIAL_MAXIMUM_PAIR_COUNT && Mcb->PoolType == PagedPool) {
+
+        Mapping = FsRtlAllocateFirstMapping();
+
+    } else {
+
+        Mapping = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING) * NewMax );
+    }
+
+    for (i = 0; i < Directory->ChunkCount; i += 1) {
+
+        RtlCopyMemory( &Mapping[Directory->Chunks[i].BaseIndex],
+                       Directory->Chunks[i].Mapping,
+                       Directory->Chunks[i].PairCount * sizeof(MAPPING) );
+    }
+
+    FsRtlFreeChunks( Directory );
+
+    Mcb->Mapping = Mapping;
+    Mcb->MaximumPairCount = NewMax;
+
+    return;
+}
+
+
+
+//  Private Routine
+
+
+VOID
+FsRtlFreeChunks (
+    IN PMAPPING_DIRECTORY Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a chunk directory along with all of its chunks.
+
+Arguments:
+
+    Directory - Supplies the directory to free
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG i;
+
+    if (Directory->Chunks != NULL) {
+
+        for (i = 0; i < Directory->ChunkCount; i += 1) {
+
+            ExFreePool( Directory->Chunks[i].Mapping );
+        }
+
+        ExFreePool( Directory->Chunks );
+    }
+
+    ExFreePool( Directory );
+
+    return;
+}
+
+
+
+//  Private Routine
+
+
+VOID
+FsRtlTrimChunks (
+    IN PNONOPAQUE_MCB Mcb
+    )
+
+/*++
+
+Routine Description:
+
+    This routine brings the chunks of an Mcb in line with its pair count
+    after the Mcb has been truncated, by shortening the chunk holding the
+    new last pair and freeing the chunks beyond it.  The first chunk is
+    always kept.
+
+Arguments:
+
+    Mcb - Supplies the mcb being trimmed
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PMAPPING_DIRECTORY Directory = MappingDirectory( Mcb );
+    PMAPPING_CHUNK Chunk;
+
+    if (Directory->PairCount == Mcb->PairCount) {
+
+        return;
+    }
+
+    ASSERT( Mcb->PairCount < Directory->PairCount );
+
+    while ((Directory->ChunkCount > 1) &&
+           (Directory->Chunks[Directory->ChunkCount - 1].BaseIndex >= Mcb->PairCount)) {
+
+        Directory->ChunkCount -= 1;
+
+        ExFreePool( Directory->Chunks[Directory->ChunkCount].Mapping );
+    }
+
+    Chunk = &Directory->Chunks[Directory->ChunkCount - 1];
+    Chunk->PairCount = Mcb->PairCount - Chunk->BaseIndex;
+
+    Directory->PairCount = Mcb->PairCount;
+
+    if (Directory->CursorChunk >= Directory->ChunkCount) {
+
+        Directory->CursorChunk = Directory->ChunkCount - 1;
+    }
+
+    return;
+}
+
+
+
+//  Private Routine
+
+
+ULONG
+FsRtlFindChunk (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locates the chunk holding the mapping pair at a given
+    index.  An index one past the last pair gives the last chunk.  The
+    chunk last used and the one after it are tried before searching the
+    directory, and the chunk found becomes the one last used.
+
+Arguments:
+
+    Directory - Supplies the chunk directory to search
+
+    Index - Supplies the index of the mapping pair
+
+Return Value:
+
+    ULONG - The index of the chunk within the directory
+
+--*/
+
+{
+    PMAPPING_CHUNK Chunks = Directory->Chunks;
+    ULONG Cursor = Directory->CursorChunk;
+    LONG MinChunk;
+    LONG MaxChunk;
+    LONG MidChunk;
+
+
+    //  Check the chunk we used last, and then the next one for callers
+    //  walking forward through the pairs
+
+
+    if (Index - Chunks[Cursor].BaseIndex < Chunks[Cursor].PairCount) {
+
+        return Cursor;
+    }
+
+    if ((Cursor + 1 < Directory->ChunkCount) &&
+        (Index - Chunks[Cursor + 1].BaseIndex < Chunks[Cursor + 1].PairCount)) {
+
+        Directory->CursorChunk = Cursor + 1;
+
+        return Cursor + 1;
+    }
+
+
+    //  Otherwise do a binary search for the last chunk that starts at or
+    //  before the index
+
+
+    MinChunk = 0;
+    MaxChunk = Directory->ChunkCount - 1;
+
+    while (MinChunk < MaxChunk) {
+
+        MidChunk = (MinChunk + MaxChunk + 1) / 2;
+
+        if (Chunks[MidChunk].BaseIndex <= Index) {
+
+            MinChunk = MidChunk;
+
+        } else {
+
+            MaxChunk = MidChunk - 1;
+        }
+    }
+
+    Directory->CursorChunk = MinChunk;
+
+    return MinChunk;
+}
+
+
+
+//  Private Routine
+
+
+PMAPPING
+FsRtlFindChunkPair (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG Index
+    )
+
+/*++
+
+Routine Description:
+
+    This routine returns the mapping pair at a given index of a chunked
+    Mcb.  It is what the MappingPair macro calls for chunked Mcbs.
+
+Arguments:
+
+    Directory - Supplies the chunk directory of the Mcb
+
+    Index - Supplies the index of the mapping pair
+
+Return Value:
+
+    PMAPPING - The mapping pair
+
+--*/
+
+{
+    PMAPPING_CHUNK Chunk;
+
+    Chunk = &Directory->Chunks[FsRtlFindChunk( Directory, Index )];
+
+    return &Chunk->Mapping[Index - Chunk->BaseIndex];
+}
+
+
+
+//  Private Routine
+
+
+BOOLEAN
+FsRtlFindVbnChunk (
+    IN PNONOPAQUE_MCB Mcb,
+    IN VBN Vbn,
+    OUT PULONG Chunk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine locates the chunk of a chunked Mcb that must hold the
+    mapping for a Vbn, if any does.  Only pairs below the pair count of
+    the Mcb are considered.  The chunk last used is tried before
+    searching the directory.
+
+Arguments:
+
+    Mcb - Supplies the mcb to search, which must not be empty
+
+    Vbn - Supplies the Vbn to look up
+
+    Chunk - Receives the index of the chunk within the directory
+
+Return Value:
+
+    BOOLEAN - TRUE if a chunk covers the Vbn and FALSE if the Vbn is
+        beyond the last mapping
+
+--*/
+
+{
+    PMAPPING_DIRECTORY Directory = MappingDirectory( Mcb );
+    ULONG ChunkCount;
+    ULONG Cursor;
+    LONG MinChunk;
+    LONG MaxChunk;
+    LONG MidChunk;
+
+    Cursor = Directory->CursorChunk;
+
+
+    //  Only search the chunks holding pairs below the pair count, which
+    //  is all of them unless the Mcb has been truncated since it was last
+    //  changed
+
+
+    ChunkCount = Directory->ChunkCount;
+
+    if (Directory->PairCount != Mcb->PairCount) {
+
+        ChunkCount = FsRtlFindChunk( Directory, Mcb->PairCount - 1 ) + 1;
+    }
+
+
+    //  Check the chunk we used last
+
+
+    if ((Cursor < ChunkCount) &&
+        (Vbn < ChunkNextVbn( Mcb, Directory, Cursor )) &&
+        ((Cursor == 0) || (Vbn >= ChunkNextVbn( Mcb, Directory, Cursor - 1 )))) {
+
+        Directory->CursorChunk = Cursor;
+        *Chunk = Cursor;
+
+        return TRUE;
+    }
+
+
+    //  Otherwise do a binary search for the first chunk that ends after
+    //  the Vbn
+
+
+    MinChunk = 0;
+    MaxChunk = ChunkCount - 1;
+
+    while (MinChunk < MaxChunk) {
+
+        MidChunk = (MinChunk + MaxChunk) / 2;
+
+        if (Vbn < ChunkNextVbn( Mcb, Directory, MidChunk )) {
+
+            MaxChunk = MidChunk;
+
+        } else {
+
+            MinChunk = MidChunk + 1;
+        }
+    }
+
+    if (Vbn >= ChunkNextVbn( Mcb, Directory, MinChunk )) {
+
+        return FALSE;
+    }
+
+    Directory->CursorChunk = MinChunk;
+    *Chunk = MinChunk;
+
+    return TRUE;
+}
+
+
+
+//  Private Routine
+
+
+PMAPPING_CHUNK
+FsRtlInsertChunk (
+    IN PNONOPAQUE_MCB Mcb,
+    IN ULONG WhereToInsertChunk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates a new empty chunk and puts it into the chunk
+    directory of an Mcb at the specified position, growing the directory
+    if it is full.  If pool is not available this routine raises and the
+    Mcb is left as it was.
+
+Arguments:
+
+    Mcb - Supplies the mcb being modified
+
+    WhereToInsertChunk - Supplies the index within the directory for the
+        new chunk
+
+Return Value:
+
+    PMAPPING_CHUNK - The new chunk.  Its base index is left for the
+        caller to fill in.
+
+--*/
+
+{
+    PMAPPING_DIRECTORY Directory = MappingDirectory( Mcb );
+    PMAPPING_CHUNK Chunks;
+    PMAPPING Mapping;
+
+    PAGED_CODE();
+
+    Mapping = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING) * MAPPING_CHUNK_PAIRS );
+
+
+    //  Double the directory if there is no room in it
+
+
+    if (Directory->ChunkCount == Directory->MaximumChunkCount) {
+
+        try {
+
+            Chunks = FsRtlpAllocatePool( Mcb->PoolType, sizeof(MAPPING_CHUNK) * Directory->MaximumChunkCount * 2 );
+
+        } finally {
+
+            if (AbnormalTermination()) {
+
+                ExFreePool( Mapping );
+            }
+        }
+
+        RtlCopyMemory( Chunks, Directory->Chunks, sizeof(MAPPING_CHUNK) * Directory->ChunkCount );
+
+        ExFreePool( Directory->Chunks );
+
+        Directory->Chunks = Chunks;
+        Directory->MaximumChunkCount *= 2;
+    }
+
+    RtlMoveMemory( &Directory->Chunks[WhereToInsertChunk + 1],
+                   &Directory->Chunks[WhereToInsertChunk],
+                   (Directory->ChunkCount - WhereToInsertChunk) * sizeof(MAPPING_CHUNK) );
+
+    Directory->ChunkCount += 1;
+
+    Directory->Chunks[WhereToInsertChunk].Mapping = Mapping;
+    Directory->Chunks[WhereToInsertChunk].PairCount = 0;
+
+    return &Directory->Chunks[WhereToInsertChunk];
+}
+
+
+
+//  Private Routine
+
+
+VOID
+FsRtlDeleteChunk (
+    IN PMAPPING_DIRECTORY Directory,
+    IN ULONG WhereToDeleteChunk
+    )
+
+/*++
+
+Routine Description:
+
+    This routine frees a chunk and removes it from the chunk directory.
+    The caller must already have moved any pairs still in the chunk.
+
+Arguments:
+
+    Directory - Supplies the chunk directory being modified
+
+    WhereToDeleteChunk - Supplies the index within the directory of the
+        chunk to free
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ExFreePool( Directory->Chunks[WhereToDeleteChunk].Mapping );
+
+    Directory->ChunkCount -= 1;
+
+    RtlMoveMemory( &Directory->Chunks[WhereToDeleteChunk],
+                   &Directory->Chunks[WhereToDeleteChunk + 1],
+                   (Directory->ChunkCount - WhereToDeleteChunk) * sizeof(MAPPING_CHUNK) );
+
+    if (Directory->CursorChunk >= Directory->ChunkCount) {
+
+        Directory->CursorChunk = Directory->ChunkCount - 1;
+    }
+
+    return;
+}
@@ -30,6 +30,11 @@ Abstract:
          against a template (possibly containing wildcards) to sees if the
          string is in the language denoted by the template.
 
+      o  FsRtlCompileNameExpression and FsRtlIsNameInCompiledExpression -
+         These routines do the same as FsRtlIsNameInExpression for callers
+         which match many names against one template, by examining the
+         template only once.
+
 Author:
 
     Gary Kimura     [GaryKi]    5-Feb-1990
@@ -80,12 +85,33 @@ FsRtlIsNameInExpressionPrivate (
     IN PWCH UpcaseTable
     );
 
+BOOLEAN
+FsRtlpAreCharactersEqual (
+    IN PWCH Expression,
+    IN PWCH Name,
+    IN ULONG Length,
+    IN BOOLEAN IgnoreCase,
+    IN PWCH UpcaseTable
+    );
+
+
+//  The forms of a compiled expression
+
+
+#define FSRTL_EXPRESSION_MATCH_ALL       (0)
+#define FSRTL_EXPRESSION_LITERAL         (1)
+#define FSRTL_EXPRESSION_SINGLE_STAR     (2)
+#define FSRTL_EXPRESSION_GENERAL         (3)
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FsRtlAreNamesEqual)
 #pragma alloc_text(PAGE, FsRtlDissectName)
 #pragma alloc_text(PAGE, FsRtlDoesNameContainWildCards)
 #pragma alloc_text(PAGE, FsRtlIsNameInExpression)
 #pragma alloc_text(PAGE, FsRtlIsNameInExpressionPrivate)
+#pragma alloc_text(PAGE, FsRtlCompileNameExpression)
+#pragma alloc_text(PAGE, FsRtlIsNameInCompiledExpression)
+#pragma alloc_text(PAGE, FsRtlpAreCharactersEqual)
 #endif
 
 
@@ -1076,3 +1102,307 @@ Return Value:
     return (BOOLEAN)(CurrentState == MaxState);
 }
 
+
+
+VOID
+FsRtlCompileNameExpression (
+    IN PUNICODE_STRING Expression,
+    IN BOOLEAN IgnoreCase,
+    IN PWCH UpcaseTable OPTIONAL,
+    OUT PFSRTL_NAME_EXPRESSION CompiledExpression
+    )
+
+/*++
+
+Routine Description:
+
+    This routine examines an expression once so that many names can then be
+    matched against it with FsRtlIsNameInCompiledExpression, which gives the
+    same answers as FsRtlIsNameInExpression.
+
+    The literal characters in front of the first wild card and after the last
+    one must match the start and end of any name in the language of the
+    expression, and every literal character and ? consumes exactly one name
+    character, so these give a quick test that rejects most names.  If the
+    only wild card is a single *, the test decides the match by itself.  Only
+    names which pass it and are matched against a more complicated expression
+    are given to the full matcher.
+
+Arguments:
+
+    Expression - Supplies the expression to compile.  The buffer is referred
+        to by the compiled expression and must outlive it.  (Caller must
+        already upcase if passing IgnoreCase TRUE.)
+
+    IgnoreCase - TRUE if names should be upcased before comparing.
+
+    UpcaseTable - Optionally supplies the upcase table to use.
+
+    CompiledExpression - Receives the compiled expression.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Index;
+    ULONG Count;
+    ULONG FirstWild;
+    ULONG LastWild;
+    ULONG Stars = 0;
+    ULONG Minimum = 0;
+    WCHAR ExprChar;
+
+    PAGED_CODE();
+
+    CompiledExpression->Expression = *Expression;
+    CompiledExpression->IgnoreCase = IgnoreCase;
+    CompiledExpression->UpcaseTable = UpcaseTable;
+
+    Count = Expression->Length / sizeof(WCHAR);
+    FirstWild = LastWild = Count;
+
+
+    //  Find the wild cards, and count the characters which consume exactly
+    //  one name character.
+
+
+    for (Index = 0; Index < Count; Index += 1) {
+
+        ExprChar = Expression->Buffer[Index];
+
+        ASSERT( !IgnoreCase || !((ExprChar >= L'a') && (ExprChar <= L'z')) );
+
+        if (FsRtlIsUnicodeCharacterWild( ExprChar )) {
+
+            if (FirstWild == Count) {
+
+                FirstWild = Index;
+            }
+
+            LastWild = Index;
+
+            if (ExprChar == L'*') {
+
+                Stars += 1;
+                continue;
+            }
+
+            if (ExprChar != L'?') {
+
+                continue;
+            }
+        }
+
+        Minimum += 1;
+    }
+
+    if (FirstWild == Count) {
+
+        CompiledExpression->Form = FSRTL_EXPRESSION_LITERAL;
+        CompiledExpression->PrefixLength = Expression->Length;
+        CompiledExpression->SuffixLength = 0;
+
+    } else {
+
+        CompiledExpression->PrefixLength = (USHORT)(FirstWild * sizeof(WCHAR));
+        CompiledExpression->SuffixLength = (USHORT)((Count - LastWild - 1) * sizeof(WCHAR));
+
+
+        //  An expression of nothing but *s matches everything.  One with a
+        //  single * and otherwise literal characters is settled by the
+        //  prefix and suffix.  Anything else needs the full matcher.
+
+
+        if (Stars == Count) {
+
+            CompiledExpression->Form = FSRTL_EXPRESSION_MATCH_ALL;
+
+        } else if (Stars == 1 && FirstWild == LastWild) {
+
+            CompiledExpression->Form = FSRTL_EXPRESSION_SINGLE_STAR;
+
+        } else {
+
+            CompiledExpression->Form = FSRTL_EXPRESSION_GENERAL;
+        }
+    }
+
+    CompiledExpression->MinimumLength = (USHORT)(Minimum * sizeof(WCHAR));
+}
+
+
+BOOLEAN
+FsRtlIsNameInCompiledExpression (
+    IN PFSRTL_NAME_EXPRESSION CompiledExpression,
+    IN PUNICODE_STRING Name
+    )
+
+/*++
+
+Routine Description:
+
+    This routine tells the caller if a name is in the language defined by an
+    expression compiled by FsRtlCompileNameExpression.
+
+Arguments:
+
+    CompiledExpression - Supplies the compiled expression.
+
+    Name - Supplies the input name to check for.
+
+Return Value:
+
+    BOOLEAN - TRUE if Name is an element in the set of strings denoted
+        by the expression and FALSE otherwise.
+
+--*/
+
+{
+    PUNICODE_STRING Expression = &CompiledExpression->Expression;
+    BOOLEAN IgnoreCase = CompiledExpression->IgnoreCase;
+    PWCH UpcaseTable = CompiledExpression->UpcaseTable;
+    USHORT SuffixLength = CompiledExpression->SuffixLength;
+
+    PAGED_CODE();
+
+
+    //  If one string is empty return FALSE.  If both are empty return TRUE.
+
+
+    if ( (Name->Length == 0) || (Expression->Length == 0) ) {
+
+        return (BOOLEAN)(!(Name->Length + Expression->Length));
+    }
+
+    if (CompiledExpression->Form == FSRTL_EXPRESSION_MATCH_ALL) {
+
+        return TRUE;
+    }
+
+
+    //  A literal expression must match the whole name.
+
+
+    if (CompiledExpression->Form == FSRTL_EXPRESSION_LITERAL) {
+
+        return (BOOLEAN)((Name->Length == Expression->Length) &&
+                         FsRtlpAreCharactersEqual( Expression->Buffer,
+                                                   Name->Buffer,
+                                                   Expression->Length,
+                                                   IgnoreCase,
+                                                   UpcaseTable ));
+    }
+
+
+    //  Otherwise the name must be long enough, and begin and end with the
+    //  literal characters around the wild cards.
+
+
+    if ((Name->Length < CompiledExpression->MinimumLength) ||
+
+        !FsRtlpAreCharactersEqual( Expression->Buffer,
+                                   Name->Buffer,
+                                   CompiledExpression->PrefixLength,
+                                   IgnoreCase,
+                                   UpcaseTable ) ||
+
+        !FsRtlpAreCharactersEqual( (PWCH)((PUCHAR)Expression->Buffer + Expression->Length - SuffixLength),
+                                   (PWCH)((PUCHAR)Name->Buffer + Name->Length - SuffixLength),
+                                   SuffixLength,
+                                   IgnoreCase,
+                                   UpcaseTable )) {
+
+        return FALSE;
+    }
+
+    if (CompiledExpression->Form == FSRTL_EXPRESSION_SINGLE_STAR) {
+
+        return TRUE;
+    }
+
+
+    //  Run the full matcher, which needs an upcased name if we weren't given
+    //  an upcase table.
+
+
+    if (IgnoreCase && !ARGUMENT_PRESENT( UpcaseTable )) {
+
+        return FsRtlIsNameInExpression( Expression, Name, TRUE, NULL );
+    }
+
+    return FsRtlIsNameInExpressionPrivate( Expression, Name, IgnoreCase, UpcaseTable );
+}
+
+
+BOOLEAN
+FsRtlpAreCharactersEqual (
+    IN PWCH Expression,
+    IN PWCH Name,
+    IN ULONG Length,
+    IN BOOLEAN IgnoreCase,
+    IN PWCH UpcaseTable
+    )
+
+/*++
+
+Routine Description:
+
+    This routine compares a run of literal expression characters with name
+    characters.  The run is first compared a word at a time, and only from
+    the first difference on, if the comparison ignores case, one character
+    at a time through the upcase table.
+
+Arguments:
+
+    Expression - Supplies the expression characters, upcased if IgnoreCase.
+
+    Name - Supplies the name characters.
+
+    Length - Supplies the length of both runs in bytes.
+
+    IgnoreCase - TRUE if the name characters should be upcased.
+
+    UpcaseTable - Optionally supplies the upcase table to use.
+
+Return Value:
+
+    BOOLEAN - TRUE if the runs are equal.
+
+--*/
+
+{
+    ULONG Index;
+    WCHAR NameChar;
+
+    PAGED_CODE();
+
+    Index = (ULONG)RtlCompareMemory( Expression, Name, Length );
+
+    if (Index == Length) {
+
+        return TRUE;
+    }
+
+    if (!IgnoreCase) {
+
+        return FALSE;
+    }
+
+    for (Index /= sizeof(WCHAR); Index < Length / sizeof(WCHAR); Index += 1) {
+
+        NameChar = Name[Index];
+
+        NameChar = ARGUMENT_PRESENT( UpcaseTable ) ? UpcaseTable[NameChar] :
+                                                     RtlUpcaseUnicodeChar( NameChar );
+
+        if (NameChar != Expression[Index]) {
+
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
@@ -32,6 +32,9 @@ Abstract:
         o  FsRtlNotifyCleanup - This routine is called to remove any
            references to a particular FsContext structure from the notify
            queue.  If the matching FsContext structure is found in the queue, then all associated Irps are completed.
+        o  FsRtlNotifyQueryStatistics - This routine returns the counts of
+           changes reported, coalesced and dropped for one directory watcher
+           or for all the watchers sharing a synchronization object.
 
 Author:
     Brian Andrew    [BrianAn]   9-19-1991
@@ -54,6 +57,24 @@ typedef struct _REAL_NOTIFY_SYNC {
     FAST_MUTEX FastMutex;
     ERESOURCE_THREAD OwningThread;
     ULONG OwnerCount;
+
+
+    //  The number of directory watchers on the lists using this object whose
+    //  completion filter includes each filter bit.  A change whose filter
+    //  match has no watchers can be dismissed without walking the lists.
+    //  Watchers are not indexed by the name of the directory they watch,
+    //  since that name belongs to the file system, which rewrites it in
+    //  place when the directory or one of its ancestors is renamed.
+
+
+    ULONG FilterCounts[32];
+
+
+    //  Totals of the statistics of all the directory watchers.
+
+
+    FSRTL_NOTIFY_STATISTICS Statistics;
+
 } REAL_NOTIFY_SYNC, *PREAL_NOTIFY_SYNC;
 
 
@@ -186,6 +207,12 @@ typedef struct _NOTIFY_CHANGE {
 
     PEPROCESS OwningProcess;
 
+
+    //  Counts of the changes reported to this watcher.
+
+
+    FSRTL_NOTIFY_STATISTICS Statistics;
+
 } NOTIFY_CHANGE, *PNOTIFY_CHANGE;
 
 #define NOTIFY_WATCH_TREE               (0x0001)
@@ -328,6 +355,25 @@ FsRtlCheckNotifyForDelete(
     IN PVOID FsContext
 );
 
+VOID
+FsRtlNotifyChargeWatcher(
+    IN PREAL_NOTIFY_SYNC NotifySync,
+    IN PNOTIFY_CHANGE Notify,
+    IN BOOLEAN Add
+);
+
+BOOLEAN
+FsRtlNotifyIsFilterWatched(
+    IN PREAL_NOTIFY_SYNC NotifySync,
+    IN ULONG FilterMatch
+);
+
+BOOLEAN
+FsRtlNotifyIsRepeatedEntry(
+    IN PNOTIFY_CHANGE Notify,
+    IN ULONG PreviousEntry
+);
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, FsRtlNotifyInitializeSync)
 #pragma alloc_text(PAGE, FsRtlNotifyUninitializeSync)
@@ -340,6 +386,10 @@ FsRtlCheckNotifyForDelete(
 #pragma alloc_text(PAGE, FsRtlNotifyReportChange)
 #pragma alloc_text(PAGE, FsRtlNotifyUpdateBuffer)
 #pragma alloc_text(PAGE, FsRtlCheckNotifyForDelete)
+#pragma alloc_text(PAGE, FsRtlNotifyQueryStatistics)
+#pragma alloc_text(PAGE, FsRtlNotifyChargeWatcher)
+#pragma alloc_text(PAGE, FsRtlNotifyIsFilterWatched)
+#pragma alloc_text(PAGE, FsRtlNotifyIsRepeatedEntry)
 #endif
 
 
@@ -391,6 +441,9 @@ Return Value:
     RealSync->OwningThread = (ERESOURCE_THREAD)0;
     RealSync->OwnerCount = 0;
 
+    RtlZeroMemory(RealSync->FilterCounts, sizeof(RealSync->FilterCounts));
+    RtlZeroMemory(&RealSync->Statistics, sizeof(FSRTL_NOTIFY_STATISTICS));
+
     *NotifySync = (PNOTIFY_SYNC)RealSync;
 
     DebugTrace(-1, Dbg, "FsRtlNotifyInitializeSync:  Exit\n", 0);
@@ -741,6 +794,8 @@ Return Value:
             Notify->OwningProcess = THREAD_TO_PROCESS(NotifyIrp->Tail.Overlay.Thread);
             InsertTailList(NotifyList, &Notify->NotifyList);
 
+            FsRtlNotifyChargeWatcher((PREAL_NOTIFY_SYNC)NotifySync, Notify, TRUE);
+
             Notify->ReferenceCount = 1;
 
 
@@ -1037,8 +1092,11 @@ Return Value:
     ULONG SizeOfEntry;
     ULONG CurrentOffset;
     ULONG NextEntryOffset;
+    ULONG PreviousEntry;
     ULONG ExceptionCode;
 
+    PREAL_NOTIFY_SYNC RealSync = (PREAL_NOTIFY_SYNC)NotifySync;
+
     PAGED_CODE();
 
     DebugTrace(+1, Dbg, "FsRtlNotifyFullReportChange:  Entered\n", 0);
@@ -1053,6 +1111,20 @@ Return Value:
         return;
     }
 
+
+    //  If no directory watcher is interested in this kind of change then there
+    //  is no need to walk the list.  This is checked without the mutex; a watcher
+    //  being added at the same moment could equally have missed the change had
+    //  it been reported a little earlier.
+
+
+    if ((FullTargetName != NULL) &&
+        !FsRtlNotifyIsFilterWatched(RealSync, FilterMatch)) {
+
+        DebugTrace(-1, Dbg, "FsRtlNotifyFullReportChange:  Exit\n", 0);
+        return;
+    }
+
     ParentName.Buffer = NULL;
     TargetName.Buffer = NULL;
 
@@ -1246,6 +1318,25 @@ Return Value:
             }
 
 
+            //  Count the change against the watcher.
+
+
+            Notify->Statistics.EventsReported += 1;
+            RealSync->Statistics.EventsReported += 1;
+
+
+            //  If the watcher wants the details but its buffer has already
+            //  overflowed then the details of this change are lost.
+
+
+            if (FlagOn(Notify->Flags, NOTIFY_IMMEDIATE_NOTIFY)
+                && Notify->BufferLength != 0) {
+
+                Notify->Statistics.EventsDropped += 1;
+                RealSync->Statistics.EventsDropped += 1;
+            }
+
+
             //  If this entry is going into a buffer then check that
             //  it will fit.
 
@@ -1590,6 +1681,7 @@ Return Value:
 
 
                 NextEntryOffset = (ULONG)LongAlign(Notify->DataLength);
+                PreviousEntry = Notify->LastEntry;
 
                 if (SizeOfEntry <= AllocationLength
                     && (NextEntryOffset + SizeOfEntry) <= AllocationLength) {
@@ -1715,10 +1807,29 @@ Return Value:
                                                     SizeOfEntry)) {
 
 
-                            //  Update the buffer data length.
+                            //  If this just repeats the last modification in the
+                            //  buffer then fold it into that entry.  Otherwise update
+                            //  the buffer data length.
+
+
+                            if (Action == FILE_ACTION_MODIFIED &&
+                                Notify->DataLength != 0 &&
+                                FsRtlNotifyIsRepeatedEntry(Notify, PreviousEntry)) {
 
+                                Notify->LastEntry = PreviousEntry;
 
-                            Notify->DataLength = NextEntryOffset + SizeOfEntry;
+                                Add2Ptr(Notify->Buffer,
+                                        PreviousEntry,
+                                        PFILE_NOTIFY_INFORMATION)->NextEntryOffset = 0;
+
+                                Notify->Statistics.EventsCoalesced += 1;
+                                RealSync->Statistics.EventsCoalesced += 1;
+
+                            }
+                            else {
+
+                                Notify->DataLength = NextEntryOffset + SizeOfEntry;
+                            }
 
 
                             //  We couldn't copy the data into the buffer.  Just
@@ -1739,6 +1850,19 @@ Return Value:
                 }
 
 
+                //  The watcher has lost the details of this change, and from now
+                //  on will only be told that something changed.
+
+
+                if (FlagOn(Notify->Flags, NOTIFY_IMMEDIATE_NOTIFY)) {
+
+                    Notify->Statistics.Overflows += 1;
+                    Notify->Statistics.EventsDropped += 1;
+                    RealSync->Statistics.Overflows += 1;
+                    RealSync->Statistics.EventsDropped += 1;
+                }
+
+
                 //  If we have a buffer but can't use it then clear all of the
                 //  buffer related fields.  Also deallocate any buffer allocated
                 //  by us.
@@ -1877,6 +2001,8 @@ Return Value:
 
             RemoveEntryList(&Notify->NotifyList);
 
+            FsRtlNotifyChargeWatcher((PREAL_NOTIFY_SYNC)NotifySync, Notify, FALSE);
+
             InterlockedDecrement(&Notify->ReferenceCount);
 
             if (Notify->ReferenceCount == 0) {
@@ -1918,6 +2044,82 @@ Return Value:
 
 
 
+BOOLEAN
+FsRtlNotifyQueryStatistics(
+    IN PNOTIFY_SYNC NotifySync,
+    IN PLIST_ENTRY NotifyList,
+    IN PVOID FsContext OPTIONAL,
+    OUT PFSRTL_NOTIFY_STATISTICS Statistics
+)
+
+/*++
+
+Routine Description:
+
+    This routine returns the counts of the changes reported to a directory
+    watcher, and of those which were folded into an earlier entry of its
+    buffer or lost when its buffer overflowed.  If no FsContext is given
+    the totals for all the watchers using this synchronization object are
+    returned instead, along with the number of watchers.
+
+Arguments:
+
+    NotifySync  -  This is the controlling fast mutex for this notify list.
+
+    NotifyList  -  This is the start of the notify list to search.
+
+    FsContext  -  This is the value assigned by the file system to identify
+                  the notify structure of interest.
+
+    Statistics  -  Receives the counts.
+
+Return Value:
+
+    BOOLEAN - TRUE if the counts were returned, FALSE if there is no notify
+              structure for FsContext on the list.
+
+--*/
+
+{
+    PREAL_NOTIFY_SYNC RealSync = (PREAL_NOTIFY_SYNC)NotifySync;
+    PNOTIFY_CHANGE Notify;
+    BOOLEAN Found = TRUE;
+
+    PAGED_CODE();
+
+    DebugTrace(+1, Dbg, "FsRtlNotifyQueryStatistics:  Entered\n", 0);
+
+    AcquireNotifySync(NotifySync);
+
+    if (ARGUMENT_PRESENT(FsContext)) {
+
+        Notify = FsRtlIsNotifyOnList(NotifyList, FsContext);
+
+        if (Notify != NULL) {
+
+            *Statistics = Notify->Statistics;
+
+        }
+        else {
+
+            Found = FALSE;
+        }
+
+    }
+    else {
+
+        *Statistics = RealSync->Statistics;
+    }
+
+    ReleaseNotifySync(NotifySync);
+
+    DebugTrace(-1, Dbg, "FsRtlNotifyQueryStatistics:  Exit -> %08lx\n", Found);
+
+    return Found;
+}
+
+
+
 //  Local support routine
 
 
@@ -2928,3 +3130,190 @@ Return Value:
 
     return;
 }
+
+
+
+//  Local support routine
+
+
+VOID
+FsRtlNotifyChargeWatcher(
+    IN PREAL_NOTIFY_SYNC NotifySync,
+    IN PNOTIFY_CHANGE Notify,
+    IN BOOLEAN Add
+)
+
+/*++
+
+Routine Description:
+
+    This routine is called with the notify sync held when a notify structure
+    is added to or removed from a notify list.  It maintains the number of
+    watchers and, for a directory watcher, the number of watchers interested
+    in each bit of the completion filter.
+
+Arguments:
+
+    NotifySync  -  This is the synchronization object of the notify list.
+
+    Notify  -  This is the notify structure being added or removed.
+
+    Add  -  TRUE if the structure is being added, FALSE if it is being
+            removed.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ULONG Bit;
+
+    PAGED_CODE();
+
+    if (Add) {
+
+        NotifySync->Statistics.Watchers += 1;
+
+    }
+    else {
+
+        NotifySync->Statistics.Watchers -= 1;
+    }
+
+
+    //  The view index watchers are not matched on the filter.
+
+
+    if (Notify->FullDirectoryName == NULL) {
+
+        return;
+    }
+
+    for (Bit = 0; Bit < 32; Bit += 1) {
+
+        if (FlagOn(Notify->CompletionFilter, 1 << Bit)) {
+
+            if (Add) {
+
+                NotifySync->FilterCounts[Bit] += 1;
+
+            }
+            else {
+
+                ASSERT(NotifySync->FilterCounts[Bit] != 0);
+                NotifySync->FilterCounts[Bit] -= 1;
+            }
+        }
+    }
+
+    return;
+}
+
+
+
+//  Local support routine
+
+
+BOOLEAN
+FsRtlNotifyIsFilterWatched(
+    IN PREAL_NOTIFY_SYNC NotifySync,
+    IN ULONG FilterMatch
+)
+
+/*++
+
+Routine Description:
+
+    This routine is called to find whether any directory watcher using this
+    synchronization object is interested in a change.  It may be called
+    without the notify sync held, in which case the answer may be out of date
+    by the time it is returned.
+
+Arguments:
+
+    NotifySync  -  This is the synchronization object of the notify lists.
+
+    FilterMatch  -  This is the kind of change being reported.
+
+Return Value:
+
+    BOOLEAN - TRUE if some watcher's completion filter includes one of the
+              bits of FilterMatch, FALSE otherwise.
+
+--*/
+
+{
+    ULONG Bit;
+
+    PAGED_CODE();
+
+    for (Bit = 0; Bit < 32; Bit += 1) {
+
+        if (FlagOn(FilterMatch, 1 << Bit)
+            && NotifySync->FilterCounts[Bit] != 0) {
+
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+
+//  Local support routine
+
+
+BOOLEAN
+FsRtlNotifyIsRepeatedEntry(
+    IN PNOTIFY_CHANGE Notify,
+    IN ULONG PreviousEntry
+)
+
+/*++
+
+Routine Description:
+
+    This routine is called after an entry has been appended to the buffer of
+    a notify structure, to find whether it repeats the entry before it.  A
+    file which is written many times between reads of the buffer then takes
+    only one entry in it.  Only the entry immediately before is checked, so
+    the order of the changes seen by the caller is unaffected.
+
+Arguments:
+
+    Notify  -  This is the notify structure.  The new entry is the last entry
+               in its buffer.
+
+    PreviousEntry  -  This is the offset in the buffer of the entry before the
+                      new entry.
+
+Return Value:
+
+    BOOLEAN - TRUE if both entries have the same action and name, FALSE
+              otherwise.
+
+--*/
+
+{
+    PFILE_NOTIFY_INFORMATION Previous;
+    PFILE_NOTIFY_INFORMATION Current;
+
+    PAGED_CODE();
+
+    if (PreviousEntry == Notify->LastEntry) {
+
+        return FALSE;
+    }
+
+    Previous = Add2Ptr(Notify->Buffer, PreviousEntry, PFILE_NOTIFY_INFORMATION);
+    Current = Add2Ptr(Notify->Buffer, Notify->LastEntry, PFILE_NOTIFY_INFORMATION);
+
+    return (BOOLEAN)(Previous->Action == Current->Action
+                     && Previous->FileNameLength == Current->FileNameLength
+                     && RtlEqualMemory(Previous->FileName,
+                                       Current->FileName,
+                                       Current->FileNameLength));
+}
@@ -39,6 +39,7 @@ Abstract:
       o  FsRtlFindInTunnelCache - Finds and returns a key/value from the tunnel
       o  FsRtlDeleteKeyFromTunnelCache - Deletes all entries with a given directory key from the tunnel
       o  FsRtlDeleteTunnelCache - Deletes a TUNNEL structure
+      o  FsRtlQueryTunnelCacheStatistics - Returns the hit, miss and eviction counts of a TUNNEL
 
 Author:
     Dan Lovinger     [DanLo]    8-Aug-1995
@@ -57,6 +58,7 @@ Author:
 #define TUNNEL_KEY_NAME           L"\\Registry\\Machine\\System\\CurrentControlSet\\Control\\FileSystem"
 #define TUNNEL_AGE_VALUE_NAME     L"MaximumTunnelEntryAgeInSeconds"
 #define TUNNEL_SIZE_VALUE_NAME    L"MaximumTunnelEntries"
+#define TUNNEL_MEMORY_VALUE_NAME  L"MaximumTunnelMemoryInKB"
 #define KEY_WORK_AREA ((sizeof(KEY_VALUE_FULL_INFORMATION) + sizeof(ULONG)) + 64)
 
 
@@ -65,6 +67,14 @@ Author:
 
 ULONG   TunnelMaxEntries;
 ULONG   TunnelMaxAge;
+ULONG   TunnelMaxMemory;
+
+
+//  The limits are applied to each shard of a cache separately
+
+
+ULONG   TunnelShardMaxEntries;
+ULONG   TunnelShardMaxMemory;
 
 
 //  We use a lookaside list to manage the common size tunnel entry. The common size
@@ -94,19 +104,20 @@ PAGED_LOOKASIDE_LIST    TunnelLookasideList;
 
 //  A TUNNEL is allocated in each VCB and initialized at mount time.
 
-//  TUNNEL_NODES are then arranged off of the TUNNEL in a splay tree keyed
+//  TUNNEL_NODES are then arranged off of the TUNNEL in hash chains keyed
 //  by DirKey ## Name, where Name is whichever of the names was removed from
-//  the directory (short or long). Each node is also timestamped and inserted
-//  into a timer queue for age expiration.
+//  the directory (short or long), in one of the shards of the TUNNEL picked
+//  by the same key. Each node is also timestamped and inserted into the
+//  timer queue of its shard for age expiration.
 
 
 typedef struct {
 
 
-    //  Splay links in the Cache tree
+    //  Links in the hash chain of the shard
 
 
-    RTL_SPLAY_LINKS      CacheLinks;
+    LIST_ENTRY           HashLinks;
 
 
     //  List links in the timer queue
@@ -127,12 +138,24 @@ typedef struct {
     ULONGLONG            DirKey;
 
 
+    //  Hash of DirKey ## Name, which saves most name comparisons
+
+
+    ULONG                Hash;
+
+
     //  Flags for the entry
 
 
     ULONG                Flags;
 
 
+    //  Pool charged to the shard for this node
+
+
+    ULONG                NodeSize;
+
+
     //  Long/Short names of the file
 
 
@@ -159,7 +182,7 @@ FsRtlGetTunnelParameterValue(
 
 VOID
 FsRtlPruneTunnelCache(
-    IN PTUNNEL Cache,
+    IN PTUNNEL_SHARD Shard,
     IN OUT PLIST_ENTRY FreePoolList);
 
 #ifdef ALLOC_PRAGMA
@@ -169,6 +192,7 @@ FsRtlPruneTunnelCache(
 #pragma alloc_text(PAGE, FsRtlFindInTunnelCache)
 #pragma alloc_text(PAGE, FsRtlDeleteKeyFromTunnelCache)
 #pragma alloc_text(PAGE, FsRtlDeleteTunnelCache)
+#pragma alloc_text(PAGE, FsRtlQueryTunnelCacheStatistics)
 #pragma alloc_text(PAGE, FsRtlPruneTunnelCache)
 #pragma alloc_text(PAGE, FsRtlGetTunnelParameterValue)
 #endif
@@ -182,7 +206,7 @@ FsRtlPruneTunnelCache(
 #if defined(TUNNELTEST) || defined(KEYVIEW)
 VOID DumpUnicodeString(UNICODE_STRING *s);
 VOID DumpNode(TUNNEL_NODE *Node, ULONG Indent);
-VOID DumpTunnel(TUNNEL *Tunnel);
+VOID DumpTunnel(TUNNEL_SHARD *Shard);
 #define DblHex64(a) (ULONG)((a >> 32) & 0xffffffff),(ULONG)(a & 0xffffffff)
 #endif // TUNNELTEST
 
@@ -200,10 +224,65 @@ VOID DumpTunnel(TUNNEL *Tunnel);
 #endif
 
 
+//  The hash is scrambled before being reduced to a shard and a bucket index,
+//  taking the shard from the bits above those used for the bucket.  A mass
+//  delete in one directory is then spread over all the shards and can use
+//  the whole of the limits of the cache.
+
+
+#define FsRtlTunnelScramble(Hash)   ((ULONG)((Hash) * 0x9e3779b1) >> 16)
+
+#define FsRtlTunnelShard(Cache, Hash)                                           \
+    (&(Cache)->Shards[(FsRtlTunnelScramble(Hash) / TUNNEL_BUCKETS) % TUNNEL_SHARDS])
+
+#define FsRtlTunnelBucket(Shard, Hash)                                          \
+    (&(Shard)->Buckets[FsRtlTunnelScramble(Hash) % TUNNEL_BUCKETS])
+
+
+INLINE
+ULONG
+FsRtlHashTunnelKey(
+    ULONGLONG DirectoryKey,
+    PUNICODE_STRING Name
+)
+/*++
+
+Routine Description:
+
+    Hash a key/name pair, ignoring the case of the name
+
+Arguments:
+
+    DirectoryKey      - a key value
+
+    Name              - a filename
+
+Return Value:
+
+    Hash value
+
+--*/
+
+{
+    ULONG Hash;
+    ULONG Index;
+
+    Hash = (ULONG)DirectoryKey ^ (ULONG)(DirectoryKey >> 32);
+
+    for (Index = 0; Index < Name->Length / sizeof(WCHAR); Index += 1) {
+
+        Hash = Hash * 37 + RtlUpcaseUnicodeChar(Name->Buffer[Index]);
+    }
+
+    return Hash;
+}
+
+
 INLINE
-LONG
-FsRtlCompareNodeAndKey(
+BOOLEAN
+FsRtlTunnelNodeMatches(
     TUNNEL_NODE *Node,
+    ULONG Hash,
     ULONGLONG DirectoryKey,
     PUNICODE_STRING Name
 )
@@ -217,23 +296,25 @@ Arguments:
 
     Node              - a tunnel node
 
+    Hash              - the hash of the key/name pair
+
     DirectoryKey      - a key value
 
     Name              - a filename
 
 Return Value:
 
-    Signed comparison result
+    TRUE if the node is for the key/name pair
 
 --*/
 
 {
-    return  (Node->DirKey > DirectoryKey ? 1 :
-        (Node->DirKey < DirectoryKey ? -1 :
-         RtlCompareUnicodeString((FlagOn(Node->Flags, TUNNEL_FLAG_KEY_SHORT) ?
-                                  &Node->ShortName : &Node->LongName),
-                                 Name,
-                                 TRUE)));
+    return (BOOLEAN)(Node->Hash == Hash &&
+                     Node->DirKey == DirectoryKey &&
+                     RtlEqualUnicodeString((FlagOn(Node->Flags, TUNNEL_FLAG_KEY_SHORT) ?
+                                            &Node->ShortName : &Node->LongName),
+                                           Name,
+                                           TRUE));
 }
 
 
@@ -317,10 +398,9 @@ Return Value:
 INLINE
 VOID
 FsRtlRemoveNodeFromTunnel(
-    IN PTUNNEL Cache,
+    IN PTUNNEL_SHARD Shard,
     IN PTUNNEL_NODE Node,
-    IN PLIST_ENTRY FreePoolList,
-    IN PBOOLEAN Splay OPTIONAL
+    IN PLIST_ENTRY FreePoolList
 )
 /*++
 
@@ -332,37 +412,24 @@ Routine Description:
 
 Arguments:
 
-    Cache - the tunnel cache the node is in
+    Shard - the shard of the tunnel cache the node is in
 
     Node - the node being removed
 
     FreePoolList - an initialized list to take the node if it was allocated from
         pool
 
-    Splay - an optional flag to indicate whether the tree should be splayed on
-        the delete. Set to FALSE if splaying was performed.
-
 Return Value:
 
     None.
 
 --*/
 {
-    if (Splay && *Splay) {
-
-        Cache->Cache = RtlDelete(&Node->CacheLinks);
-
-        *Splay = FALSE;
-
-    }
-    else {
-
-        RtlDeleteNoSplay(&Node->CacheLinks, &Cache->Cache);
-    }
-
+    RemoveEntryList(&Node->HashLinks);
     RemoveEntryList(&Node->ListLinks);
 
-    Cache->NumEntries--;
+    Shard->NumEntries--;
+    Shard->PoolBytes -= Node->NodeSize;
 
     FsRtlFreeTunnelNode(Node, FreePoolList);
 }
@@ -422,6 +489,36 @@ Return Value:
     ValueName.MaximumLength = sizeof(TUNNEL_AGE_VALUE_NAME);
     (VOID)FsRtlGetTunnelParameterValue(&ValueName, &TunnelMaxAge);
 
+    TunnelMaxMemory = 0;
+
+    ValueName.Buffer = TUNNEL_MEMORY_VALUE_NAME;
+    ValueName.Length = sizeof(TUNNEL_MEMORY_VALUE_NAME) - sizeof(WCHAR);
+    ValueName.MaximumLength = sizeof(TUNNEL_MEMORY_VALUE_NAME);
+    (VOID)FsRtlGetTunnelParameterValue(&ValueName, &TunnelMaxMemory);
+
+
+    //  Unless told otherwise, allow each entry a lookaside sized node.  Long
+    //  names then run into the memory limit before the entry limit.
+
+
+    if (TunnelMaxMemory == 0 || TunnelMaxMemory > MAXULONG / 1024) {
+
+        if (TunnelMaxEntries > MAXULONG / LOOKASIDE_NODE_SIZE) {
+
+            TunnelMaxMemory = MAXULONG;
+
+        }
+        else {
+
+            TunnelMaxMemory = TunnelMaxEntries * LOOKASIDE_NODE_SIZE;
+        }
+
+    }
+    else {
+
+        TunnelMaxMemory *= 1024;
+    }
+
     if (TunnelMaxAge == 0) {
 
 
@@ -441,6 +538,13 @@ Return Value:
     TunnelMaxAge *= 10000000;
 
 
+    //  Divide the limits between the shards of each cache
+
+
+    TunnelShardMaxEntries = (TunnelMaxEntries + TUNNEL_SHARDS - 1) / TUNNEL_SHARDS;
+    TunnelShardMaxMemory = TunnelMaxMemory / TUNNEL_SHARDS;
+
+
     //  Build the lookaside list for common node allocation
 
 
@@ -525,13 +629,29 @@ Return Value:
 
 --*/
 {
+    PTUNNEL_SHARD Shard;
+    ULONG Index;
+
     PAGED_CODE();
 
-    ExInitializeFastMutex(&Cache->Mutex);
+    for (Shard = &Cache->Shards[0];
+         Shard < &Cache->Shards[TUNNEL_SHARDS];
+         Shard++) {
+
+        ExInitializeFastMutex(&Shard->Mutex);
+
+        for (Index = 0; Index < TUNNEL_BUCKETS; Index += 1) {
 
-    Cache->Cache = NULL;
-    InitializeListHead(&Cache->TimerQueue);
-    Cache->NumEntries = 0;
+            InitializeListHead(&Shard->Buckets[Index]);
+        }
+
+        InitializeListHead(&Shard->TimerQueue);
+        Shard->NumEntries = 0;
+        Shard->PoolBytes = 0;
+
+        Shard->Hits = Shard->Misses = 0;
+        Shard->Evictions = Shard->Expirations = 0;
+    }
 
     return;
 }
@@ -618,15 +738,16 @@ Return Value:
 
 --*/
 {
-    LONG Compare;
+    ULONG Hash;
     ULONG NodeSize;
     PUNICODE_STRING NameKey;
-    PRTL_SPLAY_LINKS *Links;
+    PTUNNEL_SHARD Shard;
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY Link;
     LIST_ENTRY FreePoolList;
 
     PTUNNEL_NODE Node = NULL;
     PTUNNEL_NODE NewNode = NULL;
-    BOOLEAN FreeOldNode = FALSE;
     BOOLEAN AllocatedFromPool = FALSE;
 
     PAGED_CODE();
@@ -668,137 +789,59 @@ Return Value:
         }
 
         AllocatedFromPool = TRUE;
-    }
-
-
-    //  Traverse the cache to find our insertion point
-
-
-    NameKey = (KeyByShortName ? ShortName : LongName);
-
-    ExAcquireFastMutex(&Cache->Mutex);
-
-    Links = &Cache->Cache;
-
-    while (*Links) {
-
-        Node = CONTAINING_RECORD(*Links, TUNNEL_NODE, CacheLinks);
-
-        Compare = FsRtlCompareNodeAndKey(Node, DirKey, NameKey);
-
-        if (Compare > 0) {
 
-            Links = &RtlLeftChild(&Node->CacheLinks);
-
-        }
-        else {
-
-            if (Compare < 0) {
-
-                Links = &RtlRightChild(&Node->CacheLinks);
-
-            }
-            else {
-
-                break;
-            }
-        }
     }
+    else {
 
-
-    //  Thread new data into the splay tree
-
-
-    RtlInitializeSplayLinks(&NewNode->CacheLinks);
-
-    if (Node) {
-
-
-        //  Not inserting first node in tree
-
-
-        if (*Links) {
-
-
-            //  Entry exists in the cache, so replace by swapping all splay links
-
-
-            RtlRightChild(&NewNode->CacheLinks) = RtlRightChild(*Links);
-            RtlLeftChild(&NewNode->CacheLinks) = RtlLeftChild(*Links);
-
-            if (RtlRightChild(*Links)) RtlParent(RtlRightChild(*Links)) = &NewNode->CacheLinks;
-            if (RtlLeftChild(*Links)) RtlParent(RtlLeftChild(*Links)) = &NewNode->CacheLinks;
-
-            if (!RtlIsRoot(*Links)) {
-
-
-                //  Change over the parent links. Note that we've messed with *Links now
-                //  since it is pointing at the parent member.
-
-
-                RtlParent(&NewNode->CacheLinks) = RtlParent(*Links);
-
-                if (RtlIsLeftChild(*Links)) {
-
-                    RtlLeftChild(RtlParent(*Links)) = &NewNode->CacheLinks;
-
-                }
-                else {
-
-                    RtlRightChild(RtlParent(*Links)) = &NewNode->CacheLinks;
-                }
-
-            }
-            else {
+        NodeSize = LOOKASIDE_NODE_SIZE;
+    }
 
 
-                //  Set root of the cache
+    //  Find the shard and hash chain for the key
 
 
-                Cache->Cache = &NewNode->CacheLinks;
-            }
-
+    NameKey = (KeyByShortName ? ShortName : LongName);
 
-            //  Free old node
+    Hash = FsRtlHashTunnelKey(DirKey, NameKey);
+    Shard = FsRtlTunnelShard(Cache, Hash);
+    Bucket = FsRtlTunnelBucket(Shard, Hash);
 
+    ExAcquireFastMutex(&Shard->Mutex);
 
-            RemoveEntryList(&Node->ListLinks);
 
-            FsRtlFreeTunnelNode(Node, &FreePoolList);
+    //  If the entry exists in the cache, replace it
 
-            Cache->NumEntries--;
 
-        }
-        else {
+    for (Link = Bucket->Flink; Link != Bucket; Link = Link->Flink) {
 
+        Node = CONTAINING_RECORD(Link, TUNNEL_NODE, HashLinks);
 
-            //  Simple insertion as a leaf
+        if (FsRtlTunnelNodeMatches(Node, Hash, DirKey, NameKey)) {
 
-
-            NewNode->CacheLinks.Parent = &Node->CacheLinks;
-            *Links = &NewNode->CacheLinks;
+            FsRtlRemoveNodeFromTunnel(Shard, Node, &FreePoolList);
+            break;
         }
-
     }
-    else {
 
-        Cache->Cache = &NewNode->CacheLinks;
-    }
 
+    //  Thread onto the hash chain and the timer list
 
-    //  Thread onto the timer list
 
+    InsertHeadList(Bucket, &NewNode->HashLinks);
 
     KeQuerySystemTime(&NewNode->CreateTime);
-    InsertTailList(&Cache->TimerQueue, &NewNode->ListLinks);
+    InsertTailList(&Shard->TimerQueue, &NewNode->ListLinks);
 
-    Cache->NumEntries++;
+    Shard->NumEntries++;
+    Shard->PoolBytes += NodeSize;
 
 
     //  Stash tunneling information
 
 
     NewNode->DirKey = DirKey;
+    NewNode->Hash = Hash;
+    NewNode->NodeSize = NodeSize;
 
     if (KeyByShortName) {
 
@@ -854,17 +897,17 @@ Return Value:
     DbgPrint("FsRtlAddToTunnelCache:\n");
     DumpNode(NewNode, 1);
 #ifndef KEYVIEW
-    DumpTunnel(Cache);
+    DumpTunnel(Shard);
 #endif
 #endif // TUNNELTEST
 
 
-    //  Clean out the cache, release, and then drop any pool memory we need to
+    //  Clean out the shard, release, and then drop any pool memory we need to
 
 
-    FsRtlPruneTunnelCache(Cache, &FreePoolList);
+    FsRtlPruneTunnelCache(Shard, &FreePoolList);
 
-    ExReleaseFastMutex(&Cache->Mutex);
+    ExReleaseFastMutex(&Shard->Mutex);
 
     FsRtlEmptyFreePoolList(&FreePoolList);
 
@@ -954,11 +997,13 @@ Return Value:
 
 --*/
 {
-    PRTL_SPLAY_LINKS Links;
-    PTUNNEL_NODE Node;
-    LONG Compare;
+    ULONG Hash;
+    PTUNNEL_SHARD Shard;
+    PLIST_ENTRY Bucket;
+    PLIST_ENTRY Link;
     LIST_ENTRY FreePoolList;
 
+    PTUNNEL_NODE Node = NULL;
     BOOLEAN Status = FALSE;
 
     PAGED_CODE();
@@ -975,56 +1020,55 @@ Return Value:
     DbgPrint("++\nSearching for %wZ , %08x%08x\n--\n", Name, DblHex64(DirKey));
 #endif
 
-    ExAcquireFastMutex(&Cache->Mutex);
+    Hash = FsRtlHashTunnelKey(DirKey, Name);
+    Shard = FsRtlTunnelShard(Cache, Hash);
+    Bucket = FsRtlTunnelBucket(Shard, Hash);
 
 
-    //  Expire aged entries first so we don't grab old data
+    //  Most names being created were never tunneled, and most hash chains are
+    //  empty.  An empty chain can be seen without the mutex; an entry being
+    //  added to it at the same time is one we could as easily have just missed.
 
 
-    FsRtlPruneTunnelCache(Cache, &FreePoolList);
+    if (IsListEmpty(Bucket)) {
 
-    Links = Cache->Cache;
+        InterlockedIncrement((PLONG)&Shard->Misses);
+        return FALSE;
+    }
 
-    while (Links) {
+    ExAcquireFastMutex(&Shard->Mutex);
 
-        Node = CONTAINING_RECORD(Links, TUNNEL_NODE, CacheLinks);
 
-        Compare = FsRtlCompareNodeAndKey(Node, DirKey, Name);
+    //  Expire aged entries first so we don't grab old data
 
-        if (Compare > 0) {
 
-            Links = RtlLeftChild(&Node->CacheLinks);
+    FsRtlPruneTunnelCache(Shard, &FreePoolList);
 
-        }
-        else {
+    for (Link = Bucket->Flink; Link != Bucket; Link = Link->Flink) {
 
-            if (Compare < 0) {
+        Node = CONTAINING_RECORD(Link, TUNNEL_NODE, HashLinks);
 
-                Links = RtlRightChild(&Node->CacheLinks);
+        if (FsRtlTunnelNodeMatches(Node, Hash, DirKey, Name)) {
 
-            }
-            else {
 
-
-                //  Found tunneling information
+            //  Found tunneling information
 
 
 #if defined(TUNNELTEST) || defined(KEYVIEW)
-                DbgPrint("FsRtlFindInTunnelCache:\n");
-                DumpNode(Node, 1);
+            DbgPrint("FsRtlFindInTunnelCache:\n");
+            DumpNode(Node, 1);
 #ifndef KEYVIEW
-                DumpTunnel(Cache);
+            DumpTunnel(Shard);
 #endif
 #endif // TUNNELTEST
 
-                break;
-            }
+            break;
         }
     }
 
     try {
 
-        if (Links) {
+        if (Link != Bucket) {
 
 
             //  Copy node data into caller's area
@@ -1060,7 +1104,17 @@ Return Value:
     }
     finally{
 
-     ExReleaseFastMutex(&Cache->Mutex);
+     if (Status) {
+
+         Shard->Hits += 1;
+
+     }
+     else {
+
+         InterlockedIncrement((PLONG)&Shard->Misses);
+     }
+
+     ExReleaseFastMutex(&Shard->Mutex);
 
      FsRtlEmptyFreePoolList(&FreePoolList);
     }
@@ -1108,14 +1162,11 @@ Return Value:
 
 --*/
 {
-    PRTL_SPLAY_LINKS Links;
-    PRTL_SPLAY_LINKS SuccessorLinks;
+    PTUNNEL_SHARD Shard;
     PTUNNEL_NODE Node;
+    PLIST_ENTRY Link, Next;
     LIST_ENTRY FreePoolList;
 
-    PRTL_SPLAY_LINKS LastLinks = NULL;
-    BOOLEAN Splay = TRUE;
-
     PAGED_CODE();
 
 
@@ -1130,80 +1181,41 @@ Return Value:
     DbgPrint("++\nDeleting key %08x%08x\n--\n", DblHex64(DirKey));
 #endif
 
-    ExAcquireFastMutex(&Cache->Mutex);
-
-    Links = Cache->Cache;
 
-    while (Links) {
+    //  The entries for the directory may be in any shard.  Directories are
+    //  removed far less often than names, and the shards are bounded, so
+    //  simply walk each of them.
 
-        Node = CONTAINING_RECORD(Links, TUNNEL_NODE, CacheLinks);
 
-        if (Node->DirKey > DirKey) {
+    for (Shard = &Cache->Shards[0];
+         Shard < &Cache->Shards[TUNNEL_SHARDS];
+         Shard++) {
 
+        ExAcquireFastMutex(&Shard->Mutex);
 
-            //  All nodes to the right are bigger, go left
+        for (Link = Shard->TimerQueue.Flink;
+             Link != &Shard->TimerQueue;
+             Link = Next) {
 
+            Next = Link->Flink;
 
-            Links = RtlLeftChild(&Node->CacheLinks);
+            Node = CONTAINING_RECORD(Link, TUNNEL_NODE, ListLinks);
 
-        }
-        else {
-
-            if (Node->DirKey < DirKey) {
-
-                if (LastLinks) {
-
-
-                    //  If we have previously seen a candidate node to delete
-                    //  and we have now gone too far left - we know where to start.
-
-
-                    break;
-                }
-
-                Links = RtlRightChild(&Node->CacheLinks);
+            if (Node->DirKey == DirKey) {
 
+                FsRtlRemoveNodeFromTunnel(Shard, Node, &FreePoolList);
             }
-            else {
-
-
-                //  Node is a candidate to be deleted, but we might have more nodes
-                //  to the left in the tree. Note this location and go on.
-
-
-                LastLinks = Links;
-                Links = RtlLeftChild(&Node->CacheLinks);
-            }
-        }
-    }
-
-    for (Links = LastLinks;
-         Links;
-         Links = SuccessorLinks) {
-
-        SuccessorLinks = RtlRealSuccessor(Links);
-        Node = CONTAINING_RECORD(Links, TUNNEL_NODE, CacheLinks);
-
-        if (Node->DirKey != DirKey) {
-
-
-            //  Reached nodes which have a different key, so we're done
-
-
-            break;
         }
 
-        FsRtlRemoveNodeFromTunnel(Cache, Node, &FreePoolList, &Splay);
-    }
-
 #ifdef TUNNELTEST
-    DbgPrint("FsRtlDeleteKeyFromTunnelCache:\n");
+        DbgPrint("FsRtlDeleteKeyFromTunnelCache:\n");
 #ifndef KEYVIEW
-    DumpTunnel(Cache);
+        DumpTunnel(Shard);
 #endif
 #endif // TUNNELTEST
 
-    ExReleaseFastMutex(&Cache->Mutex);
+        ExReleaseFastMutex(&Shard->Mutex);
+    }
 
 
     //  Free delayed pool
@@ -1247,8 +1259,10 @@ Return Value:
 
 --*/
 {
+    PTUNNEL_SHARD Shard;
     PTUNNEL_NODE Node;
     PLIST_ENTRY Link, Next;
+    ULONG Index;
 
     PAGED_CODE();
 
@@ -1259,24 +1273,89 @@ Return Value:
     if (TunnelMaxEntries == 0) return;
 
 
-    //  Zero out the cache and delete everything on the timer list
+    //  Zero out each shard and delete everything on its timer list
 
 
-    Cache->Cache = NULL;
-    Cache->NumEntries = 0;
+    for (Shard = &Cache->Shards[0];
+         Shard < &Cache->Shards[TUNNEL_SHARDS];
+         Shard++) {
 
-    for (Link = Cache->TimerQueue.Flink;
-         Link != &Cache->TimerQueue;
-         Link = Next) {
+        for (Link = Shard->TimerQueue.Flink;
+             Link != &Shard->TimerQueue;
+             Link = Next) {
 
-        Next = Link->Flink;
+            Next = Link->Flink;
 
-        Node = CONTAINING_RECORD(Link, TUNNEL_NODE, ListLinks);
+            Node = CONTAINING_RECORD(Link, TUNNEL_NODE, ListLinks);
+
+            FsRtlFreeTunnelNode(Node, NULL);
+        }
+
+        for (Index = 0; Index < TUNNEL_BUCKETS; Index += 1) {
+
+            InitializeListHead(&Shard->Buckets[Index]);
+        }
 
-        FsRtlFreeTunnelNode(Node, NULL);
+        InitializeListHead(&Shard->TimerQueue);
+        Shard->NumEntries = 0;
+        Shard->PoolBytes = 0;
     }
 
-    InitializeListHead(&Cache->TimerQueue);
+    return;
+}
+
+
+
+//    FsRtlQueryTunnelCacheStatistics - return the counters of a tunnel cache
+
+//    Arguments:
+//        Cache        a tunnel cache initialized by FsRtlInitializeTunnelCache()
+//        Statistics    TUNNEL_STATISTICS* totals for all the shards of the cache
+
+
+VOID
+FsRtlQueryTunnelCacheStatistics(
+    IN PTUNNEL Cache,
+    OUT PTUNNEL_STATISTICS Statistics
+)
+/*++
+
+Routine Description:
+
+    Returns the number of entries in a tunnel cache, the pool they use, and the
+    number of lookups which hit and missed and of entries evicted and expired
+    since the cache was initialized. The shards are not locked, so the totals
+    are only a snapshot.
+
+Arguments:
+
+    Cache - a tunnel cache initialized by FsRtlInitializeTunnelCache()
+
+    Statistics - receives the totals
+
+Return Value:
+
+    None
+
+--*/
+{
+    PTUNNEL_SHARD Shard;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Statistics, sizeof(TUNNEL_STATISTICS));
+
+    for (Shard = &Cache->Shards[0];
+         Shard < &Cache->Shards[TUNNEL_SHARDS];
+         Shard++) {
+
+        Statistics->Entries += Shard->NumEntries;
+        Statistics->PoolBytes += Shard->PoolBytes;
+        Statistics->Hits += Shard->Hits;
+        Statistics->Misses += Shard->Misses;
+        Statistics->Evictions += Shard->Evictions;
+        Statistics->Expirations += Shard->Expirations;
+    }
 
     return;
 }
@@ -1284,22 +1363,22 @@ Return Value:
 
 VOID
 FsRtlPruneTunnelCache(
-    IN PTUNNEL Cache,
+    IN PTUNNEL_SHARD Shard,
     IN OUT PLIST_ENTRY FreePoolList
 )
 /*++
 
 Routine Description:
 
-    Removes deadwood entries from the tunnel cache as defined by TunnelMaxAge and TunnelMaxEntries.
-    Pool memory is returned on a list for deletion by the calling routine at a time of
-    its choosing.
+    Removes deadwood entries from a shard of a tunnel cache as defined by TunnelMaxAge
+    and the per shard share of TunnelMaxEntries and TunnelMaxMemory. Pool memory is
+    returned on a list for deletion by the calling routine at a time of its choosing.
 
     For performance reasons we don't want to force freeing of memory inside a mutex.
 
 Arguments:
 
-    Cache - the tunnel cache to prune
+    Shard - the shard of the tunnel cache to prune
 
     FreePoolList - a list to queue pool memory on to
 
@@ -1311,7 +1390,6 @@ Return Value:
     PTUNNEL_NODE Node;
     LARGE_INTEGER ExpireTime;
     LARGE_INTEGER CurrentTime;
-    BOOLEAN Splay = TRUE;
 
     PAGED_CODE();
 
@@ -1330,9 +1408,9 @@ Return Value:
     //  prevent entries from going away.
 
 
-    while (!IsListEmpty(&Cache->TimerQueue)) {
+    while (!IsListEmpty(&Shard->TimerQueue)) {
 
-        Node = CONTAINING_RECORD(Cache->TimerQueue.Flink, TUNNEL_NODE, ListLinks);
+        Node = CONTAINING_RECORD(Shard->TimerQueue.Flink, TUNNEL_NODE, ListLinks);
 
         if (Node->CreateTime.QuadPart < ExpireTime.QuadPart ||
             Node->CreateTime.QuadPart > CurrentTime.QuadPart) {
@@ -1341,7 +1419,9 @@ Return Value:
             DbgPrint("Expiring node %x (%ud%ud 1/10 msec too old)\n", Node, DblHex64(ExpireTime.QuadPart - Node->CreateTime.QuadPart));
 #endif // TUNNELTEST
 
-            FsRtlRemoveNodeFromTunnel(Cache, Node, FreePoolList, &Splay);
+            FsRtlRemoveNodeFromTunnel(Shard, Node, FreePoolList);
+
+            Shard->Expirations += 1;
 
         }
         else {
@@ -1355,18 +1435,21 @@ Return Value:
     }
 
 
-    //  Remove entries until we're under the TunnelMaxEntries limit
+    //  Remove entries until we're under the limits
 
 
-    while (Cache->NumEntries > TunnelMaxEntries) {
+    while (Shard->NumEntries > TunnelShardMaxEntries ||
+           Shard->PoolBytes > TunnelShardMaxMemory) {
 
-        Node = CONTAINING_RECORD(Cache->TimerQueue.Flink, TUNNEL_NODE, ListLinks);
+        Node = CONTAINING_RECORD(Shard->TimerQueue.Flink, TUNNEL_NODE, ListLinks);
 
 #if defined(TUNNELTEST) || defined(KEYVIEW)
-        DbgPrint("Dumping node %x (%d > %d)\n", Node, Cache->NumEntries, TunnelMaxEntries);
+        DbgPrint("Dumping node %x (%d > %d)\n", Node, Shard->NumEntries, TunnelShardMaxEntries);
 #endif // TUNNELTEST
 
-        FsRtlRemoveNodeFromTunnel(Cache, Node, FreePoolList, &Splay);
+        FsRtlRemoveNodeFromTunnel(Shard, Node, FreePoolList);
+
+        Shard->Evictions += 1;
     }
 
     return;
@@ -1509,122 +1592,45 @@ Return Value:
 
 VOID
 DumpTunnel(
-    PTUNNEL Tunnel
+    PTUNNEL_SHARD Shard
 )
 {
-    PRTL_SPLAY_LINKS SplayLinks, Ptr;
     PTUNNEL_NODE Node;
     PLIST_ENTRY Link;
-    ULONG Indent = 1, i;
+    ULONG Index;
     ULONG EntryCount = 0;
     BOOLEAN CountOff = FALSE;
 
     DbgPrint("++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n");
 
-    DbgPrint("NumEntries = %d\n", Tunnel->NumEntries);
-    DbgPrint("****** Cache Tree\n");
-
-    SplayLinks = Tunnel->Cache;
-
-    if (SplayLinks == NULL) {
-
-        goto end;
-    }
-
-    while (RtlLeftChild(SplayLinks) != NULL) {
-
-        SplayLinks = RtlLeftChild(SplayLinks);
-        Indent++;
-    }
-
-    while (SplayLinks) {
-
-        Node = CONTAINING_RECORD(SplayLinks, TUNNEL_NODE, CacheLinks);
-
-        EntryCount++;
-
-        DumpNode(Node, Indent);
-
-        Ptr = SplayLinks;
+    DbgPrint("NumEntries = %d, PoolBytes = %d\n", Shard->NumEntries, Shard->PoolBytes);
+    DbgPrint("****** Hash Chains\n");
 
-        /*
-          first check to see if there is a right subtree to the input link
-          if there is then the real successor is the left most node in
-          the right subtree.  That is find and return P in the following diagram
+    for (Index = 0; Index < TUNNEL_BUCKETS; Index++) {
 
-                      Links
-                         \
-                          .
-                         .
-                        .
-                       /
-                      P
-                       \
-        */
+        for (Link = Shard->Buckets[Index].Flink;
+             Link != &Shard->Buckets[Index];
+             Link = Link->Flink) {
 
-        if ((Ptr = RtlRightChild(SplayLinks)) != NULL) {
+            Node = CONTAINING_RECORD(Link, TUNNEL_NODE, HashLinks);
 
-            Indent++;
-            while (RtlLeftChild(Ptr) != NULL) {
+            EntryCount++;
 
-                Indent++;
-                Ptr = RtlLeftChild(Ptr);
-            }
-
-            SplayLinks = Ptr;
-
-        }
-        else {
-            /*
-              we do not have a right child so check to see if have a parent and if
-              so find the first ancestor that we are a left decendent of. That
-              is find and return P in the following diagram
-
-                               P
-                              /
-                             .
-                              .
-                               .
-                              Links
-            */
-
-            Ptr = SplayLinks;
-            while (RtlIsRightChild(Ptr)) {
-
-                Indent--;
-                Ptr = RtlParent(Ptr);
-            }
-
-            if (!RtlIsLeftChild(Ptr)) {
-
-
-                //  we do not have a real successor so we simply return
-                //  NULL
-
-                SplayLinks = NULL;
-
-            }
-            else {
-
-                Indent--;
-                SplayLinks = RtlParent(Ptr);
-            }
+            DumpNode(Node, 2);
         }
     }
 
-end:
-
-    if (CountOff = (EntryCount != Tunnel->NumEntries)) {
+    if (CountOff = (EntryCount != Shard->NumEntries)) {
 
-        DbgPrint("!!!!!!!!!! Splay Tree Count Mismatch (%d != %d)\n", EntryCount, Tunnel->NumEntries);
+        DbgPrint("!!!!!!!!!! Hash Chain Count Mismatch (%d != %d)\n", EntryCount, Shard->NumEntries);
     }
 
     EntryCount = 0;
 
     DbgPrint("****** Timer Queue\n");
 
-    for (Link = Tunnel->TimerQueue.Flink;
-         Link != &Tunnel->TimerQueue;
+    for (Link = Shard->TimerQueue.Flink;
+         Link != &Shard->TimerQueue;
          Link = Link->Flink) {
 
         Node = CONTAINING_RECORD(Link, TUNNEL_NODE, ListLinks);
@@ -1634,9 +1640,9 @@ end:
         DumpNode(Node, 1);
     }
 
-    if (CountOff |= (EntryCount != Tunnel->NumEntries)) {
+    if (CountOff |= (EntryCount != Shard->NumEntries)) {
 
-        DbgPrint("!!!!!!!!!! Timer Queue Count Mismatch (%d != %d)\n", EntryCount, Tunnel->NumEntries);
+        DbgPrint("!!!!!!!!!! Timer Queue Count Mismatch (%d != %d)\n", EntryCount, Shard->NumEntries);
     }
 
     ASSERT(!CountOff);
@@ -1680,9 +1686,8 @@ DumpNode(
              &Node->ShortName,
              &Node->LongName);
 
-    DbgPrint("%sP = %x, R = %x, L = %x\n", SpaceBuf,
-             RtlParent(&Node->CacheLinks),
-             RtlRightChild(&Node->CacheLinks),
-             RtlLeftChild(&Node->CacheLinks));
+    DbgPrint("%sHash = %08x, Size = %d\n", SpaceBuf,
+             Node->Hash,
+             Node->NodeSize);
 }
 #endif // TUNNELTEST
@@ -0,0 +1,233 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ulock.c
+
+Abstract:
+    Byte range lock benchmark.  Creates a file in the given directory and
+    takes a large number of one byte exclusive locks on every other byte
+    of it through one handle, reporting the time taken to grant each lock.
+
+    It then measures, through a second handle, the rate of one byte reads
+    of the unlocked bytes between the locks, each of which has to be
+    checked against the lock trees of the file, and the rate at which
+    further handles can be opened, take a single lock and be closed.  The
+    cleanup of each of those handles unlocks all of its locks, which with
+    the per owner lock counts no longer means visiting every lock held on
+    the file.  Lastly it times the close of the first handle, which
+    unlocks all of the locks at once.
+
+    usage: ulock directory [locks [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_FILE_NAME     L"ulock.dat"
+#define BENCH_MAX_LOCKS     4000000
+
+OBJECT_ATTRIBUTES BenchAttributes;
+UNICODE_STRING BenchName;
+
+
+NTSTATUS OpenBenchFile(IN ULONG Disposition, OUT PHANDLE Handle)
+{
+    IO_STATUS_BLOCK IoStatus;
+
+    return NtCreateFile(Handle, GENERIC_READ | GENERIC_WRITE | DELETE | SYNCHRONIZE, &BenchAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL,
+                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, Disposition, FILE_SYNCHRONOUS_IO_NONALERT | FILE_DELETE_ON_CLOSE, NULL, 0);
+}
+
+
+NTSTATUS LockByte(IN HANDLE File, IN ULONG Byte)
+{
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Length;
+
+    Offset.QuadPart = Byte;
+    Length.QuadPart = 1;
+
+    return NtLockFile(File, NULL, NULL, NULL, &IoStatus, &Offset, &Length, 0, TRUE, TRUE);
+}
+
+
+NTSTATUS GrantLocks(IN HANDLE File, IN ULONG Locks)
+{
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Elapsed;
+    NTSTATUS Status;
+    ULONG i;
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    for (i = 0; i < Locks; i++)
+    {
+        Status = LockByte(File, i * 2);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Lock of byte %u failed (%X)\n", i * 2, Status);
+            return Status;
+        }
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("grant            %8u locks  %10I64u ms  %8I64u ns/lock\n", Locks, Elapsed / 1000, (Elapsed * 1000) / Locks);
+    return STATUS_SUCCESS;
+}
+
+
+VOID RunChecks(IN PCHAR Title, IN BOOLEAN Cleanup, IN ULONG Locks, IN ULONG Seconds)
+{
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    HANDLE File;
+    ULONGLONG Total;
+    ULONGLONG Elapsed;
+    ULONG Seed;
+    ULONG Byte;
+    UCHAR Data;
+    NTSTATUS Status;
+
+    Status = OpenBenchFile(FILE_OPEN, &File);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", &BenchName, Status);
+        return;
+    }
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        NtClose(File);
+        return;
+    }
+
+    Total = 0;
+    Seed = 1;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        Byte = (RtlRandom(&Seed) % Locks) * 2 + 1;
+
+        if (Cleanup)
+        {
+            //  Each pass takes a lock through a handle of its own, and the
+            //  close of the handle has to find it among all the others.
+
+            HANDLE Handle;
+
+            Status = OpenBenchFile(FILE_OPEN, &Handle);
+            if (NT_SUCCESS(Status))
+            {
+                Status = LockByte(Handle, Byte);
+                NtClose(Handle);
+            }
+        }
+        else
+        {
+            Offset.QuadPart = Byte;
+            Status = NtReadFile(File, NULL, NULL, NULL, &IoStatus, &Data, 1, &Offset, NULL);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("%s of byte %u failed (%X)\n", Title, Byte, Status);
+            break;
+        }
+
+        Total += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+    NtClose(File);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("%-16s %8u locks  %10I64u ops  %8I64u ops/sec  %8I64u ns/op\n",
+           Title, Locks, Total, (Total * 1000000) / (Elapsed ? Elapsed : 1), Total ? (Elapsed * 1000) / Total : 0);
+}
+
+
+main(int argc, char **argv)
+{
+    IO_STATUS_BLOCK IoStatus;
+    FILE_END_OF_FILE_INFORMATION EndOfFile;
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    UNICODE_STRING Directory;
+    LARGE_INTEGER Start, End, Frequency;
+    WCHAR NameBuffer[512];
+    ULONGLONG Elapsed;
+    HANDLE File;
+    ULONG Locks;
+    ULONG Seconds;
+    NTSTATUS Status;
+
+    Locks = BenchArgument(argc, argv, 2, 100000);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((argc < 2) || (Locks == 0) || (Locks > BENCH_MAX_LOCKS) || (Seconds == 0))
+    {
+        printf("usage: ulock directory [locks (1-%u) [seconds]]\n", BENCH_MAX_LOCKS);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &Directory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    swprintf(NameBuffer, L"%wZ\\%s", &Directory, BENCH_FILE_NAME);
+    RtlInitUnicodeString(&BenchName, NameBuffer);
+    InitializeObjectAttributes(&BenchAttributes, &BenchName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    Status = OpenBenchFile(FILE_OVERWRITE_IF, &File);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create %wZ (%X)\n", &BenchName, Status);
+        return 1;
+    }
+
+    //  Reads of the unlocked bytes must fall within the file
+
+    EndOfFile.EndOfFile.QuadPart = (LONGLONG)Locks * 2;
+    Status = NtSetInformationFile(File, &IoStatus, &EndOfFile, sizeof(EndOfFile), FileEndOfFileInformation);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to extend %wZ (%X)\n", &BenchName, Status);
+        NtClose(File);
+        return 1;
+    }
+
+    Status = GrantLocks(File, Locks);
+    if (NT_SUCCESS(Status))
+    {
+        RunChecks("check", FALSE, Locks, Seconds);
+        RunChecks("lock and cleanup", TRUE, Locks, Seconds);
+    }
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+    NtClose(File);
+    NtQueryPerformanceCounter(&End, NULL);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+    printf("unlock all       %8u locks  %10I64u ms\n", Locks, Elapsed);
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
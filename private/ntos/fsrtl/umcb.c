@@ -0,0 +1,267 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    umcb.c
+
+Abstract:
+    Large Mcb benchmark for heavily fragmented files.  Grows two files in
+    the given directory a cluster at a time, alternating between them,
+    with noncached write through writes, so that each cluster of the
+    first file typically lands in a run of its own.  The file system
+    keeps one mapping pair per run (and for holes) in the Large Mcb of
+    the file, so with the default of a million extents the Mcb of the
+    file holds a million pairs.
+
+    Reports the time taken to build the file, which is dominated by
+    adding a pair at the end of the Mcb each time, then the rate of
+    noncached single sector reads at random and in order, each of which
+    has to look up the run holding the sector, and lastly the time to
+    truncate the file by half and then to nothing.
+
+    The build needs extents clusters of free space for each file.
+
+    usage: umcb directory [extents [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_FILE_NAME     L"umcb.dat"
+#define BENCH_FILL_NAME     L"umcbfill.dat"
+#define BENCH_MAX_EXTENTS   4000000
+
+HANDLE BenchFile;
+HANDLE FillFile;
+ULONG ClusterSize;
+ULONG SectorSize;
+PVOID Buffer;
+
+
+NTSTATUS OpenBenchFile(IN PUNICODE_STRING Directory, IN PWSTR FileName, OUT PHANDLE Handle)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[512];
+
+    swprintf(NameBuffer, L"%wZ\\%s", Directory, FileName);
+    RtlInitUnicodeString(&Name, NameBuffer);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    return NtCreateFile(Handle, GENERIC_READ | GENERIC_WRITE | DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, FILE_OVERWRITE_IF,
+                        FILE_SYNCHRONOUS_IO_NONALERT | FILE_NO_INTERMEDIATE_BUFFERING | FILE_WRITE_THROUGH | FILE_DELETE_ON_CLOSE, NULL, 0);
+}
+
+
+NTSTATUS BuildFile(IN ULONG Extents)
+{
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Offset;
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < Extents; i++)
+    {
+        Offset.QuadPart = (LONGLONG)i * ClusterSize;
+
+        Status = NtWriteFile(BenchFile, NULL, NULL, NULL, &IoStatus, Buffer, ClusterSize, &Offset, NULL);
+        if (NT_SUCCESS(Status))
+        {
+            Status = NtWriteFile(FillFile, NULL, NULL, NULL, &IoStatus, Buffer, ClusterSize, &Offset, NULL);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Write of cluster %u failed (%X)\n", i, Status);
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID RunReads(IN PCHAR Title, IN BOOLEAN Random, IN ULONG Extents, IN ULONG Seconds)
+{
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    ULONGLONG Total;
+    ULONGLONG Elapsed;
+    ULONG Seed;
+    ULONG Cluster;
+    NTSTATUS Status;
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        return;
+    }
+
+    Total = 0;
+    Seed = 1;
+    Cluster = 0;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        if (Random)
+        {
+            Cluster = RtlRandom(&Seed) % Extents;
+        }
+        else if (++Cluster == Extents)
+        {
+            Cluster = 0;
+        }
+
+        Offset.QuadPart = (LONGLONG)Cluster * ClusterSize;
+        Status = NtReadFile(BenchFile, NULL, NULL, NULL, &IoStatus, Buffer, SectorSize, &Offset, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Read of cluster %u failed (%X)\n", Cluster, Status);
+            break;
+        }
+
+        Total += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("%-16s %8u extents  %10I64u reads  %8I64u reads/sec  %6I64u us/read\n",
+           Title, Extents, Total, (Total * 1000000) / (Elapsed ? Elapsed : 1), Total ? Elapsed / Total : 0);
+}
+
+
+NTSTATUS Truncate(IN ULONG Clusters)
+{
+    FILE_END_OF_FILE_INFORMATION EndOfFile;
+    FILE_ALLOCATION_INFORMATION Allocation;
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Elapsed;
+    NTSTATUS Status;
+
+    EndOfFile.EndOfFile.QuadPart = (LONGLONG)Clusters * ClusterSize;
+    Allocation.AllocationSize = EndOfFile.EndOfFile;
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+    Status = NtSetInformationFile(BenchFile, &IoStatus, &EndOfFile, sizeof(EndOfFile), FileEndOfFileInformation);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtSetInformationFile(BenchFile, &IoStatus, &Allocation, sizeof(Allocation), FileAllocationInformation);
+    }
+    NtQueryPerformanceCounter(&End, NULL);
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Truncate to %u clusters failed (%X)\n", Clusters, Status);
+        return Status;
+    }
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+    printf("truncate to %8u clusters  %8I64u ms\n", Clusters, Elapsed);
+    return STATUS_SUCCESS;
+}
+
+
+main(int argc, char **argv)
+{
+    FILE_FS_SIZE_INFORMATION SizeInformation;
+    IO_STATUS_BLOCK IoStatus;
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    UNICODE_STRING Directory;
+    LARGE_INTEGER Start, End, Frequency;
+    SIZE_T BufferSize;
+    ULONGLONG Elapsed;
+    ULONG Extents;
+    ULONG Seconds;
+    NTSTATUS Status;
+
+    Extents = BenchArgument(argc, argv, 2, 1000000);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((argc < 2) || (Extents == 0) || (Extents > BENCH_MAX_EXTENTS) || (Seconds == 0))
+    {
+        printf("usage: umcb directory [extents (1-%u) [seconds]]\n", BENCH_MAX_EXTENTS);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &Directory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    Status = OpenBenchFile(&Directory, BENCH_FILE_NAME, &BenchFile);
+    if (NT_SUCCESS(Status))
+    {
+        Status = OpenBenchFile(&Directory, BENCH_FILL_NAME, &FillFile);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create files in %wZ (%X)\n", &Directory, Status);
+        return 1;
+    }
+
+    Status = NtQueryVolumeInformationFile(BenchFile, &IoStatus, &SizeInformation, sizeof(SizeInformation), FileFsSizeInformation);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to query the volume (%X)\n", Status);
+        return 1;
+    }
+
+    SectorSize = SizeInformation.BytesPerSector;
+    ClusterSize = SizeInformation.BytesPerSector * SizeInformation.SectorsPerAllocationUnit;
+
+    //  Noncached transfers need a sector aligned buffer
+
+    Buffer = NULL;
+    BufferSize = ClusterSize;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to allocate the buffer (%X)\n", Status);
+        return 1;
+    }
+
+    RtlFillMemory(Buffer, ClusterSize, 0x5a);
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+    Status = BuildFile(Extents);
+    NtQueryPerformanceCounter(&End, NULL);
+
+    if (NT_SUCCESS(Status))
+    {
+        Elapsed = ((End.QuadPart - Start.QuadPart) * 1000) / Frequency.QuadPart;
+        printf("build            %8u extents  %8I64u ms  %6I64u us/extent  (%u byte clusters)\n",
+               Extents, Elapsed, (Elapsed * 1000) / Extents, ClusterSize);
+
+        RunReads("random reads", TRUE, Extents, Seconds);
+        RunReads("in order reads", FALSE, Extents, Seconds);
+
+        Status = Truncate(Extents / 2);
+        if (NT_SUCCESS(Status))
+        {
+            Status = Truncate(0);
+        }
+    }
+
+    NtClose(FillFile);
+    NtClose(BenchFile);
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
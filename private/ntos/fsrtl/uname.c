@@ -0,0 +1,253 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uname.c
+
+Abstract:
+    Wild card directory enumeration benchmark.  Enumerates a directory
+    with a number of search expressions, restarting the scan as often as
+    needed to examine the given number of names for each, and reports
+    the rate at which names are examined and how many matched.  Every
+    name the file system looks at is matched against the expression of
+    the query, so with a large directory the rate is dominated by the
+    matching of names against the expression.
+
+    The directory is filled with files named in a few styles first if a
+    count of files is given; with no count the names already in the
+    directory are used, which allows read only media such as a UDF disc
+    to be measured.  Files created here are deleted afterwards.
+
+    usage: uname directory [files [names]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_MAX_FILES     200000
+#define BENCH_BUFFER_SIZE   0x10000
+
+//  The expressions are given in their NT form, where < > and " are the
+//  DOS_STAR, DOS_QM and DOS_DOT wild cards of the Win32 patterns *, ?
+//  and . in an 8.3 style search.
+
+PWSTR BenchExpressions[] = {
+    L"*",
+    L"*.TXT",
+    L"REPORT*",
+    L"REPORT*.DOC",
+    L"*1?.TXT",
+    L"DATA<.\"DAT",
+    L"IMG_>>>5.JPG",
+    NULL
+};
+
+UNICODE_STRING BenchDirectory;
+UCHAR QueryBuffer[BENCH_BUFFER_SIZE];
+
+
+VOID BenchFileName(OUT PWCHAR Buffer, IN ULONG Index)
+{
+    switch (Index % 4)
+    {
+    case 0:
+        swprintf(Buffer, L"report%06u.doc", Index);
+        break;
+    case 1:
+        swprintf(Buffer, L"Notes %u.txt", Index);
+        break;
+    case 2:
+        swprintf(Buffer, L"data%u.dat", Index);
+        break;
+    default:
+        swprintf(Buffer, L"IMG_%u.jpg", Index);
+        break;
+    }
+}
+
+
+NTSTATUS OpenBenchFile(IN ULONG Index, IN ULONG Disposition, IN ULONG Options)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[512];
+    WCHAR FileName[32];
+    HANDLE Handle;
+    NTSTATUS Status;
+
+    BenchFileName(FileName, Index);
+    swprintf(NameBuffer, L"%wZ\\%s", &BenchDirectory, FileName);
+    RtlInitUnicodeString(&Name, NameBuffer);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    Status = NtCreateFile(&Handle, DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, Disposition, FILE_SYNCHRONOUS_IO_NONALERT | Options, NULL, 0);
+    if (NT_SUCCESS(Status))
+    {
+        NtClose(Handle);
+    }
+
+    return Status;
+}
+
+
+VOID RunEnumeration(IN PWSTR ExpressionString, IN ULONG Names)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Expression;
+    PFILE_NAMES_INFORMATION Entry;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Directory;
+    ULONGLONG Examined;
+    ULONGLONG Matched;
+    ULONGLONG Elapsed;
+    ULONG DirectorySize;
+    ULONG Passes;
+    BOOLEAN Restart;
+    NTSTATUS Status;
+
+    InitializeObjectAttributes(&ObjectAttributes, &BenchDirectory, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Directory, FILE_LIST_DIRECTORY | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", &BenchDirectory, Status);
+        return;
+    }
+
+    //  Count the names in the directory once, so that we know how many
+    //  passes it takes to examine the requested number of names
+
+    DirectorySize = 0;
+    Restart = TRUE;
+    while (NT_SUCCESS(NtQueryDirectoryFile(Directory, NULL, NULL, NULL, &IoStatus, QueryBuffer, sizeof(QueryBuffer), FileNamesInformation, FALSE, NULL, Restart)))
+    {
+        for (Entry = (PFILE_NAMES_INFORMATION)QueryBuffer; ; Entry = (PFILE_NAMES_INFORMATION)((PUCHAR)Entry + Entry->NextEntryOffset))
+        {
+            DirectorySize += 1;
+            if (Entry->NextEntryOffset == 0)
+            {
+                break;
+            }
+        }
+        Restart = FALSE;
+    }
+
+    NtClose(Directory);
+
+    if (DirectorySize == 0)
+    {
+        printf("%wZ is empty\n", &BenchDirectory);
+        return;
+    }
+
+    //  The search expression is fixed by the first query on a handle, so
+    //  each pass opens the directory again
+
+    RtlInitUnicodeString(&Expression, ExpressionString);
+    Passes = (Names + DirectorySize - 1) / DirectorySize;
+    Examined = (ULONGLONG)Passes * DirectorySize;
+    Matched = 0;
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (Passes--)
+    {
+        Status = NtOpenFile(&Directory, FILE_LIST_DIRECTORY | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_DIRECTORY_FILE | FILE_SYNCHRONOUS_IO_NONALERT);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to open %wZ (%X)\n", &BenchDirectory, Status);
+            return;
+        }
+
+        Restart = TRUE;
+        while (NT_SUCCESS(NtQueryDirectoryFile(Directory, NULL, NULL, NULL, &IoStatus, QueryBuffer, sizeof(QueryBuffer), FileNamesInformation, FALSE, &Expression, Restart)))
+        {
+            for (Entry = (PFILE_NAMES_INFORMATION)QueryBuffer; ; Entry = (PFILE_NAMES_INFORMATION)((PUCHAR)Entry + Entry->NextEntryOffset))
+            {
+                Matched += 1;
+                if (Entry->NextEntryOffset == 0)
+                {
+                    break;
+                }
+            }
+            Restart = FALSE;
+        }
+
+        NtClose(Directory);
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("%-14ws %10I64u names  %10I64u matched  %10I64u names/sec  %6I64u ns/name\n",
+           ExpressionString, Examined, Matched, (Examined * 1000000) / (Elapsed ? Elapsed : 1), (Elapsed * 1000) / Examined);
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    ULONG Files = 0;
+    ULONG Names = 1000000;
+    ULONG Created;
+    NTSTATUS Status;
+    ULONG i;
+
+    if (argc > 2)
+    {
+        Files = atoi(argv[2]);
+    }
+
+    if (argc > 3)
+    {
+        Names = atoi(argv[3]);
+    }
+
+    if ((argc < 2) || (Files > BENCH_MAX_FILES) || (Names == 0))
+    {
+        printf("usage: uname directory [files (0-%u) [names]]\n", BENCH_MAX_FILES);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &BenchDirectory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    Status = STATUS_SUCCESS;
+    for (Created = 0; Created < Files; Created++)
+    {
+        Status = OpenBenchFile(Created, FILE_CREATE, 0);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create file %u in %wZ (%X)\n", Created, &BenchDirectory, Status);
+            break;
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        for (i = 0; BenchExpressions[i] != NULL; i++)
+        {
+            RunEnumeration(BenchExpressions[i], Names);
+        }
+    }
+
+    for (i = 0; i < Created; i++)
+    {
+        OpenBenchFile(i, FILE_OPEN, FILE_DELETE_ON_CLOSE);
+    }
+
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
@@ -0,0 +1,288 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    unotify.c
+
+Abstract:
+    Change notification benchmark.  A number of watcher threads each
+    watch the given directory tree for changes while the main thread
+    appends a byte at a time to a few files in it, and reports the rate
+    of writes and the number of notifications and entries the watchers
+    received.  Every write is reported to the notify package, which has
+    to match it against each of the watchers.
+
+    The first pass watches only for security changes, which the writes
+    never make, so the writes should run at close to the rate with no
+    watchers at all.  The second pass watches for size changes; repeated
+    writes to the same file between reads of a watcher's buffer are
+    folded into one entry, so the entries received should be far fewer
+    than the writes, and the overflows (notifications returned with no
+    entries) should be rare.
+
+    usage: unotify directory [watchers [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_MAX_WATCHERS  64
+#define BENCH_FILES         4
+#define BENCH_BUFFER_SIZE   0x1000
+
+UNICODE_STRING BenchDirectory;
+ULONG WatchFilter;
+ULONGLONG NotifyCounts[BENCH_MAX_WATCHERS];
+ULONGLONG EntryCounts[BENCH_MAX_WATCHERS];
+ULONGLONG OverflowCounts[BENCH_MAX_WATCHERS];
+
+
+ULONG WatcherThread(IN PVOID Context)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    PFILE_NOTIFY_INFORMATION Entry;
+    LARGE_INTEGER Timeout;
+    ULONG Buffer[BENCH_BUFFER_SIZE / sizeof(ULONG)];
+    HANDLE Directory;
+    HANDLE Event;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    InitializeObjectAttributes(&ObjectAttributes, &BenchDirectory, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&Directory, FILE_LIST_DIRECTORY | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_DIRECTORY_FILE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", &BenchDirectory, Status);
+        RtlExitUserThread(Status);
+    }
+
+    Status = NtCreateEvent(&Event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create event (%X)\n", Status);
+        NtClose(Directory);
+        RtlExitUserThread(Status);
+    }
+
+    //  Wake up now and then to see whether the run is over
+
+    Timeout.QuadPart = -10 * 1000 * 100;
+
+    while (!StopBenchmark)
+    {
+        NtClearEvent(Event);
+        Status = NtNotifyChangeDirectoryFile(Directory, Event, NULL, NULL, &IoStatus, Buffer, sizeof(Buffer), WatchFilter, TRUE);
+        if (Status == STATUS_PENDING)
+        {
+            while (!StopBenchmark && (NtWaitForSingleObject(Event, FALSE, &Timeout) == STATUS_TIMEOUT))
+            {
+                NOTHING;
+            }
+
+            if (StopBenchmark)
+            {
+                break;
+            }
+
+            Status = IoStatus.Status;
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Notify on %wZ failed (%X)\n", &BenchDirectory, Status);
+            break;
+        }
+
+        NotifyCounts[ThreadIndex] += 1;
+
+        //  An empty notification means that the changes overflowed the
+        //  buffer and were lost
+
+        if (IoStatus.Information == 0)
+        {
+            OverflowCounts[ThreadIndex] += 1;
+            continue;
+        }
+
+        for (Entry = (PFILE_NOTIFY_INFORMATION)Buffer; ; Entry = (PFILE_NOTIFY_INFORMATION)((PUCHAR)Entry + Entry->NextEntryOffset))
+        {
+            EntryCounts[ThreadIndex] += 1;
+            if (Entry->NextEntryOffset == 0)
+            {
+                break;
+            }
+        }
+    }
+
+    //  Closing the handle cancels any notification still outstanding
+
+    NtClose(Directory);
+    NtClose(Event);
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Filter, IN PHANDLE Files, IN ULONG Watchers, IN ULONG Seconds)
+{
+    HANDLE ThreadHandles[BENCH_MAX_WATCHERS];
+    IO_STATUS_BLOCK IoStatus;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Delay;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    ULONG ThreadCount;
+    ULONGLONG Writes;
+    ULONGLONG Notifications;
+    ULONGLONG Entries;
+    ULONGLONG Overflows;
+    ULONGLONG Elapsed;
+    UCHAR Data = 0;
+    NTSTATUS Status;
+    ULONG i;
+
+    StopBenchmark = FALSE;
+    WatchFilter = Filter;
+    ThreadCount = 0;
+
+    for (i = 0; i < Watchers; i++)
+    {
+        NotifyCounts[i] = 0;
+        EntryCounts[i] = 0;
+        OverflowCounts[i] = 0;
+
+        Status = RtlCreateUserThread(NtCurrentProcess(), NULL, FALSE, 0, 0, 0, (PUSER_THREAD_START_ROUTINE)WatcherThread, (PVOID)(ULONG_PTR)i, &ThreadHandles[ThreadCount], NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create watcher thread (%X)\n", Status);
+            break;
+        }
+
+        ThreadCount += 1;
+    }
+
+    //  Give the watchers time to post their first notification
+
+    Delay.QuadPart = -10 * 1000 * 500;
+    NtDelayExecution(FALSE, &Delay);
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        StopBenchmark = TRUE;
+        Thread = NULL;
+    }
+
+    Offset.HighPart = -1;
+    Offset.LowPart = FILE_WRITE_TO_END_OF_FILE;
+    Writes = 0;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        Status = NtWriteFile(Files[Writes % BENCH_FILES], NULL, NULL, NULL, &IoStatus, &Data, 1, &Offset, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Write failed (%X)\n", Status);
+            StopBenchmark = TRUE;
+            break;
+        }
+
+        Writes += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+
+    if (Thread != NULL)
+    {
+        BenchWaitTimer(Thread);
+    }
+
+    NtWaitForMultipleObjects(ThreadCount, ThreadHandles, WaitAll, FALSE, NULL);
+
+    Notifications = 0;
+    Entries = 0;
+    Overflows = 0;
+    for (i = 0; i < ThreadCount; i++)
+    {
+        NtClose(ThreadHandles[i]);
+        Notifications += NotifyCounts[i];
+        Entries += EntryCounts[i];
+        Overflows += OverflowCounts[i];
+    }
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("%-10s %2u watchers  %8I64u writes/sec  %10I64u notifications  %10I64u entries  %8I64u overflows\n",
+           Title, ThreadCount, (Writes * 1000000) / (Elapsed ? Elapsed : 1), Notifications, Entries, Overflows);
+}
+
+
+main(int argc, char **argv)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[512];
+    HANDLE Files[BENCH_FILES];
+    ULONG Watchers;
+    ULONG Seconds;
+    ULONG Created;
+    NTSTATUS Status;
+
+    Watchers = BenchArgument(argc, argv, 2, 8);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((argc < 2) || (Watchers == 0) || (Watchers > BENCH_MAX_WATCHERS) || (Seconds == 0))
+    {
+        printf("usage: unotify directory [watchers (1-%u) [seconds]]\n", BENCH_MAX_WATCHERS);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &BenchDirectory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    Status = STATUS_SUCCESS;
+    for (Created = 0; Created < BENCH_FILES; Created++)
+    {
+        swprintf(NameBuffer, L"%wZ\\unotify%u.dat", &BenchDirectory, Created);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+        Status = NtCreateFile(&Files[Created], GENERIC_WRITE | DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL,
+                              FILE_SHARE_READ, FILE_OVERWRITE_IF, FILE_SYNCHRONOUS_IO_NONALERT | FILE_DELETE_ON_CLOSE, NULL, 0);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create %wZ (%X)\n", &Name, Status);
+            break;
+        }
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        RunBenchmark("unwatched", FILE_NOTIFY_CHANGE_SECURITY, Files, Watchers, Seconds);
+        RunBenchmark("watched", FILE_NOTIFY_CHANGE_SIZE, Files, Watchers, Seconds);
+    }
+
+    while (Created--)
+    {
+        NtClose(Files[Created]);
+    }
+
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
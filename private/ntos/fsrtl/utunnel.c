@@ -0,0 +1,143 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    utunnel.c
+
+Abstract:
+    Tunnel cache benchmark.  Worker threads repeatedly delete and create
+    again files of their own in one directory, the pattern of a file
+    server saving documents through a temporary file.  Every delete adds
+    the names of the file to the tunnel cache of the volume and every
+    create looks its name up there, so the rate of deletes and creates
+    shows how well the cache copes with concurrent use.  Run with 1, 2,
+    4 ... threads up to the count given; with a sharded cache the rate
+    should rise with the number of threads.
+
+    The hit, miss and eviction counts of the cache of a volume can be
+    read with FsRtlQueryTunnelCacheStatistics from the debugger.
+
+    usage: utunnel directory [threads [files [seconds]]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_MAX_FILES     10000
+
+UNICODE_STRING BenchDirectory;
+ULONG BenchFiles;
+
+
+NTSTATUS CreateBenchFile(IN ULONG ThreadIndex, IN ULONG FileIndex, IN ULONG Options)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[512];
+    HANDLE File;
+    NTSTATUS Status;
+
+    swprintf(NameBuffer, L"%wZ\\Document %02u-%05u.doc", &BenchDirectory, ThreadIndex, FileIndex);
+    RtlInitUnicodeString(&Name, NameBuffer);
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    Status = NtCreateFile(&File, GENERIC_WRITE | DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, FILE_OPEN_IF, FILE_SYNCHRONOUS_IO_NONALERT | Options, NULL, 0);
+    if (NT_SUCCESS(Status))
+    {
+        NtClose(File);
+    }
+
+    return Status;
+}
+
+
+ULONG WorkerThread(IN PVOID Context)
+{
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG FileIndex;
+
+    for (FileIndex = 0; FileIndex < BenchFiles; FileIndex++)
+    {
+        CreateBenchFile(ThreadIndex, FileIndex, 0);
+    }
+
+    FileIndex = 0;
+    while (!StopBenchmark)
+    {
+        //  The delete tunnels the names and the create finds them again
+
+        Status = CreateBenchFile(ThreadIndex, FileIndex, FILE_DELETE_ON_CLOSE);
+        if (NT_SUCCESS(Status))
+        {
+            Status = CreateBenchFile(ThreadIndex, FileIndex, 0);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Delete and create of file %u failed (%X)\n", FileIndex, Status);
+            break;
+        }
+
+        BenchCounts[ThreadIndex] += 1;
+
+        if (++FileIndex == BenchFiles)
+        {
+            FileIndex = 0;
+        }
+    }
+
+    for (FileIndex = 0; FileIndex < BenchFiles; FileIndex++)
+    {
+        CreateBenchFile(ThreadIndex, FileIndex, FILE_DELETE_ON_CLOSE);
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    ULONGLONG Cycles;
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 2, 8);
+    BenchFiles = BenchArgument(argc, argv, 3, 100);
+    Seconds = BenchArgument(argc, argv, 4, 5);
+
+    if ((argc < 2) || (Threads == 0) || (Threads > BENCH_MAX_THREADS) || (BenchFiles == 0) || (BenchFiles > BENCH_MAX_FILES) || (Seconds == 0))
+    {
+        printf("usage: utunnel directory [threads (1-%u) [files (1-%u) [seconds]]]\n", BENCH_MAX_THREADS, BENCH_MAX_FILES);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &BenchDirectory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        Cycles = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WorkerThread, n, Seconds, NULL, NULL);
+        printf("%2u threads  %10I64u deletes and creates  %8I64u per sec\n", n, Cycles, Cycles / Seconds);
+    }
+
+    return 0;
+}
@@ -191,6 +191,35 @@ CmSetRegistryQuotaInformation(
     );
 
 
+// Key control block cache statistics returned by CmQueryKcbCacheInformation.
+// The lookup counters are cumulative; the table and chain figures are a
+// snapshot taken while the cache is locked.
+
+typedef struct _CM_KCB_CACHE_INFORMATION {
+    ULONG   HashTableSize;          // current number of kcb hash buckets
+    ULONG   MaximumHashTableSize;
+    ULONG   TableResizes;
+    ULONG   KcbCount;               // kcbs in the hash table
+    ULONG   UsedBuckets;
+    ULONG   LongestChain;
+    ULONG   Lookups;                // CmpCacheLookup calls
+    ULONG   CompleteHits;           // whole remaining path was cached
+    ULONG   PartialHits;            // some prefix of the path was cached
+    ULONG   Misses;
+    ULONG   ChainProbes;            // kcbs examined on hash chains by lookups
+    ULONG   NegativeCacheSize;
+    ULONG   NegativeEntries;
+    ULONG   NegativeHits;
+    ULONG   NegativeInserts;
+    ULONG   NegativeInvalidations;
+} CM_KCB_CACHE_INFORMATION, *PCM_KCB_CACHE_INFORMATION;
+
+VOID
+CmQueryKcbCacheInformation(
+    OUT PCM_KCB_CACHE_INFORMATION KcbCacheInformation
+    );
+
+
 
 typedef
 VOID
@@ -110,6 +110,13 @@ typedef struct _CM_KEY_HASH {
 //                           This is done so CmpSearchForOpenSubKeysInCachen can clean
 //                           up the cache properly before a key can be unloaded.
 
+// 4. CM_KCB_NEGATIVE_CACHED: This bit is only used for non-symbolic keys and is
+//                           independent of the bits above.  When set, the negative
+//                           lookup cache may hold entries for subkey names of this key
+//                           that were looked up and not found.  The entries are purged
+//                           whenever the subkey info of the key is cleaned up (a subkey
+//                           is created or deleted) and when the kcb is freed.
+
 
 //   KCB
 //   +-------------------+
@@ -228,6 +235,7 @@ typedef struct _CACHED_CHILD_LIST {
 #define CM_KCB_SYM_LINK_FOUND   0x0008
 #define CM_KCB_KEY_NON_EXIST    0x0010
 #define CM_KCB_NO_DELAY_CLOSE   0x0020
+#define CM_KCB_NEGATIVE_CACHED  0x0040
 
 #define CM_KCB_CACHE_MASK (CM_KCB_NO_SUBKEY | \
                            CM_KCB_KEY_NON_EXIST | \
@@ -326,18 +334,37 @@ typedef struct  _CM_KEY_REFERENCE {
 // fast index. All hives that are newly created on a V3-capable system are therefore
 // unreadable on V1 & 2 systems.
 
+// Version 4 adds the hash leaf. A hash leaf has the same layout as a fast leaf, but
+// the second dword of each entry holds a hash of the whole upcased subkey name (the
+// same hash used for a single name component of a kcb ConvKey) instead of the first
+// four characters. A lookup compares hashes and only touches the subkey cell when
+// the hash matches, so a probe that misses, or that would otherwise have to resolve a
+// tie in the first four characters, usually never faults in a key node. The entries
+// are still kept sorted by name, so the binary searches used to insert a subkey and to
+// select a leaf below a root work unchanged. Fast and slow leaves in a version 4 hive
+// are converted to hash leaves the next time a subkey is added to them, and a full
+// hash leaf is split below a root rather than degraded to a slow leaf. Version 3
+// hives are left at version 3, and so stay readable on V3 systems, unless the
+// registry value Control\Session Manager\Configuration Manager\UpgradeHashIndex
+// is set, in which case they are upgraded the first time a subkey is added to them.
+
 // N.B. There is code in cmindex.c that relies on the Signature and Count fields of
 //      CM_KEY_INDEX and CM_KEY_FAST_INDEX being at the same offset in the structure!
 
 #define UseFastIndex(Hive) ((Hive)->Version>=3)
+#define UseHashIndex(Hive) ((Hive)->Version>=4)
 
 #define CM_KEY_INDEX_ROOT   0x6972      // ir
 #define CM_KEY_INDEX_LEAF   0x696c      // il
 #define CM_KEY_FAST_LEAF    0x666c      // fl
+#define CM_KEY_HASH_LEAF    0x686c      // hl
 
 typedef struct _CM_INDEX {
     HCELL_INDEX Cell;
-    UCHAR NameHint[4];                  // upcased first four chars of name
+    union {
+        UCHAR NameHint[4];              // upcased first four chars of name (fast leaf)
+        ULONG HashKey;                  // hash of upcased name (hash leaf)
+    };
 } CM_INDEX, *PCM_INDEX;
 
 typedef struct _CM_KEY_FAST_INDEX {
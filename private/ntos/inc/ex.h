@@ -1839,6 +1839,20 @@ ExMapHandleToPointer (
     );
 
 
+//  A function that takes a handle value and returns the object pointer
+//  stored in its entry without locking the entry.  The caller must have
+//  some other way of keeping the object from going away while it looks
+//  at it.
+
+
+NTKERNELAPI
+PVOID
+ExLookupHandleTableObject (
+    IN PHANDLE_TABLE HandleTable,
+    IN HANDLE Handle
+    );
+
+
 //  Macros for resetting the owner of the handle table, and current
 //  noop macro for setting fifo/lifo behaviour of the table
 
@@ -1996,6 +2010,16 @@ ExDebugLogEvent(
     IN ULONG Data4
     );
 
+// Kernel event tracing, see extrace.h for the events and the file they
+// are written to.
+extern ULONG ExTraceEnableFlags;
+
+#define ExTraceEnabled(Class) ((ExTraceEnableFlags & (Class)) != 0)
+
+NTKERNELAPI NTSTATUS ExStartTrace(IN PUNICODE_STRING FileName, IN ULONG EnableFlags, IN ULONG EventsPerProcessor, OUT PULONG SessionId);
+NTKERNELAPI NTSTATUS ExStopTrace(IN ULONG SessionId);
+NTKERNELAPI VOID ExTraceEvent(IN ULONG Class, IN USHORT Type, IN ULONG_PTR Data1, IN ULONG_PTR Data2, IN ULONG_PTR Data3, IN ULONG_PTR Data4);
+
 VOID ExShutdownSystem(VOID);
 VOID ExAcquireTimeRefreshLock(VOID);
 VOID ExReleaseTimeRefreshLock(VOID);
@@ -0,0 +1,92 @@
+/*++ BUILD Version: 0001    // Increment this if a change has global effects
+
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+
+    extrace.h
+
+Abstract:
+
+    Definitions shared by the kernel event tracing in ex\logger.c and the
+    programs that control it and read its files.
+
+    Events of the classes a trace session enables are logged with a
+    timestamp into per-processor rings of the session, without a lock,
+    and written to the session's file by its logger thread.  The file
+    holds an EX_TRACE_FILE_HEADER followed by EX_TRACE_EVENT records.
+
+    Sessions are started and stopped from user mode through
+    NtSystemDebugControl, which needs the debug privilege.
+
+Revision History:
+
+--*/
+
+#ifndef _EXTRACE_
+#define _EXTRACE_
+
+#define EX_TRACE_CLASS_IO              0x00000001
+#define EX_TRACE_CLASS_PAGE_FAULT      0x00000002
+#define EX_TRACE_CLASS_CONTEXT_SWAP    0x00000004   // multiprocessor kernels only
+#define EX_TRACE_CLASS_ALL             0x00000007
+
+#define EX_TRACE_EVENT_LOST            0    // Data[0] events of the processor lost since the last record
+#define EX_TRACE_EVENT_IO_START        1    // Irp, DeviceObject, MajorFunction, MinorFunction
+#define EX_TRACE_EVENT_IO_COMPLETE     2    // Irp, Status, Information, MajorFunction
+#define EX_TRACE_EVENT_PAGE_FAULT      3    // VirtualAddress, Status, program counter
+#define EX_TRACE_EVENT_CONTEXT_SWAP    4    // old thread id, new thread id
+
+#define EX_TRACE_MAXIMUM_SESSIONS      4
+#define EX_TRACE_NUMBER_OF_DATA_VALUES 4
+
+
+// Sequence is one more than the index of the event among all those logged
+// on its processor, so that for each processor the events written plus
+// those reported lost add up to the Sequence of the last one.  Lost event
+// records have a Sequence of zero.
+
+
+typedef struct _EX_TRACE_EVENT {
+    ULONG Sequence;
+    USHORT Type;
+    UCHAR Processor;
+    UCHAR Irql;
+    HANDLE ProcessId;
+    HANDLE ThreadId;
+    LARGE_INTEGER TimeStamp;
+    ULONG_PTR Data[ EX_TRACE_NUMBER_OF_DATA_VALUES ];
+} EX_TRACE_EVENT, *PEX_TRACE_EVENT;
+
+#define EX_TRACE_FILE_SIGNATURE 'crTE'
+#define EX_TRACE_FILE_VERSION   1
+
+typedef struct _EX_TRACE_FILE_HEADER {
+    ULONG Signature;
+    ULONG Version;
+    ULONG EventSize;
+    ULONG EnableFlags;
+    ULONG NumberOfProcessors;
+    ULONG EventsPerProcessor;
+    LARGE_INTEGER Frequency;        // of the event timestamps
+    LARGE_INTEGER StartTime;        // system time
+    LARGE_INTEGER StartTimeStamp;   // performance counter at StartTime
+} EX_TRACE_FILE_HEADER, *PEX_TRACE_FILE_HEADER;
+
+
+// NtSystemDebugControl commands, numbered clear of those of SYSDBG_COMMAND.
+// SysDbgStartTrace takes an EX_TRACE_START and returns the ULONG session id,
+// SysDbgStopTrace takes the session id.
+
+
+#define SysDbgStartTrace ((SYSDBG_COMMAND)0x100)
+#define SysDbgStopTrace  ((SYSDBG_COMMAND)0x101)
+
+typedef struct _EX_TRACE_START {
+    ULONG EnableFlags;
+    ULONG EventsPerProcessor;
+    ULONG FileNameLength;           // in bytes
+    WCHAR FileName[1];              // NT path, not terminated
+} EX_TRACE_START, *PEX_TRACE_START;
+
+#endif // _EXTRACE_
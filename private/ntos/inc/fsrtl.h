@@ -706,39 +706,80 @@ FsRtlPrivateLock (
 
 
 
-//  Tunnel cache structure
+//  The tunnel cache is split into shards, each with its own mutex, so that
+//  deletes and creates of different names on a volume do not contend.
+//  Entries are placed in a shard and a hash chain by DirKey ## Name.
+
 
+#define TUNNEL_SHARDS           4
+#define TUNNEL_BUCKETS          32
 
 typedef struct {
 
 
-    //  Mutex for cache manipulation
+    //  Mutex for shard manipulation
 
 
     FAST_MUTEX          Mutex;
 
 
-    //  Splay Tree of tunneled information keyed by
+    //  Hash chains of tunneled information keyed by
     //  DirKey ## Name
 
 
-    PRTL_SPLAY_LINKS    Cache;
+    LIST_ENTRY          Buckets[TUNNEL_BUCKETS];
 
 
-    //  Timer queue used to age entries out of the main cache
+    //  Timer queue used to age entries out of the shard
 
 
     LIST_ENTRY          TimerQueue;
 
 
-    //  Keep track of the number of entries in the cache to prevent
-    //  excessive use of memory
+    //  Keep track of the number of entries in the shard and the pool they
+    //  use to prevent excessive use of memory
+
+
+    ULONG               NumEntries;
+    ULONG               PoolBytes;
+
 
+    //  Lookups which found an entry and those which did not, and entries
+    //  removed because the shard was full or because they aged out
 
-    USHORT              NumEntries;
+
+    ULONG               Hits;
+    ULONG               Misses;
+    ULONG               Evictions;
+    ULONG               Expirations;
+
+} TUNNEL_SHARD, *PTUNNEL_SHARD;
+
+
+//  Tunnel cache structure
+
+
+typedef struct {
+
+    TUNNEL_SHARD        Shards[TUNNEL_SHARDS];
 
 } TUNNEL, *PTUNNEL;
 
+
+//  Totals for a tunnel cache returned by FsRtlQueryTunnelCacheStatistics
+
+
+typedef struct {
+
+    ULONG               Entries;
+    ULONG               PoolBytes;
+    ULONG               Hits;
+    ULONG               Misses;
+    ULONG               Evictions;
+    ULONG               Expirations;
+
+} TUNNEL_STATISTICS, *PTUNNEL_STATISTICS;
+
 NTKERNELAPI
 VOID
 FsRtlInitializeTunnelCache (
@@ -780,6 +821,13 @@ FsRtlDeleteTunnelCache (
     IN TUNNEL *Cache);
 
 
+NTKERNELAPI
+VOID
+FsRtlQueryTunnelCacheStatistics (
+    IN TUNNEL *Cache,
+    OUT TUNNEL_STATISTICS *Statistics);
+
+
 
 //  Dbcs name support routines, implemented in DbcsName.c
 
@@ -1417,6 +1465,51 @@ FsRtlNotifyCleanup (
     );
 
 
+//  Counts of the changes seen by one directory watcher, or by all of the
+//  directory watchers sharing a notify sync.
+
+
+typedef struct _FSRTL_NOTIFY_STATISTICS {
+
+
+    //  Number of watchers currently on the lists (totals only)
+
+
+    ULONG Watchers;
+
+
+    //  Changes which matched the watcher
+
+
+    ULONG EventsReported;
+
+
+    //  Changes which repeated the last entry in the watcher's buffer and
+    //  were folded into it
+
+
+    ULONG EventsCoalesced;
+
+
+    //  Changes whose details were lost because the watcher's buffer had
+    //  overflowed, and the number of times it overflowed
+
+
+    ULONG EventsDropped;
+    ULONG Overflows;
+
+} FSRTL_NOTIFY_STATISTICS, *PFSRTL_NOTIFY_STATISTICS;
+
+NTKERNELAPI
+BOOLEAN
+FsRtlNotifyQueryStatistics (
+    IN PNOTIFY_SYNC NotifySync,
+    IN PLIST_ENTRY NotifyList,
+    IN PVOID FsContext OPTIONAL,
+    OUT PFSRTL_NOTIFY_STATISTICS Statistics
+    );
+
+
 
 //  Unicode Name support routines, implemented in Name.c
 
@@ -1465,6 +1558,48 @@ FsRtlIsNameInExpression (
     );
 
 
+//  An expression compiled by FsRtlCompileNameExpression, for callers that
+//  match many names against the same expression, such as a directory
+//  enumeration.  It refers to the caller's expression buffer, which must
+//  not change or be freed while the compiled expression is in use.
+
+
+typedef struct _FSRTL_NAME_EXPRESSION {
+
+    UNICODE_STRING Expression;
+    PWCH UpcaseTable;
+
+
+    //  Byte lengths of the literal characters before the first and after
+    //  the last wild card, and of the shortest name that can match.
+
+
+    USHORT PrefixLength;
+    USHORT SuffixLength;
+    USHORT MinimumLength;
+
+    UCHAR Form;
+    BOOLEAN IgnoreCase;
+
+} FSRTL_NAME_EXPRESSION, *PFSRTL_NAME_EXPRESSION;
+
+NTKERNELAPI
+VOID
+FsRtlCompileNameExpression (
+    IN PUNICODE_STRING Expression,
+    IN BOOLEAN IgnoreCase,
+    IN PWCH UpcaseTable OPTIONAL,
+    OUT PFSRTL_NAME_EXPRESSION CompiledExpression
+    );
+
+NTKERNELAPI
+BOOLEAN
+FsRtlIsNameInCompiledExpression (
+    IN PFSRTL_NAME_EXPRESSION CompiledExpression,
+    IN PUNICODE_STRING Name
+    );
+
+
 
 //  Stack Overflow support routine, implemented in StackOvf.c
 
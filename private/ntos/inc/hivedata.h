@@ -39,6 +39,11 @@ Author:
 
 #define HLOG_MINSIZE(Hive)      ((Hive)->Cluster * HSECTOR_SIZE * 2)
 
+// Once this many bytes of commit records have been appended to a log, the
+// next flush syncs the primary instead, which empties the log.
+
+#define HLOG_RECORD_LIMIT       (1024*1024)
+
 // ===== Basic Structures and Definitions =====
 
 // These are same whether on disk or in memory.
@@ -245,6 +250,30 @@ typedef struct  _HBIN {
 //  Recovery consists of reading the file in, computing which clusters of data are present from the dirtyvector, and where they belong in
 //  the hive address space.  Position in file is by sequential count.
 
+//  Between syncs of the primary, flushes append commit records to the log
+//  rather than rewriting the log and the primary.  Each record holds only
+//  the sectors changed since the previous record:
+
+//          +-------------------------------+
+//          | HBASE_BLOCK copy              |
+//          +-------------------------------+ <- cluster (usually 512) bound
+//          | HLOG_RECORD header            |
+//          +-------------------------------+ <- cluster (usually 512) bound
+//          | Vector of sectors in record   |
+//          +-------------------------------+ <- cluster (usually 512) bound
+//          | Record Data                   |
+//          +-------------------------------+ <- cluster (usually 512) bound
+//          | next HLOG_RECORD ...          |
+//          +-------------------------------+
+
+//  A record applies to the primary whose Sequence2 it carries, so records
+//  left over from before the last sync of the primary are ignored.  When
+//  the primary is next synced the "DIRT" vector and dirty data are written
+//  after the last record, so a crash before the primary is complete still
+//  finds the records intact.  Records are only appended while the layout
+//  of bins in memory matches the primary, so recovery can copy their
+//  sectors into the image read from the primary.
+
 //  Logs can allocate on cluster boundaries (physical sector size of host machine) because they will never be written on any machine other
 //  than the one that created them.
 
@@ -269,7 +298,7 @@ typedef struct  _HBIN {
 #define HBASE_BLOCK_SIGNATURE   0x66676572  // "regf"
 
 #define HSYS_MAJOR          1               // Must match to read at all
-#define HSYS_MINOR          3               // Must be <= to write, always
+#define HSYS_MINOR          4               // Must be <= to write, always
                                             // set up to writer's version.
 
 #define HBASE_FORMAT_MEMORY 1               // Direct memory load case
@@ -299,6 +328,20 @@ typedef struct _HBASE_BLOCK {
 #define HLOG_HEADER_SIZE  (FIELD_OFFSET(HBASE_BLOCK, Reserved2))
 #define HLOG_DV_SIGNATURE   0x54524944      // "DIRT"
 
+// --- HLOG_RECORD --- header of a commit record appended to the log
+
+#define HLOG_RECORD_SIGNATURE   0x53434552  // "RECS"
+
+typedef struct _HLOG_RECORD {
+    ULONG           Signature;
+    ULONG           Sequence;               // Sequence2 of primary it applies to
+    ULONG           Record;                 // 0 for first record after sync
+    ULONG           Length;                 // of whole record, cluster multiple
+    ULONG           HiveLength;             // sizes the vector
+    ULONG           DataLength;             // bytes of sector data
+    ULONG           CheckSum;               // of header, vector and data
+} HLOG_RECORD, *PHLOG_RECORD;
+
 // ===== In Memory Structures =====
 
 // In memory image of a Hive looks just like the on-disk image, EXCEPT that the HBIN structures can be spread throughout memory rather than packed together.
@@ -550,6 +593,13 @@ typedef struct _HHIVE {
     ULONG                   Version;            // hive version, to allow supporting multiple
                                                 // formats simultaneously.
 
+    RTL_BITMAP              CommitVector;       // sectors changed since last commit
+                                                // record, same size as DirtyVector
+    BOOLEAN                 LogAppend;          // bin layout matches primary, so
+                                                // commit records may be appended
+    ULONG                   LogRecordCount;     // commit records since last sync
+    ULONG                   LogRecordLength;    // bytes of them after log header
+
     struct _DUAL {
         ULONG               Length;
         PHMAP_DIRECTORY     Map;
@@ -613,8 +613,14 @@ typedef struct _KPROFILE {// Profile object structure definition
     KAFFINITY Affinity;
     CSHORT Source;
     BOOLEAN Started;
+    BOOLEAN StackSamples;
+    ULONG RingSize;
+    ULONG SamplesPerRing;
+    KAFFINITY PendingSamples;           // Processors holding a sample at Head
 } KPROFILE, *PKPROFILE, *RESTRICTED_POINTER PRKPROFILE;
 
+// Stack sample profiles, see kesample.h.
+
 // Define kernel channel object structure and types.
 
 #define LISTEN_CHANNEL 0x1
@@ -1710,6 +1716,14 @@ NTKERNELAPI VOID FASTCALL KeSetTimeUpdateNotifyRoutine(IN PTIME_UPDATE_NOTIFY_RO
 
 // end_ntddk end_nthal end_ntifs
 
+PSWAP_CONTEXT_NOTIFY_ROUTINE FASTCALL KeExchangeSwapContextNotifyRoutine(IN PSWAP_CONTEXT_NOTIFY_ROUTINE NotifyRoutine, IN PSWAP_CONTEXT_NOTIFY_ROUTINE Comparand);
+
+// Process time update notify routine.
+
+typedef VOID (FASTCALL *PPROCESS_TIME_UPDATE_NOTIFY_ROUTINE)(IN PKPROCESS Process, IN KPROCESSOR_MODE Mode);
+
+BOOLEAN FASTCALL KeSetProcessTimeUpdateNotifyRoutine(IN PPROCESS_TIME_UPDATE_NOTIFY_ROUTINE NotifyRoutine);
+
 // External references to public kernel data structures
 
 
@@ -0,0 +1,57 @@
+/*++ BUILD Version: 0001    // Increment this if a change has global effects
+
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+
+    kesample.h
+
+Abstract:
+
+    Definitions shared by the stack sample profiles of ke\profobj.c and the
+    programs that read their rings.
+
+    A profile object created with a bucket size of PROFILE_STACK_SAMPLES
+    has no address range.  Instead, each profile interrupt records the
+    stack of the interrupted thread in the ring of the current processor.
+    The buffer is split into one ring per processor, each RingSize bytes
+    long, and the ring of processor n starts n * RingSize bytes into it.
+
+    The kernel adds samples at Head and the reader takes them from Tail,
+    advancing it once it has copied them; the ring is empty when Head
+    equals Tail.  The newest sample is built in the slot at Head, outside
+    the reader's range, and samples from the same thread with the same
+    stack only bump its Count.  It is published by advancing Head when a
+    different stack arrives or the profile is stopped.
+
+Revision History:
+
+--*/
+
+#ifndef _KESAMPLE_
+#define _KESAMPLE_
+
+#define PROFILE_STACK_SAMPLES 1
+#define PROFILE_STACK_DEPTH 16
+
+typedef struct _KSTACK_SAMPLE {
+    HANDLE UniqueProcess;
+    HANDLE UniqueThread;
+    ULONG Hash;
+    ULONG Count;
+    USHORT Depth;
+    USHORT KernelDepth;                 // Frames[0 .. KernelDepth-1] are kernel mode
+    PVOID Frames[PROFILE_STACK_DEPTH];
+} KSTACK_SAMPLE, *PKSTACK_SAMPLE;
+
+typedef struct _KSTACK_SAMPLE_RING {
+    ULONG Head;
+    ULONG Tail;
+    ULONG Lost;                         // Samples dropped because the ring was full
+    ULONG NumberOfSamples;
+    ULONG RingSize;
+    ULONG Processor;
+    KSTACK_SAMPLE Samples[1];
+} KSTACK_SAMPLE_RING, *PKSTACK_SAMPLE_RING;
+
+#endif // _KESAMPLE_
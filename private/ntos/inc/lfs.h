@@ -395,6 +395,11 @@ LfsCheckWriteRange (
     IN OUT PULONG FlushLength
     );
 
+VOID
+LfsSetCommitDelay (
+    IN ULONG Microseconds
+    );
+
 
 //  Log File Query Record routines
 
@@ -842,6 +842,7 @@ typedef VOID (FASTCALL *PHARD_FAULT_NOTIFY_ROUTINE)(IN HANDLE FileObject, IN PVO
 
 NTKERNELAPI VOID FASTCALL MmSetPageFaultNotifyRoutine(IN PPAGE_FAULT_NOTIFY_ROUTINE NotifyRoutine);
 NTKERNELAPI VOID FASTCALL MmSetHardFaultNotifyRoutine(IN PHARD_FAULT_NOTIFY_ROUTINE NotifyRoutine);
+PPAGE_FAULT_NOTIFY_ROUTINE FASTCALL MmExchangePageFaultNotifyRoutine(IN PPAGE_FAULT_NOTIFY_ROUTINE NotifyRoutine, IN PPAGE_FAULT_NOTIFY_ROUTINE Comparand);
 NTSTATUS MmCallDllInitialize(IN  PLDR_DATA_TABLE_ENTRY DataTableEntry);
 
 // Crash dump only
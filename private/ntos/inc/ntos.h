@@ -53,8 +53,10 @@ Revision History:
 
 #include "arc.h"
 #include "ke.h"
+#include "kesample.h"
 #include "kd.h"
 #include "ex.h"
+#include "extrace.h"
 #include "ps.h"
 #include "se.h"
 #include "io.h"
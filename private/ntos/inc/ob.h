@@ -205,12 +205,23 @@ typedef struct _OBJECT_TYPE {
 
 #define NUMBER_HASH_BUCKETS 37
 
+// HashBuckets is the initial bucket array.  Once a directory fills up it is
+// rehashed into a larger pool allocated array described by Buckets and
+// BucketCount.  A NULL Buckets field means the embedded array is in use.
+// ChangeCount is bumped every time an entry is inserted or deleted and is
+// used to validate the object name lookup cache.
+
 typedef struct _OBJECT_DIRECTORY {
     struct _OBJECT_DIRECTORY_ENTRY *HashBuckets[ NUMBER_HASH_BUCKETS ];
     struct _OBJECT_DIRECTORY_ENTRY **LookupBucket;
     BOOLEAN LookupFound;
     USHORT SymbolicLinkUsageCount;
     struct _DEVICE_MAP *DeviceMap;
+    struct _OBJECT_DIRECTORY_ENTRY **Buckets;
+    ULONG BucketCount;
+    ULONG EntryCount;
+    ULONG LookupHash;
+    ULONG ChangeCount;
 } OBJECT_DIRECTORY, *POBJECT_DIRECTORY;
 
 
@@ -219,6 +230,7 @@ typedef struct _OBJECT_DIRECTORY {
 typedef struct _OBJECT_DIRECTORY_ENTRY {
     struct _OBJECT_DIRECTORY_ENTRY *ChainLink;
     PVOID Object;
+    ULONG HashValue;
 } OBJECT_DIRECTORY_ENTRY, *POBJECT_DIRECTORY_ENTRY;
 
 
@@ -351,6 +363,7 @@ typedef struct _OBJECT_HEADER_CREATOR_INFO {
 #define OB_FLAG_PERMANENT_OBJECT        0x10
 #define OB_FLAG_DEFAULT_SECURITY_QUOTA  0x20
 #define OB_FLAG_SINGLE_HANDLE_ENTRY     0x40
+#define OB_FLAG_SHARDED_REFERENCES      0x80
 
 #define OBJECT_TO_OBJECT_HEADER( o ) \
     CONTAINING_RECORD( (o), OBJECT_HEADER, Body )
@@ -506,13 +519,23 @@ NTKERNELAPI VOID FASTCALL ObfReferenceObject(IN PVOID Object);
 //  end_wdm end_ntddk end_nthal end_ntifs
 #else
 
+NTKERNELAPI VOID FASTCALL ObfReferenceObject(IN PVOID Object);
+
 #define ObReferenceObject(Object) {                                \
     POBJECT_HEADER ObjectHeader = OBJECT_TO_OBJECT_HEADER(Object); \
-    InterlockedIncrement(&ObjectHeader->PointerCount);             \
+    if (ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) {        \
+        ObfReferenceObject(Object);                                \
+    } else {                                                       \
+        InterlockedIncrement(&ObjectHeader->PointerCount);         \
+    }                                                              \
 }
 
 #endif
 
+//  Takes a reference only if the object is not already being deleted.
+
+NTKERNELAPI BOOLEAN FASTCALL ObReferenceObjectSafe(IN PVOID Object);
+
 //  begin_wdm begin_ntddk begin_nthal begin_ntifs
 
 NTKERNELAPI
@@ -675,6 +698,42 @@ ObDeassignSecurity (
     IN OUT PSECURITY_DESCRIPTOR *SecurityDescriptor
     );
 
+//
+// Reference statistics.  Each entry describes one of the most frequently
+// referenced objects seen by the reference sampler, ordered by rate.
+//
+
+typedef struct _OB_REFERENCE_STATISTICS_ENTRY {
+    PVOID Object;
+    ULONG TypeIndex;
+    ULONG PointerCount;
+    ULONG HandleCount;
+    ULONG SampledReferences;
+    ULONG ReferencesPerSecond;
+    BOOLEAN Sharded;
+} OB_REFERENCE_STATISTICS_ENTRY, *POB_REFERENCE_STATISTICS_ENTRY;
+
+typedef struct _OB_REFERENCE_STATISTICS {
+    ULONG SampleInterval;
+    ULONG ShardedReferenceThreshold;
+    ULONG ShardedObjects;
+    ULONG NumberOfEntries;
+    OB_REFERENCE_STATISTICS_ENTRY Entries[1];
+} OB_REFERENCE_STATISTICS, *POB_REFERENCE_STATISTICS;
+
+NTSTATUS
+ObQueryReferenceStatistics(
+    OUT POB_REFERENCE_STATISTICS ReferenceStatistics,
+    IN ULONG Length,
+    OUT PULONG ReturnLength OPTIONAL
+    );
+
+NTSTATUS
+ObSetObjectReferenceSharding(
+    IN PVOID Object,
+    IN BOOLEAN Enable
+    );
+
 #endif // DEVL
 
 #endif // _OB_
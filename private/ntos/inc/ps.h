@@ -127,6 +127,36 @@ typedef struct _WOW64_PROCESS
 #endif
 } WOW64_PROCESS, *PWOW64_PROCESS;
 
+// Job accounting.  The processor time, I/O and page faults charged to a job.
+// Times are in 100ns units.
+typedef struct _PS_JOB_ACCOUNTING
+{
+    LARGE_INTEGER UserTime;
+    LARGE_INTEGER KernelTime;
+    ULONGLONG ReadOperationCount;
+    ULONGLONG WriteOperationCount;
+    ULONGLONG OtherOperationCount;
+    ULONGLONG ReadTransferCount;
+    ULONGLONG WriteTransferCount;
+    ULONGLONG OtherTransferCount;
+    ULONG PageFaultCount;
+} PS_JOB_ACCOUNTING, *PPS_JOB_ACCOUNTING;
+
+// The counters a process in a job charges as it runs, see PsChargeJobUsage.
+typedef enum _PS_JOB_USAGE
+{
+    PsJobUserTime,
+    PsJobKernelTime,
+    PsJobReadOperationCount,
+    PsJobWriteOperationCount,
+    PsJobOtherOperationCount,
+    PsJobReadTransferCount,
+    PsJobWriteTransferCount,
+    PsJobOtherTransferCount,
+    PsJobPageFaultCount,
+    PsJobMaximumUsage
+} PS_JOB_USAGE;
+
 #define PS_SET_BITS(Flags, Flag)     ExInterlockedSetBits (Flags, Flag)
 #define PS_CLEAR_BITS(Flags, Flag)     ExInterlockedClearBits (Flags, Flag)
 #define PS_SET_CLEAR_BITS(Flags, sFlag, cFlag)     ExInterlockedSetClearBits (Flags, sFlag, cFlag)
@@ -262,6 +292,11 @@ typedef struct _EPROCESS
     SIZE_T CommitChargeLimit;
     SIZE_T CommitChargePeak;
 
+    // The process times charged to the job, in ticks, where the clock
+    // interrupt does not charge them, see PspChargeProcessRunTime
+    ULONG JobUserTimeCharged;
+    ULONG JobKernelTimeCharged;
+
     LIST_ENTRY ThreadListHead;
 
     PRTL_BITMAP VadPhysicalPagesBitMap;
@@ -467,6 +502,19 @@ typedef struct _EJOB
     SIZE_T CurrentJobMemoryUsed;
 
     FAST_MUTEX MemoryLimitsLock;
+
+    // Nesting: the job this one is nested in, written once under PspJobListLock.
+    // Limits of the parent apply to the processes of this job as well.
+    struct _EJOB *ParentJob;
+
+    // Commit charged without the memory limits lock, one slot per processor.
+    // Pushed into CurrentJobMemoryUsed whenever the lock is taken.
+    struct _PSP_JOB_COMMIT_SLOT *CommitSlots;
+
+    // Usage charged by the processes of this job and of the jobs nested in
+    // it, one slot per processor.  The totals above are brought up to the
+    // sum of the slots under the job lock.
+    struct _PSP_JOB_USAGE_SLOT *UsageSlots;
 } EJOB;
 typedef EJOB *PEJOB;
 
@@ -493,6 +541,7 @@ extern WORK_QUEUE_ITEM PsReaperWorkItem;
 
 BOOLEAN PsChangeJobMemoryUsage(SSIZE_T Amount);
 VOID PsReportProcessMemoryLimitViolation(VOID);
+VOID PsChargeJobUsage(IN PEPROCESS Process, IN PS_JOB_USAGE Usage, IN ULONG Amount);
 
 #if DEVL
 #define THREAD_HIT_SLOTS 750
@@ -0,0 +1,187 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ubench.c
+
+Abstract:
+    Common routines of the user mode benchmarks, included by each of
+    them.
+
+    A benchmark runs worker threads that loop until StopBenchmark is
+    set, counting their iterations in BenchCounts[ThreadIndex], where
+    the thread index is the context of the worker.  BenchRunThreads runs
+    them for a number of seconds and returns the total.  Benchmarks that
+    measure more than one thing per worker keep further counts of their
+    own, indexed the same way.
+
+    Benchmarks that do their work on the main thread instead start a
+    timer with BenchStartTimer, loop until StopBenchmark is set and then
+    wait for the timer with BenchWaitTimer.  BenchArgument reads the
+    numeric arguments of the command line.
+
+Environment:
+    User Mode
+--*/
+
+#ifndef _UBENCH_
+#define _UBENCH_
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_MAX_THREADS   32
+
+volatile BOOLEAN StopBenchmark;
+ULONGLONG BenchCounts[BENCH_MAX_THREADS];
+
+
+ULONG BenchArgument(IN int argc, IN char **argv, IN int Index, IN ULONG Default)
+{
+    if (argc > Index)
+    {
+        return atoi(argv[Index]);
+    }
+
+    return Default;
+}
+
+
+ULONGLONG BenchRunThreads(IN PUSER_THREAD_START_ROUTINE StartRoutine, IN ULONG Threads, IN ULONG Seconds, IN PUSER_THREAD_START_ROUTINE ChurnRoutine OPTIONAL, OUT PCLIENT_ID ClientIds OPTIONAL)
+
+/*++
+
+Routine Description:
+
+    Runs Threads workers for Seconds and returns the sum of their counts.
+
+    The workers are created suspended and resumed together, so that when
+    ClientIds is given each of them can find the client ids of all the
+    others there before any of them starts.  When ChurnRoutine is given
+    it runs in one more thread alongside the workers and should also
+    stop when StopBenchmark is set.
+
+Arguments:
+
+    StartRoutine - Supplies the routine of the workers.
+
+    Threads - Supplies the number of workers, at most BENCH_MAX_THREADS.
+
+    Seconds - Supplies how long to run them for.
+
+    ChurnRoutine - Optionally supplies the routine of the extra thread.
+
+    ClientIds - Optionally receives the client ids of the workers.
+
+Return Value:
+
+    The sum of the counts of the workers.
+
+--*/
+
+{
+    HANDLE ThreadHandles[BENCH_MAX_THREADS + 1];
+    ULONG WorkerCount;
+    ULONG ThreadCount;
+    LARGE_INTEGER Delay;
+    ULONGLONG Total;
+    NTSTATUS Status;
+    ULONG i;
+
+    StopBenchmark = FALSE;
+    ThreadCount = 0;
+
+    for (i = 0; i < Threads; i++)
+    {
+        BenchCounts[i] = 0;
+
+        Status = RtlCreateUserThread(NtCurrentProcess(), NULL, TRUE, 0, 0, 0, StartRoutine, (PVOID)(ULONG_PTR)i, &ThreadHandles[ThreadCount], (ClientIds != NULL) ? &ClientIds[i] : NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create worker thread (%X)\n", Status);
+            break;
+        }
+
+        ThreadCount += 1;
+    }
+
+    WorkerCount = ThreadCount;
+
+    if (ChurnRoutine != NULL)
+    {
+        Status = RtlCreateUserThread(NtCurrentProcess(), NULL, TRUE, 0, 0, 0, ChurnRoutine, NULL, &ThreadHandles[ThreadCount], NULL);
+        if (NT_SUCCESS(Status))
+        {
+            ThreadCount += 1;
+        }
+        else
+        {
+            printf("Unable to create churn thread (%X)\n", Status);
+        }
+    }
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        NtResumeThread(ThreadHandles[i], NULL);
+    }
+
+    Delay.QuadPart = -10 * 1000 * 1000 * (LONGLONG)Seconds;
+    NtDelayExecution(FALSE, &Delay);
+    StopBenchmark = TRUE;
+
+    NtWaitForMultipleObjects(ThreadCount, ThreadHandles, WaitAll, FALSE, NULL);
+
+    for (i = 0; i < ThreadCount; i++)
+    {
+        NtClose(ThreadHandles[i]);
+    }
+
+    Total = 0;
+    for (i = 0; i < WorkerCount; i++)
+    {
+        Total += BenchCounts[i];
+    }
+
+    return Total;
+}
+
+
+ULONG BenchTimerThread(IN PVOID Context)
+{
+    LARGE_INTEGER Delay;
+
+    Delay.QuadPart = -10 * 1000 * 1000 * (LONGLONG)(ULONG_PTR)Context;
+    NtDelayExecution(FALSE, &Delay);
+    StopBenchmark = TRUE;
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+BOOLEAN BenchStartTimer(IN ULONG Seconds, OUT PHANDLE Thread)
+{
+    NTSTATUS Status;
+
+    StopBenchmark = FALSE;
+    Status = RtlCreateUserThread(NtCurrentProcess(), NULL, FALSE, 0, 0, 0, (PUSER_THREAD_START_ROUTINE)BenchTimerThread, (PVOID)(ULONG_PTR)Seconds, Thread, NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create timer thread (%X)\n", Status);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+VOID BenchWaitTimer(IN HANDLE Thread)
+{
+    NtWaitForSingleObject(Thread, FALSE, NULL);
+    NtClose(Thread);
+}
+
+#endif // _UBENCH_
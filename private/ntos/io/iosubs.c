@@ -1245,6 +1245,10 @@ Return Value:
     // Invoke the driver at its dispatch routine entry point.
     driverObject = DeviceObject->DriverObject;
 
+    if (ExTraceEnabled(EX_TRACE_CLASS_IO)) {
+        ExTraceEvent(EX_TRACE_CLASS_IO, EX_TRACE_EVENT_IO_START, (ULONG_PTR) Irp, (ULONG_PTR) DeviceObject, irpSp->MajorFunction, irpSp->MinorFunction);
+    }
+
     PERFINFO_DRIVER_MAJORFUNCTION_CALL(Irp, irpSp, driverObject);
     status = driverObject->MajorFunction[irpSp->MajorFunction]( DeviceObject, Irp );
     PERFINFO_DRIVER_MAJORFUNCTION_RETURN(Irp, irpSp, driverObject);
@@ -2297,6 +2301,16 @@ Return Value:
 
     ASSERT( Irp->IoStatus.Status != 0xffffffff );
 
+    if (ExTraceEnabled(EX_TRACE_CLASS_IO)) {
+        stackPointer = IoGetCurrentIrpStackLocation( Irp );
+        ExTraceEvent( EX_TRACE_CLASS_IO,
+                      EX_TRACE_EVENT_IO_COMPLETE,
+                      (ULONG_PTR) Irp,
+                      (ULONG_PTR) Irp->IoStatus.Status,
+                      Irp->IoStatus.Information,
+                      Irp->CurrentLocation <= Irp->StackCount ? stackPointer->MajorFunction : 0 );
+    }
+
 
     // Ensure that if this is a paging I/O operation, and it failed, that the
     // reason for the failure isn't because quota was exceeded.
@@ -10648,6 +10662,7 @@ Routine Description:
     if (IoCountOperations == TRUE) {
         IoOtherOperationCount += 1;
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->OtherOperationCount, 1);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobOtherOperationCount, 1 );
     }
 }
 
@@ -10662,6 +10677,7 @@ Routine Description:
     if (IoCountOperations == TRUE) {
         IoReadOperationCount += 1;
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->ReadOperationCount, 1);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobReadOperationCount, 1 );
     }
 }
 
@@ -10676,6 +10692,7 @@ Routine Description:
     if (IoCountOperations == TRUE) {
         IoWriteOperationCount += 1;
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->WriteOperationCount, 1);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobWriteOperationCount, 1 );
     }
 }
 
@@ -10693,6 +10710,7 @@ Arguments:
     if (IoCountOperations == TRUE) {
         ExInterlockedAddLargeStatistic( &IoOtherTransferCount, TransferCount );
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->OtherTransferCount, TransferCount);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobOtherTransferCount, TransferCount );
     }
 }
 
@@ -10710,6 +10728,7 @@ Arguments:
     if (IoCountOperations == TRUE) {
         ExInterlockedAddLargeStatistic( &IoReadTransferCount, TransferCount );
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->ReadTransferCount, TransferCount);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobReadTransferCount, TransferCount );
     }
 }
 
@@ -10728,6 +10747,7 @@ Arguments:
     if (IoCountOperations == TRUE) {
         ExInterlockedAddLargeStatistic( &IoWriteTransferCount, TransferCount );
         ExInterlockedAddLargeStatistic( &THREAD_TO_PROCESS(PsGetCurrentThread())->WriteTransferCount, TransferCount);
+        PsChargeJobUsage( THREAD_TO_PROCESS(PsGetCurrentThread()), PsJobWriteTransferCount, TransferCount );
     }
 }
 
@@ -64,7 +64,9 @@ include mac386.inc
         extrn   _KiTimerTableListHead:DWORD
         extrn   _KiTimerExpireDpc:DWORD
         extrn   _KiTimeUpdateNotifyRoutine:DWORD
+        extrn   _KiProcessTimeUpdateNotifyRoutine:DWORD
         extrn   _KiProfileListHead:DWORD
+        extrn   _KiStackProfileListHead:DWORD
         extrn   _KiProfileLock:DWORD
         extrn   _KiProfileInterval:DWORD
         extrn   _KdDebuggerEnabled:BYTE
@@ -72,6 +74,7 @@ include mac386.inc
         EXTRNP  _DbgBreakPointWithStatus,1
         EXTRNP  _KdPollBreakIn
         EXTRNP  _KiDeliverApc,3
+        EXTRNP  _KiRecordStackSample,2
         extrn   _KeI386MachineType:DWORD
 
 if DBG
@@ -484,6 +487,15 @@ Kutp20:
 
 ALIGN 4
 Kutp50:                                 ;
+        cmp     _KiProcessTimeUpdateNotifyRoutine, 0 ; check for callout routine
+        je      short Kutp50a           ; if eq, no callout routine registered
+        push    edx                     ; save processor mode
+        mov     ecx, ThApcState+AsProcess[ebx] ; set current thread's process
+        call    [_KiProcessTimeUpdateNotifyRoutine] ; notify callout routine
+        pop     edx                     ; restore processor mode
+        mov     eax, PCR[PcSelfPcr]     ; restore PCR address
+
+Kutp50a:
 
 ifndef NT_UP
 
@@ -843,6 +855,21 @@ kipi50: mov     esi,[esi].LsFlink       ; (esi) -> profile object
 ALIGN 4
 kipi60:
 
+
+;   Record the stack of the interrupted thread if there are stack sample
+;   profiles.  These are not kept on the lists above since they have no
+;   range to match.
+
+
+        mov     edx,offset FLAT:_KiStackProfileListHead
+        cmp     [edx].LsFlink,edx       ; any stack sample profiles?
+        je      short kipi70            ; if e, none
+        mov     ecx, [esp+8]            ; (ecx) = profile source
+        stdCall _KiRecordStackSample,<ebp,ecx>
+
+ALIGN 4
+kipi70:
+
 ifndef  NT_UP
         lea     eax,_KiProfileLock
         RELEASE_SPINLOCK    eax
@@ -156,6 +156,9 @@ Arguments:
     if (TrFrame->PreviousMode != KernelMode) {
         ++Thread->UserTime;
         ExInterlockedIncrementLong(&Process->UserTime, &Lock);// Atomic Update of Process User Time required.
+        if (KiProcessTimeUpdateNotifyRoutine != NULL) {
+            KiProcessTimeUpdateNotifyRoutine(Process, UserMode);
+        }
         ++Prcb->UserTime;// Update the time spent in user mode for the current processor.
     } else {
         if (TrFrame->OldIrql > DISPATCH_LEVEL) {
@@ -163,6 +166,9 @@ Arguments:
         } else if ((TrFrame->OldIrql < DISPATCH_LEVEL) || (Prcb->DpcRoutineActive == 0)) {
             ++Thread->KernelTime;
             ExInterlockedIncrementLong(&Process->KernelTime, &Lock);
+            if (KiProcessTimeUpdateNotifyRoutine != NULL) {
+                KiProcessTimeUpdateNotifyRoutine(Process, KernelMode);
+            }
         } else {
             ++Prcb->DpcTime;
         }
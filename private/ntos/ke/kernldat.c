@@ -82,6 +82,14 @@ PTHREAD_SELECT_NOTIFY_ROUTINE KiThreadSelectNotifyRoutine;
 PTIME_UPDATE_NOTIFY_ROUTINE KiTimeUpdateNotifyRoutine;
 
 
+// KiProcessTimeUpdateNotifyRoutine - This is the address of a callout
+//      routine which is called with the process that is charged when the
+//      runtime for a thread is updated if the address is not NULL.
+
+
+PPROCESS_TIME_UPDATE_NOTIFY_ROUTINE KiProcessTimeUpdateNotifyRoutine;
+
+
 // Public kernel data declaration and allocation.
 
 // KeActiveProcessors - This is the set of processors that active in the
@@ -470,6 +478,13 @@ ULONG KiProfileInterval = DEFAULT_PROFILE_INTERVAL;
 LIST_ENTRY KiProfileListHead;
 
 
+// KiStackProfileListHead - This is the list head for the stack sample
+//      profile list.  It is guarded by the profile lock.
+
+
+LIST_ENTRY KiStackProfileListHead;
+
+
 // KiProfileLock - This is the spin lock that guards the profile list.
 
 
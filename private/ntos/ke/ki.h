@@ -366,6 +366,8 @@ NTSTATUS KiRaiseException (
     IN BOOLEAN FirstChance
     );
 VOID FASTCALL KiReadyThread (IN PRKTHREAD Thread);
+VOID KiPublishStackSamples (IN PKPROFILE Profile);
+VOID KiRecordStackSample (IN PKTRAP_FRAME TrapFrame, IN KPROFILE_SOURCE Source);
 LOGICAL FASTCALL KiReinsertTreeTimer (IN PRKTIMER Timer, IN ULARGE_INTEGER DueTime);
 
 #if DBG
@@ -549,6 +551,7 @@ extern ULONG KiProfileAlignmentFixupInterval;
 extern ULONG KiProfileAlignmentFixupCount;
 extern ULONG KiProfileInterval;
 extern LIST_ENTRY KiProfileListHead;
+extern LIST_ENTRY KiStackProfileListHead;
 extern KSPIN_LOCK KiProfileLock;
 extern ULONG KiReadySummary;
 extern UCHAR KiArgumentTable[];
@@ -566,6 +569,7 @@ extern BOOLEAN KiSlavesStartExecution;
 extern PSWAP_CONTEXT_NOTIFY_ROUTINE KiSwapContextNotifyRoutine;
 extern PTHREAD_SELECT_NOTIFY_ROUTINE KiThreadSelectNotifyRoutine;
 extern PTIME_UPDATE_NOTIFY_ROUTINE KiTimeUpdateNotifyRoutine;
+extern PPROCESS_TIME_UPDATE_NOTIFY_ROUTINE KiProcessTimeUpdateNotifyRoutine;
 extern LIST_ENTRY KiWaitInListHead;
 extern LIST_ENTRY KiWaitOutListHead;
 extern CALL_PERFORMANCE_DATA KiWaitSingleCallData;
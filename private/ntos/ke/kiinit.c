@@ -145,6 +145,7 @@ Return Value:
 
     KeInitializeSpinLock(&KiProfileLock);
     InitializeListHead(&KiProfileListHead);
+    InitializeListHead(&KiStackProfileListHead);
 
 
     // Initialize the active profile source listhead.
@@ -19,7 +19,9 @@ Environment:
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, KeAddSystemServiceTable)
 #pragma alloc_text(PAGE, KeSetSwapContextNotifyRoutine)
+#pragma alloc_text(PAGE, KeExchangeSwapContextNotifyRoutine)
 #pragma alloc_text(PAGE, KeSetTimeUpdateNotifyRoutine)
+#pragma alloc_text(PAGE, KeSetProcessTimeUpdateNotifyRoutine)
 #pragma alloc_text(PAGE, KeSetThreadSelectNotifyRoutine)
 #pragma alloc_text(PAGE, KeQueryActiveProcessors)
 #pragma alloc_text(PAGELK, KiCalibrateTimeAdjustment)
@@ -482,6 +484,24 @@ Return Value:
 }
 
 
+PSWAP_CONTEXT_NOTIFY_ROUTINE FASTCALL KeExchangeSwapContextNotifyRoutine(IN PSWAP_CONTEXT_NOTIFY_ROUTINE NotifyRoutine, IN PSWAP_CONTEXT_NOTIFY_ROUTINE Comparand)
+/*++
+Routine Description:
+    This function sets the address of the swap context notify callout routine only if the routine set now is Comparand,
+    so that a caller neither replaces a routine someone else set nor clears one that replaced its own.
+Arguments:
+    NotifyRoutine - Supplies the address of the swap context notify callout routine.
+    Comparand - Supplies the routine that must be set now for NotifyRoutine to be set.
+Return Value:
+    The routine that was set before the call.  NotifyRoutine was set if this is Comparand.
+--*/
+{
+    PAGED_CODE();
+
+    return (PSWAP_CONTEXT_NOTIFY_ROUTINE)InterlockedCompareExchangePointer((PVOID *)&KiSwapContextNotifyRoutine, (PVOID)NotifyRoutine, (PVOID)Comparand);
+}
+
+
 VOID FASTCALL KeSetThreadSelectNotifyRoutine(IN PTHREAD_SELECT_NOTIFY_ROUTINE NotifyRoutine)
 /*++
 Routine Description:
@@ -514,6 +534,28 @@ Return Value:
 }
 
 
+BOOLEAN FASTCALL KeSetProcessTimeUpdateNotifyRoutine(IN PPROCESS_TIME_UPDATE_NOTIFY_ROUTINE NotifyRoutine)
+/*++
+Routine Description:
+    This function sets the address of a callout routine which will be called with the process and the processor mode each time the runtime of a thread is charged to its process.
+    The routine is called at clock level and must not be pageable.
+Arguments:
+    NotifyRoutine - Supplies the address of the process time update notify callout routine.
+Return Value:
+    TRUE if the clock interrupt of this architecture calls the routine, FALSE if it does not, in which case the routine is not set.
+--*/
+{
+    PAGED_CODE();
+
+#if defined(_X86_) || defined(_IA64_)
+    KiProcessTimeUpdateNotifyRoutine = NotifyRoutine;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+
 KAFFINITY KeQueryActiveProcessors(VOID)
 /*++
 Routine Description:
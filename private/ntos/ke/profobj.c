@@ -103,7 +103,9 @@ Arguments:
 
     BucketSize - Supplies the log base 2 of the size of a profiling bucket.
         Thus, BucketSize = 2 yields 4-byte buckets, BucketSize = 7 yields
-        128-byte buckets.
+        128-byte buckets.  A value of PROFILE_STACK_SAMPLES makes this a
+        stack sample profile, which has no range; RangeSize then supplies
+        the size of the buffer that holds the sample rings.
 
     Segment - Supplies the non-Flat code segment to profile.  If this
         is zero, then the flat profiling is done.  This will only
@@ -146,9 +148,36 @@ Return Value:
         Profile->Process = NULL;
     }
 
-    Profile->RangeBase = RangeBase;
-    Profile->RangeLimit = (PUCHAR)RangeBase + RangeSize;
-    Profile->BucketShift = BucketSize - 2;
+    if (BucketSize == PROFILE_STACK_SAMPLES) {
+
+
+        // Split the buffer into a ring for each processor. The geometry of
+        // the rings is kept here rather than trusted from the buffer, which
+        // the profiling process can write to.
+
+
+        Profile->RangeBase = NULL;
+        Profile->RangeLimit = NULL;
+        Profile->BucketShift = 0;
+        Profile->StackSamples = TRUE;
+        Profile->PendingSamples = 0;
+        Profile->RingSize = (ULONG)(RangeSize / KeNumberProcessors) &
+                            ~(sizeof(ULONG_PTR) - 1);
+
+        Profile->SamplesPerRing =
+            (Profile->RingSize - FIELD_OFFSET(KSTACK_SAMPLE_RING, Samples)) /
+                sizeof(KSTACK_SAMPLE);
+
+    } else {
+        Profile->RangeBase = RangeBase;
+        Profile->RangeLimit = (PUCHAR)RangeBase + RangeSize;
+        Profile->BucketShift = BucketSize - 2;
+        Profile->StackSamples = FALSE;
+        Profile->PendingSamples = 0;
+        Profile->RingSize = 0;
+        Profile->SamplesPerRing = 0;
+    }
+
     Profile->Started = FALSE;
     Profile->Segment = Segment;
     Profile->Source = (CSHORT)ProfileSource;
@@ -312,7 +341,8 @@ Arguments:
     Profile - Supplies a pointer to a control object of type profile.
 
     Buffer - Supplies a pointer to an array of counters, which record
-        the number of hits in the corresponding bucket.
+        the number of hits in the corresponding bucket, or for a stack
+        sample profile, to the buffer that holds the sample rings.
 
 Return Value:
 
@@ -335,11 +365,30 @@ Return Value:
     ULONG SourceSize;
     KAFFINITY AffinitySet;
     PULONG Reference;
+    PKSTACK_SAMPLE_RING Ring;
+    ULONG Processor;
 
     ASSERT_PROFILE(Profile);
     ASSERT(KeGetCurrentIrql() <= DISPATCH_LEVEL);
 
 
+    // Set up the sample rings of a stack sample profile while the buffer
+    // can still take exceptions.
+
+
+    if ((Profile->StackSamples != FALSE) && (Profile->Started == FALSE)) {
+        for (Processor = 0; Processor < (ULONG)KeNumberProcessors; Processor += 1) {
+            Ring = (PKSTACK_SAMPLE_RING)((PCHAR)Buffer + Processor * Profile->RingSize);
+            Ring->Head = 0;
+            Ring->Tail = 0;
+            Ring->Lost = 0;
+            Ring->NumberOfSamples = Profile->SamplesPerRing;
+            Ring->RingSize = Profile->RingSize;
+            Ring->Processor = Processor;
+        }
+    }
+
+
     // Allocate pool that may be required before raising to PROFILE_LEVEL.
 
 
@@ -384,8 +433,12 @@ Return Value:
         Started = TRUE;
         Profile->Buffer = Buffer;
         Profile->Started = TRUE;
+        Profile->PendingSamples = 0;
         Process = Profile->Process;
-        if (Process != NULL) {
+        if (Profile->StackSamples != FALSE) {
+            InsertTailList(&KiStackProfileListHead, &Profile->ProfileListEntry);
+
+        } else if (Process != NULL) {
             InsertTailList(&Process->ProfileListHead, &Profile->ProfileListEntry);
 
         } else {
@@ -594,6 +647,9 @@ Return Value:
         Stopped = TRUE;
         Profile->Started = FALSE;
         RemoveEntryList(&Profile->ProfileListEntry);
+        if (Profile->PendingSamples != 0) {
+            KiPublishStackSamples(Profile);
+        }
 
 
         // Search the profile source list to find the entry for this
@@ -717,6 +773,307 @@ Return Value:
     return Stopped;
 }
 
+#if defined(_X86_)
+
+ULONG
+KiCaptureStackSample (
+    IN PKTRAP_FRAME TrapFrame,
+    IN PKTHREAD Thread,
+    OUT PKSTACK_SAMPLE Sample
+    )
+
+/*++
+
+Routine Description:
+
+    This function captures the stack of the interrupted thread for a stack
+    sample profile. If the thread was interrupted in kernel mode, the frame
+    chain is walked for as long as it stays within the kernel stack of the
+    thread, which is resident while the thread runs, and then the user mode
+    program counter is added from the trap frame of the thread's last entry
+    into the system, if any. User mode stacks are not walked, since they may
+    not be resident and page faults cannot be taken at profile level; only
+    the user mode program counter is recorded.
+
+Arguments:
+
+    TrapFrame - Supplies a pointer to the profile interrupt trap frame.
+
+    Thread - Supplies a pointer to the current thread.
+
+    Sample - Supplies a pointer to the sample to fill in.
+
+Return Value:
+
+    The number of frames captured.
+
+--*/
+
+{
+
+    ULONG_PTR FramePointer;
+    ULONG_PTR NextFramePointer;
+    ULONG_PTR ReturnAddress;
+    ULONG_PTR StackBase;
+    ULONG_PTR StackLimit;
+    PKTRAP_FRAME UserTrapFrame;
+    ULONG Depth;
+    ULONG Hash;
+
+    Depth = 0;
+    if ((TrapFrame->EFlags & EFLAGS_V86_MASK) != 0) {
+        Sample->Frames[Depth++] = (PVOID)((TrapFrame->SegCs << 4) + TrapFrame->Eip);
+        Sample->KernelDepth = 0;
+
+    } else if ((TrapFrame->SegCs & MODE_MASK) != 0) {
+        Sample->Frames[Depth++] = (PVOID)TrapFrame->Eip;
+        Sample->KernelDepth = 0;
+
+    } else {
+        Sample->Frames[Depth++] = (PVOID)TrapFrame->Eip;
+        StackBase = (ULONG_PTR)Thread->StackBase;
+        StackLimit = (ULONG_PTR)Thread->StackLimit;
+        FramePointer = TrapFrame->Ebp;
+        while (Depth < PROFILE_STACK_DEPTH - 1) {
+            if ((FramePointer < StackLimit) ||
+                (FramePointer + 2 * sizeof(ULONG_PTR) > StackBase)) {
+                break;
+            }
+
+            NextFramePointer = ((PULONG_PTR)FramePointer)[0];
+            ReturnAddress = ((PULONG_PTR)FramePointer)[1];
+            if ((ReturnAddress <= (ULONG_PTR)MM_HIGHEST_USER_ADDRESS) ||
+                (NextFramePointer <= FramePointer)) {
+                break;
+            }
+
+            Sample->Frames[Depth++] = (PVOID)ReturnAddress;
+            FramePointer = NextFramePointer;
+        }
+
+        Sample->KernelDepth = (USHORT)Depth;
+
+
+        // Add the user mode program counter if the thread entered the
+        // system from user mode.
+
+
+        UserTrapFrame = Thread->TrapFrame;
+        if (((ULONG_PTR)UserTrapFrame >= StackLimit) &&
+            ((ULONG_PTR)(UserTrapFrame + 1) <= StackBase) &&
+            ((UserTrapFrame->SegCs & MODE_MASK) != 0) &&
+            ((UserTrapFrame->EFlags & EFLAGS_V86_MASK) == 0)) {
+            Sample->Frames[Depth++] = (PVOID)UserTrapFrame->Eip;
+        }
+    }
+
+    Hash = 0;
+    Sample->Depth = (USHORT)Depth;
+    while (Depth-- != 0) {
+        Hash = ((Hash << 5) | (Hash >> 27)) ^ (ULONG)(ULONG_PTR)Sample->Frames[Depth];
+    }
+
+    Sample->Hash = Hash;
+    return Sample->Depth;
+}
+
+#endif
+
+VOID
+KiRecordStackSample (
+    IN PKTRAP_FRAME TrapFrame,
+    IN KPROFILE_SOURCE Source
+    )
+
+/*++
+
+Routine Description:
+
+    This function is called from the profile interrupt with the profile
+    lock held when there are stack sample profiles. The stack of the
+    interrupted thread is captured once and added to the ring of the
+    current processor in each stack sample profile that matches the
+    source, processor and process.
+
+    The rings are written only by the processor they belong to, so they
+    need no lock of their own. The reader may change Head and Tail, but
+    they are only used as indexes after being checked against the number
+    of samples in the ring, which the kernel keeps in the profile object.
+
+    The newest sample of each ring is held in the slot at Head, which the
+    reader does not copy, so that repeats of the same stack can be counted
+    in it. It is published by advancing Head when a different stack
+    arrives, or by KeStopProfile.
+
+Arguments:
+
+    TrapFrame - Supplies a pointer to the profile interrupt trap frame.
+
+    Source - Supplies the source of the profile interrupt.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+#if defined(_X86_)
+
+    PLIST_ENTRY NextEntry;
+    PKSTACK_SAMPLE Pending;
+    PKSTACK_SAMPLE_RING Ring;
+    PKPROFILE Profile;
+    PKPROCESS Process;
+    PKTHREAD Thread;
+    PKPRCB Prcb;
+    KSTACK_SAMPLE Sample;
+    ULONG Head;
+    ULONG Next;
+    ULONG Tail;
+
+    Prcb = KeGetCurrentPrcb();
+    Thread = Prcb->CurrentThread;
+    Process = Thread->ApcState.Process;
+
+    if (KiCaptureStackSample(TrapFrame, Thread, &Sample) == 0) {
+        return;
+    }
+
+    Sample.UniqueProcess = ((PETHREAD)Thread)->Cid.UniqueProcess;
+    Sample.UniqueThread = ((PETHREAD)Thread)->Cid.UniqueThread;
+    Sample.Count = 1;
+
+    NextEntry = KiStackProfileListHead.Flink;
+    while (NextEntry != &KiStackProfileListHead) {
+        Profile = CONTAINING_RECORD(NextEntry, KPROFILE, ProfileListEntry);
+        NextEntry = NextEntry->Flink;
+
+        if ((Profile->Source != (CSHORT)Source) ||
+            ((Profile->Affinity & Prcb->SetMember) == 0) ||
+            ((Profile->Process != NULL) && (Profile->Process != Process)) ||
+            (Profile->SamplesPerRing < 2)) {
+            continue;
+        }
+
+        Ring = (PKSTACK_SAMPLE_RING)((PCHAR)Profile->Buffer +
+                                     Prcb->Number * Profile->RingSize);
+
+        Head = Ring->Head;
+        Tail = Ring->Tail;
+        if ((Head >= Profile->SamplesPerRing) || (Tail >= Profile->SamplesPerRing)) {
+            Ring->Lost += 1;
+            continue;
+        }
+
+
+        // If the pending sample at Head is the same stack of the same
+        // thread, count this one with it. Otherwise publish the pending
+        // sample, if there is room for a new one after it.
+
+
+        if ((Profile->PendingSamples & Prcb->SetMember) != 0) {
+            Pending = &Ring->Samples[Head];
+            if ((Pending->UniqueThread == Sample.UniqueThread) &&
+                (Pending->Hash == Sample.Hash) &&
+                (Pending->Depth == Sample.Depth) &&
+                RtlEqualMemory(Pending->Frames,
+                               Sample.Frames,
+                               Sample.Depth * sizeof(PVOID))) {
+                Pending->Count += 1;
+                continue;
+            }
+
+            Next = Head + 1;
+            if (Next == Profile->SamplesPerRing) {
+                Next = 0;
+            }
+
+            if (Next == Tail) {
+                Ring->Lost += 1;
+                continue;
+            }
+
+            Ring->Head = Next;
+            Head = Next;
+        }
+
+        RtlCopyMemory(&Ring->Samples[Head],
+                      &Sample,
+                      FIELD_OFFSET(KSTACK_SAMPLE, Frames) + Sample.Depth * sizeof(PVOID));
+
+        Profile->PendingSamples |= Prcb->SetMember;
+    }
+
+#endif
+
+    return;
+}
+
+VOID
+KiPublishStackSamples (
+    IN PKPROFILE Profile
+    )
+
+/*++
+
+Routine Description:
+
+    This function is called with the profile lock held when a stack sample
+    profile is stopped. The pending sample at the head of the ring of each
+    processor is published, or counted as lost if the ring is full.
+
+Arguments:
+
+    Profile - Supplies a pointer to a control object of type profile.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PKSTACK_SAMPLE_RING Ring;
+    KAFFINITY Pending;
+    ULONG Processor;
+    ULONG Head;
+    ULONG Next;
+
+    Pending = Profile->PendingSamples;
+    Profile->PendingSamples = 0;
+    for (Processor = 0; Pending != 0; Processor += 1, Pending >>= 1) {
+        if ((Pending & 1) == 0) {
+            continue;
+        }
+
+        Ring = (PKSTACK_SAMPLE_RING)((PCHAR)Profile->Buffer +
+                                     Processor * Profile->RingSize);
+
+        Head = Ring->Head;
+        if (Head >= Profile->SamplesPerRing) {
+            Ring->Lost += 1;
+            continue;
+        }
+
+        Next = Head + 1;
+        if (Next == Profile->SamplesPerRing) {
+            Next = 0;
+        }
+
+        if (Next == Ring->Tail) {
+            Ring->Lost += Ring->Samples[Head].Count;
+
+        } else {
+            Ring->Head = Next;
+        }
+    }
+
+    return;
+}
+
 #if !defined(NT_UP)
 
 
@@ -0,0 +1,283 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uprof.c
+
+Abstract:
+    Stack sample profiler.  Creates a stack sample profile for the given
+    process, or for all processes, and reads the samples from the ring of
+    each processor while the profile runs, without stopping it.  The
+    samples are counted by process, thread and stack, and the stacks that
+    were hit most are printed with their counts, kernel frames first and
+    then the user mode program counter, ready to be folded into a flame
+    graph once the addresses are resolved against the module lists.
+
+    The rate at which samples can be taken and read is a measure of the
+    cost of the profile interrupt with stack sampling on: each line gives
+    the samples read and lost over the run.
+
+    usage: uprof [process id [seconds [interval]]]
+
+        process id 0 profiles all processes, which needs the system
+        profile privilege; the interval is in 100ns units
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "kesample.h"
+
+#define BENCH_RING_SIZE     (256 * 1024)
+#define BENCH_STACKS        4096
+#define BENCH_TOP_STACKS    20
+#define BENCH_READ_DELAY    50
+
+
+KSTACK_SAMPLE Stacks[BENCH_STACKS];
+ULONG StackCount;
+ULONGLONG SampleCount;
+ULONGLONG DroppedCount;
+
+
+VOID CountSample(IN PKSTACK_SAMPLE Sample)
+{
+    PKSTACK_SAMPLE Stack;
+    ULONG i;
+
+    SampleCount += Sample->Count;
+
+    if (Sample->Depth > PROFILE_STACK_DEPTH)
+    {
+        return;
+    }
+
+    //  Stacks are kept in an open addressed table keyed by thread and
+    //  stack hash, and compared in full when the keys match
+
+    i = (Sample->Hash ^ (ULONG)(ULONG_PTR)Sample->UniqueThread) % BENCH_STACKS;
+    for (;;)
+    {
+        Stack = &Stacks[i];
+        if (Stack->Count == 0)
+        {
+            if (StackCount == BENCH_STACKS - 1)
+            {
+                DroppedCount += Sample->Count;
+                return;
+            }
+
+            *Stack = *Sample;
+            StackCount += 1;
+            return;
+        }
+
+        if ((Stack->UniqueThread == Sample->UniqueThread) &&
+            (Stack->Hash == Sample->Hash) &&
+            (Stack->Depth == Sample->Depth) &&
+            RtlEqualMemory(Stack->Frames, Sample->Frames, Sample->Depth * sizeof(PVOID)))
+        {
+            Stack->Count += Sample->Count;
+            return;
+        }
+
+        i = (i + 1) % BENCH_STACKS;
+    }
+}
+
+
+ULONG ReadRings(IN PVOID Buffer, IN ULONG Processors)
+{
+    PKSTACK_SAMPLE_RING Ring;
+    KSTACK_SAMPLE Sample;
+    ULONG Lost;
+    ULONG Head;
+    ULONG Tail;
+    ULONG i;
+
+    Lost = 0;
+    Ring = Buffer;
+
+    for (i = 0; i < Processors; i++)
+    {
+        //  Copy each sample out before advancing the tail past it, since
+        //  the kernel may reuse the slot as soon as the tail moves
+
+        Head = Ring->Head;
+        Tail = Ring->Tail;
+        while (Tail != Head)
+        {
+            Sample = Ring->Samples[Tail];
+            CountSample(&Sample);
+
+            Tail += 1;
+            if (Tail == Ring->NumberOfSamples)
+            {
+                Tail = 0;
+            }
+
+            Ring->Tail = Tail;
+        }
+
+        Lost += Ring->Lost;
+        Ring = (PKSTACK_SAMPLE_RING)((PCHAR)Ring + Ring->RingSize);
+    }
+
+    return Lost;
+}
+
+
+VOID PrintStacks(VOID)
+{
+    PKSTACK_SAMPLE Stack;
+    PKSTACK_SAMPLE Top;
+    ULONG Printed;
+    ULONG i, j;
+
+    for (Printed = 0; Printed < BENCH_TOP_STACKS; Printed++)
+    {
+        Top = NULL;
+        for (i = 0; i < BENCH_STACKS; i++)
+        {
+            Stack = &Stacks[i];
+            if ((Stack->Count != 0) && ((Top == NULL) || (Stack->Count > Top->Count)))
+            {
+                Top = Stack;
+            }
+        }
+
+        if (Top == NULL)
+        {
+            break;
+        }
+
+        printf("%8u  %4p.%-4p ", Top->Count, Top->UniqueProcess, Top->UniqueThread);
+        for (j = 0; j < Top->Depth; j++)
+        {
+            printf("%s%p", (j == Top->KernelDepth) ? " | " : " ", Top->Frames[j]);
+        }
+
+        printf("\n");
+
+        //  Take it out of the running for the next line
+
+        Top->Count = 0;
+    }
+}
+
+
+main(int argc, char **argv)
+{
+    SYSTEM_BASIC_INFORMATION BasicInfo;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    CLIENT_ID ClientId;
+    LARGE_INTEGER Delay;
+    HANDLE Process;
+    HANDLE Profile;
+    PVOID Buffer;
+    SIZE_T BufferSize;
+    ULONG ProcessId = 0;
+    ULONG Seconds = 10;
+    ULONG Interval = 0;
+    ULONG Reads;
+    ULONG Lost;
+    NTSTATUS Status;
+
+    if (argc > 1)
+    {
+        ProcessId = atoi(argv[1]);
+    }
+
+    if (argc > 2)
+    {
+        Seconds = atoi(argv[2]);
+    }
+
+    if (argc > 3)
+    {
+        Interval = atoi(argv[3]);
+    }
+
+    if (Seconds == 0)
+    {
+        printf("usage: uprof [process id [seconds [interval]]]\n");
+        return 1;
+    }
+
+    Status = NtQuerySystemInformation(SystemBasicInformation, &BasicInfo, sizeof(BasicInfo), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to query the number of processors (%X)\n", Status);
+        return 1;
+    }
+
+    Process = NULL;
+    if (ProcessId != 0)
+    {
+        InitializeObjectAttributes(&ObjectAttributes, NULL, 0, NULL, NULL);
+        ClientId.UniqueProcess = (HANDLE)(ULONG_PTR)ProcessId;
+        ClientId.UniqueThread = NULL;
+        Status = NtOpenProcess(&Process, PROCESS_QUERY_INFORMATION, &ObjectAttributes, &ClientId);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to open process %u (%X)\n", ProcessId, Status);
+            return 1;
+        }
+    }
+
+    Buffer = NULL;
+    BufferSize = BENCH_RING_SIZE * BasicInfo.NumberOfProcessors;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to allocate the sample rings (%X)\n", Status);
+        return 1;
+    }
+
+    if (Interval != 0)
+    {
+        NtSetIntervalProfile(Interval, ProfileTime);
+    }
+
+    Status = NtCreateProfile(&Profile, Process, NULL, 0, PROFILE_STACK_SAMPLES, Buffer, (ULONG)BufferSize, ProfileTime, (KAFFINITY)-1);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtStartProfile(Profile);
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to start the stack sample profile (%X)\n", Status);
+        return 1;
+    }
+
+    //  Read the rings while the profile runs
+
+    Delay.QuadPart = -10 * 1000 * BENCH_READ_DELAY;
+    for (Reads = 0; Reads < (Seconds * 1000) / BENCH_READ_DELAY; Reads++)
+    {
+        NtDelayExecution(FALSE, &Delay);
+        ReadRings(Buffer, BasicInfo.NumberOfProcessors);
+    }
+
+    NtStopProfile(Profile);
+    Lost = ReadRings(Buffer, BasicInfo.NumberOfProcessors);
+    NtClose(Profile);
+
+    printf("%I64u samples  %I64u per sec  %u stacks  %u lost in the rings  %I64u not counted\n",
+           SampleCount, SampleCount / Seconds, StackCount, Lost, DroppedCount);
+
+    PrintStacks();
+
+    if (Process != NULL)
+    {
+        NtClose(Process);
+    }
+
+    return 0;
+}
@@ -30,6 +30,7 @@ Revision History:
 #pragma alloc_text(PAGE, LfsFlushLbcb)
 #pragma alloc_text(PAGE, LfsFlushToLsnPriv)
 #pragma alloc_text(PAGE, LfsGetLbcb)
+#pragma alloc_text(PAGE, LfsJoinGroupCommit)
 #endif
 
 
@@ -169,6 +170,19 @@ Return Value:
     DebugTrace(  0, Dbg, "Lsn (High)    -> %08lx\n", Lsn.HighPart );
 
 
+    //  Let the flush be shared with other threads before choosing what
+    //  to write.  If this returns FALSE our Lsn went out with another
+    //  thread's flush.
+
+
+    if (Lsn.QuadPart > Lfcb->LastFlushedLsn.QuadPart
+        && !LfsJoinGroupCommit( Lfcb, &Lsn )) {
+
+        DebugTrace( -1, Dbg, "LfsFlushToLsnPriv:  Exit\n", 0 );
+        return;
+    }
+
+
     //  We check if the Lsn is in the valid range.  Raising an
     //  exception if not.
 
@@ -495,3 +509,110 @@ Return Value:
 
     return Lbcb;
 }
+
+
+BOOLEAN
+LfsJoinGroupCommit (
+    IN PLFCB Lfcb,
+    IN OUT PLSN Lsn
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called with the Lfcb acquired before flushing an Lsn
+    which is not yet on disk.  It lets concurrent flush requests share a
+    single log write.
+
+    If another thread is writing the log we wait for it rather than close
+    off the current log page and queue behind it.  That write takes every
+    contiguous page on the workque so it often covers our Lsn as well.
+    The largest Lsn anyone is waiting for is left in the Lfcb so that the
+    next thread to flush can take it on.
+
+    If no write is in progress and a commit delay has been set, we mark
+    the write as in progress and drop the Lfcb for the delay.  Other
+    threads may add records to the current page meanwhile, and any that
+    ask for a flush wait for ours.  After the delay we flush up to the
+    largest Lsn requested.
+
+Arguments:
+
+    Lfcb - This is the file control block for the log file.
+
+    Lsn - On input the Lsn the caller must flush.  On output the Lsn to
+        flush, which may be larger if other threads have asked for more.
+
+Return Value:
+
+    BOOLEAN - FALSE if the Lsn has been flushed by another thread and
+        there is nothing more to do, TRUE if the caller should flush.
+
+--*/
+
+{
+    PAGED_CODE();
+
+    if (Lfcb->LfsIoState != LfsNoIoInProgress) {
+
+        if (Lsn->QuadPart > Lfcb->GroupCommitLsn.QuadPart) {
+
+            Lfcb->GroupCommitLsn = *Lsn;
+        }
+
+        while ((Lfcb->LfsIoState != LfsNoIoInProgress)
+               && (Lsn->QuadPart > Lfcb->LastFlushedLsn.QuadPart)) {
+
+            Lfcb->Waiters += 1;
+
+            LfsReleaseLfcb( Lfcb );
+
+            KeWaitForSingleObject( &Lfcb->Sync->Event,
+                                   Executive,
+                                   KernelMode,
+                                   FALSE,
+                                   NULL );
+
+            LfsAcquireLfcb( Lfcb );
+            Lfcb->Waiters -= 1;
+        }
+
+        if (Lsn->QuadPart <= Lfcb->LastFlushedLsn.QuadPart) {
+
+            return FALSE;
+        }
+
+    } else if (LfsData.CommitDelay.QuadPart != 0) {
+
+        Lfcb->LfsIoState = LfsClientThreadIo;
+        KeClearEvent( &Lfcb->Sync->Event );
+
+        LfsReleaseLfcb( Lfcb );
+
+        KeDelayExecutionThread( KernelMode, FALSE, &LfsData.CommitDelay );
+
+        LfsAcquireLfcb( Lfcb );
+
+
+        //  Wake anyone who waited on us.  They will find the write done
+        //  when they get the Lfcb, or do it themselves if we fail.
+
+
+        Lfcb->LfsIoState = LfsNoIoInProgress;
+        KeSetEvent( &Lfcb->Sync->Event, 0, FALSE );
+    }
+
+
+    //  Take on the Lsns of the threads waiting for us.
+
+
+    if (Lfcb->GroupCommitLsn.QuadPart > Lsn->QuadPart) {
+
+        *Lsn = Lfcb->GroupCommitLsn;
+    }
+
+    Lfcb->GroupCommitLsn = LfsZeroLsn;
+
+    return TRUE;
+}
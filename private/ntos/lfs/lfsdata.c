@@ -46,6 +46,14 @@ LARGE_INTEGER LfsLi1 = {0x00000001, 0x00000000};
 
 LSN LfsZeroLsn = {0x00000000, 0x00000000};
 
+
+//  The commit delay in microseconds set when the service is initialized,
+//  read from Control\FileSystem\LfsCommitDelay by
+//  LfsInitializeLogFileService.  See LfsSetCommitDelay.
+
+
+ULONG LfsCommitDelay = 0;
+
 #ifdef LFSDBG
 
 LONG LfsDebugTraceLevel = 0x0000000F;
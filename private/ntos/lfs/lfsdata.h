@@ -36,6 +36,8 @@ extern LFS_DATA LfsData;
 extern LARGE_INTEGER LfsLi0;
 extern LARGE_INTEGER LfsLi1;
 
+extern ULONG LfsCommitDelay;
+
 
 //  The following Lsn is used as a starting point in the file.
 
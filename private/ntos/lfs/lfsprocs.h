@@ -150,6 +150,12 @@ LfsGetLbcb (
     IN PLFCB Lfcb
     );
 
+BOOLEAN
+LfsJoinGroupCommit (
+    IN PLFCB Lfcb,
+    IN OUT PLSN Lsn
+    );
+
 
 
 //  The following routines are in LfsData.c
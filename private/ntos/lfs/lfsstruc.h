@@ -576,6 +576,13 @@ typedef struct _LFCB {
     ULONG Waiters;
 
 
+    //  Largest Lsn that a thread waiting for another thread's flush has
+    //  asked for.  The next thread to flush takes it on.
+
+
+    LSN GroupCommitLsn;
+
+
     //  On-disk value for OpenLogCount.  This is the value we will stuff into
     //  the client handles.
 
@@ -662,6 +669,14 @@ typedef struct _LFS_DATA {
     FAST_MUTEX BufferLock;
     KEVENT BufferNotification;
 
+
+    //  Time a thread flushing the log waits for others to join it, as a
+    //  relative time.  Zero for no delay.  Set by LfsSetCommitDelay, and
+    //  from LfsCommitDelay when the service is initialized.
+
+
+    LARGE_INTEGER CommitDelay;
+
 } LFS_DATA, *PLFS_DATA;
 
 #define LFS_DATA_INIT_FAILED                (0x00000001)
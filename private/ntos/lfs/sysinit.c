@@ -38,6 +38,8 @@ Return Value:
 --*/
 {
     LARGE_INTEGER CurrentTime;
+    RTL_QUERY_REGISTRY_TABLE QueryTable[2];
+    ULONG DefaultCommitDelay = 0;
 
     PAGED_CODE();
 
@@ -62,6 +64,21 @@ Return Value:
     //  Initialize the buffer allocation.  System will be robust enough to tolerate allocation failures.
     ExInitializeFastMutex( &LfsData.BufferLock );
     KeInitializeEvent( &LfsData.BufferNotification, NotificationEvent, TRUE );
+
+    //  Read the group commit delay from Control\FileSystem\LfsCommitDelay.  It stays zero if the value is absent.
+    RtlZeroMemory( QueryTable, sizeof( QueryTable ));
+    QueryTable[0].Flags = RTL_QUERY_REGISTRY_DIRECT;
+    QueryTable[0].Name = L"LfsCommitDelay";
+    QueryTable[0].EntryContext = &LfsCommitDelay;
+    QueryTable[0].DefaultType = REG_DWORD;
+    QueryTable[0].DefaultData = &DefaultCommitDelay;
+    QueryTable[0].DefaultLength = sizeof( ULONG );
+
+    if (!NT_SUCCESS( RtlQueryRegistryValues( RTL_REGISTRY_CONTROL, L"FileSystem", QueryTable, NULL, NULL ))) {
+        LfsCommitDelay = 0;
+    }
+
+    LfsSetCommitDelay( LfsCommitDelay );
     LfsData.Buffer1 = LfsAllocatePoolNoRaise( PagedPool, LFS_BUFFER_SIZE );
 
     if (LfsData.Buffer1 == NULL) {
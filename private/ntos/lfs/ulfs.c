@@ -0,0 +1,165 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    ulfs.c
+
+Abstract:
+    Log file service commit benchmark.  Writer threads each create,
+    write, flush and delete small files in a directory on an NTFS volume
+    as fast as they can.  Every flush of a file whose metadata has
+    changed forces the volume log to disk through LfsFlushToLsn, so the
+    rate of commits and the flush latency show how well concurrent log
+    flushes are shared.  Run with 1, 2, 4 ... threads up to the count
+    given; with group commit the commit rate should rise with the number
+    of threads.
+
+    The group commit delay is set in microseconds by the registry value
+    Control\FileSystem\LfsCommitDelay and takes effect at boot.
+
+    usage: ulfs directory [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_DATA_LENGTH   512
+
+UNICODE_STRING BenchDirectory;
+ULONGLONG CommitTimes[BENCH_MAX_THREADS];
+ULONGLONG MaxCommitTimes[BENCH_MAX_THREADS];
+
+
+ULONG WriterThread(IN PVOID Context)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[512];
+    UCHAR Data[BENCH_DATA_LENGTH];
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Elapsed;
+    HANDLE File;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG Counter = 0;
+
+    RtlFillMemory(Data, sizeof(Data), (UCHAR)ThreadIndex);
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        swprintf(NameBuffer, L"%wZ\\ulfs%02u.%u", &BenchDirectory, ThreadIndex, Counter % 16);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+        NtQueryPerformanceCounter(&Start, NULL);
+
+        Status = NtCreateFile(&File, GENERIC_WRITE | DELETE | SYNCHRONIZE, &ObjectAttributes, &IoStatus, NULL, FILE_ATTRIBUTE_NORMAL, 0, FILE_OVERWRITE_IF, FILE_SYNCHRONOUS_IO_NONALERT | FILE_DELETE_ON_CLOSE, NULL, 0);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Create of %wZ failed (%X)\n", &Name, Status);
+            break;
+        }
+
+        Status = NtWriteFile(File, NULL, NULL, NULL, &IoStatus, Data, sizeof(Data), NULL, NULL);
+        if (NT_SUCCESS(Status))
+        {
+            Status = NtFlushBuffersFile(File, &IoStatus);
+        }
+        NtClose(File);
+
+        NtQueryPerformanceCounter(&End, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Write of %wZ failed (%X)\n", &Name, Status);
+            break;
+        }
+
+        Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+        CommitTimes[ThreadIndex] += Elapsed;
+        if (Elapsed > MaxCommitTimes[ThreadIndex])
+        {
+            MaxCommitTimes[ThreadIndex] = Elapsed;
+        }
+
+        BenchCounts[ThreadIndex] += 1;
+        Counter += 1;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG Commits;
+    ULONGLONG CommitTime;
+    ULONGLONG MaxCommitTime;
+    ULONG i;
+
+    for (i = 0; i < Threads; i++)
+    {
+        CommitTimes[i] = 0;
+        MaxCommitTimes[i] = 0;
+    }
+
+    Commits = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WriterThread, Threads, Seconds, NULL, NULL);
+
+    CommitTime = 0;
+    MaxCommitTime = 0;
+    for (i = 0; i < Threads; i++)
+    {
+        CommitTime += CommitTimes[i];
+        if (MaxCommitTimes[i] > MaxCommitTime)
+        {
+            MaxCommitTime = MaxCommitTimes[i];
+        }
+    }
+
+    printf("%2u threads  %10I64u commits  %8I64u commits/sec  %8I64u us/commit (max %I64u)\n",
+           Threads, Commits, Commits / Seconds, Commits ? CommitTime / Commits : 0, MaxCommitTime);
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 2, 8);
+    Seconds = BenchArgument(argc, argv, 3, 5);
+
+    if ((argc < 2) || (Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: ulfs directory [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &BenchDirectory, NULL, NULL))
+    {
+        printf("Invalid directory %s\n", argv[1]);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        RunBenchmark(n, Seconds);
+    }
+
+    return 0;
+}
@@ -31,6 +31,7 @@ Revision History:
 #pragma alloc_text(PAGE, LfsCheckWriteRange)
 #pragma alloc_text(PAGE, LfsFlushToLsn)
 #pragma alloc_text(PAGE, LfsForceWrite)
+#pragma alloc_text(PAGE, LfsSetCommitDelay)
 #pragma alloc_text(PAGE, LfsWrite)
 #endif
 
@@ -561,3 +562,44 @@ Return Value:
 }
 
 
+VOID
+LfsSetCommitDelay (
+    IN ULONG Microseconds
+    )
+
+/*++
+
+Routine Description:
+
+    This routine is called by a client to set how long a thread flushing
+    a log file waits for other threads to add their records before it
+    writes, so that one write can serve several flush requests.  The
+    delay applies to all log files.  Zero, the default, means no delay.
+    A delay only helps when many threads are committing at once; it adds
+    its full length to every flush otherwise.  The initial delay is
+    LfsCommitDelay, which is read from the registry value
+    Control\FileSystem\LfsCommitDelay.
+
+Arguments:
+
+    Microseconds - This is the delay.
+
+Return Value:
+
+    None
+
+--*/
+
+{
+    PAGED_CODE();
+
+    DebugTrace( +1, Dbg, "LfsSetCommitDelay:  Entered\n", 0 );
+    DebugTrace(  0, Dbg, "Microseconds      -> %08lx\n", Microseconds );
+
+    LfsData.CommitDelay.QuadPart = -10 * (LONGLONG) Microseconds;
+
+    DebugTrace( -1, Dbg, "LfsSetCommitDelay:  Exit\n", 0 );
+
+    return;
+}
+
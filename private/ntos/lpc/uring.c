@@ -0,0 +1,357 @@
+/*++
+
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+
+    uring.c
+
+Abstract:
+
+    User Mode benchmark comparing classic LPC request/reply with the
+    shared memory ring transport in ntdll.  A server thread and a client
+    thread run in the same process.  Each transport is measured for
+    ping-pong latency (one message outstanding) and for streaming
+    throughput (a batch of messages outstanding).
+
+    usage: uring [seconds [batch]]
+
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ubench.c"     // Common benchmark routines
+#include "..\dll\lpcring.h"
+
+#define RING_PORT_NAME      L"\\RPC Control\\LpcRingBench"
+#define RING_SIZE           0x10000
+#define RING_MAX_BATCH      256
+#define BENCH_DATA_LENGTH   16
+
+typedef struct _BENCH_MESSAGE {
+    PORT_MESSAGE h;
+    ULONG Data[ BENCH_DATA_LENGTH / sizeof( ULONG ) ];
+} BENCH_MESSAGE, *PBENCH_MESSAGE;
+
+HANDLE ServerPort;
+
+
+ULONG
+ServerThread(
+    PVOID Context
+    )
+{
+    ULONG_PTR MessageBuffer[ PORT_MAXIMUM_MESSAGE_LENGTH / sizeof( ULONG_PTR ) ];
+    PPORT_MESSAGE Message = (PPORT_MESSAGE)MessageBuffer;
+    PPORT_MESSAGE ReplyMessage;
+    ULONG Data[ BENCH_DATA_LENGTH / sizeof( ULONG ) ];
+    PLPC_RING Ring;
+    HANDLE CommPort;
+    LARGE_INTEGER RetryDelay;
+    ULONG Length;
+    NTSTATUS Status;
+
+    ReplyMessage = NULL;
+    RetryDelay.QuadPart = -10 * 1000;
+
+    while (TRUE) {
+
+        Status = NtReplyWaitReceivePort( ServerPort, (PVOID *)&Ring, ReplyMessage, Message );
+        ReplyMessage = NULL;
+
+        if (!NT_SUCCESS( Status )) {
+
+            break;
+        }
+
+        switch (Message->u2.s2.Type & ~LPC_KERNELMODE_MESSAGE) {
+
+        case LPC_CONNECTION_REQUEST:
+
+            //  Ring connections carry connection info, classic ones do not
+
+            if (Message->u1.s1.DataLength != 0) {
+
+                RtlAcceptLpcRing( Message, NULL, &Ring );
+
+            } else {
+
+                Status = NtAcceptConnectPort( &CommPort, NULL, Message, TRUE, NULL, NULL );
+
+                if (NT_SUCCESS( Status )) {
+
+                    NtCompleteConnectPort( CommPort );
+                }
+            }
+            break;
+
+        case LPC_REQUEST:
+
+            //  Classic request, echo it back with the next receive
+
+            ReplyMessage = Message;
+            break;
+
+        case LPC_DATAGRAM:
+
+            //  Doorbell, echo everything in the request ring
+
+            while (RtlReadLpcRing( Ring, Data, sizeof( Data ), &Length, FALSE ) == STATUS_SUCCESS) {
+
+                //  The benchmark client always drains its replies, so
+                //  wait for it; a real server would reply through the
+                //  port or drop the client instead.
+
+                while (RtlWriteLpcRing( Ring, Data, Length ) == STATUS_CANT_WAIT) {
+
+                    NtDelayExecution( FALSE, &RetryDelay );
+                }
+            }
+            break;
+
+        case LPC_PORT_CLOSED:
+        case LPC_CLIENT_DIED:
+
+            if (Ring != NULL) {
+
+                RtlCloseLpcRing( Ring );
+            }
+            break;
+        }
+    }
+
+    RtlExitUserThread( STATUS_SUCCESS );
+    return 0;
+}
+
+
+VOID
+Report(
+    IN PCHAR Title,
+    IN ULONG Messages,
+    IN LARGE_INTEGER Start,
+    IN LARGE_INTEGER End,
+    IN LARGE_INTEGER Frequency
+    )
+{
+    ULONGLONG Microseconds;
+
+    Microseconds = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+
+    if (Microseconds == 0) {
+
+        Microseconds = 1;
+    }
+
+    printf( "%-24s %10u messages  %10I64u messages/sec  %8I64u ns/message\n",
+            Title,
+            Messages,
+            ((ULONGLONG)Messages * 1000000) / Microseconds,
+            (Microseconds * 1000) / (Messages ? Messages : 1) );
+}
+
+
+VOID
+BenchClassic(
+    IN PUNICODE_STRING PortName,
+    IN PSECURITY_QUALITY_OF_SERVICE Qos,
+    IN ULONG Seconds
+    )
+{
+    BENCH_MESSAGE Request;
+    BENCH_MESSAGE Reply;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    HANDLE Port;
+    ULONG Messages;
+    NTSTATUS Status;
+
+    Status = NtConnectPort( &Port, PortName, Qos, NULL, NULL, NULL, NULL, NULL );
+
+    if (!NT_SUCCESS( Status )) {
+
+        printf( "Classic connect failed (%X)\n", Status );
+        return;
+    }
+
+    if (!BenchStartTimer( Seconds, &Thread )) {
+
+        NtClose( Port );
+        return;
+    }
+
+    Messages = 0;
+    NtQueryPerformanceCounter( &Start, &Frequency );
+
+    while (!StopBenchmark) {
+
+        Request.h.u1.s1.DataLength = BENCH_DATA_LENGTH;
+        Request.h.u1.s1.TotalLength = sizeof( Request );
+        Request.h.u2.ZeroInit = 0;
+        Request.Data[ 0 ] = Messages;
+
+        Status = NtRequestWaitReplyPort( Port, &Request.h, &Reply.h );
+
+        if (!NT_SUCCESS( Status ) || (Reply.Data[ 0 ] != Messages)) {
+
+            printf( "Classic request failed (%X)\n", Status );
+            break;
+        }
+
+        Messages += 1;
+    }
+
+    NtQueryPerformanceCounter( &End, NULL );
+    BenchWaitTimer( Thread );
+    Report( "classic ping-pong", Messages, Start, End, Frequency );
+
+    NtClose( Port );
+}
+
+
+VOID
+BenchRing(
+    IN PUNICODE_STRING PortName,
+    IN PSECURITY_QUALITY_OF_SERVICE Qos,
+    IN ULONG Seconds,
+    IN ULONG Batch
+    )
+{
+    ULONG Data[ BENCH_DATA_LENGTH / sizeof( ULONG ) ];
+    LARGE_INTEGER Start, End, Frequency;
+    CHAR Title[ 32 ];
+    HANDLE Thread;
+    PLPC_RING Ring;
+    ULONG Messages;
+    ULONG Length;
+    ULONG i;
+    NTSTATUS Status;
+
+    Status = RtlConnectLpcRing( PortName, Qos, RING_SIZE, &Ring );
+
+    if (!NT_SUCCESS( Status )) {
+
+        printf( "Ring connect failed (%X)\n", Status );
+        return;
+    }
+
+    RtlZeroMemory( Data, sizeof( Data ) );
+
+    if (!BenchStartTimer( Seconds, &Thread )) {
+
+        RtlCloseLpcRing( Ring );
+        return;
+    }
+
+    Messages = 0;
+    NtQueryPerformanceCounter( &Start, &Frequency );
+
+    while (!StopBenchmark) {
+
+        for (i = 0; i < Batch; i += 1) {
+
+            Data[ 0 ] = Messages + i;
+            Status = RtlWriteLpcRing( Ring, Data, sizeof( Data ) );
+
+            if (!NT_SUCCESS( Status )) {
+
+                break;
+            }
+        }
+
+        for (i = 0; NT_SUCCESS( Status ) && (i < Batch); i += 1) {
+
+            Status = RtlReadLpcRing( Ring, Data, sizeof( Data ), &Length, TRUE );
+
+            if (NT_SUCCESS( Status ) && (Data[ 0 ] != Messages + i)) {
+
+                Status = STATUS_DATA_ERROR;
+            }
+        }
+
+        if (!NT_SUCCESS( Status )) {
+
+            printf( "Ring transfer failed (%X)\n", Status );
+            break;
+        }
+
+        Messages += Batch;
+    }
+
+    NtQueryPerformanceCounter( &End, NULL );
+    BenchWaitTimer( Thread );
+
+    sprintf( Title, Batch == 1 ? "ring ping-pong" : "ring batch %u", Batch );
+    Report( Title, Messages, Start, End, Frequency );
+
+    printf( "%-24s %10u doorbells sent, %u wakeups\n", "", Ring->DoorbellsSent, Ring->Wakeups );
+
+    RtlCloseLpcRing( Ring );
+}
+
+
+int
+main(
+    int argc,
+    char *argv[]
+    )
+{
+    SECURITY_QUALITY_OF_SERVICE Qos;
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING PortName;
+    HANDLE Thread;
+    ULONG Seconds;
+    ULONG Batch;
+    NTSTATUS Status;
+
+    Seconds = BenchArgument( argc, argv, 1, 5 );
+    Batch = BenchArgument( argc, argv, 2, 64 );
+
+    if ((Seconds == 0) || (Batch == 0) || (Batch > RING_MAX_BATCH)) {
+
+        printf( "usage: uring [seconds [batch (1-%u)]]\n", RING_MAX_BATCH );
+        return 1;
+    }
+
+    RtlInitUnicodeString( &PortName, RING_PORT_NAME );
+    InitializeObjectAttributes( &ObjectAttributes, &PortName, 0, NULL, NULL );
+
+    Status = NtCreatePort( &ServerPort,
+                           &ObjectAttributes,
+                           sizeof( LPC_RING_CONNECT_INFO ),
+                           sizeof( BENCH_MESSAGE ),
+                           0 );
+
+    if (!NT_SUCCESS( Status )) {
+
+        printf( "Unable to create %wZ (%X)\n", &PortName, Status );
+        return 1;
+    }
+
+    Status = RtlCreateUserThread( NtCurrentProcess(), NULL, FALSE, 0, 0, 0,
+                                  (PUSER_THREAD_START_ROUTINE)ServerThread,
+                                  NULL, &Thread, NULL );
+
+    if (!NT_SUCCESS( Status )) {
+
+        printf( "Unable to create server thread (%X)\n", Status );
+        return 1;
+    }
+
+    Qos.Length = sizeof( Qos );
+    Qos.ImpersonationLevel = SecurityImpersonation;
+    Qos.ContextTrackingMode = SECURITY_STATIC_TRACKING;
+    Qos.EffectiveOnly = TRUE;
+
+    BenchClassic( &PortName, &Qos, Seconds );
+    BenchRing( &PortName, &Qos, Seconds, 1 );
+    BenchRing( &PortName, &Qos, Seconds, Batch );
+
+    NtClose( ServerPort );
+    NtClose( Thread );
+
+    return 0;
+}
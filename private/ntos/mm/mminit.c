@@ -2067,6 +2067,19 @@ NTKERNELAPI VOID FASTCALL MmSetPageFaultNotifyRoutine(PPAGE_FAULT_NOTIFY_ROUTINE
 }
 
 
+PPAGE_FAULT_NOTIFY_ROUTINE FASTCALL MmExchangePageFaultNotifyRoutine(IN PPAGE_FAULT_NOTIFY_ROUTINE NotifyRoutine, IN PPAGE_FAULT_NOTIFY_ROUTINE Comparand)
+/*++
+Routine Description:
+    This function sets the page fault notify routine only if the routine set now is Comparand,
+    so that a caller neither replaces a routine someone else set nor clears one that replaced its own.
+Return Value:
+    The routine that was set before the call.  NotifyRoutine was set if this is Comparand.
+--*/
+{
+    return (PPAGE_FAULT_NOTIFY_ROUTINE)InterlockedCompareExchangePointer((PVOID *)&MmPageFaultNotifyRoutine, (PVOID)NotifyRoutine, (PVOID)Comparand);
+}
+
+
 NTKERNELAPI VOID FASTCALL MmSetHardFaultNotifyRoutine(PHARD_FAULT_NOTIFY_ROUTINE NotifyRoutine)
 {
     MmHardFaultNotifyRoutine = NotifyRoutine;
@@ -150,6 +150,7 @@ Environment:
     PMMWSLE Wsle;
     ULONG QuotaIncrement;
     BOOLEAN MustReplace;
+    PEPROCESS Process;
 
     MustReplace = FALSE;
     WorkingSetList = WsInfo->VmWorkingSetList;
@@ -162,6 +163,13 @@ Environment:
     WsInfo->PageFaultCount += 1;
     MmInfoCounters.PageFaultCount += 1;
 
+    if ((WsInfo != &MmSystemCacheWs) && (WsInfo->u.Flags.SessionSpace == 0)) {
+        Process = CONTAINING_RECORD(WsInfo, EPROCESS, Vm);
+        if (Process->Job != NULL) {
+            PsChargeJobUsage (Process, PsJobPageFaultCount, 1);
+        }
+    }
+
 
     // Determine if a page should be removed from the working set to make
     // room for the new page.  If so, remove it.  In addition, determine
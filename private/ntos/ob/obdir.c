@@ -25,9 +25,45 @@ Revision History:
 #pragma alloc_text(PAGE,NtOpenDirectoryObject)
 #pragma alloc_text(PAGE,NtQueryDirectoryObject)
 #pragma alloc_text(PAGE,ObpLookupDirectoryEntry)
+#pragma alloc_text(PAGE,ObpDeleteDirectory)
+#pragma alloc_text(PAGE,ObpGrowDirectory)
+#pragma alloc_text(PAGE,ObpProbeNameCache)
+#pragma alloc_text(PAGE,ObpInsertNameCache)
+#pragma alloc_text(INIT,ObpInitNameCache)
 #endif
 
 
+//  Bucket array sizes a directory steps through as it grows
+
+
+ULONG ObpDirectoryBucketSizes[] = { NUMBER_HASH_BUCKETS, 149, 599, 2399, 9587, 38351 };
+
+#define OBP_DIRECTORY_BUCKET_SIZES (sizeof( ObpDirectoryBucketSizes ) / sizeof( ULONG ))
+
+VOID
+ObpGrowDirectory (
+    IN POBJECT_DIRECTORY Directory
+    );
+
+BOOLEAN
+ObpProbeNameCache (
+    IN PUNICODE_STRING ObjectName,
+    IN ULONG Attributes,
+    OUT PVOID *Object,
+    OUT PUSHORT PrefixLength,
+    OUT POBJECT_DIRECTORY *Directory,
+    OUT POBJECT_DIRECTORY *ParentDirectory
+    );
+
+VOID
+ObpInsertNameCache (
+    IN POBP_NAME_CACHE_WALK Walk,
+    IN PWCH NameEnd,
+    IN ULONG Attributes,
+    IN PVOID Object OPTIONAL
+    );
+
+
 NTSTATUS
 NtCreateDirectoryObject (
     OUT PHANDLE DirectoryHandle,
@@ -381,10 +417,11 @@ Return Value:
 
 
     //  Lock down the directory structures for the life of this
-    //  procedure
+    //  procedure.  Enumeration does not modify the directory so the
+    //  lock is only needed shared.
 
 
-    ObpEnterRootDirectoryMutex();
+    ObpEnterRootDirectoryMutexShared();
 
 
     //  DirInfo is used to march through the output buffer filling
@@ -415,9 +452,9 @@ Return Value:
     //  Our outer loop processes each hash bucket in the directory object
 
 
-    for (Bucket=0; Bucket<NUMBER_HASH_BUCKETS; Bucket++) {
+    for (Bucket=0; Bucket<ObpDirectoryBucketCount( Directory ); Bucket++) {
 
-        DirectoryEntry = Directory->HashBuckets[ Bucket ];
+        DirectoryEntry = ObpDirectoryBuckets( Directory )[ Bucket ];
 
 
         //  For this hash bucket we'll zip through its list of entries.
@@ -737,6 +774,7 @@ Return Value:
     POBJECT_HEADER_NAME_INFO NameInfo;
     PWCH Buffer;
     WCHAR Wchar;
+    ULONG HashValue;
     ULONG HashIndex;
     ULONG WcharLength;
     BOOLEAN CaseInSensitive;
@@ -782,33 +820,23 @@ Return Value:
 
 
     //  Compute the address of the head of the bucket chain for this name.
+    //  The full hash value is remembered so that a following insert can
+    //  store it in the new directory entry.
 
 
-    HashIndex = 0;
+    HashValue = 0;
     while (WcharLength--) {
 
         Wchar = *Buffer++;
-        HashIndex += (HashIndex << 1) + (HashIndex >> 1);
-
-        if (Wchar < 'a') {
-
-            HashIndex += Wchar;
-
-        } else if (Wchar > 'z') {
-
-            HashIndex += RtlUpcaseUnicodeChar( Wchar );
-
-        } else {
-
-            HashIndex += (Wchar - ('a'-'A'));
-        }
+        ObpHashNameCharacter( HashValue, Wchar );
     }
 
-    HashIndex %= NUMBER_HASH_BUCKETS;
+    HashIndex = HashValue % ObpDirectoryBucketCount( Directory );
 
-    HeadDirectoryEntry = (POBJECT_DIRECTORY_ENTRY *)&Directory->HashBuckets[ HashIndex ];
+    HeadDirectoryEntry = &ObpDirectoryBuckets( Directory )[ HashIndex ];
 
     Directory->LookupBucket = HeadDirectoryEntry;
+    Directory->LookupHash = HashValue;
 
 
     //  Walk the chain of directory entries for this hash bucket, looking
@@ -818,6 +846,17 @@ Return Value:
     while ((DirectoryEntry = *HeadDirectoryEntry) != NULL) {
 
 
+        //  Entries with a different hash value cannot match so skip them
+        //  without touching the object header
+
+
+        if (DirectoryEntry->HashValue != HashValue) {
+
+            HeadDirectoryEntry = &DirectoryEntry->ChainLink;
+            continue;
+        }
+
+
         //  Get the object header and name from the object body
 
         //  This function assumes the name must exist, otherwise it
@@ -970,6 +1009,20 @@ Return Value:
     }
 
 
+    //  If the directory is getting crowded then move it to a larger
+    //  bucket array before linking in the new entry.  The insertion point
+    //  found by the lookup has to be recomputed if the array changed.
+
+
+    if (Directory->EntryCount >= ObpDirectoryBucketCount( Directory ) * OBP_DIRECTORY_LOAD_FACTOR) {
+
+        ObpGrowDirectory( Directory );
+
+        HeadDirectoryEntry = &ObpDirectoryBuckets( Directory )[ Directory->LookupHash % ObpDirectoryBucketCount( Directory ) ];
+        Directory->LookupBucket = HeadDirectoryEntry;
+    }
+
+
     //  Link the new entry into the chain at the insertion point.
     //  This puts the new object right at the head of the current
     //  hash bucket chain
@@ -978,6 +1031,10 @@ Return Value:
     NewDirectoryEntry->ChainLink = *HeadDirectoryEntry;
     *HeadDirectoryEntry = NewDirectoryEntry;
     NewDirectoryEntry->Object = Object;
+    NewDirectoryEntry->HashValue = Directory->LookupHash;
+
+    Directory->EntryCount += 1;
+    Directory->ChangeCount += 1;
 
 
     //  Point the object header back to the directory we just inserted
@@ -1060,6 +1117,9 @@ Return Value:
 
     ExFreePool( DirectoryEntry );
 
+    Directory->EntryCount -= 1;
+    Directory->ChangeCount += 1;
+
 
     //  Return success
 
@@ -1068,6 +1128,149 @@ Return Value:
 }
 
 
+VOID
+ObpGrowDirectory (
+    IN POBJECT_DIRECTORY Directory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine moves the entries of a directory into the next larger
+    bucket array.  The caller must hold the root directory mutex
+    exclusive.  If the directory is already at the largest size or the
+    new array cannot be allocated the directory is left unchanged.
+
+    Note that this invalidates the LookupBucket set by the last lookup.
+
+Arguments:
+
+    Directory - Supplies the directory being grown
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    POBJECT_DIRECTORY_ENTRY *OldBuckets;
+    POBJECT_DIRECTORY_ENTRY *NewBuckets;
+    POBJECT_DIRECTORY_ENTRY *HeadDirectoryEntry;
+    POBJECT_DIRECTORY_ENTRY DirectoryEntry;
+    ULONG OldCount;
+    ULONG NewCount;
+    ULONG Bucket;
+    ULONG i;
+
+    PAGED_CODE();
+
+    OldBuckets = ObpDirectoryBuckets( Directory );
+    OldCount = ObpDirectoryBucketCount( Directory );
+
+
+    //  Pick the next size up, if there is one
+
+
+    for (i = 0; i < OBP_DIRECTORY_BUCKET_SIZES; i += 1) {
+
+        if (ObpDirectoryBucketSizes[ i ] > OldCount) {
+
+            break;
+        }
+    }
+
+    if (i == OBP_DIRECTORY_BUCKET_SIZES) {
+
+        return;
+    }
+
+    NewCount = ObpDirectoryBucketSizes[ i ];
+
+    NewBuckets = ExAllocatePoolWithTag( PagedPool,
+                                        NewCount * sizeof( POBJECT_DIRECTORY_ENTRY ),
+                                        'dHbO' );
+
+    if (NewBuckets == NULL) {
+
+        return;
+    }
+
+    RtlZeroMemory( NewBuckets, NewCount * sizeof( POBJECT_DIRECTORY_ENTRY ) );
+
+
+    //  Move every entry over using the hash value saved when it was
+    //  inserted.  The names themselves are not looked at.
+
+
+    for (Bucket = 0; Bucket < OldCount; Bucket += 1) {
+
+        while ((DirectoryEntry = OldBuckets[ Bucket ]) != NULL) {
+
+            OldBuckets[ Bucket ] = DirectoryEntry->ChainLink;
+
+            HeadDirectoryEntry = &NewBuckets[ DirectoryEntry->HashValue % NewCount ];
+
+            DirectoryEntry->ChainLink = *HeadDirectoryEntry;
+            *HeadDirectoryEntry = DirectoryEntry;
+        }
+    }
+
+    if (Directory->Buckets != NULL) {
+
+        ExFreePool( Directory->Buckets );
+    }
+
+    Directory->Buckets = NewBuckets;
+    Directory->BucketCount = NewCount;
+    Directory->LookupBucket = NULL;
+
+    ObpDirectoryGrowCount += 1;
+
+    return;
+}
+
+
+VOID
+ObpDeleteDirectory (
+    IN PVOID Object
+    )
+
+/*++
+
+Routine Description:
+
+    This is the delete procedure for directory objects.  It frees the
+    bucket array if the directory had grown beyond the embedded one.
+
+Arguments:
+
+    Object - Supplies the directory object being deleted
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    POBJECT_DIRECTORY Directory;
+
+    PAGED_CODE();
+
+    Directory = (POBJECT_DIRECTORY)Object;
+
+    if (Directory->Buckets != NULL) {
+
+        ExFreePool( Directory->Buckets );
+        Directory->Buckets = NULL;
+    }
+
+    return;
+}
+
+
 NTSTATUS
 ObpLookupObjectName (
     IN HANDLE RootDirectoryHandle OPTIONAL,
@@ -1150,6 +1353,8 @@ Return Value:
     BOOLEAN Reparse;
     ULONG MaxReparse = OBJ_MAX_REPARSE_ATTEMPTS;
     OB_PARSE_METHOD ParseProcedure;
+    OBP_NAME_CACHE_WALK Walk;
+    USHORT PrefixLength;
     extern POBJECT_TYPE IoFileObjectType;
 
     ObpValidateIrql( "ObpLookupObjectName" );
@@ -1164,6 +1369,7 @@ Return Value:
     Status = STATUS_SUCCESS;
 
     Object = NULL;
+    Walk.Valid = FALSE;
 
 
     //  Check if the caller has given us a directory to search.  Otherwise
@@ -1608,6 +1814,79 @@ Return Value:
 
         RemainingName = *ObjectName;
 
+
+        //  An open of an existing object by a root relative name can
+        //  usually be satisfied from the name cache.  The cache only
+        //  records the result of the directory walk itself so it is not
+        //  used if the caller would need traverse checks along the way.
+        //  A hit returns with the root directory mutex held shared.
+
+
+        Walk.Valid = FALSE;
+
+        if (ObpNameCacheEnabled &&
+            (RootDirectory == ObpRootDirectoryObject) &&
+            !ARGUMENT_PRESENT( RootDirectoryHandle ) &&
+            !ARGUMENT_PRESENT( InsertObject ) &&
+            (AccessState->Flags & TOKEN_HAS_TRAVERSE_PRIVILEGE) &&
+            !*DirectoryLocked &&
+            (RemainingName.Length != 0) &&
+            (*(RemainingName.Buffer) == OBJ_NAME_PATH_SEPARATOR)) {
+
+            if (ObpProbeNameCache( &RemainingName,
+                                   Attributes,
+                                   &Object,
+                                   &PrefixLength,
+                                   &Directory,
+                                   &ParentDirectory )) {
+
+                *DirectoryLocked = TRUE;
+                Reparse = FALSE;
+
+                RemainingName.Buffer += PrefixLength / sizeof( WCHAR );
+                RemainingName.Length -= PrefixLength;
+
+
+                //  A positive hit is either the whole name or an object
+                //  with a parse routine, so pick up exactly where the
+                //  directory walk would have.
+
+
+                if (Object != NULL) {
+
+                    goto ReparseObject;
+                }
+
+
+                //  A negative hit means some component along the way is
+                //  known not to exist.
+
+
+                ObpLeaveRootDirectoryMutex();
+                *DirectoryLocked = FALSE;
+
+                if (RemainingName.Length == 0) {
+
+                    Status = STATUS_OBJECT_NAME_NOT_FOUND;
+
+                } else {
+
+                    Status = STATUS_OBJECT_PATH_NOT_FOUND;
+                }
+
+                break;
+            }
+
+
+            //  Remember the walk so its outcome can be cached
+
+
+            Walk.Valid = TRUE;
+            Walk.Depth = 1;
+            Walk.NameStart = RemainingName.Buffer;
+            Walk.Directories[ 0 ] = RootDirectory;
+        }
+
 quickStart:
 
         Reparse = FALSE;
@@ -1703,6 +1982,15 @@ quickStart:
             if (!Object) {
 
 
+                //  Remember that this component does not exist
+
+
+                if (!InsertObject) {
+
+                    ObpInsertNameCache( &Walk, RemainingName.Buffer, Attributes, NULL );
+                }
+
+
                 //  We didn't find the object.  If there is some remaining
                 //  name left (meaning the component name is a directory in
                 //  path we trying to break) or the caller didn't specify an
@@ -1819,6 +2107,14 @@ ReparseObject:
                 KIRQL SaveIrql;
 
 
+                //  The walk ends here, so remember which object the name
+                //  prefix resolved to before the lock is dropped
+
+
+                ObpInsertNameCache( &Walk, RemainingName.Buffer, Attributes, Object );
+                Walk.Valid = FALSE;
+
+
                 //  Reference the object and then free the directory lock
                 //  This will keep the object from going away with the
                 //  directory unlocked
@@ -2039,6 +2335,10 @@ ReparseObject:
                         if (!NT_SUCCESS( Status )) {
 
                             Object = NULL;
+
+                        } else {
+
+                            ObpInsertNameCache( &Walk, RemainingName.Buffer, Attributes, Object );
                         }
                     }
 
@@ -2058,6 +2358,18 @@ ReparseObject:
                         ParentDirectory = Directory;
                         Directory = (POBJECT_DIRECTORY)Object;
 
+                        if (Walk.Valid) {
+
+                            if (Walk.Depth < OBP_NAME_CACHE_MAX_DEPTH) {
+
+                                Walk.Directories[ Walk.Depth++ ] = Directory;
+
+                            } else {
+
+                                Walk.Valid = FALSE;
+                            }
+                        }
+
                     } else {
 
 
@@ -2143,3 +2455,328 @@ ReparseObject:
 }
 
 
+VOID
+ObpInitNameCache (
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This routine allocates the object name lookup cache.  If the
+    allocation fails the cache stays disabled.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    ObpNameCache = ExAllocatePoolWithTag( PagedPool,
+                                          OBP_NAME_CACHE_ENTRIES * sizeof( OBP_NAME_CACHE_ENTRY ),
+                                          'CNbO' );
+
+    if (ObpNameCache != NULL) {
+
+        RtlZeroMemory( ObpNameCache, OBP_NAME_CACHE_ENTRIES * sizeof( OBP_NAME_CACHE_ENTRY ) );
+
+        ObpNameCacheEnabled = TRUE;
+    }
+
+    return;
+}
+
+
+BOOLEAN
+ObpProbeNameCache (
+    IN PUNICODE_STRING ObjectName,
+    IN ULONG Attributes,
+    OUT PVOID *Object,
+    OUT PUSHORT PrefixLength,
+    OUT POBJECT_DIRECTORY *Directory,
+    OUT POBJECT_DIRECTORY *ParentDirectory
+    )
+
+/*++
+
+Routine Description:
+
+    This routine looks for the longest prefix of a root relative object
+    name that has a valid entry in the name cache.  Only prefixes that end
+    at a component boundary are considered.
+
+    The caller must not hold the root directory mutex.  If an entry is
+    found this routine returns with the mutex held shared, which keeps the
+    returned object and directories from leaving the name space.
+
+Arguments:
+
+    ObjectName - Supplies the name being looked up.  It must start with
+        a path separator.
+
+    Attributes - Supplies the lookup attributes.  Only OBJ_CASE_INSENSITIVE
+        is used.
+
+    Object - Receives the object the prefix resolved to, or NULL if the
+        last component of the prefix is known not to exist
+
+    PrefixLength - Receives the length in bytes of the matched prefix
+
+    Directory - Receives the directory that contains the last component
+        of the prefix
+
+    ParentDirectory - Receives the parent of Directory, or NULL if
+        Directory is the root
+
+Return Value:
+
+    TRUE if a cache entry was found and FALSE otherwise.
+
+--*/
+
+{
+    ULONG Hashes[ OBP_NAME_CACHE_MAX_DEPTH ];
+    USHORT Lengths[ OBP_NAME_CACHE_MAX_DEPTH ];
+    ULONG Prefixes;
+    ULONG Hash;
+    ULONG Index;
+    ULONG Length;
+    ULONG Depth;
+    WCHAR Wchar;
+    BOOLEAN CaseInSensitive;
+    POBP_NAME_CACHE_ENTRY Entry;
+    POBJECT_HEADER ObjectHeader;
+    UNICODE_STRING Prefix;
+    UNICODE_STRING CachedName;
+
+    PAGED_CODE();
+
+    CaseInSensitive = (BOOLEAN)((Attributes & OBJ_CASE_INSENSITIVE) != 0);
+
+
+    //  Hash the name once, noting the hash of every prefix that ends just
+    //  before a separator.  Entries are never deeper than the maximum
+    //  depth so there is no point looking past that many components.
+
+
+    Prefixes = 0;
+    Hash = 0;
+    Length = ObjectName->Length / sizeof( WCHAR );
+
+    for (Index = 0; (Index < Length) && (Index <= OBP_NAME_CACHE_MAX_NAME); Index += 1) {
+
+        Wchar = ObjectName->Buffer[ Index ];
+
+        if ((Wchar == OBJ_NAME_PATH_SEPARATOR) && (Index != 0)) {
+
+            Hashes[ Prefixes ] = Hash;
+            Lengths[ Prefixes ] = (USHORT)(Index * sizeof( WCHAR ));
+
+            if (++Prefixes == OBP_NAME_CACHE_MAX_DEPTH) {
+
+                break;
+            }
+        }
+
+        ObpHashNameCharacter( Hash, Wchar );
+    }
+
+    if ((Index == Length) &&
+        (Length <= OBP_NAME_CACHE_MAX_NAME) &&
+        (Prefixes < OBP_NAME_CACHE_MAX_DEPTH)) {
+
+        Hashes[ Prefixes ] = Hash;
+        Lengths[ Prefixes ] = ObjectName->Length;
+        Prefixes += 1;
+    }
+
+    if (Prefixes == 0) {
+
+        ObpNameCacheMisses += 1;
+
+        return( FALSE );
+    }
+
+    ObpEnterRootDirectoryMutexShared();
+
+
+    //  Try the longest prefix first
+
+
+    while (Prefixes-- != 0) {
+
+        Entry = &ObpNameCache[ Hashes[ Prefixes ] & (OBP_NAME_CACHE_ENTRIES - 1) ];
+
+        if ((Entry->Depth == 0) ||
+            (Entry->Hash != Hashes[ Prefixes ]) ||
+            (Entry->NameLength != Lengths[ Prefixes ]) ||
+            (Entry->CaseInSensitive != CaseInSensitive)) {
+
+            continue;
+        }
+
+        Prefix.Buffer = ObjectName->Buffer;
+        Prefix.Length = Lengths[ Prefixes ];
+        Prefix.MaximumLength = Lengths[ Prefixes ];
+
+        CachedName.Buffer = Entry->Name;
+        CachedName.Length = Entry->NameLength;
+        CachedName.MaximumLength = Entry->NameLength;
+
+        if (!RtlEqualUnicodeString( &Prefix, &CachedName, CaseInSensitive )) {
+
+            continue;
+        }
+
+
+        //  Check the directories from the root down.  Each unchanged
+        //  directory guarantees that the next one is still in it and
+        //  therefore still exists.
+
+
+        for (Depth = 0; Depth < Entry->Depth; Depth += 1) {
+
+            if (Entry->Directories[ Depth ]->ChangeCount != Entry->ChangeCounts[ Depth ]) {
+
+                break;
+            }
+        }
+
+        if (Depth != Entry->Depth) {
+
+            continue;
+        }
+
+
+        //  An object that is only a prefix of the name is useful only if
+        //  it has a parse routine.  Otherwise the rest of the name would
+        //  have to be walked with the lock held shared.
+
+
+        if ((Entry->Object != NULL) &&
+            (Lengths[ Prefixes ] != ObjectName->Length)) {
+
+            ObjectHeader = OBJECT_TO_OBJECT_HEADER( Entry->Object );
+
+            if (ObjectHeader->Type->TypeInfo.ParseProcedure == NULL) {
+
+                continue;
+            }
+        }
+
+        *Object = Entry->Object;
+        *PrefixLength = Lengths[ Prefixes ];
+        *Directory = Entry->Directories[ Entry->Depth - 1 ];
+        *ParentDirectory = (Entry->Depth > 1) ? Entry->Directories[ Entry->Depth - 2 ] : NULL;
+
+        if (Entry->Object != NULL) {
+
+            ObpNameCacheHits += 1;
+
+        } else {
+
+            ObpNameCacheNegativeHits += 1;
+        }
+
+        return( TRUE );
+    }
+
+    ObpLeaveRootDirectoryMutex();
+
+    ObpNameCacheMisses += 1;
+
+    return( FALSE );
+}
+
+
+VOID
+ObpInsertNameCache (
+    IN POBP_NAME_CACHE_WALK Walk,
+    IN PWCH NameEnd,
+    IN ULONG Attributes,
+    IN PVOID Object OPTIONAL
+    )
+
+/*++
+
+Routine Description:
+
+    This routine records the outcome of a directory walk in the name
+    cache, replacing whatever entry occupied the slot.  The caller must
+    hold the root directory mutex exclusive.
+
+Arguments:
+
+    Walk - Supplies the directories traversed by the lookup.  Nothing is
+        recorded unless the walk is valid.
+
+    NameEnd - Supplies a pointer just past the last character of the name
+        prefix that was resolved
+
+    Attributes - Supplies the lookup attributes
+
+    Object - Supplies the object the prefix resolved to, or NULL if the
+        last component was not found in the last directory of the walk
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    POBP_NAME_CACHE_ENTRY Entry;
+    ULONG NameLength;
+    ULONG Hash;
+    ULONG Index;
+    WCHAR Wchar;
+
+    PAGED_CODE();
+
+    if (!Walk->Valid) {
+
+        return;
+    }
+
+    NameLength = (ULONG)((PCHAR)NameEnd - (PCHAR)Walk->NameStart);
+
+    if ((NameLength == 0) || (NameLength > OBP_NAME_CACHE_MAX_NAME * sizeof( WCHAR ))) {
+
+        return;
+    }
+
+    Hash = 0;
+
+    for (Index = 0; Index < NameLength / sizeof( WCHAR ); Index += 1) {
+
+        Wchar = Walk->NameStart[ Index ];
+        ObpHashNameCharacter( Hash, Wchar );
+    }
+
+    Entry = &ObpNameCache[ Hash & (OBP_NAME_CACHE_ENTRIES - 1) ];
+
+    Entry->Hash = Hash;
+    Entry->NameLength = (USHORT)NameLength;
+    Entry->CaseInSensitive = (BOOLEAN)((Attributes & OBJ_CASE_INSENSITIVE) != 0);
+    Entry->Object = Object;
+
+    for (Index = 0; Index < Walk->Depth; Index += 1) {
+
+        Entry->Directories[ Index ] = Walk->Directories[ Index ];
+        Entry->ChangeCounts[ Index ] = Walk->Directories[ Index ]->ChangeCount;
+    }
+
+    Entry->Depth = (UCHAR)Walk->Depth;
+
+    RtlCopyMemory( Entry->Name, Walk->NameStart, NameLength );
+
+    ObpNameCacheInserts += 1;
+
+    return;
+}
@@ -102,6 +102,8 @@ KMUTANT ObpInitKillMutant;
 ULONG ObpProtectionMode;
 ULONG ObpAuditBaseDirectories;
 ULONG ObpAuditBaseObjects;
+ULONG ObpReferenceSampleInterval;
+ULONG ObpShardedReferenceThreshold;
 
 
 //  These are global variables
@@ -317,6 +319,7 @@ Return Value:
         ObjectTypeInitializer.GenericMapping = ObpDirectoryMapping;
         ObjectTypeInitializer.UseDefaultObject = FALSE;
         ObjectTypeInitializer.MaintainTypeList = FALSE;
+        ObjectTypeInitializer.DeleteProcedure = ObpDeleteDirectory;
         ObCreateObjectType( &DirectoryTypeName,
                             &ObjectTypeInitializer,
                             (PSECURITY_DESCRIPTOR)NULL,
@@ -343,6 +346,19 @@ Return Value:
 
         ExInitializeResourceLite( &ObpRootDirectoryMutex );
 
+
+        //  Allocate the object name lookup cache.  If this fails lookups
+        //  simply always take the directory walk.
+
+
+        ObpInitNameCache();
+
+
+        //  Initialize the sharded reference counts and the reference sampler
+
+
+        ObpInitReferenceSharding();
+
 #if i386 && !FPO
 
 
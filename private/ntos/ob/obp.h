@@ -108,12 +108,33 @@ BOOLEAN FASTCALL ObpDecrHandleCount (IN POBJECT_HEADER ObjectHeader);
 
 #else
 
-#define ObpIncrPointerCount(np)           InterlockedIncrement( &np->PointerCount )
-#define ObpDecrPointerCount(np)           InterlockedDecrement( &np->PointerCount )
-#define ObpDecrPointerCountWithResult(np) (InterlockedDecrement( &np->PointerCount ) == 0)
+//  Objects with sharded references keep their pointer count changes in
+//  per processor counters, see obref.c.  Everything else goes straight to
+//  the pointer count in the header.
+
+#define ObpIncrPointerCount(np)                                  \
+    (((np)->Flags & OB_FLAG_SHARDED_REFERENCES) ?                \
+        ObpIncrShardedPointerCount( np ) :                       \
+        InterlockedIncrement( &np->PointerCount ))
+
+#define ObpDecrPointerCount(np)                                  \
+    (((np)->Flags & OB_FLAG_SHARDED_REFERENCES) ?                \
+        ObpDecrShardedPointerCount( np ) :                       \
+        InterlockedDecrement( &np->PointerCount ))
+
+#define ObpDecrPointerCountWithResult(np) (ObpDecrPointerCount( np ) == 0)
 
 #define ObpIncrHandleCount(np)            InterlockedIncrement( &np->HandleCount )
-#define ObpDecrHandleCount(np)            (InterlockedDecrement( &np->HandleCount ) == 0)
+
+//  The last handle to an object with sharded references queues the object
+//  for reconciliation, which must happen before it can be deleted.  All
+//  callers hold the object type mutex.
+
+#define ObpDecrHandleCount(np)                                   \
+    ((InterlockedDecrement( &np->HandleCount ) == 0) ?           \
+        ((((np)->Flags & OB_FLAG_SHARDED_REFERENCES) ?           \
+            ObpQueueShardReconcile( np ) : (VOID)0), TRUE) :     \
+        FALSE)
 
 #endif // MPSAVE_HANDLE_COUNT_CHECK
 
@@ -146,6 +167,17 @@ BOOLEAN FASTCALL ObpDecrHandleCount (IN POBJECT_HEADER ObjectHeader);
 }
 
 
+//  VOID ObpEnterRootDirectoryMutexShared (VOID)
+//  Readers that neither modify a directory nor rely on the LookupBucket
+//  state left behind by ObpLookupDirectoryEntry may hold the lock shared.
+//  ObpLeaveRootDirectoryMutex releases either kind of acquisition.
+#define ObpEnterRootDirectoryMutexShared() {                   \
+    ObpValidateIrql("ObpEnterRootDirectoryMutexShared");       \
+    KeEnterCriticalRegion();                                   \
+    ExAcquireResourceSharedLite(&ObpRootDirectoryMutex, TRUE); \
+}
+
+
 //  VOID ObpLeaveRootDirectoryMutex (VOID)
 #define ObpLeaveRootDirectoryMutex() {             \
     ExReleaseResource(&ObpRootDirectoryMutex);     \
@@ -224,9 +256,15 @@ PACCESS_MASK ObpCachedGrantedAccesses;
 //  Cache entry header.
 
 
+//  The reference count is only changed with interlocked operations.  It
+//  may be raised under the lock of the shard holding the entry shared and
+//  lowered without any lock, except that the last reference is only ever
+//  removed with the shard lock held exclusive.
+
+
 typedef struct _SECURITY_DESCRIPTOR_HEADER {
     LIST_ENTRY Link;
-    ULONG  RefCount;
+    LONG   RefCount;
     ULONG  FullHash;
     QUAD   SecurityDescriptor;
 } SECURITY_DESCRIPTOR_HEADER, *PSECURITY_DESCRIPTOR_HEADER;
@@ -242,25 +280,40 @@ typedef struct _SECURITY_DESCRIPTOR_HEADER {
     CONTAINING_RECORD( (_link), SECURITY_DESCRIPTOR_HEADER, Link )
 
 
-//  Macros to traverse a list of security descriptors forwards and backwards
-#define NEXT_SDHEADER(_sdh) (                                                 \
-    (_sdh)->Link.Flink == NULL ? NULL :                                       \
-    CONTAINING_RECORD( (_sdh)->Link.Flink, SECURITY_DESCRIPTOR_HEADER, Link ) \
-)
+//  The cache is split by hash into shards, each with its own lock and its
+//  own table of hash buckets.  The bucket table of a shard starts with
+//  SECURITY_DESCRIPTOR_CACHE_ENTRIES buckets and is doubled whenever the
+//  shard holds more than SECURITY_DESCRIPTOR_CACHE_LOAD descriptors per
+//  bucket, up to SECURITY_DESCRIPTOR_CACHE_MAX_ENTRIES buckets.
+
+
+#define SECURITY_DESCRIPTOR_CACHE_SHARD_SHIFT 4
+#define SECURITY_DESCRIPTOR_CACHE_SHARDS     (1 << SECURITY_DESCRIPTOR_CACHE_SHARD_SHIFT)
+#define SECURITY_DESCRIPTOR_CACHE_ENTRIES    16
+#define SECURITY_DESCRIPTOR_CACHE_MAX_ENTRIES 4096
+#define SECURITY_DESCRIPTOR_CACHE_LOAD       2
 
-#define PREV_SDHEADER(_sdh) (                                                \
-    (sdh)->Link.Blink == NULL ? NULL :                                       \
-    CONTAINING_RECORD( (sdh)->Link.Blink, SECURITY_DESCRIPTOR_HEADER, Link ) \
-)
+typedef struct _SECURITY_DESCRIPTOR_CACHE_SHARD {
 
+    ERESOURCE Lock;
+    PLIST_ENTRY Buckets;
+    ULONG BucketCount;
 
-//  Number of minor hash entries
+    //  Statistics, for the debugger.  Hits are counted with the lock
+    //  held shared, so they are updated with interlocked operations.
 
+    ULONG DescriptorCount;
+    ULONG MaximumDescriptorCount;
+    LONG Hits;
+    ULONG Misses;
+    ULONG Grows;
 
-#define SECURITY_DESCRIPTOR_CACHE_ENTRIES    256
+} SECURITY_DESCRIPTOR_CACHE_SHARD, *PSECURITY_DESCRIPTOR_CACHE_SHARD;
 
 
-//  Routines to protect the security descriptor cache
+//  Routines to protect the security descriptor pointers of objects.  The
+//  cache itself is protected by the locks of its shards, which may be
+//  taken while holding this lock but not the other way around.
 
 
 VOID ObpAcquireDescriptorCacheWriteLock (VOID);
@@ -472,10 +525,102 @@ VOID ObpCreateSymbolicLinkName (POBJECT_SYMBOLIC_LINK SymbolicLink);
 VOID ObpDeleteSymbolicLinkName (POBJECT_SYMBOLIC_LINK SymbolicLink);
 
 
+//  Object directory hashing.  The hash is always computed over the upcased
+//  name so the same value serves both case sensitive and case insensitive
+//  lookups.  The full 32 bit value is kept in each directory entry so that
+//  a directory can be rehashed into a larger bucket array without touching
+//  the object names again.
+
+
+//  VOID ObpHashNameCharacter (IN OUT ULONG Hash, IN WCHAR Wchar)
+#define ObpHashNameCharacter(_Hash, _Wchar) {             \
+    (_Hash) += ((_Hash) << 1) + ((_Hash) >> 1);           \
+    if ((_Wchar) < 'a') {                                 \
+        (_Hash) += (_Wchar);                              \
+    } else if ((_Wchar) > 'z') {                          \
+        (_Hash) += RtlUpcaseUnicodeChar( (_Wchar) );      \
+    } else {                                              \
+        (_Hash) += ((_Wchar) - ('a'-'A'));                \
+    }                                                     \
+}
+
+#define ObpDirectoryBuckets(_Directory) \
+    ((_Directory)->Buckets != NULL ? (_Directory)->Buckets : (_Directory)->HashBuckets)
+
+#define ObpDirectoryBucketCount(_Directory) \
+    ((_Directory)->Buckets != NULL ? (_Directory)->BucketCount : NUMBER_HASH_BUCKETS)
+
+
+//  A directory is grown to the next size once its average chain length
+//  would exceed the load factor.  Directories are never shrunk.
+
+
+#define OBP_DIRECTORY_LOAD_FACTOR 4
+
+
+//  Object name lookup cache.
+
+//  The cache remembers how a root relative path prefix was resolved by
+//  ObpLookupObjectName: either the object that terminated the directory
+//  walk (the full name, or an object with a parse routine such as a device
+//  or a symbolic link) or the fact that the last component was not found.
+//  Each entry records the directories that were traversed together with
+//  their ChangeCount at the time the entry was made.  The entry is only
+//  believed if every one of those directories is unchanged, checked from
+//  the root downward so that a directory is never examined unless its
+//  parent proves it is still alive.
+
+//  Entries are created while the root directory mutex is held exclusive
+//  and are probed while it is held shared, so probes from many processors
+//  proceed in parallel without touching the directory hash chains.
+
+
+#define OBP_NAME_CACHE_ENTRIES      512     // must be a power of two
+#define OBP_NAME_CACHE_MAX_DEPTH    4
+#define OBP_NAME_CACHE_MAX_NAME     96      // characters
+
+typedef struct _OBP_NAME_CACHE_ENTRY {
+    ULONG Hash;
+    USHORT NameLength;
+    BOOLEAN CaseInSensitive;
+    UCHAR Depth;
+    PVOID Object;
+    POBJECT_DIRECTORY Directories[ OBP_NAME_CACHE_MAX_DEPTH ];
+    ULONG ChangeCounts[ OBP_NAME_CACHE_MAX_DEPTH ];
+    WCHAR Name[ OBP_NAME_CACHE_MAX_NAME ];
+} OBP_NAME_CACHE_ENTRY, *POBP_NAME_CACHE_ENTRY;
+
+
+//  Per lookup record of the directories traversed so far
+
+
+typedef struct _OBP_NAME_CACHE_WALK {
+    BOOLEAN Valid;
+    ULONG Depth;
+    PWCH NameStart;
+    POBJECT_DIRECTORY Directories[ OBP_NAME_CACHE_MAX_DEPTH ];
+} OBP_NAME_CACHE_WALK, *POBP_NAME_CACHE_WALK;
+
+POBP_NAME_CACHE_ENTRY ObpNameCache;
+BOOLEAN ObpNameCacheEnabled;
+
+
+//  Statistics, maintained without interlocks and therefore approximate
+
+
+ULONG ObpNameCacheHits;
+ULONG ObpNameCacheNegativeHits;
+ULONG ObpNameCacheMisses;
+ULONG ObpNameCacheInserts;
+ULONG ObpDirectoryGrowCount;
+
+
 //  Internal Entry Points defined in obdir.c
 PVOID ObpLookupDirectoryEntry (IN POBJECT_DIRECTORY Directory, IN PUNICODE_STRING Name, IN ULONG Attributes);
 BOOLEAN ObpInsertDirectoryEntry (IN POBJECT_DIRECTORY Directory, IN PVOID Object);
 BOOLEAN ObpDeleteDirectoryEntry (IN POBJECT_DIRECTORY Directory);
+VOID ObpDeleteDirectory (IN PVOID Object);
+VOID ObpInitNameCache (VOID);
 NTSTATUS
 ObpLookupObjectName (
     IN HANDLE RootDirectoryHandle,
@@ -494,12 +639,107 @@ ObpLookupObjectName (
 VOID ObpUnlockObjectDirectoryPath (IN POBJECT_DIRECTORY LockedDirectory);
 
 
+//  Sharded reference counts.
+
+//  An object that is referenced at a high rate from many processors can be
+//  switched to sharded mode.  The object's pointer count is then biased by
+//  OBP_SHARDED_REFERENCE_BIAS so that it cannot reach zero, and references
+//  taken through ObpIncrPointerCount and ObpDecrPointerCount are counted in
+//  per processor slots instead.  The true count is the header count less
+//  the bias plus the sum of the slots.
+
+//  Sharding is only used while the object has open handles.  When the
+//  handle count drops to zero the object is queued for reconciliation:
+//  the flag is cleared, every processor is made to pass through a DPC so
+//  that nobody is still updating a slot, the slots are folded into the
+//  pointer count and the bias is removed.  Only then can the object be
+//  deleted.
+
+//  Slot updates are made at DISPATCH_LEVEL so that the DPC is a barrier.
+
+
+#define OBP_SHARDED_REFERENCE_BIAS  0x10000000
+#define OBP_MAX_SHARDED_OBJECTS     16
+#define OBP_CACHE_LINE_SIZE         64
+
+typedef struct _OBP_REFERENCE_SHARD {
+    LONG Count;
+    UCHAR Pad[ OBP_CACHE_LINE_SIZE - sizeof( LONG ) ];
+} OBP_REFERENCE_SHARD, *POBP_REFERENCE_SHARD;
+
+typedef struct _OBP_SHARDED_REFERENCE {
+    POBJECT_HEADER ObjectHeader;
+    SINGLE_LIST_ENTRY ReconcileLink;
+    BOOLEAN ReconcilePending;
+    OBP_REFERENCE_SHARD Shards[ 1 ];
+} OBP_SHARDED_REFERENCE, *POBP_SHARDED_REFERENCE;
+
+POBP_SHARDED_REFERENCE ObpShardedReferences[ OBP_MAX_SHARDED_OBJECTS ];
+KSPIN_LOCK ObpShardedReferenceLock;
+FAST_MUTEX ObpShardedReferenceMutex;
+SINGLE_LIST_ENTRY ObpShardReconcileQueue;
+WORK_QUEUE_ITEM ObpShardReconcileWorkItem;
+BOOLEAN ObpShardReconcileActive;
+KDPC ObpShardQuiesceDpc[ MAXIMUM_PROCESSORS ];
+KEVENT ObpShardQuiesceEvent;
+LONG ObpShardQuiesceCount;
+ULONG ObpShardedObjectCount;
+ULONG ObpShardPromotions;
+ULONG ObpShardReconciles;
+
+
+//  Reference sampling.
+
+//  When ObpReferenceSampleInterval is nonzero every Nth reference taken on
+//  each processor through ObReferenceObjectByHandle or ObfReferenceObject
+//  is recorded in a small table of the most referenced objects.  Entries
+//  are removed when their object is deleted so the table never holds a
+//  dangling pointer.  If ObpShardedReferenceThreshold is also nonzero an
+//  object whose estimated rate exceeds it is switched to sharded mode.
+
+
+#define OBP_REFERENCE_STATISTICS_ENTRIES    32
+
+//  Sample counts are halved once an entry has been sampled for longer than
+//  this many 100ns units, so that rates follow the recent past.
+
+#define OBP_REFERENCE_STATISTICS_WINDOW     (10 * 1000 * 1000 * 10)
+
+typedef struct _OBP_REFERENCE_SAMPLE_COUNTDOWN {
+    ULONG Countdown;
+    UCHAR Pad[ OBP_CACHE_LINE_SIZE - sizeof( ULONG ) ];
+} OBP_REFERENCE_SAMPLE_COUNTDOWN;
+
+typedef struct _OBP_REFERENCE_STATISTICS_ENTRY {
+    POBJECT_HEADER ObjectHeader;
+    ULONG Samples;
+    ULONGLONG FirstSampleTime;
+} OBP_REFERENCE_STATISTICS_ENTRY, *POBP_REFERENCE_STATISTICS_ENTRY;
+
+OBP_REFERENCE_SAMPLE_COUNTDOWN ObpReferenceSampleCountdown[ MAXIMUM_PROCESSORS ];
+OBP_REFERENCE_STATISTICS_ENTRY ObpReferenceStatistics[ OBP_REFERENCE_STATISTICS_ENTRIES ];
+KSPIN_LOCK ObpReferenceStatisticsLock;
+BOOLEAN ObpReferenceStatisticsInUse;
+POBJECT_HEADER ObpShardPromotionCandidate;
+WORK_QUEUE_ITEM ObpShardPromotionWorkItem;
+
+extern ULONG ObpReferenceSampleInterval;
+extern ULONG ObpShardedReferenceThreshold;
+
+
 //  Internal entry points defined in obref.c
 
 
 VOID ObpDeleteNameCheck (IN PVOID Object, IN BOOLEAN TypeMutexHeld);
 VOID ObpProcessRemoveObjectQueue (PVOID Parameter);
 VOID ObpRemoveObjectRoutine (PVOID Object);
+VOID ObpInitReferenceSharding (VOID);
+LONG FASTCALL ObpIncrShardedPointerCount (IN POBJECT_HEADER ObjectHeader);
+LONG FASTCALL ObpDecrShardedPointerCount (IN POBJECT_HEADER ObjectHeader);
+VOID FASTCALL ObpSampleReference (IN POBJECT_HEADER ObjectHeader);
+VOID ObpQueueShardReconcile (IN POBJECT_HEADER ObjectHeader);
+VOID ObpPurgeReferenceStatistics (IN POBJECT_HEADER ObjectHeader);
+ULONG ObpQueryPointerCount (IN POBJECT_HEADER ObjectHeader);
 
 
 //  Internal entry points defined in obhandle.c
@@ -621,5 +861,7 @@ PSECURITY_DESCRIPTOR_HEADER ObpCreateCacheEntry (PSECURITY_DESCRIPTOR InputSecur
 PSECURITY_DESCRIPTOR ObpReferenceSecurityDescriptor (PVOID Object);
 VOID ObpDereferenceSecurityDescriptor (PSECURITY_DESCRIPTOR SecurityDescriptor);
 VOID ObpDestroySecurityDescriptorHeader (IN PSECURITY_DESCRIPTOR_HEADER Header);
+PSECURITY_DESCRIPTOR_HEADER ObpLookupCacheEntry (IN PSECURITY_DESCRIPTOR_CACHE_SHARD Shard, IN PSECURITY_DESCRIPTOR InputSecurityDescriptor, IN ULONG FullHash);
+VOID ObpGrowSecurityDescriptorShard (IN PSECURITY_DESCRIPTOR_CACHE_SHARD Shard);
 BOOLEAN ObpCompareSecurityDescriptors (IN PSECURITY_DESCRIPTOR SD1, IN PSECURITY_DESCRIPTOR SD2);
 NTSTATUS ObpValidateAccessMask (PACCESS_STATE AccessState);
\ No newline at end of file
@@ -163,7 +163,7 @@ Return Value:
 
         ObjectBasicInfo.GrantedAccess = GrantedAccess;
         ObjectBasicInfo.HandleCount = ObjectHeader->HandleCount;
-        ObjectBasicInfo.PointerCount = ObjectHeader->PointerCount;
+        ObjectBasicInfo.PointerCount = ObpQueryPointerCount(ObjectHeader);
 
         QuotaInfo = OBJECT_HEADER_TO_QUOTA_INFO(ObjectHeader);
         if (QuotaInfo != NULL) {
@@ -24,6 +24,7 @@ BOOLEAN ObpRemoveQueueActive;
 #pragma alloc_text(PAGE,ObReferenceObjectByName)
 #pragma alloc_text(PAGE,ObpRemoveObjectRoutine)
 #pragma alloc_text(PAGE,ObpDeleteNameCheck)
+#pragma alloc_text(INIT,ObpInitReferenceSharding)
 #endif
 
 #ifndef LpcpAcquireLpcpLock
@@ -51,8 +52,9 @@ Note:
 {
     PAGED_CODE();
 
-    //  Simply return the current pointer count for the object.
-    return OBJECT_TO_OBJECT_HEADER(Object)->PointerCount;
+    //  Return the current pointer count for the object, including any
+    //  references counted per processor if the object is sharded.
+    return ObpQueryPointerCount(OBJECT_TO_OBJECT_HEADER(Object));
 }
 
 
@@ -527,6 +529,10 @@ Return Value:
         KeLeaveCriticalRegion();
     }
 
+    if (NT_SUCCESS(Status) && (ObpReferenceSampleInterval != 0)) {
+        ObpSampleReference(OBJECT_TO_OBJECT_HEADER(*Object));
+    }
+
     return Status;
 }
 
@@ -698,6 +704,10 @@ Return Value:
 
     ObpIncrPointerCount(ObjectHeader);
 
+    if (ObpReferenceSampleInterval != 0) {
+        ObpSampleReference(ObjectHeader);
+    }
+
     return;
 }
 
@@ -874,6 +884,11 @@ Return Value:
     CreatorInfo = OBJECT_HEADER_TO_CREATOR_INFO(ObjectHeader);
     NameInfo = OBJECT_HEADER_TO_NAME_INFO(ObjectHeader);
 
+    //  Make sure the reference sampler no longer remembers this object
+    if (ObpReferenceStatisticsInUse) {
+        ObpPurgeReferenceStatistics(ObjectHeader);
+    }
+
     //  Get exclusive access to the object type object
     ObpEnterObjectTypeMutex(ObjectType);
 
@@ -1035,6 +1050,756 @@ Return Value:
 }
 
 
+POBP_SHARDED_REFERENCE ObpFindShardedReference(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine locates the per processor reference counters for an
+    object in sharded reference mode.  The caller must be at DISPATCH_LEVEL
+    so that the counters cannot be freed underneath it.
+Arguments:
+    ObjectHeader - Supplies the header of the object being looked up
+Return Value:
+    The sharded reference block for the object, or NULL if the object is
+    not, or is no longer, sharded.
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    ULONG i;
+
+    if ((ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) == 0) {
+        return NULL;
+    }
+
+    for (i = 0; i < OBP_MAX_SHARDED_OBJECTS; i += 1) {
+        ShardedReference = ObpShardedReferences[i];
+        if ((ShardedReference != NULL) && (ShardedReference->ObjectHeader == ObjectHeader)) {
+            return ShardedReference;
+        }
+    }
+
+    return NULL;
+}
+
+
+LONG FASTCALL ObpIncrShardedPointerCount(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine adds a reference to an object that was in sharded reference
+    mode when the caller looked at its flags.  If it still is the reference
+    is counted in the current processor's slot, otherwise it is added to
+    the pointer count in the object header.
+Arguments:
+    ObjectHeader - Supplies the header of the object being referenced
+Return Value:
+    A value that is never zero.
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    KIRQL OldIrql;
+    LONG Result;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    ShardedReference = ObpFindShardedReference(ObjectHeader);
+    if (ShardedReference != NULL) {
+        ShardedReference->Shards[KeGetCurrentProcessorNumber()].Count += 1;
+        Result = 1;
+    } else {
+        Result = InterlockedIncrement(&ObjectHeader->PointerCount);
+    }
+
+    KeLowerIrql(OldIrql);
+
+    return Result;
+}
+
+
+BOOLEAN FASTCALL ObReferenceObjectSafe(IN PVOID Object)
+/*++
+Routine Description:
+    This routine adds a reference to an object whose pointer count may
+    already have dropped to zero, as happens when the object is found
+    through a table that does not itself hold a reference to it.  The
+    reference is only taken if the count is not zero; an object whose
+    count has reached zero is being deleted and must not be revived.
+    N.B. The caller must make sure the memory of the object stays valid
+        for the duration of the call, for example by having the routine
+        that deletes the object wait for lookups in progress.
+Arguments:
+    Object - Supplies a pointer to the body of the object
+Return Value:
+    TRUE if a reference was taken, FALSE if the object is being deleted.
+--*/
+{
+    POBJECT_HEADER ObjectHeader;
+    POBP_SHARDED_REFERENCE ShardedReference;
+    KIRQL OldIrql;
+    LONG OldCount;
+
+    ObjectHeader = OBJECT_TO_OBJECT_HEADER(Object);
+
+    //  A sharded object's header count carries the bias, so it is alive and
+    //  the reference can go into this processor's slot as usual.
+    if (ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) {
+        KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+        ShardedReference = ObpFindShardedReference(ObjectHeader);
+        if (ShardedReference != NULL) {
+            ShardedReference->Shards[KeGetCurrentProcessorNumber()].Count += 1;
+            KeLowerIrql(OldIrql);
+            return TRUE;
+        }
+
+        KeLowerIrql(OldIrql);
+    }
+
+    //  Otherwise bump the header count only if it has not already reached
+    //  zero, retrying if somebody else changes it underneath us.
+    while (TRUE) {
+        OldCount = *((volatile LONG *)&ObjectHeader->PointerCount);
+        if (OldCount == 0) {
+            return FALSE;
+        }
+
+        if (InterlockedCompareExchange(&ObjectHeader->PointerCount, OldCount + 1, OldCount) == OldCount) {
+            return TRUE;
+        }
+    }
+}
+
+
+LONG FASTCALL ObpDecrShardedPointerCount(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine removes a reference from an object that was in sharded
+    reference mode when the caller looked at its flags.
+    N.B. While an object is sharded its header count carries a bias, so
+        the count can only reach zero after reconciliation has removed
+        the bias and the object has dropped back to the normal path.
+Arguments:
+    ObjectHeader - Supplies the header of the object being dereferenced
+Return Value:
+    Zero if this was the last reference to the object, nonzero otherwise.
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    KIRQL OldIrql;
+    LONG Result;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    ShardedReference = ObpFindShardedReference(ObjectHeader);
+    if (ShardedReference != NULL) {
+        ShardedReference->Shards[KeGetCurrentProcessorNumber()].Count -= 1;
+        Result = 1;
+    } else {
+        Result = InterlockedDecrement(&ObjectHeader->PointerCount);
+    }
+
+    KeLowerIrql(OldIrql);
+
+    return Result;
+}
+
+
+ULONG ObpQueryPointerCount(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine returns the true pointer count of an object, folding in
+    the per processor counters if the object is sharded.
+Arguments:
+    ObjectHeader - Supplies the header of the object being queried
+Return Value:
+    A snapshot of the object's pointer count.
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    KIRQL OldIrql;
+    LONG Count;
+    ULONG i;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    Count = ObjectHeader->PointerCount;
+
+    ShardedReference = ObpFindShardedReference(ObjectHeader);
+    if (ShardedReference != NULL) {
+        Count -= OBP_SHARDED_REFERENCE_BIAS;
+        for (i = 0; i < (ULONG)KeNumberProcessors; i += 1) {
+            Count += ShardedReference->Shards[i].Count;
+        }
+    }
+
+    KeLowerIrql(OldIrql);
+
+    return (ULONG)Count;
+}
+
+
+NTSTATUS ObpEnableShardedReferences(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine switches an object to sharded reference mode.  The object
+    must have at least one open handle, since closing the last handle is
+    what returns it to normal mode.
+Arguments:
+    ObjectHeader - Supplies the header of the object; the caller holds a reference
+Return Value:
+    An appropriate NTSTATUS value
+--*/
+{
+#ifdef MPSAFE_HANDLE_COUNT_CHECK
+    //  The checking versions of the count routines only know about the header
+    UNREFERENCED_PARAMETER(ObjectHeader);
+
+    return STATUS_NOT_SUPPORTED;
+#else
+    POBP_SHARDED_REFERENCE ShardedReference;
+    NTSTATUS Status;
+    KIRQL OldIrql;
+    ULONG i;
+
+    ShardedReference = ExAllocatePoolWithTag(NonPagedPool,
+                                             FIELD_OFFSET(OBP_SHARDED_REFERENCE, Shards) + KeNumberProcessors * sizeof(OBP_REFERENCE_SHARD),
+                                             'hSbO');
+    if (ShardedReference == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(ShardedReference, FIELD_OFFSET(OBP_SHARDED_REFERENCE, Shards) + KeNumberProcessors * sizeof(OBP_REFERENCE_SHARD));
+    ShardedReference->ObjectHeader = ObjectHeader;
+
+    //  The handle count and the flag are only changed under the type mutex
+    ObpEnterObjectTypeMutex(ObjectHeader->Type);
+
+    if (ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) {
+        Status = STATUS_SUCCESS;
+    } else if (ObjectHeader->HandleCount == 0) {
+        Status = STATUS_UNSUCCESSFUL;
+    } else {
+        Status = STATUS_INSUFFICIENT_RESOURCES;
+
+        ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+        for (i = 0; i < OBP_MAX_SHARDED_OBJECTS; i += 1) {
+            if (ObpShardedReferences[i] == NULL) {
+                ObpShardedReferences[i] = ShardedReference;
+                ObpShardedObjectCount += 1;
+                ObpShardPromotions += 1;
+                Status = STATUS_SUCCESS;
+                break;
+            }
+        }
+        ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+
+        //  Bias the header count before anybody can start counting in the
+        //  slots, so that it cannot reach zero while they are in use
+        if (NT_SUCCESS(Status)) {
+            InterlockedExchangeAdd(&ObjectHeader->PointerCount, OBP_SHARDED_REFERENCE_BIAS);
+            ObjectHeader->Flags |= OB_FLAG_SHARDED_REFERENCES;
+            ShardedReference = NULL;
+        }
+    }
+
+    ObpLeaveObjectTypeMutex(ObjectHeader->Type);
+
+    if (ShardedReference != NULL) {
+        ExFreePool(ShardedReference);
+    }
+
+    return Status;
+#endif
+}
+
+
+VOID ObpShardQuiesceDpcRoutine(IN PKDPC Dpc, IN PVOID DeferredContext, IN PVOID SystemArgument1, IN PVOID SystemArgument2)
+/*++
+Routine Description:
+    This DPC runs once on each processor during reconciliation.  Slot
+    updates are made at DISPATCH_LEVEL, so once it has run no update that
+    started before the object was unsharded can still be in progress there.
+Arguments:
+    Standard DPC arguments, all ignored
+Return Value:
+    None.
+--*/
+{
+    UNREFERENCED_PARAMETER(Dpc);
+    UNREFERENCED_PARAMETER(DeferredContext);
+    UNREFERENCED_PARAMETER(SystemArgument1);
+    UNREFERENCED_PARAMETER(SystemArgument2);
+
+    if (InterlockedDecrement(&ObpShardQuiesceCount) == 0) {
+        KeSetEvent(&ObpShardQuiesceEvent, 0, FALSE);
+    }
+}
+
+
+VOID ObpReconcileShardedReferences(IN POBP_SHARDED_REFERENCE ShardedReference)
+/*++
+Routine Description:
+    This routine returns an object from sharded reference mode to normal
+    mode.  The per processor counts are folded into the header count and
+    the bias is removed, which may delete the object.
+Arguments:
+    ShardedReference - Supplies the sharded reference block, which has
+        already been marked as pending reconciliation
+Return Value:
+    None.
+--*/
+{
+    POBJECT_HEADER ObjectHeader;
+    KIRQL OldIrql;
+    LONG Sum;
+    ULONG i;
+
+    ObjectHeader = ShardedReference->ObjectHeader;
+
+    //  Unpublish the slots and clear the flag.  From here on new references
+    //  go to the header, which still carries the bias.
+    ObpEnterObjectTypeMutex(ObjectHeader->Type);
+    ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+
+    for (i = 0; i < OBP_MAX_SHARDED_OBJECTS; i += 1) {
+        if (ObpShardedReferences[i] == ShardedReference) {
+            ObpShardedReferences[i] = NULL;
+            ObpShardedObjectCount -= 1;
+            break;
+        }
+    }
+
+    ObjectHeader->Flags &= ~OB_FLAG_SHARDED_REFERENCES;
+
+    ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+    ObpLeaveObjectTypeMutex(ObjectHeader->Type);
+
+    //  Wait for every processor to pass through a DPC so that the slots,
+    //  and the block itself, are no longer in use
+    ExAcquireFastMutex(&ObpShardedReferenceMutex);
+
+    KeClearEvent(&ObpShardQuiesceEvent);
+    ObpShardQuiesceCount = KeNumberProcessors;
+
+    for (i = 0; i < (ULONG)KeNumberProcessors; i += 1) {
+        KeInitializeDpc(&ObpShardQuiesceDpc[i], ObpShardQuiesceDpcRoutine, NULL);
+        KeSetTargetProcessorDpc(&ObpShardQuiesceDpc[i], (CCHAR)i);
+        KeInsertQueueDpc(&ObpShardQuiesceDpc[i], NULL, NULL);
+    }
+
+    KeWaitForSingleObject(&ObpShardQuiesceEvent, Executive, KernelMode, FALSE, NULL);
+
+    ObpShardReconciles += 1;
+
+    ExReleaseFastMutex(&ObpShardedReferenceMutex);
+
+    Sum = 0;
+    for (i = 0; i < (ULONG)KeNumberProcessors; i += 1) {
+        Sum += ShardedReference->Shards[i].Count;
+    }
+
+    ExFreePool(ShardedReference);
+
+    //  Replace the bias with the slot total plus one reference of our own,
+    //  then drop that reference through the normal path so that the object
+    //  is deleted if nobody else holds it
+    InterlockedExchangeAdd(&ObjectHeader->PointerCount, Sum - OBP_SHARDED_REFERENCE_BIAS + 1);
+
+    ObDereferenceObject(&ObjectHeader->Body);
+}
+
+
+VOID ObpProcessShardReconcileQueue(PVOID Parameter)
+/*++
+Routine Description:
+    This is the work routine for the sharded reference reconcile queue.
+Arguments:
+    Parameter - Ignored
+Return Value:
+    None.
+--*/
+{
+    PSINGLE_LIST_ENTRY Entry;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Parameter);
+
+    ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+
+    Entry = PopEntryList(&ObpShardReconcileQueue);
+    while (Entry != NULL) {
+        ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+        ObpReconcileShardedReferences(CONTAINING_RECORD(Entry, OBP_SHARDED_REFERENCE, ReconcileLink));
+        ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+        Entry = PopEntryList(&ObpShardReconcileQueue);
+    }
+
+    ObpShardReconcileActive = FALSE;
+
+    ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+}
+
+
+VOID ObpQueueShardReconcile(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine queues a sharded object for reconciliation after its last
+    handle has been closed.  The caller holds the object type mutex.
+Arguments:
+    ObjectHeader - Supplies the header of the object
+Return Value:
+    None.
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    BOOLEAN StartWorkerThread = FALSE;
+    KIRQL OldIrql;
+    ULONG i;
+
+    ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+
+    for (i = 0; i < OBP_MAX_SHARDED_OBJECTS; i += 1) {
+        ShardedReference = ObpShardedReferences[i];
+        if ((ShardedReference != NULL) && (ShardedReference->ObjectHeader == ObjectHeader)) {
+            if (!ShardedReference->ReconcilePending) {
+                ShardedReference->ReconcilePending = TRUE;
+                PushEntryList(&ObpShardReconcileQueue, &ShardedReference->ReconcileLink);
+
+                if (!ObpShardReconcileActive) {
+                    ObpShardReconcileActive = TRUE;
+                    StartWorkerThread = TRUE;
+                }
+            }
+            break;
+        }
+    }
+
+    ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+
+    if (StartWorkerThread) {
+        ExInitializeWorkItem(&ObpShardReconcileWorkItem, ObpProcessShardReconcileQueue, NULL);
+        ExQueueWorkItem(&ObpShardReconcileWorkItem, DelayedWorkQueue);
+    }
+}
+
+
+NTSTATUS ObSetObjectReferenceSharding(IN PVOID Object, IN BOOLEAN Enable)
+/*++
+Routine Description:
+    This routine switches an object into or out of sharded reference mode.
+    Objects are also switched in automatically when the reference sampler
+    finds them hot, and out when their last handle is closed.
+Arguments:
+    Object - Supplies a pointer to the body of a referenced object
+    Enable - Supplies TRUE to shard the object's references, FALSE to
+        return it to normal mode
+Return Value:
+    An appropriate NTSTATUS value
+--*/
+{
+    POBP_SHARDED_REFERENCE ShardedReference;
+    POBJECT_HEADER ObjectHeader;
+    KIRQL OldIrql;
+    ULONG i;
+
+    ObjectHeader = OBJECT_TO_OBJECT_HEADER(Object);
+
+    if (Enable) {
+        return ObpEnableShardedReferences(ObjectHeader);
+    }
+
+    //  Claim the block unless a reconcile is already on its way.  The
+    //  caller's reference keeps the object alive across the reconcile.
+    ExAcquireSpinLock(&ObpShardedReferenceLock, &OldIrql);
+
+    ShardedReference = NULL;
+    for (i = 0; i < OBP_MAX_SHARDED_OBJECTS; i += 1) {
+        if ((ObpShardedReferences[i] != NULL) &&
+            (ObpShardedReferences[i]->ObjectHeader == ObjectHeader) &&
+            !ObpShardedReferences[i]->ReconcilePending) {
+            ShardedReference = ObpShardedReferences[i];
+            ShardedReference->ReconcilePending = TRUE;
+            break;
+        }
+    }
+
+    ExReleaseSpinLock(&ObpShardedReferenceLock, OldIrql);
+
+    if (ShardedReference != NULL) {
+        ObpReconcileShardedReferences(ShardedReference);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+ULONG ObpReferenceRate(IN POBP_REFERENCE_STATISTICS_ENTRY Entry, IN ULONGLONG CurrentTime)
+/*++
+Routine Description:
+    This routine estimates the references per second for a statistics entry.
+Arguments:
+    Entry - Supplies the entry; the caller holds the statistics lock
+    CurrentTime - Supplies the current interrupt time
+Return Value:
+    The estimated rate, or zero if the entry is less than a second old.
+--*/
+{
+    ULONGLONG Elapsed;
+
+    Elapsed = CurrentTime - Entry->FirstSampleTime;
+    if (Elapsed < 10 * 1000 * 1000) {
+        return 0;
+    }
+
+    return (ULONG)(((ULONGLONG)Entry->Samples * ObpReferenceSampleInterval * 10 * 1000 * 1000) / Elapsed);
+}
+
+
+VOID FASTCALL ObpSampleReference(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine is called for every reference taken through the sampled
+    entry points while sampling is enabled.  Every Nth call on a processor
+    is recorded in the reference statistics table, and an object found to
+    be referenced at more than the sharding threshold is handed to a
+    worker to be switched to sharded mode.
+Arguments:
+    ObjectHeader - Supplies the header of the object just referenced
+Return Value:
+    None.
+--*/
+{
+    POBP_REFERENCE_STATISTICS_ENTRY Entry;
+    POBP_REFERENCE_STATISTICS_ENTRY Victim;
+    PULONG Countdown;
+    ULONGLONG CurrentTime;
+    BOOLEAN Promote = FALSE;
+    KIRQL OldIrql;
+    ULONG i;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &OldIrql);
+
+    Countdown = &ObpReferenceSampleCountdown[KeGetCurrentProcessorNumber()].Countdown;
+    if (*Countdown > 1) {
+        *Countdown -= 1;
+        KeLowerIrql(OldIrql);
+        return;
+    }
+
+    *Countdown = ObpReferenceSampleInterval;
+
+    CurrentTime = KeQueryInterruptTime();
+
+    ExAcquireSpinLockAtDpcLevel(&ObpReferenceStatisticsLock);
+
+    //  Find the object's entry, otherwise take over the least sampled one
+    Entry = NULL;
+    Victim = &ObpReferenceStatistics[0];
+    for (i = 0; i < OBP_REFERENCE_STATISTICS_ENTRIES; i += 1) {
+        if (ObpReferenceStatistics[i].ObjectHeader == ObjectHeader) {
+            Entry = &ObpReferenceStatistics[i];
+            break;
+        }
+        if (ObpReferenceStatistics[i].Samples < Victim->Samples) {
+            Victim = &ObpReferenceStatistics[i];
+        }
+    }
+
+    if (Entry == NULL) {
+        Entry = Victim;
+        Entry->ObjectHeader = ObjectHeader;
+        Entry->Samples = 0;
+        Entry->FirstSampleTime = CurrentTime;
+        ObpReferenceStatisticsInUse = TRUE;
+    }
+
+    Entry->Samples += 1;
+
+    if ((CurrentTime - Entry->FirstSampleTime) > OBP_REFERENCE_STATISTICS_WINDOW) {
+        Entry->FirstSampleTime += (CurrentTime - Entry->FirstSampleTime) / 2;
+        Entry->Samples /= 2;
+    }
+
+    //  Only one promotion is outstanding at a time.  The candidate holds a
+    //  reference until the worker has dealt with it.
+    if ((ObpShardedReferenceThreshold != 0) &&
+        ((ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) == 0) &&
+        (ObjectHeader->HandleCount > 0) &&
+        (ObpShardPromotionCandidate == NULL) &&
+        (ObpShardedObjectCount < OBP_MAX_SHARDED_OBJECTS) &&
+        (ObpReferenceRate(Entry, CurrentTime) >= ObpShardedReferenceThreshold)) {
+        InterlockedIncrement(&ObjectHeader->PointerCount);
+        ObpShardPromotionCandidate = ObjectHeader;
+        Promote = TRUE;
+    }
+
+    ExReleaseSpinLockFromDpcLevel(&ObpReferenceStatisticsLock);
+
+    if (Promote) {
+        ExQueueWorkItem(&ObpShardPromotionWorkItem, DelayedWorkQueue);
+    }
+
+    KeLowerIrql(OldIrql);
+}
+
+
+VOID ObpProcessShardPromotion(PVOID Parameter)
+/*++
+Routine Description:
+    This is the work routine that switches the object picked by the
+    reference sampler to sharded mode.
+Arguments:
+    Parameter - Ignored
+Return Value:
+    None.
+--*/
+{
+    POBJECT_HEADER ObjectHeader;
+    KIRQL OldIrql;
+
+    UNREFERENCED_PARAMETER(Parameter);
+
+    ExAcquireSpinLock(&ObpReferenceStatisticsLock, &OldIrql);
+    ObjectHeader = ObpShardPromotionCandidate;
+    ObpShardPromotionCandidate = NULL;
+    ExReleaseSpinLock(&ObpReferenceStatisticsLock, OldIrql);
+
+    if (ObjectHeader != NULL) {
+        (VOID)ObpEnableShardedReferences(ObjectHeader);
+        ObDereferenceObject(&ObjectHeader->Body);
+    }
+}
+
+
+VOID ObpPurgeReferenceStatistics(IN POBJECT_HEADER ObjectHeader)
+/*++
+Routine Description:
+    This routine removes an object that is being deleted from the
+    reference statistics table.
+Arguments:
+    ObjectHeader - Supplies the header of the object being deleted
+Return Value:
+    None.
+--*/
+{
+    KIRQL OldIrql;
+    ULONG i;
+
+    ExAcquireSpinLock(&ObpReferenceStatisticsLock, &OldIrql);
+
+    for (i = 0; i < OBP_REFERENCE_STATISTICS_ENTRIES; i += 1) {
+        if (ObpReferenceStatistics[i].ObjectHeader == ObjectHeader) {
+            ObpReferenceStatistics[i].ObjectHeader = NULL;
+            ObpReferenceStatistics[i].Samples = 0;
+            break;
+        }
+    }
+
+    ExReleaseSpinLock(&ObpReferenceStatisticsLock, OldIrql);
+}
+
+
+NTSTATUS ObQueryReferenceStatistics(OUT POB_REFERENCE_STATISTICS ReferenceStatistics, IN ULONG Length, OUT PULONG ReturnLength OPTIONAL)
+/*++
+Routine Description:
+    This routine returns the most referenced objects seen by the reference
+    sampler, highest rate first.
+Arguments:
+    ReferenceStatistics - Supplies a kernel buffer to receive the statistics
+    Length - Supplies the length of the buffer in bytes
+    ReturnLength - Optionally receives the length needed for the statistics
+Return Value:
+    STATUS_SUCCESS, or STATUS_INFO_LENGTH_MISMATCH if the buffer is too small.
+--*/
+{
+    OB_REFERENCE_STATISTICS_ENTRY Entries[OBP_REFERENCE_STATISTICS_ENTRIES];
+    OB_REFERENCE_STATISTICS_ENTRY Temp;
+    POBP_REFERENCE_STATISTICS_ENTRY Entry;
+    POBJECT_HEADER ObjectHeader;
+    ULONGLONG CurrentTime;
+    ULONG NumberOfEntries;
+    ULONG RequiredLength;
+    KIRQL OldIrql;
+    ULONG i, j;
+
+    //  Snapshot the table.  Entries are purged before their objects are
+    //  freed, so the headers can be looked at while the lock is held.
+    NumberOfEntries = 0;
+    CurrentTime = KeQueryInterruptTime();
+
+    ExAcquireSpinLock(&ObpReferenceStatisticsLock, &OldIrql);
+
+    for (i = 0; i < OBP_REFERENCE_STATISTICS_ENTRIES; i += 1) {
+        Entry = &ObpReferenceStatistics[i];
+        ObjectHeader = Entry->ObjectHeader;
+        if (ObjectHeader == NULL) {
+            continue;
+        }
+
+        Entries[NumberOfEntries].Object = &ObjectHeader->Body;
+        Entries[NumberOfEntries].TypeIndex = (ObjectHeader->Type != NULL) ? ObjectHeader->Type->Index : 0;
+        Entries[NumberOfEntries].PointerCount = ObpQueryPointerCount(ObjectHeader);
+        Entries[NumberOfEntries].HandleCount = ObjectHeader->HandleCount;
+        Entries[NumberOfEntries].SampledReferences = Entry->Samples;
+        Entries[NumberOfEntries].ReferencesPerSecond = ObpReferenceRate(Entry, CurrentTime);
+        Entries[NumberOfEntries].Sharded = (BOOLEAN)((ObjectHeader->Flags & OB_FLAG_SHARDED_REFERENCES) != 0);
+        NumberOfEntries += 1;
+    }
+
+    ExReleaseSpinLock(&ObpReferenceStatisticsLock, OldIrql);
+
+    RequiredLength = FIELD_OFFSET(OB_REFERENCE_STATISTICS, Entries) + NumberOfEntries * sizeof(OB_REFERENCE_STATISTICS_ENTRY);
+
+    if (ARGUMENT_PRESENT(ReturnLength)) {
+        *ReturnLength = RequiredLength;
+    }
+
+    if (Length < RequiredLength) {
+        return STATUS_INFO_LENGTH_MISMATCH;
+    }
+
+    //  Order by rate, there are only a few entries
+    for (i = 1; i < NumberOfEntries; i += 1) {
+        Temp = Entries[i];
+        for (j = i; (j > 0) && (Entries[j - 1].ReferencesPerSecond < Temp.ReferencesPerSecond); j -= 1) {
+            Entries[j] = Entries[j - 1];
+        }
+        Entries[j] = Temp;
+    }
+
+    ReferenceStatistics->SampleInterval = ObpReferenceSampleInterval;
+    ReferenceStatistics->ShardedReferenceThreshold = ObpShardedReferenceThreshold;
+    ReferenceStatistics->ShardedObjects = ObpShardedObjectCount;
+    ReferenceStatistics->NumberOfEntries = NumberOfEntries;
+    RtlCopyMemory(ReferenceStatistics->Entries, Entries, NumberOfEntries * sizeof(OB_REFERENCE_STATISTICS_ENTRY));
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID ObpInitReferenceSharding(VOID)
+/*++
+Routine Description:
+    This routine initializes the sharded reference and reference sampling state.
+Arguments:
+    None.
+Return Value:
+    None.
+--*/
+{
+    ULONG i;
+
+    KeInitializeSpinLock(&ObpShardedReferenceLock);
+    KeInitializeSpinLock(&ObpReferenceStatisticsLock);
+    ExInitializeFastMutex(&ObpShardedReferenceMutex);
+    KeInitializeEvent(&ObpShardQuiesceEvent, NotificationEvent, FALSE);
+    ExInitializeWorkItem(&ObpShardPromotionWorkItem, ObpProcessShardPromotion, NULL);
+
+    ObpShardReconcileQueue.Next = NULL;
+
+    for (i = 0; i < MAXIMUM_PROCESSORS; i += 1) {
+        ObpReferenceSampleCountdown[i].Countdown = ObpReferenceSampleInterval;
+    }
+}
+
+
 // Thunks to support standard call callers
 
 
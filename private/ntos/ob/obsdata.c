@@ -90,14 +90,29 @@ ULONG ObsTotalCacheEntries = 0;
 #define OBS_DEBUG_SHOW_HEADER_FREE        ((ULONG) 0x00000100L)
 
 
-//  Array of pointers to security descriptor entries
+//  The shards of the security descriptor cache
 
 
-PLIST_ENTRY *ObsSecurityDescriptorCache = NULL;
+SECURITY_DESCRIPTOR_CACHE_SHARD ObsSecurityDescriptorShards[SECURITY_DESCRIPTOR_CACHE_SHARDS];
 
 
+//  Mix the full hash of a descriptor, whose low bits are poor since it is
+//  a sum, and use the top bits to pick the shard and the low bits to pick
+//  the bucket within it
 
-//  Resource used to protect the security descriptor cache
+
+#define ObpMixSecurityDescriptorHash( _hash ) \
+    ((((_hash) ^ ((_hash) >> 15)) * 0x9E3779B1) ^ ((_hash) >> 7))
+
+#define ObpSecurityDescriptorShard( _hash ) \
+    (&ObsSecurityDescriptorShards[ObpMixSecurityDescriptorHash( _hash ) >> (32 - SECURITY_DESCRIPTOR_CACHE_SHARD_SHIFT)])
+
+#define ObpSecurityDescriptorBucket( _shard, _hash ) \
+    (&(_shard)->Buckets[ObpMixSecurityDescriptorHash( _hash ) & ((_shard)->BucketCount - 1)])
+
+
+
+//  Resource used to protect the security descriptor pointers of objects
 
 
 ERESOURCE ObsSecurityDescriptorCacheLock;
@@ -109,6 +124,8 @@ ERESOURCE ObsSecurityDescriptorCacheLock;
 #pragma alloc_text(PAGE,ObpHashSecurityDescriptor)
 #pragma alloc_text(PAGE,ObpInitSecurityDescriptorCache)
 #pragma alloc_text(PAGE,ObpLogSecurityDescriptor)
+#pragma alloc_text(PAGE,ObpLookupCacheEntry)
+#pragma alloc_text(PAGE,ObpGrowSecurityDescriptorShard)
 #pragma alloc_text(PAGE,ObpReferenceSecurityDescriptor)
 #pragma alloc_text(PAGE,ObpCreateCacheEntry)
 #endif
@@ -136,7 +153,10 @@ Return Value:
 --*/
 
 {
+    PSECURITY_DESCRIPTOR_CACHE_SHARD Shard;
     ULONG Size;
+    ULONG i;
+    ULONG j;
     NTSTATUS Status;
 
     IF_OB_GLOBAL( BREAK_ON_INIT ) {
@@ -145,29 +165,49 @@ Return Value:
     }
 
 
-    //  Allocate the cache of pointers and zero it out
+    //  Initialize the resource used to protect the security descriptor
+    //  pointers of objects
 
 
-    Size = SECURITY_DESCRIPTOR_CACHE_ENTRIES * sizeof(PLIST_ENTRY);
-    ObsSecurityDescriptorCache = ExAllocatePoolWithTag( PagedPool, Size, 'cCdS' );
+    Status = ExInitializeResource ( &ObsSecurityDescriptorCacheLock );
 
-    if (ObsSecurityDescriptorCache == NULL ) {
+    if ( !NT_SUCCESS(Status) ) {
 
-        return( STATUS_INSUFFICIENT_RESOURCES );
+        return( Status );
     }
 
-    RtlZeroMemory( ObsSecurityDescriptorCache, Size );
 
+    //  Give each shard its lock and its initial table of empty buckets
 
-    //  Initialize the resource used to protect the security cache
 
+    Size = SECURITY_DESCRIPTOR_CACHE_ENTRIES * sizeof(LIST_ENTRY);
 
-    Status = ExInitializeResource ( &ObsSecurityDescriptorCacheLock );
+    for (i = 0; i < SECURITY_DESCRIPTOR_CACHE_SHARDS; i++) {
 
-    if ( !NT_SUCCESS(Status) ) {
+        Shard = &ObsSecurityDescriptorShards[i];
 
-        ExFreePool( ObsSecurityDescriptorCache );
-        return( Status );
+        RtlZeroMemory( Shard, sizeof(SECURITY_DESCRIPTOR_CACHE_SHARD) );
+
+        Status = ExInitializeResource ( &Shard->Lock );
+
+        if ( !NT_SUCCESS(Status) ) {
+
+            return( Status );
+        }
+
+        Shard->Buckets = ExAllocatePoolWithTag( PagedPool, Size, 'cCdS' );
+
+        if (Shard->Buckets == NULL ) {
+
+            return( STATUS_INSUFFICIENT_RESOURCES );
+        }
+
+        Shard->BucketCount = SECURITY_DESCRIPTOR_CACHE_ENTRIES;
+
+        for (j = 0; j < SECURITY_DESCRIPTOR_CACHE_ENTRIES; j++) {
+
+            InitializeListHead( &Shard->Buckets[j] );
+        }
     }
 
 
@@ -306,6 +346,10 @@ Routine Description:
     Takes a passed security descriptor and registers it into the
     security descriptor database.
 
+    Most objects are created with a descriptor that is already in the
+    cache, so the shard holding it is first searched with its lock held
+    shared and only locked exclusive if a new entry has to be added.
+
 Arguments:
 
     InputSecurityDescriptor - The new security descriptor to be logged into
@@ -323,60 +367,35 @@ Return Value:
 
 {
     ULONG FullHash;
-    UCHAR  SmallHash;
+    PSECURITY_DESCRIPTOR_CACHE_SHARD Shard;
     PSECURITY_DESCRIPTOR_HEADER NewDescriptor;
-    PLIST_ENTRY Front;
-    PLIST_ENTRY Back;
     PSECURITY_DESCRIPTOR_HEADER Header;
-    BOOLEAN Match;
 
     FullHash = ObpHashSecurityDescriptor( InputSecurityDescriptor );
-    SmallHash = (UCHAR)FullHash;
-
-
-    //  See if the entry matching SmallHash is in use.
-    //  Lock the table first, unlock if if we don't need it.
-
-
-    ObpAcquireDescriptorCacheWriteLock();
+    Shard = ObpSecurityDescriptorShard( FullHash );
 
-    Front = ObsSecurityDescriptorCache[SmallHash];
-    Back  = NULL;
-    Match = FALSE;
 
+    //  See if the descriptor is already cached.  A reference may be
+    //  added with the shard shared because the last reference is only
+    //  removed with it held exclusive.
 
-    //  Zoom down the hash bucket looking for a full hash match
-
-
-    while ( Front != NULL ) {
-
-        Header = LINK_TO_SD_HEADER( Front );
-
-
-        //  **** is this test really right?  Is the full hash value really
-        //  ordered like this?
 
+    KeEnterCriticalRegion();
+    (VOID)ExAcquireResourceShared( &Shard->Lock, TRUE );
 
-        if ( Header->FullHash > FullHash ) {
+    Header = ObpLookupCacheEntry( Shard, InputSecurityDescriptor, FullHash );
 
-            break;
-        }
+    if ( Header == NULL ) {
 
-        if ( Header->FullHash == FullHash ) {
 
-            Match = ObpCompareSecurityDescriptors( InputSecurityDescriptor,
-                                                   &Header->SecurityDescriptor );
+        //  Not there, so lock the shard exclusive and look again in case
+        //  someone else added it in the meantime
 
-            if ( Match ) {
 
-                break;
-            }
+        ExReleaseResource( &Shard->Lock );
+        (VOID)ExAcquireResourceExclusive( &Shard->Lock, TRUE );
 
-            ObPrint( SHOW_COLLISIONS,("Got a collision on %d, no match\n",SmallHash));
-        }
-
-        Back = Front;
-        Front = Front->Flink;
+        Header = ObpLookupCacheEntry( Shard, InputSecurityDescriptor, FullHash );
     }
 
 
@@ -385,17 +404,19 @@ Return Value:
     //  the caller supplied and returning the old one to our caller
 
 
-    if ( Match ) {
+    if ( Header != NULL ) {
 
-        Header->RefCount++;
+        InterlockedIncrement( &Header->RefCount );
+        InterlockedIncrement( &Shard->Hits );
 
         ObPrint( SHOW_REFERENCES, ("Reference Hash = 0x%lX, New RefCount = %d\n",Header->FullHash,Header->RefCount));
 
         *OutputSecurityDescriptor = &Header->SecurityDescriptor;
 
-        ExFreePool( InputSecurityDescriptor );
+        ExReleaseResource( &Shard->Lock );
+        KeLeaveCriticalRegion();
 
-        ObpReleaseDescriptorCacheLock();
+        ExFreePool( InputSecurityDescriptor );
 
         return( STATUS_SUCCESS );
     }
@@ -410,19 +431,48 @@ Return Value:
 
     if ( NewDescriptor == NULL ) {
 
-        ObpReleaseDescriptorCacheLock();
+        ExReleaseResource( &Shard->Lock );
+        KeLeaveCriticalRegion();
 
         return( STATUS_INSUFFICIENT_RESOURCES );
     }
 
 #if OB_DIAGNOSTICS_ENABLED
 
-    ObsTotalCacheEntries++;
+    InterlockedIncrement( (PLONG)&ObsTotalCacheEntries );
 
 #endif
 
     ObPrint( SHOW_STATISTICS, ("ObsTotalCacheEntries = %d \n",ObsTotalCacheEntries));
-    ObPrint( SHOW_COLLISIONS, ("Adding new entry for index #%d \n",SmallHash));
+
+    InsertHeadList( ObpSecurityDescriptorBucket( Shard, FullHash ), &NewDescriptor->Link );
+
+    Shard->Misses += 1;
+    Shard->DescriptorCount += 1;
+
+    if (Shard->DescriptorCount > Shard->MaximumDescriptorCount) {
+
+        Shard->MaximumDescriptorCount = Shard->DescriptorCount;
+    }
+
+
+    //  Keep the chains short as the population of the shard grows
+
+
+    if ((Shard->DescriptorCount > Shard->BucketCount * SECURITY_DESCRIPTOR_CACHE_LOAD) &&
+        (Shard->BucketCount < SECURITY_DESCRIPTOR_CACHE_MAX_ENTRIES)) {
+
+        ObpGrowSecurityDescriptorShard( Shard );
+    }
+
+
+    //  Set the output security descriptor and return to our caller
+
+
+    *OutputSecurityDescriptor = &NewDescriptor->SecurityDescriptor;
+
+    ExReleaseResource( &Shard->Lock );
+    KeLeaveCriticalRegion();
 
 
     //  We don't need the old security descriptor any more.
@@ -430,60 +480,133 @@ Return Value:
 
     ExFreePool( InputSecurityDescriptor );
 
+    return( STATUS_SUCCESS );
+}
 
-    //  The following logic inserts the new security descriptor into the
-    //  small hash list.  We need to first decide if the we're adding
-    //  the entry to the beginning of the list (back is null) or if we're
-    //  further in the list.
 
-    //  **** This logic is plain bizzare because (1) the small hash
-    //  should probably just be an array of list heads and not single
-    //  pointer value and (2) the doubly linked list of security descriptors
-    //  is not circular!  This should be fixed to use the regular set
-    //  of link list macros
+PSECURITY_DESCRIPTOR_HEADER
+ObpLookupCacheEntry (
+    IN PSECURITY_DESCRIPTOR_CACHE_SHARD Shard,
+    IN PSECURITY_DESCRIPTOR InputSecurityDescriptor,
+    IN ULONG FullHash
+    )
 
+/*++
 
-    if ( Back == NULL ) {
+Routine Description:
 
+    Searches a shard of the cache for a security descriptor.  The shard
+    must be locked shared or exclusive by the caller.
 
-        //  We're inserting at the beginning of the list for this
-        //  minor index
+Arguments:
 
+    Shard - The shard that the hash of the descriptor maps to.
 
-        NewDescriptor->Link.Flink = ObsSecurityDescriptorCache[SmallHash];
-        ObsSecurityDescriptorCache[SmallHash] = &NewDescriptor->Link;
+    InputSecurityDescriptor - The security descriptor to find.
 
-        if ( NewDescriptor->Link.Flink != NULL ) {
+    FullHash - Full 32 bit hash of the security descriptor.
 
-            NewDescriptor->Link.Flink->Blink = &NewDescriptor->Link;
-        }
+Return Value:
 
-    } else {
+    The cache entry holding an identical descriptor, or NULL.
 
+--*/
 
-        //  Hook new descriptor entry into list.
+{
+    PLIST_ENTRY ListHead;
+    PLIST_ENTRY Next;
+    PSECURITY_DESCRIPTOR_HEADER Header;
 
+    ListHead = ObpSecurityDescriptorBucket( Shard, FullHash );
 
-        NewDescriptor->Link.Flink = Front;
+    for (Next = ListHead->Flink; Next != ListHead; Next = Next->Flink) {
 
-        NewDescriptor->Link.Blink = Back;
+        Header = LINK_TO_SD_HEADER( Next );
 
-        Back->Flink = &NewDescriptor->Link;
+        if ( Header->FullHash == FullHash ) {
+
+            if ( ObpCompareSecurityDescriptors( InputSecurityDescriptor,
+                                                &Header->SecurityDescriptor )) {
 
-        if (Front != NULL) {
+                return( Header );
+            }
 
-            Front->Blink = &NewDescriptor->Link;
+            ObPrint( SHOW_COLLISIONS,("Got a collision on %lX, no match\n",FullHash));
         }
     }
 
+    return( NULL );
+}
 
-    //  Set the output security descriptor and return to our caller
 
+VOID
+ObpGrowSecurityDescriptorShard (
+    IN PSECURITY_DESCRIPTOR_CACHE_SHARD Shard
+    )
 
-    *OutputSecurityDescriptor = &NewDescriptor->SecurityDescriptor;
-    ObpReleaseDescriptorCacheLock();
+/*++
 
-    return( STATUS_SUCCESS );
+Routine Description:
+
+    Doubles the number of hash buckets of a shard and moves its entries
+    to the new buckets.  The shard must be locked exclusive.  If the new
+    table can't be allocated the shard is left as it is and will try to
+    grow again on a later insertion.
+
+Arguments:
+
+    Shard - The shard to grow.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PLIST_ENTRY OldBuckets;
+    ULONG OldBucketCount;
+    PLIST_ENTRY NewBuckets;
+    PLIST_ENTRY Entry;
+    PSECURITY_DESCRIPTOR_HEADER Header;
+    ULONG i;
+
+    OldBuckets = Shard->Buckets;
+    OldBucketCount = Shard->BucketCount;
+
+    NewBuckets = ExAllocatePoolWithTag( PagedPool, 2 * OldBucketCount * sizeof(LIST_ENTRY), 'cCdS' );
+
+    if (NewBuckets == NULL) {
+
+        return;
+    }
+
+    for (i = 0; i < 2 * OldBucketCount; i++) {
+
+        InitializeListHead( &NewBuckets[i] );
+    }
+
+    Shard->Buckets = NewBuckets;
+    Shard->BucketCount = 2 * OldBucketCount;
+
+    for (i = 0; i < OldBucketCount; i++) {
+
+        while (!IsListEmpty( &OldBuckets[i] )) {
+
+            Entry = RemoveHeadList( &OldBuckets[i] );
+            Header = LINK_TO_SD_HEADER( Entry );
+
+            InsertTailList( ObpSecurityDescriptorBucket( Shard, Header->FullHash ), Entry );
+        }
+    }
+
+    Shard->Grows += 1;
+
+    ObPrint( SHOW_STATISTICS, ("Security descriptor cache shard %x grown to %d buckets\n", Shard, Shard->BucketCount));
+
+    ExFreePool( OldBuckets );
+
+    return;
 }
 
 
@@ -544,8 +667,6 @@ Return Value:
 
     NewDescriptor->RefCount   = 1;
     NewDescriptor->FullHash   = FullHash;
-    NewDescriptor->Link.Flink = NULL;
-    NewDescriptor->Link.Blink = NULL;
 
     RtlCopyMemory( &NewDescriptor->SecurityDescriptor,
                    InputSecurityDescriptor,
@@ -596,11 +717,13 @@ Return Value:
     ASSERT( ObpCentralizedSecurity(ObjectType) );
 
 
-    //  Lock the security descriptor cache and get the objects
-    //  security descriptor
+    //  Lock the objects security descriptor pointer against being
+    //  changed and get the objects security descriptor.  Anyone setting
+    //  new security holds the lock exclusive while replacing the pointer,
+    //  so shared access is enough here.
 
 
-    ObpAcquireDescriptorCacheWriteLock();
+    ObpAcquireDescriptorCacheReadLock();
 
     SecurityDescriptor = OBJECT_TO_OBJECT_HEADER( Object )->SecurityDescriptor;
 
@@ -617,14 +740,15 @@ Return Value:
     //  If the object has a security descriptor then we need to
     //  get the security descriptor header and increment its
     //  ref count before releasing the lock and returning to
-    //  our caller
+    //  our caller.  The object holds a reference of its own, so
+    //  the count can't be going to zero underneath us.
 
 
     if ( SecurityDescriptor != NULL ) {
 
         SecurityDescriptorHeader = SD_TO_SD_HEADER( SecurityDescriptor );
         ObPrint( SHOW_REFERENCES, ("Referencing Hash %lX, Refcount = %d \n",SecurityDescriptorHeader->FullHash,SecurityDescriptorHeader->RefCount));
-        SecurityDescriptorHeader->RefCount++;
+        InterlockedIncrement( &SecurityDescriptorHeader->RefCount );
     }
 
     ObpReleaseDescriptorCacheLock();
@@ -659,12 +783,8 @@ Return Value:
     PSECURITY_DESCRIPTOR_HEADER Header;
 
 
-    //  Lock the security descriptor cache and get a pointer
-    //  to the security descriptor header
-
-
-    ObpAcquireDescriptorCacheWriteLock();
-
+    //  The object is being deleted, so no one else can be looking at
+    //  its security descriptor and there is no need to lock it.
 
     //  **** the following diagnostic code should really be done only on
     //  a checked build
@@ -686,12 +806,6 @@ Return Value:
 
     *SecurityDescriptor = NULL;
 
-
-    //  Unlock the security descriptor cache and return to our caller
-
-
-    ObpReleaseDescriptorCacheLock();
-
     return( STATUS_SUCCESS );
 }
 
@@ -719,39 +833,65 @@ Return Value:
 
 {
     PSECURITY_DESCRIPTOR_HEADER  SecurityDescriptorHeader;
+    PSECURITY_DESCRIPTOR_CACHE_SHARD Shard;
+    LONG RefCount;
 
+    SecurityDescriptorHeader = SD_TO_SD_HEADER( SecurityDescriptor );
 
-    //  Lock the security descriptor cache and get a pointer
-    //  to the security descriptor header
 
+    //  Do some debug work
 
-    ObpAcquireDescriptorCacheWriteLock();
 
-    SecurityDescriptorHeader = SD_TO_SD_HEADER( SecurityDescriptor );
+    ObPrint( SHOW_REFERENCES, ("Dereferencing SecurityDescriptor %x, hash %lx, refcount = %d \n", SecurityDescriptor, SecurityDescriptorHeader->FullHash,SecurityDescriptorHeader->RefCount));
 
 
-    //  Do some debug work
+    //  As long as this isn't the last reference just decrement the
+    //  ref count, without taking any lock
 
 
-    ObPrint( SHOW_REFERENCES, ("Dereferencing SecurityDescriptor %x, hash %lx, refcount = %d \n", SecurityDescriptor, SecurityDescriptorHeader->FullHash,SecurityDescriptorHeader->RefCount));
+    RefCount = SecurityDescriptorHeader->RefCount;
+
+    while (RefCount > 1) {
 
-    ASSERT(SecurityDescriptorHeader->RefCount != 0);
+        LONG OldRefCount;
 
+        OldRefCount = InterlockedCompareExchange( &SecurityDescriptorHeader->RefCount,
+                                                  RefCount - 1,
+                                                  RefCount );
 
-    //  Decrement the ref count and if it is now zero then
-    //  we can completely remove this entry from the cache
+        if (OldRefCount == RefCount) {
 
+            return;
+        }
+
+        RefCount = OldRefCount;
+    }
 
-    if (--SecurityDescriptorHeader->RefCount == 0) {
+    ASSERT(RefCount != 0);
+
+
+    //  This may be the last reference.  Lock the shard exclusive, so that
+    //  no one can find the entry and reference it again, and if the ref
+    //  count is now zero then we can completely remove this entry from
+    //  the cache
+
+
+    Shard = ObpSecurityDescriptorShard( SecurityDescriptorHeader->FullHash );
+
+    KeEnterCriticalRegion();
+    (VOID)ExAcquireResourceExclusive( &Shard->Lock, TRUE );
+
+    if (InterlockedDecrement( &SecurityDescriptorHeader->RefCount ) == 0) {
 
         ObpDestroySecurityDescriptorHeader( SecurityDescriptorHeader );
     }
 
 
-    //  Unlock the security descriptor cache and return to our caller
+    //  Unlock the shard and return to our caller
 
 
-    ObpReleaseDescriptorCacheLock();
+    ExReleaseResource( &Shard->Lock );
+    KeLeaveCriticalRegion();
 }
 
 
@@ -765,6 +905,7 @@ ObpDestroySecurityDescriptorHeader (
 Routine Description:
 
     Frees a cached security descriptor and unlinks it from the chain.
+    The shard holding it must be locked exclusive.
 
 Arguments:
 
@@ -778,50 +919,27 @@ Return Value:
 --*/
 
 {
-    PLIST_ENTRY Forward;
-    PLIST_ENTRY Rear;
-    UCHAR SmallHash;
+    PSECURITY_DESCRIPTOR_CACHE_SHARD Shard;
 
     ASSERT ( Header->RefCount == 0 );
 
 #if OB_DIAGNOSTICS_ENABLED
 
-    ObsTotalCacheEntries--;
+    InterlockedDecrement( (PLONG)&ObsTotalCacheEntries );
 
 #endif
 
     ObPrint( SHOW_STATISTICS, ("ObsTotalCacheEntries = %d \n",ObsTotalCacheEntries));
 
 
-    //  Unlink the cached security descriptor from its linked list and
-    //  from the small hash table if it was at the head of the list
-
-    //  **** this should all be rewritten to use the regular set of
-    //  link list macros
-
+    //  Unlink the cached security descriptor from its hash bucket
 
-    SmallHash = (UCHAR)Header->FullHash;
 
-    Forward = Header->Link.Flink;
-    Rear = Header->Link.Blink;
+    Shard = ObpSecurityDescriptorShard( Header->FullHash );
 
-    if ( Forward != NULL ) {
+    RemoveEntryList( &Header->Link );
 
-        Forward->Blink = Rear;
-    }
-
-    if ( Rear != NULL ) {
-
-        Rear->Flink = Forward;
-
-    } else {
-
-
-        //  if Rear is NULL, we're deleting the head of the list
-
-
-        ObsSecurityDescriptorCache[SmallHash] = Forward;
-    }
+    Shard->DescriptorCount -= 1;
 
     ObPrint( SHOW_HEADER_FREE, ("Freeing memory at %x \n",Header));
 
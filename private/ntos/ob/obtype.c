@@ -562,7 +562,7 @@ Return Value:
         if (!(EnumerationRoutine)( &ObjectHeader->Body,
                                    &ObjectName,
                                    ObjectHeader->HandleCount,
-                                   ObjectHeader->PointerCount,
+                                   ObpQueryPointerCount( ObjectHeader ),
                                    Parameter )) {
 
             Status = STATUS_NO_MORE_ENTRIES;
@@ -1072,7 +1072,7 @@ Return Value:
                             ObjectInfo->Object                = Object;
                             ObjectInfo->CreatorUniqueProcess  = CreatorInfo->CreatorUniqueProcess;
                             ObjectInfo->CreatorBackTraceIndex = CreatorInfo->CreatorBackTraceIndex;
-                            ObjectInfo->PointerCount          = ObjectHeader->PointerCount;
+                            ObjectInfo->PointerCount          = ObpQueryPointerCount(ObjectHeader);
                             ObjectInfo->HandleCount           = ObjectHeader->HandleCount;
                             ObjectInfo->Flags                 = (USHORT)ObjectHeader->Flags;
                             ObjectInfo->SecurityDescriptor    = ObjectHeader->SecurityDescriptor;
@@ -0,0 +1,217 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uobname.c
+
+Abstract:
+    Object name lookup benchmark.  Measures the rate at which existing
+    named objects can be opened through a multi level object directory
+    path, the rate of failed opens, and the effect of concurrent name
+    space changes on both.
+
+    usage: uobname [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_OBJECTS       64
+
+#define BENCH_OPEN_EXISTING 0
+#define BENCH_OPEN_MISSING  1
+#define BENCH_OPEN_CHURN    2
+
+WCHAR *BenchDirectories[] = {
+    L"\\ObNameBench",
+    L"\\ObNameBench\\Level1",
+    L"\\ObNameBench\\Level1\\Level2"
+};
+
+#define BENCH_DIRECTORIES (sizeof(BenchDirectories) / sizeof(BenchDirectories[0]))
+
+HANDLE DirectoryHandles[BENCH_DIRECTORIES];
+HANDLE EventHandles[BENCH_OBJECTS];
+
+ULONG BenchmarkMode;
+
+
+VOID BenchObjectName(OUT PWCHAR Buffer, IN ULONG Index, IN BOOLEAN Missing)
+{
+    swprintf(Buffer, L"%s\\%s%u", BenchDirectories[BENCH_DIRECTORIES - 1], Missing ? L"Missing" : L"Event", Index);
+}
+
+
+NTSTATUS CreateBenchNamespace(VOID)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    WCHAR NameBuffer[128];
+    NTSTATUS Status;
+    ULONG i;
+
+    for (i = 0; i < BENCH_DIRECTORIES; i++)
+    {
+        RtlInitUnicodeString(&Name, BenchDirectories[i]);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE | OBJ_OPENIF, NULL, NULL);
+        Status = NtCreateDirectoryObject(&DirectoryHandles[i], DIRECTORY_ALL_ACCESS, &ObjectAttributes);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create %wZ directory (%X)\n", &Name, Status);
+            return Status;
+        }
+    }
+
+    for (i = 0; i < BENCH_OBJECTS; i++)
+    {
+        BenchObjectName(NameBuffer, i, FALSE);
+        RtlInitUnicodeString(&Name, NameBuffer);
+        InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE | OBJ_OPENIF, NULL, NULL);
+        Status = NtCreateEvent(&EventHandles[i], EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create %wZ event (%X)\n", &Name, Status);
+            return Status;
+        }
+    }
+
+    return STATUS_SUCCESS;
+}
+
+
+VOID DeleteBenchNamespace(VOID)
+{
+    ULONG i;
+
+    for (i = 0; i < BENCH_OBJECTS; i++)
+    {
+        if (EventHandles[i] != NULL)
+        {
+            NtClose(EventHandles[i]);
+        }
+    }
+
+    for (i = BENCH_DIRECTORIES; i > 0; i--)
+    {
+        if (DirectoryHandles[i - 1] != NULL)
+        {
+            NtClose(DirectoryHandles[i - 1]);
+        }
+    }
+}
+
+
+ULONG OpenerThread(IN PVOID Context)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Names[BENCH_OBJECTS];
+    WCHAR NameBuffers[BENCH_OBJECTS][128];
+    HANDLE Handle;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG i;
+
+    for (i = 0; i < BENCH_OBJECTS; i++)
+    {
+        BenchObjectName(NameBuffers[i], i, (BOOLEAN)(BenchmarkMode == BENCH_OPEN_MISSING));
+        RtlInitUnicodeString(&Names[i], NameBuffers[i]);
+    }
+
+    i = ThreadIndex;
+    while (!StopBenchmark)
+    {
+        InitializeObjectAttributes(&ObjectAttributes, &Names[i % BENCH_OBJECTS], OBJ_CASE_INSENSITIVE, NULL, NULL);
+        Status = NtOpenEvent(&Handle, SYNCHRONIZE, &ObjectAttributes);
+        if (NT_SUCCESS(Status))
+        {
+            NtClose(Handle);
+        }
+        else if (BenchmarkMode != BENCH_OPEN_MISSING)
+        {
+            printf("Open of %wZ failed (%X)\n", &Names[i % BENCH_OBJECTS], Status);
+            break;
+        }
+
+        i += 1;
+        BenchCounts[ThreadIndex] += 1;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+ULONG ChurnThread(IN PVOID Context)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    UNICODE_STRING Name;
+    HANDLE Handle;
+
+    UNREFERENCED_PARAMETER(Context);
+
+    RtlInitUnicodeString(&Name, L"\\ObNameBench\\Level1\\Level2\\Churn");
+    InitializeObjectAttributes(&ObjectAttributes, &Name, OBJ_CASE_INSENSITIVE, NULL, NULL);
+
+    while (!StopBenchmark)
+    {
+        if (NT_SUCCESS(NtCreateEvent(&Handle, EVENT_ALL_ACCESS, &ObjectAttributes, NotificationEvent, FALSE)))
+        {
+            NtClose(Handle);
+        }
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Mode, IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG Total;
+
+    BenchmarkMode = Mode;
+    Total = BenchRunThreads((PUSER_THREAD_START_ROUTINE)OpenerThread, Threads, Seconds,
+                            (Mode == BENCH_OPEN_CHURN) ? (PUSER_THREAD_START_ROUTINE)ChurnThread : NULL, NULL);
+
+    printf("%-28s %2u threads  %10I64u opens  %10I64u opens/sec\n", Title, Threads, Total, Total / Seconds);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+    NTSTATUS Status;
+
+    Threads = BenchArgument(argc, argv, 1, 1);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: uobname [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    Status = CreateBenchNamespace();
+    if (NT_SUCCESS(Status))
+    {
+        for (n = 1; n <= Threads; n *= 2)
+        {
+            RunBenchmark("open existing", BENCH_OPEN_EXISTING, n, Seconds);
+            RunBenchmark("open missing", BENCH_OPEN_MISSING, n, Seconds);
+            RunBenchmark("open existing with churn", BENCH_OPEN_CHURN, n, Seconds);
+        }
+    }
+
+    DeleteBenchNamespace();
+    return NT_SUCCESS(Status) ? 0 : 1;
+}
@@ -0,0 +1,88 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uobref.c
+
+Abstract:
+    Object reference benchmark.  Measures the rate at which threads on
+    all processors can reference a single shared object by handle, which
+    is the case sharded reference counts are meant to help.  Run it with
+    the ObReferenceSampleInterval and ObShardedReferenceThreshold values
+    set and cleared to compare.
+
+    usage: uobref [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+HANDLE SharedEvent;
+
+
+ULONG ReferenceThread(IN PVOID Context)
+{
+    EVENT_BASIC_INFORMATION EventInformation;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    while (!StopBenchmark)
+    {
+        //  Each query references and dereferences the event through its handle
+
+        Status = NtQueryEvent(SharedEvent, EventBasicInformation, &EventInformation, sizeof(EventInformation), NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Query of shared event failed (%X)\n", Status);
+            break;
+        }
+
+        BenchCounts[ThreadIndex] += 1;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+main(int argc, char **argv)
+{
+    ULONGLONG Total;
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+    NTSTATUS Status;
+
+    Threads = BenchArgument(argc, argv, 1, 1);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: uobref [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    Status = NtCreateEvent(&SharedEvent, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to create shared event (%X)\n", Status);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        Total = BenchRunThreads((PUSER_THREAD_START_ROUTINE)ReferenceThread, n, Seconds, NULL, NULL);
+        printf("%2u threads  %10I64u references  %10I64u references/sec\n", n, Total, Total / Seconds);
+    }
+
+    NtClose(SharedEvent);
+    return 0;
+}
@@ -23,6 +23,13 @@ Revision History:
 
 #include "psp.h"
 
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text(PAGE, PspLeaveCidLookupSlot)
+#pragma alloc_text(PAGE, PspReferenceCidObject)
+#pragma alloc_text(PAGE, PspWaitForCidLookups)
+#endif
+
+
 NTSTATUS
 PsLookupProcessThreadByCid(
     IN PCLIENT_ID Cid,
@@ -59,34 +66,29 @@ Return Value:
 
 {
 
-    PHANDLE_TABLE_ENTRY CidEntry;
     PETHREAD lThread;
-    NTSTATUS Status;
-
-    CidEntry = ExMapHandleToPointer(PspCidTable, Cid->UniqueThread);
-    Status = STATUS_INVALID_CID;
-    if (CidEntry != NULL) {
-        lThread = (PETHREAD)CidEntry->Object;
-        if ((lThread != (PETHREAD)PSP_INVALID_ID) &&
-            (
-             lThread->Tcb.Header.Type == ThreadObject &&
-             lThread->Cid.UniqueProcess == Cid->UniqueProcess &&
-             lThread->GrantedAccess
-            ) ) {
-            if (ARGUMENT_PRESENT(Process)) {
-                *Process = THREAD_TO_PROCESS(lThread);
-                ObReferenceObject(*Process);
-            }
-
-            ObReferenceObject(lThread);
-            *Thread = lThread;
-            Status = STATUS_SUCCESS;
-        }
 
-        ExUnlockHandleTableEntry(PspCidTable, CidEntry);
+    lThread = (PETHREAD)PspReferenceCidObject(Cid->UniqueThread, ThreadObject);
+    if (lThread == NULL) {
+        return STATUS_INVALID_CID;
     }
 
-    return Status;
+    // Now that the thread is referenced it cannot go away, and neither can
+    // its process since the thread holds a reference to it.
+
+    if (lThread->Cid.UniqueProcess != Cid->UniqueProcess) {
+        ObDereferenceObject(lThread);
+        return STATUS_INVALID_CID;
+    }
+
+    if (ARGUMENT_PRESENT(Process)) {
+        *Process = THREAD_TO_PROCESS(lThread);
+        ObReferenceObject(*Process);
+    }
+
+    *Thread = lThread;
+
+    return STATUS_SUCCESS;
 }
 
 
@@ -121,24 +123,16 @@ Return Value:
 
 {
 
-    PHANDLE_TABLE_ENTRY CidEntry;
     PEPROCESS lProcess;
-    NTSTATUS Status;
-
-    CidEntry = ExMapHandleToPointer(PspCidTable, ProcessId);
-    Status = STATUS_INVALID_PARAMETER;
-    if (CidEntry != NULL) {
-        lProcess = (PEPROCESS)CidEntry->Object;
-        if (lProcess != (PEPROCESS)PSP_INVALID_ID && lProcess->Pcb.Header.Type == ProcessObject && lProcess->GrantedAccess ) {
-            ObReferenceObject(lProcess);
-            *Process = lProcess;
-            Status = STATUS_SUCCESS;
-        }
 
-        ExUnlockHandleTableEntry(PspCidTable, CidEntry);
+    lProcess = (PEPROCESS)PspReferenceCidObject(ProcessId, ProcessObject);
+    if (lProcess == NULL) {
+        return STATUS_INVALID_PARAMETER;
     }
 
-    return Status;
+    *Process = lProcess;
+
+    return STATUS_SUCCESS;
 }
 
 
@@ -173,23 +167,204 @@ Return Value:
 
 {
 
-    PHANDLE_TABLE_ENTRY CidEntry;
     PETHREAD lThread;
-    NTSTATUS Status;
 
-    CidEntry = ExMapHandleToPointer(PspCidTable, ThreadId);
-    Status = STATUS_INVALID_PARAMETER;
-    if (CidEntry != NULL) {
-        lThread = (PETHREAD)CidEntry->Object;
-        if (lThread != (PETHREAD)PSP_INVALID_ID && lThread->Tcb.Header.Type == ThreadObject && lThread->GrantedAccess ) {
+    lThread = (PETHREAD)PspReferenceCidObject(ThreadId, ThreadObject);
+    if (lThread == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    *Thread = lThread;
 
-            ObReferenceObject(lThread);
-            *Thread = lThread;
-            Status = STATUS_SUCCESS;
+    return STATUS_SUCCESS;
+}
+
+
+PVOID
+PspReferenceCidObject(
+    IN HANDLE Id,
+    IN UCHAR ObjectType
+    )
+
+/*++
+
+Routine Description:
+
+    This function looks up a process or thread id in the client ID table
+    and returns a referenced pointer to the process or thread.
+
+    The table entry is read without being locked, so lookups never wait
+    for each other or for the creation and deletion of other processes and
+    threads.  Instead the lookup is counted in a slot for the current
+    epoch while it looks at the object, and PspWaitForCidLookups, which
+    runs before a process or thread is freed, waits for all the lookups
+    of the epoch in which the object's entry was destroyed.  An object
+    whose pointer count has already reached zero is being deleted and is
+    not returned.
+
+Arguments:
+
+    Id - Specifies the process or thread id.
+
+    ObjectType - Supplies ProcessObject or ThreadObject, the kind of object
+        that is expected.
+
+Return Value:
+
+    A referenced pointer to the object, or NULL if the id does not refer to
+    a fully created process or thread of the expected kind.
+
+--*/
+
+{
+
+    PPSP_CID_LOOKUP_SLOT Slot;
+    ULONG Epoch;
+    PVOID Object;
+    BOOLEAN Valid;
+
+    PAGED_CODE();
+
+    // Keep the thread from being suspended while it holds up deletions.
+
+    KeEnterCriticalRegion();
+
+    // Announce the lookup in the slot of the current epoch and then make
+    // sure that the epoch did not move on in the meantime, since a delete
+    // that moved it may already have found the slot empty.
+
+    while (TRUE) {
+        Epoch = *((volatile ULONG *)&PspCidLookupEpoch);
+        Slot = &PspCidLookupSlots[KeGetCurrentProcessorNumber() & (PSP_CID_LOOKUP_SLOTS - 1)];
+        InterlockedIncrement(&Slot->Active[Epoch & 1]);
+        if (*((volatile ULONG *)&PspCidLookupEpoch) == Epoch) {
+            break;
+        }
+        PspLeaveCidLookupSlot(Slot, Epoch);
+    }
+
+    Object = ExLookupHandleTableObject(PspCidTable, Id);
+    if ((Object != NULL) && (Object != (PVOID)PSP_INVALID_ID)) {
+        if (ObjectType == ThreadObject) {
+            Valid = (BOOLEAN)(((PETHREAD)Object)->Tcb.Header.Type == ThreadObject &&
+                              ((PETHREAD)Object)->GrantedAccess != 0);
+        } else {
+            Valid = (BOOLEAN)(((PEPROCESS)Object)->Pcb.Header.Type == ProcessObject &&
+                              ((PEPROCESS)Object)->GrantedAccess != 0);
         }
 
-        ExUnlockHandleTableEntry(PspCidTable, CidEntry);
+        if (!Valid || !ObReferenceObjectSafe(Object)) {
+            Object = NULL;
+        }
+    } else {
+        Object = NULL;
+    }
+
+    PspLeaveCidLookupSlot(Slot, Epoch);
+    KeLeaveCriticalRegion();
+
+    return Object;
+}
+
+
+VOID
+PspLeaveCidLookupSlot(
+    IN PPSP_CID_LOOKUP_SLOT Slot,
+    IN ULONG Epoch
+    )
+
+/*++
+
+Routine Description:
+
+    This function ends a lookup counted in a slot. If the lookup was the
+    last one in the slot of an epoch that has been moved on, a delete may
+    be waiting for the slot to drain, so its event is set.
+
+    The epoch is moved on before the delete looks at the slot, so a delete
+    that finds the slot busy always gets the event.
+
+Arguments:
+
+    Slot - Supplies the slot the lookup was counted in.
+
+    Epoch - Supplies the epoch the lookup was counted for.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PAGED_CODE();
+
+    if ((InterlockedDecrement(&Slot->Active[Epoch & 1]) == 0) &&
+        (*((volatile ULONG *)&PspCidLookupEpoch) != Epoch)) {
+        KeSetEvent(&Slot->Drained, 0, FALSE);
+    }
+}
+
+
+VOID
+PspWaitForCidLookups(
+    VOID
+    )
+
+/*++
+
+Routine Description:
+
+    This function is called by the delete routines of processes and
+    threads after the object's client ID has been destroyed.  It moves the
+    lookup epoch on and waits until every lookup that started in the old
+    epoch has finished.  Lookups that start after that cannot find the
+    destroyed entry, so when this function returns nobody can still be
+    looking at the object.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+
+    PPSP_CID_LOOKUP_SLOT Slot;
+    ULONG Epoch;
+    ULONG i;
+
+    PAGED_CODE();
+
+    // Deletes are serialized so that the old epoch's slots are not reused
+    // by a newer epoch while somebody is still waiting for them to drain.
+
+    ExAcquireFastMutex(&PspCidLookupMutex);
+
+    Epoch = PspCidLookupEpoch;
+    InterlockedIncrement((PLONG)&PspCidLookupEpoch);
+
+    // Lookups hold a slot for a few instructions, so the slots are almost
+    // always empty at once.  If one is not, wait for its last lookup to
+    // set the event rather than poll, so that a preempted lookup is woken
+    // for as soon as it leaves.  The event may have been left set by an
+    // earlier epoch, so check the count again after each wait.
+
+    for (i = 0; i < PSP_CID_LOOKUP_SLOTS; i += 1) {
+        Slot = &PspCidLookupSlots[i];
+        while (*((volatile LONG *)&Slot->Active[Epoch & 1]) != 0) {
+            KeWaitForSingleObject(&Slot->Drained,
+                                  Executive,
+                                  KernelMode,
+                                  FALSE,
+                                  NULL);
+        }
     }
 
-    return Status;
+    ExReleaseFastMutex(&PspCidLookupMutex);
 }
@@ -922,6 +922,10 @@ VOID PspProcessDelete(IN PVOID Object)
         if (!(ExDestroyHandle(PspCidTable, Process->UniqueProcessId, NULL))) {
             KeBugCheck(CID_HANDLE_DELETION);
         }
+
+        // Lookups that found the entry before it was destroyed may still be
+        // looking at the object; let them finish before it is freed.
+        PspWaitForCidLookups();
     }
 
     PspDeleteLdt(Process);
@@ -973,6 +977,10 @@ VOID PspThreadDelete(IN PVOID Object)
         if (!(ExDestroyHandle(PspCidTable, Thread->Cid.UniqueThread, NULL))) {
             KeBugCheck(CID_HANDLE_DELETION);
         }
+
+        // Lookups that found the entry before it was destroyed may still be
+        // looking at the object; let them finish before it is freed.
+        PspWaitForCidLookups();
     }
 
     PspDeleteThreadSecurity(Thread);
@@ -67,6 +67,9 @@ GENERIC_MAPPING PspJobMapping = {
 POBJECT_TYPE PsThreadType;
 POBJECT_TYPE PsProcessType;
 PHANDLE_TABLE PspCidTable;
+PSP_CID_LOOKUP_SLOT PspCidLookupSlots[PSP_CID_LOOKUP_SLOTS];
+ULONG PspCidLookupEpoch;
+FAST_MUTEX PspCidLookupMutex;
 PEPROCESS PsInitialSystemProcess;
 HANDLE PspInitialSystemProcessHandle;
 PACCESS_TOKEN PspBootAccessToken;
@@ -83,6 +86,7 @@ BOOLEAN PspDoingGiveBacks;
 POBJECT_TYPE PsJobType;
 FAST_MUTEX PspJobListLock;
 LIST_ENTRY PspJobList;
+BOOLEAN PspJobTimeAtTick;
 
 BOOLEAN PsReaperActive = FALSE;
 LIST_ENTRY PsReaperListHead;
@@ -144,6 +148,7 @@ Return Value:
     HANDLE ThreadHandle;
     PETHREAD Thread;
     MM_SYSTEMSIZE SystemSize;
+    ULONG i;
 
     SystemSize = MmQuerySystemSize();
     PspDefaultPagefileLimit = (ULONG)-1;
@@ -267,6 +272,13 @@ Return Value:
 
     InitializeListHead(&PspJobList);
     ExInitializeFastMutex(&PspJobListLock);
+
+
+    // Have the clock interrupt charge processor time to jobs as it charges
+    // it to processes, where the architecture supports it
+
+
+    PspJobTimeAtTick = KeSetProcessTimeUpdateNotifyRoutine(PspJobTimeUpdate);
     InitializeListHead(&PspWorkingSetChangeHead.Links);
     ExInitializeFastMutex(&PspWorkingSetChangeHead.Lock);
 
@@ -282,6 +294,10 @@ Return Value:
         return FALSE;
     }
     ExRemoveHandleTable(PspCidTable);
+    ExInitializeFastMutex(&PspCidLookupMutex);
+    for (i = 0; i < PSP_CID_LOOKUP_SLOTS; i += 1) {
+        KeInitializeEvent(&PspCidLookupSlots[i].Drained, SynchronizationEvent, FALSE);
+    }
 
 #if defined(i386)
 
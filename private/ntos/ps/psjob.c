@@ -37,6 +37,16 @@ Revision History:
 #pragma alloc_text(PAGE, PspTerminateAllProcessesInJob)
 #pragma alloc_text(PAGE, PspFoldProcessAccountingIntoJob)
 #pragma alloc_text(PAGE, PspCaptureTokenFilter)
+#pragma alloc_text(PAGE, PspNestJob)
+#pragma alloc_text(PAGE, PspIsJobNestedIn)
+#pragma alloc_text(PAGE, PspTerminateNestedJobs)
+#pragma alloc_text(PAGE, PspTerminateNestedJobsAndWait)
+#pragma alloc_text(PAGE, PspChargeJobUsage64)
+#pragma alloc_text(PAGE, PspChargePriorUsage)
+#pragma alloc_text(PAGE, PspChargeProcessRunTime)
+#pragma alloc_text(PAGE, PspChargeRunningProcesses)
+#pragma alloc_text(PAGE, PspCaptureJobUsage)
+#pragma alloc_text(PAGE, PspUpdateJobTotals)
 
 
 // move to io.h
@@ -118,15 +128,45 @@ NtCreateJobObject (
 
             Job->SchedulingClass = PSP_DEFAULT_SCHEDULING_CLASSES;
 
+            Status = ExInitializeResource(&Job->JobLock);
+            if ( NT_SUCCESS(Status) ) {
 
-            // Insert Job on Job List
 
+                // Allocate the per processor commit slots, see PsChangeJobMemoryUsage
 
-            ExAcquireFastMutex(&PspJobListLock);
-            InsertTailList(&PspJobList,&Job->JobLinks);
-            ExReleaseFastMutex(&PspJobListLock);
 
-            Status = ExInitializeResource(&Job->JobLock);
+                Job->CommitSlots = ExAllocatePoolWithTag(
+                                        NonPagedPool,
+                                        KeNumberProcessors * sizeof(PSP_JOB_COMMIT_SLOT),
+                                        'cJsP'
+                                        );
+                if ( Job->CommitSlots ) {
+                    RtlZeroMemory(Job->CommitSlots, KeNumberProcessors * sizeof(PSP_JOB_COMMIT_SLOT));
+                    }
+                else {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    }
+                }
+
+            if ( NT_SUCCESS(Status) ) {
+
+
+                // Allocate the per processor usage slots, see PsChargeJobUsage
+
+
+                Job->UsageSlots = ExAllocatePoolWithTag(
+                                        NonPagedPool,
+                                        KeNumberProcessors * sizeof(PSP_JOB_USAGE_SLOT),
+                                        'uJsP'
+                                        );
+                if ( Job->UsageSlots ) {
+                    RtlZeroMemory(Job->UsageSlots, KeNumberProcessors * sizeof(PSP_JOB_USAGE_SLOT));
+                    }
+                else {
+                    Status = STATUS_INSUFFICIENT_RESOURCES;
+                    }
+                }
+
             if ( !NT_SUCCESS(Status) ) {
 
 
@@ -138,6 +178,17 @@ NtCreateJobObject (
                 }
             else {
                 ExInitializeFastMutex(&Job->MemoryLimitsLock);
+
+
+                // Insert Job on Job List. The periodic pass in
+                // PsEnforceExecutionTimeLimits may look at any job on the
+                // list, so the job must be fully initialized by now.
+
+
+                ExAcquireFastMutex(&PspJobListLock);
+                InsertTailList(&PspJobList,&Job->JobLinks);
+                ExReleaseFastMutex(&PspJobListLock);
+
                 Status = ObInsertObject(
                             (PVOID)Job,
                             NULL,
@@ -273,6 +324,7 @@ NtAssignProcessToJobObject(
     NTSTATUS Status;
     KPROCESSOR_MODE PreviousMode;
     BOOLEAN IsAdmin ;
+    HANDLE OldJobHandle;
 
     PAGED_CODE();
 
@@ -286,16 +338,6 @@ NtAssignProcessToJobObject(
         }
 
 
-    // Quick Check for prior assignment
-
-
-    if ( Process->Job ) {
-        ObDereferenceObject(Process);
-        return STATUS_ACCESS_DENIED;
-        }
-
-
-
     // Now reference the job object. Then we need to lock the process and check again
 
 
@@ -326,6 +368,34 @@ NtAssignProcessToJobObject(
         }
 
 
+    // A process that is already in a job stays in it, and is not added to
+    // the new job. Assigning it nests its whole job inside the new one
+    // instead, which puts every process of the old job under the job wide
+    // limits and termination of the new one, so the caller must be allowed
+    // to assign processes to the old job as well.
+
+
+    if ( Process->Job ) {
+        Status = ObOpenObjectByPointer(
+                    Process->Job,
+                    0,
+                    NULL,
+                    JOB_OBJECT_ASSIGN_PROCESS,
+                    PsJobType,
+                    PreviousMode,
+                    &OldJobHandle
+                    );
+        if ( NT_SUCCESS(Status) ) {
+            ZwClose(OldJobHandle);
+            Status = PspNestJob(Process->Job,Job);
+            }
+
+        ObDereferenceObject(Process);
+        ObDereferenceObject(Job);
+        return Status;
+        }
+
+
     Status = PsLockProcess(Process,PreviousMode,PsLockPollOnTimeout);
     if ( !NT_SUCCESS(Status) || Process->Job ) {
         if ( !NT_SUCCESS(Status) ) {
@@ -491,6 +561,13 @@ PspAddProcessToJob(
 
     if ( Status == STATUS_SUCCESS ) {
 
+
+        // From now on the process charges its usage to the job as it goes.
+        // Charge it with what it used before.
+
+
+        PspChargePriorUsage(Process);
+
         PspApplyJobLimitsToProcess(Job,Process);
 
         if ( Process->Job->CompletionPort
@@ -660,12 +737,38 @@ PspJobDelete(
 
 
 
-    // Remove Job on Job List
+    // Remove Job on Job List. A job that failed to initialize never made it there.
 
 
-    ExAcquireFastMutex(&PspJobListLock);
-    RemoveEntryList(&Job->JobLinks);
-    ExReleaseFastMutex(&PspJobListLock);
+    if ( Job->JobLinks.Flink ) {
+        ExAcquireFastMutex(&PspJobListLock);
+        RemoveEntryList(&Job->JobLinks);
+        ExReleaseFastMutex(&PspJobListLock);
+        }
+
+
+    // Push the last commit deltas up into the job this one is nested in
+    // before letting go of it
+
+
+    if ( Job->CommitSlots ) {
+        KeEnterCriticalRegion();
+        ExAcquireFastMutexUnsafe(&Job->MemoryLimitsLock);
+        PspHarvestJobCommit(Job);
+        ExReleaseFastMutexUnsafe(&Job->MemoryLimitsLock);
+        KeLeaveCriticalRegion();
+
+        ExFreePool(Job->CommitSlots);
+        }
+
+    if ( Job->UsageSlots ) {
+        ExFreePool(Job->UsageSlots);
+        }
+
+    if ( Job->ParentJob ) {
+        ObDereferenceObject(Job->ParentJob);
+        Job->ParentJob = NULL;
+        }
 
 
     // Free Security clutter:
@@ -822,7 +925,7 @@ NtQueryInformationJobObject(
     PVOID ReturnData;
     PEPROCESS Process;
     PLIST_ENTRY Next;
-    LARGE_INTEGER UserTime, KernelTime;
+    PS_JOB_ACCOUNTING Usage;
     PULONG_PTR NextProcessIdSlot;
     ULONG WorkingLength;
     PJOBOBJECT_BASIC_PROCESS_ID_LIST IdList;
@@ -944,53 +1047,54 @@ NtQueryInformationJobObject(
 
         RtlZeroMemory(&AccountingInfo.IoInfo,sizeof(AccountingInfo.IoInfo));
 
-        AccountingInfo.BasicInfo.TotalUserTime = Job->TotalUserTime;
-        AccountingInfo.BasicInfo.TotalKernelTime = Job->TotalKernelTime;
-        AccountingInfo.BasicInfo.ThisPeriodTotalUserTime = Job->ThisPeriodTotalUserTime;
-        AccountingInfo.BasicInfo.ThisPeriodTotalKernelTime = Job->ThisPeriodTotalKernelTime;
-        AccountingInfo.BasicInfo.TotalPageFaultCount = Job->TotalPageFaultCount;
-
-        AccountingInfo.BasicInfo.TotalProcesses = Job->TotalProcesses;
-        AccountingInfo.BasicInfo.ActiveProcesses = Job->ActiveProcesses;
-        AccountingInfo.BasicInfo.TotalTerminatedProcesses = Job->TotalTerminatedProcesses;
 
-        AccountingInfo.IoInfo.ReadOperationCount = Job->ReadOperationCount;
-        AccountingInfo.IoInfo.WriteOperationCount = Job->WriteOperationCount;
-        AccountingInfo.IoInfo.OtherOperationCount = Job->OtherOperationCount;
-        AccountingInfo.IoInfo.ReadTransferCount = Job->ReadTransferCount;
-        AccountingInfo.IoInfo.WriteTransferCount = Job->WriteTransferCount;
-        AccountingInfo.IoInfo.OtherTransferCount = Job->OtherTransferCount;
+        // The usage charged to the job, by its processes and by those of the
+        // jobs nested in it, is read from its slots without walking the
+        // process list. The period times are those at the last update of
+        // the totals plus what was charged since.
 
 
-        // Add in the time and page faults for each process
+        PspCaptureJobUsage(Job,&Usage);
 
 
-        Next = Job->ProcessListHead.Flink;
+        // Where the clock interrupt does not charge processor time to the
+        // job, add what each running process used since it was charged
 
-        while ( Next != &Job->ProcessListHead) {
 
-            Process = (PEPROCESS)(CONTAINING_RECORD(Next,EPROCESS,JobLinks));
-            if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
+        if ( !PspJobTimeAtTick ) {
 
-                UserTime.QuadPart = UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement);
-                KernelTime.QuadPart = UInt32x32To64(Process->Pcb.KernelTime,KeMaximumIncrement);
+            Next = Job->ProcessListHead.Flink;
 
-                AccountingInfo.BasicInfo.TotalUserTime.QuadPart += UserTime.QuadPart;
-                AccountingInfo.BasicInfo.TotalKernelTime.QuadPart += KernelTime.QuadPart;
-                AccountingInfo.BasicInfo.ThisPeriodTotalUserTime.QuadPart += UserTime.QuadPart;
-                AccountingInfo.BasicInfo.ThisPeriodTotalKernelTime.QuadPart += KernelTime.QuadPart;
-                AccountingInfo.BasicInfo.TotalPageFaultCount += Process->Vm.PageFaultCount;
+            while ( Next != &Job->ProcessListHead) {
 
-                AccountingInfo.IoInfo.ReadOperationCount += Process->ReadOperationCount.QuadPart;
-                AccountingInfo.IoInfo.WriteOperationCount += Process->WriteOperationCount.QuadPart;
-                AccountingInfo.IoInfo.OtherOperationCount += Process->OtherOperationCount.QuadPart;
-                AccountingInfo.IoInfo.ReadTransferCount += Process->ReadTransferCount.QuadPart;
-                AccountingInfo.IoInfo.WriteTransferCount += Process->WriteTransferCount.QuadPart;
-                AccountingInfo.IoInfo.OtherTransferCount += Process->OtherTransferCount.QuadPart;
+                Process = (PEPROCESS)(CONTAINING_RECORD(Next,EPROCESS,JobLinks));
+                if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
+                    Usage.UserTime.QuadPart += UInt32x32To64(Process->Pcb.UserTime - Process->JobUserTimeCharged,KeMaximumIncrement);
+                    Usage.KernelTime.QuadPart += UInt32x32To64(Process->Pcb.KernelTime - Process->JobKernelTimeCharged,KeMaximumIncrement);
+                    }
+                Next = Next->Flink;
                 }
-            Next = Next->Flink;
             }
 
+        AccountingInfo.BasicInfo.TotalUserTime = Usage.UserTime;
+        AccountingInfo.BasicInfo.TotalKernelTime = Usage.KernelTime;
+        AccountingInfo.BasicInfo.ThisPeriodTotalUserTime.QuadPart = Job->ThisPeriodTotalUserTime.QuadPart +
+            (Usage.UserTime.QuadPart - Job->TotalUserTime.QuadPart);
+        AccountingInfo.BasicInfo.ThisPeriodTotalKernelTime.QuadPart = Job->ThisPeriodTotalKernelTime.QuadPart +
+            (Usage.KernelTime.QuadPart - Job->TotalKernelTime.QuadPart);
+        AccountingInfo.BasicInfo.TotalPageFaultCount = Usage.PageFaultCount;
+
+        AccountingInfo.BasicInfo.TotalProcesses = Job->TotalProcesses;
+        AccountingInfo.BasicInfo.ActiveProcesses = Job->ActiveProcesses;
+        AccountingInfo.BasicInfo.TotalTerminatedProcesses = Job->TotalTerminatedProcesses;
+
+        AccountingInfo.IoInfo.ReadOperationCount = Usage.ReadOperationCount;
+        AccountingInfo.IoInfo.WriteOperationCount = Usage.WriteOperationCount;
+        AccountingInfo.IoInfo.OtherOperationCount = Usage.OtherOperationCount;
+        AccountingInfo.IoInfo.ReadTransferCount = Usage.ReadTransferCount;
+        AccountingInfo.IoInfo.WriteTransferCount = Usage.WriteTransferCount;
+        AccountingInfo.IoInfo.OtherTransferCount = Usage.OtherTransferCount;
+
         ReturnData = &AccountingInfo;
         st = STATUS_SUCCESS;
 
@@ -1021,6 +1125,8 @@ NtQueryInformationJobObject(
 
             ExAcquireFastMutexUnsafe(&Job->MemoryLimitsLock);
 
+            PspHarvestJobCommit(Job);
+
             ExtendedLimitInfo.ProcessMemoryLimit = Job->ProcessMemoryLimit << PAGE_SHIFT;
             ExtendedLimitInfo.JobMemoryLimit = Job->JobMemoryLimit << PAGE_SHIFT;
             ExtendedLimitInfo.PeakJobMemoryUsed = Job->PeakJobMemoryUsed << PAGE_SHIFT;
@@ -1759,27 +1865,23 @@ NtSetInformationJobObject(
                             if ( KeReadStateProcess(&Process->Pcb) ) {
                                 PspFoldProcessAccountingIntoJob(Job,Process);
                                 }
-                            else {
-
-                                LARGE_INTEGER ProcessTime;
 
+                            Next = Next->Flink;
+                            }
 
-                                // running processes have their current runtime
-                                // added to the programmed limit. This way, you
-                                // can set a limit on a job with processes in the
-                                // job and not have previous runtimes count against
-                                // the limit
 
+                        // bring the totals up to what has been charged so far,
+                        // charging running processes with their runtime where the
+                        // clock does not. Clearing the period times below then
+                        // keeps previous runtimes from counting against the limit
 
-                                if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
-                                    ProcessTime.QuadPart = UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement);
-                                    Job->PerJobUserTimeLimit.QuadPart += ProcessTime.QuadPart;
-                                    }
-                                }
 
-                            Next = Next->Flink;
+                        if ( !PspJobTimeAtTick ) {
+                            PspChargeRunningProcesses(Job);
                             }
 
+                        PspUpdateJobTotals(Job);
+
 
 
                         // clear period times and reset the job
@@ -2335,6 +2437,10 @@ NTSTATUS NtTerminateJobObject(IN HANDLE JobHandle, IN NTSTATUS ExitStatus)
     ExReleaseResource(&Job->JobLock);
     KeLeaveCriticalRegion();
 
+    // The processes of jobs nested in this one go with it
+
+    PspTerminateNestedJobsAndWait(Job,ExitStatus);
+
     ObDereferenceObject(Job);
     return st;
 }
@@ -2355,121 +2461,135 @@ PsEnforceExecutionTimeLimits(
     ExAcquireFastMutex(&PspJobListLock);
 
 
-    // Look at each job. If time limits are set for the job, then enforce them
+    // Look at each job. If time limits are set for the job, then enforce them.
+    // Where the clock interrupt does not charge processor time to jobs, every
+    // job has its running processes charged here, so that the jobs it is
+    // nested in see its time
 
     NextJob = PspJobList.Flink;
     while ( NextJob != &PspJobList ) {
         Job = (PEJOB)(CONTAINING_RECORD(NextJob,EJOB,JobLinks));
-        if ( Job->LimitFlags & (JOB_OBJECT_LIMIT_PROCESS_TIME | JOB_OBJECT_LIMIT_JOB_TIME) ) {
-            // Job looks like a candidate for time enforcing. Need to get the
-            // job lock to be sure, but we don't want to hang waiting for the
-            // job lock, so skip the job until next time around if we need to
 
-            if ( ExAcquireResourceExclusive(&Job->JobLock, FALSE) ) {
-                if ( Job->LimitFlags & (JOB_OBJECT_LIMIT_PROCESS_TIME | JOB_OBJECT_LIMIT_JOB_TIME) ) {
-                    // Job is setup for time limits
+        if ( PspJobTimeAtTick &&
+             !(Job->LimitFlags & (JOB_OBJECT_LIMIT_PROCESS_TIME | JOB_OBJECT_LIMIT_JOB_TIME)) ) {
+            NextJob = NextJob->Flink;
+            continue;
+            }
 
-                    RunningJobTime.QuadPart = Job->ThisPeriodTotalUserTime.QuadPart;
+        // Need to get the job lock, but we don't want to hang waiting for the
+        // job lock, so skip the job until next time around if we need to
 
-                    NextProcess = Job->ProcessListHead.Flink;
+        if ( ExAcquireResourceExclusive(&Job->JobLock, FALSE) ) {
 
-                    while ( NextProcess != &Job->ProcessListHead) {
-                        Process = (PEPROCESS)(CONTAINING_RECORD(NextProcess,EPROCESS,JobLinks));
-                        ProcessTime.QuadPart = UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement);
+            if ( !PspJobTimeAtTick ) {
+                PspChargeRunningProcesses(Job);
+                }
 
-                        if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
-                            RunningJobTime.QuadPart += ProcessTime.QuadPart;
-                            }
+            if ( Job->LimitFlags & (JOB_OBJECT_LIMIT_PROCESS_TIME | JOB_OBJECT_LIMIT_JOB_TIME) ) {
+                // Job is setup for time limits. Bring the period time up to
+                // all the time charged so far, by its own processes and by
+                // those of the jobs nested in it.
 
-                        if ( Job->LimitFlags & JOB_OBJECT_LIMIT_PROCESS_TIME ) {
-                            if ( ProcessTime.QuadPart > Job->PerProcessUserTimeLimit.QuadPart ) {
+                PspUpdateJobTotals(Job);
 
+                RunningJobTime.QuadPart = Job->ThisPeriodTotalUserTime.QuadPart;
 
-                                // Process Time Limit has been exceeded.
+                NextProcess = Job->ProcessListHead.Flink;
 
-                                // Reference the process. Assert that it is not in its
-                                // delete routine. If all is OK, then nuke and dereferece
-                                // the process
+                while ( NextProcess != &Job->ProcessListHead) {
+                    Process = (PEPROCESS)(CONTAINING_RECORD(NextProcess,EPROCESS,JobLinks));
+                    ProcessTime.QuadPart = UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement);
 
+                    if ( Job->LimitFlags & JOB_OBJECT_LIMIT_PROCESS_TIME &&
+                         ProcessTime.QuadPart > Job->PerProcessUserTimeLimit.QuadPart ) {
 
-                                ObReferenceObject(Process);
 
+                        // Process Time Limit has been exceeded.
 
-                                // Avoid double delete since process could be in delete routine during the above ref
+                        // Reference the process. Assert that it is not in its
+                        // delete routine. If all is OK, then nuke and dereferece
+                        // the process
 
-                                if ( ObGetObjectPointerCount(Process) > 1 ) {
 
-                                    if ( !(Process->JobStatus & PS_JOB_STATUS_NOT_REALLY_ACTIVE) ) {
-                                        if ( PspTerminateProcess(Process,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) == STATUS_SUCCESS ) {
+                        ObReferenceObject(Process);
 
-                                            Job->TotalTerminatedProcesses++;
-                                            PS_SET_CLEAR_BITS (&Process->JobStatus,
-                                                               PS_JOB_STATUS_NOT_REALLY_ACTIVE,
-                                                               PS_JOB_STATUS_LAST_REPORT_MEMORY);
-                                            Job->ActiveProcesses--;
 
-                                            if ( Job->CompletionPort ) {
-                                                IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, (PVOID)Process->UniqueProcessId, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_PROCESS_TIME, FALSE);
-                                                }
-                                            PspFoldProcessAccountingIntoJob(Job,Process);
+                        // Avoid double delete since process could be in delete routine during the above ref
 
-                                            }
+                        if ( ObGetObjectPointerCount(Process) > 1 ) {
+
+                            if ( !(Process->JobStatus & PS_JOB_STATUS_NOT_REALLY_ACTIVE) ) {
+                                if ( PspTerminateProcess(Process,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) == STATUS_SUCCESS ) {
+
+                                    Job->TotalTerminatedProcesses++;
+                                    PS_SET_CLEAR_BITS (&Process->JobStatus,
+                                                       PS_JOB_STATUS_NOT_REALLY_ACTIVE,
+                                                       PS_JOB_STATUS_LAST_REPORT_MEMORY);
+                                    Job->ActiveProcesses--;
+
+                                    if ( Job->CompletionPort ) {
+                                        IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, (PVOID)Process->UniqueProcessId, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_PROCESS_TIME, FALSE);
                                         }
-                                    ObDereferenceObject(Process);
+                                    PspFoldProcessAccountingIntoJob(Job,Process);
+
                                     }
                                 }
+                            ObDereferenceObject(Process);
                             }
-
-                        NextProcess = NextProcess->Flink;
                         }
-                    if ( Job->LimitFlags & JOB_OBJECT_LIMIT_JOB_TIME ) {
-                        if ( RunningJobTime.QuadPart > Job->PerJobUserTimeLimit.QuadPart ) {
-                            // Job Time Limit has been exceeded.
 
-                            // Perform the appropriate action
-                            switch ( Job->EndOfJobTimeAction ) {
-                            case JOB_OBJECT_TERMINATE_AT_END_OF_JOB:
-                                if ( PspTerminateAllProcessesInJob(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) ) {
-                                    if ( Job->ActiveProcesses == 0 ) {
-                                        KeSetEvent(&Job->Event,0,FALSE);
-                                        if ( Job->CompletionPort ) {
-                                            PS_CLEAR_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
-                                            IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, NULL, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_JOB_TIME, FALSE);
-                                            }
+                    NextProcess = NextProcess->Flink;
+                    }
+                if ( Job->LimitFlags & JOB_OBJECT_LIMIT_JOB_TIME ) {
+                    if ( RunningJobTime.QuadPart > Job->PerJobUserTimeLimit.QuadPart ) {
+                        // Job Time Limit has been exceeded.
+
+                        // Perform the appropriate action. Termination takes
+                        // the processes of nested jobs along, since their time
+                        // counts against the limit.
+                        switch ( Job->EndOfJobTimeAction ) {
+                        case JOB_OBJECT_TERMINATE_AT_END_OF_JOB:
+                            PspTerminateNestedJobs(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout);
+                            if ( PspTerminateAllProcessesInJob(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) ) {
+                                if ( Job->ActiveProcesses == 0 ) {
+                                    KeSetEvent(&Job->Event,0,FALSE);
+                                    if ( Job->CompletionPort ) {
+                                        PS_CLEAR_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
+                                        IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, NULL, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_JOB_TIME, FALSE);
                                         }
                                     }
-                                break;
-                            case JOB_OBJECT_POST_AT_END_OF_JOB:
-                                if ( Job->CompletionPort ) {
-                                    PS_CLEAR_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
-                                    st = IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, NULL, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_JOB_TIME, FALSE);
-                                    if ( NT_SUCCESS(st) ) {
-                                        // Clear job level time limit
-                                        Job->LimitFlags &= ~JOB_OBJECT_LIMIT_JOB_TIME;
-                                        Job->PerJobUserTimeLimit.QuadPart = 0;
-                                        }
+                                }
+                            break;
+                        case JOB_OBJECT_POST_AT_END_OF_JOB:
+                            if ( Job->CompletionPort ) {
+                                PS_CLEAR_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
+                                st = IoSetIoCompletion(Job->CompletionPort, Job->CompletionKey, NULL, STATUS_SUCCESS, JOB_OBJECT_MSG_END_OF_JOB_TIME, FALSE);
+                                if ( NT_SUCCESS(st) ) {
+                                    // Clear job level time limit
+                                    Job->LimitFlags &= ~JOB_OBJECT_LIMIT_JOB_TIME;
+                                    Job->PerJobUserTimeLimit.QuadPart = 0;
                                     }
-                                else {
-                                    if ( PspTerminateAllProcessesInJob(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) ) {
-                                        if ( Job->ActiveProcesses == 0 ) {
-                                            KeSetEvent(&Job->Event,0,FALSE);
-                                            }
+                                }
+                            else {
+                                PspTerminateNestedJobs(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout);
+                                if ( PspTerminateAllProcessesInJob(Job,ERROR_NOT_ENOUGH_QUOTA,PsLockReturnTimeout) ) {
+                                    if ( Job->ActiveProcesses == 0 ) {
+                                        KeSetEvent(&Job->Event,0,FALSE);
                                         }
                                     }
-                                break;
                                 }
+                            break;
                             }
                         }
                     }
-                ExReleaseResource(&Job->JobLock);
                 }
+            ExReleaseResource(&Job->JobLock);
             }
         NextJob = NextJob->Flink;
         }
     ExReleaseFastMutex(&PspJobListLock);
 }
 
-
 BOOLEAN PspTerminateAllProcessesInJob(PEJOB Job, NTSTATUS Status, PSLOCKPROCESSMODE LockMode)
 {
     PLIST_ENTRY NextProcess;
@@ -2518,163 +2638,841 @@ BOOLEAN PspTerminateAllProcessesInJob(PEJOB Job, NTSTATUS Status, PSLOCKPROCESSM
     return TerminatedAProcess;
 }
 
-
-VOID
-PspFoldProcessAccountingIntoJob(
+NTSTATUS
+PspNestJob(
     PEJOB Job,
-    PEPROCESS Process
+    PEJOB ParentJob
     )
-{
-    LARGE_INTEGER UserTime, KernelTime;
+/*++
 
-    if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
-        UserTime.QuadPart = UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement);
-        KernelTime.QuadPart = UInt32x32To64(Process->Pcb.KernelTime,KeMaximumIncrement);
+Routine Description:
 
-        Job->TotalUserTime.QuadPart += UserTime.QuadPart;
-        Job->TotalKernelTime.QuadPart += KernelTime.QuadPart;
-        Job->ThisPeriodTotalUserTime.QuadPart += UserTime.QuadPart;
-        Job->ThisPeriodTotalKernelTime.QuadPart += KernelTime.QuadPart;
+    Nests a job inside another. From now on the accounting of the parent
+    includes that of the nested job, and the job wide limits of the parent,
+    job memory and job time, count the nested job's commit and time, and
+    end its processes along with the parent's own. Limits that apply to
+    each process, the per process time and memory limits, active process
+    count, affinity, priority and scheduling class, UI and security
+    limits, are not applied to the processes of the nested job, which
+    stay under those of their own job.
 
-        Job->ReadOperationCount += Process->ReadOperationCount.QuadPart;
-        Job->WriteOperationCount += Process->WriteOperationCount.QuadPart;
-        Job->OtherOperationCount += Process->OtherOperationCount.QuadPart;
-        Job->ReadTransferCount += Process->ReadTransferCount.QuadPart;
-        Job->WriteTransferCount += Process->WriteTransferCount.QuadPart;
-        Job->OtherTransferCount += Process->OtherTransferCount.QuadPart;
+Arguments:
 
-        Job->TotalPageFaultCount += Process->Vm.PageFaultCount;
+    Job - Referenced job to nest.
+    ParentJob - Referenced job to nest it in.
 
+Return Value:
 
-        if ( Process->CommitChargePeak > Job->PeakProcessMemoryUsed ) {
-            Job->PeakProcessMemoryUsed = Process->CommitChargePeak;
-            }
+    STATUS_ACCESS_DENIED if the job is already nested, or ParentJob is the
+    job itself or nested in it.
 
-        PS_SET_CLEAR_BITS (&Process->JobStatus,
-                           PS_JOB_STATUS_ACCOUNTING_FOLDED,
-                           PS_JOB_STATUS_LAST_REPORT_MEMORY);
+--*/
+{
+    SIZE_T JobMemoryUsed;
 
-        if ( Job->CompletionPort && Job->ActiveProcesses == 0) {
-            IoSetIoCompletion(
-                Job->CompletionPort,
-                Job->CompletionKey,
-                NULL,
-                STATUS_SUCCESS,
-                JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO,
-                FALSE
-                );
-            }
+    PAGED_CODE();
+
+    if ( Job->SessionId != ParentJob->SessionId ) {
+        return STATUS_ACCESS_DENIED;
         }
-}
 
-NTSTATUS
-PspCaptureTokenFilter(
-    KPROCESSOR_MODE PreviousMode,
-    PJOBOBJECT_SECURITY_LIMIT_INFORMATION SecurityLimitInfo,
-    PPS_JOB_TOKEN_FILTER * TokenFilter
-    )
-{
-    NTSTATUS Status ;
-    PPS_JOB_TOKEN_FILTER Filter ;
+    ExAcquireFastMutex(&PspJobListLock);
 
-    Filter = ExAllocatePoolWithTag( NonPagedPool, sizeof( PS_JOB_TOKEN_FILTER ), 'fTsP' );
-    if ( !Filter )
-    {
-        *TokenFilter = NULL ;
-        return STATUS_INSUFFICIENT_RESOURCES ;
-    }
-    RtlZeroMemory( Filter, sizeof( PS_JOB_TOKEN_FILTER ) );
+    if ( Job->ParentJob || PspIsJobNestedIn(ParentJob,Job) ) {
+        ExReleaseFastMutex(&PspJobListLock);
+        return STATUS_ACCESS_DENIED;
+        }
 
-    try {
-        Status = STATUS_SUCCESS ;
 
-        //  Capture Sids to remove
-        if (ARGUMENT_PRESENT( SecurityLimitInfo->SidsToDisable)) {
-            ProbeForRead( SecurityLimitInfo->SidsToDisable, sizeof(TOKEN_GROUPS), sizeof(ULONG) );
-            Filter->CapturedGroupCount = SecurityLimitInfo->SidsToDisable->GroupCount;
-            Status = SeCaptureSidAndAttributesArray(
-                        SecurityLimitInfo->SidsToDisable->Groups,
-                        Filter->CapturedGroupCount,
-                        PreviousMode,
-                        NULL, 0,
-                        NonPagedPool,
-                        TRUE,
-                        &Filter->CapturedGroups,
-                        &Filter->CapturedGroupsLength
-                        );
-        }
+    // From now on the commit deltas pushed out of the slots of the job go on
+    // to the parent. Hand the parent what was pushed before under the same
+    // lock, so that no commit is lost or counted twice.
 
-        //  Capture PrivilegesToDelete
-        if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(SecurityLimitInfo->PrivilegesToDelete)) {
-            ProbeForRead( SecurityLimitInfo->PrivilegesToDelete, sizeof(TOKEN_PRIVILEGES), sizeof(ULONG) );
-            Filter->CapturedPrivilegeCount = SecurityLimitInfo->PrivilegesToDelete->PrivilegeCount;
-            Status = SeCaptureLuidAndAttributesArray(
-                         SecurityLimitInfo->PrivilegesToDelete->Privileges,
-                         Filter->CapturedPrivilegeCount,
-                         PreviousMode,
-                         NULL, 0,
-                         NonPagedPool,
-                         TRUE,
-                         &Filter->CapturedPrivileges,
-                         &Filter->CapturedPrivilegesLength
-                         );
-        }
 
-        //  Capture Restricted Sids
-        if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(SecurityLimitInfo->RestrictedSids)) {
-            ProbeForRead( SecurityLimitInfo->RestrictedSids, sizeof(TOKEN_GROUPS), sizeof(ULONG) );
-            Filter->CapturedSidCount = SecurityLimitInfo->RestrictedSids->GroupCount;
-            Status = SeCaptureSidAndAttributesArray(
-                        SecurityLimitInfo->RestrictedSids->Groups,
-                        Filter->CapturedSidCount,
-                        PreviousMode,
-                        NULL, 0,
-                        NonPagedPool,
-                        TRUE,
-                        &Filter->CapturedSids,
-                        &Filter->CapturedSidsLength
-                        );
+    ExAcquireFastMutexUnsafe(&Job->MemoryLimitsLock);
 
-        }
+    PspHarvestJobCommit(Job);
 
+    ObReferenceObject(ParentJob);
+    Job->ParentJob = ParentJob;
+    JobMemoryUsed = Job->CurrentJobMemoryUsed;
 
+    ExReleaseFastMutexUnsafe(&Job->MemoryLimitsLock);
 
-    } except(EXCEPTION_EXECUTE_HANDLER) {
+    ExReleaseFastMutex(&PspJobListLock);
 
-        Status = GetExceptionCode();
-    }  // end_try
+    PspAddJobCommit(ParentJob,(SSIZE_T)JobMemoryUsed);
 
-    if ( !NT_SUCCESS( Status ) )
-    {
-        if ( Filter->CapturedSids )
-        {
-            ExFreePool( Filter->CapturedSids );
-        }
+    return STATUS_SUCCESS;
+}
 
-        if ( Filter->CapturedPrivileges )
-        {
-            ExFreePool( Filter->CapturedPrivileges );
-        }
+BOOLEAN
+PspIsJobNestedIn(
+    PEJOB Job,
+    PEJOB ParentJob
+    )
+{
+    PAGED_CODE();
 
-        if ( Filter->CapturedGroups )
-        {
-            ExFreePool( Filter->CapturedGroups );
+    while ( Job != NULL ) {
+        if ( Job == ParentJob ) {
+            return TRUE;
+            }
+        Job = Job->ParentJob;
         }
 
-        ExFreePool( Filter );
+    return FALSE;
+}
 
-        Filter = NULL ;
+VOID
+PspTerminateNestedJobs(
+    PEJOB Job,
+    NTSTATUS Status,
+    PSLOCKPROCESSMODE LockMode
+    )
+/*++
 
-    }
+Routine Description:
 
-    *TokenFilter = Filter ;
+    Terminates the processes of all jobs nested in a job, at any depth. The
+    caller holds PspJobListLock, so nested jobs whose lock is busy are
+    skipped rather than waited for.
 
-    return Status ;
+Arguments:
 
+    Job - Job whose nested jobs are terminated.
+    Status - Exit status for the processes.
+    LockMode - As for PspTerminateAllProcessesInJob.
 
-}
+Return Value:
 
+    None.
 
+--*/
+{
+    PLIST_ENTRY NextJob;
+    PEJOB NestedJob;
+
+    PAGED_CODE();
+
+    NextJob = PspJobList.Flink;
+    while ( NextJob != &PspJobList ) {
+        NestedJob = (PEJOB)(CONTAINING_RECORD(NextJob,EJOB,JobLinks));
+
+        if ( NestedJob != Job && PspIsJobNestedIn(NestedJob,Job) ) {
+            if ( ExAcquireResourceExclusive(&NestedJob->JobLock, FALSE) ) {
+                PspTerminateAllProcessesInJob(NestedJob,Status,LockMode);
+                ExReleaseResource(&NestedJob->JobLock);
+                }
+            }
+
+        NextJob = NextJob->Flink;
+        }
+}
+
+VOID
+PspTerminateNestedJobsAndWait(
+    PEJOB Job,
+    NTSTATUS Status
+    )
+/*++
+
+Routine Description:
+
+    Terminates the processes of all jobs nested in a job, at any depth,
+    waiting for the lock of each nested job. PspJobListLock is only held
+    to walk the list: each nested job is referenced, which keeps it on the
+    list, and terminated with the list lock released.
+
+Arguments:
+
+    Job - Job whose nested jobs are terminated.
+    Status - Exit status for the processes.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY NextJob;
+    PEJOB NestedJob;
+    PEJOB ReferencedJob;
+
+    PAGED_CODE();
+
+    ReferencedJob = NULL;
+
+    ExAcquireFastMutex(&PspJobListLock);
+
+    NextJob = PspJobList.Flink;
+    while ( NextJob != &PspJobList ) {
+        NestedJob = (PEJOB)(CONTAINING_RECORD(NextJob,EJOB,JobLinks));
+
+        if ( NestedJob != Job && PspIsJobNestedIn(NestedJob,Job) ) {
+            ObReferenceObject(NestedJob);
+
+
+            // Avoid double delete since the job could be in its delete
+            // routine, waiting for the list lock, during the above ref
+
+
+            if ( ObGetObjectPointerCount(NestedJob) > 1 ) {
+                ExReleaseFastMutex(&PspJobListLock);
+
+
+                // The job referenced on the previous pass is let go with the
+                // list lock released, since its delete routine takes it
+
+
+                if ( ReferencedJob ) {
+                    ObDereferenceObject(ReferencedJob);
+                    }
+                ReferencedJob = NestedJob;
+
+                KeEnterCriticalRegion();
+                ExAcquireResourceExclusive(&NestedJob->JobLock, TRUE);
+                PspTerminateAllProcessesInJob(NestedJob,Status,PsLockPollOnTimeout);
+                ExReleaseResource(&NestedJob->JobLock);
+                KeLeaveCriticalRegion();
+
+                ExAcquireFastMutex(&PspJobListLock);
+                }
+            }
+
+        NextJob = NextJob->Flink;
+        }
+
+    ExReleaseFastMutex(&PspJobListLock);
+
+    if ( ReferencedJob ) {
+        ObDereferenceObject(ReferencedJob);
+        }
+}
+
+VOID
+PspFoldProcessAccountingIntoJob(
+    PEJOB Job,
+    PEPROCESS Process
+    )
+{
+    if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
+
+
+        // The usage of the process has been charged to the job as it ran.
+        // Where the clock does not charge the processor time, charge what
+        // was used since the last pass
+
+
+        if ( !PspJobTimeAtTick ) {
+            PspChargeProcessRunTime(Process);
+            }
+
+        PspRaiseJobPeak(&Job->PeakProcessMemoryUsed,Process->CommitChargePeak);
+
+        PS_SET_CLEAR_BITS (&Process->JobStatus,
+                           PS_JOB_STATUS_ACCOUNTING_FOLDED,
+                           PS_JOB_STATUS_LAST_REPORT_MEMORY);
+
+        if ( Job->CompletionPort && Job->ActiveProcesses == 0) {
+            IoSetIoCompletion(
+                Job->CompletionPort,
+                Job->CompletionKey,
+                NULL,
+                STATUS_SUCCESS,
+                JOB_OBJECT_MSG_ACTIVE_PROCESS_ZERO,
+                FALSE
+                );
+            }
+        }
+}
+
+VOID
+PsChargeJobUsage(
+    IN PEPROCESS Process,
+    IN PS_JOB_USAGE Usage,
+    IN ULONG Amount
+    )
+/*++
+
+Routine Description:
+
+    Charges usage of a process to its job and to each job that job is
+    nested in, by adding it to the slot of the current processor in each.
+    No lock is taken, so this may be called at any IRQL up to clock level.
+    Processes whose accounting was folded into the job charge nothing more.
+
+Arguments:
+
+    Process - Process that used the resource. It, and so its job, must not
+        be deleted while this runs.
+    Usage - Counter to charge.
+    Amount - Amount to add. Times are in 100ns units.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PEJOB Job;
+    ULONG Processor;
+
+    Job = Process->Job;
+
+    if ( Job == NULL || (Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
+        return;
+        }
+
+    Processor = KeGetCurrentProcessorNumber();
+
+    do {
+        ExInterlockedAddLargeStatistic(&Job->UsageSlots[Processor].Usage[Usage], Amount);
+        Job = Job->ParentJob;
+        } while ( Job != NULL );
+}
+
+VOID
+FASTCALL
+PspJobTimeUpdate(
+    IN PKPROCESS Process,
+    IN KPROCESSOR_MODE Mode
+    )
+/*++
+
+Routine Description:
+
+    Called by the clock interrupt for each tick it charges to a process,
+    see KeSetProcessTimeUpdateNotifyRoutine. Charges the tick to the job of
+    the process.
+
+Arguments:
+
+    Process - Process charged with the tick.
+    Mode - UserMode if the tick is user time, else KernelMode.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PsChargeJobUsage(CONTAINING_RECORD(Process,EPROCESS,Pcb),
+                     (Mode == UserMode) ? PsJobUserTime : PsJobKernelTime,
+                     KeMaximumIncrement);
+}
+
+VOID
+PspChargeJobUsage64(
+    PEPROCESS Process,
+    PS_JOB_USAGE Usage,
+    ULONGLONG Amount
+    )
+{
+    PAGED_CODE();
+
+    while ( Amount > MAXULONG ) {
+        PsChargeJobUsage(Process,Usage,MAXULONG);
+        Amount -= MAXULONG;
+        }
+
+    if ( Amount != 0 ) {
+        PsChargeJobUsage(Process,Usage,(ULONG)Amount);
+        }
+}
+
+VOID
+PspChargePriorUsage(
+    PEPROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    Charges the job of a process just added to it with what the process
+    used before. A tick or two that the clock charged between the process
+    getting its job and this capture are counted twice, which is within
+    the precision of the tick.
+
+Arguments:
+
+    Process - Process just added to its job. The job lock must be held
+        exclusive.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PAGED_CODE();
+
+    if ( PspJobTimeAtTick ) {
+        PspChargeJobUsage64(Process,PsJobUserTime,UInt32x32To64(Process->Pcb.UserTime,KeMaximumIncrement));
+        PspChargeJobUsage64(Process,PsJobKernelTime,UInt32x32To64(Process->Pcb.KernelTime,KeMaximumIncrement));
+        }
+
+    PspChargeJobUsage64(Process,PsJobReadOperationCount,Process->ReadOperationCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobWriteOperationCount,Process->WriteOperationCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobOtherOperationCount,Process->OtherOperationCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobReadTransferCount,Process->ReadTransferCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobWriteTransferCount,Process->WriteTransferCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobOtherTransferCount,Process->OtherTransferCount.QuadPart);
+    PspChargeJobUsage64(Process,PsJobPageFaultCount,Process->Vm.PageFaultCount);
+}
+
+VOID
+PspChargeProcessRunTime(
+    PEPROCESS Process
+    )
+/*++
+
+Routine Description:
+
+    Charges the job of a process with the processor time the process used
+    since this was last done. Only used where the clock interrupt does not
+    charge the time to the job itself.
+
+Arguments:
+
+    Process - Process in the job. The job lock must be held exclusive.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    ULONG UserTime;
+    ULONG KernelTime;
+
+    PAGED_CODE();
+
+    UserTime = Process->Pcb.UserTime;
+    KernelTime = Process->Pcb.KernelTime;
+
+    PspChargeJobUsage64(Process,PsJobUserTime,UInt32x32To64(UserTime - Process->JobUserTimeCharged,KeMaximumIncrement));
+    PspChargeJobUsage64(Process,PsJobKernelTime,UInt32x32To64(KernelTime - Process->JobKernelTimeCharged,KeMaximumIncrement));
+
+    Process->JobUserTimeCharged = UserTime;
+    Process->JobKernelTimeCharged = KernelTime;
+}
+
+VOID
+PspChargeRunningProcesses(
+    PEJOB Job
+    )
+/*++
+
+Routine Description:
+
+    Charges each running process of a job with the processor time it used
+    since it was last charged. Only used where the clock interrupt does not
+    charge the time to the job itself.
+
+Arguments:
+
+    Job - Job to charge. The job lock must be held exclusive.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PLIST_ENTRY Next;
+    PEPROCESS Process;
+
+    PAGED_CODE();
+
+    Next = Job->ProcessListHead.Flink;
+
+    while ( Next != &Job->ProcessListHead) {
+
+        Process = (PEPROCESS)(CONTAINING_RECORD(Next,EPROCESS,JobLinks));
+        if ( !(Process->JobStatus & PS_JOB_STATUS_ACCOUNTING_FOLDED) ) {
+            PspChargeProcessRunTime(Process);
+            }
+        Next = Next->Flink;
+        }
+}
+
+VOID
+PspCaptureJobUsage(
+    PEJOB Job,
+    PPS_JOB_ACCOUNTING Usage
+    )
+/*++
+
+Routine Description:
+
+    Returns the usage charged to a job so far, the sum of its slots.
+
+Arguments:
+
+    Job - Job whose usage is wanted.
+    Usage - Receives the usage.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PPSP_JOB_USAGE_SLOT Slot;
+    ULONG i;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(Usage,sizeof(*Usage));
+
+    for ( i = 0; i < (ULONG)KeNumberProcessors; i++ ) {
+        Slot = &Job->UsageSlots[i];
+
+        Usage->UserTime.QuadPart += Slot->Usage[PsJobUserTime].QuadPart;
+        Usage->KernelTime.QuadPart += Slot->Usage[PsJobKernelTime].QuadPart;
+        Usage->ReadOperationCount += Slot->Usage[PsJobReadOperationCount].QuadPart;
+        Usage->WriteOperationCount += Slot->Usage[PsJobWriteOperationCount].QuadPart;
+        Usage->OtherOperationCount += Slot->Usage[PsJobOtherOperationCount].QuadPart;
+        Usage->ReadTransferCount += Slot->Usage[PsJobReadTransferCount].QuadPart;
+        Usage->WriteTransferCount += Slot->Usage[PsJobWriteTransferCount].QuadPart;
+        Usage->OtherTransferCount += Slot->Usage[PsJobOtherTransferCount].QuadPart;
+        Usage->PageFaultCount += Slot->Usage[PsJobPageFaultCount].LowPart;
+        }
+}
+
+VOID
+PspUpdateJobTotals(
+    PEJOB Job
+    )
+/*++
+
+Routine Description:
+
+    Brings the totals of a job up to the usage charged to its slots, and
+    adds the time charged since the last update to the period times.
+
+Arguments:
+
+    Job - Job to update. The job lock must be held exclusive.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PS_JOB_ACCOUNTING Usage;
+
+    PAGED_CODE();
+
+    PspCaptureJobUsage(Job,&Usage);
+
+    Job->ThisPeriodTotalUserTime.QuadPart += Usage.UserTime.QuadPart - Job->TotalUserTime.QuadPart;
+    Job->ThisPeriodTotalKernelTime.QuadPart += Usage.KernelTime.QuadPart - Job->TotalKernelTime.QuadPart;
+    Job->TotalUserTime = Usage.UserTime;
+    Job->TotalKernelTime = Usage.KernelTime;
+
+    Job->ReadOperationCount = Usage.ReadOperationCount;
+    Job->WriteOperationCount = Usage.WriteOperationCount;
+    Job->OtherOperationCount = Usage.OtherOperationCount;
+    Job->ReadTransferCount = Usage.ReadTransferCount;
+    Job->WriteTransferCount = Usage.WriteTransferCount;
+    Job->OtherTransferCount = Usage.OtherTransferCount;
+
+    Job->TotalPageFaultCount = Usage.PageFaultCount;
+}
+
+NTSTATUS
+PspCaptureTokenFilter(
+    KPROCESSOR_MODE PreviousMode,
+    PJOBOBJECT_SECURITY_LIMIT_INFORMATION SecurityLimitInfo,
+    PPS_JOB_TOKEN_FILTER * TokenFilter
+    )
+{
+    NTSTATUS Status ;
+    PPS_JOB_TOKEN_FILTER Filter ;
+
+    Filter = ExAllocatePoolWithTag( NonPagedPool, sizeof( PS_JOB_TOKEN_FILTER ), 'fTsP' );
+    if ( !Filter )
+    {
+        *TokenFilter = NULL ;
+        return STATUS_INSUFFICIENT_RESOURCES ;
+    }
+    RtlZeroMemory( Filter, sizeof( PS_JOB_TOKEN_FILTER ) );
+
+    try {
+        Status = STATUS_SUCCESS ;
+
+        //  Capture Sids to remove
+        if (ARGUMENT_PRESENT( SecurityLimitInfo->SidsToDisable)) {
+            ProbeForRead( SecurityLimitInfo->SidsToDisable, sizeof(TOKEN_GROUPS), sizeof(ULONG) );
+            Filter->CapturedGroupCount = SecurityLimitInfo->SidsToDisable->GroupCount;
+            Status = SeCaptureSidAndAttributesArray(
+                        SecurityLimitInfo->SidsToDisable->Groups,
+                        Filter->CapturedGroupCount,
+                        PreviousMode,
+                        NULL, 0,
+                        NonPagedPool,
+                        TRUE,
+                        &Filter->CapturedGroups,
+                        &Filter->CapturedGroupsLength
+                        );
+        }
+
+        //  Capture PrivilegesToDelete
+        if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(SecurityLimitInfo->PrivilegesToDelete)) {
+            ProbeForRead( SecurityLimitInfo->PrivilegesToDelete, sizeof(TOKEN_PRIVILEGES), sizeof(ULONG) );
+            Filter->CapturedPrivilegeCount = SecurityLimitInfo->PrivilegesToDelete->PrivilegeCount;
+            Status = SeCaptureLuidAndAttributesArray(
+                         SecurityLimitInfo->PrivilegesToDelete->Privileges,
+                         Filter->CapturedPrivilegeCount,
+                         PreviousMode,
+                         NULL, 0,
+                         NonPagedPool,
+                         TRUE,
+                         &Filter->CapturedPrivileges,
+                         &Filter->CapturedPrivilegesLength
+                         );
+        }
+
+        //  Capture Restricted Sids
+        if (NT_SUCCESS(Status) && ARGUMENT_PRESENT(SecurityLimitInfo->RestrictedSids)) {
+            ProbeForRead( SecurityLimitInfo->RestrictedSids, sizeof(TOKEN_GROUPS), sizeof(ULONG) );
+            Filter->CapturedSidCount = SecurityLimitInfo->RestrictedSids->GroupCount;
+            Status = SeCaptureSidAndAttributesArray(
+                        SecurityLimitInfo->RestrictedSids->Groups,
+                        Filter->CapturedSidCount,
+                        PreviousMode,
+                        NULL, 0,
+                        NonPagedPool,
+                        TRUE,
+                        &Filter->CapturedSids,
+                        &Filter->CapturedSidsLength
+                        );
+
+        }
+
+
+
+    } except(EXCEPTION_EXECUTE_HANDLER) {
+
+        Status = GetExceptionCode();
+    }  // end_try
+
+    if ( !NT_SUCCESS( Status ) )
+    {
+        if ( Filter->CapturedSids )
+        {
+            ExFreePool( Filter->CapturedSids );
+        }
+
+        if ( Filter->CapturedPrivileges )
+        {
+            ExFreePool( Filter->CapturedPrivileges );
+        }
+
+        if ( Filter->CapturedGroups )
+        {
+            ExFreePool( Filter->CapturedGroups );
+        }
+
+        ExFreePool( Filter );
+
+        Filter = NULL ;
+
+    }
+
+    *TokenFilter = Filter ;
+
+    return Status ;
+
+
+}
+
+
+
+VOID
+PspAddJobCommit(
+    PEJOB Job,
+    SSIZE_T Amount
+    )
+/*++
+
+Routine Description:
+
+    Charges commit to a job without taking its memory limits lock, by
+    adding it to the slot of the current processor. It reaches the total of
+    the job the next time the lock is taken.
+
+Arguments:
+
+    Job - Job to charge.
+    Amount - Pages to charge, negative to give them back.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    PSSIZE_T Delta;
+
+    Delta = &Job->CommitSlots[KeGetCurrentProcessorNumber()].Delta;
+
+#if defined(_WIN64)
+    InterlockedExchangeAdd64((PLONGLONG)Delta, Amount);
+#else
+    InterlockedExchangeAdd((PLONG)Delta, Amount);
+#endif
+}
+
+VOID
+PspHarvestJobCommit(
+    PEJOB Job
+    )
+/*++
+
+Routine Description:
+
+    Pushes the commit charged to the slots of a job into its total, and on
+    into the slots of the job it is nested in. The memory limits lock of the
+    job must be held.
+
+Arguments:
+
+    Job - Job whose slots are emptied.
+
+Return Value:
+
+    None.
+
+--*/
+{
+    SSIZE_T Delta;
+    ULONG i;
+
+    Delta = 0;
+    for ( i = 0; i < (ULONG)KeNumberProcessors; i++ ) {
+        Delta += (SSIZE_T)InterlockedExchangePointer((PVOID *)&Job->CommitSlots[i].Delta, NULL);
+        }
+
+    if ( Delta != 0 ) {
+        Job->CurrentJobMemoryUsed += Delta;
+        PspRaiseJobPeak(&Job->PeakJobMemoryUsed,Job->CurrentJobMemoryUsed);
+
+        if ( Job->ParentJob ) {
+            PspAddJobCommit(Job->ParentJob,Delta);
+            }
+        }
+}
+
+VOID
+PspRaiseJobPeak(
+    PSIZE_T Peak,
+    SIZE_T Value
+    )
+{
+    SIZE_T OldPeak;
+
+
+    // Deltas pushed out of different slots can leave a total briefly below
+    // zero, which is never a peak
+
+
+    if ( (SSIZE_T)Value < 0 ) {
+        return;
+        }
+
+    while ( Value > (OldPeak = *(volatile SIZE_T *)Peak) ) {
+        if ( InterlockedCompareExchangePointer((PVOID *)Peak, (PVOID)Value, (PVOID)OldPeak) == (PVOID)OldPeak ) {
+            break;
+            }
+        }
+}
+
+BOOLEAN
+PspChargeJobCommit(
+    PEJOB Job,
+    PEPROCESS Process,
+    SSIZE_T Amount,
+    PEJOB *ParentJob
+    )
+/*++
+
+Routine Description:
+
+    Charges commit to a job under its memory limits lock, checking the job
+    memory limit. The caller is in a critical region.
+
+Arguments:
+
+    Job - Job to charge.
+    Process - Current process, reported to the job port if the limit is hit.
+    Amount - Pages to charge, negative to give them back.
+    ParentJob - Receives the job this one is nested in, read under the lock
+        so that the charge goes on to it exactly when it is not part of what
+        PspNestJob handed over.
+
+Return Value:
+
+    FALSE if the charge would exceed the job memory limit, in which case
+    nothing is charged.
+
+--*/
+{
+    SIZE_T CurrentJobMemoryUsed;
+    BOOLEAN ReturnValue;
+
+    ReturnValue = TRUE;
+
+    ExAcquireFastMutexUnsafe(&Job->MemoryLimitsLock);
+
+    PspHarvestJobCommit(Job);
+
+    CurrentJobMemoryUsed = Job->CurrentJobMemoryUsed + Amount;
+
+    if ( Job->LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY &&
+         (SSIZE_T)CurrentJobMemoryUsed > 0 &&
+         CurrentJobMemoryUsed > Job->JobMemoryLimit ) {
+        ReturnValue = FALSE;
+
+
+        // Tell the job port that commit has been exceeded, and process id x
+        // was the one that hit it.
+
+
+        if ( Job->CompletionPort
+             && Process->UniqueProcessId
+             && (Process->JobStatus & PS_JOB_STATUS_NEW_PROCESS_REPORTED)
+             && (Process->JobStatus & PS_JOB_STATUS_LAST_REPORT_MEMORY) == 0) {
+
+            PS_SET_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
+            IoSetIoCompletion(
+                Job->CompletionPort,
+                Job->CompletionKey,
+                (PVOID)Process->UniqueProcessId,
+                STATUS_SUCCESS,
+                JOB_OBJECT_MSG_JOB_MEMORY_LIMIT,
+                TRUE
+                );
+
+            }
+        }
+    else {
+
+        // update current and peak counters
+
+        Job->CurrentJobMemoryUsed = CurrentJobMemoryUsed;
+        PspRaiseJobPeak(&Job->PeakJobMemoryUsed,CurrentJobMemoryUsed);
+        }
+
+    *ParentJob = Job->ParentJob;
+
+    ExReleaseFastMutexUnsafe(&Job->MemoryLimitsLock);
+
+    return ReturnValue;
+}
 
 BOOLEAN
 PsChangeJobMemoryUsage(
@@ -2683,7 +3481,9 @@ PsChangeJobMemoryUsage(
 {
     PEPROCESS Process;
     PEJOB Job;
-    SIZE_T CurrentJobMemoryUsed;
+    PEJOB LimitJob;
+    PEJOB ParentJob;
+    PEJOB ChargedJob;
     BOOLEAN ReturnValue;
 
     ReturnValue = TRUE;
@@ -2691,63 +3491,62 @@ PsChangeJobMemoryUsage(
     Job = Process->Job;
     if ( Job ) {
 
-        // This routine can be called while hoolding the process lock (during
-        // teb deletion... So instead of using the job lock, we must use the
-        // memory limits lock. The lock order is always (job lock followed by
-        // process lock. The memory limits lock never nests or calls other
-        // code while held. It can be grapped while holding the job lock, or the process
-        // lock.
-
-        KeEnterCriticalRegion();
-        ExAcquireFastMutexUnsafe(&Job->MemoryLimitsLock);
-
-        CurrentJobMemoryUsed = Job->CurrentJobMemoryUsed + Amount;
-
-        if ( Job->LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY &&
-             CurrentJobMemoryUsed > Job->JobMemoryLimit ) {
-            CurrentJobMemoryUsed = Job->CurrentJobMemoryUsed;
-            ReturnValue = FALSE;
 
+        // Look for a job memory limit on the job or on any job it is nested in
 
 
+        for ( LimitJob = Job; LimitJob != NULL; LimitJob = LimitJob->ParentJob ) {
+            if ( LimitJob->LimitFlags & JOB_OBJECT_LIMIT_JOB_MEMORY ) {
+                break;
+                }
+            }
 
-            // Tell the job port that commit has been exceeded, and process id x
-            // was the one that hit it.
+        if ( LimitJob == NULL ) {
 
 
-            if ( Job->CompletionPort
-                 && Process->UniqueProcessId
-                 && (Process->JobStatus & PS_JOB_STATUS_NEW_PROCESS_REPORTED)
-                 && (Process->JobStatus & PS_JOB_STATUS_LAST_REPORT_MEMORY) == 0) {
+            // Nothing to check, so the charge need only be counted. Count it
+            // in the slot of this processor rather than serializing every
+            // commit change in the job on the memory limits lock.
 
-                PS_SET_BITS (&Process->JobStatus, PS_JOB_STATUS_LAST_REPORT_MEMORY);
-                IoSetIoCompletion(
-                    Job->CompletionPort,
-                    Job->CompletionKey,
-                    (PVOID)Process->UniqueProcessId,
-                    STATUS_SUCCESS,
-                    JOB_OBJECT_MSG_JOB_MEMORY_LIMIT,
-                    TRUE
-                    );
 
-                }
+            PspAddJobCommit(Job,Amount);
             }
+        else {
 
-        if ( ReturnValue ) {
+            // This routine can be called while hoolding the process lock (during
+            // teb deletion... So instead of using the job lock, we must use the
+            // memory limits lock. The lock order is always (job lock followed by
+            // process lock. The memory limits lock never nests or calls other
+            // code while held. It can be grapped while holding the job lock, or the process
+            // lock.
+
+            // Charge the job and then each job it is nested in, one lock at a
+            // time. If one of them is over its limit give the charge back to
+            // the jobs below it.
 
-            // update current and peak counters
+            KeEnterCriticalRegion();
 
-            Job->CurrentJobMemoryUsed = CurrentJobMemoryUsed;
-            if ( CurrentJobMemoryUsed > Job->PeakJobMemoryUsed ) {
-                Job->PeakJobMemoryUsed = CurrentJobMemoryUsed;
+            for ( LimitJob = Job; LimitJob != NULL; LimitJob = ParentJob ) {
+                if ( !PspChargeJobCommit(LimitJob,Process,Amount,&ParentJob) ) {
+                    ReturnValue = FALSE;
+                    break;
+                    }
                 }
 
-            if ( Process->CommitCharge + Amount > Job->PeakProcessMemoryUsed ) {
-                Job->PeakProcessMemoryUsed = Process->CommitCharge + Amount;
+            if ( !ReturnValue ) {
+                for ( ChargedJob = Job; ChargedJob != LimitJob; ChargedJob = ChargedJob->ParentJob ) {
+                    ExAcquireFastMutexUnsafe(&ChargedJob->MemoryLimitsLock);
+                    ChargedJob->CurrentJobMemoryUsed -= Amount;
+                    ExReleaseFastMutexUnsafe(&ChargedJob->MemoryLimitsLock);
+                    }
                 }
+
+            KeLeaveCriticalRegion();
+            }
+
+        if ( ReturnValue ) {
+            PspRaiseJobPeak(&Job->PeakProcessMemoryUsed,Process->CommitCharge + Amount);
             }
-        ExReleaseFastMutexUnsafe(&Job->MemoryLimitsLock);
-        KeLeaveCriticalRegion();
         }
 
     return ReturnValue;
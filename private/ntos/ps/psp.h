@@ -222,9 +222,68 @@ VOID PspApplyJobLimitsToProcess(PEJOB Job, PEPROCESS Process);
 BOOLEAN PspTerminateAllProcessesInJob(PEJOB Job, NTSTATUS Status, PSLOCKPROCESSMODE LockMode);
 VOID PspFoldProcessAccountingIntoJob(PEJOB Job, PEPROCESS Process);
 NTSTATUS PspCaptureTokenFilter(KPROCESSOR_MODE PreviousMode, PJOBOBJECT_SECURITY_LIMIT_INFORMATION SecurityLimitInfo, PPS_JOB_TOKEN_FILTER * TokenFilter);
+NTSTATUS PspNestJob(PEJOB Job, PEJOB ParentJob);
+BOOLEAN PspIsJobNestedIn(PEJOB Job, PEJOB ParentJob);
+VOID PspTerminateNestedJobs(PEJOB Job, NTSTATUS Status, PSLOCKPROCESSMODE LockMode);
+VOID PspTerminateNestedJobsAndWait(PEJOB Job, NTSTATUS Status);
+VOID FASTCALL PspJobTimeUpdate(IN PKPROCESS Process, IN KPROCESSOR_MODE Mode);
+VOID PspChargeJobUsage64(PEPROCESS Process, PS_JOB_USAGE Usage, ULONGLONG Amount);
+VOID PspChargePriorUsage(PEPROCESS Process);
+VOID PspChargeProcessRunTime(PEPROCESS Process);
+VOID PspChargeRunningProcesses(PEJOB Job);
+VOID PspCaptureJobUsage(PEJOB Job, PPS_JOB_ACCOUNTING Usage);
+VOID PspUpdateJobTotals(PEJOB Job);
+VOID PspAddJobCommit(PEJOB Job, SSIZE_T Amount);
+VOID PspHarvestJobCommit(PEJOB Job);
+VOID PspRaiseJobPeak(PSIZE_T Peak, SIZE_T Value);
+BOOLEAN PspChargeJobCommit(PEJOB Job, PEPROCESS Process, SSIZE_T Amount, PEJOB *ParentJob);
+
+// Lookups of client IDs read PspCidTable without locking its entries.
+// Each lookup in progress is counted in a per processor slot for the
+// current epoch; the delete routines of processes and threads move the
+// epoch on and wait for the slots of the old one to drain before the
+// object can be freed.  The last lookup to leave a slot of an old epoch
+// sets the slot's event.
+
+#define PSP_CID_LOOKUP_SLOTS    32
+#define PSP_CACHE_LINE_SIZE     64
+
+typedef struct _PSP_CID_LOOKUP_SLOT {
+    LONG Active[2];
+    KEVENT Drained;
+    UCHAR Pad[PSP_CACHE_LINE_SIZE - 2 * sizeof(LONG) - sizeof(KEVENT)];
+} PSP_CID_LOOKUP_SLOT, *PPSP_CID_LOOKUP_SLOT;
+
+// Client ID lookup support, see pscid.c
+PVOID PspReferenceCidObject(IN HANDLE Id, IN UCHAR ObjectType);
+VOID PspLeaveCidLookupSlot(IN PPSP_CID_LOOKUP_SLOT Slot, IN ULONG Epoch);
+VOID PspWaitForCidLookups(VOID);
+
+// Commit charged to a job without its memory limits lock is added to the
+// slot of the current processor, and pushed into the job's total and from
+// there into the slots of the job it is nested in whenever the lock is
+// taken.  Jobs with a job memory limit of their own or in a job they are
+// nested in charge under the lock of each job in turn instead.
+
+typedef struct _PSP_JOB_COMMIT_SLOT {
+    SSIZE_T Delta;
+    UCHAR Pad[PSP_CACHE_LINE_SIZE - sizeof(SSIZE_T)];
+} PSP_JOB_COMMIT_SLOT, *PPSP_JOB_COMMIT_SLOT;
+
+// Usage is charged to the slot of the current processor in the job and in
+// each job it is nested in.  The slots only ever grow, the usage of a job is
+// their sum.
+
+typedef struct _PSP_JOB_USAGE_SLOT {
+    LARGE_INTEGER Usage[PsJobMaximumUsage];
+    UCHAR Pad[2 * PSP_CACHE_LINE_SIZE - PsJobMaximumUsage * sizeof(LARGE_INTEGER)];
+} PSP_JOB_USAGE_SLOT, *PPSP_JOB_USAGE_SLOT;
 
 // Global Data
 extern PHANDLE_TABLE PspCidTable;
+extern PSP_CID_LOOKUP_SLOT PspCidLookupSlots[PSP_CID_LOOKUP_SLOTS];
+extern ULONG PspCidLookupEpoch;
+extern FAST_MUTEX PspCidLookupMutex;
 extern HANDLE PspInitialSystemProcessHandle;
 extern PACCESS_TOKEN PspBootAccessToken;
 extern KSPIN_LOCK PspEventPairLock;
@@ -254,5 +313,6 @@ extern BOOLEAN PspUseJobSchedulingClasses;
 
 extern FAST_MUTEX PspJobListLock;
 extern LIST_ENTRY PspJobList;
+extern BOOLEAN PspJobTimeAtTick;
 
 #endif // _PSP_
\ No newline at end of file
@@ -0,0 +1,234 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    upscid.c
+
+Abstract:
+    Client ID lookup benchmark.  Worker threads open processes and
+    threads by id in a tight loop, the way performance monitors and
+    service supervisors do, while another thread keeps creating threads
+    that exit at once.  Every open looks the id up in the client ID table
+    and every thread creation and deletion adds and removes an entry, so
+    the rate of opens shows how well the lookups scale and how much they
+    suffer from the churn.  Run with 1, 2, 4 ... threads up to the count
+    given, first without and then with the churn.
+
+    Finally the time to take a snapshot of all processes and threads with
+    NtQuerySystemInformation is reported.  A call with too small a buffer
+    returns the size needed for the whole snapshot, so the snapshot takes
+    exactly two calls.
+
+    usage: upscid [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_SNAPSHOTS     100
+
+//  The last client id slot stays empty to end the list of targets
+
+CLIENT_ID TargetCids[BENCH_MAX_THREADS + 1];
+ULONGLONG ChurnCount;
+
+
+ULONG ExitingThread(IN PVOID Context)
+{
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+ULONG ChurnThread(IN PVOID Context)
+{
+    HANDLE Thread;
+    NTSTATUS Status;
+
+    while (!StopBenchmark)
+    {
+        Status = RtlCreateUserThread(NtCurrentProcess(), NULL, FALSE, 0, 0, 0, (PUSER_THREAD_START_ROUTINE)ExitingThread, NULL, &Thread, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to create thread (%X)\n", Status);
+            break;
+        }
+
+        NtWaitForSingleObject(Thread, FALSE, NULL);
+        NtClose(Thread);
+        ChurnCount += 1;
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+ULONG WorkerThread(IN PVOID Context)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    CLIENT_ID ClientId;
+    HANDLE Handle;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+    ULONG Target = ThreadIndex;
+
+    InitializeObjectAttributes(&ObjectAttributes, NULL, 0, NULL, NULL);
+
+    while (!StopBenchmark)
+    {
+        //  Alternate between opening the process by its id alone and one
+        //  of the other workers by its full client id
+
+        ClientId.UniqueProcess = TargetCids[Target].UniqueProcess;
+        ClientId.UniqueThread = NULL;
+        Status = NtOpenProcess(&Handle, PROCESS_QUERY_INFORMATION, &ObjectAttributes, &ClientId);
+        if (NT_SUCCESS(Status))
+        {
+            NtClose(Handle);
+            Status = NtOpenThread(&Handle, THREAD_QUERY_INFORMATION, &ObjectAttributes, &TargetCids[Target]);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Open of %p.%p failed (%X)\n", TargetCids[Target].UniqueProcess, TargetCids[Target].UniqueThread, Status);
+            break;
+        }
+
+        NtClose(Handle);
+        BenchCounts[ThreadIndex] += 2;
+
+        if (TargetCids[++Target].UniqueThread == NULL)
+        {
+            Target = 0;
+        }
+    }
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+VOID RunBenchmark(IN ULONG Threads, IN ULONG Seconds, IN BOOLEAN Churn)
+{
+    ULONGLONG Opens;
+
+    ChurnCount = 0;
+    RtlZeroMemory(TargetCids, sizeof(TargetCids));
+
+    Opens = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WorkerThread, Threads, Seconds,
+                            Churn ? (PUSER_THREAD_START_ROUTINE)ChurnThread : NULL, TargetCids);
+
+    printf("%2u threads  %-8s %10I64u opens  %8I64u per sec  %8I64u threads created\n",
+           Threads, Churn ? "churn" : "quiet", Opens, Opens / Seconds, ChurnCount);
+}
+
+
+VOID RunSnapshots(VOID)
+{
+    PSYSTEM_PROCESS_INFORMATION ProcessInfo;
+    LARGE_INTEGER Start, End, Frequency;
+    SYSTEM_PROCESS_INFORMATION SmallBuffer;
+    PVOID Buffer;
+    SIZE_T BufferSize;
+    ULONGLONG Elapsed;
+    ULONG Length;
+    ULONG Processes;
+    ULONG Threads;
+    NTSTATUS Status;
+    ULONG i;
+
+    Elapsed = 0;
+    Processes = 0;
+    Threads = 0;
+
+    for (i = 0; i < BENCH_SNAPSHOTS; i++)
+    {
+        NtQueryPerformanceCounter(&Start, &Frequency);
+
+        //  Ask for the size of the snapshot, then take it.  Leave some room
+        //  for processes and threads created between the two calls.
+
+        Length = 0;
+        Status = NtQuerySystemInformation(SystemProcessInformation, &SmallBuffer, sizeof(SmallBuffer), &Length);
+        if ((Status != STATUS_INFO_LENGTH_MISMATCH) || (Length == 0))
+        {
+            printf("Size query returned %X with length %u\n", Status, Length);
+            return;
+        }
+
+        Buffer = NULL;
+        BufferSize = Length + Length / 8;
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Unable to allocate the buffer (%X)\n", Status);
+            return;
+        }
+
+        Status = NtQuerySystemInformation(SystemProcessInformation, Buffer, (ULONG)BufferSize, &Length);
+
+        NtQueryPerformanceCounter(&End, NULL);
+        Elapsed += ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Snapshot failed (%X)\n", Status);
+            BufferSize = 0;
+            NtFreeVirtualMemory(NtCurrentProcess(), &Buffer, &BufferSize, MEM_RELEASE);
+            return;
+        }
+
+        Processes = 0;
+        Threads = 0;
+        for (ProcessInfo = Buffer; ; ProcessInfo = (PSYSTEM_PROCESS_INFORMATION)((PUCHAR)ProcessInfo + ProcessInfo->NextEntryOffset))
+        {
+            Processes += 1;
+            Threads += ProcessInfo->NumberOfThreads;
+            if (ProcessInfo->NextEntryOffset == 0)
+            {
+                break;
+            }
+        }
+
+        BufferSize = 0;
+        NtFreeVirtualMemory(NtCurrentProcess(), &Buffer, &BufferSize, MEM_RELEASE);
+    }
+
+    printf("snapshot  %4u processes  %5u threads  %8I64u us/snapshot\n", Processes, Threads, Elapsed / BENCH_SNAPSHOTS);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 1, 8);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: upscid [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        RunBenchmark(n, Seconds, FALSE);
+        RunBenchmark(n, Seconds, TRUE);
+    }
+
+    RunSnapshots();
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    upsjob.c
+
+Abstract:
+    Job accounting benchmark.  The benchmark puts itself in a job, nests
+    that job in a second one, and then has worker threads commit and
+    decommit a few pages in a tight loop, the way a heap grows and
+    shrinks.  Every commit change is charged to both jobs, so the rate of
+    changes shows how well the charging scales.  Run with 1, 2, 4 ...
+    threads up to the count given, first with no job memory limit, when
+    the changes are counted per processor without a lock, and then with
+    a limit on the outer job, when each change takes the lock of both
+    jobs in turn.
+
+    Finally the time to query the accounting of the outer job is reported
+    along with the totals, which include the time and commit used by the
+    workers in the inner job.
+
+    usage: upsjob [threads [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_QUERIES       1000
+#define BENCH_REGION_SIZE   (64 * 1024)
+
+HANDLE InnerJob;
+HANDLE OuterJob;
+
+
+ULONG WorkerThread(IN PVOID Context)
+{
+    PVOID Region;
+    PVOID Base;
+    SIZE_T Size;
+    NTSTATUS Status;
+    ULONG ThreadIndex = (ULONG)(ULONG_PTR)Context;
+
+    Region = NULL;
+    Size = BENCH_REGION_SIZE;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Region, 0, &Size, MEM_RESERVE, PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to reserve memory (%X)\n", Status);
+        RtlExitUserThread(Status);
+    }
+
+    while (!StopBenchmark)
+    {
+        Base = Region;
+        Size = BENCH_REGION_SIZE;
+        Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Base, 0, &Size, MEM_COMMIT, PAGE_READWRITE);
+        if (NT_SUCCESS(Status))
+        {
+            Status = NtFreeVirtualMemory(NtCurrentProcess(), &Base, &Size, MEM_DECOMMIT);
+        }
+
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Commit change failed (%X)\n", Status);
+            break;
+        }
+
+        BenchCounts[ThreadIndex] += 2;
+    }
+
+    Size = 0;
+    NtFreeVirtualMemory(NtCurrentProcess(), &Region, &Size, MEM_RELEASE);
+
+    RtlExitUserThread(STATUS_SUCCESS);
+    return 0;
+}
+
+
+BOOLEAN SetJobMemoryLimit(IN HANDLE Job, IN SIZE_T Limit)
+{
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION LimitInfo;
+    NTSTATUS Status;
+
+    RtlZeroMemory(&LimitInfo, sizeof(LimitInfo));
+    if (Limit != 0)
+    {
+        LimitInfo.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_JOB_MEMORY;
+        LimitInfo.JobMemoryLimit = Limit;
+    }
+
+    Status = NtSetInformationJobObject(Job, JobObjectExtendedLimitInformation, &LimitInfo, sizeof(LimitInfo));
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to set the job memory limit (%X)\n", Status);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+VOID RunBenchmark(IN PCHAR Title, IN ULONG Threads, IN ULONG Seconds)
+{
+    ULONGLONG Changes;
+
+    Changes = BenchRunThreads((PUSER_THREAD_START_ROUTINE)WorkerThread, Threads, Seconds, NULL, NULL);
+    printf("%2u threads  %-10s %10I64u commit changes  %8I64u per sec\n", Threads, Title, Changes, Changes / Seconds);
+}
+
+
+VOID RunQueries(VOID)
+{
+    JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION Accounting;
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION LimitInfo;
+    LARGE_INTEGER Start, End, Frequency;
+    ULONGLONG Elapsed;
+    NTSTATUS Status;
+    ULONG i;
+
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    for (i = 0; i < BENCH_QUERIES; i++)
+    {
+        Status = NtQueryInformationJobObject(OuterJob, JobObjectBasicAndIoAccountingInformation, &Accounting, sizeof(Accounting), NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Accounting query failed (%X)\n", Status);
+            return;
+        }
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+
+    Status = NtQueryInformationJobObject(OuterJob, JobObjectExtendedLimitInformation, &LimitInfo, sizeof(LimitInfo), NULL);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Limit query failed (%X)\n", Status);
+        return;
+    }
+
+    printf("query     %8I64u ns/query\n", (Elapsed * 1000) / BENCH_QUERIES);
+    printf("outer job %8I64u ms user  %8I64u ms kernel  %8u page faults  %8Iu KB peak commit\n",
+           Accounting.BasicInfo.TotalUserTime.QuadPart / 10000, Accounting.BasicInfo.TotalKernelTime.QuadPart / 10000,
+           Accounting.BasicInfo.TotalPageFaultCount, LimitInfo.PeakJobMemoryUsed / 1024);
+}
+
+
+main(int argc, char **argv)
+{
+    ULONG Threads;
+    ULONG Seconds;
+    NTSTATUS Status;
+    ULONG n;
+
+    Threads = BenchArgument(argc, argv, 1, 8);
+    Seconds = BenchArgument(argc, argv, 2, 5);
+
+    if ((Threads == 0) || (Threads > BENCH_MAX_THREADS) || (Seconds == 0))
+    {
+        printf("usage: upsjob [threads (1-%u) [seconds]]\n", BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    //  Put this process in the inner job, then assign it to the outer job,
+    //  which nests the inner job in the outer one
+
+    Status = NtCreateJobObject(&InnerJob, JOB_OBJECT_ALL_ACCESS, NULL);
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtAssignProcessToJobObject(InnerJob, NtCurrentProcess());
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtCreateJobObject(&OuterJob, JOB_OBJECT_ALL_ACCESS, NULL);
+    }
+
+    if (NT_SUCCESS(Status))
+    {
+        Status = NtAssignProcessToJobObject(OuterJob, NtCurrentProcess());
+    }
+
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to set up the nested jobs (%X)\n", Status);
+        return 1;
+    }
+
+    for (n = 1; n <= Threads; n *= 2)
+    {
+        if (!SetJobMemoryLimit(OuterJob, 0))
+        {
+            return 1;
+        }
+
+        RunBenchmark("unlimited", n, Seconds);
+
+        if (!SetJobMemoryLimit(OuterJob, 1024 * 1024 * 1024))
+        {
+            return 1;
+        }
+
+        RunBenchmark("limited", n, Seconds);
+    }
+
+    RunQueries();
+
+    return 0;
+}
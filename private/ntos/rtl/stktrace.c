@@ -87,6 +87,17 @@ PSTACK_TRACE_DATABASE RtlpStackTraceDataBase;
 
 PRTL_STACK_TRACE_ENTRY RtlpExtendStackTraceDataBase(IN PRTL_STACK_TRACE_ENTRY InitialValue, IN ULONG Size);
 
+PRTL_STACK_TRACE_ENTRY RtlpFindStackTrace(IN PRTL_STACK_TRACE_ENTRY StackTrace, IN ULONG Hash, OUT PRTL_STACK_TRACE_ENTRY **LastLink);
+
+
+// Number of hash buckets. The buckets have to fit in the first page of the
+// database, which is the only one committed up front when it is not
+// precommitted. A prime keeps the sums of return addresses that are used
+// as hashes spread out.
+
+
+#define RTLP_STACK_TRACE_BUCKETS 509
+
 
 NTSTATUS
 RtlInitStackTraceDataBaseEx(
@@ -134,7 +145,7 @@ RtlInitStackTraceDataBaseEx(
         }
 
     DataBase->CommitBase = CommitBase;
-    DataBase->NumberOfBuckets = 37;
+    DataBase->NumberOfBuckets = RTLP_STACK_TRACE_BUCKETS;
     DataBase->NextFreeLowerMemory = (PCHAR)
         (&DataBase->Buckets[ DataBase->NumberOfBuckets ]);
     DataBase->NextFreeUpperMemory = (PCHAR)CommitBase + ReserveSize;
@@ -424,6 +435,67 @@ Environment:
     return( p );
 }
 
+PRTL_STACK_TRACE_ENTRY
+RtlpFindStackTrace(
+    IN PRTL_STACK_TRACE_ENTRY StackTrace,
+    IN ULONG Hash,
+    OUT PRTL_STACK_TRACE_ENTRY **LastLink
+    )
+/*++
+
+Routine Description:
+
+    This routine looks a stack trace up in the database without taking
+    the database lock. This works because entries are never removed
+    or changed once they are linked into a hash chain, and a new entry
+    is linked at the end of its chain only after it has been filled in.
+    A lookup racing with an insertion either sees the new entry complete
+    or does not see it at all.
+
+Arguments:
+
+    StackTrace - stack trace to look up.
+
+    Hash - hash of the stack trace, as computed by RtlCaptureStackBackTrace.
+
+    LastLink - receives the address of the link that ends the hash chain
+        when the trace is not found. It is only of use to a caller that
+        holds the database lock, since otherwise the chain can grow.
+
+Return Value:
+
+    The address of the saved stack trace or null if it is not in the
+    database.
+
+--*/
+
+{
+    PSTACK_TRACE_DATABASE DataBase;
+    PRTL_STACK_TRACE_ENTRY p, *pp;
+    ULONG DepthSize;
+
+    DataBase = RtlpStackTraceDataBase;
+    DepthSize = StackTrace->Depth * sizeof( StackTrace->BackTrace[ 0 ] );
+    pp = &DataBase->Buckets[ Hash % DataBase->NumberOfBuckets ];
+
+    while (p = *pp) {
+        if (p->Depth == StackTrace->Depth &&
+            RtlCompareMemory( &p->BackTrace[ 0 ],
+            &StackTrace->BackTrace[ 0 ],
+            DepthSize
+            ) == DepthSize
+            ) {
+            break;
+        }
+        else {
+            pp = &p->HashChain;
+        }
+    }
+
+    *LastLink = pp;
+    return( p );
+}
+
 USHORT
 RtlLogStackBackTrace(
     VOID
@@ -437,6 +509,11 @@ Routine Description:
     stack trace database. It should be noted that we do not save
     duplicate traces.
 
+    Most traces logged are already in the database, so the lookup is
+    done without the database lock, and the lock is taken only to add
+    a new trace. Heap and critical section tracing on a busy process
+    then no longer serialize every allocation on the database lock.
+
 Arguments:
 
     None.
@@ -491,6 +568,25 @@ Environment:
         return 0;
     }
 
+    InterlockedIncrement( (PLONG)&RtlpStackTraceDataBase->NumberOfEntriesLookedUp );
+
+
+    // We will try to find out if the trace has been saved in the past,
+    // without the lock first.
+
+
+    try {
+        p = RtlpFindStackTrace( &StackTrace, Hash, &pp );
+    }
+    except(EXCEPTION_EXECUTE_HANDLER) {
+        p = NULL;
+    }
+
+    if (p != NULL) {
+        InterlockedIncrement( (PLONG)&p->TraceCount );
+        return( p->Index );
+    }
+
 
     // Lock the global per-process stack trace database.
 
@@ -501,31 +597,15 @@ Environment:
         return( 0 );
     }
 
-    DataBase->NumberOfEntriesLookedUp++;
-
     try {
 
 
-        // We will try to find out if the trace has been saved in the past.
-        // We find the right hash chain and then traverse it.
+        // Look again since another thread may have saved the same trace
+        // since we looked. Only the threads holding the lock add to the
+        // chains, so what we find now stays valid until we release it.
 
 
-        DepthSize = StackTrace.Depth * sizeof( StackTrace.BackTrace[ 0 ] );
-        pp = &DataBase->Buckets[ Hash % DataBase->NumberOfBuckets ];
-
-        while (p = *pp) {
-            if (p->Depth == StackTrace.Depth &&
-                RtlCompareMemory( &p->BackTrace[ 0 ],
-                &StackTrace.BackTrace[ 0 ],
-                DepthSize
-                ) == DepthSize
-                ) {
-                break;
-            }
-            else {
-                pp = &p->HashChain;
-            }
-        }
+        p = RtlpFindStackTrace( &StackTrace, Hash, &pp );
 
         if (p == NULL) {
 
@@ -534,6 +614,7 @@ Environment:
             // and save the new trace.
 
 
+            DepthSize = StackTrace.Depth * sizeof( StackTrace.BackTrace[ 0 ] );
             RequestedSize = FIELD_OFFSET( RTL_STACK_TRACE_ENTRY, BackTrace ) +
                 DepthSize;
 
@@ -541,11 +622,13 @@ Environment:
 
 
             // If we managed to stack the trace we need to link it as the last
-            // element in the proper hash chain.
+            // element in the proper hash chain. The interlocked exchange makes
+            // sure the contents of the entry are visible to lookups running
+            // without the lock before the entry itself is.
 
 
             if (p != NULL) {
-                *pp = p;
+                InterlockedExchangePointer( (PVOID *)pp, p );
             }
         }
     }
@@ -565,7 +648,7 @@ Environment:
     RtlpReleaseStackTraceDataBase();
 
     if (p != NULL) {
-        p->TraceCount++;
+        InterlockedIncrement( (PLONG)&p->TraceCount );
         return( p->Index );
         }
     else {
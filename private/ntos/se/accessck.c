@@ -86,6 +86,50 @@ SepNormalAccessCheck(
 BOOLEAN SepSidInTokenEx (IN PACCESS_TOKEN AToken, IN PSID PrincipalSelfSid, IN PSID Sid, IN BOOLEAN DenyAce, IN BOOLEAN Restricted);
 
 
+//  Access check result cache.  File servers open the same files over and
+//  over with the same few client tokens, and the object manager already
+//  shares one copy of identical security descriptors, so most access checks
+//  evaluate a DACL that was evaluated moments before for the same token.
+//  The cache remembers the outcome of the DACL walk keyed by the identity
+//  and ModifiedId of the tokens, the access still wanted once privileges
+//  have been applied, and the contents of the DACL.
+
+//  Keying on the ModifiedId means an adjustment of the groups of a token
+//  retires all of its entries without having to find them.  The DACL is
+//  compared by contents rather than by address, because the descriptors of
+//  file system objects come and go and their addresses are reused.
+
+//  The table is direct mapped; each shard of entries has a fast mutex of
+//  its own so checks on different processors seldom wait on each other.
+
+#define SEP_ACCESS_CACHE_ENTRIES    128
+#define SEP_ACCESS_CACHE_SHARDS     16
+#define SEP_ACCESS_CACHE_MAX_ACL    512
+
+typedef struct _SEP_ACCESS_CACHE_ENTRY {
+    LUID TokenId;
+    LUID ModifiedId;
+    LUID PrimaryTokenId;
+    LUID PrimaryModifiedId;
+    ACCESS_MASK Remaining;
+    ACCESS_MASK Result;
+    ULONG AclHash;
+    ULONG AclSize;
+    ULONG Acl[SEP_ACCESS_CACHE_MAX_ACL / sizeof(ULONG)];
+} SEP_ACCESS_CACHE_ENTRY, *PSEP_ACCESS_CACHE_ENTRY;
+
+typedef struct _SEP_ACCESS_CACHE_SHARD {
+    FAST_MUTEX Lock;
+} SEP_ACCESS_CACHE_SHARD, *PSEP_ACCESS_CACHE_SHARD;
+
+PSEP_ACCESS_CACHE_ENTRY SepAccessCache;
+SEP_ACCESS_CACHE_SHARD SepAccessCacheShards[SEP_ACCESS_CACHE_SHARDS];
+
+ULONG SepAccessCacheIndex (IN PTOKEN EToken, IN PACL Dacl, IN ACCESS_MASK Remaining, OUT PULONG AclHash);
+BOOLEAN SepAccessCacheLookup (IN PTOKEN EToken, IN PTOKEN PrimaryToken, IN PACL Dacl, IN ACCESS_MASK Remaining, OUT PACCESS_MASK Result);
+VOID SepAccessCacheInsert (IN PTOKEN EToken, IN PTOKEN PrimaryToken, IN PACL Dacl, IN ACCESS_MASK Remaining, IN ACCESS_MASK Result);
+
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE,SeCaptureObjectTypeList)
 #pragma alloc_text(PAGE,SeFreeCapturedObjectTypeList)
@@ -94,6 +138,10 @@ BOOLEAN SepSidInTokenEx (IN PACCESS_TOKEN AToken, IN PSID PrincipalSelfSid, IN P
 #pragma alloc_text(PAGE,SepAddAccessTypeList)
 #pragma alloc_text(PAGE,SepSidInToken)
 #pragma alloc_text(PAGE,SepSidInTokenEx)
+#pragma alloc_text(INIT,SepAccessCacheInitialization)
+#pragma alloc_text(PAGE,SepAccessCacheIndex)
+#pragma alloc_text(PAGE,SepAccessCacheLookup)
+#pragma alloc_text(PAGE,SepAccessCacheInsert)
 #pragma alloc_text(PAGE,SepAccessCheck)
 #pragma alloc_text(PAGE,NtAccessCheck)
 #pragma alloc_text(PAGE,NtAccessCheckByType)
@@ -504,6 +552,17 @@ Return Value:
     TokenSid = Token->UserAndGroups;
     UserAndGroupCount = Token->UserAndGroupCount;
 
+    // Tokens with many groups have an index of their SIDs sorted by hash.
+    if (Token->SidIndex != NULL) {
+        i = SepSidIndexLookup(Token, Sid);
+        if (i == UserAndGroupCount) {
+            return FALSE;
+        }
+
+        TokenSid += i;
+        return (BOOLEAN)((i == 0) || (TokenSid->Attributes & SE_GROUP_ENABLED) || (DenyAce && (TokenSid->Attributes & SE_GROUP_USE_FOR_DENY_ONLY)));
+    }
+
     // Scan through the user/groups and attempt to find a match with the specified SID.
     for (i = 0 ; i < UserAndGroupCount ; i += 1) {
         MatchSid = (PISID)TokenSid->Sid;
@@ -580,6 +639,19 @@ Return Value:
     } else {
         TokenSid = Token->UserAndGroups;
         UserAndGroupCount = Token->UserAndGroupCount;
+
+        // Tokens with many groups have an index of their SIDs sorted by hash.
+        if (Token->SidIndex != NULL) {
+            i = SepSidIndexLookup(Token, Sid);
+            if (i == UserAndGroupCount) {
+                return FALSE;
+            }
+
+            TokenSid += i;
+            return (BOOLEAN)(((i == 0) && ((TokenSid->Attributes & SE_GROUP_USE_FOR_DENY_ONLY) == 0)) ||
+                             (TokenSid->Attributes & SE_GROUP_ENABLED) ||
+                             (DenyAce && (TokenSid->Attributes & SE_GROUP_USE_FOR_DENY_ONLY)));
+        }
     }
 
     // Scan through the user/groups and attempt to find a match with the specified SID.
@@ -609,6 +681,134 @@ Return Value:
 }
 
 
+VOID SepAccessCacheInitialization (VOID)
+/*++
+Routine Description:
+    Allocates the access check result cache.  The system runs without the cache if it can not be allocated.
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < SEP_ACCESS_CACHE_SHARDS; i += 1) {
+        ExInitializeFastMutex(&SepAccessCacheShards[i].Lock);
+    }
+
+    SepAccessCache = ExAllocatePoolWithTag( PagedPool, SEP_ACCESS_CACHE_ENTRIES * sizeof(SEP_ACCESS_CACHE_ENTRY), 'hCeS' );
+    if (SepAccessCache != NULL) {
+        RtlZeroMemory(SepAccessCache, SEP_ACCESS_CACHE_ENTRIES * sizeof(SEP_ACCESS_CACHE_ENTRY));
+    }
+}
+
+
+ULONG SepAccessCacheIndex (IN PTOKEN EToken, IN PACL Dacl, IN ACCESS_MASK Remaining, OUT PULONG AclHash)
+/*++
+Routine Description:
+    Hashes a DACL and picks the cache entry for a check of it.
+Arguments:
+    EToken - Effective token of the caller.
+    Dacl - ACL being checked, no larger than SEP_ACCESS_CACHE_MAX_ACL.
+    Remaining - Access still wanted from the DACL.
+    AclHash - Receives the hash of the contents of the DACL.
+Return Value:
+    The index of the cache entry.
+--*/
+{
+    PULONG AclData = (PULONG)Dacl;
+    ULONG Hash = 0;
+    ULONG i;
+
+    PAGED_CODE();
+
+    for (i = 0; i < Dacl->AclSize / sizeof(ULONG); i += 1) {
+        Hash = (Hash * 31) + AclData[i];
+    }
+
+    *AclHash = Hash;
+    return (Hash ^ (EToken->TokenId.LowPart * 0x9E3779B1) ^ Remaining) % SEP_ACCESS_CACHE_ENTRIES;
+}
+
+
+BOOLEAN SepAccessCacheLookup (IN PTOKEN EToken, IN PTOKEN PrimaryToken, IN PACL Dacl, IN ACCESS_MASK Remaining, OUT PACCESS_MASK Result)
+/*++
+Routine Description:
+    Looks for the result of an earlier walk of an identical DACL on behalf of the same tokens.
+Arguments:
+    EToken - Effective token of the caller.
+    PrimaryToken - Process token of the caller.
+    Dacl - ACL being checked.
+    Remaining - Access still wanted from the DACL.
+    Result - Receives the result of the earlier walk: the access granted for a MAXIMUM_ALLOWED check, or the access left ungranted otherwise.
+Return Value:
+    TRUE if the result was found in the cache, FALSE otherwise.
+--*/
+{
+    PSEP_ACCESS_CACHE_ENTRY Entry;
+    PSEP_ACCESS_CACHE_SHARD Shard;
+    ULONG AclHash;
+    ULONG Index;
+    BOOLEAN Found = FALSE;
+
+    PAGED_CODE();
+
+    Index = SepAccessCacheIndex(EToken, Dacl, Remaining, &AclHash);
+    Entry = &SepAccessCache[Index];
+    Shard = &SepAccessCacheShards[Index % SEP_ACCESS_CACHE_SHARDS];
+
+    ExAcquireFastMutex(&Shard->Lock);
+
+    if (Entry->AclHash == AclHash &&
+        Entry->AclSize == Dacl->AclSize &&
+        Entry->Remaining == Remaining &&
+        RtlEqualLuid(&Entry->TokenId, &EToken->TokenId) &&
+        RtlEqualLuid(&Entry->ModifiedId, &EToken->ModifiedId) &&
+        RtlEqualLuid(&Entry->PrimaryTokenId, &PrimaryToken->TokenId) &&
+        RtlEqualLuid(&Entry->PrimaryModifiedId, &PrimaryToken->ModifiedId) &&
+        RtlEqualMemory(Entry->Acl, Dacl, Dacl->AclSize)) {
+        *Result = Entry->Result;
+        Found = TRUE;
+    }
+
+    ExReleaseFastMutex(&Shard->Lock);
+
+    return Found;
+}
+
+
+VOID SepAccessCacheInsert (IN PTOKEN EToken, IN PTOKEN PrimaryToken, IN PACL Dacl, IN ACCESS_MASK Remaining, IN ACCESS_MASK Result)
+/*++
+Routine Description:
+    Remembers the result of a walk of a DACL, replacing whatever was in its cache entry.
+Arguments:
+    See SepAccessCacheLookup.
+--*/
+{
+    PSEP_ACCESS_CACHE_ENTRY Entry;
+    PSEP_ACCESS_CACHE_SHARD Shard;
+    ULONG AclHash;
+    ULONG Index;
+
+    PAGED_CODE();
+
+    Index = SepAccessCacheIndex(EToken, Dacl, Remaining, &AclHash);
+    Entry = &SepAccessCache[Index];
+    Shard = &SepAccessCacheShards[Index % SEP_ACCESS_CACHE_SHARDS];
+
+    ExAcquireFastMutex(&Shard->Lock);
+
+    Entry->TokenId = EToken->TokenId;
+    Entry->ModifiedId = EToken->ModifiedId;
+    Entry->PrimaryTokenId = PrimaryToken->TokenId;
+    Entry->PrimaryModifiedId = PrimaryToken->ModifiedId;
+    Entry->Remaining = Remaining;
+    Entry->Result = Result;
+    Entry->AclHash = AclHash;
+    Entry->AclSize = Dacl->AclSize;
+    RtlCopyMemory(Entry->Acl, Dacl, Dacl->AclSize);
+
+    ExReleaseFastMutex(&Shard->Lock);
+}
+
+
 VOID
 SepMaximumAccessCheck(
     IN PTOKEN EToken,
@@ -1069,6 +1269,9 @@ Return Value:
     PIOBJECT_TYPE_LIST LocalTypeList;
     ULONG LocalTypeListLength;
     ULONG ResultListIndex;
+    BOOLEAN Cacheable;
+    BOOLEAN CacheHit = FALSE;
+    ACCESS_MASK CachedResult;
 
     PAGED_CODE();
 
@@ -1206,14 +1409,29 @@ Return Value:
         LocalTypeListLength = ObjectTypeListLength;
     }
 
+    // Plain checks of small DACLs may have been made before with the same tokens.
+    // Checks by object type or on behalf of a principal self SID are always evaluated.
+    Cacheable = (BOOLEAN)(SepAccessCache != NULL && ObjectTypeListLength == 0 && !ReturnResultList && PrincipalSelfSid == NULL && Dacl->AclSize <= SEP_ACCESS_CACHE_MAX_ACL);
+    if ( Cacheable ) {
+        CacheHit = SepAccessCacheLookup(EToken, PrimaryToken, Dacl, Remaining, &CachedResult);
+    }
+
     // If the caller wants the MAXIMUM_ALLOWED or the caller wants the results on all objects and subobjects, use a slower algorithm that traverses all the ACEs.
     if ( (DesiredAccess & MAXIMUM_ALLOWED) != 0 || ReturnResultList ) {
-        // Do the normal maximum-allowed access check
-        SepMaximumAccessCheck(EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,FALSE);
+        if ( CacheHit ) {
+            LocalTypeList->CurrentGranted = CachedResult;
+        } else {
+            // Do the normal maximum-allowed access check
+            SepMaximumAccessCheck(EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,FALSE);
 
-        // If this is a restricted token, do the additional access check
-        if (SeTokenIsRestricted( EToken ) ) {
-            SepMaximumAccessCheck(EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,TRUE);
+            // If this is a restricted token, do the additional access check
+            if (SeTokenIsRestricted( EToken ) ) {
+                SepMaximumAccessCheck(EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,TRUE);
+            }
+
+            if ( Cacheable ) {
+                SepAccessCacheInsert(EToken, PrimaryToken, Dacl, Remaining, LocalTypeList->CurrentGranted);
+            }
         }
 
         // If the caller wants to know the individual results of each sub-object,
@@ -1408,18 +1626,20 @@ Return Value:
     }
 #endif
 
-    // Do the normal access check first
-    SepNormalAccessCheck(Remaining,EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,FALSE);
+    if ( CacheHit ) {
+        LocalTypeList->Remaining = CachedResult;
+    } else {
+        // Do the normal access check first
+        SepNormalAccessCheck(Remaining,EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,FALSE);
 
-    if (LocalTypeList->Remaining != 0) {
-        Status = STATUS_ACCESS_DENIED;
-        PreviouslyGrantedAccess = 0;
-        goto ReturnOneStatus;
-    }
+        // If this is a restricted token and the normal check succeeded, do the additional access check
+        if (LocalTypeList->Remaining == 0 && SeTokenIsRestricted( EToken ) ) {
+            SepNormalAccessCheck(Remaining,EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,TRUE);
+        }
 
-    // If this is a restricted token, do the additional access check
-    if (SeTokenIsRestricted( EToken ) ) {
-        SepNormalAccessCheck(Remaining,EToken,PrimaryToken,Dacl,PrincipalSelfSid,LocalTypeListLength,LocalTypeList,ObjectTypeListLength,TRUE);
+        if ( Cacheable ) {
+            SepAccessCacheInsert(EToken, PrimaryToken, Dacl, Remaining, LocalTypeList->Remaining);
+        }
     }
 
     if (LocalTypeList->Remaining != 0) {
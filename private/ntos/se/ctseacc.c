@@ -876,6 +876,142 @@ TestSeAccess()
     return CompletionStatus;
 }
 
+#define ACCESS_RATE_CHECKS 100000
+
+BOOLEAN
+TestSeAccessRateRun(
+    IN PCHAR Title,
+    IN HANDLE Token,
+    IN PSECURITY_DESCRIPTOR Descriptor,
+    IN PACCESS_DENIED_ACE ChangingAce OPTIONAL
+    )
+
+//  Times ACCESS_RATE_CHECKS access checks of the descriptor.  If an ACE
+//  is given its mask is changed before each check, so that no two checks
+//  see the same DACL.
+
+{
+    GENERIC_MAPPING Mapping = {0x1, 0x2, 0x4, 0xF};
+    ULONG PrivilegeBuffer[16];
+    ULONG PrivilegeLength;
+    ACCESS_MASK GrantedAccess;
+    NTSTATUS AccessStatus;
+    LARGE_INTEGER Start, End, Frequency;
+    ULONG i;
+
+    NtQueryPerformanceCounter( &Start, &Frequency );
+
+    for (i = 0; i < ACCESS_RATE_CHECKS; i += 1) {
+
+        if (ARGUMENT_PRESENT(ChangingAce)) {
+            ChangingAce->Mask = 0x100 | (i & 0xFF);
+        }
+
+        PrivilegeLength = sizeof(PrivilegeBuffer);
+        Status = NtAccessCheck(
+                     Descriptor,
+                     Token,
+                     0x1,
+                     &Mapping,
+                     (PPRIVILEGE_SET)PrivilegeBuffer,
+                     &PrivilegeLength,
+                     &GrantedAccess,
+                     &AccessStatus
+                     );
+
+        if (!NT_SUCCESS(Status) || !NT_SUCCESS(AccessStatus) || (GrantedAccess != 0x1)) {
+            DbgPrint("***** Failed **\n");
+            DbgPrint("Status is: 0x%lx, AccessStatus is: 0x%lx \n", Status, AccessStatus);
+            return FALSE;
+        }
+    }
+
+    NtQueryPerformanceCounter( &End, NULL );
+
+    DbgPrint("Se:     %s%8ld checks/sec\n", Title,
+             (ULONG)((ACCESS_RATE_CHECKS * Frequency.QuadPart) / (End.QuadPart - Start.QuadPart + 1)));
+
+    return TRUE;
+}
+
+
+BOOLEAN
+TestSeAccessRate()
+
+//  Test:
+
+//      Repeated checks of the same descriptor with the same token
+//      Repeated checks of a descriptor whose DACL changes every time
+
+//  The DACL denies access to a number of SIDs that are not in the token
+//  before the ACE that grants access to everyone, so every check that
+//  is evaluated compares each SID of the token with each of the ACEs.
+
+{
+    SECURITY_QUALITY_OF_SERVICE SecurityQos;
+    OBJECT_ATTRIBUTES TokenAttributes;
+    PSECURITY_DESCRIPTOR Descriptor;
+    PACL Dacl;
+    PACCESS_DENIED_ACE FirstAce;
+    HANDLE ProcessToken;
+    HANDLE Token;
+    BOOLEAN CompletionStatus = TRUE;
+
+    TSeVariableInitialization();
+
+    Status = NtOpenProcessToken( NtCurrentProcess(), TOKEN_DUPLICATE, &ProcessToken );
+    SEASSERT_SUCCESS( Status );
+
+    SecurityQos.Length = (ULONG)sizeof(SECURITY_QUALITY_OF_SERVICE);
+    SecurityQos.ImpersonationLevel = SecurityImpersonation;
+    SecurityQos.ContextTrackingMode = SECURITY_STATIC_TRACKING;
+    SecurityQos.EffectiveOnly = FALSE;
+    InitializeObjectAttributes( &TokenAttributes, NULL, 0, NULL, NULL );
+    TokenAttributes.SecurityQualityOfService = &SecurityQos;
+
+    Status = NtDuplicateToken(
+                 ProcessToken,
+                 TOKEN_QUERY,
+                 &TokenAttributes,
+                 FALSE,
+                 TokenImpersonation,
+                 &Token
+                 );
+    SEASSERT_SUCCESS( Status );
+    NtClose( ProcessToken );
+
+    Dacl = (PACL)TstAllocatePool( PagedPool, 400 );
+    Status = RtlCreateAcl( Dacl, 400, ACL_REVISION ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, FredSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, WilmaSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, PebblesSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, DinoSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, BarneySid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, BettySid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, BambamSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessDeniedAce( Dacl, ACL_REVISION, 0x1, NeandertholSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlAddAccessAllowedAce( Dacl, ACL_REVISION, 0x3, WorldSid ); SEASSERT_SUCCESS( Status );
+    Status = RtlGetAce( Dacl, 0, (PVOID *)&FirstAce ); SEASSERT_SUCCESS( Status );
+
+    Descriptor = (PSECURITY_DESCRIPTOR)TstAllocatePool( PagedPool, SECURITY_DESCRIPTOR_MIN_LENGTH );
+    RtlCreateSecurityDescriptor( Descriptor, SECURITY_DESCRIPTOR_REVISION );
+    RtlSetDaclSecurityDescriptor( Descriptor, TRUE, Dacl, FALSE );
+    RtlSetOwnerSecurityDescriptor( Descriptor, FredSid, FALSE );
+    RtlSetGroupSecurityDescriptor( Descriptor, FlintstoneSid, FALSE );
+
+    if (!TestSeAccessRateRun( "Same descriptor...                     ", Token, Descriptor, NULL )) {
+        CompletionStatus = FALSE;
+    }
+
+    if (!TestSeAccessRateRun( "Changing descriptor...                 ", Token, Descriptor, FirstAce )) {
+        CompletionStatus = FALSE;
+    }
+
+    NtClose( Token );
+
+    return CompletionStatus;
+}
+
 BOOLEAN
 TSeAcc()
 {
@@ -905,6 +1041,10 @@ TSeAcc()
     if (!TestSeAccess()) {
         Result = FALSE;
     }
+    DbgPrint("Se:   Access Check Rate Test...                            Suite\n");
+    if (!TestSeAccessRate()) {
+        Result = FALSE;
+    }
 
     DbgPrint("\n");
     DbgPrint("\n");
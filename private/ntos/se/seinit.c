@@ -145,6 +145,13 @@ Return Value:
         return FALSE;
     }
 
+
+    // Initialize the access check result cache.  The system runs without
+    // the cache if it can not be allocated.
+
+
+    SepAccessCacheInitialization();
+
 //    //
 //    // Initialize auditing structures
 //    //
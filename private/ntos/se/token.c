@@ -39,6 +39,9 @@ Revision History:
 #pragma alloc_text(PAGE,SeSubProcessToken)
 #pragma alloc_text(PAGE,NtCreateToken)
 #pragma alloc_text(PAGE,SepTokenDeleteMethod)
+#pragma alloc_text(PAGE,SepHashSid)
+#pragma alloc_text(PAGE,SepBuildSidIndex)
+#pragma alloc_text(PAGE,SepSidIndexLookup)
 #pragma alloc_text(PAGE,SepIdAssignableAsOwner)
 #pragma alloc_text(PAGE,SeIsChildToken)
 #pragma alloc_text(PAGE,SeIsChildTokenByPointer)
@@ -1827,10 +1830,212 @@ Return Value:
         ExFreePool( (((TOKEN *)Token)->AuditData) );
     }
 
+    if (ARGUMENT_PRESENT(((TOKEN *)Token)->SidIndex )) {
+        ExFreePool( (((TOKEN *)Token)->SidIndex) );
+    }
+
 
     return;
 }
 
+ULONG
+SepHashSid(
+    IN PSID Sid
+    )
+
+/*++
+
+Routine Description:
+
+    Computes the hash of a SID used by the SID index of a token.  The
+    relative id at the end of the SID is what tells most groups of a
+    domain apart, so every subauthority goes into the hash.
+
+Arguments:
+
+    Sid - Points to the SID to hash.
+
+Return Value:
+
+    The hash of the SID.
+
+--*/
+
+{
+    PISID ISid = (PISID)Sid;
+    ULONG Hash;
+    ULONG i;
+
+    PAGED_CODE();
+
+    Hash = ISid->IdentifierAuthority.Value[5] + (ISid->SubAuthorityCount << 8);
+
+    for (i = 0; i < ISid->SubAuthorityCount; i += 1) {
+        Hash = (Hash * 37) + ISid->SubAuthority[i];
+    }
+
+    return Hash;
+}
+
+
+VOID
+SepBuildSidIndex(
+    IN PTOKEN Token
+    )
+
+/*++
+
+Routine Description:
+
+    Builds the SID index of a token with a large number of users and
+    groups, so that SepSidInToken finds a SID with a binary search
+    rather than comparing it with every SID in the token.  This is
+    done once the UserAndGroups array of a new token is final.
+
+    If the index can not be allocated the token is simply left without
+    one and is scanned as before.
+
+Arguments:
+
+    Token - Points to the token, which has no index yet.
+
+Return Value:
+
+    None.
+
+--*/
+
+{
+    PSEP_SID_INDEX SidIndex;
+    SEP_SID_INDEX_ENTRY Entry;
+    ULONG Count;
+    ULONG Gap;
+    ULONG i;
+    ULONG j;
+
+    PAGED_CODE();
+
+    ASSERT( Token->SidIndex == NULL );
+
+    Count = Token->UserAndGroupCount;
+
+    if (Count < SEP_SID_INDEX_THRESHOLD) {
+        return;
+    }
+
+    SidIndex = ExAllocatePoolWithTag( PagedPool,
+                                      FIELD_OFFSET( SEP_SID_INDEX, Entries ) + Count * sizeof( SEP_SID_INDEX_ENTRY ),
+                                      'xIeS' );
+
+    if (SidIndex == NULL) {
+        return;
+    }
+
+    SidIndex->Count = Count;
+
+    for (i = 0; i < Count; i += 1) {
+        SidIndex->Entries[i].Hash = SepHashSid( Token->UserAndGroups[i].Sid );
+        SidIndex->Entries[i].Index = i;
+    }
+
+
+    // Shell sort by hash and then by position in the array, so that of
+    // two identical SIDs the one that comes first in the token is found
+    // first.
+
+
+    for (Gap = Count / 2; Gap > 0; Gap /= 2) {
+        for (i = Gap; i < Count; i += 1) {
+            Entry = SidIndex->Entries[i];
+            for (j = i; j >= Gap; j -= Gap) {
+                if ((SidIndex->Entries[j - Gap].Hash < Entry.Hash) ||
+                    ((SidIndex->Entries[j - Gap].Hash == Entry.Hash) && (SidIndex->Entries[j - Gap].Index < Entry.Index))) {
+                    break;
+                }
+                SidIndex->Entries[j] = SidIndex->Entries[j - Gap];
+            }
+            SidIndex->Entries[j] = Entry;
+        }
+    }
+
+    Token->SidIndex = SidIndex;
+}
+
+
+ULONG
+SepSidIndexLookup(
+    IN PTOKEN Token,
+    IN PSID Sid
+    )
+
+/*++
+
+Routine Description:
+
+    Finds a SID in the UserAndGroups array of a token through the SID
+    index of the token.
+
+Arguments:
+
+    Token - Points to the token, which must have a SID index.
+
+    Sid - Points to the SID to find.
+
+Return Value:
+
+    The index in the UserAndGroups array of the first entry with the
+    SID, or UserAndGroupCount if the SID is not in the token.
+
+--*/
+
+{
+    PSEP_SID_INDEX SidIndex = Token->SidIndex;
+    ULONG SidLength;
+    ULONG Hash;
+    ULONG Low;
+    ULONG High;
+    ULONG Middle;
+    PISID MatchSid;
+
+    PAGED_CODE();
+
+    SidLength = 8 + (4 * ((PISID)Sid)->SubAuthorityCount);
+    Hash = SepHashSid( Sid );
+
+
+    // Find the first entry with the hash of the SID.
+
+
+    Low = 0;
+    High = SidIndex->Count;
+
+    while (Low < High) {
+        Middle = (Low + High) / 2;
+        if (SidIndex->Entries[Middle].Hash < Hash) {
+            Low = Middle + 1;
+        } else {
+            High = Middle;
+        }
+    }
+
+
+    // Entries with the same hash are in the order of the array, so the
+    // first one with an equal SID is the one a scan would have found.
+
+
+    for (; (Low < SidIndex->Count) && (SidIndex->Entries[Low].Hash == Hash); Low += 1) {
+        MatchSid = (PISID)Token->UserAndGroups[SidIndex->Entries[Low].Index].Sid;
+
+        if ((((PISID)Sid)->Revision == MatchSid->Revision) &&
+            (SidLength == (8 + (4 * (ULONG)MatchSid->SubAuthorityCount))) &&
+            RtlEqualMemory( Sid, MatchSid, SidLength )) {
+            return SidIndex->Entries[Low].Index;
+        }
+    }
+
+    return Token->UserAndGroupCount;
+}
+
 NTSTATUS
 SepCreateToken(
     OUT PHANDLE TokenHandle,
@@ -2216,6 +2421,7 @@ Return Value:
     Token->ProxyData = NULL;
     Token->AuditData = NULL;
     Token->DynamicPart = NULL;
+    Token->SidIndex = NULL;
 
     if (ARGUMENT_PRESENT( ProxyData )) {
 
@@ -2324,6 +2530,8 @@ Return Value:
     Token->RestrictedSids = NULL;
     Token->RestrictedSidCount = 0;
 
+    SepBuildSidIndex( Token );
+
 
 
     //  Dynamic part initialization
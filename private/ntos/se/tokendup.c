@@ -537,6 +537,7 @@ Return Value:
     NewToken->TokenFlags = ExistingToken->TokenFlags;
     NewToken->ProxyData = NewProxyData;
     NewToken->AuditData = NewAuditData;
+    NewToken->SidIndex = NULL;
     NewToken->SessionId = ExistingToken->SessionId;
 
     // The following fields differ in the new token.
@@ -631,6 +632,8 @@ Return Value:
         SepMakeTokenEffectiveOnly( NewToken );
     }
 
+    SepBuildSidIndex( NewToken );
+
 
 #ifdef TOKEN_DEBUG
 
@@ -1985,6 +1988,7 @@ Return Value:
     NewToken->TokenFlags = ExistingToken->TokenFlags;
     NewToken->ProxyData = NewProxyData;
     NewToken->AuditData = NewAuditData;
+    NewToken->SidIndex = NULL;
 
 
 
@@ -2188,6 +2192,8 @@ Return Value:
         PrivilegesToDelete
         );
 
+    SepBuildSidIndex( NewToken );
+
 #ifdef TOKEN_DEBUG
 // Debug
     DbgPrint("\n");
@@ -252,6 +252,7 @@ typedef struct _TOKEN {
 
     PSECURITY_TOKEN_PROXY_DATA ProxyData;               // Ro: 4-Bytes
     PSECURITY_TOKEN_AUDIT_DATA AuditData;               // Ro: 4-Bytes
+    struct _SEP_SID_INDEX *SidIndex;                    // Ro: 4-Bytes
 
 
     // This marks the beginning of the variable part of the token.
@@ -344,10 +345,35 @@ typedef struct _TOKEN {
 
 //        NOTE:  Access to this field is guarded by the global
 //               PROCESS SECURITY FIELDS LOCK.
+
+//    SidIndex - Optionally points to a copy of the SIDs of the UserAndGroups
+//        array sorted by hash, which SepSidInToken searches instead of
+//        scanning the array.  It is only built for tokens with at least
+//        SEP_SID_INDEX_THRESHOLD users and groups.  The SIDs of a token
+//        never change once it is built, only their attributes, so the
+//        index needs no lock.
+
 //    VariablePart - Is the beginning of the variable part of the token.
 
 
 
+// Hashed index of the users and groups of a token.  The entries are sorted
+// by Hash and then by Index, so the first entry found for a SID is the one
+// that a scan of the UserAndGroups array would have found.
+
+#define SEP_SID_INDEX_THRESHOLD 16
+
+typedef struct _SEP_SID_INDEX_ENTRY {
+    ULONG Hash;
+    ULONG Index;
+} SEP_SID_INDEX_ENTRY, *PSEP_SID_INDEX_ENTRY;
+
+typedef struct _SEP_SID_INDEX {
+    ULONG Count;
+    SEP_SID_INDEX_ENTRY Entries[ANYSIZE_ARRAY];
+} SEP_SID_INDEX, *PSEP_SID_INDEX;
+
+
 // Internal version of Object Type list
 
 typedef struct _IOBJECT_TYPE_LIST {
@@ -570,6 +596,22 @@ SepMakeTokenEffectiveOnly(
     IN PTOKEN Token
     );
 
+ULONG
+SepHashSid(
+    IN PSID Sid
+    );
+
+VOID
+SepBuildSidIndex(
+    IN PTOKEN Token
+    );
+
+ULONG
+SepSidIndexLookup(
+    IN PTOKEN Token,
+    IN PSID Sid
+    );
+
 BOOLEAN
 SepTokenInitialization( VOID );
 
@@ -621,6 +663,9 @@ SepObjectInTypeList (
     OUT PULONG ReturnedIndex
     );
 
+VOID
+SepAccessCacheInitialization( VOID );
+
 #ifdef TOKEN_DEBUG
 VOID SepDumpToken(IN PTOKEN T);
 #endif //TOKEN_DEBUG
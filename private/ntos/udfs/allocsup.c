@@ -111,6 +111,8 @@ Return Value:
     LARGE_INTEGER LocalPsn;
     LARGE_INTEGER LocalSectorCount;
 
+    ULONG RunOffset;
+
     PAGED_CODE();
 
 
@@ -128,6 +130,32 @@ Return Value:
 
     Vcb = Fcb->Vcb;
 
+
+    //  A regular stream is usually read through a run in several transfers, so
+    //  check whether this offset lies in the last run we looked up.
+
+
+    if (!FlagOn( Fcb->FcbState, FCB_STATE_VMCB_MAPPING )) {
+
+        UdfLockFcb( IrpContext, Fcb );
+
+        if (FileOffset >= Fcb->CachedRunOffset &&
+            FileOffset < Fcb->CachedRunOffset + Fcb->CachedRunByteCount) {
+
+            RunOffset = (ULONG) (FileOffset - Fcb->CachedRunOffset);
+
+            Recorded = Fcb->CachedRunRecorded;
+            *DiskOffset = (Recorded ? Fcb->CachedRunDiskOffset + RunOffset : 0);
+            *ByteCount = Fcb->CachedRunByteCount - RunOffset;
+
+            UdfUnlockFcb( IrpContext, Fcb );
+
+            return Recorded;
+        }
+
+        UdfUnlockFcb( IrpContext, Fcb );
+    }
+
     LocalPsn.QuadPart = LocalSectorCount.QuadPart = 0;
 
 
@@ -301,6 +329,24 @@ Return Value:
 
     *ByteCount -= SectorOffset( Vcb, FileOffset );
 
+
+    //  Remember this run, from the start of the sector, for the next lookup.
+
+
+    if (!FlagOn( Fcb->FcbState, FCB_STATE_VMCB_MAPPING )) {
+
+        RunOffset = SectorOffset( Vcb, FileOffset );
+
+        UdfLockFcb( IrpContext, Fcb );
+
+        Fcb->CachedRunOffset = FileOffset - RunOffset;
+        Fcb->CachedRunDiskOffset = *DiskOffset - RunOffset;
+        Fcb->CachedRunByteCount = *ByteCount + RunOffset;
+        Fcb->CachedRunRecorded = Recorded;
+
+        UdfUnlockFcb( IrpContext, Fcb );
+    }
+
     return Recorded;
 }
 
@@ -374,6 +374,19 @@ Return Value:
     ASSERT_IRP_CONTEXT( IrpContext );
 
 
+    //  Walks of the metadata often come back to the extent which is already
+    //  mapped.  The media is read only, so simply keep the existing mapping.
+
+
+    if (View->Bcb != NULL &&
+        View->Partition == Partition &&
+        View->Lbn == Lbn &&
+        View->Length == Length) {
+
+        return;
+    }
+
+
     //  Remove any existing mapping
 
 
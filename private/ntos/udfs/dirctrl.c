@@ -1179,6 +1179,17 @@ Return Value:
             Ccb->SearchExpression = SearchExpression;
 
 
+            //  Names are already upcased for a case-insensitive search by the
+            //  time they are compared, so the expression is compiled for a
+            //  case sensitive match.
+
+
+            FsRtlCompileNameExpression( &Ccb->SearchExpression,
+                                        FALSE,
+                                        NULL,
+                                        &Ccb->CompiledExpression );
+
+
             //  Set the appropriate flags in the Ccb.
 
 
@@ -1600,7 +1611,7 @@ Return Value:
 
             if (UdfIsNameInExpression( IrpContext,
                                        &DirContext->CaseObjectName,
-                                       &Ccb->SearchExpression,
+                                       &Ccb->CompiledExpression,
                                        BooleanFlagOn( Ccb->Flags, CCB_FLAG_ENUM_NAME_EXP_HAS_WILD ))) {
 
 
@@ -1646,7 +1657,7 @@ Return Value:
 
                 if (UdfIsNameInExpression( IrpContext,
                                            &DirContext->ShortObjectName,
-                                           &Ccb->SearchExpression,
+                                           &Ccb->CompiledExpression,
                                            BooleanFlagOn( Ccb->Flags, CCB_FLAG_ENUM_NAME_EXP_HAS_WILD ))) {
 
 
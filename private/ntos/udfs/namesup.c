@@ -1203,7 +1203,7 @@ BOOLEAN
 UdfIsNameInExpression (
     IN PIRP_CONTEXT IrpContext,
     IN PUNICODE_STRING CurrentName,
-    IN PUNICODE_STRING SearchExpression,
+    IN PFSRTL_NAME_EXPRESSION SearchExpression,
     IN BOOLEAN Wild
     )
 
@@ -1218,7 +1218,7 @@ Arguments:
 
     CurrentName - Filename from the disk.
 
-    SearchExpression - Filename expression to use for match.
+    SearchExpression - Compiled filename expression to use for match.
 
     Wild - True if wildcards are present in SearchExpression.
 
@@ -1246,10 +1246,8 @@ Return Value:
 
     if (Wild) {
 
-        Match = FsRtlIsNameInExpression( SearchExpression,
-                                         CurrentName,
-                                         FALSE,
-                                         NULL );
+        Match = FsRtlIsNameInCompiledExpression( SearchExpression,
+                                                 CurrentName );
 
 
     //  Otherwise do a direct memory comparison for the name string.
@@ -1257,9 +1255,9 @@ Return Value:
 
     } else {
 
-        if ((CurrentName->Length != SearchExpression->Length) ||
+        if ((CurrentName->Length != SearchExpression->Expression.Length) ||
             (!RtlEqualMemory( CurrentName->Buffer,
-                              SearchExpression->Buffer,
+                              SearchExpression->Expression.Buffer,
                               CurrentName->Length ))) {
 
             Match = FALSE;
@@ -59,6 +59,14 @@ Revision History:
 
 #define READ_AHEAD_GRANULARITY           (0x10000)
 
+
+//  Read ahead amount used for files opened for sequential access.  Optical
+//  media seeks slowly, so a stream being read straight through is better
+//  served by fewer and larger reads.
+
+
+#define SEQUENTIAL_READ_AHEAD_GRANULARITY   (0x40000)
+
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text(PAGE, UdfCommonRead)
 #endif
@@ -470,7 +478,10 @@ Return Value:
                                   &UdfData.CacheManagerCallbacks,
                                   Fcb );
 
-            CcSetReadAheadGranularity( IrpSp->FileObject, READ_AHEAD_GRANULARITY );
+            CcSetReadAheadGranularity( IrpSp->FileObject,
+                                       (FlagOn( IrpSp->FileObject->Flags, FO_SEQUENTIAL_ONLY ) ?
+                                        SEQUENTIAL_READ_AHEAD_GRANULARITY :
+                                        READ_AHEAD_GRANULARITY) );
         }
 
 
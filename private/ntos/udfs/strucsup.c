@@ -93,6 +93,7 @@ INLINE VOID UdfInitializeFcbMcb (IN PFCB Fcb)
 
     if (FlagOn( Fcb->FcbState, FCB_STATE_MCB_INITIALIZED )) {
         FsRtlResetLargeMcb( &Fcb->Mcb, TRUE );
+        Fcb->CachedRunByteCount = 0;
     } else {
         FsRtlInitializeLargeMcb( &Fcb->Mcb, UdfPagedPool );
         SetFlag( Fcb->FcbState, FCB_STATE_MCB_INITIALIZED );
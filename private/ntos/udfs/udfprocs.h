@@ -926,7 +926,7 @@ BOOLEAN
 UdfIsNameInExpression (
     IN PIRP_CONTEXT IrpContext,
     IN PUNICODE_STRING CurrentName,
-    IN PUNICODE_STRING SearchExpression,
+    IN PFSRTL_NAME_EXPRESSION SearchExpression,
     IN BOOLEAN Wild
     );
 
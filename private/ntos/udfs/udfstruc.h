@@ -1021,6 +1021,19 @@ typedef struct _FCB {
     };
 
 
+    //  The last run returned by UdfLookupAllocation for a stream mapped by the
+    //  Mcb, after sparing and method 2 fixups.  A large read is broken into
+    //  transfers which mostly fall in the same run, and these are mapped from
+    //  here without going back to the Mcb and the sparing table.  The run is
+    //  empty if the byte count is zero.  Synchronized with the FcbMutex.
+
+
+    LONGLONG CachedRunOffset;
+    LONGLONG CachedRunDiskOffset;
+    ULONG CachedRunByteCount;
+    BOOLEAN CachedRunRecorded;
+
+
     //  This is the nonpaged data for the Fcb
 
 
@@ -1119,6 +1132,13 @@ typedef struct _CCB {
     UNICODE_STRING SearchExpression;
 
 
+    //  The search expression compiled for matching against each name in the
+    //  directory.  It refers to the buffer of the search expression above.
+
+
+    FSRTL_NAME_EXPRESSION CompiledExpression;
+
+
     //  Highest ULONG-representable FileIndex so far found in the directory stream.
     //  This corresponds to the highest FileIndex returnable in a query structure.
 
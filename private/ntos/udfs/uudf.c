@@ -0,0 +1,164 @@
+/*++
+Copyright (c) 1989  Microsoft Corporation
+
+Module Name:
+    uudf.c
+
+Abstract:
+    UDF streaming benchmark.  Reads a large file on a UDF volume, such as
+    a video file on a DVD or on a mounted disc image, and reports the
+    throughput of
+
+        cached reads in order through a handle opened for sequential
+        access, which are driven by the cache manager's read ahead
+
+        noncached reads in order, each of which maps its transfer through
+        the allocation of the file
+
+        noncached reads at random offsets
+
+    Each noncached transfer is broken up at every extent of the file and
+    at every spared or relocated sector, so heavily fragmented files and
+    discs with sparing tables show the cost of the lookups.
+
+    usage: uudf file [transfer [seconds]]
+
+Environment:
+    User Mode
+--*/
+
+#include <nt.h>
+#include <ntrtl.h>
+#include <nturtl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ubench.c"     // Common benchmark routines
+
+#define BENCH_MAX_TRANSFER  (1024 * 1024)
+
+UNICODE_STRING BenchName;
+PVOID Buffer;
+
+
+VOID RunReads(IN PCHAR Title, IN ULONG Options, IN BOOLEAN Random, IN ULONG Transfer, IN ULONG Seconds)
+{
+    OBJECT_ATTRIBUTES ObjectAttributes;
+    IO_STATUS_BLOCK IoStatus;
+    FILE_STANDARD_INFORMATION StandardInformation;
+    LARGE_INTEGER Offset;
+    LARGE_INTEGER Start, End, Frequency;
+    HANDLE Thread;
+    HANDLE File;
+    ULONGLONG Transfers;
+    ULONGLONG Bytes;
+    ULONGLONG Elapsed;
+    ULONG Seed;
+    NTSTATUS Status;
+
+    InitializeObjectAttributes(&ObjectAttributes, &BenchName, OBJ_CASE_INSENSITIVE, NULL, NULL);
+    Status = NtOpenFile(&File, FILE_READ_DATA | SYNCHRONIZE, &ObjectAttributes, &IoStatus, FILE_SHARE_READ, FILE_SYNCHRONOUS_IO_NONALERT | FILE_NON_DIRECTORY_FILE | Options);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to open %wZ (%X)\n", &BenchName, Status);
+        return;
+    }
+
+    Status = NtQueryInformationFile(File, &IoStatus, &StandardInformation, sizeof(StandardInformation), FileStandardInformation);
+    if (!NT_SUCCESS(Status) || (StandardInformation.EndOfFile.QuadPart < Transfer))
+    {
+        printf("%wZ is smaller than one transfer\n", &BenchName);
+        NtClose(File);
+        return;
+    }
+
+    if (!BenchStartTimer(Seconds, &Thread))
+    {
+        NtClose(File);
+        return;
+    }
+
+    Transfers = 0;
+    Bytes = 0;
+    Seed = 1;
+    Offset.QuadPart = 0;
+    NtQueryPerformanceCounter(&Start, &Frequency);
+
+    while (!StopBenchmark)
+    {
+        if (Random)
+        {
+            //  Pick a transfer sized block anywhere in the file
+
+            Offset.QuadPart = (((ULONGLONG)RtlRandom(&Seed) << 31 | RtlRandom(&Seed)) % (StandardInformation.EndOfFile.QuadPart / Transfer)) * Transfer;
+        }
+        else if (Offset.QuadPart + Transfer > StandardInformation.EndOfFile.QuadPart)
+        {
+            Offset.QuadPart = 0;
+        }
+
+        Status = NtReadFile(File, NULL, NULL, NULL, &IoStatus, Buffer, Transfer, &Offset, NULL);
+        if (!NT_SUCCESS(Status))
+        {
+            printf("Read at %I64x failed (%X)\n", Offset.QuadPart, Status);
+            break;
+        }
+
+        Offset.QuadPart += Transfer;
+        Bytes += IoStatus.Information;
+        Transfers += 1;
+    }
+
+    NtQueryPerformanceCounter(&End, NULL);
+    BenchWaitTimer(Thread);
+    NtClose(File);
+
+    Elapsed = ((End.QuadPart - Start.QuadPart) * 1000000) / Frequency.QuadPart;
+    printf("%-18s %7u bytes  %10I64u reads  %8I64u KB/sec  %8I64u us/read\n",
+           Title, Transfer, Transfers, ((Bytes * 1000000) / (Elapsed ? Elapsed : 1)) / 1024, Transfers ? Elapsed / Transfers : 0);
+}
+
+
+main(int argc, char **argv)
+{
+    ANSI_STRING AnsiName;
+    UNICODE_STRING DosName;
+    SIZE_T BufferSize;
+    ULONG Transfer;
+    ULONG Seconds;
+    NTSTATUS Status;
+
+    Transfer = BenchArgument(argc, argv, 2, 64 * 1024);
+    Seconds = BenchArgument(argc, argv, 3, 10);
+
+    //  Noncached transfers must be whole sectors
+
+    if ((argc < 2) || (Transfer == 0) || (Transfer % 2048) || (Transfer > BENCH_MAX_TRANSFER) || (Seconds == 0))
+    {
+        printf("usage: uudf file [transfer (multiple of 2048 up to %u) [seconds]]\n", BENCH_MAX_TRANSFER);
+        return 1;
+    }
+
+    RtlInitAnsiString(&AnsiName, argv[1]);
+    RtlAnsiStringToUnicodeString(&DosName, &AnsiName, TRUE);
+    if (!RtlDosPathNameToNtPathName_U(DosName.Buffer, &BenchName, NULL, NULL))
+    {
+        printf("Invalid file name %s\n", argv[1]);
+        return 1;
+    }
+
+    Buffer = NULL;
+    BufferSize = BENCH_MAX_TRANSFER;
+    Status = NtAllocateVirtualMemory(NtCurrentProcess(), &Buffer, 0, &BufferSize, MEM_COMMIT, PAGE_READWRITE);
+    if (!NT_SUCCESS(Status))
+    {
+        printf("Unable to allocate the buffer (%X)\n", Status);
+        return 1;
+    }
+
+    RunReads("cached sequential", FILE_SEQUENTIAL_ONLY, FALSE, Transfer, Seconds);
+    RunReads("noncached in order", FILE_NO_INTERMEDIATE_BUFFERING, FALSE, Transfer, Seconds);
+    RunReads("noncached random", FILE_NO_INTERMEDIATE_BUFFERING, TRUE, Transfer, Seconds);
+
+    return 0;
+}